@@ -22,6 +22,7 @@
 #include "app_azure_rtos.h"
 /* Private includes ----------------------------------------------------------*/
 /* USER CODE BEGIN Includes */
+#include "boot.h"
 
 /* USER CODE END Includes */
 
@@ -150,6 +151,7 @@ VOID tx_application_define(VOID *first_unused_memory)
       /* USER CODE END  MX_FileX_Init_Error */
     }
     /* USER CODE BEGIN  MX_FileX_Init_Success */
+    boot_mark("filex");
 
     /* USER CODE END  MX_FileX_Init_Success */
   }
@@ -176,6 +178,7 @@ VOID tx_application_define(VOID *first_unused_memory)
       /* USER CODE END  MX_NetXDuo_Init_Error */
     }
     /* USER CODE BEGIN  MX_NetXDuo_Init_Success */
+    boot_mark("netx");
 
     /* USER CODE END MX_NetXDuo_Init_Success */
 
@@ -204,6 +207,7 @@ VOID tx_application_define(VOID *first_unused_memory)
       /* USER CODE END  MX_USBX_Init_Error */
     }
     /* USER CODE BEGIN  MX_USBX_Init_Success */
+    boot_mark("usbx");
 
     /* USER CODE END  MX_USBX_Init_Success */
   }
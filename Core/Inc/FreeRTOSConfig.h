@@ -43,7 +43,12 @@
 #define configTICK_RATE_HZ                         (1000u)
 #define configMAX_PRIORITIES                       (32u)
 #define configMINIMAL_STACK_SIZE                   (512u)
+#if RTOS_STATIC_ALLOCATION
+/* Nothing creates FreeRTOS objects, the application uses CMSIS-RTOS2 with static memory (rtos_static.h) */
+#define configTOTAL_HEAP_SIZE                      (1024u * 4u)
+#else
 #define configTOTAL_HEAP_SIZE                      (1024u * 128u)
+#endif
 /* #define configMAX_TASK_NAME_LEN                  (16) */
 /* #define configUSE_TRACE_FACILITY                 0 */
 #define configUSE_16_BIT_TICKS                      0
@@ -1,16 +1,116 @@
+#ifndef SUSI_H
+#define SUSI_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/* SUSI master engine: packets are sent by SPI5 DMA, the clock idles between the
+ * bytes of a packet for byte_idle SPI clock periods (SPI MIDI) and between
+ * packets for gap_us (TIM7 one-pulse). Packets come from a queue fed by RPC and,
+ * with mirroring, from the function groups of the DCC packets the command
+ * station sends to one address, which take priority over the queue. */
+#define SUSI_MASTER_QUEUE_SIZE          64u     // packets, power of two
+#define SUSI_MASTER_DEFAULT_GAP_US      500u
+#define SUSI_MASTER_MAX_GAP_US          65535u  // TIM7 is 16 bit, 1 us ticks
+#define SUSI_MASTER_ACK_GAP_US          2000u   // after CV packets, the slave acknowledges by holding data low for 1-2 ms
+#define SUSI_MASTER_SYNC_US             ((PACKET_TIMEOUT_MS + 1u) * 1000u)  // idle clock before the first packet
+#define SUSI_MASTER_DEFAULT_BYTE_IDLE   0u
+#define SUSI_MASTER_MAX_BYTE_IDLE       15u     // SPI clock periods
+#define SUSI_MASTER_TIM_PRIORITY        8u      // same as SPI5, the two never preempt each other
+#define SUSI_FG_COUNT                   9u      // function groups FG1-FG9, F0-F68
+
+typedef struct {
+  uint8_t bytes[3];
+  uint8_t length;             // 2, or 3 for extended packets (0x70-0x7F)
+} SusiPacket_t;
+
+typedef struct {
+  bool running;
+  uint32_t gap_us;
+  uint8_t byte_idle;
+  uint16_t mirror_address;    // DCC address mirrored, 0 = off
+  uint32_t queued;            // packets waiting
+  uint32_t capacity;
+  uint32_t high_water;        // highest fill level since start
+  uint32_t sent;              // packets sent since start
+  uint32_t mirrored;          // of these, function groups mirrored from DCC
+  uint32_t errors;            // SPI or DMA errors
+} SusiMasterStats_t;
+
 void SUSI_Master_Init(SPI_HandleTypeDef *hspi);
-void SUSI_Master_Start(void);
-void SUSI_Master_Stop(void);
+void SUSI_Master_Start(void);   // defaults, no mirroring
+void SUSI_Master_Stop(void);    // clears the queue
+
+/**
+ * @brief Start the master engine, restarts it with the new timing if running
+ * @param gap_us Idle clock between packets, 1-SUSI_MASTER_MAX_GAP_US
+ * @param byte_idle Idle clock periods between the bytes of a packet, 0-SUSI_MASTER_MAX_BYTE_IDLE
+ * @param mirror_address DCC address whose function groups are forwarded, 0 = none
+ * @return false for invalid parameters or if SPI/DMA setup failed
+ */
+bool SUSI_Master_StartEx(uint32_t gap_us, uint8_t byte_idle, uint16_t mirror_address);
+
+/**
+ * @brief Queue packets, all or none (thread context)
+ * @return false if they do not fit or one has the wrong length for its command
+ */
+bool SUSI_Master_Queue(const SusiPacket_t *packets, uint32_t count);
+
+void SUSI_Master_GetStats(SusiMasterStats_t *stats);
+
+/* Length of a packet starting with command byte */
+uint8_t SUSI_PacketLength(uint8_t command);
+
+void SUSI_M_SPI_TxCpltCallback(SPI_HandleTypeDef *hspi);
+void SUSI_M_SPI_ErrorCallback(SPI_HandleTypeDef *hspi);
+
+/* SUSI slave receiver: SPI2 receives by circular DMA without per packet
+ * re-initialisation, TIM16 frames the bytes every poll period and queues
+ * them with the poll time. After PACKET_TIMEOUT_MS without a byte an
+ * incomplete packet is dropped and the SPI bit counter reset. */
+#define SUSI_SLAVE_FRAMES               256u    // frame ring, power of two
+#define SUSI_SLAVE_POLL_US              250u    // timestamp resolution, about two bytes at the fastest clock
+#define SUSI_SLAVE_TIM_PRIORITY         8u      // same as the SUSI master
+
+typedef struct {
+  uint32_t time_us;           // poll time after the last byte, since start, wraps after 71 minutes
+  uint8_t bytes[3];
+  uint8_t length;             // 2, or 3 for extended packets (0x70-0x7F)
+} SusiFrame_t;
+
+typedef struct {
+  bool running;
+  uint32_t time_us;           // current poll time
+  uint32_t frames;            // packets received since start
+  uint32_t bytes;
+  uint32_t resyncs;           // incomplete packets dropped at an inter byte timeout
+  uint32_t overflows;         // frames lost to a full ring
+  uint32_t errors;            // SPI overruns
+  uint32_t pending;           // frames waiting to be read
+  uint32_t capacity;
+  uint8_t function_groups[SUSI_FG_COUNT];   // last FG1-FG9 data received
+} SusiSlaveStats_t;
 
 void SUSI_Slave_Init(SPI_HandleTypeDef *hspi);
-void SUSI_Slave_Start(void);
-void SUSI_Slave_Stop(void);
 
-void SUSI_S_SPI_RxCpltCallback(SPI_HandleTypeDef *hspi);
+/**
+ * @brief Start receiving, restarts if running; clears the ring and the counters
+ * @return false if the DMA could not be set up
+ */
+bool SUSI_Slave_Start(void);
+void SUSI_Slave_Stop(void);     // received frames stay readable
+
+/**
+ * @brief Copy out and release up to max received frames (thread context, one reader)
+ * @return Number of frames copied
+ */
+uint32_t SUSI_Slave_Read(SusiFrame_t *frames, uint32_t max);
+
+void SUSI_Slave_GetStats(SusiSlaveStats_t *stats);
 
 
 /* SUSI commands */
@@ -61,8 +161,15 @@ void SUSI_S_SPI_RxCpltCallback(SPI_HandleTypeDef *hspi);
 #define EXTENDED_PACKET_PATTERN   0x70
 #define EXTENDED_PACKET_MASK      0xF0
 
+/* CV manipulation (extended packets), followed by the slave acknowledge */
+#define SUSI_CV_VERIFY_BYTE  (0x77)
+#define SUSI_CV_BIT          (0x7B)
+#define SUSI_CV_WRITE_BYTE   (0x7F)
+
 
 
 #ifdef __cplusplus
 }
 #endif
+
+#endif /* SUSI_H */
@@ -0,0 +1,152 @@
+/**
+ * @file accessory_sequence.h
+ * @brief On-device accessory switching sequences with output latency measurement
+ *
+ * A sequence switches every output address of a range on and off, pass after
+ * pass, from the command station thread (loop=0) through the scheduled
+ * transmit path, so the on and off times are exact to one bit time:
+ *   - basic accessory (RCN-213): 10AAAAAA 1AAACDDD, the output address is the
+ *     decoder address and the output pair (AAAAAAAAADD), D0 is "output",
+ *     on activates it (C=1), off deactivates it (C=0)
+ *   - extended accessory: 10AAAAAA 0AAA0AA1 XXXXXXXX, on sends aspect_on,
+ *     off aspect_off
+ * Each command is sent "packets" times back to back; on_ms is the time from
+ * the last on packet of an address to its first off packet, off_ms from the
+ * last off packet to the first on packet of the next address.
+ *
+ * With pins, address k of the range (0 based) answers on pins[k % count], an
+ * IO input armed for GPIO edge capture. The first transmission of a command
+ * on the track (end bit started, command station packet hook) opens a trial
+ * on its pin, the first edge on that pin closes it, and the delay goes to the
+ * on or off latency of the pin. A trial still open after timeout_ms, or when
+ * the next command for the pin goes out, counts as a timeout. Further edges
+ * until the next command, a pulsed output falling back or contact bounce,
+ * are only counted. The measurement needs interrupt
+ * driven transmit and replaces a capture started by gpio_capture_control;
+ * it cannot run next to a response latency test, which uses the same hooks.
+ */
+
+#ifndef ACCESSORY_SEQUENCE_H
+#define ACCESSORY_SEQUENCE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define ACCESSORY_SEQUENCE_ADDRESSES      2048u   // 11 bit output addresses
+#define ACCESSORY_SEQUENCE_MAX_PACKETS    16u     // transmissions of one command
+#define ACCESSORY_SEQUENCE_MAX_TIME_MS    60000u  // on_ms and off_ms
+#define ACCESSORY_SEQUENCE_MAX_TIMEOUT_MS 10000u  // well below the 17 s cycle counter wrap
+#define ACCESSORY_SEQUENCE_MAX_PINS       15u     // IO1-IO15
+#define ACCESSORY_SEQUENCE_MAX_PACKET     4u      // with checksum
+
+typedef enum {
+    ACCESSORY_SEQUENCE_BASIC = 0,
+    ACCESSORY_SEQUENCE_EXTENDED
+} AccessorySequenceType_t;
+
+typedef struct {
+    uint8_t type;               // AccessorySequenceType_t
+    uint8_t output;             // basic: D0, 0 or 1
+    uint8_t aspect_on;          // extended
+    uint8_t aspect_off;
+    uint16_t address_first;     // output address 0-2047
+    uint16_t address_count;     // 1-2048, the range must end at or below 2047
+    uint8_t packets;            // transmissions of each command, 1-ACCESSORY_SEQUENCE_MAX_PACKETS
+    uint32_t on_ms;
+    uint32_t off_ms;
+    uint32_t passes;            // over the range, 0 until stopped
+    uint32_t timeout_ms;        // response timeout with pins
+    uint8_t pin_count;          // 0: no measurement
+    uint8_t pins[ACCESSORY_SEQUENCE_MAX_PINS];  // IO numbers 1-15, no two on the same EXTI line
+} AccessorySequenceConfig_t;
+
+typedef struct {
+    uint32_t count;
+    uint64_t sum_us;
+    uint32_t min_us;            // UINT32_MAX without responses
+    uint32_t max_us;
+    uint32_t timeouts;
+} AccessorySequenceLatency_t;
+
+typedef struct {
+    AccessorySequenceLatency_t on;
+    AccessorySequenceLatency_t off;
+    uint32_t extra_edges;       // edges without an open trial
+} AccessorySequenceChannel_t;
+
+typedef struct {
+    AccessorySequenceConfig_t config;
+    bool running;
+    bool measuring;             // the hooks are armed
+    uint32_t pass;              // pass of the next command
+    uint16_t address;           // address of the next command
+    uint32_t commands;          // commands generated
+    uint32_t trials;            // commands seen on the track with a pin
+    AccessorySequenceChannel_t channel[ACCESSORY_SEQUENCE_MAX_PINS];
+} AccessorySequenceStatus_t;
+
+typedef struct {
+    uint8_t length;
+    uint8_t bytes[ACCESSORY_SEQUENCE_MAX_PACKET];
+    uint32_t gap_us;
+} AccessorySequencePacket_t;
+
+void AccessorySequence_Init(void);
+
+/**
+ * @brief Check and store the configuration of the next run, refused while one runs
+ * @param error Set to a static description on failure (may be NULL)
+ * @return 0 on success, -1 for an invalid configuration
+ */
+int AccessorySequence_Configure(const AccessorySequenceConfig_t *config, const char **error);
+
+/**
+ * @brief Arm the measurement and rewind the sequence, called when a run is requested
+ * @param conflicts Set to the pins which cannot be captured (may be NULL)
+ * @param error Set to a static description on failure (may be NULL)
+ * @return 0 on success, -1 on failure
+ */
+int AccessorySequence_Prepare(uint16_t *conflicts, const char **error);
+
+/**
+ * @brief Command station thread: the next packet of the sequence
+ * @return false after the last pass
+ */
+bool AccessorySequence_Next(AccessorySequencePacket_t *packet);
+
+/**
+ * @brief Command station thread: a command is not on the track yet, or its trial still open
+ */
+bool AccessorySequence_Pending(void);
+
+/**
+ * @brief Command station thread: count the open trials as timeouts and disarm the measurement
+ */
+void AccessorySequence_Finish(void);
+
+/**
+ * @brief True while a run holds the edge and packet hooks
+ */
+bool AccessorySequence_Measuring(void);
+
+void AccessorySequence_GetStatus(AccessorySequenceStatus_t *status);
+
+/**
+ * @brief Run the configured sequence (command station must run with loop=0)
+ *
+ * Stopped with CommandStation_StopProgram, progress in CommandStation_GetProgramStatus.
+ * @param conflicts Set to the pins which cannot be captured (may be NULL)
+ * @param error Set to a static description on failure (may be NULL)
+ * @return true if started
+ */
+bool CommandStation_RunAccessorySequence(uint16_t *conflicts, const char **error);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ACCESSORY_SEQUENCE_H */
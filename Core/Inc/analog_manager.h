@@ -7,6 +7,10 @@
  * This module manages on-demand ADC readings with averaging for all allocated channels.
  * Supports ADC1 (channels 2,3,5,6) and ADC2 (channels 2,6).
  * All readings are performed on-demand with mutex protection for thread safety.
+ *
+ * With ANALOG_STREAM_ENABLE all channels are instead sampled continuously by
+ * timer triggered DMA and readings average the most recent samples in memory
+ * without blocking.
  */
 
 #ifndef ANALOG_MANAGER_H
@@ -16,15 +20,58 @@
 extern "C" {
 #endif
 
+#include <stdbool.h>
 #include <stdint.h>
 
 /* Number of samples to average for each channel */
 #define ADC_AVG_SAMPLES 4
 
-// 656mV per count (multiplier)
-#define VOLTAGE_FEEDBACK_SCALE_FACTOR_MV  (6.8f)
-// 0.5ma per count (divider)
-#define CURRENT_FEEDBACK_SCALE_FACTOR_MA  (2)
+/* Continuous mode window of analog_manager_get_value, the span of ADC_AVG_SAMPLES
+ * on-demand readings 1 ms apart */
+#define ANALOG_VALUE_WINDOW_MS      4u
+
+/* Continuous mode: scan rate, scans per averaged bucket and bucket history depth */
+#ifndef ANALOG_STREAM_ENABLE
+#define ANALOG_STREAM_ENABLE        1
+#endif
+#define ANALOG_STREAM_RATE_HZ       10000u
+#define ANALOG_STREAM_BUCKET_SCANS  10u     // 1 ms per bucket
+#define ANALOG_STREAM_HISTORY       1024u   // buckets, power of two
+#define ANALOG_RAW_HISTORY          4096u   // single track current samples, power of two (410 ms)
+#define ANALOG_SAMPLE_US            (1000000u / ANALOG_STREAM_RATE_HZ)
+
+/* Service mode ACK: current increase of at least 60 mA for 6 +/- 1 ms (NMRA S-9.2.3),
+ * required in this many consecutive 1 ms buckets */
+#define ANALOG_ACK_THRESHOLD_MA     60u
+#define ANALOG_ACK_MIN_MS           4u
+
+/* On-demand mode: each reading is one conversion averaged by the ADC oversampler
+ * (ratio and shift per channel) instead of ADC_AVG_SAMPLES conversions 1 ms apart */
+#ifndef ANALOG_OVERSAMPLING_ENABLE
+#define ANALOG_OVERSAMPLING_ENABLE  1
+#endif
+
+/* Feedback scale factors per count, unsigned fixed point with 16 fractional bits,
+ * so a conversion is one multiply and shift and no float math */
+#define ANALOG_VOLTAGE_MV_PER_COUNT_Q16   445645u   // 6.8 mV, ADC1 channel 6
+#define ANALOG_CURRENT_MA_PER_COUNT_Q16   32768u    // 0.5 mA, ADC2 channel 2
+
+static inline uint16_t analog_counts_to_mv(uint32_t counts)
+{
+    uint32_t const mv = (counts * ANALOG_VOLTAGE_MV_PER_COUNT_Q16 + 0x8000u) >> 16;
+    return (uint16_t)(mv < 0xFFFFu ? mv : 0xFFFFu);
+}
+
+static inline uint16_t analog_counts_to_ma(uint32_t counts)
+{
+    return (uint16_t)((counts * ANALOG_CURRENT_MA_PER_COUNT_Q16) >> 16);
+}
+
+// Threshold or step in counts, ma up to 65535
+static inline uint32_t analog_ma_to_counts(uint32_t ma)
+{
+    return ((ma << 16) + ANALOG_CURRENT_MA_PER_COUNT_Q16 / 2u) / ANALOG_CURRENT_MA_PER_COUNT_Q16;
+}
 
 /**
  * @brief Initialize the Analog Manager
@@ -41,6 +88,94 @@ int analog_manager_init(void);
  */
 int analog_manager_get_value(uint8_t adc_num, uint8_t channel, uint16_t *value);
 
+/**
+ * @brief Check whether continuous sampling is running
+ * @return true in continuous mode, false in on-demand mode
+ */
+bool analog_manager_is_streaming(void);
+
+/**
+ * @brief Average of the most recent window of a channel (continuous mode only, never blocks)
+ * @param adc_num ADC number (1 or 2)
+ * @param channel Channel number (2, 3, 5, or 6)
+ * @param window_ms Averaging window, clamped to the available history
+ * @param value Pointer to store the averaged value
+ * @return 0 on success, -1 on invalid parameters, in on-demand mode or before the first bucket
+ */
+int analog_manager_get_average(uint8_t adc_num, uint8_t channel, uint32_t window_ms, uint16_t *value);
+
+/**
+ * @brief Called in the ADC DMA interrupt for every bucket of the track current
+ * @param bucket Bucket number since start (1 ms each at the default rate, TIM3 paced)
+ * @param voltage_raw Latest track voltage bucket (ADC1 channel 6), counts
+ * @param current_raw Track current bucket (ADC2 channel 2), counts
+ */
+typedef void (*AnalogBucketHook)(uint32_t bucket, uint16_t voltage_raw, uint16_t current_raw);
+
+/* Bucket hook users, each has a slot of its own */
+typedef enum {
+    ANALOG_HOOK_TELEMETRY = 0,
+    ANALOG_HOOK_RECORDER,
+    ANALOG_HOOK_LATENCY,
+    ANALOG_HOOK_GUARD,
+    ANALOG_HOOK_CAPTURE,
+    ANALOG_HOOK_COUNT
+} AnalogHookSlot_t;
+
+/**
+ * @brief Install or remove (NULL) a bucket hook (continuous mode only)
+ */
+void analog_manager_set_bucket_hook(AnalogHookSlot_t slot, AnalogBucketHook hook);
+
+/**
+ * @brief Number of the track current sample being taken now (continuous mode only, ISR safe)
+ *
+ * Samples are numbered from the start of the stream, one per scan, from the
+ * position of the DMA in the buffer. Valid while the bucket interrupt is less
+ * than one bucket behind.
+ */
+uint32_t analog_manager_current_sample(void);
+
+/**
+ * @brief Copy single track current samples, counts (continuous mode only, ISR safe)
+ *
+ * The samples of a bucket are available once its bucket hooks have returned.
+ * @param first Sample number, see analog_manager_current_sample()
+ * @return count, or 0 if a sample is not taken yet or already overwritten
+ */
+uint32_t analog_manager_read_current_samples(uint32_t first, uint16_t *out, uint32_t count);
+
+/**
+ * @brief Set analog watchdog 1 of ADC2, which watches the track current (continuous mode only)
+ *
+ * The watchdog flags every conversion above high_raw, with enable its interrupt
+ * (ADC2_IRQn, see track_guard.c) is on. The threshold takes effect from the next
+ * conversion, sampling goes on.
+ * @param high_raw Threshold in counts
+ * @return 0 on success, -1 in on-demand mode
+ */
+int analog_manager_set_current_watchdog(uint16_t high_raw, bool enable);
+
+/**
+ * @brief Arm the ACK detector on the track current (continuous mode only, ISR safe)
+ *
+ * The baseline is the average current of the last 8 ms. The detector then looks for
+ * ANALOG_ACK_MIN_MS consecutive 1 ms buckets at least ANALOG_ACK_THRESHOLD_MA above it.
+ */
+void analog_ack_arm(void);
+
+/**
+ * @brief Stop looking for an ACK
+ */
+void analog_ack_disarm(void);
+
+/**
+ * @brief Check whether an ACK was seen since the detector was armed
+ * @param delay_ms Set to the time from arming to the start of the pulse (may be NULL)
+ * @return true if an ACK was detected
+ */
+bool analog_ack_detected(uint32_t *delay_ms);
+
 int get_voltage_feedback_mv(uint16_t *voltage_mv);
 int get_voltage_feedback_mv_averaged(uint16_t *voltage_mv, uint8_t num_samples, uint32_t sample_delay_ms);
 int get_current_feedback_ma(uint16_t *current_ma);
@@ -0,0 +1,74 @@
+/**
+ * @file aux_track.h
+ * @brief Second, independent DCC output on two IO header pins
+ *
+ * A transmitter of its own next to the command station: its own DCC library
+ * instance, packet queue and timing profile, driven by TIM5 (1 us ticks,
+ * interrupt priority 3, below the main track on TIM2). The P and N levels go
+ * to two IO pins as logic level signals for an external booster, IO13/IO14
+ * share a port and switch in the same bus cycle. The library sends idle
+ * packets whenever the queue is empty.
+ *
+ * The output has no current sensing, no BiDi cutout and no packet hooks;
+ * service mode stays on the main track, operations mode traffic can run
+ * here at the same time.
+ */
+
+#ifndef AUX_TRACK_H
+#define AUX_TRACK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define AUX_TRACK_DEFAULT_P_IO      13u
+#define AUX_TRACK_DEFAULT_N_IO      14u
+#define AUX_TRACK_MIN_PREAMBLE      14u
+#define AUX_TRACK_MAX_PREAMBLE      30u
+#define AUX_TRACK_TIM_PRIORITY      3u
+
+typedef struct {
+    uint8_t p_io;               // IO1-IO15
+    uint8_t n_io;
+    uint8_t profile;            // PacketTimingProfile_t, symmetric halves only
+    uint8_t preamble_bits;
+} AuxTrackConfig_t;
+
+typedef struct {
+    bool running;
+    AuxTrackConfig_t config;
+    uint16_t bit1_us;           // half-bit durations in use
+    uint16_t bit0_us;
+    uint32_t accepted;          // packets queued since start
+    uint32_t rejected;          // packets refused by a full queue
+    uint32_t transmitted;       // packets started on the output, idle packets included
+} AuxTrackStatus_t;
+
+/**
+ * @brief Configure the pins as outputs and start transmitting idle packets
+ * @return 0 on success, -1 for an invalid configuration, -2 if a pin cannot be
+ *         made an output (captured), -3 if already running
+ */
+int AuxTrack_Start(const AuxTrackConfig_t *config);
+
+/**
+ * @brief Stop the timer, both outputs low; queued packets are discarded at the next start
+ */
+void AuxTrack_Stop(void);
+
+/**
+ * @brief Queue one packet (bytes include the checksum), thread context
+ * @return false if not running, the length is invalid or the queue is full
+ */
+bool AuxTrack_Send(const uint8_t *bytes, uint8_t length);
+
+void AuxTrack_GetStatus(AuxTrackStatus_t *status);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* AUX_TRACK_H */
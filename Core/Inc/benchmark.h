@@ -0,0 +1,97 @@
+/**
+ * @file benchmark.h
+ * @brief On-target benchmarks of the hot paths
+ *
+ * Built with -DDCC_TESTER_BENCHMARK=ON (CMake preset "Benchmark"). A run is
+ * requested by the benchmark_run RPC or the "bench" console command and
+ * executed by the RPC thread between requests, results are read with
+ * benchmark_results or printed on the console. Every case is timed per call
+ * with the DWT cycle counter and interrupts enabled: min is the undisturbed
+ * cost, mean and max include preemption.
+ *
+ * Cases:
+ *   rpc      RpcServer::handle of each method without side effects
+ *   dcc      packet construction used by the command station thread
+ *   cs       CommandStation::transmit() (command station stopped)
+ *   decoder  Decoder::receive() per edge of idle packets (decoder stopped)
+ *   adc      voltage and current feedback reads
+ *   params   parameter save and restore (only when flash is requested,
+ *            saves unsaved parameter changes like parameters_save)
+ */
+
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define BENCHMARK_MAX_RESULTS           48u
+#define BENCHMARK_DEFAULT_ITERATIONS    100u
+#define BENCHMARK_MAX_ITERATIONS        10000u
+#define BENCHMARK_FLASH_ITERATIONS      10u     // at most, parameter save/restore
+#define BENCHMARK_CALLS_PER_ITERATION   16u     // transmit() and receive() calls
+
+typedef enum {
+    BENCHMARK_OK = 0,
+    BENCHMARK_SKIPPED,          // resource in use (command station or decoder running)
+    BENCHMARK_FAILED            // the call returned an error
+} BenchmarkStatus_t;
+
+typedef struct {
+    uint32_t runs;
+    uint32_t min_cycles;
+    uint32_t max_cycles;
+    uint64_t total_cycles;
+} BenchmarkStats_t;
+
+typedef struct {
+    const char *group;
+    const char *name;
+    uint8_t status;             // BenchmarkStatus_t
+    BenchmarkStats_t stats;
+} BenchmarkResult_t;
+
+void benchmark_stats_clear(BenchmarkStats_t *stats);
+void benchmark_stats_add(BenchmarkStats_t *stats, uint32_t cycles);
+
+/**
+ * @brief Request a run, executed by the RPC thread
+ * @param iterations Calls per case, 1-BENCHMARK_MAX_ITERATIONS
+ * @param flash Include parameter save/restore
+ * @return false if a run is already pending or in progress
+ */
+bool Benchmark_Request(uint32_t iterations, bool flash);
+
+/**
+ * @brief A run is pending or in progress
+ */
+bool Benchmark_Busy(void);
+
+/**
+ * @brief RPC thread: execute a requested run
+ */
+void Benchmark_Poll(void);
+
+/**
+ * @brief Results of the last run
+ * @param iterations Set to the calls per case of that run (may be NULL)
+ * @return Number of results
+ */
+uint32_t Benchmark_GetResults(const BenchmarkResult_t **results, uint32_t *iterations);
+
+/**
+ * @brief Print the results of the last run on the console
+ */
+void Benchmark_Print(void);
+
+const char *Benchmark_StatusName(uint8_t status);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BENCHMARK_H */
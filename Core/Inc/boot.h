@@ -0,0 +1,104 @@
+/**
+ * @file boot.h
+ * @brief Boot time profile and subsystems initialised on first use
+ *
+ * Every step of the start up, from main() after HAL_Init to the start of the
+ * scheduler, is timed with the DWT cycle counter. Later milestones (RPC server
+ * ready, USB host connected, first RPC request) are taken once each, in ms
+ * since main().
+ *
+ * With BOOT_LAZY_INIT (CMake option DCC_TESTER_LAZY_INIT, on by default) the
+ * subsystems a test does not always need (decoder, SUSI master and slave, CAN
+ * sync) set up their peripheral, interrupt and thread the first time they are
+ * started instead of at boot. Their start functions call boot_require(),
+ * which initialises at most once, under a lock. Without it every subsystem is
+ * initialised in App_ThreadX_Init as before.
+ */
+
+#ifndef BOOT_H
+#define BOOT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef BOOT_LAZY_INIT
+#define BOOT_LAZY_INIT          0
+#endif
+
+#define BOOT_MAX_STEPS          24u
+
+typedef enum {
+    BOOT_SUBSYSTEM_DECODER = 0,
+    BOOT_SUBSYSTEM_SUSI_MASTER,
+    BOOT_SUBSYSTEM_SUSI_SLAVE,
+    BOOT_SUBSYSTEM_CAN_SYNC,
+    BOOT_SUBSYSTEM_COUNT
+} BootSubsystem_t;
+
+typedef enum {
+    BOOT_EVENT_RPC_READY = 0,   // RPC server thread waits for requests
+    BOOT_EVENT_USB_ACTIVE,      // USB host configured the CDC interface
+    BOOT_EVENT_FIRST_REQUEST,   // first RPC request received (USB or network)
+    BOOT_EVENT_COUNT
+} BootEvent_t;
+
+typedef struct {
+    const char *name;
+    uint32_t end_us;            // since main()
+    uint32_t us;                // duration of the step
+} BootStep_t;
+
+typedef struct {
+    bool ready;
+    uint32_t at_ms;             // when it was initialised, since main()
+    uint32_t init_us;
+} BootSubsystemState_t;
+
+typedef struct {
+    bool lazy;                  // BOOT_LAZY_INIT
+    uint32_t step_count;
+    BootStep_t steps[BOOT_MAX_STEPS];
+    uint32_t event_ms[BOOT_EVENT_COUNT];    // 0 if not reached yet
+    BootSubsystemState_t subsystems[BOOT_SUBSYSTEM_COUNT];
+} BootProfile_t;
+
+/**
+ * @brief Start the profile, first statement after HAL_Init
+ */
+void boot_profile_start(void);
+
+/**
+ * @brief End of an init step, steps beyond BOOT_MAX_STEPS are dropped
+ * @param step Static name of the step which just finished
+ */
+void boot_mark(const char *step);
+
+/**
+ * @brief Record a milestone, only its first occurrence is kept
+ */
+void boot_event(BootEvent_t event);
+
+/**
+ * @brief App_ThreadX_Init: create the lock, initialise every subsystem unless lazy
+ */
+void boot_subsystems_init(void);
+
+/**
+ * @brief Initialise a subsystem if it is not yet (thread context)
+ */
+void boot_require(BootSubsystem_t subsystem);
+
+void boot_get_profile(BootProfile_t *profile);
+
+const char *boot_subsystem_name(BootSubsystem_t subsystem);
+const char *boot_event_name(BootEvent_t event);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BOOT_H */
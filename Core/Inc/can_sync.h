@@ -0,0 +1,126 @@
+/**
+ * @file can_sync.h
+ * @brief FDCAN bridge for synchronised packet programs on several testers
+ *
+ * One tester is the master, the others follow (node 1-15). All of them run
+ * the command station in custom packet mode with the same packet program
+ * loaded. The master broadcasts START with a lead time; every node, the
+ * master included, takes the start of frame of that message from the FDCAN
+ * timestamp counter (one CAN bit, 2 us) as common reference and starts its
+ * program lead_ms later, on the DWT cycle counter.
+ *
+ * While a session runs the master sends a MARKER for every packet it puts on
+ * the track (command station packet hook). Its Tx event timestamp gives the
+ * delay from the packet to the start of frame, which the next MARKER carries.
+ * A follower maps the master packet onto its own time base through the
+ * marker start of frame and accumulates the offset of its own packet with
+ * the same index since start (positive: the follower is late).
+ *
+ * POLL makes each follower answer with two RESULT frames, so the master
+ * collects the offset summary of every board over the bus.
+ *
+ * Classic CAN, 500 kbit/s, standard identifiers:
+ *   START   CAN_SYNC_ID_BASE + 0   session, lead_ms (u16)
+ *   MARKER  CAN_SYNC_ID_BASE + 1   index (u32), lag_us of index - 1 (i16), session
+ *   POLL    CAN_SYNC_ID_BASE + 2   session
+ *   STOP    CAN_SYNC_ID_BASE + 3   session
+ *   RESULT  CAN_SYNC_ID_BASE + 0x10 + 2 * node + page (unique per node)
+ *
+ * With DMA transmit the packet hook runs when a packet is rendered, ahead of
+ * the track; the offsets are only meaningful if all boards use the same mode.
+ */
+
+#ifndef CAN_SYNC_H
+#define CAN_SYNC_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CAN_SYNC_BITRATE            500000u
+#define CAN_SYNC_ID_BASE            0x640u
+#define CAN_SYNC_MAX_NODES          16u     // node 0 is the master
+#define CAN_SYNC_DEFAULT_LEAD_MS    50u
+#define CAN_SYNC_MIN_LEAD_MS        5u      // covers the start of the program thread
+#define CAN_SYNC_MAX_LEAD_MS        5000u
+#define CAN_SYNC_COLLECT_MS         20u     // wait for RESULT frames after POLL
+#define CAN_SYNC_IRQ_PRIORITY       5u      // below the DCC transmit interrupt
+#define CAN_SYNC_HISTORY            16u     // packets in flight between marker and packet, power of two
+
+typedef enum {
+    CAN_SYNC_ROLE_OFF = 0,
+    CAN_SYNC_ROLE_MASTER,
+    CAN_SYNC_ROLE_FOLLOWER
+} CanSyncRole_t;
+
+/* Offset summary of one node */
+typedef struct {
+    bool valid;                 // master: RESULT received for the current session
+    bool started;               // program started in the current session
+    bool running;
+    uint16_t matched;           // packets with an offset, saturates
+    uint16_t missed;            // markers lost, saturates
+    uint16_t packets;           // packets since start, saturates
+    int16_t min_us;
+    int16_t max_us;
+    int16_t mean_us;
+} CanSyncResult_t;
+
+typedef struct {
+    uint8_t role;               // CanSyncRole_t
+    uint8_t node;
+    uint8_t session;
+    uint32_t lead_ms;
+    bool started;               // program start fired
+    const char *start_error;    // CommandStation_RunProgram error of the last start, NULL if ok
+    uint32_t tx_frames;
+    uint32_t rx_frames;
+    uint32_t tx_dropped;        // Tx FIFO full
+    uint32_t markers;           // sent (master) or received (follower)
+    bool bus_off;
+    uint8_t tx_error_count;
+    uint8_t rx_error_count;
+    CanSyncResult_t local;
+} CanSyncStatus_t;
+
+/**
+ * @brief Configure FDCAN1 (bit timing, filter, timestamp counter) and create the start thread
+ */
+void can_sync_init(void);
+
+/**
+ * @brief Select the role, stops a running session; the controller runs unless role is OFF
+ * @param node 1-15 for a follower, ignored otherwise (the master is node 0)
+ * @return 0 on success, -1 for an invalid role or node, -2 if the controller failed to start
+ */
+int can_sync_configure(CanSyncRole_t role, uint8_t node);
+
+/**
+ * @brief Master: broadcast START, all nodes start their program lead_ms after its start of frame
+ * @return 0 on success, -1 if not master or lead_ms is out of range, -2 if the frame could not be queued
+ */
+int can_sync_start(uint32_t lead_ms);
+
+/**
+ * @brief Master: broadcast STOP and stop the local program, the results stay readable
+ * @return 0 on success, -1 if not master
+ */
+int can_sync_stop(void);
+
+/**
+ * @brief Master: broadcast POLL and wait CAN_SYNC_COLLECT_MS for the RESULT frames (thread context)
+ * @param results CAN_SYNC_MAX_NODES entries indexed by node, node 0 is the master itself
+ * @return 0 on success, -1 if not master
+ */
+int can_sync_collect(CanSyncResult_t *results);
+
+void can_sync_get_status(CanSyncStatus_t *status);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CAN_SYNC_H */
@@ -0,0 +1,51 @@
+/**
+ * @file checksum.h
+ * @brief CRC service on the CRC peripheral
+ *
+ * Shared by the parameter manager (CRC-32) and the binary RPC frames
+ * (CRC-16/CCITT). The CPU feeds short buffers to the peripheral, CRC-32
+ * buffers of CHECKSUM_DMA_MIN bytes and more are written to it by a GPDMA2
+ * memory to memory transfer. A caller that finds the peripheral in use (another
+ * thread or an interrupt) or calls before checksum_init() gets the same result
+ * from the lookup table.
+ */
+
+#ifndef CHECKSUM_H
+#define CHECKSUM_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CHECKSUM_DMA_MIN    1024u   // bytes
+
+typedef struct {
+    uint32_t hardware;      // calculations by the peripheral, CPU fed
+    uint32_t dma;           // calculations by the peripheral, DMA fed
+    uint32_t software;      // table fallbacks: peripheral busy, not initialized or DMA error
+} ChecksumStats_t;
+
+/**
+ * @brief Enable the CRC peripheral clock and set up the DMA channel
+ */
+void checksum_init(void);
+
+/**
+ * @brief CRC-32 (IEEE 802.3, as zlib: reflected, init and final xor 0xFFFFFFFF)
+ */
+uint32_t checksum_crc32(const void *data, uint32_t length);
+
+/**
+ * @brief CRC-16/CCITT-FALSE (poly 0x1021, init 0xFFFF, not reflected)
+ */
+uint16_t checksum_crc16_ccitt(const void *data, uint32_t length);
+
+void checksum_get_stats(ChecksumStats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CHECKSUM_H */
@@ -1,18 +1,162 @@
 #include <stdbool.h>
 #include <stdint.h>
+#include "packet_timing.h"
+#ifdef DCC_TESTER_BENCHMARK
+#include "benchmark.h"
+#endif
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/* Depth of the custom packet queue, must be a power of two */
+#ifndef CUSTOM_PACKET_QUEUE_SIZE
+#define CUSTOM_PACKET_QUEUE_SIZE 256
+#endif
+
+/* Depth of the queue between the command station thread and the transmit path for
+ * scheduled packets, must be a power of two */
+#ifndef SCHEDULED_PACKET_QUEUE_SIZE
+#define SCHEDULED_PACKET_QUEUE_SIZE 16
+#endif
+
+/* Encoded scheduled packets kept for reuse, must be a power of two */
+#ifndef PACKET_CACHE_ENTRIES
+#define PACKET_CACHE_ENTRIES 32
+#endif
+
+/* Packet gap placeholder: use the gap given with the trigger */
+#define CUSTOM_PACKET_GAP_DEFAULT UINT32_MAX
+
+typedef struct {
+    uint32_t count;        // packets currently queued
+    uint32_t capacity;     // queue depth
+    uint32_t high_water;   // highest fill level since the last replace/stop
+    uint32_t underruns;    // times a stream ran dry while transmitting
+    uint32_t transmitted;  // packets handed to the track since start
+    bool streaming;        // stream mode armed
+    uint32_t cache_hits;   // scheduled packets taken from the encoded packet cache since start
+    uint32_t cache_misses; // scheduled packets encoded since start
+} CommandStationQueueStats_t;
+
 void CommandStation_Init(void);
-bool CommandStation_Start(uint8_t loop);  // loop: 0=no loop, 1=loop1, 2=loop2, 3=loop3. Returns true if started, false if already running
+bool CommandStation_Start(uint8_t loop);  // loop: 0=no loop, 1=loop1, 2=loop2, 3=loop3, 4=refresh. Returns true if started, false if already running
 bool CommandStation_Stop(void);  // Returns true if stopped, false if not running
+uint32_t CommandStation_GetPacketSeq(void);  // Packets started since the command station was started (ISR safe)
 bool CommandStation_bidi_Threshold(uint16_t threshold);
 bool CommandStation_LoadCustomPacket(const uint8_t* bytes, uint8_t length, bool replace);
+bool CommandStation_LoadCustomPacketEx(const uint8_t* bytes, uint8_t length, bool replace, uint32_t gap_us);
+bool CommandStation_LoadCustomPacketTimed(const uint8_t* bytes, uint8_t length, bool replace, uint32_t gap_us,
+                                          const PacketTiming_t* timing);  // timing: scheduled mode, NULL = global override
+/* Bulk load of records u8 length + length packet bytes, raw or as hex digits (hex=true). All records
+ * are queued or none: 0 on success, -1 for a malformed record, -2 if the queue cannot take them all,
+ * -3 for replace during transmission. loaded: records queued, on failure the index of the failing one */
+int CommandStation_LoadCustomPackets(const uint8_t* data, uint32_t size, bool hex, bool replace, uint32_t gap_us,
+                                     uint32_t* loaded);
 void CommandStation_TriggerTransmit(uint32_t delay_ms);
+void CommandStation_TriggerTransmitEx(uint32_t delay_ms, bool stream);
+void CommandStation_TriggerTransmitScheduled(uint32_t gap_us, bool stream);
 bool CommandStation_IsCustomPacketQueueFull(void);
 uint8_t CommandStation_GetCustomPacketQueueCount(void);
+void CommandStation_GetCustomPacketQueueStats(CommandStationQueueStats_t* stats);
+
+/* Called in the transmit interrupt with every packet that went out on the track (end bit started) */
+typedef void (*CommandStationPacketHook)(uint32_t packet_seq, const uint8_t* bytes, uint8_t length);
+
+/* Packet hook users, each has a slot of its own */
+typedef enum {
+    COMMAND_STATION_HOOK_RECORDER = 0,
+    COMMAND_STATION_HOOK_LATENCY,
+    COMMAND_STATION_HOOK_SUSI,
+    COMMAND_STATION_HOOK_CAN_SYNC,
+    COMMAND_STATION_HOOK_CAPTURE,
+    COMMAND_STATION_HOOK_SCOPE,
+    COMMAND_STATION_HOOK_ACCESSORY,
+    COMMAND_STATION_HOOK_COUNT
+} CommandStationHookSlot_t;
+
+void CommandStation_SetPacketHook(CommandStationHookSlot_t slot, CommandStationPacketHook hook);  // NULL removes the hook
+
+/* Scope trigger: the SCOPE pin goes high for width_bits bits from the start of the bit a condition
+ * fired on, written with the track outputs of that half-bit (from the TIM2 DMA in DMA transmit mode).
+ * dcc_trigger_first_bit and packets with PACKET_PROGRAM_FLAG_TRIGGER fire independently of it */
+#define SCOPE_TRIGGER_MAX_MATCH 6u
+
+typedef enum {
+    SCOPE_TRIGGER_OFF = 0,
+    SCOPE_TRIGGER_PACKET_SEQ,       // start bit of packet packet_seq since the start (1 = first)
+    SCOPE_TRIGGER_MATCH,            // end bit of a packet starting with match
+    SCOPE_TRIGGER_OVERRIDE_BIT,     // bit "bit" of a packet (0 = start bit) sent with overridden timing
+    SCOPE_TRIGGER_RAILCOM_ERROR,    // first bit after a cutout with invalid symbols or UART errors
+    SCOPE_TRIGGER_COUNT
+} ScopeTriggerCondition_t;
+
+typedef struct {
+    uint8_t condition;              // ScopeTriggerCondition_t
+    bool single;                    // off again after the first fire
+    uint8_t width_bits;             // pulse length, 1-255
+    uint16_t bit;                   // SCOPE_TRIGGER_OVERRIDE_BIT
+    uint32_t packet_seq;            // SCOPE_TRIGGER_PACKET_SEQ
+    uint8_t match[SCOPE_TRIGGER_MAX_MATCH];  // SCOPE_TRIGGER_MATCH
+    uint8_t match_length;
+} ScopeTrigger_t;
+
+typedef struct {
+    uint32_t fired;                 // pulses of the condition since it was set
+    uint32_t last_packet_seq;       // packet of the last pulse
+} ScopeTriggerStatus_t;
+
+void CommandStation_SetScopeTrigger(const ScopeTrigger_t* trigger);  // replaces the condition, taken at the next half-bit
+void CommandStation_GetScopeTrigger(ScopeTrigger_t* trigger, ScopeTriggerStatus_t* status);
+const char* CommandStation_ScopeTriggerName(ScopeTriggerCondition_t condition);
+
+/* Half-bit recording: every half-bit sent is appended to a RAM buffer as it leaves the transmit
+ * path, run length encoded. A recording starts after and ends with a bit boundary inside a
+ * preamble (ten one bits), a replay is spliced in at the same point, so both hold whole packets.
+ * Replay drives the outputs from the recording in place of the library and the scheduler, through
+ * the DMA tables or the TIM2 interrupt like any other half-bit. Levels are not recorded as such,
+ * only whether a half-bit toggles them; recordings need BiDi off, cutouts are not half-bits. */
+#define COMMAND_STATION_RECORD_ENTRIES  16384u
+#define COMMAND_STATION_RECORD_DURATION 0x7FFFu     // TIM2 ticks (us) of the half-bit
+#define COMMAND_STATION_RECORD_HOLD     0x8000u     // no edge, the previous level continues
+#define COMMAND_STATION_RECORD_REPEAT_SHIFT 16u     // repeats - 1 of the same half-bit, 0-65535
+
+typedef enum {
+    COMMAND_STATION_RECORD_IDLE = 0,
+    COMMAND_STATION_RECORD_ARMED,       // waiting for a preamble
+    COMMAND_STATION_RECORD_RECORDING,
+    COMMAND_STATION_RECORD_STOPPING,    // waiting for a preamble
+    COMMAND_STATION_REPLAY_ARMED,
+    COMMAND_STATION_REPLAY_RUNNING,
+    COMMAND_STATION_REPLAY_STOPPING,
+    COMMAND_STATION_RECORD_STATE_COUNT
+} CommandStationRecordState_t;
+
+typedef struct {
+    uint8_t state;                  // CommandStationRecordState_t
+    bool full;                      // the last recording ran out of entries
+    uint32_t entries;               // entries recorded or uploaded
+    uint64_t half_bits;
+    uint64_t duration_us;
+    uint32_t passes;                // replay: 0 until stopped
+    uint32_t pass;                  // replay: passes completed
+    uint32_t entry;                 // replay: entry being sent
+} CommandStationRecordStatus_t;
+
+/* Record from the next preamble on, the previous recording is discarded. false with error set if
+ * the command station does not run, runs with BiDi or a recording or replay is active */
+bool CommandStation_RecordStart(const char** error);
+/* Replay the recording passes times (0 until stopped), from the next preamble on */
+bool CommandStation_ReplayStart(uint32_t passes, const char** error);
+/* End a recording or replay at the next preamble, a replay at the latest at the end of its pass */
+void CommandStation_RecordStop(void);
+void CommandStation_GetRecordStatus(CommandStationRecordStatus_t* status);
+const char* CommandStation_RecordStateName(CommandStationRecordState_t state);
+/* Copy entries from first on, returns the number copied */
+uint32_t CommandStation_RecordRead(uint32_t first, uint32_t* entries, uint32_t max);
+/* Upload entries at first, 0 starts a new recording, otherwise first must be the current length.
+ * -1 while recording or replaying, -2 for a gap, too many entries or a zero duration */
+int CommandStation_RecordWrite(uint32_t first, const uint32_t* entries, uint32_t count);
 
 // RAM-only override parameter getters/setters
 void CommandStation_SetZerobitOverrideMask(uint64_t mask);
@@ -21,6 +165,17 @@ void CommandStation_SetZerobitDeltaP(int32_t delta);
 int32_t CommandStation_GetZerobitDeltaP(void);
 void CommandStation_SetZerobitDeltaN(int32_t delta);
 int32_t CommandStation_GetZerobitDeltaN(void);
+/* Change the timing while running, taken at the next packet boundary. Returns once taken: 0 on success,
+ * -1 for durations the transmit path cannot tell apart or a preamble shorter than at start, -2 if not
+ * running, -3 if not taken in time. Scheduled packets already queued keep the timing they were built with */
+int CommandStation_UpdateTiming(uint8_t preamble_bits, uint8_t bit1_duration, uint8_t bit0_duration,
+                                const char** error);
+
+#ifdef DCC_TESTER_BENCHMARK
+/* Time calls of transmit() and of the whole TIM2 half bit path with the track outputs left alone,
+ * false while the command station runs */
+bool CommandStation_BenchmarkTransmit(uint32_t calls, BenchmarkStats_t* transmit, BenchmarkStats_t* half_bit);
+#endif
 
 
 #ifdef __cplusplus
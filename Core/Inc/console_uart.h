@@ -0,0 +1,54 @@
+/**
+ * @file console_uart.h
+ * @brief Buffered DMA transmit for the USART3 console
+ *
+ * _write copies printf output into a RAM ring and returns, USART3 TX DMA
+ * (GPDMA1 channel 0, set up by CubeMX) sends the ring from the transmit
+ * complete callback. At 115200 baud a byte takes 87 us, a status dump which
+ * used to block the calling thread for tens of milliseconds now costs a copy.
+ *
+ * When the ring is full the overflow policy decides:
+ *   CONSOLE_TX_OVERFLOW_BLOCK  wait for space (lossless, the default)
+ *   CONSOLE_TX_OVERFLOW_DROP   discard the bytes and print a marker with the
+ *                              number of dropped bytes once space is back
+ * Writes from an interrupt or with interrupts masked (ThreadX initialization)
+ * never wait, they drop.
+ */
+
+#ifndef CONSOLE_UART_H
+#define CONSOLE_UART_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CONSOLE_TX_OVERFLOW_DROP   0
+#define CONSOLE_TX_OVERFLOW_BLOCK  1
+
+#ifndef CONSOLE_TX_OVERFLOW
+#define CONSOLE_TX_OVERFLOW        CONSOLE_TX_OVERFLOW_BLOCK
+#endif
+
+#ifndef CONSOLE_TX_BUFFER_SIZE
+#define CONSOLE_TX_BUFFER_SIZE     4096u   // a power of two
+#endif
+
+/**
+ * @brief Switch the console to DMA transmit, call after MX_USART3_UART_Init
+ *        (output before this call is sent blocking)
+ */
+void console_init(void);
+
+/**
+ * @brief Queue bytes for transmission, used by _write
+ * @return Number of bytes queued or sent
+ */
+int console_write(const char *data, int len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CONSOLE_UART_H */
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+// Sparse store of the 1024 CVs of an emulated decoder
+//
+// Only the CVs which have been written take space: N entries of a sorted key array and
+// a value array, looked up by binary search. CV257-512 are indexed (RCN-225): they exist
+// once per page selected by CV31 (high byte) and CV32 (low byte), the page is part of the
+// key. CVs never written read as 0. Addresses are 0 based as in the DCC library, 0 is CV1.
+template<size_t N>
+class CvStore {
+public:
+  static constexpr uint32_t kCvs{1024u};
+  static constexpr uint32_t kIndexHigh{30u};       // CV31
+  static constexpr uint32_t kIndexLow{31u};        // CV32
+  static constexpr uint32_t kIndexedFirst{256u};   // CV257
+  static constexpr uint32_t kIndexedLast{511u};    // CV512
+
+  static constexpr size_t capacity() { return N; }
+  size_t size() const { return _count; }
+  void clear() { _count = 0u; }
+
+  static constexpr bool indexed(uint32_t cv_addr) {
+    return cv_addr >= kIndexedFirst && cv_addr <= kIndexedLast;
+  }
+
+  // Page selected by CV31/CV32
+  uint16_t page() const {
+    return static_cast<uint16_t>(read(kIndexHigh, 0u) << 8u | read(kIndexLow, 0u));
+  }
+
+  // Value on the current page
+  uint8_t read(uint32_t cv_addr) const { return read(cv_addr, indexed(cv_addr) ? page() : 0u); }
+
+  // Value on a given page, the page is ignored outside CV257-512
+  uint8_t read(uint32_t cv_addr, uint16_t page) const {
+    if (cv_addr >= kCvs) return 0u;
+    uint32_t const key{make_key(cv_addr, page)};
+    size_t const i{lower_bound(key)};
+    return i < _count && _keys[i] == key ? _values[i] : 0u;
+  }
+
+  // Write on the current page, false if out of range or the store is full
+  bool write(uint32_t cv_addr, uint8_t value) {
+    return write(cv_addr, indexed(cv_addr) ? page() : 0u, value);
+  }
+
+  bool write(uint32_t cv_addr, uint16_t page, uint8_t value) {
+    if (cv_addr >= kCvs) return false;
+    uint32_t const key{make_key(cv_addr, page)};
+    size_t const i{lower_bound(key)};
+    if (i < _count && _keys[i] == key) {
+      _values[i] = value;
+      return true;
+    }
+    if (_count == N) return false;
+    for (size_t j{_count}; j > i; j--) {
+      _keys[j] = _keys[j - 1u];
+      _values[j] = _values[j - 1u];
+    }
+    _keys[i] = key;
+    _values[i] = value;
+    _count++;
+    return true;
+  }
+
+private:
+  static constexpr uint32_t make_key(uint32_t cv_addr, uint16_t page) {
+    return indexed(cv_addr) ? static_cast<uint32_t>(page) << 10u | cv_addr : cv_addr;
+  }
+
+  size_t lower_bound(uint32_t key) const {
+    size_t first{0u};
+    size_t count{_count};
+    while (count) {
+      size_t const step{count / 2u};
+      if (_keys[first + step] < key) {
+        first += step + 1u;
+        count -= step + 1u;
+      } else {
+        count = step;
+      }
+    }
+    return first;
+  }
+
+  std::array<uint32_t, N> _keys{};
+  std::array<uint8_t, N> _values{};
+  size_t _count{0u};
+};
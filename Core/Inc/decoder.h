@@ -1,12 +1,98 @@
 
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Capture TIM15 edges by circular DMA instead of one interrupt per edge */
+#ifndef DECODER_DMA_CAPTURE
+#define DECODER_DMA_CAPTURE       1
+#endif
+#define DECODER_CAPTURE_SIZE      128u   // edges, half of it per DMA event
+#define DECODER_CAPTURE_FLUSH_MS  2u     // decode a partly filled half after this idle time
+
+/*
+ * Emulated decoder
+ *
+ * With emulation enabled at start the decoder answers like a real one: the
+ * edges are decoded in the TIM15 interrupt, the end of each packet wakes the
+ * decoder thread at once to execute it and starts the TIM14 one pulse timer
+ * (1 us ticks) for the cutout. A service mode ACK switches the load on HL for
+ * DECODER_ACK_US, the timer switches it off again. The RailCom replies of the
+ * DCC library are sent on UART4 (decoder side BiDi transmitter) at
+ * DECODER_BIDI_CH1_US and DECODER_BIDI_CH2_US after the edge which ended the
+ * packet: the cutout starts 26-32 us after it, channel 1 80-177 us and
+ * channel 2 193-454 us into the cutout (RCN-217).
+ *
+ * The 1024 CVs are kept in a sparse store, CV257-512 once per CV31/CV32 page.
+ */
+#define DECODER_CV_CAPACITY       384u   // CVs written, defaults included
+#define DECODER_CV_PAGE_CURRENT   0xFFFFFFFFu
+#define DECODER_ACK_GPIO_Port     HL_GPIO_Port
+#define DECODER_ACK_Pin           HL_Pin
+#define DECODER_ACK_US            6000u  // S-9.2.3: 6 ms +- 1 ms
+#define DECODER_BIDI_CH1_US       110u
+#define DECODER_BIDI_CH2_US       224u
+
+#ifdef DCC_TESTER_BENCHMARK
+#include "benchmark.h"
+#endif
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+typedef struct {
+    bool ack;                   // drive the ACK load
+    bool railcom;               // transmit in the cutout
+} DecoderEmulation_t;
+
+typedef struct {
+    bool running;
+    bool emulating;             // current run, see Decoder_SetEmulation
+    bool ack;
+    bool railcom;
+    uint32_t packets;           // packet ends seen while emulating
+    uint32_t acks;
+    uint32_t ch1;               // cutout transmissions
+    uint32_t ch2;
+    uint32_t bidi_busy;         // cutouts with the previous transmission still running
+    uint32_t last_response_us;  // packet end to executed
+    uint32_t max_response_us;
+    uint32_t late;              // executed after the channel 2 slot had started
+    uint32_t cvs;               // entries used in the CV store
+} DecoderEmulationStats_t;
+
 void Decoder_Init(void);
 void Decoder_Start(void);
 void Decoder_Stop(void);
 
+/**
+ * @brief Select emulation for the following Decoder_Start, NULL for the plain decoder
+ */
+void Decoder_SetEmulation(const DecoderEmulation_t* emulation);
+
+void Decoder_GetEmulationStats(DecoderEmulationStats_t* stats);
+
+/**
+ * @brief Access the CV store, also while the decoder runs
+ * @param cv CV number 1-1024
+ * @param page CV31/CV32 page of CV257-512, DECODER_CV_PAGE_CURRENT for the selected one
+ * @return 0 on success, -1 if cv is out of range (or the store is full on write)
+ */
+int Decoder_ReadCv(uint32_t cv, uint32_t page, uint8_t* value);
+int Decoder_WriteCv(uint32_t cv, uint32_t page, uint8_t value);
+
+/**
+ * @brief Clear the CV store and load the defaults
+ */
+void Decoder_ResetCvs(void);
+
+#ifdef DCC_TESTER_BENCHMARK
+/* Time receive() per edge on a stream of idle packets, false while the decoder runs */
+bool Decoder_BenchmarkReceive(uint32_t edges, BenchmarkStats_t* stats);
+#endif
+
 #ifdef __cplusplus
 }
 #endif
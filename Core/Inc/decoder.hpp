@@ -36,10 +36,5 @@ private:
   // Write CV bit
   bool writeCv(uint32_t cv_addr, bool bit, uint32_t pos);
 
-  // Minimal set of CVs
-  std::array<uint8_t, 29uz> _cvs{
-    3u,   1u,   2u, 1u,   1u,   1u,   4u, DCC_MANUFACTURER_ID,
-    55u,  0u,   0u, 117u, 128u, 195u, 0u, 0u,
-    192u, 128u, 0u, 0u,   0u,   0u,   0u, 0u,
-    0u,   0u,   0u, 131u, 14u};
+  // The CVs are kept in the sparse store of decoder.cpp, outside the interrupt hot state
 };
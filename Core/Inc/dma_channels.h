@@ -0,0 +1,64 @@
+/**
+ * @file dma_channels.h
+ * @brief GPDMA channel allocation for the hand written (non CubeMX) DMA streams
+ *
+ * CubeMX owns GPDMA1 channel 0 (USART3 TX, see stm32h5xx_hal_msp.c).
+ * Every other channel used by the application is listed here so that
+ * allocations can be checked at a glance.
+ */
+
+#ifndef DMA_CHANNELS_H
+#define DMA_CHANNELS_H
+
+#include "stm32h5xx_hal.h"
+
+/* DCC command station: TIM2 update -> TIM2->ARR (half-bit durations) */
+#define DCC_TX_ARR_DMA_CHANNEL        GPDMA1_Channel1
+#define DCC_TX_ARR_DMA_IRQn           GPDMA1_Channel1_IRQn
+#define DCC_TX_ARR_DMA_IRQHandler     GPDMA1_Channel1_IRQHandler
+#define DCC_TX_ARR_DMA_REQUEST        GPDMA1_REQUEST_TIM2_UP
+
+/* DCC command station: TIM2 CC3 -> TR_P/TR_N (and SCOPE) port BSRR */
+#define DCC_TX_TR_DMA_CHANNEL         GPDMA1_Channel2
+#define DCC_TX_TR_DMA_REQUEST         GPDMA1_REQUEST_TIM2_CH3
+
+/* DCC command station: TIM2 CC4 -> TRACK_P port BSRR */
+#define DCC_TX_TRACK_DMA_CHANNEL      GPDMA1_Channel3
+#define DCC_TX_TRACK_DMA_REQUEST      GPDMA1_REQUEST_TIM2_CH4
+
+/* Analog manager continuous mode: ADC1 DR -> scan buffer */
+#define ADC1_STREAM_DMA_CHANNEL       GPDMA1_Channel4
+#define ADC1_STREAM_DMA_IRQn          GPDMA1_Channel4_IRQn
+#define ADC1_STREAM_DMA_IRQHandler    GPDMA1_Channel4_IRQHandler
+#define ADC1_STREAM_DMA_REQUEST       GPDMA1_REQUEST_ADC1
+
+/* Analog manager continuous mode: ADC2 DR -> scan buffer */
+#define ADC2_STREAM_DMA_CHANNEL       GPDMA1_Channel5
+#define ADC2_STREAM_DMA_IRQn          GPDMA1_Channel5_IRQn
+#define ADC2_STREAM_DMA_IRQHandler    GPDMA1_Channel5_IRQHandler
+#define ADC2_STREAM_DMA_REQUEST       GPDMA1_REQUEST_ADC2
+
+/* RailCom receiver: UART4 RDR -> cutout buffer, armed per cutout, no interrupt */
+#define RAILCOM_RX_DMA_CHANNEL        GPDMA1_Channel6
+#define RAILCOM_RX_DMA_REQUEST        GPDMA1_REQUEST_UART4_RX
+
+/* Decoder capture: TIM15 CCR1 (edge to edge time) -> circular capture ring */
+#define DECODER_CAPTURE_DMA_CHANNEL   GPDMA1_Channel7
+#define DECODER_CAPTURE_DMA_IRQn      GPDMA1_Channel7_IRQn
+#define DECODER_CAPTURE_DMA_IRQHandler GPDMA1_Channel7_IRQHandler
+#define DECODER_CAPTURE_DMA_REQUEST   GPDMA1_REQUEST_TIM15_CH1
+
+/* Checksum service: buffer -> CRC DR, software request, polled */
+#define CHECKSUM_DMA_CHANNEL          GPDMA2_Channel0
+
+/* SUSI master: packet buffer -> SPI5 TXDR, completion through the SPI5 EOT interrupt */
+#define SUSI_MASTER_TX_DMA_CHANNEL    GPDMA2_Channel1
+#define SUSI_MASTER_TX_DMA_IRQn       GPDMA2_Channel1_IRQn
+#define SUSI_MASTER_TX_DMA_IRQHandler GPDMA2_Channel1_IRQHandler
+#define SUSI_MASTER_TX_DMA_REQUEST    GPDMA2_REQUEST_SPI5_TX
+
+/* SUSI slave: SPI2 RXDR -> circular receive buffer, position polled by TIM16, no interrupt */
+#define SUSI_SLAVE_RX_DMA_CHANNEL     GPDMA2_Channel2
+#define SUSI_SLAVE_RX_DMA_REQUEST     GPDMA2_REQUEST_SPI2_RX
+
+#endif /* DMA_CHANNELS_H */
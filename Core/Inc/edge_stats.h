@@ -0,0 +1,81 @@
+/**
+ * @file edge_stats.h
+ * @brief Half-bit duration statistics of the decoder input
+ *
+ * Every edge time captured by TIM15 is classified as one or zero half bit and
+ * binned into a histogram, with count, sum, min and max kept per class and per
+ * phase. Consecutive halves alternate between phase 0 and 1, the phase which
+ * carried the high input level is tracked from the DEC_IN pin so that the P/N
+ * asymmetry can be reported with its sign. Updates are a handful of integer
+ * operations per edge, no division.
+ */
+
+#ifndef EDGE_STATS_H
+#define EDGE_STATS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define EDGE_STATS_MIN_US         32u    // shorter edges are counted as glitches
+#define EDGE_STATS_ONE_MAX_US     75u    // longest one half
+#define EDGE_STATS_ONE_BIN_US     1u
+#define EDGE_STATS_ONE_BINS       (EDGE_STATS_ONE_MAX_US + 1u - EDGE_STATS_MIN_US)
+#define EDGE_STATS_ZERO_FIRST_US  (EDGE_STATS_ONE_MAX_US + 1u)
+#define EDGE_STATS_ZERO_BIN_US    4u     // zero halves 76-587 us, longer ones in the overflow count
+#define EDGE_STATS_ZERO_BINS      128u
+
+typedef enum {
+    EDGE_STATS_ONE = 0,
+    EDGE_STATS_ZERO,
+    EDGE_STATS_CLASSES
+} EdgeStatsClass_t;
+
+typedef struct {
+    uint32_t count;
+    uint64_t sum_us;
+    uint16_t min_us;
+    uint16_t max_us;
+} EdgeStatsPhase_t;
+
+typedef struct {
+    uint32_t edges;                              // edges seen since reset
+    uint32_t glitches;                           // edges shorter than EDGE_STATS_MIN_US
+    uint32_t zero_overflow;                      // zero halves beyond the last bin
+    uint8_t high_phase;                          // phase which carried the high level
+    EdgeStatsPhase_t phase[EDGE_STATS_CLASSES][2];
+    uint32_t one_bins[EDGE_STATS_ONE_BINS];
+    uint32_t zero_bins[EDGE_STATS_ZERO_BINS];
+} EdgeStats_t;
+
+/**
+ * @brief Add one captured edge time (capture interrupt or DMA drain)
+ * @param width_us Duration of the half bit which ended with the edge
+ */
+void edge_stats_add(uint16_t width_us);
+
+/**
+ * @brief Report the input level of the half bit which ended with the last added edge
+ * @param high true if that half was high
+ */
+void edge_stats_set_level(bool high);
+
+/**
+ * @brief Request a reset, carried out by the capture side with the next edge
+ */
+void edge_stats_reset(void);
+
+/**
+ * @brief Copy the statistics (taken while edges arrive, may lag by a few edges)
+ * @param stats Output
+ */
+void edge_stats_get(EdgeStats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* EDGE_STATS_H */
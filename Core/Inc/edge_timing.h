@@ -0,0 +1,108 @@
+/**
+ * @file edge_timing.h
+ * @brief Latency and jitter of the interrupt driven track output
+ *
+ * With interrupt driven transmit every TIM2 update starts a half bit and the
+ * handler writes the track outputs (BSRR) for it. The DWT cycle counter is
+ * sampled at handler entry and right after the BSRR write:
+ *   latency  entry to write, the software part of the edge delay
+ *   error    time between two writes less the duration TIM2 was programmed
+ *            with, the jitter a decoder sees on the half bit (signed)
+ * Both are kept per phase (P = first half of the bit) and binned. Interrupts
+ * that do not write the outputs (BiDi cutout) restart the interval, half bits
+ * off by more than half their duration count as late instead of being binned.
+ *
+ * The DMA transmit path has no software in the edge path and is not measured.
+ * The output as seen on the pin is covered by the decoder input edge statistics
+ * (edge_stats.h) with the track looped back to DEC_IN.
+ */
+
+#ifndef EDGE_TIMING_H
+#define EDGE_TIMING_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define EDGE_TIMING_BIN_SHIFT       4u     // 16 cycles per bin
+#define EDGE_TIMING_BIN_CYCLES      (1u << EDGE_TIMING_BIN_SHIFT)
+#define EDGE_TIMING_LATENCY_BINS    64u    // 0-1023 cycles, longer ones in latency_overflow
+#define EDGE_TIMING_ERROR_BINS      64u    // -512..511 cycles
+#define EDGE_TIMING_ERROR_FIRST     (-(int32_t)(EDGE_TIMING_ERROR_BINS * EDGE_TIMING_BIN_CYCLES / 2u))
+
+typedef struct {
+    uint32_t count;
+    uint64_t sum;
+    uint32_t min;
+    uint32_t max;
+} EdgeTimingLatency_t;
+
+typedef struct {
+    uint32_t count;
+    int64_t sum;
+    int32_t min;
+    int32_t max;
+} EdgeTimingError_t;
+
+typedef struct {
+    bool active;                                 // interrupt driven transmit running
+    uint32_t cycles_per_tick;                    // core cycles per TIM2 tick
+    uint32_t half_bits;                          // interrupts which wrote the outputs
+    uint32_t missed;                             // interrupts without an output write
+    uint32_t late;                               // error beyond half the programmed duration
+    EdgeTimingLatency_t latency[2];              // [0 = P, 1 = N]
+    EdgeTimingError_t error[2];
+    uint32_t latency_bins[EDGE_TIMING_LATENCY_BINS];
+    uint32_t latency_overflow;
+    uint32_t error_bins[EDGE_TIMING_ERROR_BINS];
+    uint32_t error_underflow;
+    uint32_t error_overflow;
+} EdgeTiming_t;
+
+/**
+ * @brief Interrupt driven transmit starts (command station thread, before TIM2 runs)
+ * @param cycles_per_tick Core cycles per TIM2 tick
+ */
+void edge_timing_start(uint32_t cycles_per_tick);
+
+/**
+ * @brief Transmit stopped or switched to DMA
+ */
+void edge_timing_stop(void);
+
+/**
+ * @brief TIM2 update handler entry
+ * @param cycles DWT cycle counter read first thing in the handler
+ */
+void edge_timing_entry(uint32_t cycles);
+
+/**
+ * @brief Track outputs written (after the BSRR write)
+ * @param p true for the P half
+ */
+void edge_timing_output(bool p);
+
+/**
+ * @brief End of the TIM2 update handler
+ * @param arr Auto reload value written for the half bit that has just started
+ */
+void edge_timing_period(uint32_t arr);
+
+/**
+ * @brief Request a reset, carried out by the next TIM2 interrupt
+ */
+void edge_timing_reset(void);
+
+/**
+ * @brief Copy the statistics (taken while the track runs, may lag by a few half bits)
+ */
+void edge_timing_get(EdgeTiming_t *timing);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* EDGE_TIMING_H */
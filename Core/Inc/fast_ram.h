@@ -0,0 +1,35 @@
+/**
+ * @file fast_ram.h
+ * @brief Placement of the DCC interrupt handlers and their state in SRAM
+ *
+ * The STM32H563 has no TCM and no data cache: SRAM is zero wait state, code
+ * fetched from flash costs 5 wait states on every ICACHE miss. The handlers
+ * which time the track signal (TIM2 and the DMA refill of the command
+ * station, TIM15 of the decoder) and the functions they call on every edge
+ * are therefore copied to SRAM by the startup code (.RamFunc, part of .data
+ * in STM32H563xx_FLASH.ld), so their execution time no longer depends on what
+ * else the ICACHE holds.
+ *
+ * The state of each handler is one 32 byte (ICACHE line, bus burst) aligned
+ * object in .fast_data, at the start of .data, instead of file statics
+ * scattered over .bss.
+ *
+ * Calls from flash to SRAM and back go through linker veneers, so a function
+ * marked here should do all of its work in SRAM: a handler calling into the
+ * DCC library is flattened so the library code is copied along.
+ */
+
+#ifndef FAST_RAM_H
+#define FAST_RAM_H
+
+/* Code copied to and executed from SRAM */
+#define FAST_RAM_FUNC           __attribute__((section(".RamFunc")))
+
+/* FAST_RAM_FUNC with every call into the same translation unit inlined */
+#define FAST_RAM_FLATTEN        __attribute__((section(".RamFunc"), flatten))
+
+/* Interrupt hot state, aligned to FAST_RAM_LINE */
+#define FAST_RAM_LINE           32
+#define FAST_RAM_DATA           __attribute__((section(".fast_data"), aligned(FAST_RAM_LINE)))
+
+#endif /* FAST_RAM_H */
@@ -0,0 +1,110 @@
+/**
+ * @file gpio_io.h
+ * @brief Test header IO1-IO16: table driven access, snapshot reads and edge capture
+ *
+ * IO1-IO15 are GPIO pins spread over five ports, IO16 is the user button
+ * (read-only). A snapshot reads the input data register of every port once,
+ * back to back, and maps the bits to IO numbers, so all inputs are sampled
+ * within a few bus cycles of each other.
+ *
+ * Edge capture arms the EXTI line of the selected inputs for both edges and
+ * records every transition into a RAM ring with the extended cycle counter
+ * and the command station packet sequence number at the time of the edge, so
+ * the response of a decoder output can be related to the packet that caused
+ * it. EXTI lines are shared by pin number across ports; inputs on the same
+ * line (IO4/IO6/IO12, IO3/IO11, IO7/IO8, IO10/IO15) cannot be captured
+ * together. The low 32 bits of the extended count are the DWT cycle counter,
+ * which wraps after about 17 s at 250 MHz; timebase_ns() gives the UTC of an
+ * edge.
+ */
+
+#ifndef GPIO_IO_H
+#define GPIO_IO_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define GPIO_IO_COUNT             16u     // IO1-IO16
+#define GPIO_IO_PIN_COUNT         15u     // IO1-IO15 are GPIO pins, IO16 the user button
+#define GPIO_IO_CAPTURE_RECORDS   256u    // power of two
+#define GPIO_IO_EXTI_PRIORITY     5u      // below the DCC transmit interrupt
+
+typedef struct {
+    uint64_t cycles;            // timebase_cycles() at the edge
+    uint32_t packet_seq;        // CommandStation_GetPacketSeq() at the edge
+    uint8_t io;                 // 1-15
+    uint8_t level;              // level after the edge
+} GpioIoEdge_t;
+
+typedef struct {
+    bool active;
+    uint16_t mask;              // captured inputs, bit 0 = IO1
+    uint32_t edges;             // recorded since start
+    uint32_t overflows;         // edges lost to a full ring
+    uint32_t pending;           // records waiting to be read
+} GpioIoCaptureStats_t;
+
+/**
+ * @brief Read one input
+ * @param io 1-16
+ * @return 0 or 1, -1 for an invalid IO number
+ */
+int gpio_io_read(uint8_t io);
+
+/**
+ * @brief All inputs as a word, bit 0 = IO1 ... bit 15 = IO16
+ */
+uint16_t gpio_io_snapshot(void);
+
+/**
+ * @brief Make IO1-IO15 a push-pull output with the given level
+ * @return false for an invalid IO number or while the input is captured
+ */
+bool gpio_io_configure_output(uint8_t io, bool level);
+
+/**
+ * @brief Set an output level
+ * @return false for an invalid IO number
+ */
+bool gpio_io_write(uint8_t io, bool level);
+
+/**
+ * @brief Port BSRR address and pin mask of an IO, for writers which switch outputs from an interrupt
+ * @return false for an invalid IO number
+ */
+bool gpio_io_output_bsrr(uint8_t io, volatile uint32_t **bsrr, uint32_t *mask);
+
+/**
+ * @brief Start edge capture on the inputs in mask (bit 0 = IO1), clears the ring
+ * @param conflicts Set to the inputs which made the request fail (may be NULL):
+ *                  outputs, IO16, or inputs sharing an EXTI line
+ * @return false if mask is empty or conflicts
+ */
+bool gpio_io_capture_start(uint16_t mask, uint16_t *conflicts);
+
+/**
+ * @brief Disarm the EXTI lines, recorded edges stay readable
+ */
+void gpio_io_capture_stop(void);
+
+/**
+ * @brief Copy out and release up to max recorded edges (thread context, one reader)
+ * @return Number of edges copied
+ */
+uint32_t gpio_io_capture_read(GpioIoEdge_t *edges, uint32_t max);
+
+void gpio_io_capture_stats(GpioIoCaptureStats_t *stats);
+
+/* Called in the EXTI interrupt with every captured edge, also when the ring is full */
+typedef void (*GpioIoEdgeHook)(const GpioIoEdge_t *edge);
+void gpio_io_set_edge_hook(GpioIoEdgeHook hook);  // NULL removes the hook
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* GPIO_IO_H */
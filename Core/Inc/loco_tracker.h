@@ -0,0 +1,116 @@
+/**
+ * @file loco_tracker.h
+ * @brief Multi-address decoder emulation for command station throughput tests
+ *
+ * While enabled, every packet of the on-board decoder input with a good
+ * checksum (framed by the sniffer, see sniffer_track) is decoded for its
+ * address, whatever the address of the emulated Decoder. Multi function
+ * decoder addresses are kept in an open addressing hash table with linear
+ * probing, one LocoTrackerEntry_t per address: the last speed, direction and
+ * functions sent, and when and how often the address was refreshed. There is
+ * no output per packet, the host reads the table and the throughput counters.
+ *
+ * Only the first instruction of a packet updates the state; every packet to an
+ * address counts as a refresh of it. 14 speed step packets are taken as 28
+ * speed steps. Times are on the sniffer edge clock in us, it wraps after 71
+ * minutes.
+ *
+ * The table holds LOCO_TRACKER_MAX_LOCOS addresses, packets to further ones
+ * are only counted in "full". Entries are never removed, enabling again
+ * clears the table.
+ */
+
+#ifndef LOCO_TRACKER_H
+#define LOCO_TRACKER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LOCO_TRACKER_CAPACITY       4096u       // slots, power of two
+#define LOCO_TRACKER_MAX_LOCOS      3072u       // 3/4 of the slots, keeps probe runs short
+#define LOCO_TRACKER_WINDOW_US      1000000u    // rate window
+
+/* Address of an entry: short 1-127, long 0-10239 with LOCO_TRACKER_LONG */
+#define LOCO_TRACKER_LONG           0x8000u
+
+/* Entry flags */
+#define LOCO_TRACKER_FLAG_FORWARD   0x01u
+#define LOCO_TRACKER_FLAG_ESTOP     0x02u       // last speed was an emergency stop
+#define LOCO_TRACKER_FLAG_STEPS128  0x04u       // last speed had 128 steps, else 28
+#define LOCO_TRACKER_FLAG_SPEED     0x08u       // a speed was received
+
+typedef struct {
+    uint16_t address;           // 0 for an empty slot
+    uint8_t speed;              // speed step, 0 stop
+    uint8_t flags;              // LOCO_TRACKER_FLAG_*
+    uint32_t functions;         // F0-F31, bit n is Fn
+    uint32_t first_us;          // first packet to the address
+    uint32_t last_us;           // last packet to the address
+    uint32_t refreshes;         // packets to the address
+    uint32_t max_interval_us;   // longest time between two of them
+} LocoTrackerEntry_t;
+
+typedef struct {
+    bool enabled;
+    uint32_t packets;           // good packets
+    uint32_t loco_packets;      // to multi function decoder addresses
+    uint32_t idle_packets;
+    uint32_t broadcast_packets;
+    uint32_t accessory_packets;
+    uint32_t other_packets;     // reserved and extended addresses
+    uint32_t locos;             // addresses in the table
+    uint32_t full;              // loco packets not tracked, table full
+    uint32_t first_us;          // first packet
+    uint32_t last_us;           // last packet
+    uint32_t rate;              // loco packets per second in the last full window
+    uint32_t peak_rate;
+    uint32_t max_interval_us;   // longest refresh interval of any address
+    uint16_t max_interval_address;
+    uint16_t max_probe;         // longest probe run of an insert
+} LocoTrackerStats_t;
+
+/**
+ * @brief Start or stop tracking, starting clears the table and counters
+ *
+ * Packets are only seen while the decoder runs (Decoder_Start).
+ */
+void loco_tracker_enable(bool enable);
+
+bool loco_tracker_enabled(void);
+
+/**
+ * @brief Decode one packet (sniffer framer, decoder capture path)
+ * @param bytes Packet bytes, checksum included
+ * @param length Number of bytes
+ * @param time_us Start bit on the edge clock
+ */
+void loco_tracker_packet(const uint8_t *bytes, uint32_t length, uint32_t time_us);
+
+void loco_tracker_get_stats(LocoTrackerStats_t *stats);
+
+/**
+ * @brief Copy the used entries from a slot on, in slot order
+ * @param slot First slot to look at
+ * @param entries Output
+ * @param max Capacity of entries
+ * @param next Set to the slot to continue with, LOCO_TRACKER_CAPACITY at the end
+ * @return Entries copied
+ */
+uint32_t loco_tracker_read(uint32_t slot, LocoTrackerEntry_t *entries, uint32_t max, uint32_t *next);
+
+/**
+ * @brief Look up one address
+ * @param address Short address or long address with LOCO_TRACKER_LONG
+ * @return true if the address was seen
+ */
+bool loco_tracker_find(uint16_t address, LocoTrackerEntry_t *entry);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LOCO_TRACKER_H */
@@ -64,6 +64,9 @@ extern FDCAN_HandleTypeDef hfdcan1;
 void Error_Handler(void);
 void MX_SDMMC1_SD_Init(void);
 void MX_USB_PCD_Init(void);
+void MX_FDCAN1_Init(void);
+void MX_SPI5_Init(void);
+void MX_SPI2_Init(void);
 
 /* USER CODE BEGIN EFP */
 
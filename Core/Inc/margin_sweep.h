@@ -0,0 +1,159 @@
+/**
+ * @file margin_sweep.h
+ * @brief On-device search of the bit timing margins of a decoder
+ *
+ * The sweep finds how far the one and zero bit durations can move away from
+ * the configured timing before the decoder stops responding. Durations are in
+ * TIM2 ticks (1 us) and are sent through the scheduled transmit path, so they
+ * are not bound to the limits of the DCC library. The sweep runs in the
+ * command station thread in custom packet mode (loop=0).
+ *
+ * A trial sends packets commands at the trial timing, preamble included, and
+ * the response detector decides whether the decoder took them:
+ *
+ *   CURRENT  speed command, track current must rise current_delta_ma above
+ *            the rest current measured at the start
+ *   IO       F0 on, the IO inputs masked by io_mask must become io_level
+ *
+ * After every trial the opposite command (stop, F0 off) is sent with the
+ * configured timing and the decoder must be back at rest within settle_ms.
+ *
+ * The configured timing is tried first and must pass. Each enabled edge is
+ * then searched from the configured value towards its limit: the limit is
+ * tried, and if it fails the interval is bisected down to resolution_us,
+ * assuming the decoder accepts everything between the configured value and
+ * the margin. A value passes when trials trials in a row pass.
+ */
+
+#ifndef MARGIN_SWEEP_H
+#define MARGIN_SWEEP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "test_case.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MARGIN_SWEEP_MAX_PACKET     5u      // long address, two instruction bytes, checksum
+#define MARGIN_SWEEP_MAX_US         10000u  // half-bit duration limit of a trial
+#define MARGIN_SWEEP_MAX_TRIALS     10u
+#define MARGIN_SWEEP_MAX_PACKETS    100u
+#define MARGIN_SWEEP_MAX_WAIT_MS    10000u
+
+typedef enum {
+    MARGIN_DETECT_CURRENT = 0,
+    MARGIN_DETECT_IO,
+    MARGIN_DETECT_COUNT
+} MarginDetector_t;
+
+// Edges, bit n of MarginSweepConfig_t.edges
+typedef enum {
+    MARGIN_EDGE_BIT1_MIN = 0,
+    MARGIN_EDGE_BIT1_MAX,
+    MARGIN_EDGE_BIT0_MIN,
+    MARGIN_EDGE_BIT0_MAX,
+    MARGIN_EDGE_COUNT
+} MarginEdge_t;
+
+#define MARGIN_EDGES_ALL            ((1u << MARGIN_EDGE_COUNT) - 1u)
+
+typedef struct {
+    uint16_t address;           // 1-10239, 1-127 are sent as short addresses
+    uint8_t detector;           // MarginDetector_t
+    uint8_t edges;              // bit n = MarginEdge_t n
+    uint8_t speed;              // CURRENT: 128 step speed byte of the command, bit 7 forward
+    uint8_t trials;             // passing trials in a row for a value to pass, 1-MARGIN_SWEEP_MAX_TRIALS
+    uint8_t resolution_us;      // bisection ends when pass and fail are this close
+    uint16_t packets;           // command packets per trial, 1-MARGIN_SWEEP_MAX_PACKETS
+    uint32_t gap_us;            // before each packet, 0 is the preamble only
+    uint16_t timeout_ms;        // response time allowed after the last command packet
+    uint16_t settle_ms;         // time allowed to return to rest
+    uint16_t current_delta_ma;  // CURRENT: rise above the rest current
+    uint16_t io_mask;           // IO: bit 0 = IO1
+    uint16_t io_level;
+    uint16_t limit_us[MARGIN_EDGE_COUNT];   // search limit of each edge
+} MarginSweepConfig_t;
+
+typedef struct {
+    bool searched;
+    bool limited;               // the limit passed, the margin reaches at least that far
+    uint16_t pass_us;           // furthest passing duration
+    uint16_t fail_us;           // closest failing duration, 0 if limited
+    uint16_t trials;
+} MarginEdgeResult_t;
+
+typedef struct {
+    bool running;
+    bool completed;             // every enabled edge was searched
+    uint8_t edge;               // MarginEdge_t being searched
+    uint16_t bit1_us;           // timing of the current/last trial
+    uint16_t bit0_us;
+    uint16_t nominal_bit1_us;   // configured timing at the start
+    uint16_t nominal_bit0_us;
+    uint16_t rest_ma;           // CURRENT: current at rest
+    uint32_t trials;
+    uint32_t elapsed_ms;
+    const char *error;          // why the last sweep ended early, NULL otherwise
+    MarginEdgeResult_t edges[MARGIN_EDGE_COUNT];
+} MarginSweepStatus_t;
+
+/**
+ * @brief Check and store the configuration of the next sweep
+ * @param error Set to a static description on failure (may be NULL)
+ * @return 0 on success, -1 for an invalid configuration or while running
+ */
+int MarginSweep_Configure(const MarginSweepConfig_t *config, const char **error);
+
+/**
+ * @brief Check the stored configuration before a sweep
+ * @param error Set to a static description on failure (may be NULL)
+ * @return 0 on success, -1 on failure
+ */
+int MarginSweep_Prepare(const char **error);
+
+void MarginSweep_GetConfig(MarginSweepConfig_t *config);
+
+/**
+ * @brief Command packet of the sweep
+ * @param active true for the command (speed, F0 on), false for the rest command
+ * @param bytes MARGIN_SWEEP_MAX_PACKET bytes, the packet including its checksum
+ * @return Packet length
+ */
+uint8_t MarginSweep_Command(bool active, uint8_t *bytes);
+
+/**
+ * @brief Detector state of a probe
+ * @return true if the decoder responded to the command / is back at rest
+ */
+bool MarginSweep_Responded(const TestProbe_t *probe);
+bool MarginSweep_AtRest(const TestProbe_t *probe);
+
+/**
+ * @brief Command station thread: sweep bookkeeping
+ *
+ * Start with the configured timing and the rest current, then Next gives the
+ * timing of each trial and Report its outcome until Next returns false.
+ */
+void MarginSweep_Start(uint16_t bit1_us, uint16_t bit0_us, uint16_t rest_ma);
+bool MarginSweep_Next(uint16_t *bit1_us, uint16_t *bit0_us);
+void MarginSweep_Report(bool passed);
+void MarginSweep_End(const char *error);
+
+void MarginSweep_GetStatus(MarginSweepStatus_t *status);
+
+/**
+ * @brief Run the configured sweep (command station must run with loop=0)
+ *
+ * Stopped with CommandStation_StopProgram.
+ * @param error Set to a static description on failure (may be NULL)
+ * @return true if started
+ */
+bool CommandStation_RunMarginSweep(const char **error);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MARGIN_SWEEP_H */
@@ -0,0 +1,86 @@
+/**
+ * @file memory_map.h
+ * @brief Where the RAM went: linker sections and every RTOS object
+ *
+ * The summary splits the RAM region into .data, .bss, the heap and main stack
+ * reserved by the linker script and what is left between the heap and the
+ * main stack. That gap is the room for new buffers (capture, recording) without
+ * touching anything else.
+ *
+ * The objects are taken from the ThreadX created lists (threads, queues,
+ * semaphores, mutexes, event flags, timers, byte and block pools) and the NetX
+ * packet pools, so they include those of USBX, NetX and FileX. An object lies
+ * in a byte pool when its memory was allocated at run time, otherwise it is
+ * static (rtos_static.h, CubeMX pool buffers).
+ */
+
+#ifndef MEMORY_MAP_H
+#define MEMORY_MAP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MEMORY_MAP_NAME_LENGTH  24u
+
+typedef enum {
+    MEMORY_OBJECT_THREAD = 0,
+    MEMORY_OBJECT_QUEUE,
+    MEMORY_OBJECT_SEMAPHORE,
+    MEMORY_OBJECT_MUTEX,
+    MEMORY_OBJECT_EVENT_FLAGS,
+    MEMORY_OBJECT_TIMER,
+    MEMORY_OBJECT_BYTE_POOL,
+    MEMORY_OBJECT_BLOCK_POOL,
+    MEMORY_OBJECT_PACKET_POOL,
+    MEMORY_OBJECT_COUNT
+} MemoryObjectType_t;
+
+typedef struct {
+    char name[MEMORY_MAP_NAME_LENGTH];
+    uint8_t type;               // MemoryObjectType_t
+    const char *pool;           // byte pool holding the memory, NULL if static
+    uint32_t address;           // stack, queue storage or pool area, else the control block
+    uint32_t size;              // bytes, control block included
+    uint32_t used;              // stack high water, queued messages or allocated pool bytes
+} MemoryObject_t;
+
+typedef struct {
+    uint32_t ram_start;
+    uint32_t ram_size;          // up to the top of the main stack
+    uint32_t data_bytes;        // .data, including the code copied to SRAM
+    uint32_t bss_bytes;
+    uint32_t heap_bytes;        // _Min_Heap_Size
+    uint32_t stack_bytes;       // main stack (interrupts)
+    uint32_t free_bytes;        // between the heap and the main stack
+    uint32_t static_bytes;      // RTOS objects outside the byte pools
+    uint32_t pool_bytes;        // byte pool areas
+    uint32_t pool_free_bytes;   // not allocated in the byte pools
+    uint32_t objects;           // RTOS objects
+    bool static_allocation;     // RTOS_STATIC_ALLOCATION
+} MemoryMapSummary_t;
+
+/**
+ * @brief Fill the summary (thread context)
+ */
+void memory_map_summary(MemoryMapSummary_t *summary);
+
+/**
+ * @brief Copy the RTOS objects starting at index first (thread context)
+ *
+ * Indices follow the MemoryObjectType_t order, then creation order, and stay
+ * the same as long as no object is created or deleted.
+ * @return Number of objects copied
+ */
+uint32_t memory_map_objects(uint32_t first, MemoryObject_t *objects, uint32_t max);
+
+const char *memory_map_type_name(MemoryObjectType_t type);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MEMORY_MAP_H */
@@ -0,0 +1,78 @@
+/**
+ * @file netx_rpc_transport.h
+ * @brief RPC over TCP and UDP on the NetXDuo Ethernet interface
+ *
+ * A TCP server on PARAM_NETWORK_PORT (default 2560) accepts one client at a
+ * time, requests are newline terminated JSON as on USB and are answered in
+ * order. Every UDP datagram to the same port carries one request or several
+ * newline separated ones, the responses go back to the sender, a host which
+ * only loads packets may ignore them. Binary frames are USB only.
+ *
+ * Received NX_PACKETs from NxAppPool are posted on the command bus
+ * (rpc_bus.h) as they are and released once handled. Only TCP requests split across segments are
+ * copied, into a reassembly buffer.
+ */
+
+#ifndef NETX_RPC_TRANSPORT_H
+#define NETX_RPC_TRANSPORT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "rpc_transport_types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct NX_PACKET_STRUCT;
+
+typedef struct {
+    const char *data;                  // one or more requests, LF (or CRLF) separated
+    uint32_t length;
+    uint8_t origin;                    // RPC_ORIGIN_TCP or RPC_ORIGIN_UDP
+    uint32_t session;                  // TCP connection the request arrived on
+    uint32_t peer_ip;                  // UDP sender
+    uint16_t peer_port;
+    struct NX_PACKET_STRUCT *packet;   // NULL for the reassembly buffer
+} NetxRpcRequest_t;
+
+typedef struct {
+    uint32_t ip_address;               // 0 until DHCP has completed
+    uint16_t port;
+    bool client_connected;
+    uint32_t connections;              // TCP connections accepted
+    uint32_t requests;                 // buffers handed to the RPC thread
+    uint32_t reassembled;              // of which went through the reassembly buffer
+    uint32_t overflows;                // TCP requests longer than RX_BUFFER_SIZE, discarded
+    uint32_t dropped;                  // UDP datagrams discarded (empty or fragmented)
+    uint32_t tx_errors;                // responses which could not be sent
+} NetxRpcStats_t;
+
+/**
+ * @brief Create the server threads, call after the NetXDuo IP instance exists
+ */
+void NetxRpc_Init(void);
+
+/**
+ * @brief RPC thread: send a response to the origin of request, waits for room in the TCP window
+ * @return false if the client is gone or the data could not be sent
+ */
+bool NetxRpc_Send(const NetxRpcRequest_t *request, const uint8_t *data, uint32_t length);
+
+/**
+ * @brief RPC thread: send an unsolicited message to the TCP client or the last UDP sender
+ */
+void NetxRpc_SendEvent(uint8_t origin, const uint8_t *data, uint32_t length);
+
+/**
+ * @brief RPC thread: return a request and its packet once every response has been sent
+ */
+void NetxRpc_Release(NetxRpcRequest_t *request);
+
+void NetxRpc_GetStats(NetxRpcStats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* NETX_RPC_TRANSPORT_H */
@@ -0,0 +1,88 @@
+/**
+ * @file packet_capture.h
+ * @brief Track current trace around one chosen packet
+ *
+ * Armed with a packet prefix and/or a packet sequence number, the capture
+ * takes the first matching packet the command station sends and keeps the
+ * single track current samples (see analog_manager_current_sample) from
+ * pre_bits one bits before its first preamble bit to window_us after it: a
+ * scope-like trace of the current during that packet, e.g. a decoder's ACK or
+ * load step, aligned to the bits.
+ *
+ * The packet is framed when its end bit starts (command station packet hook),
+ * its start is found back from the sample being taken at that moment and the
+ * nominal bit times of the parameters, so the samples come from the history
+ * of the continuous scan. Resolution is that of the scan (ANALOG_SAMPLE_US),
+ * alignment within one sample. Scheduled packets with their own timing are
+ * placed with the global bit times.
+ *
+ * Requires continuous analog sampling and interrupt driven transmit.
+ */
+
+#ifndef PACKET_CAPTURE_H
+#define PACKET_CAPTURE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PACKET_CAPTURE_MAX_MATCH        6u
+#define PACKET_CAPTURE_MAX_SAMPLES      480u    // 48 ms, one binary response
+#define PACKET_CAPTURE_MAX_BYTES        18u
+
+typedef enum {
+    PACKET_CAPTURE_IDLE = 0,
+    PACKET_CAPTURE_ARMED,           // waiting for the packet
+    PACKET_CAPTURE_TRIGGERED,       // packet sent, window still being sampled
+    PACKET_CAPTURE_DONE,
+    PACKET_CAPTURE_FAILED           // samples overwritten before they were copied
+} PacketCaptureState_t;
+
+typedef struct {
+    uint8_t match[PACKET_CAPTURE_MAX_MATCH];    // packet prefix, match_length 0 = any packet
+    uint8_t match_length;
+    uint32_t packet_seq;            // only this packet sequence number, 0 = any
+    uint16_t pre_bits;              // one bits before the first preamble bit
+    uint32_t window_us;             // from the first preamble bit on
+} PacketCaptureConfig_t;
+
+typedef struct {
+    uint8_t state;                  // PacketCaptureState_t
+    uint32_t packet_seq;
+    uint8_t bytes[PACKET_CAPTURE_MAX_BYTES];
+    uint8_t length;
+    uint32_t packet_us;             // first preamble bit to end bit
+    uint16_t count;                 // samples
+    uint16_t packet_index;          // sample of the first preamble bit
+    uint16_t end_index;             // sample of the end bit
+} PacketCaptureInfo_t;
+
+/**
+ * @brief Arm a capture, replaces the previous one
+ * @return 0 on success, -1 without continuous sampling or if the window exceeds PACKET_CAPTURE_MAX_SAMPLES
+ */
+int packet_capture_arm(const PacketCaptureConfig_t *config);
+
+/**
+ * @brief Stop waiting, a finished capture stays readable
+ */
+void packet_capture_cancel(void);
+
+void packet_capture_get_info(PacketCaptureInfo_t *info);
+
+/**
+ * @brief Copy samples of a finished capture, counts
+ * @return Samples copied, 0 unless the capture is done
+ */
+uint32_t packet_capture_read(uint32_t first, uint16_t *out, uint32_t max);
+
+const char *packet_capture_state_name(PacketCaptureState_t state);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PACKET_CAPTURE_H */
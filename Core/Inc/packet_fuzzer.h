@@ -0,0 +1,146 @@
+/**
+ * @file packet_fuzzer.h
+ * @brief On-device random packet generator for decoder acceptance testing
+ *
+ * The fuzzer generates packets with a xorshift32 generator and feeds them to
+ * the scheduled transmit path from the command station thread (loop=0), so it
+ * runs at full track rate without the host. Packets are drawn from the enabled
+ * classes over an address range, every packet can get its own bit timing
+ * jitter within +-jitter_us, and invalid_percent of them carry a fault
+ * (see packet_timing.h): wrong checksum, flipped bit, short preamble, dropped
+ * or out of spec half-bit.
+ *
+ * A packet only depends on the generator state before it and the
+ * configuration. The log keeps that state for the last PACKET_FUZZ_LOG_SIZE
+ * packets: a run started with the logged state as seed and the same
+ * configuration replays the packet and everything after it.
+ */
+
+#ifndef PACKET_FUZZER_H
+#define PACKET_FUZZER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "packet_timing.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef PACKET_FUZZ_LOG_SIZE
+#define PACKET_FUZZ_LOG_SIZE        64u     // power of two
+#endif
+#define PACKET_FUZZ_MAX_PACKET      7u      // long address, four instruction bytes, checksum
+#define PACKET_FUZZ_MAX_JITTER_US   1000u
+#define PACKET_FUZZ_STRETCH_US      40u     // out of spec half-bits are this much past the jitter
+
+// Packet classes, bit n of PacketFuzzConfig_t.classes
+typedef enum {
+    PACKET_FUZZ_CLASS_IDLE = 0,         // idle and reset packets
+    PACKET_FUZZ_CLASS_SPEED,            // 14/28 and 128 step speed
+    PACKET_FUZZ_CLASS_FUNCTION,         // F0-F28 groups
+    PACKET_FUZZ_CLASS_POM,              // operations mode CV access, long form
+    PACKET_FUZZ_CLASS_ACCESSORY,        // basic accessory, ignores the address range
+    PACKET_FUZZ_CLASS_RANDOM,           // loco address with random instruction bytes
+    PACKET_FUZZ_CLASS_COUNT
+} PacketFuzzClass_t;
+
+#define PACKET_FUZZ_CLASSES_ALL     ((1u << PACKET_FUZZ_CLASS_COUNT) - 1u)
+
+typedef enum {
+    PACKET_FUZZ_FAULT_NONE = 0,
+    PACKET_FUZZ_FAULT_CHECKSUM,
+    PACKET_FUZZ_FAULT_FLIP,             // one bit of the packet inverted
+    PACKET_FUZZ_FAULT_PREAMBLE,         // fewer than 10 preamble bits
+    PACKET_FUZZ_FAULT_DROP,             // one half-bit dropped
+    PACKET_FUZZ_FAULT_STRETCH,          // one half-bit out of spec
+    PACKET_FUZZ_FAULT_COUNT
+} PacketFuzzFault_t;
+
+typedef struct {
+    uint32_t seed;              // 0 picks a seed, reported in the status
+    uint32_t count;             // packets per run, 0 until stopped
+    uint16_t address_min;       // loco addresses 0-10239, 0 is broadcast
+    uint16_t address_max;
+    uint8_t classes;            // bit n = PacketFuzzClass_t n
+    uint8_t invalid_percent;    // 0-100
+    uint8_t profile;            // PacketTimingProfile_t
+    bool trigger_invalid;       // scope trigger on the start bit of invalid packets
+    uint16_t jitter_us;         // half-bit jitter bound, 0-PACKET_FUZZ_MAX_JITTER_US
+    uint32_t gap_min_us;        // gap before each packet, 0 is the preamble only
+    uint32_t gap_max_us;
+} PacketFuzzConfig_t;
+
+typedef struct {
+    uint8_t length;
+    uint8_t flags;              // PACKET_PROGRAM_FLAG_*
+    uint8_t bytes[PACKET_FUZZ_MAX_PACKET];
+    uint32_t gap_us;
+    PacketTiming_t timing;
+} PacketFuzzPacket_t;
+
+typedef struct {
+    uint32_t index;             // packet number in the run, 0 based
+    uint32_t state;             // generator state before the packet, the seed replaying it
+    uint8_t packet_class;       // PacketFuzzClass_t
+    uint8_t fault;              // PacketFuzzFault_t
+    uint8_t length;
+    uint8_t bytes[PACKET_FUZZ_MAX_PACKET];  // as generated, before a checksum fault
+    int16_t deltaP;             // jitter of the P / N halves of the jittered bits
+    int16_t deltaN;
+    uint32_t gap_us;
+} PacketFuzzLogEntry_t;
+
+typedef struct {
+    PacketFuzzConfig_t config;  // seed as used
+    uint32_t state;             // generator state before the next packet
+    uint32_t generated;
+    uint32_t classes[PACKET_FUZZ_CLASS_COUNT];
+    uint32_t faults[PACKET_FUZZ_FAULT_COUNT];   // faults[0]: valid packets
+} PacketFuzzStatus_t;
+
+/**
+ * @brief Create the lock, call once at system init
+ */
+void PacketFuzz_Init(void);
+
+/**
+ * @brief Check and store the configuration of the next run, clears the log and counters
+ * @param error Set to a static description on failure (may be NULL)
+ * @return 0 on success, -1 for an invalid configuration
+ */
+int PacketFuzz_Configure(const PacketFuzzConfig_t *config, const char **error);
+
+/**
+ * @brief Command station thread: restart the configured run from its seed
+ */
+void PacketFuzz_Rewind(void);
+
+/**
+ * @brief Command station thread: generate and log the next packet
+ * @return false once count packets were generated
+ */
+bool PacketFuzz_Next(PacketFuzzPacket_t *packet);
+
+void PacketFuzz_GetStatus(PacketFuzzStatus_t *status);
+
+/**
+ * @brief Copy logged packets from packet index first on, oldest first
+ * @return Number of entries copied
+ */
+uint32_t PacketFuzz_GetLog(uint32_t first, PacketFuzzLogEntry_t *entries, uint32_t max);
+
+/**
+ * @brief Run the configured fuzzer (command station must run with loop=0)
+ *
+ * Stopped with CommandStation_StopProgram, progress in CommandStation_GetProgramStatus.
+ * @param error Set to a static description on failure (may be NULL)
+ * @return true if started
+ */
+bool CommandStation_RunFuzzer(const char **error);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PACKET_FUZZER_H */
@@ -0,0 +1,116 @@
+/**
+ * @file packet_program.h
+ * @brief RAM resident packet programs executed by the command station
+ *
+ * A packet program is a list of entries uploaded over RPC and executed by the
+ * command station thread in custom packet mode (loop=0), so test sequences run
+ * on-device without a host round trip per packet. Packets are sent through the
+ * scheduled transmit path, gaps are therefore exact to one bit time.
+ *
+ * Entries:
+ *   PACKET  send bytes repeat times, gap_us before each transmission,
+ *           optional scope trigger and bit timing (see packet_timing.h)
+ *   DELAY   add gap_us to the gap before the next packet
+ *   LABEL   jump target with id label
+ *   LOOP    jump back to label, repeat times in total (0 = forever)
+ *   END     stop the program
+ */
+
+#ifndef PACKET_PROGRAM_H
+#define PACKET_PROGRAM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "packet_timing.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef PACKET_PROGRAM_MAX_ENTRIES
+#define PACKET_PROGRAM_MAX_ENTRIES   128
+#endif
+#define PACKET_PROGRAM_MAX_PACKET    18   // DCC_MAX_PACKET_SIZE
+
+typedef enum {
+    PACKET_PROGRAM_OP_PACKET = 0,
+    PACKET_PROGRAM_OP_DELAY,
+    PACKET_PROGRAM_OP_LABEL,
+    PACKET_PROGRAM_OP_LOOP,
+    PACKET_PROGRAM_OP_END
+} PacketProgramOp_t;
+
+#define PACKET_PROGRAM_FLAG_TRIGGER   0x01u  // scope trigger on the start bit of this packet
+#define PACKET_PROGRAM_FLAG_OVERRIDE  0x02u  // timing below replaces the global zero bit override
+#define PACKET_PROGRAM_FLAG_ACK       0x04u  // arm the service mode ACK detector on the start bit
+
+typedef struct {
+    uint8_t op;                 // PacketProgramOp_t
+    uint8_t flags;              // PACKET_PROGRAM_FLAG_*
+    uint8_t length;             // packet length
+    uint8_t label;              // LABEL id / LOOP target label id
+    uint16_t repeat;            // PACKET transmissions / LOOP passes (0 = forever)
+    uint16_t target;            // LOOP: resolved index of the target label
+    uint32_t gap_us;            // PACKET: gap before each transmission, DELAY: extra gap
+    uint8_t bytes[PACKET_PROGRAM_MAX_PACKET];
+    PacketTiming_t timing;      // PACKET with PACKET_PROGRAM_FLAG_OVERRIDE
+} PacketProgramEntry_t;
+
+typedef struct {
+    uint16_t entries;           // loaded entries
+    bool running;
+    uint16_t pc;                // entry being executed
+    uint32_t packets_sent;      // packets handed to the track by the last/current run
+} PacketProgramStatus_t;
+
+/**
+ * @brief Discard the loaded program
+ * @return 0 on success, -1 if a program is running
+ */
+int PacketProgram_Clear(void);
+
+/**
+ * @brief Append entries to the loaded program
+ * @param entries Entries to append
+ * @param count Number of entries
+ * @return 0 on success, -1 if running or the program would exceed PACKET_PROGRAM_MAX_ENTRIES
+ */
+int PacketProgram_Append(const PacketProgramEntry_t *entries, uint16_t count);
+
+/**
+ * @brief Resolve loop targets and check the program before a run
+ * @param error Set to a static description if the program is invalid (may be NULL)
+ * @return 0 on success, -1 if invalid
+ */
+int PacketProgram_Prepare(const char **error);
+
+/**
+ * @brief Access the loaded program
+ * @param entries Set to the first entry
+ * @return Number of entries
+ */
+uint16_t PacketProgram_Get(const PacketProgramEntry_t **entries);
+
+/**
+ * @brief Start executing the loaded program (command station must run with loop=0)
+ * @param error Set to a static description on failure (may be NULL)
+ * @return true if started
+ */
+bool CommandStation_RunProgram(const char **error);
+
+/**
+ * @brief Stop a running program after the current packet
+ */
+void CommandStation_StopProgram(void);
+
+/**
+ * @brief Get program execution status
+ * @param status Status output
+ */
+void CommandStation_GetProgramStatus(PacketProgramStatus_t *status);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PACKET_PROGRAM_H */
@@ -0,0 +1,90 @@
+/**
+ * @file packet_stats.h
+ * @brief Packet validation counters of the decoder input
+ *
+ * The sniffer framer runs on every edge of the decoder input while the
+ * decoder runs, recording enabled or not, and reports each packet and each
+ * framing error here. The counters only ever grow on the capture side and
+ * are read and cleared by the RPC thread, all of them are atomics so neither
+ * side takes a lock.
+ *
+ * Checks per packet:
+ *   - checksum (XOR of all bytes)
+ *   - preamble: a start bit after fewer than SNIFFER_MIN_PREAMBLE one bits
+ *     following a complete packet is a short preamble, the packet is lost.
+ *     The shortest preamble of the accepted packets is kept too, a command
+ *     station has to send at least 14 bits (RCN-211).
+ *   - bit timing: each half bit from the start bit to the end bit against the
+ *     decoder acceptance limits of NMRA S-9.1, one 52-64 us, zero 90-10000 us
+ *
+ * Packets with a good checksum are counted by type from their first bytes.
+ */
+
+#ifndef PACKET_STATS_H
+#define PACKET_STATS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PACKET_STATS_ONE_MIN_US     52u
+#define PACKET_STATS_ONE_MAX_US     64u
+#define PACKET_STATS_ZERO_MIN_US    90u
+#define PACKET_STATS_ZERO_MAX_US    10000u
+
+typedef enum {
+    PACKET_STATS_TYPE_IDLE = 0,         // 0xFF 0x00
+    PACKET_STATS_TYPE_RESET,            // 0x00 0x00, decoder reset
+    PACKET_STATS_TYPE_BROADCAST,        // other packets to address 0
+    PACKET_STATS_TYPE_LOCO_SHORT,       // 1-127
+    PACKET_STATS_TYPE_LOCO_LONG,        // 192-231
+    PACKET_STATS_TYPE_ACCESSORY,        // basic accessory, 128-191 with bit 7 of the second byte set
+    PACKET_STATS_TYPE_EXT_ACCESSORY,    // extended accessory, 128-191 with bit 7 clear
+    PACKET_STATS_TYPE_EXTENDED,         // 253-254, logon and automatic address assignment
+    PACKET_STATS_TYPE_RESERVED,         // 232-252
+    PACKET_STATS_TYPE_COUNT
+} PacketStatsType_t;
+
+typedef struct {
+    uint32_t packets;           // framed, good checksum or not
+    uint32_t checksum_errors;
+    uint32_t framing_errors;    // bit pairs or lengths that broke a packet
+    uint32_t short_preambles;
+    uint32_t timing_errors;     // half bits outside the S-9.1 limits
+    uint32_t timing_packets;    // packets with at least one of them
+    uint32_t min_preamble;      // bits, 0 before the first packet
+    uint32_t types[PACKET_STATS_TYPE_COUNT];
+} PacketStats_t;
+
+/**
+ * @brief Count one framed packet (sniffer framer)
+ * @param bytes Packet bytes, checksum included
+ * @param count Number of bytes
+ * @param checksum_ok XOR of all bytes is zero
+ * @param preamble Preamble bits before the start bit
+ * @param halves Half bit durations from the start bit to the end bit
+ * @param half_count Number of halves
+ */
+void packet_stats_packet(const uint8_t *bytes, uint32_t count, bool checksum_ok,
+                         uint32_t preamble, const uint16_t *halves, uint32_t half_count);
+
+void packet_stats_framing_error(void);
+void packet_stats_short_preamble(void);
+
+void packet_stats_get(PacketStats_t *stats);
+
+/**
+ * @brief Clear the counters, packets framed meanwhile may count half
+ */
+void packet_stats_reset(void);
+
+const char *packet_stats_type_name(PacketStatsType_t type);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PACKET_STATS_H */
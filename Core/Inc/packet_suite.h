@@ -0,0 +1,124 @@
+/**
+ * @file packet_suite.h
+ * @brief Precompiled packet suites on the SD card
+ *
+ * A packet suite is a file of test vectors, SUITnnnn.BIN in the root directory
+ * of the SD card, copied there on a PC or uploaded in bulk with
+ * PacketSuite_Write. A run plays every vector through the scheduled transmit
+ * path with the timing profile chosen for the run, without a host round trip.
+ *
+ * Suites up to PACKET_SUITE_BUFFER_SIZE bytes of vectors are read once and
+ * stay in RAM, repeated runs do not touch the card. Larger suites are streamed,
+ * a reader thread keeps the buffer filled ahead of the command station thread.
+ *
+ * File layout, little endian:
+ *   PacketSuiteHeader_t, header_size bytes
+ *   vectors, each: u8 length, u8 flags, u16 repeat, u32 gap_us, u8 bytes[length]
+ * flags are PACKET_PROGRAM_FLAG_TRIGGER / PACKET_PROGRAM_FLAG_ACK, repeat 0
+ * sends the vector once, gap_us 0 uses the suite default gap.
+ */
+
+#ifndef PACKET_SUITE_H
+#define PACKET_SUITE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "packet_timing.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PACKET_SUITE_MAGIC          0x53434344u   // "DCCS"
+#define PACKET_SUITE_VERSION        1u
+#define PACKET_SUITE_VECTOR_HEADER  8u
+#define PACKET_SUITE_MAX_INDEX      9999u
+#ifndef PACKET_SUITE_BUFFER_SIZE
+#define PACKET_SUITE_BUFFER_SIZE    (32u * 1024u)  // bytes, power of two
+#endif
+
+typedef struct {
+    uint32_t magic;             // PACKET_SUITE_MAGIC
+    uint16_t version;
+    uint16_t header_size;       // offset of the first vector
+    uint32_t vectors;
+    uint32_t default_gap_us;
+    char name[16];              // zero padded
+} PacketSuiteHeader_t;
+
+typedef struct {
+    uint8_t length;
+    uint8_t flags;
+    uint16_t repeat;
+    uint32_t gap_us;            // resolved, never 0
+    uint8_t bytes[PACKET_TIMING_MAX_BYTES];
+} PacketSuiteVector_t;
+
+typedef struct {
+    bool loaded;
+    bool resident;              // held in RAM, otherwise streamed
+    uint16_t index;
+    char name[17];
+    uint32_t vectors;
+    uint32_t size;              // bytes of vectors
+    uint32_t vectors_read;      // by the current/last run
+    uint32_t underruns;         // times the command station waited for the card
+} PacketSuiteStatus_t;
+
+/**
+ * @brief Create the reader thread
+ */
+void PacketSuite_Init(void);
+
+/**
+ * @brief SD card mounted or removed (FileX thread)
+ * @param media FX_MEDIA of the card, NULL when removed (unloads the suite)
+ */
+void PacketSuite_SetMedia(void *media);
+
+/**
+ * @brief Load suite index for the next runs (RPC thread, no run in progress)
+ * @param gap_us Default gap replacing the one in the file, 0 keeps it
+ * @param error Set to a static description on failure (may be NULL)
+ * @return 0 on success, -1 on failure
+ */
+int PacketSuite_Load(uint16_t index, uint32_t gap_us, const char **error);
+
+/**
+ * @brief Write part of a suite file, offset 0 starts a new file
+ *
+ * Chunks must be written in order, offset is the current file size.
+ * @return 0 on success, -1 without SD card, -2 on an offset gap, -3 on a write error
+ */
+int PacketSuite_Write(uint16_t index, uint32_t offset, const uint8_t *data, uint32_t length);
+
+/**
+ * @brief Command station thread: restart the loaded suite from its first vector
+ * @return 0 on success, -1 if no suite is loaded
+ */
+int PacketSuite_Rewind(void);
+
+/**
+ * @brief Command station thread: next vector of the suite
+ * @return 1 with a vector, 0 at the end, -1 on a read error or corrupt vector
+ */
+int PacketSuite_Next(PacketSuiteVector_t *vector);
+
+void PacketSuite_GetStatus(PacketSuiteStatus_t *status);
+
+/**
+ * @brief Run the loaded suite (command station must run with loop=0)
+ *
+ * Stopped with CommandStation_StopProgram, progress in CommandStation_GetProgramStatus.
+ * @param profile PacketTimingProfile_t used for every vector
+ * @param loops Passes through the suite, 0 repeats until stopped
+ * @param error Set to a static description on failure (may be NULL)
+ * @return true if started
+ */
+bool CommandStation_RunSuite(uint8_t profile, uint32_t loops, const char **error);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PACKET_SUITE_H */
@@ -0,0 +1,89 @@
+/**
+ * @file packet_timing.h
+ * @brief Per packet bit timing for scheduled transmission
+ *
+ * A scheduled packet is sent with one of the timing profiles below and an optional
+ * override which shifts the half-bit durations of selected bits. Unlike the global
+ * zero bit override mask, which is limited to the first 64 bits of a packet, the
+ * override covers every bit of a maximum length packet and the preamble bits
+ * leading up to its start bit.
+ *
+ * Bit positions count from the packet start bit (0), the same numbering as the
+ * global zerobit_override_mask. Preamble positions count backwards from the start
+ * bit, position 0 is the last preamble bit.
+ *
+ * Fault rules corrupt a packet on purpose: flip the value of bits, stretch or
+ * shrink their halves, drop a half-bit (no edge, the previous level continues
+ * for a single tick), shorten the preamble or corrupt the checksum. Bit rules
+ * cover count positions from first (same numbering as above).
+ *
+ * The timing is expanded into a half-bit duration table when the packet is handed
+ * to the transmit path, so the transmit interrupt only does a table lookup, with
+ * or without faults.
+ */
+
+#ifndef PACKET_TIMING_H
+#define PACKET_TIMING_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PACKET_TIMING_MAX_BYTES       18   // DCC_MAX_PACKET_SIZE
+#define PACKET_TIMING_MAX_BITS        (1 + 9 * PACKET_TIMING_MAX_BYTES)  // start bit, bytes, separators
+#define PACKET_TIMING_PREAMBLE_BITS   32
+#define PACKET_TIMING_MAX_FAULTS      4
+#define PACKET_TIMING_MAX_HALF_US     0x7FFF  // half-bit durations are clamped to 1..this
+
+typedef enum {
+    PACKET_TIMING_PROFILE_CONFIGURED = 0,  // dcc bit1/bit0 duration parameters
+    PACKET_TIMING_PROFILE_NOMINAL,         // 58/100 us
+    PACKET_TIMING_PROFILE_BIT1_MIN,        // one bit halves at the decoder acceptance minimum
+    PACKET_TIMING_PROFILE_BIT1_MAX,        // one bit halves at the decoder acceptance maximum
+    PACKET_TIMING_PROFILE_BIT0_MIN,        // zero bit halves at the decoder acceptance minimum
+    PACKET_TIMING_PROFILE_BIT0_MAX,        // zero bit at the maximum total duration
+    PACKET_TIMING_PROFILE_STRETCHED_ZERO,  // zero bit with one half stretched to the maximum
+    PACKET_TIMING_PROFILE_COUNT
+} PacketTimingProfile_t;
+
+typedef enum {
+    PACKET_FAULT_NONE = 0,
+    PACKET_FAULT_FLIP,               // send the positions with the inverted bit value
+    PACKET_FAULT_STRETCH,            // add value ticks (negative shrinks) to the halves of the positions
+    PACKET_FAULT_DROP,               // drop halves of the positions
+    PACKET_FAULT_TRUNCATE_PREAMBLE,  // at most value preamble bits before the packet
+    PACKET_FAULT_CHECKSUM,           // exclusive or the last byte with value
+    PACKET_FAULT_COUNT
+} PacketFaultType_t;
+
+typedef enum {
+    PACKET_FAULT_HALF_P = 1,
+    PACKET_FAULT_HALF_N = 2,
+    PACKET_FAULT_HALF_BOTH = 3
+} PacketFaultHalf_t;
+
+typedef struct {
+    uint8_t type;            // PacketFaultType_t
+    uint8_t half;            // PacketFaultHalf_t, STRETCH and DROP
+    uint8_t first;           // first position, FLIP, STRETCH and DROP
+    uint8_t count;           // positions from first
+    int16_t value;
+} PacketFault_t;
+
+typedef struct {
+    uint8_t profile;         // PacketTimingProfile_t
+    uint8_t zero_bits_only;  // packet positions only adjust zero bits (preamble positions always apply)
+    uint8_t bits[(PACKET_TIMING_MAX_BITS + 7) / 8];  // overridden packet positions, bit n%8 of byte n/8
+    uint32_t preamble;       // overridden preamble positions
+    int32_t deltaP;          // added to the P half of overridden bits
+    int32_t deltaN;          // added to the N half of overridden bits
+    PacketFault_t faults[PACKET_TIMING_MAX_FAULTS];  // unused entries are PACKET_FAULT_NONE
+} PacketTiming_t;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PACKET_TIMING_H */
@@ -0,0 +1,255 @@
+/**
+ * @file packet_vm.h
+ * @brief Packet VM: test logic as uploaded bytecode, run by the command station
+ *
+ * A VM program is a list of instructions and a table of packets, uploaded over
+ * RPC or read from VMnnnn.BIN in the root directory of the SD card. The command
+ * station thread runs it in custom packet mode (loop=0) without a host round
+ * trip, so a new test procedure needs neither a firmware update nor a host
+ * script pacing it.
+ *
+ * Every instruction is op, a, b, c (u8 each) and imm (i32). The VM has
+ * PACKET_VM_REGISTERS 32-bit registers r0.., all 0 at the start, and a
+ * condition set by the last compare:
+ *
+ *   END     exit with code imm
+ *   SEND    packet a of the table, b PACKET_VM_SEND_*, c + 1 transmissions,
+ *           imm us of gap before each one (scheduled path, exact to a bit time)
+ *   GAP     imm bits (one bit durations) of idle before the next SEND
+ *   WAIT    until the scheduled packets are on the track, then imm bits more
+ *   READ    ra = reading b (PACKET_VM_SRC_*)
+ *   LOAD    ra = imm
+ *   ADD     ra = rb + imm
+ *   ADDR    ra = rb + rc
+ *   SUB     ra = rb - rc
+ *   AND     ra = rb & imm
+ *   SHR     ra = rb >> imm (logical)
+ *   CMP     compare ra with imm (signed)
+ *   CMPR    compare ra with rb (signed)
+ *   BR      branch to imm if condition a (PACKET_VM_COND_*) holds
+ *   DJNZ    ra = ra - 1, branch to imm if ra is not 0
+ *   PATCH   byte b of packet a = rc (low 8 bits), the checksum byte follows
+ *   RECORD  record tag a with c registers from rb (c 1-PACKET_VM_RECORD_VALUES)
+ *
+ * The program is sandboxed: PacketVm_Prepare checks every operand, register,
+ * packet index and branch target before a run, so the interpreter never reads
+ * or writes outside the VM. Patched packets are a copy, the next run starts
+ * from the loaded table. A RailCom SEND returns once the library took its
+ * packets, the program polls the RAILCOM readings for the reply. A program running PACKET_VM_SLICE instructions
+ * without a SEND, GAP or WAIT yields for a millisecond, a polling loop never
+ * holds the command station thread. Records are published by their count, the
+ * host reads the finished ones during a run.
+ *
+ * SD file layout, little endian:
+ *   PacketVmFileHeader_t, header_size bytes
+ *   instructions, PacketVmInstruction_t each
+ *   packets, PacketVmPacket_t each (length, then PACKET_VM_MAX_PACKET bytes)
+ * Packets include their checksum byte, Scripts/Utility/PacketVm.py assembles
+ * a program to the file or to the packet_vm_load parameters.
+ */
+
+#ifndef PACKET_VM_H
+#define PACKET_VM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PACKET_VM_MAGIC             0x56434344u   // "DCCV"
+#define PACKET_VM_VERSION           1u
+#define PACKET_VM_MAX_INDEX         9999u
+#ifndef PACKET_VM_MAX_INSTRUCTIONS
+#define PACKET_VM_MAX_INSTRUCTIONS  512
+#endif
+#define PACKET_VM_MAX_PACKETS       32
+#define PACKET_VM_MAX_PACKET        18   // DCC_MAX_PACKET_SIZE
+#define PACKET_VM_REGISTERS         16
+#define PACKET_VM_MAX_RECORDS       256
+#define PACKET_VM_RECORD_VALUES     4
+#define PACKET_VM_SLICE             256u    // instructions between yields
+#define PACKET_VM_MAX_BITS          1000000 // GAP and WAIT
+#define PACKET_VM_WINDOW_MS         4u      // current and voltage readings, averaged
+
+typedef enum {
+    PACKET_VM_OP_END = 0,
+    PACKET_VM_OP_SEND,
+    PACKET_VM_OP_GAP,
+    PACKET_VM_OP_WAIT,
+    PACKET_VM_OP_READ,
+    PACKET_VM_OP_LOAD,
+    PACKET_VM_OP_ADD,
+    PACKET_VM_OP_ADDR,
+    PACKET_VM_OP_SUB,
+    PACKET_VM_OP_AND,
+    PACKET_VM_OP_SHR,
+    PACKET_VM_OP_CMP,
+    PACKET_VM_OP_CMPR,
+    PACKET_VM_OP_BR,
+    PACKET_VM_OP_DJNZ,
+    PACKET_VM_OP_PATCH,
+    PACKET_VM_OP_RECORD,
+    PACKET_VM_OP_COUNT
+} PacketVmOp_t;
+
+/* SEND flags */
+#define PACKET_VM_SEND_TRIGGER      0x01u   // scope trigger on the start bit
+#define PACKET_VM_SEND_ACK          0x02u   // clear and arm the ACK detector on the first transmission
+#define PACKET_VM_SEND_RAILCOM      0x04u   // through the library, which sends the cutout (BiDi)
+#define PACKET_VM_SEND_ALL          (PACKET_VM_SEND_TRIGGER | PACKET_VM_SEND_ACK | PACKET_VM_SEND_RAILCOM)
+
+typedef enum {
+    PACKET_VM_SRC_CURRENT_MA = 0,   // track current, averaged over PACKET_VM_WINDOW_MS
+    PACKET_VM_SRC_VOLTAGE_MV,       // track voltage, likewise
+    PACKET_VM_SRC_IO,               // IO inputs, bit 0 = IO1
+    PACKET_VM_SRC_RAILCOM_FRAMES,   // valid RailCom frames since the command station started
+    PACKET_VM_SRC_RAILCOM_CH1,      // channel 1 datagram of the last cutout, id << 8 | data, -1 if none
+    PACKET_VM_SRC_ACK,              // ms from arming to the ACK, -1 without an ACK
+    PACKET_VM_SRC_TICK_MS,          // HAL tick
+    PACKET_VM_SRC_PACKETS,          // packets sent by the run
+    PACKET_VM_SRC_COUNT
+} PacketVmSource_t;
+
+typedef enum {
+    PACKET_VM_COND_ALWAYS = 0,
+    PACKET_VM_COND_EQ,
+    PACKET_VM_COND_NE,
+    PACKET_VM_COND_LT,
+    PACKET_VM_COND_LE,
+    PACKET_VM_COND_GT,
+    PACKET_VM_COND_GE,
+    PACKET_VM_COND_COUNT
+} PacketVmCond_t;
+
+typedef struct {
+    uint8_t op;                 // PacketVmOp_t
+    uint8_t a;
+    uint8_t b;
+    uint8_t c;
+    int32_t imm;
+} PacketVmInstruction_t;
+
+typedef struct {
+    uint8_t length;             // checksum included
+    uint8_t bytes[PACKET_VM_MAX_PACKET];
+} PacketVmPacket_t;
+
+typedef struct {
+    uint32_t magic;             // PACKET_VM_MAGIC
+    uint16_t version;
+    uint16_t header_size;       // offset of the first instruction
+    uint16_t instructions;
+    uint16_t packets;
+    char name[16];              // zero padded
+} PacketVmFileHeader_t;
+
+typedef struct {
+    uint16_t pc;                // of the RECORD instruction
+    uint8_t tag;
+    uint8_t count;              // values
+    uint32_t tick_ms;
+    int32_t values[PACKET_VM_RECORD_VALUES];
+} PacketVmRecord_t;
+
+typedef struct {
+    uint16_t instructions;      // loaded
+    uint16_t packets;
+    int32_t file;               // VMnnnn.BIN the program was read from, -1 if uploaded
+    char name[17];
+    bool running;
+    uint16_t pc;
+    uint32_t executed;          // instructions of the last/current run
+    uint32_t yields;
+    uint32_t records;
+    uint32_t dropped;           // records beyond PACKET_VM_MAX_RECORDS
+    int32_t exit_code;          // END imm, 0 if the run fell off the end or was stopped
+    bool stopped;               // by a stop request or a command station stop
+    uint32_t elapsed_ms;        // duration of the last/current run
+    int32_t registers[PACKET_VM_REGISTERS];  // at the end of the last run
+} PacketVmStatus_t;
+
+/**
+ * @brief Create the file lock, called before the FileX thread mounts the card
+ */
+void PacketVm_Init(void);
+
+/**
+ * @brief SD card mounted or removed (FileX thread)
+ * @param media FX_MEDIA of the card, NULL when removed
+ */
+void PacketVm_SetMedia(void *media);
+
+/**
+ * @brief Discard the loaded program
+ * @return 0 on success, -1 while running
+ */
+int PacketVm_Clear(void);
+
+/**
+ * @brief Append instructions and packets to the loaded program
+ * @return 0 on success, -1 while running or beyond the limits
+ */
+int PacketVm_Append(const PacketVmInstruction_t *instructions, uint16_t count,
+                    const PacketVmPacket_t *packets, uint16_t packet_count);
+
+/**
+ * @brief Replace the loaded program with VMnnnn.BIN (RPC thread, no run in progress)
+ * @param error Set to a static description on failure (may be NULL)
+ * @return 0 on success, -1 on failure
+ */
+int PacketVm_LoadFile(uint16_t index, const char **error);
+
+/**
+ * @brief Verify the loaded program before a run
+ * @param error Set to a static description on failure (may be NULL)
+ * @param pc Set to the offending instruction on failure (may be NULL)
+ * @return 0 on success, -1 on failure
+ */
+int PacketVm_Prepare(const char **error, uint16_t *pc);
+
+/**
+ * @brief Loaded program (command station thread while running)
+ * @return Number of instructions
+ */
+uint16_t PacketVm_Get(const PacketVmInstruction_t **instructions, const PacketVmPacket_t **packets,
+                      uint16_t *packet_count);
+
+/**
+ * @brief Reading of a READ instruction, source PACKET_VM_SRC_* (command station thread)
+ * @param packets_sent Packets sent by the run so far
+ */
+int32_t PacketVm_Read(uint8_t source, uint32_t packets_sent);
+
+/**
+ * @brief Command station thread: run bookkeeping
+ */
+void PacketVm_RunStart(void);
+void PacketVm_RunPc(uint16_t pc, uint32_t executed, uint32_t yields);
+void PacketVm_AddRecord(const PacketVmRecord_t *record);
+void PacketVm_RunEnd(int32_t exit_code, bool stopped, const int32_t *registers);
+
+/**
+ * @brief Copy records of the last/current run starting at index first
+ * @return Number of records copied
+ */
+uint32_t PacketVm_GetRecords(uint32_t first, PacketVmRecord_t *records, uint32_t max);
+
+void PacketVm_GetStatus(PacketVmStatus_t *status);
+
+/**
+ * @brief Run the loaded VM program (command station must run with loop=0)
+ *
+ * Stopped with CommandStation_StopProgram.
+ * @param error Set to a static description on failure (may be NULL)
+ * @param pc Set to the instruction the verifier refused (may be NULL)
+ * @return true if started
+ */
+bool CommandStation_RunVm(const char **error, uint16_t *pc);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PACKET_VM_H */
@@ -32,6 +32,7 @@ typedef enum {
     PARAM_DCC_BIT0_DURATION,
     PARAM_DCC_BIDI_ENABLE,
     PARAM_DCC_TRIGGER_FIRST_BIT,
+    PARAM_DCC_DMA_TRANSMIT,
     PARAM_DCC_SHORT_CIRCUIT_THRESHOLD,
     PARAM_DCC_BIDI_DAC,
     PARAM_DCC_ZEROBIT_OVERRIDE_MASK,
@@ -58,6 +59,39 @@ typedef enum {
     PARAM_COUNT
 } ParameterId;
 
+/**
+ * @brief Where a parameter is stored and which values it accepts
+ */
+typedef struct {
+    const char *name;   // field name, used by the parameters_get/parameters_set RPCs
+    uint16_t offset;    // byte offset in the parameter block
+    uint8_t size;       // 1, 2 or 4 bytes, 0 if not stored by the parameter manager
+    uint32_t min;
+    uint32_t max;
+} ParameterDescriptor_t;
+
+/**
+ * @brief Flash change log counters
+ */
+typedef struct {
+    uint32_t records;            // change records behind the image in flash
+    uint32_t capacity;           // change records that fit before the sector is rewritten
+    uint32_t erases;             // sector erases since boot
+    uint32_t last_save_records;  // records appended by the last save, 0 if it rewrote the image
+} ParameterFlashStats_t;
+
+#define PARAM_PROFILE_SLOTS         7u      // EDATA sectors behind the parameter sector
+#define PARAM_PROFILE_NAME_LENGTH   24u     // including the terminator
+
+/**
+ * @brief RAM only parameters kept in a profile (command station zero bit overrides)
+ */
+typedef struct {
+    uint64_t zerobit_override_mask;
+    int32_t zerobit_deltap;
+    int32_t zerobit_deltan;
+} ParameterOverrides_t;
+
 /**
  * @brief Initialize the parameter manager
  * 
@@ -119,6 +153,67 @@ int parameter_manager_restore(void);
  */
 void parameter_manager_factory_reset(void);
 
+/**
+ * @brief Get the flash change log counters
+ */
+void parameter_manager_get_flash_stats(ParameterFlashStats_t *stats);
+
+/**
+ * @brief Call first in NMI_Handler
+ *
+ * Restoring probes the change log for its end, which raises an ECC error on
+ * the first erased halfword.
+ *
+ * @return 1 if the NMI was that probe and has been cleared, 0 otherwise
+ */
+int parameter_manager_flash_nmi(void);
+
+/**
+ * @brief Store the parameters in RAM and the overrides as a named profile
+ *
+ * Erases and programs the slot's own sector, the saved parameters and the
+ * other slots are not touched.
+ *
+ * @param slot 0 to PARAM_PROFILE_SLOTS - 1
+ * @param name 1 to PARAM_PROFILE_NAME_LENGTH - 1 characters
+ * @return 0 on success, -1 on failure
+ */
+int parameter_profile_save(uint32_t slot, const char *name, const ParameterOverrides_t *overrides);
+
+/**
+ * @brief Replace the parameters in RAM by a profile, flash is not written
+ *
+ * The parameter block is copied with preemption disabled, no thread sees a
+ * mix of two profiles. The caller applies the overrides.
+ *
+ * @return 0 on success, -1 if the slot is empty or corrupt
+ */
+int parameter_profile_activate(uint32_t slot, ParameterOverrides_t *overrides);
+
+/**
+ * @brief Name of the profile in a slot
+ * @param name Buffer of PARAM_PROFILE_NAME_LENGTH bytes
+ * @return 0 on success, -1 if the slot is empty
+ */
+int parameter_profile_get_name(uint32_t slot, char *name);
+
+/**
+ * @return Slot holding the profile, -1 if there is none by that name
+ */
+int parameter_profile_find(const char *name);
+
+/**
+ * @brief Erase a profile slot
+ * @return 0 on success, -1 on failure
+ */
+int parameter_profile_delete(uint32_t slot);
+
+/* Generic parameter access, O(1) through the descriptor table */
+const ParameterDescriptor_t *parameter_get_descriptor(ParameterId id);
+ParameterId parameter_find(const char *name);   // PARAM_COUNT if unknown
+int parameter_get(ParameterId id, uint32_t *value);
+int parameter_set(ParameterId id, uint32_t value);
+
 /* Individual parameter accessors */
 int set_dcc_track_voltage(uint16_t voltage_mv);
 int get_dcc_track_voltage(uint16_t *voltage_mv);
@@ -141,6 +236,15 @@ int get_dcc_bidi_dac(uint16_t *dac_value);
 int set_dcc_trigger_first_bit(uint8_t enable);
 int get_dcc_trigger_first_bit(uint8_t *enable);
 
+int set_dcc_dma_transmit(uint8_t enable);
+int get_dcc_dma_transmit(uint8_t *enable);
+
+int set_system_debug_level(uint8_t level);
+int get_system_debug_level(uint8_t *level);
+
+int set_network_port(uint16_t port);
+int get_network_port(uint16_t *port);
+
 /**
  * @brief Usage Notes:
  * 
@@ -152,21 +256,25 @@ int get_dcc_trigger_first_bit(uint8_t *enable);
  * FLASH PERSISTENCE:
  * ------------------
  * - Parameters are stored in the first flash sector
- * - Automatic wear leveling for flash longevity
+ * - save() appends a record per changed parameter, the sector is only
+ *   erased and rewritten when the records fill it
  * - CRC32 validation ensures data integrity
  * - Call save() to persist changes to flash
  * - Call restore() to load from flash
+ * - Up to PARAM_PROFILE_SLOTS named profiles, one sector each, switch the
+ *   whole configuration in RAM with parameter_profile_activate()
+ * - factory_reset() erases the profiles as well
  * 
  * MEMORY USAGE:
  * -------------
  * - ~2KB RAM for parameter cache
- * - 6KB flash for persistent storage
+ * - 6KB flash for persistent storage, 6KB per profile slot
  * 
  * TYPICAL USAGE PATTERN:
  * ----------------------
  * 1. Initialize: parameter_manager_init(0)
- * 2. Read params: getParameter()
- * 3. Modify params: setParameter()
+ * 2. Read params: get_*() or parameter_get()
+ * 3. Modify params: set_*() or parameter_set() (range checked)
  * 4. Save to flash: parameter_manager_save()
  * 5. On next boot: parameter_manager_init(0) restores automatically
  */
@@ -0,0 +1,72 @@
+/**
+ * @file power_idle.h
+ * @brief Sleep in the RTOS idle loop while no test runs
+ *
+ * ThreadX calls the low power hooks (TX_LOW_POWER) from its scheduler loop
+ * when no thread is ready, with interrupts disabled. tx_low_power_enter
+ * executes WFI there, the core stops until the next interrupt (SysTick at the
+ * latest) and the pending interrupt is serviced once the scheduler enables
+ * interrupts again. The tick keeps running, RTOS timeouts are unchanged.
+ *
+ * Wake up from WFI adds a few cycles of latency to the first interrupt, so
+ * every subsystem which timestamps interrupts while it runs holds the sleep
+ * off: the command station (transmit half bits, packet hooks), the decoder
+ * (input capture) and the GPIO edge capture. With none of them running the
+ * tester idles asleep between runs.
+ *
+ * The time asleep is measured on SysTick, which keeps counting in sleep mode.
+ * Cycles the DWT counter missed meanwhile are credited to the profiler idle
+ * time, so the load figures stay consistent whether or not it stops.
+ */
+
+#ifndef POWER_IDLE_H
+#define POWER_IDLE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    POWER_IDLE_HOLD_COMMAND_STATION = 0,
+    POWER_IDLE_HOLD_DECODER,
+    POWER_IDLE_HOLD_CAPTURE,    // GPIO edge capture
+    POWER_IDLE_HOLD_COUNT
+} PowerIdleHold_t;
+
+typedef struct {
+    bool enabled;
+    uint32_t holds;             // bit per PowerIdleHold_t
+    uint32_t sleeps;            // WFI executed
+    uint32_t skipped;           // idle entries held off or disabled
+    uint64_t asleep_cycles;     // CPU cycles, from SysTick
+    uint32_t cpu_hz;
+} PowerIdleStats_t;
+
+/**
+ * @brief Allow or forbid the idle sleep, allowed from boot
+ */
+void power_idle_enable(bool enable);
+
+/**
+ * @brief Hold the sleep off while a subsystem runs (any context)
+ */
+void power_idle_hold(PowerIdleHold_t hold, bool active);
+
+void power_idle_stats(PowerIdleStats_t *stats);
+
+const char *power_idle_hold_name(PowerIdleHold_t hold);
+
+/**
+ * @brief Scheduler idle loop hooks, interrupts disabled
+ */
+void tx_low_power_enter(void);
+void tx_low_power_exit(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* POWER_IDLE_H */
@@ -0,0 +1,74 @@
+/**
+ * @file priority_profile.h
+ * @brief Thread priorities and preemption thresholds switchable at run time
+ *
+ * A profile is a list of thread names with a ThreadX priority (0 is highest)
+ * and preemption threshold. Only threads with a priority above the threshold
+ * of the running thread preempt it, a threshold equal to the priority is plain
+ * preemptive scheduling. Threads a profile does not name keep the priority
+ * they were created with, so does a thread created after the profile was
+ * applied until the next apply. "default" restores the built-in settings of
+ * every thread seen so far.
+ *
+ * The latency probe measures what a profile does to a thread woken by the
+ * RTOS tick: it sleeps one tick at a time at the priority under test and
+ * reads how long ago SysTick reloaded when it runs again. Busy higher
+ * priority threads, preemption thresholds and interrupt time all add to it.
+ */
+
+#ifndef PRIORITY_PROFILE_H
+#define PRIORITY_PROFILE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PRIORITY_PROFILE_MAX_THREADS    32u     // threads whose built-in settings are kept
+#define PRIORITY_PROFILE_LOWEST         63u     // TX_MAX_PRIORITIES - 1
+
+typedef struct {
+    uint32_t samples;
+    uint32_t late;              // woken more than a tick late
+    uint32_t min_cycles;        // UINT32_MAX without samples
+    uint32_t max_cycles;
+    uint64_t sum_cycles;
+    uint32_t cpu_hz;
+    uint8_t priority;
+    bool running;
+} PriorityProbeStats_t;
+
+void priority_profile_init(void);
+
+/**
+ * @brief Apply a profile by name
+ * @return 0 on success, -1 for an unknown profile, -2 if a setting was refused
+ */
+int priority_profile_apply(const char *name);
+
+/**
+ * @brief Change one thread, the active profile becomes "custom"
+ * @return 0 on success, -1 for an unknown thread, -2 for a threshold below the priority
+ *         number or a priority out of range, -3 if the kernel refused it
+ */
+int priority_profile_set(const char *thread, uint8_t priority, uint8_t threshold);
+
+const char *priority_profile_active(void);
+uint32_t priority_profile_count(void);
+const char *priority_profile_name(uint32_t index);
+
+/**
+ * @brief Restart the latency probe at a ThreadX priority
+ * @return false for a priority out of range
+ */
+bool priority_probe_start(uint8_t priority);
+void priority_probe_stop(void);
+void priority_probe_stats(PriorityProbeStats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PRIORITY_PROFILE_H */
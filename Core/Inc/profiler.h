@@ -0,0 +1,113 @@
+/**
+ * @file profiler.h
+ * @brief Per thread CPU load, interrupt time and stack high water marks
+ *
+ * ThreadX calls the execution change hooks (TX_ENABLE_EXECUTION_CHANGE_NOTIFY)
+ * on every context switch, the profiler charges the DWT cycles of each slice to
+ * the thread that ran it. Instrumented interrupts (SysTick and the handlers
+ * which call profiler_isr_enter/exit) are charged to "isr" instead of the
+ * thread they interrupted, time without a ready thread to "idle". Interrupts
+ * which are not instrumented stay in the interrupted thread's count.
+ *
+ * Counters run from kernel start or the last profiler_reset(). A single slice
+ * longer than one wrap of the cycle counter (about 17 s at 250 MHz) is
+ * undercounted.
+ *
+ * Stack high water marks come from the ThreadX stack fill pattern, the deepest
+ * word which no longer holds 0xEFEFEFEF.
+ */
+
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PROFILER_MAX_THREADS    24u
+#define PROFILER_NAME_LENGTH    16u
+
+typedef enum {
+    PROFILER_ISR_TIM2 = 0,      // DCC transmit half bits
+    PROFILER_ISR_TIM15,         // decoder input capture
+    PROFILER_ISR_COUNT
+} ProfilerIsr_t;
+
+typedef struct {
+    char name[PROFILER_NAME_LENGTH];
+    uint8_t priority;           // ThreadX priority, 0 is highest
+    uint8_t threshold;          // preemption threshold, equal to priority unless set
+    uint8_t state;              // TX_READY, TX_SUSPENDED, ...
+    uint32_t stack_size;        // bytes
+    uint32_t stack_used;        // high water mark, bytes
+    uint64_t cycles;
+} ProfilerThread_t;
+
+typedef struct {
+    uint32_t count;
+    uint32_t max_cycles;        // longest single run
+    uint64_t cycles;
+} ProfilerIsrStats_t;
+
+typedef struct {
+    uint32_t cpu_hz;            // SystemCoreClock, cycles per second
+    uint64_t total_cycles;      // threads + isr + idle
+    uint64_t isr_cycles;        // all instrumented interrupts, nesting counted once
+    uint64_t idle_cycles;
+    uint32_t thread_count;      // entries in threads
+    uint32_t threads_missing;   // threads beyond PROFILER_MAX_THREADS
+    ProfilerThread_t threads[PROFILER_MAX_THREADS];
+    ProfilerIsrStats_t isr[PROFILER_ISR_COUNT];
+} ProfilerSnapshot_t;
+
+/**
+ * @brief Restart all counters, stack high water marks are not reset
+ */
+void profiler_reset(void);
+
+/**
+ * @brief Copy the counters of every thread and interrupt (thread context)
+ */
+void profiler_snapshot(ProfilerSnapshot_t *snapshot);
+
+/**
+ * @brief Stack high water mark, from the deepest overwritten word to the top
+ * @return Bytes used
+ */
+uint32_t profiler_stack_used(const void *start, uint32_t size);
+
+/**
+ * @brief First statement of an instrumented interrupt handler
+ * @return Start cycle, for profiler_isr_exit
+ */
+uint32_t profiler_isr_enter(void);
+
+/**
+ * @brief Last statement of an instrumented interrupt handler
+ */
+void profiler_isr_exit(ProfilerIsr_t isr, uint32_t start);
+
+/**
+ * @brief Idle loop, interrupts disabled: cycles which passed without the cycle counter (sleep)
+ */
+void profiler_idle_add(uint32_t cycles);
+
+/**
+ * @brief Share of the total in tenths of a percent
+ */
+uint32_t profiler_permille(uint64_t cycles, uint64_t total);
+
+const char *profiler_isr_name(ProfilerIsr_t isr);
+
+/**
+ * @brief "ready", "sleep", "mutex", ... for ProfilerThread_t state
+ */
+const char *profiler_thread_state_name(uint8_t state);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PROFILER_H */
@@ -0,0 +1,135 @@
+/**
+ * @file railcom.h
+ * @brief RailCom (BiDi) receiver of the command station
+ *
+ * UART4 receives the cutout at 250 kbaud by DMA. The transfer is armed when the
+ * cutout starts, the byte count at the start of channel 2 splits the data into
+ * channel 1 and channel 2, and at the end of the cutout the bytes are 4-of-8
+ * decoded (RCN-217 / S-9.3.2) into a frame which is queued in a lock-free ring.
+ * Frames are read out in batches by the RPC thread.
+ *
+ * Each frame carries the sequence number of the packet that preceded the cutout,
+ * counted from the start of the command station, so replies can be matched to
+ * the packets sent. Cutouts in which nothing was received are only counted.
+ */
+
+#ifndef RAILCOM_H
+#define RAILCOM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef RAILCOM_RING_SIZE
+#define RAILCOM_RING_SIZE        128    // frames, power of two
+#endif
+#define RAILCOM_CH1_BYTES        2
+#define RAILCOM_CH2_BYTES        6
+#define RAILCOM_MAX_BYTES        (RAILCOM_CH1_BYTES + RAILCOM_CH2_BYTES)
+
+/* Decoded symbols: 0-63 data, otherwise one of these */
+#define RAILCOM_SYMBOL_ACK       0x40u
+#define RAILCOM_SYMBOL_NACK      0x41u
+#define RAILCOM_SYMBOL_BUSY      0x42u
+#define RAILCOM_SYMBOL_INVALID   0xFFu  // not a 4-of-8 code
+
+/* Frame flags */
+#define RAILCOM_FLAG_INVALID     0x01u  // at least one invalid symbol
+#define RAILCOM_FLAG_UART_ERROR  0x02u  // framing, noise or overrun error during the cutout
+
+/* Outcome of the most recent cutout, see railcom_last_cutout() */
+#define RAILCOM_RESULT_NONE      0u     // no cutout since the start
+#define RAILCOM_RESULT_EMPTY     1u     // nothing received
+#define RAILCOM_RESULT_OK        2u     // frame queued, all symbols valid
+#define RAILCOM_RESULT_INVALID   3u     // frame queued with invalid symbols or UART errors
+#define RAILCOM_RESULT_DROPPED   4u     // ring full
+
+typedef struct {
+    uint32_t packet_seq;                 // packet preceding the cutout
+    uint32_t tick_ms;                    // HAL tick at the end of the cutout
+    uint8_t ch1_count;                   // symbols received in channel 1
+    uint8_t ch2_count;                   // symbols received in channel 2
+    uint8_t flags;                       // RAILCOM_FLAG_*
+    uint8_t ch1[RAILCOM_CH1_BYTES];      // decoded symbols
+    uint8_t ch2[RAILCOM_CH2_BYTES];
+} RailcomFrame_t;
+
+typedef struct {
+    uint32_t cutouts;                    // cutouts listened to
+    uint32_t frames;                     // frames queued
+    uint32_t empty;                      // cutouts without data
+    uint32_t dropped;                    // frames lost because the ring was full
+    uint32_t invalid;                    // frames with invalid symbols
+    uint32_t pending;                    // frames waiting to be read
+    uint32_t high_water;                 // maximum ring fill level
+} RailcomStats_t;
+
+/**
+ * @brief Enable UART4 reception and set up the receive DMA channel
+ * @return 0 on success, -1 on failure
+ */
+int railcom_init(void);
+
+/**
+ * @brief Forget queued frames and clear the statistics (command station start)
+ *
+ * Must not run concurrently with railcom_read().
+ */
+void railcom_reset(void);
+
+/**
+ * @brief Cutout started, arm reception (transmit interrupt)
+ */
+void railcom_cutout_start(void);
+
+/**
+ * @brief Channel 2 window started (transmit interrupt)
+ */
+void railcom_channel2_start(void);
+
+/**
+ * @brief Cutout ended, decode and queue what was received (transmit interrupt)
+ * @param packet_seq Sequence number of the packet preceding the cutout
+ */
+void railcom_cutout_end(uint32_t packet_seq);
+
+/**
+ * @brief Take queued frames, oldest first
+ * @param frames Output array
+ * @param max Capacity of frames
+ * @return Number of frames copied
+ */
+uint32_t railcom_read(RailcomFrame_t *frames, uint32_t max);
+
+/**
+ * @brief Get receiver statistics
+ * @param stats Statistics output
+ */
+void railcom_get_stats(RailcomStats_t *stats);
+
+/**
+ * @brief Outcome of the most recent cutout without taking frames from the ring (ISR safe)
+ * @param packet_seq Set to the packet preceding that cutout (may be NULL)
+ * @param ch1 Set to the channel 1 datagram, id in bits 8-11, data in bits 0-7,
+ *            0xFFFF if channel 1 did not hold a valid datagram (may be NULL)
+ * @return RAILCOM_RESULT_*
+ */
+uint8_t railcom_last_cutout(uint32_t *packet_seq, uint16_t *ch1);
+
+/**
+ * @brief Channel 1 datagram of a frame (12 bits: 4 bit id, 8 bit data)
+ * @param frame Frame
+ * @param id Set to the datagram id
+ * @param data Set to the datagram data
+ * @return true if channel 1 holds two data symbols
+ */
+bool railcom_channel1_datagram(const RailcomFrame_t *frame, uint8_t *id, uint8_t *data);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* RAILCOM_H */
@@ -0,0 +1,135 @@
+/**
+ * @file recorder.h
+ * @brief Recording to the SD card
+ *
+ * Records the track analog buckets, the packets sent by the command station
+ * and the packets seen by the decoder input (sniffer) into binary files on the
+ * SD card, for runs too long or too fast to stream over USB.
+ *
+ * The producers (ADC DMA interrupt, command station transmit interrupt) push
+ * fixed size entries into lock-free rings. A fill thread packs them into one of
+ * two sector aligned blocks, a writer thread writes full blocks with a single
+ * fx_file_write each while the other block is being filled. Files are rotated
+ * once they reach the size limit.
+ *
+ * File layout, little endian, see RecorderFileHeader_t:
+ *   offset 0            header, RECORDER_HEADER_SIZE bytes
+ *   offset 512 + n * RECORDER_BLOCK_SIZE   block n
+ * Block:
+ *   RecorderBlockHeader_t, then records up to used bytes, zero filled
+ * Record:
+ *   u16 length (header included, without padding), u8 channel, u8 flags,
+ *   payload; the next record starts at the next multiple of 4
+ * Payloads:
+ *   RECORDER_CHANNEL_ANALOG   u32 bucket (1 ms), u16 voltage_mv, u16 current_ma
+ *   RECORDER_CHANNEL_PACKETS  u32 cycles (DWT), u32 packet_seq, u8 bytes[]
+ *   RECORDER_CHANNEL_DECODER  sniffer records, see sniffer.h
+ */
+
+#ifndef RECORDER_H
+#define RECORDER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define RECORDER_MAGIC              0x52434344u   // "DCCR"
+#define RECORDER_BLOCK_MAGIC        0x4B4C4244u   // "DBLK"
+#define RECORDER_VERSION            2u
+#define RECORDER_HEADER_SIZE        512u          // one sector
+#define RECORDER_BLOCK_SIZE         (32u * 512u)  // bytes per write
+#define RECORDER_DEFAULT_FILE_MB    1024u
+#define RECORDER_MAX_FILE_MB        4000u         // FAT32 file size limit
+
+/* Channels, also the bits of the channel mask */
+#define RECORDER_CHANNEL_ANALOG     0u
+#define RECORDER_CHANNEL_PACKETS    1u
+#define RECORDER_CHANNEL_DECODER    2u
+#define RECORDER_CHANNELS           3u
+
+/* Record flags */
+#define RECORDER_FLAG_LOST          0x01u         // records of this channel were lost before this one
+
+typedef struct {
+    uint8_t id;                 // RECORDER_CHANNEL_*
+    uint8_t enabled;
+    uint16_t payload_size;      // fixed payload size, 0 if variable
+    char name[12];
+} RecorderChannel_t;
+
+typedef struct {
+    uint32_t magic;             // RECORDER_MAGIC
+    uint16_t version;
+    uint16_t header_size;       // RECORDER_HEADER_SIZE
+    uint32_t block_size;        // RECORDER_BLOCK_SIZE
+    uint32_t file_index;        // RECnnnnn.BIN
+    uint32_t blocks;            // written on close, 0 if the file was not closed
+    uint32_t start_tick_ms;
+    uint32_t cycle_hz;          // DWT cycle counter rate
+    uint32_t channel_mask;
+    uint16_t channel_count;
+    uint16_t time_source;       // TimebaseSource_t at the start, see timebase.h
+    RecorderChannel_t channels[RECORDER_CHANNELS];
+    uint64_t start_time_ns;     // UTC in ns since 1970 at start_tick_ms
+} RecorderFileHeader_t;
+
+typedef struct {
+    uint32_t magic;             // RECORDER_BLOCK_MAGIC
+    uint32_t seq;               // block number since the recording started
+    uint32_t tick_ms;           // when the block was started
+    uint32_t cycles;            // DWT cycle counter when the block was started
+    uint16_t used;              // bytes of records, header included
+    uint16_t records;
+    uint32_t lost;              // records lost since the previous block
+    uint64_t time_ns;           // UTC in ns since 1970 at cycles
+} RecorderBlockHeader_t;
+
+typedef struct {
+    bool active;
+    bool media;                 // SD card mounted
+    uint32_t channel_mask;
+    uint32_t file_index;        // file being written
+    uint32_t files;             // files opened since start
+    uint32_t blocks;            // blocks written since start
+    uint64_t bytes;             // bytes written since start
+    uint32_t records;           // records packed since start
+    uint32_t lost;              // records lost: ring full, no free block
+    uint32_t write_errors;
+} RecorderStats_t;
+
+/**
+ * @brief Create the fill and writer threads
+ */
+void recorder_init(void);
+
+/**
+ * @brief SD card mounted or removed (FileX thread)
+ * @param media FX_MEDIA of the card, NULL when removed (stops a recording)
+ */
+void recorder_set_media(void *media);
+
+/**
+ * @brief Start recording into a new file
+ * @param channel_mask Channels to record, bit RECORDER_CHANNEL_*
+ * @param max_file_mb Size at which the next file is started
+ * @param widths Decoder channel: record half bit durations
+ * @return 0 on success, -1 without SD card, -2 if the analog channel needs
+ *         continuous sampling, -3 if already recording
+ */
+int recorder_start(uint32_t channel_mask, uint32_t max_file_mb, bool widths);
+
+/**
+ * @brief Stop recording, writes the last block and closes the file
+ */
+void recorder_stop(void);
+
+void recorder_get_stats(RecorderStats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* RECORDER_H */
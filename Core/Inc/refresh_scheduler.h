@@ -0,0 +1,111 @@
+/**
+ * @file refresh_scheduler.h
+ * @brief Operations mode packet scheduler: new commands by priority, refresh in between
+ *
+ * The scheduler keeps speed and function state (F0-F28) of up to
+ * REFRESH_MAX_ADDRESSES locomotives. A change queues a command in a binary
+ * heap ordered by priority (emergency stop, speed, functions) and arrival, so
+ * insert and take are O(log n). A new command goes out REFRESH_COMMAND_REPEATS
+ * times; the repeats wait for the first transmission of every other command
+ * (emergency stops excepted), which spreads them over the other addresses.
+ * When no command is due the scheduler refreshes the addresses round robin:
+ * speed on every second visit of an address, the function groups in use in
+ * turn on the others.
+ *
+ * Packets to the same address are at least REFRESH_ADDRESS_GAP_MS apart (NMRA
+ * S-9.2.4), measured when they are handed to the command station. With a
+ * single address the gap shows as idle packets in between.
+ *
+ * The command station thread takes packets with refresh_next() whenever the
+ * library queue has room; every other function can be called from any thread.
+ */
+
+#ifndef REFRESH_SCHEDULER_H
+#define REFRESH_SCHEDULER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define REFRESH_MAX_ADDRESSES       256u
+#define REFRESH_COMMAND_REPEATS     3u      // transmissions of a new command before it only refreshes
+#define REFRESH_ADDRESS_GAP_MS      5u
+#define REFRESH_MAX_ADDRESS         10239u  // long address range, 1-127 are sent as short addresses
+#define REFRESH_PACKET_MAX          6u      // long address, two instruction bytes, checksum
+
+// Speed byte of the 128 step command: bit 7 forward, 0 stop, 1 emergency stop, 2-127 steps 1-126
+#define REFRESH_SPEED_FORWARD       0x80u
+#define REFRESH_SPEED_ESTOP         0x01u
+
+typedef struct {
+    uint32_t addresses;         // addresses in the table
+    uint32_t pending;           // commands waiting in the heap
+    uint32_t commands;          // command packets sent, repeats included
+    uint32_t refreshes;         // refresh packets sent
+    uint32_t idles;             // refresh_next() calls with nothing sendable
+    uint32_t coalesced;         // changes merged into a command still queued
+} RefreshStatus_t;
+
+typedef struct {
+    uint16_t address;
+    uint8_t speed;              // 128 step speed byte
+    uint32_t functions;         // bit n = Fn
+} RefreshEntry_t;
+
+/**
+ * @brief Create the lock, call once before the command station starts
+ */
+void refresh_init(void);
+
+/**
+ * @brief Set the speed of an address, adding it to the table if needed
+ * @return 0 on success, -1 for an invalid address, -2 if the table is full
+ */
+int refresh_set_speed(uint16_t address, uint8_t speed);
+
+/**
+ * @brief Set F0-F28 of an address, only the function groups that changed are queued
+ * @return 0 on success, -1 for an invalid address or functions above F28, -2 if the table is full
+ */
+int refresh_set_functions(uint16_t address, uint32_t functions);
+
+/**
+ * @brief Emergency stop every address in the table, keeps the direction
+ */
+void refresh_emergency_stop(void);
+
+/**
+ * @brief Remove an address, its queued commands are dropped
+ * @return 0 on success, -1 if the address is not in the table
+ */
+int refresh_release(uint16_t address);
+
+/**
+ * @brief Remove all addresses and queued commands, clears the counters
+ */
+void refresh_clear(void);
+
+/**
+ * @brief Next packet for the track (command station thread)
+ * @param now_ms Kernel tick in ms
+ * @param bytes   REFRESH_PACKET_MAX bytes, the packet including its checksum
+ * @return Packet length, 0 if nothing may be sent now
+ */
+uint8_t refresh_next(uint32_t now_ms, uint8_t *bytes);
+
+void refresh_get_status(RefreshStatus_t *status);
+
+/**
+ * @brief Copy table entries in address order starting at index first
+ * @return Number of entries copied
+ */
+uint32_t refresh_get_entries(uint32_t first, RefreshEntry_t *entries, uint32_t max);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* REFRESH_SCHEDULER_H */
@@ -0,0 +1,120 @@
+/**
+ * @file response_latency.h
+ * @brief Packet to output response latency of a decoder under test
+ *
+ * A trial starts with a matching packet, at the moment its end bit starts on
+ * the track (command station packet hook, DWT cycle counter). The trial waits
+ * for the first edge on every selected IO input (GPIO edge capture) and, if
+ * enabled, for a step of the track current against the average of the
+ * RESPONSE_LATENCY_BASELINE_MS buckets before the packet (ADC stream, 1 ms
+ * resolution). Each response adds its delay to the distribution of its
+ * channel, channels without a response within the timeout count a timeout.
+ * The trial ends when every channel has responded or timed out; matching
+ * packets meanwhile are ignored.
+ *
+ * Trigger "change" starts a trial only with a matching packet whose bytes
+ * differ from the previous matching one, so a refreshed packet stream drives
+ * one trial per state change (first matching packet after start included).
+ * Trigger "every" starts one with every matching packet.
+ *
+ * Requires interrupt driven transmit: with DMA transmit the packets are
+ * framed while the tables are rendered, ahead of the track.
+ */
+
+#ifndef RESPONSE_LATENCY_H
+#define RESPONSE_LATENCY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define RESPONSE_LATENCY_MAX_PINS           4u
+#define RESPONSE_LATENCY_MAX_MATCH          6u      // packet prefix bytes
+#define RESPONSE_LATENCY_LABEL_SIZE         24u
+#define RESPONSE_LATENCY_BINS               32u
+#define RESPONSE_LATENCY_DEFAULT_BIN_US     1000u
+#define RESPONSE_LATENCY_MAX_BIN_US         100000u
+#define RESPONSE_LATENCY_DEFAULT_TIMEOUT_MS 500u
+#define RESPONSE_LATENCY_MAX_TIMEOUT_MS     10000u  // well below the 17 s cycle counter wrap
+#define RESPONSE_LATENCY_BASELINE_MS        4u
+
+typedef enum {
+    RESPONSE_LATENCY_TRIGGER_CHANGE = 0,
+    RESPONSE_LATENCY_TRIGGER_EVERY
+} ResponseLatencyTrigger_t;
+
+typedef struct {
+    char label[RESPONSE_LATENCY_LABEL_SIZE];    // name of the test, reported back
+    uint16_t pins;                  // IO inputs, bit 0 = IO1, at most RESPONSE_LATENCY_MAX_PINS
+    uint16_t current_ma;            // current step threshold, 0 = not measured
+    uint32_t timeout_ms;
+    uint32_t bin_us;                // histogram bin width
+    uint8_t match[RESPONSE_LATENCY_MAX_MATCH];  // packet prefix, match_length 0 = every packet
+    uint8_t match_length;
+    uint8_t trigger;                // ResponseLatencyTrigger_t
+} ResponseLatencyConfig_t;
+
+typedef struct {
+    uint32_t count;
+    uint64_t sum_us;
+    uint32_t min_us;
+    uint32_t max_us;
+    uint32_t timeouts;              // trials without a response
+    uint32_t bins[RESPONSE_LATENCY_BINS];
+    uint32_t overflow;              // responses beyond the last bin
+} ResponseLatencyChannel_t;
+
+typedef struct {
+    bool active;
+    ResponseLatencyConfig_t config;
+    uint32_t packets;               // matching packets
+    uint32_t trials;                // trials started
+    uint32_t ignored;               // matching packets during a trial
+    uint8_t pin_count;
+    uint8_t pin_io[RESPONSE_LATENCY_MAX_PINS];  // IO number of each pin channel
+    ResponseLatencyChannel_t pin[RESPONSE_LATENCY_MAX_PINS];
+    ResponseLatencyChannel_t current;
+} ResponseLatency_t;
+
+/**
+ * @brief Start a test, clears the distributions (a running test is stopped first)
+ *
+ * The pins are armed for GPIO edge capture, replacing a capture started by
+ * gpio_capture_control.
+ *
+ * @param conflicts Set to the pins which cannot be captured (may be NULL)
+ * @return 0 on success, -1 for an invalid configuration, -2 if the pins
+ *         cannot be captured together, -3 if the current step needs
+ *         continuous analog sampling, -4 with DMA transmit enabled
+ */
+int response_latency_start(const ResponseLatencyConfig_t *config, uint16_t *conflicts);
+
+/**
+ * @brief Stop the test, an open trial is dropped, the results stay readable
+ */
+void response_latency_stop(void);
+
+/**
+ * @brief True while a test holds the edge and packet hooks
+ */
+bool response_latency_active(void);
+
+/**
+ * @brief Copy the results (taken while the test runs, may lag by one response)
+ */
+void response_latency_get(ResponseLatency_t *results);
+
+/**
+ * @brief Latency below which percent of the responses of a channel are
+ * @return Upper edge of the bin holding the percentile, limited to max_us
+ */
+uint32_t response_latency_percentile(const ResponseLatencyChannel_t *channel, uint32_t bin_us, uint32_t percent);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* RESPONSE_LATENCY_H */
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Size of the per request arena used by the RPC server's json values
+#ifndef RPC_ARENA_SIZE
+#define RPC_ARENA_SIZE (16u * 1024u)
+#endif
+
+// Bump allocator backing all json values built while handling one RPC request
+//
+// Allocation is a pointer increment and deallocation is a no-op; the whole arena is
+// released at once by reset() after the request has been answered, so request handling
+// never touches (or fragments) the system heap. If a request outgrows the arena the
+// allocation falls back to the heap and is counted. Only the RPC server thread may use it.
+class RpcArena {
+public:
+  static void* allocate(size_t size, size_t align);
+  static void deallocate(void* p);
+
+  // Release everything allocated since the last reset
+  static void reset();
+
+  static size_t capacity() { return RPC_ARENA_SIZE; }
+  static size_t used() { return _used; }
+  static size_t peak() { return _peak; }
+  static uint32_t heapFallbacks() { return _heap_fallbacks; }
+
+private:
+  static size_t _used;
+  static size_t _peak;
+  static uint32_t _heap_fallbacks;
+};
+
+// Stateless std allocator on top of RpcArena
+template<typename T>
+struct RpcArenaAllocator {
+  using value_type = T;
+
+  RpcArenaAllocator() = default;
+  template<typename U>
+  constexpr RpcArenaAllocator(RpcArenaAllocator<U> const&) noexcept {}
+
+  T* allocate(size_t n) { return static_cast<T*>(RpcArena::allocate(n * sizeof(T), alignof(T))); }
+  void deallocate(T* p, size_t) noexcept { RpcArena::deallocate(p); }
+
+  template<typename U>
+  bool operator==(RpcArenaAllocator<U> const&) const noexcept { return true; }
+  template<typename U>
+  bool operator!=(RpcArenaAllocator<U> const&) const noexcept { return false; }
+};
+
+using RpcString = std::basic_string<char, std::char_traits<char>, RpcArenaAllocator<char>>;
@@ -0,0 +1,130 @@
+/**
+ * @file rpc_binary.h
+ * @brief Binary framed RPC protocol on the CDC-ACM link
+ *
+ * Compact alternative to the JSON requests for hot commands. Binary frames are
+ * only recognised after the host has enabled them with the rpc_binary_mode JSON
+ * method; JSON requests keep working in binary mode.
+ *
+ * Frame layout (all multi-byte fields little endian):
+ *   [0]      RPC_BIN_SOF
+ *   [1]      opcode (responses: opcode | RPC_BIN_RESPONSE_FLAG)
+ *   [2]      sequence number, echoed in the response
+ *   [3..4]   payload length
+ *   [5..]    payload (responses: status byte followed by data)
+ *   [n-2..]  CRC-16/CCITT (poly 0x1021, init 0xFFFF) over bytes 1 .. end of payload
+ */
+
+#ifndef RPC_BINARY_H
+#define RPC_BINARY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "rpc_transport_types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define RPC_BIN_SOF               0xD5u
+#define RPC_BIN_VERSION           1u
+#define RPC_BIN_HEADER_SIZE       5u
+#define RPC_BIN_CRC_SIZE          2u
+#define RPC_BIN_OVERHEAD          (RPC_BIN_HEADER_SIZE + RPC_BIN_CRC_SIZE)
+#define RPC_BIN_MAX_PAYLOAD       (RX_BUFFER_SIZE - RPC_BIN_OVERHEAD - 1u)
+#define RPC_BIN_RESPONSE_FLAG     0x80u
+#define RPC_BIN_MAX_RESPONSE      1024u  // response data after the status byte
+
+/* Opcodes */
+#define RPC_BIN_OP_ECHO               0x00u  // payload echoed back
+#define RPC_BIN_OP_LOAD_PACKET        0x01u  // flags (bit0 replace), packet bytes
+#define RPC_BIN_OP_TRANSMIT_PACKET    0x02u  // flags (bit0 stream, bit1 delay in us), delay u32
+#define RPC_BIN_OP_QUEUE_STATUS       0x03u  // -> count, capacity, high_water, underruns, transmitted u32, stream u8
+#define RPC_BIN_OP_GET_VOLTAGE_MV     0x04u  // -> voltage u16
+#define RPC_BIN_OP_GET_CURRENT_MA     0x05u  // -> current u16
+#define RPC_BIN_OP_RAILCOM_READ       0x06u  // max u8 (optional) -> count u8, count frames
+
+/* railcom_read frame: packet_seq u32, tick_ms u32, flags u8, ch1_count u8, ch2_count u8,
+ * ch1 symbols [2], ch2 symbols [6] */
+#define RPC_BIN_RAILCOM_FRAME_SIZE    19u
+
+#define RPC_BIN_OP_SNIFFER_READ       0x07u  // -> count u8, count sniffer records (see sniffer.h)
+#define RPC_BIN_OP_SUITE_WRITE        0x08u  // suite u16, offset u32, data -> file size u32
+#define RPC_BIN_OP_LOAD_PACKETS       0x09u  // flags (bit0 replace), records (length u8, bytes) -> loaded u16, count u16
+#define RPC_BIN_OP_CAPTURE_READ       0x0Au  // first u16 (optional) -> state u8, packet_seq u32, count u16,
+                                             // packet_index u16, end_index u16, sample_us u16, n u16, n samples u16
+
+/* Response status codes */
+#define RPC_BIN_STATUS_OK             0x00u
+#define RPC_BIN_STATUS_BAD_CRC        0x01u
+#define RPC_BIN_STATUS_BAD_LENGTH     0x02u
+#define RPC_BIN_STATUS_UNKNOWN_OPCODE 0x03u
+#define RPC_BIN_STATUS_INVALID_PARAM  0x04u
+#define RPC_BIN_STATUS_FAILED         0x05u
+
+/**
+ * @brief Binary frames accepted by the CDC-ACM receive path
+ */
+extern volatile uint8_t rpc_binary_enabled;
+
+/**
+ * @brief Enable or disable binary framing for the current session
+ * @param enable true to accept binary frames
+ */
+void RpcBinary_SetEnabled(bool enable);
+
+/**
+ * @brief Calculate CRC-16/CCITT
+ * @param data Data to checksum
+ * @param length Number of bytes
+ * @return CRC value
+ */
+uint16_t rpc_bin_crc16(const uint8_t *data, uint32_t length);
+
+/**
+ * @brief Check how much of a receive buffer starting with RPC_BIN_SOF forms a frame
+ * @param data Receive buffer, data[0] must be RPC_BIN_SOF
+ * @param available Number of bytes received so far
+ * @return Total frame length if complete, 0 if more data is needed, -1 if the header is invalid
+ */
+int32_t rpc_bin_frame_length(const uint8_t *data, uint32_t available);
+
+/**
+ * @brief Fill in header and CRC of a frame whose payload is already at out + RPC_BIN_HEADER_SIZE
+ * @param out Frame buffer
+ * @param opcode Opcode byte
+ * @param seq Sequence number
+ * @param payload_length Payload length
+ * @return Total frame length
+ */
+uint16_t rpc_bin_finish_frame(uint8_t *out, uint8_t opcode, uint8_t seq, uint16_t payload_length);
+
+static inline uint16_t rpc_bin_get_u16(const uint8_t *p)
+{
+    return (uint16_t)(p[0] | ((uint16_t)p[1] << 8));
+}
+
+static inline uint32_t rpc_bin_get_u32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline void rpc_bin_put_u16(uint8_t *p, uint16_t value)
+{
+    p[0] = (uint8_t)value;
+    p[1] = (uint8_t)(value >> 8);
+}
+
+static inline void rpc_bin_put_u32(uint8_t *p, uint32_t value)
+{
+    p[0] = (uint8_t)value;
+    p[1] = (uint8_t)(value >> 8);
+    p[2] = (uint8_t)(value >> 16);
+    p[3] = (uint8_t)(value >> 24);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* RPC_BINARY_H */
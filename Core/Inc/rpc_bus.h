@@ -0,0 +1,85 @@
+/**
+ * @file rpc_bus.h
+ * @brief Requests of every transport in priority lanes for the RPC thread
+ *
+ * USB, TCP, UDP and the console post their requests here instead of the RPC
+ * thread draining a queue per transport in turn. A request goes into the lane
+ * of its method (RpcEntry::lane): stop and emergency stop ahead of everything
+ * else, bulk loads behind the rest. The RPC thread takes the oldest request
+ * of the highest lane and looks at the urgent lane again between the requests
+ * of a network buffer, so a stop waits for the request being handled at most,
+ * however much bulk traffic another client queued. Responses go back to the
+ * transport the request came from (origin).
+ *
+ * Requests of one TCP connection stay in order, a stop sent behind bulk loads
+ * on the same connection only overtakes what is already on the bus.
+ */
+
+#ifndef RPC_BUS_H
+#define RPC_BUS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "rpc_transport_types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    RPC_LANE_URGENT = 0,        // stop, emergency stop
+    RPC_LANE_NORMAL,
+    RPC_LANE_BULK,              // packet, program, test case and suite loads
+    RPC_LANE_COUNT
+} RpcLane_t;
+
+// Requests a transport can have outstanding at once, every lane holds all of them so posting cannot fail
+#define RPC_BUS_USB_REQUESTS    5u
+#define RPC_BUS_NET_REQUESTS    4u
+#define RPC_BUS_CLI_REQUESTS    1u
+#define RPC_BUS_DEPTH           (RPC_BUS_USB_REQUESTS + RPC_BUS_NET_REQUESTS + RPC_BUS_CLI_REQUESTS)
+
+typedef struct {
+    void *request;              // rpc_rxbuffer_t (USB), NetxRpcRequest_t (TCP, UDP), console request
+    uint8_t origin;             // RPC_ORIGIN_*
+    uint8_t lane;               // RpcLane_t
+    uint32_t posted_ms;
+} RpcBusMessage_t;
+
+typedef struct {
+    uint32_t posted;
+    uint32_t served;
+    uint32_t pending;
+    uint32_t high_water;        // most requests waiting at once
+    uint32_t max_wait_ms;       // longest time from post to handling
+    uint32_t dropped;           // lane full, the transport got its request back
+} RpcLaneStats_t;
+
+/**
+ * @brief Create the lanes, before any transport posts (RpcServer_Init)
+ */
+void RpcBus_Init(void);
+
+/**
+ * @brief Transports: queue a request in the lane of its method and wake the RPC thread
+ * @param data, length Request as received, classified without parsing it
+ * @param type RPC_FRAME_JSON or RPC_FRAME_BINARY
+ * @return false if the lane is full, the request is still the caller's
+ */
+bool RpcBus_Post(uint8_t origin, void *request, const char *data, uint32_t length, uint8_t type);
+
+/**
+ * @brief RPC thread: take the oldest request of the highest lane up to lowest
+ * @return false if none is waiting
+ */
+bool RpcBus_Take(RpcBusMessage_t *message, RpcLane_t lowest);
+
+void RpcBus_GetStats(RpcLaneStats_t stats[RPC_LANE_COUNT]);
+
+const char *RpcBus_LaneName(RpcLane_t lane);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* RPC_BUS_H */
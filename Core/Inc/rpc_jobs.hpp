@@ -0,0 +1,123 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include "rpc_server.hpp"
+#include "rpc_transport_types.h"
+
+// Asynchronous RPC jobs
+//
+// A handler which may block for a long time (averaged measurements, service mode,
+// stopping the command station) runs its work as a job. With "async":true in the
+// params the RPC thread queues the job for a worker thread and answers with the
+// job id at once, so other requests, emergency stops included, are not held up.
+// When the job is done the RPC thread sends an unsolicited notification:
+//   {"event":"job_complete","job_id":N,"method":"...","duration_ms":T,"result":{...}}
+//
+// run executes on a worker thread and must not touch json values, the request
+// arena belongs to the RPC thread. Arguments and results are exchanged through
+// the data member. response builds the result on the RPC thread.
+
+#ifndef RPC_JOB_WORKERS
+#define RPC_JOB_WORKERS 2u
+#endif
+#define RPC_JOB_SLOTS 8u
+#define RPC_JOB_DATA_SIZE 64u
+
+enum RpcJobState : uint8_t {
+    RPC_JOB_FREE = 0,
+    RPC_JOB_QUEUED,
+    RPC_JOB_RUNNING,
+    RPC_JOB_DONE
+};
+
+struct RpcJob;
+typedef void (*RpcJobRunFn)(RpcJob& job);
+typedef json (*RpcJobResponseFn)(const RpcJob& job);
+
+struct RpcJob {
+    uint32_t id;
+    const char* method;
+    RpcJobRunFn run;
+    RpcJobResponseFn response;
+    std::atomic<uint8_t> state;
+    uint8_t origin;             // RPC_ORIGIN_* the job_complete event goes to
+    uint32_t queued_ms;
+    uint32_t duration_ms;
+    alignas(8) uint8_t data[RPC_JOB_DATA_SIZE];
+};
+
+template<typename T>
+T& rpc_job_data(RpcJob& job) {
+    static_assert(sizeof(T) <= RPC_JOB_DATA_SIZE && alignof(T) <= 8u, "job data too large");
+    return *reinterpret_cast<T*>(job.data);
+}
+
+template<typename T>
+const T& rpc_job_data(const RpcJob& job) {
+    static_assert(sizeof(T) <= RPC_JOB_DATA_SIZE && alignof(T) <= 8u, "job data too large");
+    return *reinterpret_cast<const T*>(job.data);
+}
+
+// Create the worker threads
+void RpcJobs_Init(void);
+
+// RPC thread: transport of the request being handled, recorded by RpcJobs_Alloc
+void RpcJobs_SetOrigin(uint8_t origin);
+
+// RPC thread: take a free slot, nullptr if all are in use
+RpcJob* RpcJobs_Alloc(const char* method, RpcJobRunFn run, RpcJobResponseFn response);
+
+// RPC thread: hand a slot from RpcJobs_Alloc to the workers
+bool RpcJobs_Submit(RpcJob* job);
+
+// RPC thread: next finished job, nullptr if none, release it with RpcJobs_Free
+RpcJob* RpcJobs_Completed(void);
+void RpcJobs_Free(RpcJob* job);
+
+// Slot access for status reports
+const RpcJob& RpcJobs_Slot(size_t index);
+
+// Runs a job inline, or on a worker if params contains "async":true
+template<typename T>
+json rpc_job_execute(const json& params, const char* method, RpcJobRunFn run, RpcJobResponseFn response,
+                     const T& data) {
+    bool async = false;
+    if (params.is_object() && params.contains("async")) {
+        if (!params["async"].is_boolean()) {
+            return {
+                {"status", "error"},
+                {"message", "async must be a boolean"}
+            };
+        }
+        async = params["async"].get<bool>();
+    }
+
+    if (!async) {
+        RpcJob job{};
+        rpc_job_data<T>(job) = data;
+        run(job);
+        return response(job);
+    }
+
+    RpcJob* job = RpcJobs_Alloc(method, run, response);
+    if (!job) {
+        return {
+            {"status", "error"},
+            {"message", "Too many jobs in progress"}
+        };
+    }
+    rpc_job_data<T>(*job) = data;
+    if (!RpcJobs_Submit(job)) {
+        return {
+            {"status", "error"},
+            {"message", "Failed to queue job"}
+        };
+    }
+    return {
+        {"status", "ok"},
+        {"async", true},
+        {"job_id", job->id}
+    };
+}
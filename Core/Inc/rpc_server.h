@@ -10,6 +10,16 @@ void RpcServer_Init(void);
 void RpcServer_Start(bool test_mode);
 void RpcServer_Stop(void);
 
+// Wake the RPC thread, called by transports after queuing a request and by job workers
+void RpcServer_Notify(void);
+
+// RpcLane_t of the method a request names, found without parsing it (rpc_bus.h)
+uint8_t RpcServer_Lane(const char *data, uint32_t length, uint8_t type);
+
+// Console thread: run one JSON request through the method table on the RPC thread and
+// print the response on the debug UART. False if the server is not running
+bool RpcServer_Console(const char *request, uint32_t length);
+
 #ifdef __cplusplus
 }
 #endif
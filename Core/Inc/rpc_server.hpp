@@ -1,10 +1,16 @@
 #pragma once
 
+#include <array>
+#include <bit>
 #include <string>
 #include <functional>
 #include <cstring>
+#include <optional>
 
 #include "rpc_server.h"
+#include "rpc_arena.hpp"
+#include "rpc_binary.h"
+#include "rpc_bus.h"
 // nlohmann json headers
 #include <nlohmann/json.hpp>
 
@@ -13,35 +19,222 @@ extern "C" void vRPCTask(void* ctx);
 
 // Handler signature using nlohmann json
 // Handlers take a JSON object (the "params" node) and return a response JSON object
-using json = nlohmann::json;
+// All values (containers and strings) live in the per request RpcArena
+using json = nlohmann::basic_json<std::map, std::vector, RpcString, bool, std::int64_t, std::uint64_t,
+                                  double, RpcArenaAllocator>;
 typedef json (*RpcHandlerFn)(const json&);
 
-// Fixed-size registry entry
+// Binary handler signature (see rpc_binary.h)
+// Handlers decode the request payload, write response data into resp (at most resp_size bytes)
+// and return an RPC_BIN_STATUS_* code
+typedef uint8_t (*RpcBinHandlerFn)(const uint8_t* req, uint16_t req_length,
+                                   uint8_t* resp, uint16_t resp_size, uint16_t* resp_length);
+
+// Streamed response: a JSON object whose one array member is written element by element.
+// The text collects in the transmit buffer and goes to the sink each time the buffer fills,
+// the sink returns once the transport has taken it (the USB host read it, the TCP window
+// had room). The client receives the response while it is produced, and a response of any
+// length needs no more memory than that buffer.
+class RpcStream {
+public:
+    // Hands a chunk to the transport of the request, false if it could not be sent
+    typedef bool (*SinkFn)(void* context, const char* data, size_t length);
+
+    RpcStream(char* buf, size_t size, SinkFn sink, void* context)
+        : output(*this), buf(buf), size(size), sink(sink), context(context) {}
+
+    // Open the response with the members of head and the request id, then the array member
+    void begin(const json& head, const char* array);
+    void item(const json& value);
+    // Close the array and the response, "complete" false tells the client elements are missing
+    void end(bool complete);
+
+    bool started() const { return opened; }
+    bool ok() const { return !failed; }     // false once a chunk could not be sent, stop producing
+    size_t sent() const { return total; }
+
+private:
+    friend class RpcServer;
+
+    class Output : public nlohmann::detail::output_adapter_protocol<char> {
+    public:
+        explicit Output(RpcStream& stream) : stream(stream) {}
+        void write_character(char c) override { stream.put(&c, 1u); }
+        void write_characters(const char* s, std::size_t length) override { stream.put(s, length); }
+
+    private:
+        RpcStream& stream;
+    };
+
+    void start(const json* request_id);
+    void key(const char* name);
+    void put(const char* s, size_t length);
+    void flush();
+
+    Output output;
+    std::optional<nlohmann::detail::serializer<json>> serializer;  // one for the whole response
+    char* buf;
+    size_t size;
+    SinkFn sink;
+    void* context;
+    const json* id = nullptr;
+    size_t pos = 0;
+    size_t total = 0;
+    uint32_t members = 0;
+    uint32_t items = 0;
+    bool opened = false;
+    bool failed = false;
+};
+
+// Streamed handler: returns a response like RpcHandlerFn without touching the stream (errors,
+// small results), or writes it through begin/item/end, the returned value is then dropped
+typedef json (*RpcStreamFn)(const json& params, RpcStream& stream);
+
+// Method table entry, bin_handler is the optional binary fast path of the same method,
+// lane the priority of its requests on the command bus, stream set instead of handler for
+// a streamed method
 struct RpcEntry {
     const char* name;
     RpcHandlerFn handler;
+    RpcBinHandlerFn bin_handler;
+    uint8_t opcode;
+    uint8_t lane = RPC_LANE_NORMAL;
+    RpcStreamFn stream = nullptr;
 };
 
-// Simple RPC server class for embedded systems
-class RpcServer {
+// FNV-1a over a method name, the seed selects one of a family of hash functions
+constexpr uint32_t rpc_method_hash(const char* name, uint32_t seed) {
+    uint32_t h = 2166136261u ^ (seed * 0x9E3779B9u);
+    while (*name) {
+        h = (h ^ static_cast<uint8_t>(*name++)) * 16777619u;
+    }
+    return h ^ (h >> 16);
+}
+
+constexpr bool rpc_names_equal(const char* a, const char* b) {
+    while (*a && *a == *b) {
+        ++a;
+        ++b;
+    }
+    return *a == *b;
+}
+
+// Lookup view of a method table, independent of the table size
+struct RpcMethodView {
+    static constexpr uint8_t kEmpty = 0xFFu;
+
+    const RpcEntry* entries;
+    const uint8_t* slots;      // hash slot -> entry index
+    const uint8_t* opcodes;    // binary opcode -> entry index
+    uint32_t slot_mask;
+    uint32_t seed;
+
+    const RpcEntry* find(const char* name) const {
+        uint8_t const index = slots[rpc_method_hash(name, seed) & slot_mask];
+        if (index == kEmpty || std::strcmp(entries[index].name, name) != 0) return nullptr;
+        return &entries[index];
+    }
+
+    const RpcEntry* find_binary(uint8_t opcode) const {
+        if (opcode & RPC_BIN_RESPONSE_FLAG) return nullptr;
+        uint8_t const index = opcodes[opcode];
+        return index == kEmpty ? nullptr : &entries[index];
+    }
+};
+
+// Method table built at compile time from a constexpr list of entries
+//
+// The constructor searches for a hash seed which places every name in a slot of
+// its own, so a lookup is one hash, one slot read and one strcmp. Binary opcodes
+// index a direct lookup table. Duplicate names or opcodes, or no seed found, make
+// ok() false, which the definition of the table checks with a static_assert.
+template<size_t N>
+class RpcMethodTable {
+    static_assert(N > 0u && N < RpcMethodView::kEmpty, "method count must fit the slot index");
+
 public:
-    RpcServer() : count(0) {
-        for (int i = 0; i < kMaxMethods; ++i) {
-            table[i] = {nullptr, nullptr};
+    static constexpr size_t kSlots = std::bit_ceil(8u * N);  // sparse enough for a seed to be found quickly
+    static constexpr uint32_t kMaxSeeds = 4096u;
+
+    constexpr explicit RpcMethodTable(const std::array<RpcEntry, N>& list) : entries(list) {
+        opcodes.fill(RpcMethodView::kEmpty);
+        for (size_t i = 0; i < N; ++i) {
+            for (size_t j = 0; j < i; ++j) {
+                if (rpc_names_equal(entries[i].name, entries[j].name)) return;
+            }
+            if (entries[i].bin_handler) {
+                uint8_t const opcode = entries[i].opcode;
+                if ((opcode & RPC_BIN_RESPONSE_FLAG) || opcodes[opcode] != RpcMethodView::kEmpty) return;
+                opcodes[opcode] = static_cast<uint8_t>(i);
+            }
+        }
+        for (seed = 0; seed < kMaxSeeds; ++seed) {
+            if (place()) {
+                valid = true;
+                return;
+            }
         }
     }
 
-    // Register a handler into the fixed table
-    bool register_method(const char* name, RpcHandlerFn handler);
+    constexpr bool ok() const { return valid; }
+    constexpr size_t size() const { return N; }
+    constexpr const RpcEntry& operator[](size_t i) const { return entries[i]; }
 
-    // Handle a raw request string and return a serialized response
-    std::string handle(const std::string& request_str);
+    constexpr RpcMethodView view() const {
+        return {entries.data(), slots.data(), opcodes.data(), static_cast<uint32_t>(kSlots - 1u), seed};
+    }
 
 private:
-    static constexpr int kMaxMethods = 30;
-    RpcEntry table[kMaxMethods];
-    int count;
+    std::array<RpcEntry, N> entries{};
+    std::array<uint8_t, kSlots> slots{};
+    std::array<uint8_t, RPC_BIN_RESPONSE_FLAG> opcodes{};
+    uint32_t seed = 0;
+    bool valid = false;
 
-    std::string error_response(const char* msg);
-    RpcHandlerFn find(const char* name) const;
+    constexpr bool place() {
+        slots.fill(RpcMethodView::kEmpty);
+        for (size_t i = 0; i < N; ++i) {
+            uint8_t& slot = slots[rpc_method_hash(entries[i].name, seed) & (kSlots - 1u)];
+            if (slot != RpcMethodView::kEmpty) return false;
+            slot = static_cast<uint8_t>(i);
+        }
+        return true;
+    }
 };
+
+// Simple RPC server class for embedded systems
+class RpcServer {
+public:
+    constexpr explicit RpcServer(RpcMethodView methods) : methods(methods) {}
+
+    // Handle a raw request and serialize the CRLF terminated response into out,
+    // returns the response length (0 if out cannot even hold an error response).
+    // With a stream, which must write into out, streamed methods are available and
+    // send their response themselves, 0 is then returned
+    size_t handle(const char* request_str, size_t length, char* out, size_t out_size,
+                  RpcStream* stream = nullptr);
+
+    // Handle a complete binary frame, returns the response frame length written to out
+    uint16_t handle_binary(const uint8_t* frame, uint16_t length, uint8_t* out, uint16_t out_size);
+
+    // Serialize an unsolicited message such as a job notification, 0 if it does not fit
+    size_t notify(const json& message, char* out, size_t out_size) { return serialize(message, out, out_size); }
+
+    // Calls executed by one batch request at most
+    static constexpr size_t kMaxBatchCalls = 16;
+
+private:
+    RpcMethodView methods;
+    RpcStream* streaming = nullptr;  // stream of the request being handled
+
+    size_t dispatch(const char* request_str, size_t length, char* out, size_t out_size);
+    json call(const json& request, bool allow_batch);
+    json batch(const json& params);
+    size_t serialize(const json& response, char* out, size_t out_size);
+    size_t error_response(const char* msg, char* out, size_t out_size);
+};
+
+#ifdef DCC_TESTER_BENCHMARK
+// The server of the RPC thread, the benchmark times it between requests
+RpcServer& rpc_server_instance();
+#endif
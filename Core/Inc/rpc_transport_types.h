@@ -4,10 +4,20 @@
 #include <stdint.h>
 
 #define RX_BUFFER_SIZE 2048
+#define RPC_TX_BUFFER_SIZE 2048   // serialized JSON response incl. CRLF
+
+#define RPC_FRAME_JSON    0   // CRLF terminated JSON request
+#define RPC_FRAME_BINARY  1   // binary frame, see rpc_binary.h
+
+#define RPC_ORIGIN_USB    0   // USB CDC ACM
+#define RPC_ORIGIN_TCP    1   // network RPC client, see netx_rpc_transport.h
+#define RPC_ORIGIN_UDP    2   // network RPC datagram
+#define RPC_ORIGIN_CLI    3   // debug UART console, see RpcServer_Console
 
 typedef struct {
     char data[RX_BUFFER_SIZE];
     uint16_t length;
+    uint8_t type;
 } rpc_rxbuffer_t;
 
 #endif
\ No newline at end of file
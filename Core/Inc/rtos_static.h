@@ -0,0 +1,97 @@
+/**
+ * @file rtos_static.h
+ * @brief Compile time memory for the CMSIS-RTOS2 objects of the application
+ *
+ * With RTOS_STATIC_ALLOCATION (CMake option DCC_TESTER_STATIC_RTOS, on by
+ * default) every thread stack and control block, semaphore, mutex, event flags
+ * group and message queue of the application is a static object declared next
+ * to its user, so the memory is in the link map and boot does no pool
+ * allocations. The CMSIS byte pools (tx_user.h) and the FreeRTOS adaptation
+ * heap (FreeRTOSConfig.h) then shrink to what is left to run time creation.
+ * Without it the same declarations only name the objects and osXxxNew()
+ * allocates from the byte pools as before.
+ *
+ *   RTOS_THREAD_MEMORY(cmdStationTask, 8192);
+ *   const osThreadAttr_t cmdStationTask_attributes = {
+ *     .name = "cmdStationTask",
+ *     RTOS_THREAD_ATTR_MEMORY(cmdStationTask),
+ *     .priority = ...
+ *   };
+ *
+ *   RTOS_SEMAPHORE(done_sem);
+ *   done_sem = osSemaphoreNew(1, 0, &done_sem_attr);
+ *
+ * RTOS_THREAD_ATTR_MEMORY() sets cb_mem, cb_size, stack_mem and stack_size,
+ * in declaration order so it can be used in C++ designated initializers.
+ * memory_map.h reports where every object ended up.
+ */
+
+#ifndef RTOS_STATIC_H
+#define RTOS_STATIC_H
+
+#include "cmsis_os2.h"
+#include "tx_api.h"
+
+#ifndef RTOS_STATIC_ALLOCATION
+#define RTOS_STATIC_ALLOCATION      0
+#endif
+
+#define RTOS_WORDS(bytes)           (((bytes) + sizeof(ULONG) - 1u) / sizeof(ULONG))
+
+#if RTOS_STATIC_ALLOCATION
+
+#define RTOS_THREAD_MEMORY(id, size) \
+    static TX_THREAD id##_cb; \
+    static ULONG id##_stack[RTOS_WORDS(size)]; \
+    enum { id##_stack_size = (size) }
+
+#define RTOS_THREAD_ATTR_MEMORY(id) \
+    .cb_mem = &id##_cb, .cb_size = sizeof(TX_THREAD), \
+    .stack_mem = id##_stack, .stack_size = id##_stack_size
+
+/* count threads sharing one attribute set, RTOS_THREAD_ARRAY_ATTR picks the memory of thread i */
+#define RTOS_THREAD_ARRAY_MEMORY(id, count, size) \
+    static TX_THREAD id##_cb[count]; \
+    static ULONG id##_stack[count][RTOS_WORDS(size)]; \
+    enum { id##_stack_size = (size) }
+
+#define RTOS_THREAD_ARRAY_ATTR(attr, id, i) \
+    ((attr).cb_mem = &id##_cb[i], (attr).cb_size = sizeof(TX_THREAD), (attr).stack_mem = id##_stack[i])
+
+#define RTOS_OBJECT_ATTR(attr_type, cb_type, id) \
+    static cb_type id##_cb; \
+    static const attr_type id##_attr = { .name = #id, .cb_mem = &id##_cb, .cb_size = sizeof(cb_type) }
+
+#define RTOS_MESSAGE_QUEUE(id, count, size) \
+    static TX_QUEUE id##_cb; \
+    static ULONG id##_mem[(count) * RTOS_WORDS(size)]; \
+    static const osMessageQueueAttr_t id##_attr = { .name = #id, .cb_mem = &id##_cb, .cb_size = sizeof(TX_QUEUE), \
+                                                    .mq_mem = id##_mem, .mq_size = sizeof(id##_mem) }
+
+#else
+
+#define RTOS_THREAD_MEMORY(id, size) \
+    enum { id##_stack_size = (size) }
+
+#define RTOS_THREAD_ATTR_MEMORY(id) \
+    .cb_mem = NULL, .cb_size = 0, .stack_mem = NULL, .stack_size = id##_stack_size
+
+#define RTOS_THREAD_ARRAY_MEMORY(id, count, size) \
+    enum { id##_stack_size = (size) }
+
+#define RTOS_THREAD_ARRAY_ATTR(attr, id, i) \
+    ((void)(attr), (void)(i))
+
+#define RTOS_OBJECT_ATTR(attr_type, cb_type, id) \
+    static const attr_type id##_attr = { .name = #id }
+
+#define RTOS_MESSAGE_QUEUE(id, count, size) \
+    static const osMessageQueueAttr_t id##_attr = { .name = #id }
+
+#endif
+
+#define RTOS_SEMAPHORE(id)          RTOS_OBJECT_ATTR(osSemaphoreAttr_t, TX_SEMAPHORE, id)
+#define RTOS_MUTEX(id)              RTOS_OBJECT_ATTR(osMutexAttr_t, TX_MUTEX, id)
+#define RTOS_EVENT_FLAGS(id)        RTOS_OBJECT_ATTR(osEventFlagsAttr_t, TX_EVENT_FLAGS_GROUP, id)
+
+#endif /* RTOS_STATIC_H */
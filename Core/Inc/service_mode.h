@@ -0,0 +1,69 @@
+/**
+ * @file service_mode.h
+ * @brief Service mode (programming track) CV verify and read
+ *
+ * Direct mode verify operations following NMRA S-9.2.3, executed on-device by the
+ * command station thread in custom packet mode (loop=0). Each verify sends reset
+ * packets, the verify packets and recovery reset packets (ACK window) through the
+ * scheduled transmit path with a long preamble. The transmit path arms the current
+ * ACK detector of the analog manager on the start bit of the first verify packet,
+ * so only a current pulse that follows that packet counts as ACK.
+ *
+ * A byte read is eight bit verifies followed by a byte verify of the result.
+ */
+
+#ifndef SERVICE_MODE_H
+#define SERVICE_MODE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SERVICE_MODE_PREAMBLE_BITS     20   // long preamble of service mode packets
+#define SERVICE_MODE_RESET_PACKETS     3    // reset packets before the verify packets
+#define SERVICE_MODE_VERIFY_PACKETS    5    // identical verify packets
+#define SERVICE_MODE_RECOVERY_PACKETS  6    // reset packets after, decoder ACK window
+#define SERVICE_MODE_TIMEOUT_MS        5000u
+
+typedef enum {
+    SERVICE_MODE_READ_BYTE = 0,  // bit verify each bit, then verify the byte
+    SERVICE_MODE_VERIFY_BYTE,    // verify the CV holds value
+    SERVICE_MODE_VERIFY_BIT      // verify bit of the CV equals value (0/1)
+} ServiceModeOp_t;
+
+typedef struct {
+    uint8_t op;                 // ServiceModeOp_t
+    uint16_t cv;                // 1-1024
+    uint8_t value;              // VERIFY_BYTE value, VERIFY_BIT bit value
+    uint8_t bit;                // VERIFY_BIT position 0-7
+} ServiceModeRequest_t;
+
+typedef struct {
+    bool ack;                   // last verify acknowledged (READ_BYTE: byte verify of value)
+    uint8_t value;              // READ_BYTE: value read
+    uint16_t verifies;          // verify sequences sent
+    uint32_t ack_delay_ms;      // last ACK: arming to pulse start
+    uint32_t duration_ms;       // whole operation
+} ServiceModeResult_t;
+
+/**
+ * @brief Execute a service mode operation, blocks until done
+ *
+ * Requires the command station running with loop=0 and continuous analog sampling,
+ * no packet program or custom packet transmission may be active.
+ *
+ * @param request Operation
+ * @param result Result output
+ * @param error Set to a static description on failure (may be NULL)
+ * @return true if executed (result valid), false on error
+ */
+bool CommandStation_ServiceMode(const ServiceModeRequest_t *request, ServiceModeResult_t *result, const char **error);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SERVICE_MODE_H */
@@ -0,0 +1,113 @@
+/**
+ * @file sniffer.h
+ * @brief DCC sniffer of the on-board decoder input
+ *
+ * Every edge time captured by TIM15 for the decoder is also fed to a packet
+ * framer of its own, which counts each packet for the validation statistics
+ * (packet_stats.h). While enabled it also records each packet into a RAM ring:
+ * raw bytes, checksum status, preamble length, timestamps and optionally the
+ * duration of every half bit from the start bit to the end bit.
+ *
+ * Record layout (little endian, packed):
+ *   u16  record length in bytes, header included
+ *   u32  time_us   start bit on the edge clock (sum of all edge times since enable)
+ *   u32  tick_ms   HAL tick when the packet ended
+ *   u8   flags     SNIFFER_FLAG_*
+ *   u8   preamble  preamble bits before the start bit (saturates at 255)
+ *   u8   count     packet bytes
+ *   u8   bytes[count]
+ *   u16  halves[2 * (1 + 9 * count)]  only with SNIFFER_FLAG_WIDTHS, in us
+ *
+ * The edge clock only advances with edges, a line without edges for more than
+ * 65 ms (timer overflow) leaves a gap in it.
+ */
+
+#ifndef SNIFFER_H
+#define SNIFFER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef SNIFFER_BUFFER_SIZE
+#define SNIFFER_BUFFER_SIZE      (64u * 1024u)   // bytes, power of two
+#endif
+#define SNIFFER_MAX_BYTES         18              // DCC_MAX_PACKET_SIZE
+#define SNIFFER_HEADER_SIZE       13u
+#define SNIFFER_MAX_RECORD        (SNIFFER_HEADER_SIZE + SNIFFER_MAX_BYTES + 2u * 2u * (1u + 9u * SNIFFER_MAX_BYTES))
+
+/* Half bit classification in us */
+#define SNIFFER_HALF_MIN_US       35u     // shorter edges are glitches
+#define SNIFFER_HALF_ONE_MAX_US   75u     // one bit half 52-64 us with margin
+#define SNIFFER_HALF_ZERO_MAX_US  12000u  // zero bit half 90-10000 us with margin
+#define SNIFFER_MIN_PREAMBLE      10u     // bits a decoder needs before the start bit
+
+/* Record flags */
+#define SNIFFER_FLAG_CHECKSUM_OK  0x01u   // XOR of all bytes is zero
+#define SNIFFER_FLAG_WIDTHS       0x02u   // half bit durations follow the bytes
+
+typedef struct {
+    bool enabled;
+    bool widths;                // half bit durations recorded
+    uint32_t packets;           // packets recorded since enable
+    uint32_t checksum_errors;   // recorded packets with a bad checksum
+    uint32_t framing_errors;    // bit pairs or lengths that broke a packet
+    uint32_t dropped;           // packets lost because the ring was full
+    uint32_t used;              // bytes waiting to be read
+    uint32_t capacity;          // ring size in bytes
+} SnifferStats_t;
+
+/**
+ * @brief Start or stop recording
+ * @param enable true to record
+ * @param widths Record half bit durations (ignored when disabling)
+ */
+void sniffer_enable(bool enable, bool widths);
+
+/**
+ * @brief Discard recorded packets and clear the statistics
+ *
+ * Only while disabled, the recording side must not touch the ring.
+ * @return 0 on success, -1 if enabled
+ */
+int sniffer_clear(void);
+
+/**
+ * @brief Frame packets for the loco tracker too, recording enabled or not
+ *
+ * Packets with a good checksum are passed to loco_tracker_packet with their
+ * start bit time on the edge clock (not reset by sniffer_enable).
+ * @param enable true to pass packets
+ */
+void sniffer_track(bool enable);
+
+/**
+ * @brief Feed one captured edge time (decoder capture path)
+ * @param width_us Time since the previous edge
+ */
+void sniffer_edge(uint16_t width_us);
+
+/**
+ * @brief Take whole records, oldest first
+ * @param out Output buffer
+ * @param size Capacity of out
+ * @param max_records Maximum number of records to take (0 = as many as fit)
+ * @param records Set to the number of records copied (may be NULL)
+ * @return Bytes copied
+ */
+uint32_t sniffer_read(uint8_t *out, uint32_t size, uint32_t max_records, uint32_t *records);
+
+/**
+ * @brief Get sniffer statistics
+ * @param stats Statistics output
+ */
+void sniffer_get_stats(SnifferStats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SNIFFER_H */
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Lock-free single producer / single consumer ring buffer
+//
+// The producer only ever writes _head and the consumer only ever writes _tail, so the
+// ring can be shared between a thread and an ISR (or two threads) without a lock. Both
+// indices run freely and are masked on access, which lets the ring hold all N entries.
+template<typename T, size_t N>
+class SpscRing {
+  static_assert(N >= 2u && (N & (N - 1u)) == 0u, "SpscRing size must be a power of two");
+
+public:
+  static constexpr size_t capacity() { return N; }
+
+  // Producer: copy value into the ring, returns false if full
+  bool push(T const& value) {
+    T* slot{claim()};
+    if (!slot) return false;
+    *slot = value;
+    commit();
+    return true;
+  }
+
+  // Producer: get the next free slot to construct an entry in place (nullptr if full)
+  T* claim() {
+    uint32_t const head{_head.load(std::memory_order_relaxed)};
+    if (head - _tail.load(std::memory_order_acquire) >= N) return nullptr;
+    return &_buf[head & (N - 1u)];
+  }
+
+  // Producer: free slot offset entries past the next one, for a batch published at once
+  // with commit(count) (nullptr if full)
+  T* claim(uint32_t offset) {
+    uint32_t const head{_head.load(std::memory_order_relaxed) + offset};
+    if (head - _tail.load(std::memory_order_acquire) >= N) return nullptr;
+    return &_buf[head & (N - 1u)];
+  }
+
+  // Producer: publish the slot returned by claim()
+  void commit() { commit(1u); }
+
+  // Producer: publish the count slots claimed from offset 0 on
+  void commit(uint32_t count) {
+    uint32_t const head{_head.load(std::memory_order_relaxed) + count};
+    _head.store(head, std::memory_order_release);
+    uint32_t const used{head - _tail.load(std::memory_order_acquire)};
+    if (used > _high_water) _high_water = used;
+  }
+
+  // Consumer: oldest entry or nullptr if empty, stays valid until pop()
+  T const* front() const {
+    uint32_t const tail{_tail.load(std::memory_order_relaxed)};
+    if (tail == _head.load(std::memory_order_acquire)) return nullptr;
+    return &_buf[tail & (N - 1u)];
+  }
+
+  // Consumer: release the entry returned by front()
+  void pop() {
+    _tail.store(_tail.load(std::memory_order_relaxed) + 1u, std::memory_order_release);
+  }
+
+  // Consumer: copy out and release the oldest entry, returns false if empty
+  bool pop(T& value) {
+    T const* entry{front()};
+    if (!entry) return false;
+    value = *entry;
+    pop();
+    return true;
+  }
+
+  size_t size() const {
+    return _head.load(std::memory_order_acquire) - _tail.load(std::memory_order_acquire);
+  }
+
+  bool empty() const { return size() == 0u; }
+
+  bool full() const { return size() >= N; }
+
+  // Highest fill level seen by the producer since the last reset
+  uint32_t highWater() const { return _high_water; }
+
+  // Drop all entries, only allowed while neither side is accessing the ring
+  void reset() {
+    _tail.store(_head.load(std::memory_order_relaxed), std::memory_order_release);
+    _high_water = 0u;
+  }
+
+private:
+  std::array<T, N> _buf{};
+  std::atomic<uint32_t> _head{0u};
+  std::atomic<uint32_t> _tail{0u};
+  uint32_t _high_water{0u};
+};
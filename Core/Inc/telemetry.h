@@ -0,0 +1,83 @@
+/**
+ * @file telemetry.h
+ * @brief Streaming telemetry over UDP
+ *
+ * Once enabled every continuous mode analog bucket (1 ms) produces a record,
+ * snapshotted in the ADC DMA interrupt together with the packet sequence number
+ * and the outcome of the last RailCom cutout. The telemetry thread writes the
+ * records straight into NxAppPool packets and sends a datagram when it is full
+ * (TELEMETRY_RECORDS_PER_DATAGRAM) or the latency limit has passed.
+ *
+ * Datagram layout, little endian:
+ *   header, 28 bytes
+ *     u16  magic        TELEMETRY_MAGIC
+ *     u8   version      TELEMETRY_VERSION
+ *     u8   record_size  sizeof(TelemetryRecord_t)
+ *     u16  count        records that follow
+ *     u16  lost         records lost since the previous datagram (saturates)
+ *     u32  seq          datagram number since enable
+ *     u32  tick_ms      HAL tick when the datagram was sent
+ *     u32  cycles       DWT cycle counter when the datagram was sent
+ *     u64  time_ns      UTC in ns since 1970 at cycles, see timebase.h
+ *   count records, 16 bytes each, see TelemetryRecord_t
+ */
+
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TELEMETRY_MAGIC                 0x4D54u   // "TM"
+#define TELEMETRY_VERSION               2u
+#define TELEMETRY_HEADER_SIZE           28u
+#define TELEMETRY_RECORDS_PER_DATAGRAM  90u       // 1468 byte payload, fits a 1500 byte MTU
+#define TELEMETRY_RING_RECORDS          256u      // buffered between interrupt and thread, power of two
+#define TELEMETRY_DEFAULT_LATENCY_MS    50u
+
+typedef struct {
+    uint32_t sample;        // analog bucket number, TIM3 paced: 1 ms per bucket
+    uint32_t packet_seq;    // packets started by the command station so far
+    uint16_t voltage_mv;    // track voltage, latest bucket
+    uint16_t current_ma;    // track current
+    uint8_t railcom;        // RAILCOM_RESULT_* of the most recent cutout
+    uint8_t railcom_lag;    // packets sent since that cutout, saturates at 255
+    uint16_t railcom_ch1;   // channel 1 datagram of that cutout, see railcom_last_cutout()
+} TelemetryRecord_t;
+
+typedef struct {
+    bool enabled;
+    uint32_t host_ip;
+    uint16_t host_port;
+    uint16_t decimation;    // one record every n buckets
+    uint32_t records;       // records sent
+    uint32_t datagrams;     // datagrams sent
+    uint32_t lost;          // records lost: ring full or no packet buffer
+    uint32_t tx_errors;     // datagrams which could not be sent
+} TelemetryStats_t;
+
+/**
+ * @brief Create the telemetry thread, call after the NetXDuo IP instance exists
+ */
+void telemetry_init(void);
+
+/**
+ * @brief Start streaming to host_ip:host_port, restart with new settings if running
+ * @param decimation One record every decimation buckets (1 = 1 kHz)
+ * @param latency_ms Longest time a record waits for its datagram
+ * @return 0 on success, -1 without continuous analog sampling or network
+ */
+int telemetry_start(uint32_t host_ip, uint16_t host_port, uint16_t decimation, uint32_t latency_ms);
+
+void telemetry_stop(void);
+void telemetry_get_stats(TelemetryStats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TELEMETRY_H */
@@ -0,0 +1,161 @@
+/**
+ * @file test_case.h
+ * @brief On-device decoder test cases with closed-loop pass/fail evaluation
+ *
+ * A test list is a sequence of steps uploaded over RPC and executed by the
+ * command station thread in custom packet mode (loop=0). Consecutive steps
+ * with the same test id form one test case. A step sends its packet repeat
+ * times, then checks its expectations against the decoder response:
+ *
+ *   CURRENT  track current, averaged over TEST_CASE_CURRENT_WINDOW_MS of the
+ *            ADC stream, within current_min_ma..current_max_ma
+ *   ACK      service mode ACK pulse, detector armed on the first packet
+ *   IO       IO inputs masked by io_mask equal io_level
+ *   RAILCOM  a valid RailCom frame after one of the packets of the step
+ *
+ * The expectations must all be met within timeout_ms of the last packet, or
+ * with TEST_EXPECT_HOLD stay met for the whole timeout_ms (a motor that must
+ * not stop, an output that must stay off; current and IO only). The first
+ * failing step ends its test case, the run goes on with the next one. Each
+ * case leaves one result record; the host only reads the records.
+ *
+ * Packets go through the scheduled transmit path, so gaps are exact to one
+ * bit time. Steps expecting RailCom go through the library instead, which
+ * sends the cutout (BiDi must be enabled).
+ */
+
+#ifndef TEST_CASE_H
+#define TEST_CASE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef TEST_CASE_MAX_STEPS
+#define TEST_CASE_MAX_STEPS         128
+#endif
+#define TEST_CASE_MAX_RESULTS       TEST_CASE_MAX_STEPS
+#define TEST_CASE_MAX_PACKET        18   // DCC_MAX_PACKET_SIZE
+#define TEST_CASE_MAX_TIMEOUT_MS    10000u
+#define TEST_CASE_CURRENT_WINDOW_MS 4u
+
+#define TEST_EXPECT_CURRENT     0x01u
+#define TEST_EXPECT_ACK         0x02u
+#define TEST_EXPECT_IO          0x04u
+#define TEST_EXPECT_RAILCOM     0x08u
+#define TEST_EXPECT_ALL         (TEST_EXPECT_CURRENT | TEST_EXPECT_ACK | TEST_EXPECT_IO | TEST_EXPECT_RAILCOM)
+#define TEST_EXPECT_HOLD        0x80u   // met for the whole timeout instead of within it
+
+typedef struct {
+    uint8_t test;               // test case id
+    uint8_t expect;             // TEST_EXPECT_*, 0 only sends the packets
+    uint8_t flags;              // PACKET_PROGRAM_FLAG_TRIGGER
+    uint8_t length;             // packet length, 0 sends nothing (a pure check)
+    uint16_t repeat;            // transmissions, 0 = 1
+    uint16_t timeout_ms;
+    uint16_t current_min_ma;
+    uint16_t current_max_ma;
+    uint16_t io_mask;           // bit 0 = IO1
+    uint16_t io_level;
+    uint32_t gap_us;            // before each transmission (scheduled path)
+    uint8_t bytes[TEST_CASE_MAX_PACKET];
+} TestStep_t;
+
+typedef struct {
+    uint8_t test;               // test case id
+    bool passed;
+    uint16_t step;              // index of the failing step, or of the last step of the case
+    uint8_t failed;             // expectations not met by the failing step
+    uint16_t current_ma;        // last current measured by the case
+    uint16_t io;                // last IO input snapshot
+    uint32_t response_ms;       // last step: time from its last packet until the expectations were met
+    uint32_t elapsed_ms;        // whole case
+} TestResult_t;
+
+typedef struct {
+    uint16_t steps;             // loaded steps
+    bool running;
+    uint16_t step;              // step being executed
+    uint32_t results;           // result records of the last/current run
+    uint32_t passed;
+    uint32_t failed;
+    uint32_t elapsed_ms;        // duration of the last/current run
+} TestRunStatus_t;
+
+/* Sensor readings a step is evaluated against */
+typedef struct {
+    uint16_t current_ma;
+    uint16_t io;
+    uint32_t railcom_frames;    // valid frames since the command station started
+} TestProbe_t;
+
+/**
+ * @brief Discard the loaded steps
+ * @return 0 on success, -1 while running
+ */
+int TestCase_Clear(void);
+
+/**
+ * @brief Append steps to the loaded list
+ * @return 0 on success, -1 while running or beyond TEST_CASE_MAX_STEPS
+ */
+int TestCase_Append(const TestStep_t *steps, uint16_t count);
+
+/**
+ * @brief Validate the loaded steps before a run
+ * @param error Set to a static description on failure (may be NULL)
+ * @return 0 on success, -1 on failure
+ */
+int TestCase_Prepare(const char **error);
+
+/**
+ * @brief Loaded steps (command station thread while running)
+ * @return Number of steps
+ */
+uint16_t TestCase_Get(const TestStep_t **steps);
+
+/**
+ * @brief Read the current, the IO inputs and the RailCom frame count
+ */
+void TestCase_Probe(TestProbe_t *probe);
+
+/**
+ * @brief Expectations of a step not met by a probe
+ * @param railcom_base Probe railcom_frames before the first packet of the step
+ * @return TEST_EXPECT_* bits failing, 0 if all are met (ACK is checked by the caller)
+ */
+uint8_t TestCase_Check(const TestStep_t *step, const TestProbe_t *probe, uint32_t railcom_base);
+
+/**
+ * @brief Command station thread: run bookkeeping
+ */
+void TestCase_RunStart(void);
+void TestCase_RunStep(uint16_t step);
+void TestCase_AddResult(const TestResult_t *result);
+void TestCase_RunEnd(void);
+
+/**
+ * @brief Copy result records of the last/current run starting at index first
+ * @return Number of records copied
+ */
+uint32_t TestCase_GetResults(uint32_t first, TestResult_t *results, uint32_t max);
+
+void TestCase_GetStatus(TestRunStatus_t *status);
+
+/**
+ * @brief Run the loaded test list (command station must run with loop=0)
+ *
+ * Stopped with CommandStation_StopProgram.
+ * @param error Set to a static description on failure (may be NULL)
+ * @return true if started
+ */
+bool CommandStation_RunTests(const char **error);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TEST_CASE_H */
@@ -0,0 +1,111 @@
+/**
+ * @file timebase.h
+ * @brief Monotonic 64-bit capture timebase disciplined to UTC by SNTP
+ *
+ * The DWT cycle counter is extended to 64 bits: every read compares it with
+ * the previous one and counts the wraps, the HAL tick reads it once per
+ * millisecond so no wrap (17 s at 250 MHz) is ever missed. The extended count
+ * never goes backwards and is what the capture rings stamp.
+ *
+ * Cycles map to UTC (ns since 1970) through a linear segment: a base cycle
+ * count, the UTC at that count and the nanoseconds per cycle. At boot the
+ * base comes from the RTC (one second resolution). Every SNTP update then
+ * gives a sample of UTC against the cycle count:
+ *   - the first one, or one more than TIMEBASE_STEP_NS away, steps the base
+ *   - later ones slew: a new segment starts where the old one is at that
+ *     moment, its rate absorbs the offset within TIMEBASE_SLEW_NS (longer
+ *     for large offsets, the rate never changes by more than
+ *     TIMEBASE_MAX_SLEW_PPB), then continues at the measured frequency
+ * The frequency of the cycle counter is measured over all SNTP samples since
+ * the last step, so the crystal error drops out as the baseline grows. UTC
+ * only ever jumps on a step, which is counted in the status. Cycles the
+ * counter misses while the core sleeps (power_idle.h) move the segment on,
+ * a cycle count taken before a sleep converts that much later afterwards;
+ * the GPIO edge capture holds the sleep off.
+ *
+ * Every board of a rack stamps its data with the same UTC, the host merges
+ * the streams on time_ns without aligning them itself. The accuracy is that
+ * of SNTP on the local network, typically below a millisecond.
+ */
+
+#ifndef TIMEBASE_H
+#define TIMEBASE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TIMEBASE_STEP_NS        128000000ull    // larger SNTP offsets step instead of slewing
+#define TIMEBASE_SLEW_NS        16000000000ull  // shortest time an offset is slewed over
+#define TIMEBASE_MAX_SLEW_PPB   500000          // 500 ppm
+#define TIMEBASE_FREQ_MIN_NS    60000000000ull  // SNTP baseline before the frequency is measured
+
+typedef enum {
+    TIMEBASE_SOURCE_NONE = 0,   // time since boot
+    TIMEBASE_SOURCE_RTC,
+    TIMEBASE_SOURCE_SNTP,
+} TimebaseSource_t;
+
+typedef struct {
+    TimebaseSource_t source;
+    uint32_t syncs;             // SNTP samples taken
+    uint32_t steps;             // UTC jumps: RTC set, first SNTP, offsets above TIMEBASE_STEP_NS
+    int64_t last_offset_ns;     // SNTP time less the timebase at the last sample
+    int32_t freq_ppb;           // cycle counter rate above SystemCoreClock, as measured
+    bool slewing;               // the last offset is still being absorbed
+    uint64_t last_sync_ns;      // UTC of the last SNTP sample, 0 before the first
+    uint32_t cpu_hz;
+    // Taken together, to relate millisecond stamps (tick_ms) to UTC
+    uint64_t cycles;
+    uint64_t time_ns;
+    uint32_t tick_ms;
+} TimebaseStatus_t;
+
+/**
+ * @brief Seed UTC from the RTC, call once after the RTC is initialised
+ */
+void timebase_init(void);
+
+/**
+ * @brief Extended cycle counter, any context
+ */
+uint64_t timebase_cycles(void);
+
+/**
+ * @brief Keep the wrap count current, from the 1 kHz HAL tick
+ */
+void timebase_tick(void);
+
+/**
+ * @brief UTC in ns since 1970 of an extended cycle count (any context)
+ */
+uint64_t timebase_ns(uint64_t cycles);
+
+uint64_t timebase_now_ns(void);
+
+/**
+ * @brief SNTP sample: NTP time (seconds since 1900, 32-bit fraction) at cycles
+ */
+void timebase_sntp_sample(uint32_t ntp_seconds, uint32_t ntp_fraction, uint64_t cycles);
+
+/**
+ * @brief The RTC was set, step to it unless SNTP disciplines the timebase
+ */
+void timebase_rtc_changed(void);
+
+/**
+ * @brief Cycles the counter missed in WFI, idle hook with interrupts disabled
+ */
+void timebase_sleep_add(uint32_t cycles);
+
+void timebase_status(TimebaseStatus_t *status);
+const char *timebase_source_name(TimebaseSource_t source);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TIMEBASE_H */
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include "packet_timing.h"
+
+// Half-bit durations in us of a timing profile
+struct TimingProfile {
+  char const* name;
+  uint16_t one_p;
+  uint16_t one_n;
+  uint16_t zero_p;
+  uint16_t zero_n;
+};
+
+// Precompiled timing profiles, indexed by PacketTimingProfile_t
+//
+// Limits are those a decoder has to accept according to NMRA S-9.1: one bit halves
+// 52-64 us, zero bit halves 90-10000 us with at most 12000 us for the whole bit.
+// The configured profile is a placeholder, its durations come from the parameters.
+inline constexpr std::array<TimingProfile, PACKET_TIMING_PROFILE_COUNT> timing_profiles{{
+  {"configured", 0u, 0u, 0u, 0u},
+  {"nominal", 58u, 58u, 100u, 100u},
+  {"bit1_min", 52u, 52u, 100u, 100u},
+  {"bit1_max", 64u, 64u, 100u, 100u},
+  {"bit0_min", 58u, 58u, 90u, 90u},
+  {"bit0_max", 58u, 58u, 6000u, 6000u},
+  {"stretched_zero", 58u, 58u, 100u, 9900u},
+}};
+
+static_assert(timing_profiles[PACKET_TIMING_PROFILE_NOMINAL].one_p == 58u, "profile table out of order");
+static_assert(timing_profiles[PACKET_TIMING_PROFILE_STRETCHED_ZERO].zero_p +
+              timing_profiles[PACKET_TIMING_PROFILE_STRETCHED_ZERO].zero_n <= 12000u,
+              "stretched zero exceeds the maximum zero bit duration");
+
+// Profile index by name, PACKET_TIMING_PROFILE_COUNT if unknown
+inline uint8_t timing_profile_from_name(char const* name) {
+  for (uint8_t i = 0u; i < timing_profiles.size(); i++) {
+    if (std::strcmp(timing_profiles[i].name, name) == 0) return i;
+  }
+  return PACKET_TIMING_PROFILE_COUNT;
+}
@@ -0,0 +1,88 @@
+/**
+ * @file trace_log.h
+ * @brief Deferred binary trace log
+ *
+ * printf formats and then blocks on the console UART, a few lines cost
+ * milliseconds, which is too much for the command station loops and impossible
+ * in an interrupt. TRACE_LOG only stores the format string pointer, a timestamp
+ * and up to four 32-bit arguments in a RAM ring, formatting and output happen
+ * in a low priority thread.
+ *
+ * Records are written with interrupts masked for the few words of the copy, so
+ * any thread or interrupt may log. A full ring drops the new record and counts
+ * it, producers never wait.
+ *
+ * Records above the level in PARAM_SYSTEM_DEBUG_LEVEL are discarded on entry.
+ *
+ * Restrictions on the format string, which is printed long after the call:
+ *   - it must be a string literal (the pointer is stored, not the text)
+ *   - only 32-bit conversions: %d %u %x %c, %ld %lu %lx, %p
+ *   - %s only for strings with static storage duration
+ *   - no floating point or 64-bit conversions
+ */
+
+#ifndef TRACE_LOG_H
+#define TRACE_LOG_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TRACE_LOG_RECORDS     256u   // ring size, a power of two
+#define TRACE_LOG_MAX_ARGS    4u
+#define TRACE_LOG_DRAIN_MS    10u    // drain delay after the first record, batches bursts
+
+typedef enum {
+    TRACE_LEVEL_ERROR = 0,
+    TRACE_LEVEL_WARN,
+    TRACE_LEVEL_INFO,          // default debug level
+    TRACE_LEVEL_DEBUG,
+    TRACE_LEVEL_VERBOSE
+} TraceLevel_t;
+
+typedef struct {
+    uint32_t records;          // records accepted since boot
+    uint32_t dropped;          // records lost to a full ring
+    uint32_t filtered;         // records discarded by the level
+    uint16_t pending;          // records waiting for the drain thread
+    uint16_t high_water;       // most records pending at once
+    uint8_t level;             // active level
+} TraceLogStats_t;
+
+/**
+ * @brief TRACE_LOG(level, "format", args...) with zero to four arguments
+ */
+#define TRACE_LOG(level, ...)  TRACE_LOG_(level, __VA_ARGS__, 0, 0, 0, 0, 0)
+#define TRACE_LOG_(level, fmt, a0, a1, a2, a3, ...) \
+    trace_log_write((level), (fmt), (uint32_t)(a0), (uint32_t)(a1), (uint32_t)(a2), (uint32_t)(a3))
+
+#define TRACE_ERROR(...)  TRACE_LOG(TRACE_LEVEL_ERROR, __VA_ARGS__)
+#define TRACE_WARN(...)   TRACE_LOG(TRACE_LEVEL_WARN, __VA_ARGS__)
+#define TRACE_INFO(...)   TRACE_LOG(TRACE_LEVEL_INFO, __VA_ARGS__)
+#define TRACE_DEBUG(...)  TRACE_LOG(TRACE_LEVEL_DEBUG, __VA_ARGS__)
+
+/**
+ * @brief Create the drain thread, call after parameter_manager_init
+ */
+void trace_log_init(void);
+
+/**
+ * @brief Store a record (thread and interrupt safe)
+ */
+void trace_log_write(uint8_t level, const char *fmt, uint32_t a0, uint32_t a1, uint32_t a2, uint32_t a3);
+
+/**
+ * @brief Set the active level and store it in PARAM_SYSTEM_DEBUG_LEVEL
+ * @return 0 on success, -1 on failure
+ */
+int trace_log_set_level(uint8_t level);
+
+void trace_log_get_stats(TraceLogStats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TRACE_LOG_H */
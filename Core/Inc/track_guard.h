@@ -0,0 +1,95 @@
+/**
+ * @file track_guard.h
+ * @brief Track short circuit and overcurrent protection in interrupt context
+ *
+ * Two trips, both cut BR_ENABLE from an interrupt without waiting for a thread:
+ *   - short circuit: analog watchdog 1 of ADC2 on the track current channel.
+ *     Every conversion of the continuous scan is compared in hardware against
+ *     PARAM_DCC_SHORT_CIRCUIT_THRESHOLD, the watchdog interrupt clears the pin,
+ *     so the track is off at most one scan (100 us at 10 kHz) plus the interrupt
+ *     entry after the current crossed the threshold.
+ *   - overcurrent: the 1 ms current buckets above PARAM_DCC_TRACK_CURRENT_LIMIT
+ *     for TRACK_GUARD_LIMIT_MS in a row, checked in the ADC DMA interrupt.
+ * A threshold of 0 disables its trip. A threshold above the measuring range
+ * (2047 mA) trips at full scale.
+ *
+ * A trip latches: the transmit path does not drive BR_ENABLE again until the
+ * next CommandStation_Start. Each trip is logged with its time, the RPC thread
+ * then sends a "track_fault" event to every client and stops the command
+ * station. Needs continuous analog sampling (ANALOG_STREAM_ENABLE), in on-demand
+ * mode the guard stays unarmed.
+ */
+
+#ifndef TRACK_GUARD_H
+#define TRACK_GUARD_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TRACK_GUARD_IRQ_PRIORITY    1u      // above the DCC transmit interrupts
+#define TRACK_GUARD_LIMIT_MS        10u     // buckets above the current limit before a trip
+#define TRACK_GUARD_LOG             8u      // most recent trips kept
+
+typedef enum {
+    TRACK_FAULT_SHORT = 0,                  // analog watchdog
+    TRACK_FAULT_OVERCURRENT,                // averaged current limit
+    TRACK_FAULT_COUNT
+} TrackFaultSource_t;
+
+typedef struct {
+    uint32_t number;            // trips since boot, 1 for the first
+    uint32_t tick_ms;           // HAL tick at the trip
+    uint32_t packet_seq;        // packets started by the command station so far
+    uint16_t current_ma;        // conversion or bucket which tripped
+    uint8_t source;             // TrackFaultSource_t
+} TrackFault_t;
+
+typedef struct {
+    bool armed;                 // continuous sampling runs, watchdog configured
+    bool tripped;               // latched until the next command station start
+    uint16_t short_circuit_ma;
+    uint16_t current_limit_ma;
+    uint32_t trips;
+    uint32_t fault_count;       // entries in the log, at most TRACK_GUARD_LOG
+    TrackFault_t faults[TRACK_GUARD_LOG];   // oldest first
+} TrackGuardStatus_t;
+
+/**
+ * @brief Take the thresholds from the parameters and arm, after analog_manager_init
+ */
+void track_guard_init(void);
+
+/**
+ * @brief Apply changed threshold parameters, a latched trip stays latched
+ */
+void track_guard_configure(void);
+
+/**
+ * @brief Command station start: clear a trip and arm again
+ */
+void track_guard_clear(void);
+
+/**
+ * @brief Whether the track must stay off (ISR safe)
+ */
+bool track_guard_tripped(void);
+
+/**
+ * @brief RPC thread: next trip not reported yet
+ * @return false if all trips have been taken
+ */
+bool track_guard_take_fault(TrackFault_t *fault);
+
+void track_guard_get_status(TrackGuardStatus_t *status);
+
+const char *track_guard_source_name(TrackFaultSource_t source);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TRACK_GUARD_H */
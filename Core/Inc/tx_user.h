@@ -74,8 +74,20 @@
 /* CMSIS RTOS V2 */
 #define USE_MEMORY_POOL_ALLOCATION
 #define TX_BYTE_POOL_MIN            (1024) /* Minimum size of a byte pool block */ 
+#if RTOS_STATIC_ALLOCATION
+/* Application objects are static (rtos_static.h), the pools only serve run time creation */
+#define RTOS2_BYTE_POOL_HEAP_SIZE   (1024 * 4)
+#define RTOS2_BYTE_POOL_STACK_SIZE  (1024 * 4)
+#else
 #define RTOS2_BYTE_POOL_HEAP_SIZE   (1024 * 16) /* 16 KB for ThreadX byte pool heap */
 #define RTOS2_BYTE_POOL_STACK_SIZE  (1024 * 64) /* 64 KB for ThreadX byte pool stack */
+#endif
+
+/* Execution change hooks, implemented by the profiler (profiler.c) */
+#define TX_ENABLE_EXECUTION_CHANGE_NOTIFY
+
+/* Scheduler idle loop hooks, WFI while no test runs (power_idle.c) */
+#define TX_LOW_POWER
 
 /* USER CODE END 1 */
 
@@ -271,12 +283,17 @@
 /*#define TX_SAFETY_CRITICAL*/
 
 /* USER CODE BEGIN 2 */
+/* Preemption thresholds are switched at run time (priority_profile.c), the generated
+   setting above is overridden here so that it survives a regeneration */
+#undef TX_DISABLE_PREEMPTION_THRESHOLD
+
 /* both */
 /* FreeRTOS compatibility layer */
 /* CMSIS RTOS V2 compatibility layer */
 #define TX_THREAD_USER_EXTENSION \
     ULONG tx_thread_detached_joinable; \
-    VOID *txfr_thread_ptr;
+    VOID *txfr_thread_ptr; \
+    unsigned long long tx_thread_profile_cycles;
 
 /* USER CODE END 2 */
 
@@ -0,0 +1,106 @@
+/**
+ * @file usb_capture.h
+ * @brief Binary capture stream on a second USB CDC ACM function
+ *
+ * The device enumerates with two CDC ACM functions: the first carries the RPC
+ * frames, the second only this stream, so bulk data never queues in front of
+ * a request or response. While started, the capture rings are moved into
+ * fixed size blocks and written to the second function as large transfers,
+ * one block is filled while the previous one is on the bus. Nothing is sent
+ * until the host opens the port (DTR), data the host does not read is lost
+ * with a gap in the stream, the RPC channel is not held up.
+ *
+ * Sources:
+ *   - current: the single track current samples of the continuous scan
+ *     (analog_manager_read_current_samples), u16 counts at ANALOG_STREAM_RATE_HZ
+ *   - sniffer: the records of the running sniffer, see sniffer.h for the layout.
+ *     The records are taken from the sniffer ring, sniffer_read then finds it
+ *     empty.
+ *
+ * Block layout, little endian, at most USB_CAPTURE_BLOCK_SIZE bytes:
+ *   header, 24 bytes
+ *     u16  magic      USB_CAPTURE_MAGIC
+ *     u8   version    USB_CAPTURE_VERSION
+ *     u8   source     UsbCaptureSource_t
+ *     u16  length     block length in bytes, header included
+ *     u16  flags      USB_CAPTURE_FLAG_*
+ *     u32  seq        block number since start, all sources
+ *     u32  first      current: sample number of the first sample,
+ *                     sniffer: records in the block
+ *     u64  time_ns    UTC in ns since 1970 when the first data was taken,
+ *                     see timebase.h
+ *   payload
+ *
+ * A block is sent when it is full or its oldest data has waited
+ * USB_CAPTURE_FLUSH_MS, the host finds the next header after length bytes.
+ */
+
+#ifndef USB_CAPTURE_H
+#define USB_CAPTURE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define USB_CAPTURE_MAGIC           0x4355u     // "UC"
+#define USB_CAPTURE_VERSION         2u
+#define USB_CAPTURE_HEADER_SIZE     24u
+#define USB_CAPTURE_BLOCK_SIZE      2048u       // one write, 32 full speed packets
+#define USB_CAPTURE_BLOCKS          4u          // filled, queued and on the bus together
+#define USB_CAPTURE_FLUSH_MS        50u
+
+/* Block flags */
+#define USB_CAPTURE_FLAG_GAP        0x0001u     // data of this source lost before the block
+
+typedef enum {
+    USB_CAPTURE_SOURCE_CURRENT = 0,
+    USB_CAPTURE_SOURCE_SNIFFER,
+    USB_CAPTURE_SOURCE_COUNT
+} UsbCaptureSource_t;
+
+typedef struct {
+    bool enabled;
+    bool listening;             // host has the port open
+    uint8_t sources;            // mask of 1 << UsbCaptureSource_t
+    uint32_t blocks;            // blocks written
+    uint32_t bytes;             // bytes written
+    uint32_t gaps;              // blocks sent with USB_CAPTURE_FLAG_GAP
+    uint32_t lost_samples;      // current samples overwritten before they were taken
+    uint32_t discarded;         // blocks the host was no longer there for
+    uint32_t tx_errors;
+    uint32_t free_blocks;
+} UsbCaptureStats_t;
+
+/**
+ * @brief Create the block queues and the fill and write threads
+ */
+void usb_capture_init(void);
+
+/**
+ * @brief Start streaming, restart with new sources if running
+ * @param sources Mask of 1 << UsbCaptureSource_t
+ * @return 0 on success, -1 without sources, the current source without continuous analog sampling
+ */
+int usb_capture_start(uint32_t sources);
+
+/**
+ * @brief Stop streaming, data not sent yet is dropped
+ */
+void usb_capture_stop(void);
+
+void usb_capture_get_stats(UsbCaptureStats_t *stats);
+
+const char *usb_capture_source_name(UsbCaptureSource_t source);
+
+/* Instance callbacks of the second CDC ACM function (app_usbx_device.c) */
+void usb_capture_activate(void *cdc_acm_instance);
+void usb_capture_deactivate(void *cdc_acm_instance);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* USB_CAPTURE_H */
@@ -2,13 +2,27 @@
 #define USBX_CDC_TRANSPORT_H
 
 #include <stdint.h>
+#include "rpc_transport_types.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+typedef struct {
+    uint32_t frames;        // frames handed to the RPC thread
+    uint32_t dropped;       // complete frames discarded because no buffer came back in time
+    uint32_t overflows;     // buffers filled without a frame terminator
+    uint32_t resyncs;       // bytes skipped looking for a valid binary header
+    uint32_t stalls;        // frames which had to wait for a free buffer
+    uint32_t free_buffers;  // buffers on the free list now
+} UsbCdcRxStats_t;
+
 uint32_t UsbCdcAcm_Write(const uint8_t* data, uint32_t length, uint32_t* actual_length);
 void UsbCdcAcm_GetStatus(uint32_t* device_configured, uint32_t* cdc_active);
+void UsbCdcAcm_GetRxStats(UsbCdcRxStats_t* stats);
+
+// Every buffer posted on the command bus has to be returned once handled
+void UsbCdcAcm_ReleaseRx(rpc_rxbuffer_t* buf);
 
 #ifdef __cplusplus
 }
@@ -1,68 +1,375 @@
 #include <stdbool.h>
+#include <string.h>
 #include "cmsis_os2.h"
 #include "main.h"
 
 #include "SUSI.h"
+#include "boot.h"
+#include "command_station.h"
+#include "dma_channels.h"
 #include "stm32h5xx_hal_spi.h"
 
+/*
+ * The transmit path never blocks: TIM7 expiring starts the next packet by DMA,
+ * the SPI end of transfer starts TIM7 with the gap. Both interrupts run at the
+ * same priority, so the engine state is only changed by one of them at a time;
+ * threads and the DCC packet hook only ever kick an idle engine.
+ */
+
+#define SUSI_STOP_WAIT_MS   10u     // longest packet at the slowest clock is well below
+
+typedef enum {
+  SUSI_ENGINE_IDLE = 0,     // nothing to send, TIM7 stopped
+  SUSI_ENGINE_GAP,          // TIM7 running
+  SUSI_ENGINE_BUSY          // packet on the wire
+} SusiEngineState_t;
+
+_Static_assert((SUSI_MASTER_QUEUE_SIZE & (SUSI_MASTER_QUEUE_SIZE - 1u)) == 0u,
+               "SUSI_MASTER_QUEUE_SIZE must be a power of two");
+
 static SPI_HandleTypeDef *hMasterSPI;
-static osThreadId_t susiThread_id;
-static osSemaphoreId_t susiStart_sem;
+static DMA_HandleTypeDef hdmaSusiTx;
+static bool susiReady = false;
+
 static volatile bool susiRunning = false;
+static volatile uint8_t engineState = SUSI_ENGINE_IDLE;
+static uint32_t gapUs = SUSI_MASTER_DEFAULT_GAP_US;
+static uint32_t nextGapUs = SUSI_MASTER_DEFAULT_GAP_US;
+static uint8_t byteIdle = SUSI_MASTER_DEFAULT_BYTE_IDLE;
+static uint8_t txBuffer[3];
 
-/* Definitions for susiTask */
-static const osThreadAttr_t susiTask_attributes = {
-  .name = "susiTask",
-  .stack_size = 1024 * 4, // 4 KB stack size
-  .priority = (osPriority_t) osPriorityNormal
-};
+// Packet queue, the RPC thread produces, TIM7 consumes
+static SusiPacket_t queue[SUSI_MASTER_QUEUE_SIZE];
+static volatile uint32_t queueHead = 0;
+static volatile uint32_t queueTail = 0;
+static uint32_t queueHighWater = 0;
 
+// DCC function state mirror, the command station packet hook produces, TIM7 consumes
+static uint16_t mirrorAddress = 0;
+static uint8_t mirrorValue[SUSI_FG_COUNT];
+static volatile uint16_t mirrorDirty = 0;  // bit n = FG(n+1) due
 
-void SUSI_MasterThread(void *argument) {
-  (void)argument;
+static volatile uint32_t statSent = 0;
+static volatile uint32_t statMirrored = 0;
+static volatile uint32_t statErrors = 0;
 
-  static uint8_t pData[2] =   {0x60,0x10};            // Example function packet data
-  static uint8_t pExData[3] = {0x71,0xA5,0x5A};   // Example extended packet data
+uint8_t SUSI_PacketLength(uint8_t command) {
+  return ((command & EXTENDED_PACKET_MASK) == EXTENDED_PACKET_PATTERN) ? 3u : 2u;
+}
 
-  while (true) {
-    // Block until externally started
-    osSemaphoreAcquire(susiStart_sem, osWaitForever);
-    
-    susiRunning = true;
+// One-pulse delay, the update interrupt starts the next packet
+static void timer_start(uint32_t us) {
+  TIM7->CR1 &= ~TIM_CR1_CEN;
+  TIM7->ARR = (us < 2u ? 2u : us) - 1u;
+  TIM7->CNT = 0;
+  TIM7->SR = 0;
+  TIM7->CR1 |= TIM_CR1_CEN;
+}
 
-    while (susiRunning) {
-      HAL_SPI_Transmit(hMasterSPI, (const uint8_t *)&pData[0], 2, HAL_MAX_DELAY);
-      osDelay(100u);
-      HAL_SPI_Transmit(hMasterSPI, (const uint8_t *)&pExData[0], 3, HAL_MAX_DELAY);
-      osDelay(100u);
-    }
-    
-    osSemaphoreRelease(susiStart_sem);
-    osDelay(5u); // Give some time for the semaphore to be released
+static void timer_stop(void) {
+  TIM7->CR1 &= ~TIM_CR1_CEN;
+  TIM7->SR = 0;
+}
+
+// Start the engine if it has gone idle (any context)
+static void kick(void) {
+  uint32_t const primask = __get_PRIMASK();
+  __disable_irq();
+  if (susiRunning && engineState == SUSI_ENGINE_IDLE) {
+    engineState = SUSI_ENGINE_GAP;
+    timer_start(2u);
+  }
+  __set_PRIMASK(primask);
+}
+
+// TIM7 context: take the next packet, mirrored function groups first
+static void next_packet(void) {
+  uint8_t length = 0;
+
+  uint32_t const primask = __get_PRIMASK();
+  __disable_irq();
+  if (susiRunning && mirrorDirty) {
+    uint32_t const group = (uint32_t)__builtin_ctz(mirrorDirty);
+    mirrorDirty &= (uint16_t)~(1u << group);
+    txBuffer[0] = (uint8_t)(SUSI_FG1 + group);
+    txBuffer[1] = mirrorValue[group];
+    length = 2u;
+    statMirrored++;
+  }
+  else if (susiRunning && queueTail != queueHead) {
+    SusiPacket_t const *packet = &queue[queueTail & (SUSI_MASTER_QUEUE_SIZE - 1u)];
+    memcpy(txBuffer, packet->bytes, packet->length);
+    length = packet->length;
+    queueTail = queueTail + 1u;
+  }
+  else {
+    engineState = SUSI_ENGINE_IDLE;
+  }
+  __set_PRIMASK(primask);
+  if (length == 0u) {
+    return;
+  }
+
+  bool const cv = txBuffer[0] == SUSI_CV_VERIFY_BYTE || txBuffer[0] == SUSI_CV_BIT || txBuffer[0] == SUSI_CV_WRITE_BYTE;
+  nextGapUs = (cv && gapUs < SUSI_MASTER_ACK_GAP_US) ? SUSI_MASTER_ACK_GAP_US : gapUs;
+  engineState = SUSI_ENGINE_BUSY;
+  if (HAL_SPI_Transmit_DMA(hMasterSPI, txBuffer, length) != HAL_OK) {
+    statErrors++;
+    engineState = SUSI_ENGINE_GAP;
+    timer_start(nextGapUs);
+  }
+}
+
+static void packet_done(void) {
+  if (susiRunning) {
+    engineState = SUSI_ENGINE_GAP;
+    timer_start(nextGapUs);
+  }
+  else {
+    engineState = SUSI_ENGINE_IDLE;
+  }
+}
+
+void SUSI_M_SPI_TxCpltCallback(SPI_HandleTypeDef *hspi) {
+  (void)hspi;
+  statSent++;
+  packet_done();
+}
+
+void SUSI_M_SPI_ErrorCallback(SPI_HandleTypeDef *hspi) {
+  (void)hspi;
+  statErrors++;
+  packet_done();
+}
+
+void TIM7_IRQHandler(void) {
+  if (TIM7->SR & TIM_SR_UIF) {
+    TIM7->SR = ~TIM_SR_UIF;
+    next_packet();
+  }
+}
+
+void SUSI_MASTER_TX_DMA_IRQHandler(void) {
+  HAL_DMA_IRQHandler(&hdmaSusiTx);
+}
+
+// Command station transmit interrupt: function groups of the mirrored address
+static void mirror_packet(uint32_t packet_seq, const uint8_t *bytes, uint8_t length) {
+  (void)packet_seq;
+  uint8_t check = 0;
+  for (uint8_t i = 0; i < length; i++) {
+    check ^= bytes[i];
+  }
+  if (length < 3u || check != 0u) {
+    return;
   }
+
+  uint16_t address;
+  uint8_t i;
+  if (bytes[0] >= 1u && bytes[0] <= 127u) {
+    address = bytes[0];
+    i = 1u;
+  }
+  else if (bytes[0] >= 0xC0u && bytes[0] <= 0xE7u) {
+    address = (uint16_t)(((bytes[0] & 0x3Fu) << 8) | bytes[1]);
+    i = 2u;
+  }
+  else {
+    return;
+  }
+  if (address != mirrorAddress || i + 1u >= length) {
+    return;
+  }
+
+  uint8_t const instruction = bytes[i];
+  bool const data = i + 2u < length;   // a byte follows the instruction before the checksum
+  int32_t group = -1;
+  switch (instruction & 0xE0u) {
+    case 0x80u:   // F0 F4 F3 F2 F1, same layout as FG1
+      group = 0;
+      mirrorValue[0] = instruction & 0x1Fu;
+      break;
+    case 0xA0u:   // F8-F5 or F12-F9, FG2 holds F12-F5
+      group = 1;
+      if (instruction & 0x10u) {
+        mirrorValue[1] = (uint8_t)((mirrorValue[1] & 0xF0u) | (instruction & 0x0Fu));
+      }
+      else {
+        mirrorValue[1] = (uint8_t)((mirrorValue[1] & 0x0Fu) | ((instruction & 0x0Fu) << 4));
+      }
+      break;
+    case 0xC0u:   // feature expansion: F13-F20 (0xDE), F21-F28 (0xDF), F29-F68 (0xD8-0xDC)
+      if (!data) {
+        break;
+      }
+      if (instruction == 0xDEu) {
+        group = 2;
+      }
+      else if (instruction == 0xDFu) {
+        group = 3;
+      }
+      else if (instruction >= 0xD8u && instruction <= 0xDCu) {
+        group = 4 + (int32_t)(instruction - 0xD8u);
+      }
+      if (group >= 0) {
+        mirrorValue[group] = bytes[i + 1u];
+      }
+      break;
+    default:
+      break;
+  }
+  if (group < 0) {
+    return;
+  }
+  // Every refresh is forwarded, like a decoder passing its function state on
+  mirrorDirty |= (uint16_t)(1u << group);
+  kick();
 }
 
+static bool dma_init(void) {
+  __HAL_RCC_GPDMA2_CLK_ENABLE();
 
+  hdmaSusiTx.Instance = SUSI_MASTER_TX_DMA_CHANNEL;
+  hdmaSusiTx.Init.Request = SUSI_MASTER_TX_DMA_REQUEST;
+  hdmaSusiTx.Init.BlkHWRequest = DMA_BREQ_SINGLE_BURST;
+  hdmaSusiTx.Init.Direction = DMA_MEMORY_TO_PERIPH;
+  hdmaSusiTx.Init.SrcInc = DMA_SINC_INCREMENTED;
+  hdmaSusiTx.Init.DestInc = DMA_DINC_FIXED;
+  hdmaSusiTx.Init.SrcDataWidth = DMA_SRC_DATAWIDTH_BYTE;
+  hdmaSusiTx.Init.DestDataWidth = DMA_DEST_DATAWIDTH_BYTE;
+  hdmaSusiTx.Init.Priority = DMA_LOW_PRIORITY_HIGH_WEIGHT;
+  hdmaSusiTx.Init.SrcBurstLength = 1;
+  hdmaSusiTx.Init.DestBurstLength = 1;
+  hdmaSusiTx.Init.TransferAllocatedPort = DMA_SRC_ALLOCATED_PORT0 | DMA_DEST_ALLOCATED_PORT0;
+  hdmaSusiTx.Init.TransferEventMode = DMA_TCEM_BLOCK_TRANSFER;
+  hdmaSusiTx.Init.Mode = DMA_NORMAL;
+  if (HAL_DMA_Init(&hdmaSusiTx) != HAL_OK) {
+    return false;
+  }
+  __HAL_LINKDMA(hMasterSPI, hdmatx, hdmaSusiTx);
 
+  HAL_NVIC_SetPriority(SUSI_MASTER_TX_DMA_IRQn, SUSI_MASTER_TIM_PRIORITY, 0);
+  HAL_NVIC_EnableIRQ(SUSI_MASTER_TX_DMA_IRQn);
+  return true;
+}
+
+static void timer_init(void) {
+  __HAL_RCC_TIM7_CLK_ENABLE();
+  TIM7->CR1 = TIM_CR1_OPM | TIM_CR1_URS;   // UG below does not raise the interrupt
+  TIM7->PSC = 249;                         // 1 us ticks like TIM2
+  TIM7->DIER = TIM_DIER_UIE;
+  TIM7->EGR = TIM_EGR_UG;
+  TIM7->SR = 0;
+  HAL_NVIC_SetPriority(TIM7_IRQn, SUSI_MASTER_TIM_PRIORITY, 0);
+  HAL_NVIC_EnableIRQ(TIM7_IRQn);
+}
+
+// Reapply the SPI configuration with the inter byte idle time
+static bool spi_configure(uint8_t idle) {
+  hMasterSPI->Init.MasterInterDataIdleness = (uint32_t)idle << SPI_CFG2_MIDI_Pos;
+  if (HAL_SPI_DeInit(hMasterSPI) != HAL_OK || HAL_SPI_Init(hMasterSPI) != HAL_OK) {
+    return false;
+  }
+  __HAL_LINKDMA(hMasterSPI, hdmatx, hdmaSusiTx);
+  return true;
+}
 
 void SUSI_Master_Init(SPI_HandleTypeDef *hspi) {
   hMasterSPI = hspi;
-  susiStart_sem = osSemaphoreNew(1, 0, NULL);  // Start locked
-  susiThread_id = osThreadNew(SUSI_MasterThread, NULL, &susiTask_attributes);
+  timer_init();
+  susiReady = dma_init();
 }
 
-void SUSI_Master_Start(void) {
-  if (!susiRunning) {
-    susiRunning = true;
-    osSemaphoreRelease(susiStart_sem);
+// Stop sending, the queue is kept
+static void engine_halt(void) {
+  CommandStation_SetPacketHook(COMMAND_STATION_HOOK_SUSI, NULL);
+  susiRunning = false;
+
+  // A packet on the wire finishes, the engine then stays idle
+  for (uint32_t ms = 0; engineState == SUSI_ENGINE_BUSY && ms < SUSI_STOP_WAIT_MS; ms++) {
+    osDelay(1u);
+  }
+  if (engineState == SUSI_ENGINE_BUSY) {
+    HAL_SPI_Abort(hMasterSPI);
   }
+  timer_stop();
+  engineState = SUSI_ENGINE_IDLE;
+  mirrorDirty = 0;
 }
 
 void SUSI_Master_Stop(void) {
-  if (susiRunning) {
-    susiRunning = false;
-    osSemaphoreAcquire(susiStart_sem, osWaitForever);
+  engine_halt();
+  queueTail = queueHead;
+}
+
+bool SUSI_Master_StartEx(uint32_t gap_us, uint8_t byte_idle, uint16_t mirror_address) {
+  boot_require(BOOT_SUBSYSTEM_SUSI_MASTER);
+  if (!susiReady || gap_us == 0u || gap_us > SUSI_MASTER_MAX_GAP_US ||
+      byte_idle > SUSI_MASTER_MAX_BYTE_IDLE || mirror_address > 10239u) {
+    return false;
+  }
+  engine_halt();
+  if (!spi_configure(byte_idle)) {
+    return false;
+  }
+
+  gapUs = gap_us;
+  nextGapUs = gap_us;
+  byteIdle = byte_idle;
+  queueHighWater = queueHead - queueTail;
+  statSent = 0;
+  statMirrored = 0;
+  statErrors = 0;
+  memset(mirrorValue, 0, sizeof(mirrorValue));
+  mirrorDirty = 0;
+  mirrorAddress = mirror_address;
+  CommandStation_SetPacketHook(COMMAND_STATION_HOOK_SUSI, mirror_address ? mirror_packet : NULL);
+
+  // Idle clock first so that the slaves synchronise on the first byte
+  susiRunning = true;
+  engineState = SUSI_ENGINE_GAP;
+  timer_start(SUSI_MASTER_SYNC_US);
+  return true;
+}
+
+void SUSI_Master_Start(void) {
+  if (!susiRunning) {
+    SUSI_Master_StartEx(SUSI_MASTER_DEFAULT_GAP_US, SUSI_MASTER_DEFAULT_BYTE_IDLE, 0u);
   }
 }
 
+bool SUSI_Master_Queue(const SusiPacket_t *packets, uint32_t count) {
+  uint32_t const head = queueHead;
+  if (count > SUSI_MASTER_QUEUE_SIZE - (head - queueTail)) {
+    return false;
+  }
+  for (uint32_t i = 0; i < count; i++) {
+    if (packets[i].length != SUSI_PacketLength(packets[i].bytes[0])) {
+      return false;
+    }
+  }
+  for (uint32_t i = 0; i < count; i++) {
+    queue[(head + i) & (SUSI_MASTER_QUEUE_SIZE - 1u)] = packets[i];
+  }
+  __DMB();
+  queueHead = head + count;
+  uint32_t const fill = queueHead - queueTail;
+  if (fill > queueHighWater) {
+    queueHighWater = fill;
+  }
+  kick();
+  return true;
+}
 
+void SUSI_Master_GetStats(SusiMasterStats_t *stats) {
+  stats->running = susiRunning;
+  stats->gap_us = gapUs;
+  stats->byte_idle = byteIdle;
+  stats->mirror_address = mirrorAddress;
+  stats->queued = queueHead - queueTail;
+  stats->capacity = SUSI_MASTER_QUEUE_SIZE;
+  stats->high_water = queueHighWater;
+  stats->sent = statSent;
+  stats->mirrored = statMirrored;
+  stats->errors = statErrors;
+}
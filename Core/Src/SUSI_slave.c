@@ -1,137 +1,260 @@
 #include <stdbool.h>
-#include <stdio.h>
+#include <string.h>
 #include "cmsis_os2.h"
 #include "main.h"
 
 #include "SUSI.h"
+#include "boot.h"
+#include "dma_channels.h"
 #include "stm32h5xx_hal_spi.h"
 
-static SPI_HandleTypeDef *hSlaveSPI;
-static osThreadId_t susiThread_id;
-static osSemaphoreId_t susiStart_sem;
-static volatile bool susiRunning = false;
+/*
+ * The receive path never re-initialises the SPI: a circular DMA copies every
+ * byte from SPI2 into rxDma, TIM16 polls its write position, frames the bytes
+ * by the command length and stamps them with the poll time. A byte shifted in
+ * by a spurious clock edge would offset every later byte, so after
+ * PACKET_TIMEOUT_MS without a byte the SPI is toggled off and on to drop
+ * partial bits and the framer restarts with the next byte. TIM16 is the only
+ * producer of the frame ring, the RPC thread its only consumer.
+ */
 
-/* Definitions for susiTask */
-static const osThreadAttr_t susiTask_attributes = {
-  .name = "susiTask",
-  .stack_size = 1024 * 4, // 4 KB stack size
-  .priority = (osPriority_t) osPriorityNormal
-};
+#define SUSI_SLAVE_DMA_SIZE     64u     // bytes, far more than arrive within one poll period
 
-uint8_t rxBuffer[3];
-uint8_t txBuffer[5];
+_Static_assert((SUSI_SLAVE_FRAMES & (SUSI_SLAVE_FRAMES - 1u)) == 0u,
+               "SUSI_SLAVE_FRAMES must be a power of two");
 
-static osEventFlagsId_t spiRxEvent;
-#define SPI_RX_3BYTES_FLAG  (1 << 0)
+static SPI_HandleTypeDef *hSlaveSPI;
+static DMA_HandleTypeDef hdmaSusiRx;
+static DMA_NodeTypeDef rxNode;
+static DMA_QListTypeDef rxQueue;
+static uint8_t rxDma[SUSI_SLAVE_DMA_SIZE];
 
-void SUSI_S_SPI_RxCpltCallback(SPI_HandleTypeDef *hspi) {
-  (void)hspi;  // Unused parameter
+static volatile bool susiRunning = false;
+static uint32_t rxIndex = 0;            // next byte of rxDma to frame
+static uint32_t nowUs = 0;              // poll time
+static uint32_t lastByteUs = 0;
+static bool synced = false;             // SPI reset since the last byte
+static uint8_t partial[3];
+static uint8_t partialLength = 0;
 
-  osEventFlagsSet(spiRxEvent, SPI_RX_3BYTES_FLAG);
-}
+// Frame ring, TIM16 produces, the RPC thread consumes
+static SusiFrame_t frames[SUSI_SLAVE_FRAMES];
+static volatile uint32_t frameHead = 0;
+static volatile uint32_t frameTail = 0;
 
+static volatile uint32_t statFrames = 0;
+static volatile uint32_t statBytes = 0;
+static volatile uint32_t statResyncs = 0;
+static volatile uint32_t statOverflows = 0;
+static volatile uint32_t statErrors = 0;
+static uint8_t fgValue[SUSI_FG_COUNT];
 
-HAL_StatusTypeDef spi_conditional_rx(void) {
-    osEventFlagsClear(spiRxEvent, SPI_RX_3BYTES_FLAG);
-    HAL_SPI_DeInit(hSlaveSPI);
-    HAL_SPI_Init(hSlaveSPI);
-    rxBuffer[0] = 0;  // Clear the first byte
-    rxBuffer[1] = 0;  // Clear the second byte
-    rxBuffer[2] = 0;  // Clear the third byte 
-
-    HAL_StatusTypeDef status = HAL_SPI_Receive_IT(hSlaveSPI, rxBuffer, 3);
-    if (status != HAL_OK)
-      return status;
-    osEventFlagsWait(spiRxEvent, SPI_RX_3BYTES_FLAG, osFlagsWaitAny, PACKET_TIMEOUT_MS);
-    if ((rxBuffer[0] == 0) && (rxBuffer[1] == 0) && (rxBuffer[2] == 0))
-      return HAL_TIMEOUT;  // No data received within timeout
-    return HAL_OK;
+// Drop bits of an incomplete byte, the DMA keeps its position
+static void spi_resync(void) {
+  SPI_TypeDef *const spi = hSlaveSPI->Instance;
+  spi->CR1 &= ~SPI_CR1_SPE;
+  spi->IFCR = SPI_IFCR_OVRC;
+  spi->CR1 |= SPI_CR1_SPE;
 }
 
+static void frame_push(void) {
+  uint32_t const head = frameHead;
+  statFrames++;
+  if (partial[0] >= SUSI_FG1 && partial[0] <= SUSI_FG9) {
+    fgValue[partial[0] - SUSI_FG1] = partial[1];
+  }
+  if (head - frameTail >= SUSI_SLAVE_FRAMES) {
+    statOverflows++;
+    return;
+  }
+  SusiFrame_t *frame = &frames[head & (SUSI_SLAVE_FRAMES - 1u)];
+  frame->time_us = nowUs;
+  memcpy(frame->bytes, partial, sizeof(partial));
+  frame->length = partialLength;
+  frameHead = head + 1u;
+}
 
-/**
- * @brief SUSI Slave Thread
- * 
- * This thread waits for the semaphore to be released, indicating that the SUSI slave should start.
- * It runs in a loop until the SUSI slave is stopped, executing the necessary operations.
- */
-void SUSI_SlaveThread(void *argument) {
-  (void)argument;  // Unused parameter
-
-  while (true) {
-    // Block until externally started
-    osSemaphoreAcquire(susiStart_sem, osWaitForever);
-    
-    susiRunning = true;
-
-    spiRxEvent = osEventFlagsNew(NULL);
-    while (susiRunning) {
-      if (spi_conditional_rx() == HAL_OK) {
-        // Process received data
-        switch (rxBuffer[0]) {
-          case SUSI_FG1:
-            printf("SUSI_FG1 received: 0x%02X\r\n", rxBuffer[1]);
-            break;
-          case SUSI_FG2:
-            printf("SUSI_FG2 received: 0x%02X\r\n", rxBuffer[1]);
-            break;
-          case SUSI_FG3:
-            printf("SUSI_FG3 received: 0x%02X\r\n", rxBuffer[1]);
-            break;
-          case SUSI_FG4:
-            printf("SUSI_FG4 received: 0x%02X\r\n", rxBuffer[1]);
-            break;
-          case SUSI_FG5:
-            printf("SUSI_FG5 received: 0x%02X\r\n", rxBuffer[1]);
-            break; 
-          case SUSI_FG6: 
-            printf("SUSI_FG6 received: 0x%02X\r\n", rxBuffer[1]);
-            break;  
-          case SUSI_FG7:
-            printf("SUSI_FG7 received: 0x%02X\r\n", rxBuffer[1]);
-            break;
-          case SUSI_FG8:
-            printf("SUSI_FG8 received: 0x%02X\r\n", rxBuffer[1]);
-            break;
-          case SUSI_FG9:
-            printf("SUSI_FG9 received: 0x%02X\r\n", rxBuffer[1]);
-            break;
-          default:
-            // Handle unexpected or extended packet type
-            if ((rxBuffer[0] & EXTENDED_PACKET_MASK) == EXTENDED_PACKET_PATTERN) {
-              printf("Extended packet received: 0x%02X 0x%02X\r\n", rxBuffer[1], rxBuffer[2]);
-            }
-            else {
-              printf("Unexpected packet received: 0x%02X\r\n", rxBuffer[0]);
-            }
-            break;
-        }
+// TIM16 context: frame the bytes the DMA has written since the last poll
+static void poll(void) {
+  nowUs += SUSI_SLAVE_POLL_US;
+  if (hSlaveSPI->Instance->SR & SPI_SR_OVR) {
+    hSlaveSPI->Instance->IFCR = SPI_IFCR_OVRC;
+    statErrors++;
+  }
+
+  uint32_t const write_index = (SUSI_SLAVE_DMA_SIZE - __HAL_DMA_GET_COUNTER(&hdmaSusiRx)) % SUSI_SLAVE_DMA_SIZE;
+  if (rxIndex == write_index) {
+    if (!synced && nowUs - lastByteUs >= PACKET_TIMEOUT_MS * 1000u) {
+      if (partialLength) {
+        statResyncs++;
+        partialLength = 0;
       }
+      spi_resync();
+      synced = true;
+    }
+    return;
+  }
+
+  while (rxIndex != write_index) {
+    uint8_t const byte = rxDma[rxIndex];
+    rxIndex = (rxIndex + 1u) % SUSI_SLAVE_DMA_SIZE;
+    statBytes++;
+    partial[partialLength++] = byte;
+    if (partialLength == SUSI_PacketLength(partial[0])) {
+      frame_push();
+      partialLength = 0;
     }
-    
-    osSemaphoreRelease(susiStart_sem);
-    osDelay(5u); // Give some time for the semaphore to be released
   }
+  lastByteUs = nowUs;
+  synced = false;
+}
+
+void TIM16_IRQHandler(void) {
+  if (TIM16->SR & TIM_SR_UIF) {
+    TIM16->SR = ~TIM_SR_UIF;
+    poll();
+  }
+}
+
+static void timer_init(void) {
+  __HAL_RCC_TIM16_CLK_ENABLE();
+  TIM16->CR1 = TIM_CR1_URS;                 // UG below does not raise the interrupt
+  TIM16->PSC = 249;                         // 1 us ticks like TIM2
+  TIM16->ARR = SUSI_SLAVE_POLL_US - 1u;
+  TIM16->DIER = TIM_DIER_UIE;
+  TIM16->EGR = TIM_EGR_UG;
+  TIM16->SR = 0;
+  HAL_NVIC_SetPriority(TIM16_IRQn, SUSI_SLAVE_TIM_PRIORITY, 0);
+  HAL_NVIC_EnableIRQ(TIM16_IRQn);
 }
 
+// Circular DMA of SPI2 RXDR into rxDma, no interrupts, the position is polled
+static bool dma_start(void) {
+  __HAL_RCC_GPDMA2_CLK_ENABLE();
+
+  DMA_NodeConfTypeDef nodeConfig = {0};
+  nodeConfig.NodeType = DMA_GPDMA_LINEAR_NODE;
+  nodeConfig.Init.Request = SUSI_SLAVE_RX_DMA_REQUEST;
+  nodeConfig.Init.BlkHWRequest = DMA_BREQ_SINGLE_BURST;
+  nodeConfig.Init.Direction = DMA_PERIPH_TO_MEMORY;
+  nodeConfig.Init.SrcInc = DMA_SINC_FIXED;
+  nodeConfig.Init.DestInc = DMA_DINC_INCREMENTED;
+  nodeConfig.Init.SrcDataWidth = DMA_SRC_DATAWIDTH_BYTE;
+  nodeConfig.Init.DestDataWidth = DMA_DEST_DATAWIDTH_BYTE;
+  nodeConfig.Init.SrcBurstLength = 1;
+  nodeConfig.Init.DestBurstLength = 1;
+  nodeConfig.Init.TransferAllocatedPort = DMA_SRC_ALLOCATED_PORT0 | DMA_DEST_ALLOCATED_PORT0;
+  nodeConfig.Init.TransferEventMode = DMA_TCEM_BLOCK_TRANSFER;
+  nodeConfig.Init.Mode = DMA_NORMAL;
+  nodeConfig.TriggerConfig.TriggerPolarity = DMA_TRIG_POLARITY_MASKED;
+  nodeConfig.DataHandlingConfig.DataExchange = DMA_EXCHANGE_NONE;
+  nodeConfig.DataHandlingConfig.DataAlignment = DMA_DATA_RIGHTALIGN_ZEROPADDED;
+  nodeConfig.SrcAddress = (uint32_t)&hSlaveSPI->Instance->RXDR;
+  nodeConfig.DstAddress = (uint32_t)rxDma;
+  nodeConfig.DataSize = sizeof(rxDma);
+
+  if (HAL_DMAEx_List_BuildNode(&nodeConfig, &rxNode) != HAL_OK ||
+      HAL_DMAEx_List_ResetQ(&rxQueue) != HAL_OK ||
+      HAL_DMAEx_List_InsertNode(&rxQueue, NULL, &rxNode) != HAL_OK ||
+      HAL_DMAEx_List_SetCircularMode(&rxQueue) != HAL_OK) {
+    return false;
+  }
+
+  hdmaSusiRx.Instance = SUSI_SLAVE_RX_DMA_CHANNEL;
+  hdmaSusiRx.InitLinkedList.Priority = DMA_LOW_PRIORITY_HIGH_WEIGHT;
+  hdmaSusiRx.InitLinkedList.LinkStepMode = DMA_LSM_FULL_EXECUTION;
+  hdmaSusiRx.InitLinkedList.LinkAllocatedPort = DMA_LINK_ALLOCATED_PORT0;
+  hdmaSusiRx.InitLinkedList.TransferEventMode = DMA_TCEM_BLOCK_TRANSFER;
+  hdmaSusiRx.InitLinkedList.LinkedListMode = DMA_LINKEDLIST_CIRCULAR;
+  if (HAL_DMAEx_List_Init(&hdmaSusiRx) != HAL_OK ||
+      HAL_DMAEx_List_LinkQ(&hdmaSusiRx, &rxQueue) != HAL_OK) {
+    return false;
+  }
+  return HAL_DMAEx_List_Start(&hdmaSusiRx) == HAL_OK;
+}
 
+static void dma_stop(void) {
+  HAL_DMA_Abort(&hdmaSusiRx);
+  HAL_DMAEx_List_UnLinkQ(&hdmaSusiRx);
+  HAL_DMAEx_List_DeInit(&hdmaSusiRx);
+}
 
 void SUSI_Slave_Init(SPI_HandleTypeDef *hspi) {
   hSlaveSPI = hspi;
-  susiStart_sem = osSemaphoreNew(1, 0, NULL);  // Start locked
-  susiThread_id = osThreadNew(SUSI_SlaveThread, NULL, &susiTask_attributes);
+  timer_init();
 }
 
-void SUSI_Slave_Start(void) {
+void SUSI_Slave_Stop(void) {
   if (!susiRunning) {
-    susiRunning = true;
-    osSemaphoreRelease(susiStart_sem);
+    return;
   }
+  TIM16->CR1 &= ~TIM_CR1_CEN;
+  TIM16->SR = 0;
+  SPI_TypeDef *const spi = hSlaveSPI->Instance;
+  spi->CR1 &= ~SPI_CR1_SPE;
+  spi->CFG1 &= ~SPI_CFG1_RXDMAEN;
+  dma_stop();
+  susiRunning = false;
 }
 
-void SUSI_Slave_Stop(void) {
-  if (susiRunning) {
-    susiRunning = false;
-    osSemaphoreAcquire(susiStart_sem, osWaitForever);
+bool SUSI_Slave_Start(void) {
+  boot_require(BOOT_SUBSYSTEM_SUSI_SLAVE);
+  SUSI_Slave_Stop();
+
+  rxIndex = 0;
+  nowUs = 0;
+  lastByteUs = 0;
+  synced = false;
+  partialLength = 0;
+  frameTail = frameHead;
+  statFrames = 0;
+  statBytes = 0;
+  statResyncs = 0;
+  statOverflows = 0;
+  statErrors = 0;
+  memset(fgValue, 0, sizeof(fgValue));
+
+  if (!dma_start()) {
+    dma_stop();
+    return false;
   }
+
+  // Receive only, endless transfer; the configuration from HAL_SPI_Init stays as it is
+  SPI_TypeDef *const spi = hSlaveSPI->Instance;
+  spi->CR1 &= ~(SPI_CR1_SPE | SPI_CR1_HDDIR);
+  spi->CR2 &= ~SPI_CR2_TSIZE;
+  spi->IFCR = SPI_IFCR_OVRC;
+  spi->CFG1 |= SPI_CFG1_RXDMAEN;
+  spi->CR1 |= SPI_CR1_SPE;
+
+  susiRunning = true;
+  TIM16->CNT = 0;
+  TIM16->SR = 0;
+  TIM16->CR1 |= TIM_CR1_CEN;
+  return true;
+}
+
+uint32_t SUSI_Slave_Read(SusiFrame_t *out, uint32_t max) {
+  uint32_t count = 0;
+  while (count < max && frameTail != frameHead) {
+    out[count++] = frames[frameTail & (SUSI_SLAVE_FRAMES - 1u)];
+    frameTail = frameTail + 1u;
+  }
+  return count;
+}
+
+void SUSI_Slave_GetStats(SusiSlaveStats_t *stats) {
+  uint32_t const primask = __get_PRIMASK();
+  __disable_irq();
+  stats->running = susiRunning;
+  stats->time_us = nowUs;
+  stats->frames = statFrames;
+  stats->bytes = statBytes;
+  stats->resyncs = statResyncs;
+  stats->overflows = statOverflows;
+  stats->errors = statErrors;
+  stats->pending = frameHead - frameTail;
+  stats->capacity = SUSI_SLAVE_FRAMES;
+  memcpy(stats->function_groups, fgValue, sizeof(stats->function_groups));
+  __set_PRIMASK(primask);
 }
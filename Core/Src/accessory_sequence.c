@@ -0,0 +1,466 @@
+/**
+ * @file accessory_sequence.c
+ * @brief Accessory switching sequences and their output latency
+ *
+ * The configuration and the sequence position are shared by the RPC thread
+ * and the command station thread under the lock. The trials belong to the
+ * transmit (packet hook) and EXTI (edge hook) interrupts, each hook updates
+ * its channel with interrupts disabled for a handful of instructions and the
+ * readers copy one channel at a time the same way.
+ */
+
+#include "accessory_sequence.h"
+#include "command_station.h"
+#include "gpio_io.h"
+#include "parameter_manager.h"
+#include "response_latency.h"
+#include "cmsis_os2.h"
+#include "rtos_static.h"
+#include "stm32h5xx.h"
+#include <string.h>
+
+_Static_assert(ACCESSORY_SEQUENCE_MAX_PINS <= GPIO_IO_PIN_COUNT, "a channel per IO at most");
+
+typedef struct {
+    bool open;
+    bool on;                    // command of the open trial
+    uint32_t start;             // cycle counter at the end bit
+    bool last_valid;            // last command seen, its repeats open no trial
+    bool last_on;
+    uint16_t last_address;
+} Trial_t;
+
+static osMutexId_t g_lock = NULL;
+RTOS_MUTEX(accessoryLock);
+static AccessorySequenceConfig_t g_config = {
+    .type = ACCESSORY_SEQUENCE_BASIC,
+    .aspect_on = 1u,
+    .address_count = 1u,
+    .packets = 1u,
+    .on_ms = 100u,
+    .off_ms = 100u,
+    .passes = 1u,
+    .timeout_ms = 500u,
+};
+
+// Sequence position (command station thread)
+static uint32_t g_pass = 0;
+static uint16_t g_index = 0;                // address of the range, 0 based
+static bool g_phaseOff = false;             // the next command switches off
+static uint8_t g_repeat = 0;                // transmissions of the current command so far
+static uint32_t g_commands = 0;
+
+static bool g_running = false;              // between Prepare and Finish
+
+// Measurement (interrupts)
+static bool volatile g_measuring = false;
+static uint32_t g_cyclesPerUs = 1u;
+static uint32_t g_timeoutCycles = 0;
+static uint8_t g_ioChannel[GPIO_IO_PIN_COUNT + 1u];    // IO number -> channel + 1, 0 if none
+static Trial_t g_trial[ACCESSORY_SEQUENCE_MAX_PINS];
+static AccessorySequenceChannel_t g_channel[ACCESSORY_SEQUENCE_MAX_PINS];
+static uint32_t g_trials = 0;
+
+static void lock(void)
+{
+    osMutexAcquire(g_lock, osWaitForever);
+}
+
+static void unlock(void)
+{
+    osMutexRelease(g_lock);
+}
+
+static void latency_clear(AccessorySequenceLatency_t *latency)
+{
+    memset(latency, 0, sizeof(*latency));
+    latency->min_us = UINT32_MAX;
+}
+
+static void latency_add(AccessorySequenceLatency_t *latency, uint32_t cycles)
+{
+    uint32_t const us = cycles / g_cyclesPerUs;
+    latency->count++;
+    latency->sum_us += us;
+    if (us < latency->min_us) {
+        latency->min_us = us;
+    }
+    if (us > latency->max_us) {
+        latency->max_us = us;
+    }
+}
+
+static void trial_fail(uint32_t channel)
+{
+    Trial_t *const trial = &g_trial[channel];
+    if (trial->open) {
+        AccessorySequenceChannel_t *const results = &g_channel[channel];
+        if (trial->on) {
+            results->on.timeouts++;
+        } else {
+            results->off.timeouts++;
+        }
+        trial->open = false;
+    }
+}
+
+static void trials_timeout(uint32_t now)
+{
+    for (uint32_t i = 0; i < g_config.pin_count; i++) {
+        if (g_trial[i].open && now - g_trial[i].start >= g_timeoutCycles) {
+            trial_fail(i);
+        }
+    }
+}
+
+// Output address and command of an accessory packet, false for other packets
+static bool decode_packet(const uint8_t *bytes, uint8_t length, uint16_t *address, bool *on)
+{
+    if (length < 3u || (bytes[0] & 0xC0u) != 0x80u) {
+        return false;
+    }
+    uint16_t const board = (uint16_t)((bytes[0] & 0x3Fu) | ((~bytes[1] & 0x70u) << 2));
+    *address = (uint16_t)((board << 2) | ((bytes[1] >> 1) & 0x03u));
+    if (bytes[1] & 0x80u) {
+        if (g_config.type != ACCESSORY_SEQUENCE_BASIC || length != 3u || (bytes[1] & 0x01u) != g_config.output) {
+            return false;
+        }
+        *on = (bytes[1] & 0x08u) != 0u;
+        return true;
+    }
+    if (g_config.type != ACCESSORY_SEQUENCE_EXTENDED || length != 4u || (bytes[1] & 0x09u) != 0x01u) {
+        return false;
+    }
+    if (bytes[2] == g_config.aspect_on) {
+        *on = true;
+    } else if (bytes[2] == g_config.aspect_off) {
+        *on = false;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static void sequence_packet(uint32_t packet_seq, const uint8_t *bytes, uint8_t length)
+{
+    (void)packet_seq;
+    uint32_t const now = DWT->CYCCNT;
+    uint16_t address;
+    bool on;
+    bool const accessory = decode_packet(bytes, length, &address, &on);
+    uint32_t const primask = __get_PRIMASK();
+    __disable_irq();
+
+    trials_timeout(now);
+    if (accessory && (uint16_t)(address - g_config.address_first) < g_config.address_count) {
+        uint32_t const channel = (uint32_t)(address - g_config.address_first) % g_config.pin_count;
+        Trial_t *const trial = &g_trial[channel];
+        if (!trial->last_valid || trial->last_address != address || trial->last_on != on) {
+            // A command for the pin before the previous one was answered
+            trial_fail(channel);
+            trial->open = true;
+            trial->on = on;
+            trial->start = now;
+            trial->last_valid = true;
+            trial->last_address = address;
+            trial->last_on = on;
+            g_trials++;
+        }
+    }
+
+    __set_PRIMASK(primask);
+}
+
+static void sequence_edge(const GpioIoEdge_t *edge)
+{
+    uint8_t const channel = edge->io <= GPIO_IO_PIN_COUNT ? g_ioChannel[edge->io] : 0u;
+    if (channel == 0u) {
+        return;
+    }
+    Trial_t *const trial = &g_trial[channel - 1u];
+    AccessorySequenceChannel_t *const results = &g_channel[channel - 1u];
+    uint32_t const primask = __get_PRIMASK();
+    __disable_irq();
+
+    // An edge stamped before the packet hook preempted its handler belongs to the previous command
+    uint32_t const cycles = (uint32_t)edge->cycles;
+    if (trial->open && (int32_t)(cycles - trial->start) >= 0) {
+        latency_add(trial->on ? &results->on : &results->off, cycles - trial->start);
+        trial->open = false;
+    } else {
+        results->extra_edges++;
+    }
+    trials_timeout(DWT->CYCCNT);
+
+    __set_PRIMASK(primask);
+}
+
+static void rewind_locked(void)
+{
+    g_pass = 0;
+    g_index = 0;
+    g_phaseOff = false;
+    g_repeat = 0;
+    g_commands = 0;
+}
+
+void AccessorySequence_Init(void)
+{
+    if (g_lock != NULL) {
+        return;
+    }
+    for (uint32_t i = 0; i < ACCESSORY_SEQUENCE_MAX_PINS; i++) {
+        latency_clear(&g_channel[i].on);
+        latency_clear(&g_channel[i].off);
+    }
+    g_lock = osMutexNew(&accessoryLock_attr);
+}
+
+int AccessorySequence_Configure(const AccessorySequenceConfig_t *config, const char **error)
+{
+    const char *dummy;
+    if (error == NULL) {
+        error = &dummy;
+    }
+    if (config == NULL) {
+        *error = "invalid arguments";
+        return -1;
+    }
+    if (config->type > ACCESSORY_SEQUENCE_EXTENDED) {
+        *error = "type must be basic or extended";
+        return -1;
+    }
+    if (config->address_count == 0u || config->address_first >= ACCESSORY_SEQUENCE_ADDRESSES ||
+        config->address_count > ACCESSORY_SEQUENCE_ADDRESSES - config->address_first) {
+        *error = "address range must lie within 0-2047";
+        return -1;
+    }
+    if (config->output > 1u) {
+        *error = "output must be 0 or 1";
+        return -1;
+    }
+    if (config->type == ACCESSORY_SEQUENCE_EXTENDED && config->aspect_on == config->aspect_off) {
+        *error = "aspect_on and aspect_off must differ";
+        return -1;
+    }
+    if (config->packets == 0u || config->packets > ACCESSORY_SEQUENCE_MAX_PACKETS) {
+        *error = "packets must be 1-16";
+        return -1;
+    }
+    if (config->on_ms > ACCESSORY_SEQUENCE_MAX_TIME_MS || config->off_ms > ACCESSORY_SEQUENCE_MAX_TIME_MS) {
+        *error = "on_ms and off_ms must be 0-60000";
+        return -1;
+    }
+    if (config->timeout_ms == 0u || config->timeout_ms > ACCESSORY_SEQUENCE_MAX_TIMEOUT_MS) {
+        *error = "timeout_ms must be 1-10000";
+        return -1;
+    }
+    if (config->pin_count > ACCESSORY_SEQUENCE_MAX_PINS) {
+        *error = "too many pins";
+        return -1;
+    }
+    uint16_t pins = 0;
+    for (uint32_t i = 0; i < config->pin_count; i++) {
+        uint8_t const io = config->pins[i];
+        if (io == 0u || io > GPIO_IO_PIN_COUNT || (pins & (1u << (io - 1u)))) {
+            *error = "pins must be distinct IO numbers 1-15";
+            return -1;
+        }
+        pins |= (uint16_t)(1u << (io - 1u));
+    }
+
+    lock();
+    if (g_running) {
+        unlock();
+        *error = "accessory sequence running";
+        return -1;
+    }
+    g_config = *config;
+    rewind_locked();
+    unlock();
+    return 0;
+}
+
+int AccessorySequence_Prepare(uint16_t *conflicts, const char **error)
+{
+    const char *dummy;
+    if (error == NULL) {
+        error = &dummy;
+    }
+    if (conflicts) {
+        *conflicts = 0;
+    }
+
+    lock();
+    rewind_locked();
+    if (g_config.pin_count == 0u) {
+        g_running = true;
+        unlock();
+        return 0;
+    }
+    uint8_t dma_transmit = 0;
+    if (get_dcc_dma_transmit(&dma_transmit) == 0 && dma_transmit) {
+        unlock();
+        *error = "pins require interrupt driven transmit (dcc_dma_transmit 0)";
+        return -1;
+    }
+    if (response_latency_active()) {
+        unlock();
+        *error = "response latency test running";
+        return -1;
+    }
+    uint16_t pins = 0;
+    for (uint32_t i = 0; i < g_config.pin_count; i++) {
+        pins |= (uint16_t)(1u << (g_config.pins[i] - 1u));
+    }
+    gpio_io_capture_stop();
+    if (!gpio_io_capture_start(pins, conflicts)) {
+        unlock();
+        *error = "pins cannot be captured";
+        return -1;
+    }
+
+    memset(g_ioChannel, 0, sizeof(g_ioChannel));
+    memset(g_trial, 0, sizeof(g_trial));
+    memset(g_channel, 0, sizeof(g_channel));
+    for (uint32_t i = 0; i < g_config.pin_count; i++) {
+        g_ioChannel[g_config.pins[i]] = (uint8_t)(i + 1u);
+        latency_clear(&g_channel[i].on);
+        latency_clear(&g_channel[i].off);
+    }
+    g_trials = 0;
+    g_cyclesPerUs = SystemCoreClock / 1000000u;
+    g_timeoutCycles = g_config.timeout_ms * 1000u * g_cyclesPerUs;
+    g_measuring = true;
+    g_running = true;
+    unlock();
+
+    gpio_io_set_edge_hook(sequence_edge);
+    CommandStation_SetPacketHook(COMMAND_STATION_HOOK_ACCESSORY, sequence_packet);
+    return 0;
+}
+
+bool AccessorySequence_Next(AccessorySequencePacket_t *packet)
+{
+    lock();
+    if (g_config.passes != 0u && g_pass >= g_config.passes) {
+        unlock();
+        return false;
+    }
+
+    memset(packet, 0, sizeof(*packet));
+    uint16_t const address = (uint16_t)(g_config.address_first + g_index);
+    uint16_t const board = (uint16_t)(address >> 2);
+    uint8_t const pair = (uint8_t)(address & 0x03u);
+    uint8_t length;
+    packet->bytes[0] = (uint8_t)(0x80u | (board & 0x3Fu));
+    if (g_config.type == ACCESSORY_SEQUENCE_BASIC) {
+        packet->bytes[1] = (uint8_t)(0x80u | ((~board >> 2) & 0x70u) | (g_phaseOff ? 0u : 0x08u) |
+                                     (pair << 1) | g_config.output);
+        length = 2u;
+    } else {
+        packet->bytes[1] = (uint8_t)(((~board >> 2) & 0x70u) | (pair << 1) | 0x01u);
+        packet->bytes[2] = g_phaseOff ? g_config.aspect_off : g_config.aspect_on;
+        length = 3u;
+    }
+    uint8_t checksum = 0;
+    for (uint8_t i = 0; i < length; i++) {
+        checksum ^= packet->bytes[i];
+    }
+    packet->bytes[length++] = checksum;
+    packet->length = length;
+
+    if (g_repeat == 0u) {
+        // The hold time of the previous command, nothing before the very first one
+        if (g_phaseOff) {
+            packet->gap_us = g_config.on_ms * 1000u;
+        } else if (g_commands != 0u) {
+            packet->gap_us = g_config.off_ms * 1000u;
+        }
+        g_commands++;
+    }
+
+    if (++g_repeat >= g_config.packets) {
+        g_repeat = 0;
+        if (!g_phaseOff) {
+            g_phaseOff = true;
+        } else {
+            g_phaseOff = false;
+            if (++g_index >= g_config.address_count) {
+                g_index = 0;
+                g_pass++;
+            }
+        }
+    }
+    unlock();
+    return true;
+}
+
+void AccessorySequence_Finish(void)
+{
+    if (g_measuring) {
+        CommandStation_SetPacketHook(COMMAND_STATION_HOOK_ACCESSORY, NULL);
+        gpio_io_set_edge_hook(NULL);
+        gpio_io_capture_stop();
+
+        uint32_t const primask = __get_PRIMASK();
+        __disable_irq();
+        for (uint32_t i = 0; i < g_config.pin_count; i++) {
+            trial_fail(i);
+        }
+        __set_PRIMASK(primask);
+    }
+
+    lock();
+    g_measuring = false;
+    g_running = false;
+    unlock();
+}
+
+bool AccessorySequence_Pending(void)
+{
+    if (!g_measuring) {
+        return false;
+    }
+    uint32_t const now = DWT->CYCCNT;
+    uint32_t const primask = __get_PRIMASK();
+    __disable_irq();
+    // Every command opens one trial, the queued ones are still ahead on the track
+    bool pending = g_trials < g_commands;
+    for (uint32_t i = 0; i < g_config.pin_count; i++) {
+        if (g_trial[i].open && now - g_trial[i].start < g_timeoutCycles) {
+            pending = true;
+        }
+    }
+    __set_PRIMASK(primask);
+    return pending;
+}
+
+bool AccessorySequence_Measuring(void)
+{
+    return g_measuring;
+}
+
+void AccessorySequence_GetStatus(AccessorySequenceStatus_t *status)
+{
+    if (status == NULL) {
+        return;
+    }
+    memset(status, 0, sizeof(*status));
+    lock();
+    status->config = g_config;
+    status->running = g_running;
+    status->measuring = g_measuring;
+    status->pass = g_pass;
+    status->address = (uint16_t)(g_config.address_first + g_index);
+    status->commands = g_commands;
+    unlock();
+
+    for (uint32_t i = 0; i < ACCESSORY_SEQUENCE_MAX_PINS; i++) {
+        uint32_t const primask = __get_PRIMASK();
+        __disable_irq();
+        status->channel[i] = g_channel[i];
+        __set_PRIMASK(primask);
+    }
+    status->trials = g_trials;
+}
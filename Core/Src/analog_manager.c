@@ -7,12 +7,27 @@
  * This module manages on-demand ADC readings with averaging for all allocated channels.
  * Supports ADC1 (channels 2,3,5,6) and ADC2 (channels 2,6).
  * All readings are performed on-demand with mutex protection for thread safety.
+ *
+ * Continuous mode: TIM3 triggers a scan of all channels on both ADCs at
+ * ANALOG_STREAM_RATE_HZ, the results are written into circular DMA buffers.
+ * Each DMA half transfer holds ANALOG_STREAM_BUCKET_SCANS scans, which are
+ * reduced to one average per channel (a bucket) in the DMA interrupt and kept
+ * in a history of ANALOG_STREAM_HISTORY buckets. Readings then only average
+ * buckets from memory and never block. If the streams cannot be started the
+ * module falls back to on-demand readings.
+ *
+ * On-demand mode with ANALOG_OVERSAMPLING_ENABLE: the oversampler of the ADC
+ * adds up 2^n conversions of the channel and shifts the sum back to 12 bits,
+ * a reading is one triggered conversion without waiting between samples.
  */
 
 #include "analog_manager.h"
 #include "cmsis_os2.h"
+#include "rtos_static.h"
 #include "main.h"
 #include "stm32h5xx_hal.h"
+#include "stm32h5xx_ll_adc.h"
+#include "dma_channels.h"
 #include <stdbool.h>
 #include <stdio.h>
 #include <string.h>
@@ -23,10 +38,74 @@ extern ADC_HandleTypeDef hadc2;
 
 /* Private variables */
 static osMutexId_t adc_mutex = NULL;
+RTOS_MUTEX(adc_mutex);
+
+/* Continuous mode */
+#define ADC1_STREAM_CHANNELS    4u   // ranks: channels 2, 3, 5, 6
+#define ADC2_STREAM_CHANNELS    2u   // ranks: channels 2, 6
+#define STREAM_SLOTS            (ADC1_STREAM_CHANNELS + ADC2_STREAM_CHANNELS)
+#define STREAM_TIMER_CLOCK_HZ   1000000u  // TIM3 prescaled to 1 us ticks like TIM2
+
+static const uint32_t adc1_stream_channels[ADC1_STREAM_CHANNELS] = {ADC_CHANNEL_2, ADC_CHANNEL_3, ADC_CHANNEL_5, ADC_CHANNEL_6};
+static const uint32_t adc2_stream_channels[ADC2_STREAM_CHANNELS] = {ADC_CHANNEL_2, ADC_CHANNEL_6};
+
+/* Every channel in slot order, with its on-demand oversampling: ratio x and a shift of
+ * log2(x) average back to 12 bits, 16 conversions take about 60 us */
+typedef struct {
+    uint8_t adc_num;
+    uint8_t channel;
+    uint32_t adc_channel;
+    uint32_t ovs_ratio;         // LL_ADC_OVS_RATIO_x
+    uint32_t ovs_shift;         // LL_ADC_OVS_SHIFT_RIGHT_x
+} AnalogChannel_t;
+
+static const AnalogChannel_t kChannels[STREAM_SLOTS] = {
+    { 1, 2, ADC_CHANNEL_2, LL_ADC_OVS_RATIO_4, LL_ADC_OVS_SHIFT_RIGHT_2 },
+    { 1, 3, ADC_CHANNEL_3, LL_ADC_OVS_RATIO_4, LL_ADC_OVS_SHIFT_RIGHT_2 },
+    { 1, 5, ADC_CHANNEL_5, LL_ADC_OVS_RATIO_4, LL_ADC_OVS_SHIFT_RIGHT_2 },
+    { 1, 6, ADC_CHANNEL_6, LL_ADC_OVS_RATIO_16, LL_ADC_OVS_SHIFT_RIGHT_4 },    // track voltage
+    { 2, 2, ADC_CHANNEL_2, LL_ADC_OVS_RATIO_16, LL_ADC_OVS_SHIFT_RIGHT_4 },    // track current
+    { 2, 6, ADC_CHANNEL_6, LL_ADC_OVS_RATIO_4, LL_ADC_OVS_SHIFT_RIGHT_2 },
+};
+
+static TIM_HandleTypeDef htim3;
+static DMA_HandleTypeDef hdma_adc1_stream;
+static DMA_HandleTypeDef hdma_adc2_stream;
+static DMA_QListTypeDef adc1_stream_queue;
+static DMA_QListTypeDef adc2_stream_queue;
+static DMA_NodeTypeDef adc1_stream_node;
+static DMA_NodeTypeDef adc2_stream_node;
+__attribute__((aligned(32))) static uint16_t adc1_stream_buf[2u * ANALOG_STREAM_BUCKET_SCANS * ADC1_STREAM_CHANNELS];
+__attribute__((aligned(32))) static uint16_t adc2_stream_buf[2u * ANALOG_STREAM_BUCKET_SCANS * ADC2_STREAM_CHANNELS];
+static uint16_t stream_history[STREAM_SLOTS][ANALOG_STREAM_HISTORY];
+static uint16_t current_samples[ANALOG_RAW_HISTORY];     // every scan of the track current
+static volatile uint32_t adc1_stream_buckets = 0;  // buckets written, the history index runs modulo
+static volatile uint32_t adc2_stream_buckets = 0;
+static bool streaming = false;
+static AnalogBucketHook volatile bucket_hooks[ANALOG_HOOK_COUNT];
+
+/* Service mode ACK detector, runs on the ADC2 current buckets */
+#define ACK_SLOT                (ADC1_STREAM_CHANNELS + 0u)  // ADC2 channel 2
+#define VOLTAGE_SLOT            3u                            // ADC1 channel 6
+#define ACK_BASELINE_MS         8u
+static volatile bool ack_armed = false;
+static volatile bool ack_detected = false;
+static uint16_t ack_threshold = 0;       // baseline + ANALOG_ACK_THRESHOLD_MA in counts
+static uint32_t ack_run = 0;             // consecutive buckets above the threshold
+static uint32_t ack_arm_bucket = 0;
+static uint32_t ack_bucket = 0;          // bucket in which the pulse started
 
 /* Private function prototypes */
-static uint16_t read_adc_channel(ADC_HandleTypeDef *hadc, uint32_t channel);
-static uint16_t average_adc_readings(ADC_HandleTypeDef *hadc, uint32_t channel, uint8_t samples);
+static uint16_t read_adc_channel(ADC_HandleTypeDef *hadc, const AnalogChannel_t *channel);
+#if !ANALOG_OVERSAMPLING_ENABLE
+static uint16_t average_adc_readings(ADC_HandleTypeDef *hadc, const AnalogChannel_t *channel, uint8_t samples);
+#endif
+static int stream_start(void);
+static int stream_slot(uint8_t adc_num, uint8_t channel);
+static int stream_average(int slot, uint32_t buckets, uint16_t *value);
+
+_Static_assert((ANALOG_STREAM_HISTORY & (ANALOG_STREAM_HISTORY - 1u)) == 0u, "ANALOG_STREAM_HISTORY must be a power of two");
+_Static_assert((ANALOG_RAW_HISTORY & (ANALOG_RAW_HISTORY - 1u)) == 0u, "ANALOG_RAW_HISTORY must be a power of two");
 
 /**
  * @brief Read a single ADC channel value
@@ -34,13 +113,13 @@ static uint16_t average_adc_readings(ADC_HandleTypeDef *hadc, uint32_t channel,
  * @param channel ADC channel to read
  * @return 12-bit ADC value (0-4095) or 0 on error
  */
-static uint16_t read_adc_channel(ADC_HandleTypeDef *hadc, uint32_t channel)
+static uint16_t read_adc_channel(ADC_HandleTypeDef *hadc, const AnalogChannel_t *channel)
 {
     ADC_ChannelConfTypeDef sConfig = {0};
     uint16_t adc_value = 0;
     
     // Configure the ADC channel
-    sConfig.Channel = channel;
+    sConfig.Channel = channel->adc_channel;
     sConfig.Rank = ADC_REGULAR_RANK_1;
     sConfig.SamplingTime = ADC_SAMPLETIME_2CYCLES_5;
     sConfig.SingleDiff = ADC_SINGLE_ENDED;
@@ -51,6 +130,12 @@ static uint16_t read_adc_channel(ADC_HandleTypeDef *hadc, uint32_t channel)
     {
         return 0;
     }
+
+#if ANALOG_OVERSAMPLING_ENABLE
+    // The ADC is idle, HAL_ADC_Init of the continuous mode clears the oversampler again
+    LL_ADC_ConfigOverSamplingRatioShift(hadc->Instance, channel->ovs_ratio, channel->ovs_shift);
+    LL_ADC_SetOverSamplingScope(hadc->Instance, LL_ADC_OVS_GRP_REGULAR_CONTINUED);
+#endif
     
     // Start ADC conversion
     if (HAL_ADC_Start(hadc) != HAL_OK)
@@ -70,6 +155,7 @@ static uint16_t read_adc_channel(ADC_HandleTypeDef *hadc, uint32_t channel)
     return adc_value;
 }
 
+#if !ANALOG_OVERSAMPLING_ENABLE
 /**
  * @brief Average multiple readings from an ADC channel
  * @param hadc Pointer to ADC handle
@@ -77,7 +163,7 @@ static uint16_t read_adc_channel(ADC_HandleTypeDef *hadc, uint32_t channel)
  * @param samples Number of samples to average
  * @return Averaged 12-bit ADC value (0-4095)
  */
-static uint16_t average_adc_readings(ADC_HandleTypeDef *hadc, uint32_t channel, uint8_t samples)
+static uint16_t average_adc_readings(ADC_HandleTypeDef *hadc, const AnalogChannel_t *channel, uint8_t samples)
 {
     uint32_t sum = 0;
     uint16_t avg = 0;
@@ -100,6 +186,318 @@ static uint16_t average_adc_readings(ADC_HandleTypeDef *hadc, uint32_t channel,
     
     return avg;
 }
+#endif
+
+/**
+ * @brief Map an ADC/channel pair to its continuous mode slot
+ * @param adc_num ADC number (1 or 2)
+ * @param channel Channel number
+ * @return Slot index or -1 if the channel is not part of the scan
+ */
+static int stream_slot(uint8_t adc_num, uint8_t channel)
+{
+    for (uint32_t i = 0; i < STREAM_SLOTS; i++) {
+        if (kChannels[i].adc_num == adc_num && kChannels[i].channel == channel) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Average the most recent buckets of a slot
+ * @param slot Slot from stream_slot()
+ * @param buckets Number of buckets (1 ms each at the default rate), clamped to the history
+ * @param value Pointer to store the averaged 12-bit value
+ * @return 0 on success, -1 if no bucket has been completed yet
+ */
+static int stream_average(int slot, uint32_t buckets, uint16_t *value)
+{
+    uint32_t const count = (slot < (int)ADC1_STREAM_CHANNELS) ? adc1_stream_buckets : adc2_stream_buckets;
+    if (count == 0u) {
+        return -1;
+    }
+    if (buckets == 0u) {
+        buckets = 1u;
+    }
+    if (buckets > count) {
+        buckets = count;
+    }
+    // The entry after the oldest one may be overwritten while summing
+    if (buckets > ANALOG_STREAM_HISTORY - 1u) {
+        buckets = ANALOG_STREAM_HISTORY - 1u;
+    }
+
+    uint32_t sum = 0;
+    for (uint32_t i = 1; i <= buckets; i++) {
+        sum += stream_history[slot][(count - i) & (ANALOG_STREAM_HISTORY - 1u)];
+    }
+    *value = (uint16_t)(sum / buckets);
+    return 0;
+}
+
+/**
+ * @brief Reduce one DMA half transfer into a history bucket per channel
+ * @param samples First scan of the completed half
+ * @param channels Channels per scan
+ * @param first_slot Slot of the first rank
+ * @param count Bucket counter of the ADC
+ */
+static void stream_bucket(const uint16_t *samples, uint32_t channels, uint32_t first_slot, volatile uint32_t *count)
+{
+    uint32_t const index = *count & (ANALOG_STREAM_HISTORY - 1u);
+
+    for (uint32_t c = 0; c < channels; c++) {
+        uint32_t sum = 0;
+        for (uint32_t scan = 0; scan < ANALOG_STREAM_BUCKET_SCANS; scan++) {
+            sum += samples[scan * channels + c];
+        }
+        stream_history[first_slot + c][index] = (uint16_t)(sum / ANALOG_STREAM_BUCKET_SCANS);
+    }
+
+    if (ack_armed && first_slot <= ACK_SLOT && ACK_SLOT < first_slot + channels) {
+        if (stream_history[ACK_SLOT][index] >= ack_threshold) {
+            if (++ack_run >= ANALOG_ACK_MIN_MS && !ack_detected) {
+                ack_bucket = *count + 1u - ack_run;
+                ack_detected = true;
+            }
+        } else {
+            ack_run = 0;
+        }
+    }
+    if (first_slot <= ACK_SLOT && ACK_SLOT < first_slot + channels) {
+        uint32_t const sample = *count * ANALOG_STREAM_BUCKET_SCANS;
+        for (uint32_t scan = 0; scan < ANALOG_STREAM_BUCKET_SCANS; scan++) {
+            current_samples[(sample + scan) & (ANALOG_RAW_HISTORY - 1u)] = samples[scan * channels + (ACK_SLOT - first_slot)];
+        }
+        uint32_t const voltage = adc1_stream_buckets;
+        uint16_t const voltage_raw =
+            voltage ? stream_history[VOLTAGE_SLOT][(voltage - 1u) & (ANALOG_STREAM_HISTORY - 1u)] : 0u;
+        for (uint32_t h = 0; h < ANALOG_HOOK_COUNT; h++) {
+            AnalogBucketHook const hook = bucket_hooks[h];
+            if (hook) {
+                hook(*count, voltage_raw, stream_history[ACK_SLOT][index]);
+            }
+        }
+    }
+    *count = *count + 1u;
+}
+
+void HAL_ADC_ConvHalfCpltCallback(ADC_HandleTypeDef *hadc)
+{
+    if (hadc == &hadc1) {
+        stream_bucket(&adc1_stream_buf[0], ADC1_STREAM_CHANNELS, 0u, &adc1_stream_buckets);
+    } else if (hadc == &hadc2) {
+        stream_bucket(&adc2_stream_buf[0], ADC2_STREAM_CHANNELS, ADC1_STREAM_CHANNELS, &adc2_stream_buckets);
+    }
+}
+
+void HAL_ADC_ConvCpltCallback(ADC_HandleTypeDef *hadc)
+{
+    if (hadc == &hadc1) {
+        stream_bucket(&adc1_stream_buf[ANALOG_STREAM_BUCKET_SCANS * ADC1_STREAM_CHANNELS],
+                      ADC1_STREAM_CHANNELS, 0u, &adc1_stream_buckets);
+    } else if (hadc == &hadc2) {
+        stream_bucket(&adc2_stream_buf[ANALOG_STREAM_BUCKET_SCANS * ADC2_STREAM_CHANNELS],
+                      ADC2_STREAM_CHANNELS, ADC1_STREAM_CHANNELS, &adc2_stream_buckets);
+    }
+}
+
+/**
+  * @brief This function handles the ADC1 stream DMA channel interrupt.
+  */
+void ADC1_STREAM_DMA_IRQHandler(void)
+{
+    HAL_DMA_IRQHandler(&hdma_adc1_stream);
+}
+
+/**
+  * @brief This function handles the ADC2 stream DMA channel interrupt.
+  */
+void ADC2_STREAM_DMA_IRQHandler(void)
+{
+    HAL_DMA_IRQHandler(&hdma_adc2_stream);
+}
+
+/**
+ * @brief Reconfigure an ADC for timer triggered scans of the given channels
+ * @param hadc Pointer to ADC handle
+ * @param channels Channels in rank order
+ * @param count Number of channels
+ * @return 0 on success, -1 on failure
+ */
+static int stream_adc_init(ADC_HandleTypeDef *hadc, const uint32_t *channels, uint32_t count)
+{
+    static const uint32_t ranks[ADC1_STREAM_CHANNELS] = {
+        ADC_REGULAR_RANK_1, ADC_REGULAR_RANK_2, ADC_REGULAR_RANK_3, ADC_REGULAR_RANK_4
+    };
+    ADC_ChannelConfTypeDef sConfig = {0};
+
+    hadc->Init.ScanConvMode = ADC_SCAN_ENABLE;
+    hadc->Init.EOCSelection = ADC_EOC_SEQ_CONV;
+    hadc->Init.ContinuousConvMode = DISABLE;
+    hadc->Init.NbrOfConversion = count;
+    hadc->Init.ExternalTrigConv = ADC_EXTERNALTRIG_T3_TRGO;
+    hadc->Init.ExternalTrigConvEdge = ADC_EXTERNALTRIGCONVEDGE_RISING;
+    hadc->Init.DMAContinuousRequests = ENABLE;
+    hadc->Init.Overrun = ADC_OVR_DATA_OVERWRITTEN;
+    if (HAL_ADC_Init(hadc) != HAL_OK) {
+        return -1;
+    }
+
+    sConfig.SamplingTime = ADC_SAMPLETIME_2CYCLES_5;
+    sConfig.SingleDiff = ADC_SINGLE_ENDED;
+    sConfig.OffsetNumber = ADC_OFFSET_NONE;
+    sConfig.Offset = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        sConfig.Channel = channels[i];
+        sConfig.Rank = ranks[i];
+        if (HAL_ADC_ConfigChannel(hadc, &sConfig) != HAL_OK) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Analog watchdog 1 on the track current channel, interrupt off until the track guard arms it
+ *
+ * Which channel is watched can only be set while the ADC is idle, the threshold
+ * and the interrupt later at any time.
+ * @return 0 on success, -1 on failure
+ */
+static int stream_watchdog_init(ADC_HandleTypeDef *hadc)
+{
+    ADC_AnalogWDGConfTypeDef awdConfig = {0};
+    awdConfig.WatchdogNumber = ADC_ANALOGWATCHDOG_1;
+    awdConfig.WatchdogMode = ADC_ANALOGWATCHDOG_SINGLE_REG;
+    awdConfig.Channel = ADC_CHANNEL_2;
+    awdConfig.ITMode = DISABLE;
+    awdConfig.HighThreshold = 0xFFFu;
+    awdConfig.LowThreshold = 0u;
+    return HAL_ADC_AnalogWDGConfig(hadc, &awdConfig) == HAL_OK ? 0 : -1;
+}
+
+/**
+ * @brief Build a circular DMA queue from the ADC data register into buf and link it to the ADC
+ * @return 0 on success, -1 on failure
+ */
+static int stream_dma_init(ADC_HandleTypeDef *hadc, DMA_HandleTypeDef *hdma, DMA_Channel_TypeDef *instance,
+                           uint32_t request, DMA_QListTypeDef *queue, DMA_NodeTypeDef *node,
+                           uint16_t *buf, uint32_t length, IRQn_Type irq)
+{
+    DMA_NodeConfTypeDef nodeConfig = {0};
+    nodeConfig.NodeType = DMA_GPDMA_LINEAR_NODE;
+    nodeConfig.Init.Request = request;
+    nodeConfig.Init.BlkHWRequest = DMA_BREQ_SINGLE_BURST;
+    nodeConfig.Init.Direction = DMA_PERIPH_TO_MEMORY;
+    nodeConfig.Init.SrcInc = DMA_SINC_FIXED;
+    nodeConfig.Init.DestInc = DMA_DINC_INCREMENTED;
+    nodeConfig.Init.SrcDataWidth = DMA_SRC_DATAWIDTH_HALFWORD;
+    nodeConfig.Init.DestDataWidth = DMA_DEST_DATAWIDTH_HALFWORD;
+    nodeConfig.Init.SrcBurstLength = 1;
+    nodeConfig.Init.DestBurstLength = 1;
+    nodeConfig.Init.TransferAllocatedPort = DMA_SRC_ALLOCATED_PORT0 | DMA_DEST_ALLOCATED_PORT0;
+    nodeConfig.Init.TransferEventMode = DMA_TCEM_BLOCK_TRANSFER;
+    nodeConfig.Init.Mode = DMA_NORMAL;
+    nodeConfig.TriggerConfig.TriggerPolarity = DMA_TRIG_POLARITY_MASKED;
+    nodeConfig.DataHandlingConfig.DataExchange = DMA_EXCHANGE_NONE;
+    nodeConfig.DataHandlingConfig.DataAlignment = DMA_DATA_RIGHTALIGN_ZEROPADDED;
+    nodeConfig.SrcAddress = (uint32_t)&hadc->Instance->DR;
+    nodeConfig.DstAddress = (uint32_t)buf;
+    nodeConfig.DataSize = length * sizeof(uint16_t);
+
+    if (HAL_DMAEx_List_BuildNode(&nodeConfig, node) != HAL_OK ||
+        HAL_DMAEx_List_ResetQ(queue) != HAL_OK ||
+        HAL_DMAEx_List_InsertNode(queue, NULL, node) != HAL_OK ||
+        HAL_DMAEx_List_SetCircularMode(queue) != HAL_OK) {
+        return -1;
+    }
+
+    hdma->Instance = instance;
+    hdma->InitLinkedList.Priority = DMA_LOW_PRIORITY_HIGH_WEIGHT;
+    hdma->InitLinkedList.LinkStepMode = DMA_LSM_FULL_EXECUTION;
+    hdma->InitLinkedList.LinkAllocatedPort = DMA_LINK_ALLOCATED_PORT0;
+    hdma->InitLinkedList.TransferEventMode = DMA_TCEM_BLOCK_TRANSFER;
+    hdma->InitLinkedList.LinkedListMode = DMA_LINKEDLIST_CIRCULAR;
+    if (HAL_DMAEx_List_Init(hdma) != HAL_OK ||
+        HAL_DMAEx_List_LinkQ(hdma, queue) != HAL_OK) {
+        return -1;
+    }
+    __HAL_LINKDMA(hadc, DMA_Handle, *hdma);
+
+    HAL_NVIC_SetPriority(irq, 6, 0);
+    HAL_NVIC_EnableIRQ(irq);
+    return 0;
+}
+
+/**
+ * @brief Start timer triggered scans of both ADCs into the circular DMA buffers
+ * @return 0 on success, -1 on failure (ADCs left in on-demand configuration)
+ */
+static int stream_start(void)
+{
+    TIM_MasterConfigTypeDef sMasterConfig = {0};
+
+    __HAL_RCC_TIM3_CLK_ENABLE();
+    htim3.Instance = TIM3;
+    htim3.Init.Prescaler = 249;
+    htim3.Init.CounterMode = TIM_COUNTERMODE_UP;
+    htim3.Init.Period = (STREAM_TIMER_CLOCK_HZ / ANALOG_STREAM_RATE_HZ) - 1u;
+    htim3.Init.ClockDivision = TIM_CLOCKDIVISION_DIV1;
+    htim3.Init.AutoReloadPreload = TIM_AUTORELOAD_PRELOAD_ENABLE;
+    if (HAL_TIM_Base_Init(&htim3) != HAL_OK) {
+        return -1;
+    }
+    sMasterConfig.MasterOutputTrigger = TIM_TRGO_UPDATE;
+    sMasterConfig.MasterSlaveMode = TIM_MASTERSLAVEMODE_DISABLE;
+    if (HAL_TIMEx_MasterConfigSynchronization(&htim3, &sMasterConfig) != HAL_OK) {
+        return -1;
+    }
+
+    if (stream_adc_init(&hadc1, adc1_stream_channels, ADC1_STREAM_CHANNELS) != 0 ||
+        stream_adc_init(&hadc2, adc2_stream_channels, ADC2_STREAM_CHANNELS) != 0 ||
+        stream_watchdog_init(&hadc2) != 0) {
+        return -1;
+    }
+    if (stream_dma_init(&hadc1, &hdma_adc1_stream, ADC1_STREAM_DMA_CHANNEL, ADC1_STREAM_DMA_REQUEST,
+                        &adc1_stream_queue, &adc1_stream_node, adc1_stream_buf,
+                        sizeof(adc1_stream_buf) / sizeof(adc1_stream_buf[0]), ADC1_STREAM_DMA_IRQn) != 0 ||
+        stream_dma_init(&hadc2, &hdma_adc2_stream, ADC2_STREAM_DMA_CHANNEL, ADC2_STREAM_DMA_REQUEST,
+                        &adc2_stream_queue, &adc2_stream_node, adc2_stream_buf,
+                        sizeof(adc2_stream_buf) / sizeof(adc2_stream_buf[0]), ADC2_STREAM_DMA_IRQn) != 0) {
+        return -1;
+    }
+
+    if (HAL_ADC_Start_DMA(&hadc1, (uint32_t *)adc1_stream_buf, sizeof(adc1_stream_buf) / sizeof(adc1_stream_buf[0])) != HAL_OK ||
+        HAL_ADC_Start_DMA(&hadc2, (uint32_t *)adc2_stream_buf, sizeof(adc2_stream_buf) / sizeof(adc2_stream_buf[0])) != HAL_OK) {
+        HAL_ADC_Stop_DMA(&hadc1);
+        return -1;
+    }
+
+    if (HAL_TIM_Base_Start(&htim3) != HAL_OK) {
+        HAL_ADC_Stop_DMA(&hadc1);
+        HAL_ADC_Stop_DMA(&hadc2);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Restore the single conversion software triggered configuration used by on-demand reads
+ * @param hadc Pointer to ADC handle
+ */
+static void on_demand_adc_init(ADC_HandleTypeDef *hadc)
+{
+    hadc->Init.ScanConvMode = ADC_SCAN_DISABLE;
+    hadc->Init.EOCSelection = ADC_EOC_SINGLE_CONV;
+    hadc->Init.NbrOfConversion = 1;
+    hadc->Init.ExternalTrigConv = ADC_SOFTWARE_START;
+    hadc->Init.ExternalTrigConvEdge = ADC_EXTERNALTRIGCONVEDGE_NONE;
+    hadc->Init.DMAContinuousRequests = DISABLE;
+    hadc->Init.Overrun = ADC_OVR_DATA_PRESERVED;
+    HAL_ADC_Init(hadc);
+}
 
 /**
  * @brief Initialize the Analog Manager
@@ -110,7 +508,7 @@ int analog_manager_init(void)
     // Create mutex for ADC protection
     if (adc_mutex == NULL)
     {
-        adc_mutex = osMutexNew(NULL);
+        adc_mutex = osMutexNew(&adc_mutex_attr);
         if (adc_mutex == NULL)
         {
             printf("Failed to create ADC mutex\n");
@@ -129,10 +527,130 @@ int analog_manager_init(void)
         printf("ADC2 calibration failed\n");
     }
     
+#if ANALOG_STREAM_ENABLE
+    if (stream_start() == 0) {
+        streaming = true;
+        printf("Analog Manager initialized (continuous mode, %u Hz)\n", (unsigned)ANALOG_STREAM_RATE_HZ);
+        return 0;
+    }
+    printf("ADC continuous mode setup failed\n");
+    HAL_TIM_Base_Stop(&htim3);
+    on_demand_adc_init(&hadc1);
+    on_demand_adc_init(&hadc2);
+#endif
+
     printf("Analog Manager initialized (on-demand mode)\n");
     return 0;
 }
 
+bool analog_manager_is_streaming(void)
+{
+    return streaming;
+}
+
+void analog_manager_set_bucket_hook(AnalogHookSlot_t slot, AnalogBucketHook hook)
+{
+    if (slot < ANALOG_HOOK_COUNT) {
+        bucket_hooks[slot] = streaming ? hook : NULL;
+    }
+}
+
+int analog_manager_get_average(uint8_t adc_num, uint8_t channel, uint32_t window_ms, uint16_t *value)
+{
+    if (value == NULL || !streaming) {
+        return -1;
+    }
+    int const slot = stream_slot(adc_num, channel);
+    if (slot < 0) {
+        return -1;
+    }
+    uint32_t const buckets = (window_ms * ANALOG_STREAM_RATE_HZ) / (1000u * ANALOG_STREAM_BUCKET_SCANS);
+    return stream_average(slot, buckets, value);
+}
+
+uint32_t analog_manager_current_sample(void)
+{
+    uint32_t const ring = 2u * ANALOG_STREAM_BUCKET_SCANS;
+    uint32_t buckets;
+    uint32_t position;
+    do {
+        buckets = adc2_stream_buckets;
+        uint32_t const remaining = __HAL_DMA_GET_COUNTER(&hdma_adc2_stream) / sizeof(uint16_t);
+        position = (ring * ADC2_STREAM_CHANNELS - remaining) / ADC2_STREAM_CHANNELS;
+    } while (buckets != adc2_stream_buckets);
+
+    // The DMA is at most one bucket ahead of the bucket interrupt
+    uint32_t const processed = (buckets & 1u) * ANALOG_STREAM_BUCKET_SCANS;
+    return buckets * ANALOG_STREAM_BUCKET_SCANS + (position + ring - processed) % ring;
+}
+
+uint32_t analog_manager_read_current_samples(uint32_t first, uint16_t *out, uint32_t count)
+{
+    uint32_t const taken = adc2_stream_buckets * ANALOG_STREAM_BUCKET_SCANS;
+    if (!streaming || count == 0u || (int32_t)(taken - (first + count)) < 0 ||
+        taken - first > ANALOG_RAW_HISTORY - ANALOG_STREAM_BUCKET_SCANS) {
+        return 0;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        out[i] = current_samples[(first + i) & (ANALOG_RAW_HISTORY - 1u)];
+    }
+    return count;
+}
+
+int analog_manager_set_current_watchdog(uint16_t high_raw, bool enable)
+{
+    if (!streaming) {
+        return -1;
+    }
+    LL_ADC_DisableIT_AWD1(hadc2.Instance);
+    LL_ADC_ConfigAnalogWDThresholds(hadc2.Instance, LL_ADC_AWD1, high_raw, 0u);
+    LL_ADC_ClearFlag_AWD1(hadc2.Instance);
+    if (enable) {
+        LL_ADC_EnableIT_AWD1(hadc2.Instance);
+    }
+    return 0;
+}
+
+void analog_ack_arm(void)
+{
+    uint16_t baseline = 0;
+
+    ack_armed = false;
+    ack_detected = false;
+    if (!streaming || stream_average((int)ACK_SLOT, ACK_BASELINE_MS, &baseline) != 0) {
+        return;
+    }
+    ack_threshold = (uint16_t)(baseline + analog_ma_to_counts(ANALOG_ACK_THRESHOLD_MA));
+    ack_run = 0;
+    ack_arm_bucket = adc2_stream_buckets;
+    ack_armed = true;
+}
+
+void analog_ack_disarm(void)
+{
+    ack_armed = false;
+}
+
+bool analog_ack_detected(uint32_t *delay_ms)
+{
+    if (!ack_detected) {
+        return false;
+    }
+    if (delay_ms != NULL) {
+        uint32_t const buckets = ack_bucket - ack_arm_bucket;
+        *delay_ms = (buckets * ANALOG_STREAM_BUCKET_SCANS * 1000u) / ANALOG_STREAM_RATE_HZ;
+    }
+    return true;
+}
+
+/**
+ * @brief Averaging window equivalent to num_samples readings sample_delay_ms apart
+ */
+static uint32_t averaged_window_ms(uint8_t num_samples, uint32_t sample_delay_ms)
+{
+    return 1u + (uint32_t)(num_samples - 1u) * sample_delay_ms;
+}
+
 /**
  * @brief Get the current averaged value for a specific ADC channel (on-demand)
  * @param adc_num ADC number (1 or 2)
@@ -147,55 +665,27 @@ int analog_manager_get_value(uint8_t adc_num, uint8_t channel, uint16_t *value)
         return -1;
     }
     
-    ADC_HandleTypeDef *hadc = NULL;
-    uint32_t adc_channel = 0;
-    
-    // Validate and map ADC/channel combination
-    if (adc_num == 1)
-    {
-        hadc = &hadc1;
-        switch (channel)
-        {
-            case 2:
-                adc_channel = ADC_CHANNEL_2;
-                break;
-            case 3:
-                adc_channel = ADC_CHANNEL_3;
-                break;
-            case 5:
-                adc_channel = ADC_CHANNEL_5;
-                break;
-            case 6:
-                adc_channel = ADC_CHANNEL_6;
-                break;
-            default:
-                return -1;
-        }
-    }
-    else if (adc_num == 2)
-    {
-        hadc = &hadc2;
-        switch (channel)
-        {
-            case 2:
-                adc_channel = ADC_CHANNEL_2;
-                break;
-            case 6:
-                adc_channel = ADC_CHANNEL_6;
-                break;
-            default:
-                return -1;
-        }
-    }
-    else
+    int const slot = stream_slot(adc_num, channel);
+    if (slot < 0)
     {
         return -1;
     }
+    const AnalogChannel_t *const entry = &kChannels[slot];
+    ADC_HandleTypeDef *const hadc = entry->adc_num == 1 ? &hadc1 : &hadc2;
     
+    if (streaming)
+    {
+        return analog_manager_get_average(adc_num, channel, ANALOG_VALUE_WINDOW_MS, value);
+    }
+
     // Perform on-demand ADC reading with mutex protection
     if (adc_mutex != NULL && osMutexAcquire(adc_mutex, 100) == osOK)
     {
-        *value = average_adc_readings(hadc, adc_channel, ADC_AVG_SAMPLES);
+#if ANALOG_OVERSAMPLING_ENABLE
+        *value = read_adc_channel(hadc, entry);
+#else
+        *value = average_adc_readings(hadc, entry, ADC_AVG_SAMPLES);
+#endif
         osMutexRelease(adc_mutex);
         return 0;
     }
@@ -215,8 +705,8 @@ int get_voltage_feedback_mv(uint16_t *voltage_mv)
         return -1;
     }
 
-    // Convert ADC value to millivolts 
-    *voltage_mv = (uint16_t)((float)adc_value * VOLTAGE_FEEDBACK_SCALE_FACTOR_MV);
+    // Convert ADC value to millivolts
+    *voltage_mv = analog_counts_to_mv(adc_value);
 
     return 0;
 }
@@ -235,6 +725,15 @@ int get_voltage_feedback_mv_averaged(uint16_t *voltage_mv, uint8_t num_samples,
     uint32_t sum = 0;
     uint16_t adc_value = 0;
 
+    // The stream already holds the span the delayed samples would cover
+    if (streaming) {
+        if (analog_manager_get_average(1, 6, averaged_window_ms(num_samples, sample_delay_ms), &adc_value) != 0) {
+            return -1;
+        }
+        *voltage_mv = analog_counts_to_mv(adc_value);
+        return 0;
+    }
+
     // Collect samples with delay
     for (uint8_t i = 0; i < num_samples; i++) {
         if (analog_manager_get_value(1, 6, &adc_value) != 0) {
@@ -252,7 +751,7 @@ int get_voltage_feedback_mv_averaged(uint16_t *voltage_mv, uint8_t num_samples,
     uint16_t avg_adc_value = (uint16_t)(sum / num_samples);
 
     // Convert averaged ADC value to millivolts
-    *voltage_mv = (uint16_t)((float)avg_adc_value * VOLTAGE_FEEDBACK_SCALE_FACTOR_MV);
+    *voltage_mv = analog_counts_to_mv(avg_adc_value);
 
     return 0;
 }
@@ -270,7 +769,7 @@ int get_current_feedback_ma(uint16_t *current_ma)
     }
 
     // Convert ADC value to milliamps  (0.5ma per ADC count) 
-    *current_ma = (uint16_t)(adc_value / CURRENT_FEEDBACK_SCALE_FACTOR_MA);
+    *current_ma = analog_counts_to_ma(adc_value);
 
     return 0;
 }
@@ -289,6 +788,15 @@ int get_current_feedback_ma_averaged(uint16_t *current_ma, uint8_t num_samples,
     uint32_t sum = 0;
     uint16_t adc_value = 0;
 
+    // The stream already holds the span the delayed samples would cover
+    if (streaming) {
+        if (analog_manager_get_average(2, 2, averaged_window_ms(num_samples, sample_delay_ms), &adc_value) != 0) {
+            return -1;
+        }
+        *current_ma = analog_counts_to_ma(adc_value);
+        return 0;
+    }
+
     // Collect samples with delay
     for (uint8_t i = 0; i < num_samples; i++) {
         if (analog_manager_get_value(2, 2, &adc_value) != 0) {
@@ -306,7 +814,7 @@ int get_current_feedback_ma_averaged(uint16_t *current_ma, uint8_t num_samples,
     uint16_t avg_adc_value = (uint16_t)(sum / num_samples);
 
     // Convert averaged ADC value to milliamps (0.5ma per ADC count)
-    *current_ma = (uint16_t)(avg_adc_value / CURRENT_FEEDBACK_SCALE_FACTOR_MA);
+    *current_ma = analog_counts_to_ma(avg_adc_value);
 
     return 0;
 }
@@ -29,26 +29,37 @@
 #include "main.h"
 #include "rpc_server.h"
 #include "command_station.h"
-#include "decoder.h"
-#include "SUSI.h"
+#include "refresh_scheduler.h"
+#include "packet_fuzzer.h"
+#include "accessory_sequence.h"
+#include "priority_profile.h"
+#include "timebase.h"
+#include "checksum.h"
 #include "parameter_manager.h"
 #include "analog_manager.h"
+#include "track_guard.h"
+#include "usb_capture.h"
+#include "trace_log.h"
+#include "rtos_static.h"
+#include "boot.h"
 
 /* USER CODE END Includes */
 
 /* Private typedef -----------------------------------------------------------*/
 /* USER CODE BEGIN PTD */
+RTOS_THREAD_MEMORY(LED_Task, 256 * 4);  // 1 KB stack size
 osThreadAttr_t LED_thread_attr = {
         .name = "LED_Task",
         .priority = osPriorityNormal,
-        .stack_size = 256 * 4 // 1 KB stack size        
+        RTOS_THREAD_ATTR_MEMORY(LED_Task)
     };
 
 /* Definitions for cmdLineTask */
+RTOS_THREAD_MEMORY(cmdLineTask, 512 * 4);
 const osThreadAttr_t cmdLineTask_attributes = {
   .name = "cmdLineTask",
   .priority = (osPriority_t) osPriorityNormal,
-  .stack_size = 512 * 4
+  RTOS_THREAD_ATTR_MEMORY(cmdLineTask)
 };
 
 /* USER CODE END PTD */
@@ -97,14 +108,30 @@ UINT App_ThreadX_Init(VOID *memory_ptr)
   {
     Error_Handler();
   }
+  boot_mark("freertos");
+
+  /* Capture timestamps, UTC from the RTC until SNTP disciplines them */
+  timebase_init();
+
+  /* CRC peripheral, used from the parameter manager on */
+  checksum_init();
 
   /* Init parameter manager by restoring setting from flash */
   // Note: may need to bypass this on very first initial commissioning before parameter flash is setup??
   // flash setup is normally done onle once ... see cli_app.c command "reset"  
   parameter_manager_init(0);
+  boot_mark("parameters");
+
+  /* Start the trace log drain, its level comes from the parameters */
+  trace_log_init();
 
   /* Init and start the Analog Manager */
   analog_manager_init();
+  /* Short circuit and overcurrent trips on the track current, in interrupt context */
+  track_guard_init();
+  boot_mark("analog");
+  /* Capture stream on the second USB function, filled once started over RPC */
+  usb_capture_init();
 
   /* Create the led task */  
   ledThreadHandle = osThreadNew(LedThreadTask, NULL, &LED_thread_attr);  // Create thread with attributes
@@ -112,14 +139,20 @@ UINT App_ThreadX_Init(VOID *memory_ptr)
   cmdLineTaskHandle = osThreadNew(vCommandConsoleTask, NULL, &cmdLineTask_attributes);
   /* Create the RPC task and start it */
   RpcServer_Init();
+  boot_mark("rpc_server");
   /* Create the command station task ... but don't start it */
   CommandStation_Init();
-  /* Create the decoder task ... but don't start it */
-  Decoder_Init();
-  /* Create the SUSI Master task ... but don't start it */
-  SUSI_Master_Init(&hspi5);
-  /* Create the SUSI Slave task ... but don't start it */
-  SUSI_Slave_Init(&hspi2);
+  /* Operations mode refresh table, used by command station loops 1, 3 and 4 */
+  refresh_init();
+  /* Packet fuzzer configuration and replay log, run by the command station */
+  PacketFuzz_Init();
+  AccessorySequence_Init();
+  priority_profile_init();
+  boot_mark("command_station");
+  /* Decoder, SUSI master and slave, FDCAN sync bridge ... none of them started,
+     with lazy init they are set up on first use */
+  boot_subsystems_init();
+  boot_mark("subsystems");
 
   /* USER CODE END App_ThreadX_Init */
 
@@ -136,6 +169,7 @@ void MX_ThreadX_Init(void)
   /* USER CODE BEGIN Before_Kernel_Start */
   /* needed for CMSIS-RTOS2 support */
   osKernelInitialize();  // Initialize the ThreadX kernel
+  boot_mark("kernel_init");
 
   /* USER CODE END Before_Kernel_Start */
 
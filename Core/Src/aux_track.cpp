@@ -0,0 +1,183 @@
+#include "aux_track.h"
+#include <dcc/dcc.hpp>
+#include <atomic>
+#include "main.h"
+#include "gpio_io.h"
+#include "packet_timing.h"
+#include "parameter_manager.h"
+#include "timing_profiles.hpp"
+
+// Transmitter bound to one timer and one output pin pair, the outputs are resolved at start
+// so the update interrupt only writes precomputed BSRR words
+struct AuxTrack : dcc::tx::CrtpBase<AuxTrack, dcc::tx::Timings> {
+  friend dcc::tx::CrtpBase<AuxTrack, dcc::tx::Timings>;
+
+  explicit AuxTrack(TIM_TypeDef* tim) : tim_{tim} {}
+
+  // Write track outputs
+  void trackOutputs(bool N, bool P, bool first_bit) {
+    uint32_t const p_word = P ? p_mask_ : p_mask_ << 16u;
+    uint32_t const n_word = N ? n_mask_ : n_mask_ << 16u;
+    if (p_bsrr_ == n_bsrr_) {
+      *p_bsrr_ = p_word | n_word;
+    }
+    else {
+      *p_bsrr_ = p_word;
+      *n_bsrr_ = n_word;
+    }
+    if (P && first_bit) {
+      transmitted_ = transmitted_ + 1u;
+    }
+  }
+
+  // No BiDi on this output, the library is initialised with bidi off
+  void biDiStart() {}
+  void biDiChannel1() {}
+  void biDiChannel2() {}
+  void biDiEnd() {}
+
+  bool bind(uint8_t p_io, uint8_t n_io) {
+    return gpio_io_output_bsrr(p_io, &p_bsrr_, &p_mask_) && gpio_io_output_bsrr(n_io, &n_bsrr_, &n_mask_);
+  }
+
+  void outputsLow() {
+    *p_bsrr_ = p_mask_ << 16u;
+    *n_bsrr_ = n_mask_ << 16u;
+  }
+
+  // Update interrupt: the half-bit that just started gets its duration
+  void update() {
+    tim_->ARR = transmit();
+  }
+
+  TIM_TypeDef* const tim_;
+  volatile uint32_t* p_bsrr_{};
+  volatile uint32_t* n_bsrr_{};
+  uint32_t p_mask_{};
+  uint32_t n_mask_{};
+  uint32_t volatile transmitted_{};
+};
+
+static AuxTrack aux_track{TIM5};
+static std::atomic<bool> auxRunning{false};
+static AuxTrackConfig_t auxConfig{};
+static uint16_t auxBit1 = 0;
+static uint16_t auxBit0 = 0;
+static uint32_t auxAccepted = 0;
+static uint32_t auxRejected = 0;
+
+extern "C" void TIM5_IRQHandler(void)
+{
+  if (TIM5->SR & TIM_SR_UIF) {
+    TIM5->SR = ~TIM_SR_UIF;
+    aux_track.update();
+  }
+}
+
+static void timerStart(void)
+{
+  __HAL_RCC_TIM5_CLK_ENABLE();
+  TIM5->CR1 = TIM_CR1_URS;   // no preload, ARR written in the interrupt applies to the running half-bit
+  TIM5->PSC = 249;           // 1 us ticks like TIM2
+  TIM5->ARR = 100u;
+  TIM5->CNT = 0;
+  TIM5->DIER = TIM_DIER_UIE;
+  TIM5->EGR = TIM_EGR_UG;
+  TIM5->SR = 0;
+  HAL_NVIC_SetPriority(TIM5_IRQn, AUX_TRACK_TIM_PRIORITY, 0);
+  HAL_NVIC_EnableIRQ(TIM5_IRQn);
+  TIM5->CR1 |= TIM_CR1_CEN;
+}
+
+extern "C" int AuxTrack_Start(const AuxTrackConfig_t* config)
+{
+  if (auxRunning.load(std::memory_order_acquire)) {
+    return -3;
+  }
+  if (!config || config->p_io == config->n_io || config->p_io < 1u || config->p_io > GPIO_IO_PIN_COUNT ||
+      config->n_io < 1u || config->n_io > GPIO_IO_PIN_COUNT || config->profile >= PACKET_TIMING_PROFILE_COUNT ||
+      config->preamble_bits < AUX_TRACK_MIN_PREAMBLE || config->preamble_bits > AUX_TRACK_MAX_PREAMBLE) {
+    return -1;
+  }
+
+  uint16_t bit1 = 0;
+  uint16_t bit0 = 0;
+  if (config->profile == PACKET_TIMING_PROFILE_CONFIGURED) {
+    uint8_t bit1_duration = 0;
+    uint8_t bit0_duration = 0;
+    get_dcc_bit1_duration(&bit1_duration);
+    get_dcc_bit0_duration(&bit0_duration);
+    bit1 = bit1_duration;
+    bit0 = bit0_duration;
+  }
+  else {
+    // The library sends both halves of a bit with the same duration
+    TimingProfile const& profile = timing_profiles[config->profile];
+    if (profile.one_p != profile.one_n || profile.zero_p != profile.zero_n || profile.zero_p > UINT8_MAX) {
+      return -1;
+    }
+    bit1 = profile.one_p;
+    bit0 = profile.zero_p;
+  }
+
+  if (!gpio_io_configure_output(config->p_io, false) || !gpio_io_configure_output(config->n_io, false) ||
+      !aux_track.bind(config->p_io, config->n_io)) {
+    return -2;
+  }
+
+  aux_track.init({
+    .num_preamble = config->preamble_bits,
+    .bit1_duration = static_cast<uint8_t>(bit1),
+    .bit0_duration = static_cast<uint8_t>(bit0),
+    .flags = {.bidi = false},
+  });
+  auxConfig = *config;
+  auxBit1 = bit1;
+  auxBit0 = bit0;
+  auxAccepted = 0;
+  auxRejected = 0;
+  aux_track.transmitted_ = 0;
+  auxRunning.store(true, std::memory_order_release);
+  timerStart();
+  return 0;
+}
+
+extern "C" void AuxTrack_Stop(void)
+{
+  if (!auxRunning.load(std::memory_order_acquire)) {
+    return;
+  }
+  TIM5->CR1 &= ~TIM_CR1_CEN;
+  HAL_NVIC_DisableIRQ(TIM5_IRQn);
+  TIM5->SR = 0;
+  aux_track.outputsLow();
+  auxRunning.store(false, std::memory_order_release);
+}
+
+extern "C" bool AuxTrack_Send(const uint8_t* bytes, uint8_t length)
+{
+  if (!auxRunning.load(std::memory_order_acquire) || !bytes || length == 0u || length > DCC_MAX_PACKET_SIZE) {
+    return false;
+  }
+  dcc::Packet packet{};
+  for (uint8_t i = 0; i < length; i++) {
+    packet.push_back(bytes[i]);
+  }
+  if (!aux_track.packet(packet)) {
+    auxRejected++;
+    return false;
+  }
+  auxAccepted++;
+  return true;
+}
+
+extern "C" void AuxTrack_GetStatus(AuxTrackStatus_t* status)
+{
+  status->running = auxRunning.load(std::memory_order_acquire);
+  status->config = auxConfig;
+  status->bit1_us = auxBit1;
+  status->bit0_us = auxBit0;
+  status->accepted = auxAccepted;
+  status->rejected = auxRejected;
+  status->transmitted = aux_track.transmitted_;
+}
@@ -0,0 +1,324 @@
+/**
+ * @file benchmark.cpp
+ * @brief On-target benchmarks of the hot paths
+ *
+ * The run executes in the RPC thread (Benchmark_Poll) because RpcServer::handle
+ * resets the request arena and must not be nested inside a handler. The
+ * command station and decoder cases drive the DCC library objects directly and
+ * are skipped while the real thread owns them.
+ */
+
+#include "benchmark.h"
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <dcc/dcc.hpp>
+#include "main.h"
+#include "analog_manager.h"
+#include "command_station.h"
+#include "decoder.h"
+#include "parameter_manager.h"
+#include "rpc_server.h"
+#include "rpc_server.hpp"
+#include "rpc_transport_types.h"
+
+namespace {
+
+struct RpcCase {
+  const char* name;
+  const char* request;
+};
+
+// Methods without side effects, timed through parse, dispatch and serialize
+constexpr RpcCase kRpcCases[] = {
+  {"echo", R"({"method":"echo","params":{"value":1}})"},
+  {"command_station_queue_status", R"({"method":"command_station_queue_status","params":{}})"},
+  {"command_station_program_status", R"({"method":"command_station_program_status","params":{}})"},
+  {"command_station_timing_profiles", R"({"method":"command_station_timing_profiles","params":{}})"},
+  {"command_station_get_params", R"({"method":"command_station_get_params","params":{}})"},
+  {"command_station_packet_get_override", R"({"method":"command_station_packet_get_override","params":{}})"},
+  {"command_station_edge_timing", R"({"method":"command_station_edge_timing","params":{}})"},
+  {"decoder_edge_stats", R"({"method":"decoder_edge_stats","params":{}})"},
+  {"railcom_status", R"({"method":"railcom_status","params":{}})"},
+  {"sniffer_status", R"({"method":"sniffer_status","params":{}})"},
+  {"trace_log_status", R"({"method":"trace_log_status","params":{}})"},
+  {"get_voltage_feedback_mv", R"({"method":"get_voltage_feedback_mv","params":{}})"},
+  {"get_current_feedback_ma", R"({"method":"get_current_feedback_ma","params":{}})"},
+  {"get_gpio_input", R"({"method":"get_gpio_input","params":{"pin":1}})"},
+  {"get_gpio_inputs", R"({"method":"get_gpio_inputs","params":{}})"},
+  {"get_rtc_datetime", R"({"method":"get_rtc_datetime","params":{}})"},
+  {"system_usb_status", R"({"method":"system_usb_status","params":{}})"},
+  {"network_status", R"({"method":"network_status","params":{}})"},
+  {"telemetry_status", R"({"method":"telemetry_status","params":{}})"},
+  {"recorder_status", R"({"method":"recorder_status","params":{}})"},
+  {"packet_suite_status", R"({"method":"packet_suite_status","params":{}})"},
+  {"rpc_arena_status", R"({"method":"rpc_arena_status","params":{}})"},
+  {"rpc_jobs_status", R"({"method":"rpc_jobs_status","params":{}})"},
+  {"system_profile", R"({"method":"system_profile","params":{}})"},
+  {"(unknown method)", R"({"method":"benchmark_unknown","params":{}})"},
+  {"(invalid json)", R"({"method":"echo","params":)"},
+};
+
+std::atomic<bool> benchBusy{false};       // claimed by a request until the run has finished
+std::atomic<bool> benchRequested{false};  // parameters written, the RPC thread may start
+uint32_t benchIterations = BENCHMARK_DEFAULT_ITERATIONS;
+bool benchFlash = false;
+
+BenchmarkResult_t results[BENCHMARK_MAX_RESULTS];
+uint32_t resultCount = 0;
+uint32_t resultIterations = 0;
+
+char response[RPC_TX_BUFFER_SIZE];
+dcc::Packet packetSink;
+
+// Keep a result the compiler cannot see being used
+inline void keep(void const* p) { asm volatile("" : : "r"(p) : "memory"); }
+
+BenchmarkResult_t* addResult(const char* group, const char* name)
+{
+  if (resultCount >= BENCHMARK_MAX_RESULTS) {
+    return nullptr;
+  }
+  BenchmarkResult_t* const result = &results[resultCount++];
+  result->group = group;
+  result->name = name;
+  result->status = BENCHMARK_OK;
+  benchmark_stats_clear(&result->stats);
+  return result;
+}
+
+void runRpc(uint32_t iterations)
+{
+  RpcServer& server = rpc_server_instance();
+  for (RpcCase const& c : kRpcCases) {
+    BenchmarkResult_t* const result = addResult("rpc", c.name);
+    if (!result) {
+      return;
+    }
+    size_t const length = std::strlen(c.request);
+    for (uint32_t i = 0; i < iterations; i++) {
+      uint32_t const start = DWT->CYCCNT;
+      size_t const written = server.handle(c.request, length, response, sizeof(response));
+      benchmark_stats_add(&result->stats, DWT->CYCCNT - start);
+      if (written == 0) {
+        result->status = BENCHMARK_FAILED;
+      }
+    }
+  }
+}
+
+void runPackets(uint32_t iterations)
+{
+  // Arguments vary with the iteration so that nothing is hoisted out of the loop
+  if (BenchmarkResult_t* const result = addResult("dcc", "make_128_speed_step_control_packet")) {
+    for (uint32_t i = 0; i < iterations; i++) {
+      uint32_t const start = DWT->CYCCNT;
+      packetSink = dcc::make_128_speed_step_control_packet(3u + (i & 0x3Fu), 1u << 7u | (i & 0x7Fu));
+      keep(&packetSink);
+      benchmark_stats_add(&result->stats, DWT->CYCCNT - start);
+    }
+  }
+  if (BenchmarkResult_t* const result = addResult("dcc", "make_f0_f4_packet")) {
+    for (uint32_t i = 0; i < iterations; i++) {
+      uint32_t const start = DWT->CYCCNT;
+      packetSink = dcc::make_f0_f4_packet(3u + (i & 0x3Fu), i & 0x1Fu);
+      keep(&packetSink);
+      benchmark_stats_add(&result->stats, DWT->CYCCNT - start);
+    }
+  }
+}
+
+void runCommandStation(uint32_t iterations)
+{
+  BenchmarkResult_t* const transmit = addResult("cs", "transmit()");
+  BenchmarkResult_t* const half_bit = addResult("cs", "half bit (TIM2 path)");
+  if (!transmit || !half_bit) {
+    return;
+  }
+  if (!CommandStation_BenchmarkTransmit(iterations * BENCHMARK_CALLS_PER_ITERATION, &transmit->stats,
+                                        &half_bit->stats)) {
+    transmit->status = BENCHMARK_SKIPPED;
+    half_bit->status = BENCHMARK_SKIPPED;
+  }
+}
+
+void runDecoder(uint32_t iterations)
+{
+  if (BenchmarkResult_t* const result = addResult("decoder", "receive() per edge")) {
+    if (!Decoder_BenchmarkReceive(iterations * BENCHMARK_CALLS_PER_ITERATION, &result->stats)) {
+      result->status = BENCHMARK_SKIPPED;
+    }
+  }
+}
+
+void runAnalog(uint32_t iterations)
+{
+  // Streaming reads the DMA buffer, otherwise every call converts
+  bool const streaming = analog_manager_is_streaming();
+  BenchmarkResult_t* const voltage =
+      addResult("adc", streaming ? "get_voltage_feedback_mv (stream)" : "get_voltage_feedback_mv (on demand)");
+  BenchmarkResult_t* const current =
+      addResult("adc", streaming ? "get_current_feedback_ma (stream)" : "get_current_feedback_ma (on demand)");
+  if (!voltage || !current) {
+    return;
+  }
+  for (uint32_t i = 0; i < iterations; i++) {
+    uint16_t value = 0;
+    uint32_t start = DWT->CYCCNT;
+    int status = get_voltage_feedback_mv(&value);
+    benchmark_stats_add(&voltage->stats, DWT->CYCCNT - start);
+    if (status != 0) {
+      voltage->status = BENCHMARK_FAILED;
+    }
+
+    start = DWT->CYCCNT;
+    status = get_current_feedback_ma(&value);
+    benchmark_stats_add(&current->stats, DWT->CYCCNT - start);
+    if (status != 0) {
+      current->status = BENCHMARK_FAILED;
+    }
+  }
+}
+
+void runParameters(uint32_t iterations)
+{
+  BenchmarkResult_t* const save = addResult("params", "parameter_manager_save");
+  BenchmarkResult_t* const restore = addResult("params", "parameter_manager_restore");
+  if (!save || !restore) {
+    return;
+  }
+  uint32_t const count = iterations < BENCHMARK_FLASH_ITERATIONS ? iterations : BENCHMARK_FLASH_ITERATIONS;
+  for (uint32_t i = 0; i < count; i++) {
+    uint32_t start = DWT->CYCCNT;
+    if (parameter_manager_save() != 0) {
+      save->status = BENCHMARK_FAILED;
+    }
+    benchmark_stats_add(&save->stats, DWT->CYCCNT - start);
+
+    start = DWT->CYCCNT;
+    if (parameter_manager_restore() != 0) {
+      restore->status = BENCHMARK_FAILED;
+    }
+    benchmark_stats_add(&restore->stats, DWT->CYCCNT - start);
+  }
+}
+
+}  // namespace
+
+extern "C" void benchmark_stats_clear(BenchmarkStats_t* stats)
+{
+  stats->runs = 0;
+  stats->min_cycles = UINT32_MAX;
+  stats->max_cycles = 0;
+  stats->total_cycles = 0;
+}
+
+extern "C" void benchmark_stats_add(BenchmarkStats_t* stats, uint32_t cycles)
+{
+  stats->runs++;
+  stats->total_cycles += cycles;
+  if (cycles < stats->min_cycles) {
+    stats->min_cycles = cycles;
+  }
+  if (cycles > stats->max_cycles) {
+    stats->max_cycles = cycles;
+  }
+}
+
+// Can be called from anywhere
+extern "C" bool Benchmark_Request(uint32_t iterations, bool flash)
+{
+  if (iterations == 0u || iterations > BENCHMARK_MAX_ITERATIONS) {
+    return false;
+  }
+  bool expected = false;
+  if (!benchBusy.compare_exchange_strong(expected, true)) {
+    return false;
+  }
+  benchIterations = iterations;
+  benchFlash = flash;
+  benchRequested.store(true, std::memory_order_release);
+  RpcServer_Notify();
+  return true;
+}
+
+extern "C" bool Benchmark_Busy(void)
+{
+  return benchBusy.load(std::memory_order_acquire);
+}
+
+extern "C" void Benchmark_Poll(void)
+{
+  if (!benchRequested.load(std::memory_order_acquire)) {
+    return;
+  }
+  uint32_t const iterations = benchIterations;
+
+  // The cycle counter is enabled by the profiler at kernel start, make sure it runs
+  CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+  DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+  resultCount = 0;
+  runRpc(iterations);
+  runPackets(iterations);
+  runCommandStation(iterations);
+  runDecoder(iterations);
+  runAnalog(iterations);
+  if (benchFlash) {
+    runParameters(iterations);
+  }
+  resultIterations = iterations;
+
+  benchRequested.store(false, std::memory_order_relaxed);
+  benchBusy.store(false, std::memory_order_release);
+}
+
+extern "C" uint32_t Benchmark_GetResults(const BenchmarkResult_t** out, uint32_t* iterations)
+{
+  // Nothing to read while a run rewrites the table
+  bool const busy = Benchmark_Busy();
+  *out = results;
+  if (iterations) {
+    *iterations = busy ? 0u : resultIterations;
+  }
+  return busy ? 0u : resultCount;
+}
+
+extern "C" void Benchmark_Print(void)
+{
+  const BenchmarkResult_t* list = nullptr;
+  uint32_t iterations = 0;
+  uint32_t const count = Benchmark_GetResults(&list, &iterations);
+  if (count == 0) {
+    printf("No benchmark results\n");
+    return;
+  }
+
+  uint32_t const mhz = SystemCoreClock / 1000000u;
+  printf("Benchmark, %lu iterations, %lu MHz, cycles per call\n", static_cast<unsigned long>(iterations),
+         static_cast<unsigned long>(mhz));
+  printf("%-8s %-38s %6s %9s %9s %9s %9s\n", "group", "name", "runs", "min", "mean", "max", "mean_us");
+  for (uint32_t i = 0; i < count; i++) {
+    const BenchmarkResult_t& r = list[i];
+    if (r.status == BENCHMARK_SKIPPED || r.stats.runs == 0) {
+      printf("%-8s %-38s %s\n", r.group, r.name, Benchmark_StatusName(r.status));
+      continue;
+    }
+    uint32_t const mean = static_cast<uint32_t>(r.stats.total_cycles / r.stats.runs);
+    uint64_t const mean_ns = mhz ? static_cast<uint64_t>(mean) * 1000u / mhz : 0u;
+    printf("%-8s %-38s %6lu %9lu %9lu %9lu %5lu.%03lu%s\n", r.group, r.name, static_cast<unsigned long>(r.stats.runs),
+           static_cast<unsigned long>(r.stats.min_cycles), static_cast<unsigned long>(mean),
+           static_cast<unsigned long>(r.stats.max_cycles), static_cast<unsigned long>(mean_ns / 1000u),
+           static_cast<unsigned long>(mean_ns % 1000u), r.status == BENCHMARK_FAILED ? " failed" : "");
+  }
+}
+
+extern "C" const char* Benchmark_StatusName(uint8_t status)
+{
+  switch (status) {
+    case BENCHMARK_OK: return "ok";
+    case BENCHMARK_SKIPPED: return "skipped";
+    case BENCHMARK_FAILED: return "failed";
+    default: return "?";
+  }
+}
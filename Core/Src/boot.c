@@ -0,0 +1,162 @@
+/**
+ * @file boot.c
+ * @brief Boot time profile and subsystems initialised on first use
+ *
+ * A step is timed at the core clock in effect when it began, so the step
+ * which switches to the PLL (SystemClock_Config) is slightly overestimated.
+ * Steps must be less than one wrap of the cycle counter apart (17 s at
+ * 250 MHz), which holds for the start up. Milestones after the scheduler has
+ * started go on from the last step with the HAL tick, which does not advance
+ * while ThreadX initialises with interrupts disabled.
+ */
+
+#include "boot.h"
+#include "main.h"
+#include "rtos_static.h"
+#include "decoder.h"
+#include "SUSI.h"
+#include "can_sync.h"
+
+typedef struct {
+    const char *name;
+    void (*init)(void);
+} BootSubsystemDef_t;
+
+static void decoder_start_up(void)
+{
+    Decoder_Init();
+}
+
+static void susi_master_start_up(void)
+{
+    MX_SPI5_Init();
+    SUSI_Master_Init(&hspi5);
+}
+
+static void susi_slave_start_up(void)
+{
+    MX_SPI2_Init();
+    SUSI_Slave_Init(&hspi2);
+}
+
+// can_sync_init replaces the CubeMX bit timing, MX_FDCAN1_Init sets up the handle it starts from
+static void can_sync_start_up(void)
+{
+    MX_FDCAN1_Init();
+    can_sync_init();
+}
+
+static const BootSubsystemDef_t kSubsystems[BOOT_SUBSYSTEM_COUNT] = {
+    { "decoder", decoder_start_up },
+    { "susi_master", susi_master_start_up },
+    { "susi_slave", susi_slave_start_up },
+    { "can_sync", can_sync_start_up },
+};
+
+static const char *const kEventNames[BOOT_EVENT_COUNT] = {
+    "rpc_ready", "usb_active", "first_request"
+};
+
+RTOS_MUTEX(bootLock);
+
+static BootProfile_t g_profile;
+static osMutexId_t g_lock = NULL;
+static uint32_t g_lastCycles = 0;
+static uint32_t g_lastHz = 0;       // core clock during the step in progress
+static uint32_t g_lastTick = 0;     // HAL tick at the last step
+static uint32_t g_us = 0;           // end of the last step
+
+static uint32_t cycles_to_us(uint32_t cycles, uint32_t hz)
+{
+    uint32_t const mhz = hz / 1000000u;
+    return mhz ? cycles / mhz : 0u;
+}
+
+static uint32_t now_ms(void)
+{
+    return g_us / 1000u + (HAL_GetTick() - g_lastTick);
+}
+
+void boot_profile_start(void)
+{
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+    g_profile.lazy = BOOT_LAZY_INIT != 0;
+    g_lastCycles = 0;
+    g_lastHz = SystemCoreClock;
+    g_lastTick = HAL_GetTick();
+}
+
+void boot_mark(const char *step)
+{
+    uint32_t const now = DWT->CYCCNT;
+    uint32_t const us = cycles_to_us(now - g_lastCycles, g_lastHz);
+    g_us += us;
+    g_lastCycles = now;
+    g_lastHz = SystemCoreClock;
+    g_lastTick = HAL_GetTick();
+
+    if (g_profile.step_count < BOOT_MAX_STEPS) {
+        BootStep_t *const entry = &g_profile.steps[g_profile.step_count++];
+        entry->name = step;
+        entry->end_us = g_us;
+        entry->us = us;
+    }
+}
+
+void boot_event(BootEvent_t event)
+{
+    if ((uint32_t)event < BOOT_EVENT_COUNT && g_profile.event_ms[event] == 0u) {
+        uint32_t const ms = now_ms();
+        g_profile.event_ms[event] = ms ? ms : 1u;
+    }
+}
+
+static void subsystem_start_up(BootSubsystem_t subsystem)
+{
+    BootSubsystemState_t *const state = &g_profile.subsystems[subsystem];
+    uint32_t const start = DWT->CYCCNT;
+    kSubsystems[subsystem].init();
+    state->init_us = cycles_to_us(DWT->CYCCNT - start, SystemCoreClock);
+    state->at_ms = now_ms();
+    state->ready = true;
+}
+
+void boot_subsystems_init(void)
+{
+    g_lock = osMutexNew(&bootLock_attr);
+#if !BOOT_LAZY_INIT
+    for (uint32_t i = 0; i < BOOT_SUBSYSTEM_COUNT; i++) {
+        subsystem_start_up((BootSubsystem_t)i);
+    }
+#endif
+}
+
+void boot_require(BootSubsystem_t subsystem)
+{
+    if ((uint32_t)subsystem >= BOOT_SUBSYSTEM_COUNT || g_profile.subsystems[subsystem].ready) {
+        return;
+    }
+    osMutexAcquire(g_lock, osWaitForever);
+    if (!g_profile.subsystems[subsystem].ready) {
+        subsystem_start_up(subsystem);
+    }
+    osMutexRelease(g_lock);
+}
+
+void boot_get_profile(BootProfile_t *profile)
+{
+    *profile = g_profile;
+}
+
+const char *boot_subsystem_name(BootSubsystem_t subsystem)
+{
+    return (uint32_t)subsystem < BOOT_SUBSYSTEM_COUNT ? kSubsystems[subsystem].name : "?";
+}
+
+const char *boot_event_name(BootEvent_t event)
+{
+    return (uint32_t)event < BOOT_EVENT_COUNT ? kEventNames[event] : "?";
+}
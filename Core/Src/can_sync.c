@@ -0,0 +1,609 @@
+/**
+ * @file can_sync.c
+ * @brief FDCAN bridge for synchronised packet programs on several testers
+ *
+ * The FDCAN interrupt converts message timestamps to DWT cycles and keeps the
+ * marker bookkeeping, the transmit interrupt (packet hook) stamps the local
+ * packets. Both update the shared history with interrupts disabled for a few
+ * instructions. The start thread waits for the start time and starts the
+ * packet program; frames are queued from any context with interrupts
+ * disabled, so the Tx FIFO put index is never raced.
+ */
+
+#include "can_sync.h"
+#include "main.h"
+#include "cmsis_os2.h"
+#include "rtos_static.h"
+#include "boot.h"
+#include "command_station.h"
+#include "packet_program.h"
+#include <stdio.h>
+#include <string.h>
+
+extern FDCAN_HandleTypeDef hfdcan1;
+
+#define CAN_SYNC_TQ_PER_BIT     20u     // 1 + 15 + 4, sample point 80 %
+#define CAN_SYNC_ID_START       (CAN_SYNC_ID_BASE + 0u)
+#define CAN_SYNC_ID_MARKER      (CAN_SYNC_ID_BASE + 1u)
+#define CAN_SYNC_ID_POLL        (CAN_SYNC_ID_BASE + 2u)
+#define CAN_SYNC_ID_STOP        (CAN_SYNC_ID_BASE + 3u)
+#define CAN_SYNC_ID_RESULT      (CAN_SYNC_ID_BASE + 0x10u)
+#define CAN_SYNC_ID_LAST        (CAN_SYNC_ID_RESULT + 2u * CAN_SYNC_MAX_NODES - 1u)
+
+#define CAN_SYNC_TX_MARK_START  0x80u   // Tx event marker of START, MARKER uses index & 0x7F
+#define CAN_SYNC_LAG_NONE       INT16_MAX
+
+#define CAN_SYNC_EVENT_START    (1u << 0)
+#define CAN_SYNC_EVENT_STOP     (1u << 1)
+#define CAN_SYNC_EVENT_ALL      (CAN_SYNC_EVENT_START | CAN_SYNC_EVENT_STOP)
+
+_Static_assert((CAN_SYNC_HISTORY & (CAN_SYNC_HISTORY - 1u)) == 0u && CAN_SYNC_HISTORY <= 128u,
+               "CAN_SYNC_HISTORY must be a power of two dividing the Tx event marker range");
+
+typedef struct {
+    uint32_t index;             // packet index since start
+    uint32_t cycles;            // DWT cycle counter
+    bool valid;
+} CanSyncStamp_t;
+
+static bool g_ready = false;
+static bool g_running = false;              // controller started
+static osEventFlagsId_t g_events = NULL;
+static osThreadId_t g_threadHandle = NULL;
+RTOS_EVENT_FLAGS(canSyncEvents);
+static uint8_t g_role = CAN_SYNC_ROLE_OFF;
+static uint8_t g_node = 0;
+static uint8_t g_session = 0;
+static uint32_t g_leadMs = CAN_SYNC_DEFAULT_LEAD_MS;
+static uint32_t g_cyclesPerTick = 1u;       // DWT cycles per timestamp counter tick (one CAN bit)
+static uint32_t g_cyclesPerUs = 1u;
+
+// Session
+static volatile bool g_armed = false;       // start time set, the thread waits for it
+static uint32_t g_startCycles = 0;
+static volatile bool g_active = false;      // program started, packets are stamped
+static uint32_t g_baseSeq = 0;              // packet sequence number before the first program packet
+static const char *g_startError = NULL;
+
+static CanSyncStamp_t g_packet[CAN_SYNC_HISTORY];   // local packets
+static CanSyncStamp_t g_sof[CAN_SYNC_HISTORY];      // follower: start of frame of MARKER
+static CanSyncStamp_t g_master[CAN_SYNC_HISTORY];   // follower: master packets on the local time base
+static uint32_t g_lastMarker = 0;
+static bool g_lastMarkerValid = false;
+static uint32_t g_lagIndex = 0;             // master: index of the last measured marker
+static int32_t g_lagUs = CAN_SYNC_LAG_NONE;
+
+// Local offset summary
+static bool g_started = false;
+static uint32_t g_packets = 0;
+static uint32_t g_matched = 0;
+static uint32_t g_missed = 0;
+static int64_t g_sumUs = 0;
+static int32_t g_minUs = 0;
+static int32_t g_maxUs = 0;
+
+static CanSyncResult_t g_results[CAN_SYNC_MAX_NODES];   // master: RESULT frames
+
+static volatile uint32_t g_txFrames = 0;
+static volatile uint32_t g_rxFrames = 0;
+static volatile uint32_t g_txDropped = 0;
+static volatile uint32_t g_markers = 0;
+
+RTOS_THREAD_MEMORY(canSyncTask, 512 * 4);
+static const osThreadAttr_t canSyncTask_attributes = {
+    .name = "canSyncTask",
+    .priority = (osPriority_t) osPriorityAboveNormal,
+    RTOS_THREAD_ATTR_MEMORY(canSyncTask)
+};
+
+static void put16(uint8_t *p, uint32_t value)
+{
+    p[0] = (uint8_t)value;
+    p[1] = (uint8_t)(value >> 8);
+}
+
+static uint16_t get16(const uint8_t *p)
+{
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint16_t sat_u16(uint32_t value)
+{
+    return value > UINT16_MAX ? UINT16_MAX : (uint16_t)value;
+}
+
+static int16_t sat_i16(int32_t value)
+{
+    if (value > INT16_MAX - 1) {
+        return INT16_MAX - 1;       // INT16_MAX is CAN_SYNC_LAG_NONE
+    }
+    return value < INT16_MIN ? INT16_MIN : (int16_t)value;
+}
+
+// Queue a classic frame, any context
+static bool send(uint32_t id, const uint8_t *data, uint32_t length, uint32_t tx_mark, bool event)
+{
+    FDCAN_TxHeaderTypeDef header = {0};
+    header.Identifier = id;
+    header.IdType = FDCAN_STANDARD_ID;
+    header.TxFrameType = FDCAN_DATA_FRAME;
+    header.DataLength = length;             // FDCAN_DLC_BYTES_0 ... _8 are the byte counts
+    header.ErrorStateIndicator = FDCAN_ESI_ACTIVE;
+    header.BitRateSwitch = FDCAN_BRS_OFF;
+    header.FDFormat = FDCAN_CLASSIC_CAN;
+    header.TxEventFifoControl = event ? FDCAN_STORE_TX_EVENTS : FDCAN_NO_TX_EVENTS;
+    header.MessageMarker = tx_mark;
+
+    uint32_t const primask = __get_PRIMASK();
+    __disable_irq();
+    bool const queued = g_running && HAL_FDCAN_AddMessageToTxFifoQ(&hfdcan1, &header, data) == HAL_OK;
+    if (queued) {
+        g_txFrames++;
+    } else {
+        g_txDropped++;
+    }
+    __set_PRIMASK(primask);
+    return queued;
+}
+
+// Cycle counter at a message timestamp, shortly after it (FDCAN interrupt)
+static uint32_t to_cycles(uint32_t timestamp)
+{
+    uint32_t const now = DWT->CYCCNT;
+    uint16_t const counter = (uint16_t)HAL_FDCAN_GetTimestampCounter(&hfdcan1);
+    return now - (uint32_t)(uint16_t)(counter - (uint16_t)timestamp) * g_cyclesPerTick;
+}
+
+static void stamp(CanSyncStamp_t *history, uint32_t index, uint32_t cycles)
+{
+    CanSyncStamp_t *entry = &history[index & (CAN_SYNC_HISTORY - 1u)];
+    entry->index = index;
+    entry->cycles = cycles;
+    entry->valid = true;
+}
+
+static const CanSyncStamp_t *lookup(const CanSyncStamp_t *history, uint32_t index)
+{
+    const CanSyncStamp_t *entry = &history[index & (CAN_SYNC_HISTORY - 1u)];
+    return (entry->valid && entry->index == index) ? entry : NULL;
+}
+
+// Follower: offset once both the local and the master packet are known, interrupts disabled
+static void match(uint32_t index)
+{
+    const CanSyncStamp_t *local = lookup(g_packet, index);
+    CanSyncStamp_t *master = &g_master[index & (CAN_SYNC_HISTORY - 1u)];
+    if (local == NULL || !master->valid || master->index != index) {
+        return;
+    }
+    int32_t const us = (int32_t)(local->cycles - master->cycles) / (int32_t)g_cyclesPerUs;
+    master->valid = false;
+    if (g_matched == 0u || us < g_minUs) {
+        g_minUs = us;
+    }
+    if (g_matched == 0u || us > g_maxUs) {
+        g_maxUs = us;
+    }
+    g_sumUs += us;
+    g_matched++;
+}
+
+static void session_clear(void)
+{
+    memset(g_packet, 0, sizeof(g_packet));
+    memset(g_sof, 0, sizeof(g_sof));
+    memset(g_master, 0, sizeof(g_master));
+    g_lastMarkerValid = false;
+    g_lagUs = CAN_SYNC_LAG_NONE;
+    g_started = false;
+    g_packets = 0;
+    g_matched = 0;
+    g_missed = 0;
+    g_sumUs = 0;
+    g_minUs = 0;
+    g_maxUs = 0;
+    g_startError = NULL;
+}
+
+static void local_result(CanSyncResult_t *result)
+{
+    PacketProgramStatus_t program;
+    CommandStation_GetProgramStatus(&program);
+
+    uint32_t const primask = __get_PRIMASK();
+    __disable_irq();
+    result->valid = true;
+    result->started = g_started;
+    result->running = g_started && program.running;
+    result->matched = sat_u16(g_matched);
+    result->missed = sat_u16(g_missed);
+    result->packets = sat_u16(g_packets);
+    result->min_us = sat_i16(g_minUs);
+    result->max_us = sat_i16(g_maxUs);
+    result->mean_us = g_matched ? sat_i16((int32_t)(g_sumUs / (int64_t)g_matched)) : 0;
+    __set_PRIMASK(primask);
+}
+
+// Start the program lead_ms after the reference (FDCAN interrupt)
+static void arm(uint32_t reference, uint32_t lead_ms)
+{
+    g_startCycles = reference + lead_ms * 1000u * g_cyclesPerUs;
+    g_armed = true;
+    osEventFlagsSet(g_events, CAN_SYNC_EVENT_START);
+}
+
+// Command station transmit interrupt: end bit of every packet
+static void sync_packet(uint32_t packet_seq, const uint8_t *bytes, uint8_t length)
+{
+    (void)bytes;
+    (void)length;
+    uint32_t const now = DWT->CYCCNT;
+    if (!g_active) {
+        return;
+    }
+    uint32_t const index = packet_seq - g_baseSeq;
+    stamp(g_packet, index, now);
+    g_packets++;
+
+    if (g_role == CAN_SYNC_ROLE_MASTER) {
+        uint8_t data[7];
+        int32_t const lag = (g_lagUs != CAN_SYNC_LAG_NONE && g_lagIndex + 1u == index) ? g_lagUs : CAN_SYNC_LAG_NONE;
+        put16(&data[0], index);
+        put16(&data[2], index >> 16);
+        put16(&data[4], (uint16_t)(int16_t)lag);
+        data[6] = g_session;
+        if (send(CAN_SYNC_ID_MARKER, data, sizeof(data), index & 0x7Fu, true)) {
+            g_markers++;
+        }
+    } else {
+        match(index);
+    }
+}
+
+static void rx_marker(const uint8_t *data, uint32_t sof)
+{
+    uint32_t const index = get16(&data[0]) | ((uint32_t)get16(&data[2]) << 16);
+    int16_t const lag = (int16_t)get16(&data[4]);
+    if (data[6] != g_session || !g_active) {
+        return;
+    }
+    g_markers++;
+    if (g_lastMarkerValid && index - g_lastMarker > 1u && index > g_lastMarker) {
+        g_missed += index - g_lastMarker - 1u;
+    }
+    g_lastMarker = index;
+    g_lastMarkerValid = true;
+    stamp(g_sof, index, sof);
+
+    // The lag of the previous marker places the previous master packet on the local time base
+    const CanSyncStamp_t *previous = lookup(g_sof, index - 1u);
+    if (lag != CAN_SYNC_LAG_NONE && previous) {
+        stamp(g_master, index - 1u, previous->cycles - (uint32_t)((int32_t)lag * (int32_t)g_cyclesPerUs));
+        match(index - 1u);
+    }
+}
+
+static void reply_result(void)
+{
+    CanSyncResult_t result;
+    local_result(&result);
+    uint8_t data[8];
+    data[0] = g_node;
+    data[1] = (uint8_t)((result.started ? 0x01u : 0u) | (result.running ? 0x02u : 0u));
+    put16(&data[2], result.matched);
+    put16(&data[4], (uint16_t)result.min_us);
+    put16(&data[6], (uint16_t)result.max_us);
+    send(CAN_SYNC_ID_RESULT + 2u * g_node, data, sizeof(data), 0u, false);
+
+    data[1] = 0;
+    put16(&data[2], (uint16_t)result.mean_us);
+    put16(&data[4], result.missed);
+    put16(&data[6], result.packets);
+    send(CAN_SYNC_ID_RESULT + 2u * g_node + 1u, data, sizeof(data), 0u, false);
+}
+
+static void rx_result(uint32_t id, const uint8_t *data)
+{
+    uint32_t const node = (id - CAN_SYNC_ID_RESULT) / 2u;
+    if (node == 0u || node >= CAN_SYNC_MAX_NODES || data[0] != node) {
+        return;
+    }
+    CanSyncResult_t *result = &g_results[node];
+    if ((id - CAN_SYNC_ID_RESULT) & 1u) {
+        result->mean_us = (int16_t)get16(&data[2]);
+        result->missed = get16(&data[4]);
+        result->packets = get16(&data[6]);
+        result->valid = true;
+    } else {
+        result->started = (data[1] & 0x01u) != 0u;
+        result->running = (data[1] & 0x02u) != 0u;
+        result->matched = get16(&data[2]);
+        result->min_us = (int16_t)get16(&data[4]);
+        result->max_us = (int16_t)get16(&data[6]);
+    }
+}
+
+void HAL_FDCAN_RxFifo0Callback(FDCAN_HandleTypeDef *hfdcan, uint32_t RxFifo0ITs)
+{
+    if (!(RxFifo0ITs & FDCAN_IT_RX_FIFO0_NEW_MESSAGE)) {
+        return;
+    }
+    FDCAN_RxHeaderTypeDef header;
+    uint8_t data[8];
+    while (HAL_FDCAN_GetRxFifoFillLevel(hfdcan, FDCAN_RX_FIFO0) > 0u &&
+           HAL_FDCAN_GetRxMessage(hfdcan, FDCAN_RX_FIFO0, &header, data) == HAL_OK) {
+        g_rxFrames++;
+        if (header.IdType != FDCAN_STANDARD_ID || header.RxFrameType != FDCAN_DATA_FRAME) {
+            continue;
+        }
+        uint32_t const primask = __get_PRIMASK();
+        __disable_irq();
+        uint32_t const sof = to_cycles(header.RxTimestamp);
+        bool const follower = g_role == CAN_SYNC_ROLE_FOLLOWER;
+
+        if (follower && header.Identifier == CAN_SYNC_ID_START && header.DataLength >= 3u) {
+            g_session = data[0];
+            g_leadMs = get16(&data[1]);
+            g_active = false;
+            session_clear();
+            arm(sof, g_leadMs);
+        } else if (follower && header.Identifier == CAN_SYNC_ID_MARKER && header.DataLength >= 7u) {
+            rx_marker(data, sof);
+        } else if (follower && header.Identifier == CAN_SYNC_ID_STOP && header.DataLength >= 1u && data[0] == g_session) {
+            g_armed = false;
+            osEventFlagsSet(g_events, CAN_SYNC_EVENT_STOP);
+        } else if (g_role == CAN_SYNC_ROLE_MASTER && header.Identifier >= CAN_SYNC_ID_RESULT &&
+                   header.Identifier <= CAN_SYNC_ID_LAST && header.DataLength >= 8u) {
+            rx_result(header.Identifier, data);
+        }
+        __set_PRIMASK(primask);
+
+        if (follower && header.Identifier == CAN_SYNC_ID_POLL && header.DataLength >= 1u && data[0] == g_session) {
+            reply_result();
+        }
+    }
+}
+
+void HAL_FDCAN_TxEventFifoCallback(FDCAN_HandleTypeDef *hfdcan, uint32_t TxEventFifoITs)
+{
+    if (!(TxEventFifoITs & FDCAN_IT_TX_EVT_FIFO_NEW_DATA)) {
+        return;
+    }
+    FDCAN_TxEventFifoTypeDef event;
+    while (HAL_FDCAN_GetTxEvent(hfdcan, &event) == HAL_OK) {
+        uint32_t const primask = __get_PRIMASK();
+        __disable_irq();
+        uint32_t const sof = to_cycles(event.TxTimestamp);
+        if (event.MessageMarker == CAN_SYNC_TX_MARK_START) {
+            arm(sof, g_leadMs);
+        } else {
+            // Packet to start of frame of its MARKER, carried by the next one
+            const CanSyncStamp_t *packet = &g_packet[event.MessageMarker & (CAN_SYNC_HISTORY - 1u)];
+            if (packet->valid && (packet->index & 0x7Fu) == event.MessageMarker) {
+                g_lagIndex = packet->index;
+                g_lagUs = sat_i16((int32_t)(sof - packet->cycles) / (int32_t)g_cyclesPerUs);
+            }
+        }
+        __set_PRIMASK(primask);
+    }
+}
+
+void FDCAN1_IT0_IRQHandler(void)
+{
+    HAL_FDCAN_IRQHandler(&hfdcan1);
+}
+
+// Sleep to just before the start time, then spin on the cycle counter
+static void wait_until(uint32_t target)
+{
+    uint32_t const cycles_per_ms = g_cyclesPerUs * 1000u;
+    int32_t remaining = (int32_t)(target - DWT->CYCCNT);
+    if (remaining > (int32_t)(2u * cycles_per_ms)) {
+        osDelay((uint32_t)remaining / cycles_per_ms - 1u);
+    }
+    while ((int32_t)(target - DWT->CYCCNT) > 0 && g_armed) {
+    }
+}
+
+static void CanSyncTask(void *argument)
+{
+    (void)argument;
+    while (true) {
+        uint32_t const events = osEventFlagsWait(g_events, CAN_SYNC_EVENT_ALL, osFlagsWaitAny, osWaitForever);
+        if (events & osFlagsError) {
+            continue;
+        }
+        if (events & CAN_SYNC_EVENT_STOP) {
+            g_active = false;
+            CommandStation_SetPacketHook(COMMAND_STATION_HOOK_CAN_SYNC, NULL);
+            CommandStation_StopProgram();
+        }
+        if ((events & CAN_SYNC_EVENT_START) && g_armed) {
+            CommandStation_SetPacketHook(COMMAND_STATION_HOOK_CAN_SYNC, sync_packet);
+            wait_until(g_startCycles);
+            if (!g_armed) {
+                continue;
+            }
+            g_armed = false;
+            g_baseSeq = CommandStation_GetPacketSeq();
+            g_active = true;
+            const char *error = NULL;
+            g_started = CommandStation_RunProgram(&error);
+            g_startError = g_started ? NULL : error;
+            if (!g_started) {
+                g_active = false;
+            }
+        }
+    }
+}
+
+void can_sync_init(void)
+{
+    uint32_t const kernel = HAL_RCCEx_GetPeriphCLKFreq(RCC_PERIPHCLK_FDCAN);
+    uint32_t const prescaler = kernel / (CAN_SYNC_BITRATE * CAN_SYNC_TQ_PER_BIT);
+    if (prescaler == 0u || prescaler > 512u || prescaler * CAN_SYNC_BITRATE * CAN_SYNC_TQ_PER_BIT != kernel) {
+        printf("CAN sync: FDCAN clock %lu Hz does not divide to %lu bit/s\n",
+               (unsigned long)kernel, (unsigned long)CAN_SYNC_BITRATE);
+        return;
+    }
+
+    // CubeMX leaves FDCAN1 with placeholder bit timing and no filter
+    HAL_FDCAN_DeInit(&hfdcan1);
+    hfdcan1.Init.ClockDivider = FDCAN_CLOCK_DIV1;
+    hfdcan1.Init.FrameFormat = FDCAN_FRAME_CLASSIC;
+    hfdcan1.Init.Mode = FDCAN_MODE_NORMAL;
+    hfdcan1.Init.AutoRetransmission = ENABLE;
+    hfdcan1.Init.NominalPrescaler = prescaler;
+    hfdcan1.Init.NominalSyncJumpWidth = 4;
+    hfdcan1.Init.NominalTimeSeg1 = 15;
+    hfdcan1.Init.NominalTimeSeg2 = 4;
+    hfdcan1.Init.StdFiltersNbr = 1;
+    hfdcan1.Init.ExtFiltersNbr = 0;
+    hfdcan1.Init.TxFifoQueueMode = FDCAN_TX_FIFO_OPERATION;
+    if (HAL_FDCAN_Init(&hfdcan1) != HAL_OK) {
+        printf("CAN sync: FDCAN init failed\n");
+        return;
+    }
+
+    FDCAN_FilterTypeDef filter = {0};
+    filter.IdType = FDCAN_STANDARD_ID;
+    filter.FilterIndex = 0;
+    filter.FilterType = FDCAN_FILTER_RANGE;
+    filter.FilterConfig = FDCAN_FILTER_TO_RXFIFO0;
+    filter.FilterID1 = CAN_SYNC_ID_BASE;
+    filter.FilterID2 = CAN_SYNC_ID_LAST;
+    if (HAL_FDCAN_ConfigFilter(&hfdcan1, &filter) != HAL_OK ||
+        HAL_FDCAN_ConfigGlobalFilter(&hfdcan1, FDCAN_REJECT, FDCAN_REJECT, FDCAN_REJECT_REMOTE, FDCAN_REJECT_REMOTE) != HAL_OK ||
+        HAL_FDCAN_ConfigTimestampCounter(&hfdcan1, FDCAN_TIMESTAMP_PRESC_1) != HAL_OK ||
+        HAL_FDCAN_EnableTimestampCounter(&hfdcan1, FDCAN_TIMESTAMP_INTERNAL) != HAL_OK ||
+        HAL_FDCAN_ActivateNotification(&hfdcan1, FDCAN_IT_RX_FIFO0_NEW_MESSAGE | FDCAN_IT_TX_EVT_FIFO_NEW_DATA, 0) != HAL_OK) {
+        printf("CAN sync: FDCAN setup failed\n");
+        return;
+    }
+
+    g_cyclesPerUs = SystemCoreClock / 1000000u;
+    g_cyclesPerTick = SystemCoreClock / CAN_SYNC_BITRATE;
+
+    g_events = osEventFlagsNew(&canSyncEvents_attr);
+    g_threadHandle = osThreadNew(CanSyncTask, NULL, &canSyncTask_attributes);
+    if (g_events == NULL || g_threadHandle == NULL) {
+        printf("Failed to create CAN sync thread\n");
+        return;
+    }
+    HAL_NVIC_SetPriority(FDCAN1_IT0_IRQn, CAN_SYNC_IRQ_PRIORITY, 0);
+    HAL_NVIC_EnableIRQ(FDCAN1_IT0_IRQn);
+    g_ready = true;
+}
+
+int can_sync_configure(CanSyncRole_t role, uint8_t node)
+{
+    boot_require(BOOT_SUBSYSTEM_CAN_SYNC);
+    if (!g_ready || role > CAN_SYNC_ROLE_FOLLOWER ||
+        (role == CAN_SYNC_ROLE_FOLLOWER && (node == 0u || node >= CAN_SYNC_MAX_NODES))) {
+        return -1;
+    }
+    g_armed = false;
+    g_active = false;
+    CommandStation_SetPacketHook(COMMAND_STATION_HOOK_CAN_SYNC, NULL);
+
+    if (role == CAN_SYNC_ROLE_OFF) {
+        if (g_running) {
+            HAL_FDCAN_Stop(&hfdcan1);
+            g_running = false;
+        }
+    } else if (!g_running) {
+        if (HAL_FDCAN_Start(&hfdcan1) != HAL_OK) {
+            return -2;
+        }
+        g_running = true;
+    }
+    g_role = (uint8_t)role;
+    g_node = role == CAN_SYNC_ROLE_FOLLOWER ? node : 0u;
+    return 0;
+}
+
+int can_sync_start(uint32_t lead_ms)
+{
+    if (g_role != CAN_SYNC_ROLE_MASTER || lead_ms < CAN_SYNC_MIN_LEAD_MS || lead_ms > CAN_SYNC_MAX_LEAD_MS) {
+        return -1;
+    }
+    uint32_t const primask = __get_PRIMASK();
+    __disable_irq();
+    g_armed = false;
+    g_active = false;
+    g_session++;
+    g_leadMs = lead_ms;
+    session_clear();
+    memset(g_results, 0, sizeof(g_results));
+    __set_PRIMASK(primask);
+
+    // The Tx event of START arms the master, the reception arms the followers
+    uint8_t data[3];
+    data[0] = g_session;
+    put16(&data[1], lead_ms);
+    return send(CAN_SYNC_ID_START, data, sizeof(data), CAN_SYNC_TX_MARK_START, true) ? 0 : -2;
+}
+
+int can_sync_stop(void)
+{
+    if (g_role != CAN_SYNC_ROLE_MASTER) {
+        return -1;
+    }
+    uint8_t const data[1] = {g_session};
+    send(CAN_SYNC_ID_STOP, data, sizeof(data), 0u, false);
+    g_armed = false;
+    osEventFlagsSet(g_events, CAN_SYNC_EVENT_STOP);
+    return 0;
+}
+
+int can_sync_collect(CanSyncResult_t *results)
+{
+    if (g_role != CAN_SYNC_ROLE_MASTER) {
+        return -1;
+    }
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    for (uint32_t node = 0; node < CAN_SYNC_MAX_NODES; node++) {
+        g_results[node].valid = false;
+    }
+    __set_PRIMASK(primask);
+
+    uint8_t const data[1] = {g_session};
+    send(CAN_SYNC_ID_POLL, data, sizeof(data), 0u, false);
+    osDelay(CAN_SYNC_COLLECT_MS);
+
+    primask = __get_PRIMASK();
+    __disable_irq();
+    memcpy(results, g_results, sizeof(g_results));
+    __set_PRIMASK(primask);
+    local_result(&results[0]);
+    return 0;
+}
+
+void can_sync_get_status(CanSyncStatus_t *status)
+{
+    memset(status, 0, sizeof(*status));
+    status->role = g_role;
+    status->node = g_node;
+    status->session = g_session;
+    status->lead_ms = g_leadMs;
+    status->started = g_started;
+    status->start_error = g_startError;
+    status->tx_frames = g_txFrames;
+    status->rx_frames = g_rxFrames;
+    status->tx_dropped = g_txDropped;
+    status->markers = g_markers;
+
+    if (g_ready) {
+        FDCAN_ProtocolStatusTypeDef protocol;
+        FDCAN_ErrorCountersTypeDef counters;
+        if (HAL_FDCAN_GetProtocolStatus(&hfdcan1, &protocol) == HAL_OK) {
+            status->bus_off = protocol.BusOff != 0u;
+        }
+        if (HAL_FDCAN_GetErrorCounters(&hfdcan1, &counters) == HAL_OK) {
+            status->tx_error_count = (uint8_t)counters.TxErrorCnt;
+            status->rx_error_count = (uint8_t)counters.RxErrorCnt;
+        }
+    }
+    local_result(&status->local);
+}
@@ -7,6 +7,7 @@
 #include <strings.h>
 
 #include "cmsis_os2.h"
+#include "rtos_static.h"
 #include "stm32h5xx_nucleo.h"
 #include "stm32h5xx_hal.h"
 #include "cli_app.h"
@@ -17,27 +18,37 @@
 #include "command_station.h"
 #include "decoder.h"
 #include "susi.h"
+#include "profiler.h"
+#include "boot.h"
+#ifdef DCC_TESTER_BENCHMARK
+#include "benchmark.h"
+#endif
 
 // Declare _write prototype to avoid implicit declaration error
 int _write(int file, char *ptr, int len);
 
-typedef struct Command {
+#define CLI_LINE_LENGTH 256
+
+typedef struct {
     const char *name;
     void (*execute)(const char *arg1, const char *arg2);
     const char *help; // Optional help text
-    struct Command *next;
+    bool raw;         // arg1 is the rest of the line as typed, arg2 is empty
 } Command;
 
+// Words of the input line, pointing into InputBuffer
 typedef struct {
-    char command[32];
-    char arg1[32];
-    char arg2[32];
+    const char *command;
+    const char *arg1;
+    const char *arg2;
 } ParsedInput;
 
 osMessageQueueId_t commandQueue;
+RTOS_MESSAGE_QUEUE(commandQueue, 5, sizeof(uint32_t));
 
-static char InputBuffer[64];
+static char InputBuffer[CLI_LINE_LENGTH];
 static char OutputBuffer[32];
+static char RpcRequest[CLI_LINE_LENGTH + 32];
 static unsigned int inputIndex = 0;
 static ParsedInput parsed = {0};
 
@@ -59,13 +70,24 @@ void susi_slave_command(const char *arg1, const char *arg2) {
     (void)arg2; // Unused
     if (strcasecmp(arg1,"start") == 0) {
         printf("Start SUSI Slave ...\n");
-        SUSI_Slave_Start();
+        if (!SUSI_Slave_Start()) {
+            printf("SUSI Slave DMA setup failed\n");
+        }
     }
     else if (strcasecmp(arg1,"stop") == 0) {
         printf("Stop SUSI Slave ...\n");
         printf("Stop SUSI Slave ...\n");
         SUSI_Slave_Stop();
     }
+    else if (strcasecmp(arg1,"status") == 0) {
+        SusiSlaveStats_t stats;
+        SUSI_Slave_GetStats(&stats);
+        printf("SUSI Slave %s, frames %lu, bytes %lu, pending %lu/%lu\n",
+               stats.running ? "running" : "stopped", (unsigned long)stats.frames,
+               (unsigned long)stats.bytes, (unsigned long)stats.pending, (unsigned long)stats.capacity);
+        printf("  resyncs %lu, overflows %lu, errors %lu\n",
+               (unsigned long)stats.resyncs, (unsigned long)stats.overflows, (unsigned long)stats.errors);
+    }
     else {
         printf("Unknown SUSI command: %s\n", arg1);
     }
@@ -81,6 +103,16 @@ void susi_master_command(const char *arg1, const char *arg2) {
         printf("Stop SUSI Master ...\n");
         SUSI_Master_Stop();
     }
+    else if (strcasecmp(arg1,"status") == 0) {
+        SusiMasterStats_t stats;
+        SUSI_Master_GetStats(&stats);
+        printf("SUSI Master %s, gap %lu us, byte idle %u, mirror address %u\n",
+               stats.running ? "running" : "stopped", (unsigned long)stats.gap_us,
+               stats.byte_idle, stats.mirror_address);
+        printf("  queued %lu/%lu (high water %lu), sent %lu (mirrored %lu), errors %lu\n",
+               (unsigned long)stats.queued, (unsigned long)stats.capacity, (unsigned long)stats.high_water,
+               (unsigned long)stats.sent, (unsigned long)stats.mirrored, (unsigned long)stats.errors);
+    }
     else {
         printf("Unknown SUSI command: %s\n", arg1);
     }
@@ -97,16 +129,18 @@ void command_station_command(const char *arg1, const char *arg2) {
                 loop = 2;
             } else if (strcasecmp(arg2, "loop3") == 0 || strcasecmp(arg2, "3") == 0) {
                 loop = 3;
+            } else if (strcasecmp(arg2, "refresh") == 0 || strcasecmp(arg2, "4") == 0) {
+                loop = 4;
             } else if (strcasecmp(arg2, "0") == 0) {
                 loop = 0;
             } else {
-                printf("Unknown loop mode: %s (use 0, 1, 2, 3, loop, loop1, loop2, or loop3)\n", arg2);
+                printf("Unknown loop mode: %s (use 0-4, loop, loop1, loop2, loop3 or refresh)\n", arg2);
                 return;
             }
         }
         
         if (CommandStation_Start(loop)) {
-            const char* loop_names[] = {"no loop", "loop1 (basic)", "loop2 (functions)", "loop3 (speed ramp)"};
+            const char* loop_names[] = {"no loop", "loop1 (basic)", "loop2 (functions)", "loop3 (speed ramp)", "refresh"};
             printf("Start Command Station with %s ...\n", loop_names[loop]);
         }
     }
@@ -150,6 +184,31 @@ void rpc_server_command(const char *arg1, const char *arg2) {
     }
 }
 
+// rpc <method> [params JSON] or rpc {request}, run by the RPC server like a USB request
+void rpc_command(const char *arg1, const char *arg2) {
+    (void)arg2; // Unused
+    const char *request = arg1;
+    int length = (int)strlen(arg1);
+    if (arg1[0] == '\0') {
+        printf("Usage: rpc <method> [params JSON] | rpc {request}\n");
+        return;
+    }
+    if (arg1[0] != '{') {
+        int const method = (int)strcspn(arg1, " \t");
+        const char *params = arg1 + method + strspn(arg1 + method, " \t");
+        length = snprintf(RpcRequest, sizeof(RpcRequest), "{\"method\":\"%.*s\",\"params\":%s}",
+                          method, arg1, params[0] ? params : "{}");
+        request = RpcRequest;
+        if (length < 0 || (size_t)length >= sizeof(RpcRequest)) {
+            printf("RPC request too long\n");
+            return;
+        }
+    }
+    if (!RpcServer_Console(request, (uint32_t)length)) {
+        printf("RPC Server not running\n");
+    }
+}
+
 void bidi_command(const char *arg1, const char *arg2) {
     (void)arg2; // Unused
     if (arg1[0]) {
@@ -192,10 +251,119 @@ void hello_command(const char *arg1, const char *arg2) {
     printf("Hello, %s!\n", arg1[0] ? arg1 : "ThreadX User");
 }
 
+static void print_load(const char *name, uint64_t cycles, uint64_t total) {
+    uint32_t permille = profiler_permille(cycles, total);
+    printf("  %-15s %3lu.%lu%%\n", name, (unsigned long)(permille / 10u), (unsigned long)(permille % 10u));
+}
+
 void status_command(const char *arg1, const char *arg2) {
-    printf("System Status: %s %s\n", arg1[0] ? arg1 : "OK", arg2[0] ? arg2 : "");
+    (void)arg2; // Unused
+    static ProfilerSnapshot_t snapshot; // too large for the console stack
+
+    if (strcasecmp(arg1, "reset") == 0) {
+        profiler_reset();
+        printf("Profiler counters reset\n");
+        return;
+    }
+
+    profiler_snapshot(&snapshot);
+    uint32_t cycles_per_us = snapshot.cpu_hz / 1000000u;
+    if (cycles_per_us == 0u) {
+        cycles_per_us = 1u;
+    }
+    printf("System Status: OK, %lu ms profiled\n", (unsigned long)(snapshot.total_cycles / cycles_per_us / 1000u));
+    printf("  %-15s %6s  %-11s %3s %11s\n", "thread", "cpu", "state", "pri", "stack used");
+    for (uint32_t i = 0; i < snapshot.thread_count; i++) {
+        const ProfilerThread_t *thread = &snapshot.threads[i];
+        uint32_t permille = profiler_permille(thread->cycles, snapshot.total_cycles);
+        printf("  %-15s %3lu.%lu%%  %-11s %3u %5lu/%lu\n", thread->name,
+               (unsigned long)(permille / 10u), (unsigned long)(permille % 10u),
+               profiler_thread_state_name(thread->state), thread->priority,
+               (unsigned long)thread->stack_used, (unsigned long)thread->stack_size);
+    }
+    if (snapshot.threads_missing) {
+        printf("  ... %lu more threads\n", (unsigned long)snapshot.threads_missing);
+    }
+    print_load("isr", snapshot.isr_cycles, snapshot.total_cycles);
+    print_load("idle", snapshot.idle_cycles, snapshot.total_cycles);
+    for (uint32_t i = 0; i < PROFILER_ISR_COUNT; i++) {
+        const ProfilerIsrStats_t *isr = &snapshot.isr[i];
+        uint32_t permille = profiler_permille(isr->cycles, snapshot.total_cycles);
+        printf("  %-15s %3lu.%lu%%  %lu calls, max %lu us\n", profiler_isr_name((ProfilerIsr_t)i),
+               (unsigned long)(permille / 10u), (unsigned long)(permille % 10u),
+               (unsigned long)isr->count, (unsigned long)(isr->max_cycles / cycles_per_us));
+    }
+}
+
+void boot_command(const char *arg1, const char *arg2) {
+    (void)arg1; // Unused
+    (void)arg2; // Unused
+    static BootProfile_t profile; // too large for the console stack
+
+    boot_get_profile(&profile);
+    printf("Boot profile (%s init)\n", profile.lazy ? "lazy" : "eager");
+    for (uint32_t i = 0; i < profile.step_count; i++) {
+        printf("  %-16s %8lu us  at %8lu us\n", profile.steps[i].name,
+               (unsigned long)profile.steps[i].us, (unsigned long)profile.steps[i].end_us);
+    }
+    for (uint32_t i = 0; i < BOOT_EVENT_COUNT; i++) {
+        if (profile.event_ms[i]) {
+            printf("  %-16s at %lu ms\n", boot_event_name((BootEvent_t)i), (unsigned long)profile.event_ms[i]);
+        }
+        else {
+            printf("  %-16s not yet\n", boot_event_name((BootEvent_t)i));
+        }
+    }
+    for (uint32_t i = 0; i < BOOT_SUBSYSTEM_COUNT; i++) {
+        const BootSubsystemState_t *state = &profile.subsystems[i];
+        if (state->ready) {
+            printf("  %-16s %8lu us  at %lu ms\n", boot_subsystem_name((BootSubsystem_t)i),
+                   (unsigned long)state->init_us, (unsigned long)state->at_ms);
+        }
+        else {
+            printf("  %-16s not initialised\n", boot_subsystem_name((BootSubsystem_t)i));
+        }
+    }
 }
 
+#ifdef DCC_TESTER_BENCHMARK
+#define BENCH_TIMEOUT_MS 60000u
+
+void bench_command(const char *arg1, const char *arg2) {
+    uint32_t iterations = BENCHMARK_DEFAULT_ITERATIONS;
+    bool flash = false;
+
+    if (strcasecmp(arg1, "show") == 0) {
+        Benchmark_Print();
+        return;
+    }
+    if (strcasecmp(arg1, "flash") == 0) {
+        flash = true;
+    }
+    else if (arg1[0] != '\0') {
+        iterations = strtoul(arg1, NULL, 10);
+        flash = strcasecmp(arg2, "flash") == 0;
+    }
+
+    if (!Benchmark_Request(iterations, flash)) {
+        printf("Benchmark not started (iterations 1-%u, or a run is in progress)\n", BENCHMARK_MAX_ITERATIONS);
+        return;
+    }
+    // The RPC thread runs the suite between requests
+    printf("Benchmark running, %lu iterations%s\n", (unsigned long)iterations, flash ? " with flash" : "");
+    uint32_t waited = 0;
+    while (Benchmark_Busy() && waited < BENCH_TIMEOUT_MS) {
+        osDelay(50u);
+        waited += 50u;
+    }
+    if (Benchmark_Busy()) {
+        printf("Benchmark still pending (is the RPC server running?), see bench show\n");
+        return;
+    }
+    Benchmark_Print();
+}
+#endif
+
 void reboot_command(const char *arg1, const char *arg2) {
     (void)arg1; // Unused
     (void)arg2; // Unused
@@ -226,104 +394,83 @@ void date_time_command(const char *arg1, const char *arg2) {
            sTime.Hours, sTime.Minutes, sTime.Seconds);
 }
 
-// Statically Register commands in a linked list!
-Command cmd_help = {
-    .name = "help", 
-    .execute = help_command,
-    .help = NULL, 
-    .next = NULL
+// Sorted by name (strcmp order) for the binary search in find_command(), checked at start up
+static const Command kCommands[] = {
+#ifdef DCC_TESTER_BENCHMARK
+    { "bench", bench_command, "Cycle counts of the hot paths: bench [iterations] [flash] | bench show", false },
+#endif
+    { "bidi", bidi_command, "BiDi Threshold: bidi <value>", false },
+    { "boot", boot_command, "Boot step times and subsystem initialisation", false },
+    { "cms", command_station_command, "Command Station: cms <start|stop> [0|1|2|3|4|loop|loop1|loop2|loop3|refresh]", false },
+    { "date_time", date_time_command, "Get current date and time", false },
+    { "dec", decoder_command, "Decoder: dec <start|stop>", false },
+    { "hello", hello_command, NULL, false },
+    { "help", help_command, NULL, false },
+    { "reboot", reboot_command, "Reboot system", false },
+    { "reset", reset_command, "Factory reset", false },
+    { "rpc", rpc_command, "Any RPC method: rpc <method> [params JSON] | rpc {request}", true },
+    { "rpc_server", rpc_server_command, "RPC Server: rpc_server <start|stop>", false },
+    { "status", status_command, "Thread load, stacks and interrupt time: status [reset]", false },
+    { "susi_master", susi_master_command, "SUSI Master start/stop/status", false },
+    { "susi_slave", susi_slave_command, "SUSI Slave start/stop/status", false },
+    { "trigger", trigger_command, "Trigger First Packet Bit: trigger <on|off|1|0>", false },
 };
-Command cmd_bidi = {
-    .name = "bidi", 
-    .execute = bidi_command,
-    .help = "BiDi Threshold: bidi <value>",
-    .next = &cmd_help
 
-};
-Command cmd_trigger = {
-    .name = "trigger",
-    .execute = trigger_command,
-    .help = "Trigger First Packet Bit: trigger <on|off|1|0>",
-    .next = &cmd_bidi
-};
-Command cmd_rpcs = {
-    .name = "rpc_server", 
-    .execute = rpc_server_command,
-    .help = "RPC Server: rpc_server <start|stop>",
-    .next = &cmd_trigger
-};
-Command cmd_cms = {
-    .name = "cms", 
-    .execute = command_station_command,
-    .help = "Command Station: cms <start|stop> [0|1|2|3|loop|loop1|loop2|loop3]",
-    .next = &cmd_rpcs
-};
-Command cmd_dec = {
-    .name = "dec", 
-    .execute = decoder_command,
-    .help = "Decoder: dec <start|stop>",
-    .next = &cmd_cms
-};
-Command cmd_susi_slave = {
-    .name = "susi_slave", 
-    .execute = susi_slave_command,
-    .help = "SUSI Slave start/stop",
-    .next = &cmd_dec
-};
-Command cmd_susi_master = {
-    .name = "susi_master", 
-    .execute = susi_master_command,
-    .help = "SUSI Master start/stop",
-    .next = &cmd_susi_slave
-};
-Command cmd_hello = {
-    .name ="hello", 
-    .execute = hello_command,
-    .help = NULL,
-    .next = &cmd_susi_master
-};
-Command cmd_status = {
-    .name = "status",
-    .execute = status_command,
-    .help = NULL,
-    .next = &cmd_hello
-};
-Command cmd_date_time = {
-    .name = "date_time",
-    .execute = date_time_command,
-    .help = "Get current date and time",
-    .next = &cmd_status
-};
-Command cmd_reboot = {
-    .name = "reboot",
-    .execute = reboot_command,
-    .help = "Reboot system",
-    .next = &cmd_date_time
-};
-Command cmd_reset = {
-    .name = "reset",
-    .execute = reset_command,
-    .help = "Factory reset",
-    .next = &cmd_reboot
-};
-
-Command *command_list = &cmd_reset;
+#define COMMAND_COUNT (sizeof(kCommands) / sizeof(kCommands[0]))
 
 static void print_help(void) {
-    Command *current = command_list;
     printf("Available commands:\n");
-    while (current != NULL) {
-        printf("  %s\n", current->name);
-        if (current->help) {
-            printf("    %s\n", current->help);
+    for (size_t i = 0; i < COMMAND_COUNT; i++) {
+        printf("  %s\n", kCommands[i].name);
+        if (kCommands[i].help) {
+            printf("    %s\n", kCommands[i].help);
         }
-        current = current->next;
     }
     printf("Type 'help' for this message.\n");
 }
 
-static void parse_input(const char *input, ParsedInput *out_parsed) {
-    sscanf(input, "%s %31s %31s", out_parsed->command, out_parsed->arg1, out_parsed->arg2);
+static int compare_command(const void *key, const void *entry) {
+    return strcmp((const char *)key, ((const Command *)entry)->name);
+}
+
+static const Command *find_command(const char *name) {
+    return bsearch(name, kCommands, COMMAND_COUNT, sizeof(kCommands[0]), compare_command);
+}
+
+// Next blank separated word, terminated in place
+static char *next_word(char **cursor) {
+    char *p = *cursor + strspn(*cursor, " \t");
+    if (*p == '\0') {
+        *cursor = p;
+        return NULL;
+    }
+    char *const word = p;
+    p += strcspn(p, " \t");
+    if (*p != '\0') {
+        *p++ = '\0';
+    }
+    *cursor = p;
+    return word;
+}
+
+// Splits the line where it is instead of copying words, missing arguments are ""
+static const Command *parse_input(char *input, ParsedInput *out_parsed) {
+    char *cursor = input;
+    const char *word = next_word(&cursor);
+    out_parsed->command = word ? word : "";
+    out_parsed->arg1 = "";
+    out_parsed->arg2 = "";
+
+    const Command *const command = word ? find_command(word) : NULL;
+    if (command != NULL && command->raw) {
+        out_parsed->arg1 = cursor + strspn(cursor, " \t");
+    } else if (command != NULL) {
+        word = next_word(&cursor);
+        out_parsed->arg1 = word ? word : "";
+        word = next_word(&cursor);
+        out_parsed->arg2 = word ? word : "";
+    }
+    return command;
 }
 
 void vCommandConsoleTask(void *pvParameters)
@@ -331,7 +478,11 @@ void vCommandConsoleTask(void *pvParameters)
     (void)(pvParameters);
     uint32_t receivedChar;  // used to store the received value from the notification
     char N_char = '\n';
-    commandQueue = osMessageQueueNew(5, sizeof(uint32_t), NULL);
+    commandQueue = osMessageQueueNew(5, sizeof(uint32_t), &commandQueue_attr);
+
+    for (size_t i = 1; i < COMMAND_COUNT; i++) {
+        assert(strcmp(kCommands[i - 1].name, kCommands[i].name) < 0);
+    }
 
     osDelay(2000); // Wait for system to initialize
     
@@ -362,19 +513,11 @@ void vCommandConsoleTask(void *pvParameters)
                 _write(0, &N_char, 1); // Echo the character to the console
                 // Here you can add code to parse and execute the command
 
-                parse_input(InputBuffer, &parsed);
-    
-                Command *current = command_list;
-                bool command_found = false;
-                while (current != NULL) {
-                    if (strcmp(parsed.command, current->name) == 0) {
-                        current->execute(parsed.arg1, parsed.arg2);
-                        command_found = true;
-                        break;
-                    }
-                    current = current->next;
+                const Command *command = parse_input(InputBuffer, &parsed);
+                if (command != NULL) {
+                    command->execute(parsed.arg1, parsed.arg2);
                 }
-                if (!command_found) {
+                else {
 //                    printf("Unknown command: %s\n", parsed.command);
                 }
                 memset(InputBuffer, 0, sizeof(InputBuffer)); // Clear the input buffer
@@ -1,127 +1,2199 @@
 #include "command_station.hpp"
+#include "command_station.h"
+#include <atomic>
 #include <cstdint>
 #include <cstdio>
 #include <dcc/speed.hpp>
 #include "cmsis_os2.h"
+#include "rtos_static.h"
 #include "main.h"
+#include "dma_channels.h"
 #include "parameter_manager.h"
 #include "analog_manager.h"
+#include "track_guard.h"
 #include "stm32h5xx_hal_gpio.h"
 #include "stm32h5xx_hal_uart.h"
 #include "stm32h5xx_nucleo.h"
+#include "spsc_ring.hpp"
+#include "packet_program.h"
+#include "packet_suite.h"
+#include "packet_fuzzer.h"
+#include "accessory_sequence.h"
+#include "test_case.h"
+#include "margin_sweep.h"
+#include "packet_vm.h"
+#include "service_mode.h"
+#include "railcom.h"
+#include "timing_profiles.hpp"
+#include "trace_log.h"
+#include "profiler.h"
+#include "edge_timing.h"
+#include "refresh_scheduler.h"
+#include "fast_ram.h"
+#include "power_idle.h"
+#include <cstring>
 
 
 #define RX_BIDIR_MAX_SIZE 16 // Maximum size of the BiDi receive buffer
 
 static osThreadId_t commandStationThread_id;
 static osSemaphoreId_t commandStationStart_sem;
+static osSemaphoreId_t commandStationStopped_sem;  // released by the thread once stopped and cleaned up
+static osEventFlagsId_t commandStationEvents;
+RTOS_SEMAPHORE(commandStationStart_sem);
+RTOS_SEMAPHORE(commandStationStopped_sem);
+RTOS_EVENT_FLAGS(commandStationEvents);
 static bool commandStationRunning = false;
-static uint8_t commandStationLoop = 0;  // 0=no loop, 1=loop1, 2=loop2, 3=loop3
-static uint64_t bitCountMask = 0;
+static uint8_t commandStationLoop = 0;  // 0=no loop, 1=loop1, 2=loop2, 3=loop3, 4=refresh
 
 static uint16_t dac_value = 0;
-static uint8_t trigger_first_bit = false;
 static uint64_t zerobitOverrideMask = 0;
 static int32_t zerobitDeltaP = 0;
 static int32_t zerobitDeltaN = 0;
-static bool currentPhaseIsP = true;  // Track current phase (P or N)
+
+// Zero bit override of library packets as a table of deltas [bit position][0=P, 1=N], rebuilt
+// whenever the override changes. The bit position saturates on the last row, which stays zero,
+// so bits past the 64-bit mask (and the preamble before the first packet) are not adjusted.
+// Double buffered like the configured timing: the spare table is rebuilt and zerobitTablePending
+// set, the transmit path swaps at the start bit of the next packet, so no packet goes out with
+// a mix of old and new deltas.
+static constexpr uint32_t ZEROBIT_TABLE_BITS = 64u;
+static int32_t zerobitDeltaTable[2][ZEROBIT_TABLE_BITS + 1u][2] FAST_RAM_DATA;
+static std::atomic<bool> zerobitTablePending{false};
+
+// DMA transmit mode
+// The half-bit stream produced by command_station.transmit() is pre-rendered into
+// double-buffered tables which TIM2 streams out by DMA on its own:
+//   TIM2 update -> ARR    (duration of the half-bit that just started)
+//   TIM2 CC3    -> GPIOE  BSRR (TR_P/TR_N and SCOPE)
+//   TIM2 CC4    -> GPIOA  BSRR (TRACK_P)
+// The only interrupts left are the half/complete transfer events of the ARR channel,
+// each of which refills the half of the tables that has just been sent.
+static constexpr uint32_t DMA_TX_HALF_SIZE = 64u;  // half-bits rendered per refill
+static constexpr uint32_t DMA_TX_SIZE = 2u * DMA_TX_HALF_SIZE;
+static constexpr uint32_t DMA_TX_CC_DELAY = 1u;    // CC3/CC4 fire 1 tick after the update event
+
+struct DmaTxTables {
+  uint32_t arr[DMA_TX_SIZE];
+  uint32_t tr_bsrr[DMA_TX_SIZE];
+  uint32_t track_bsrr[DMA_TX_SIZE];
+};
+
+alignas(32) static DmaTxTables dmaTxTables;
+static DMA_HandleTypeDef hdmaTxArr;
+static DMA_HandleTypeDef hdmaTxTr;
+static DMA_HandleTypeDef hdmaTxTrack;
+static DMA_QListTypeDef dmaTxArrQueue;
+static DMA_QListTypeDef dmaTxTrQueue;
+static DMA_QListTypeDef dmaTxTrackQueue;
+static DMA_NodeTypeDef dmaTxArrNode;
+static DMA_NodeTypeDef dmaTxTrNode;
+static DMA_NodeTypeDef dmaTxTrackNode;
+static bool dmaTransmitActive = false;   // current run uses the DMA path
 
 // Custom packet queue
-static constexpr uint8_t CUSTOM_PACKET_QUEUE_MAX = 3;
-static dcc::Packet customPacketQueue[CUSTOM_PACKET_QUEUE_MAX];
-static uint8_t customPacketQueueCount = 0;
-static bool customPacketTrigger = false;
+// Single producer (RPC thread: load/trigger) / single consumer (command station thread)
+struct CustomPacket {
+  dcc::Packet packet;
+  uint32_t gap_us;        // scheduled mode gap before this packet, CUSTOM_PACKET_GAP_DEFAULT = trigger gap
+  uint8_t flags;          // scheduled mode only, PACKET_PROGRAM_FLAG_*
+  PacketTiming_t timing;  // with PACKET_PROGRAM_FLAG_OVERRIDE, replaces the global override
+};
+
+static SpscRing<CustomPacket, CUSTOM_PACKET_QUEUE_SIZE> customPacketQueue;
+static std::atomic<bool> customPacketTrigger{false};  // set by producer, cleared by consumer when drained
+static std::atomic<bool> customPacketCancel{false};   // replace: consumer drops the queue and ends the transmission
+static std::atomic<bool> customPacketStream{false};   // keep draining packets as they arrive
+static std::atomic<bool> customPacketScheduled{false}; // gaps timed by the transmit path instead of osDelay
 static uint32_t customInterPacketDelay = 100;
+static uint32_t customInterPacketGapUs = 0;
+static uint32_t customPacketsTransmitted = 0;
+static uint32_t customPacketUnderruns = 0;
+
+// Scheduled packet transmission
+// Scheduled packets bypass the library encoder. Once the library is known to be inside a
+// preamble (ten consecutive one bits, more than any packet body can hold) the transmit path
+// takes over at the next bit boundary, stretches the preamble until the requested gap has
+// elapsed and encodes the packet itself. After the last packet a full preamble is sent and
+// the library continues with the remainder of its own preamble, so the stream stays valid.
+// Gaps are measured from the end of the previous end bit to the start of the packet start
+// bit and are accurate to one bit time. Scheduled packets have no BiDi cutout.
+//
+// The thread expands each packet into a timing class per bit and a half-bit duration table
+// [class][0=P, 1=N] built from its timing profile and override, so the transmit path only
+// looks up the duration of every half-bit. Fault rules which change half-bits (stretch, drop)
+// get classes of their own: the rules covering a bit select one of 16 variants of its base
+// class. A dropped half keeps the level of the half before it (TX_HALF_HOLD) for one tick.
+enum class TxSchedState : uint8_t { Idle, Gap, Packet };
+
+static constexpr uint32_t TX_SCHED_TAKEOVER_HALF_BITS = 20u;  // ten one bits
+static constexpr uint8_t TX_CLASS_ONE = 0u;
+static constexpr uint8_t TX_CLASS_ZERO = 1u;
+static constexpr uint8_t TX_CLASS_OVERRIDE = 2u;  // or'ed with one/zero
+static constexpr uint32_t TX_CLASS_BASE = 4u;
+static constexpr uint32_t TX_CLASS_FAULT_SHIFT = 2u;  // bit n of the class above: fault rule n applies
+static constexpr uint32_t TX_CLASS_COUNT = TX_CLASS_BASE << PACKET_TIMING_MAX_FAULTS;
+static constexpr uint16_t TX_HALF_DURATION = PACKET_TIMING_MAX_HALF_US;
+static constexpr uint16_t TX_HALF_HOLD = 0x8000u;     // no edge, the previous level continues
+
+struct ScheduledPacket {
+  uint16_t half[TX_CLASS_COUNT][2];            // half-bit durations per class, TX_HALF_HOLD or'ed in
+  uint8_t bit_class[PACKET_TIMING_MAX_BITS];   // start bit, bytes MSB first with separators
+  uint16_t bits;
+  uint8_t flags;                               // PACKET_PROGRAM_FLAG_*
+  uint8_t num_preamble;                        // minimum preamble bits before the start bit
+  uint32_t preamble;                           // preamble positions sent with the override class
+  uint32_t gap_us;
+};
+
+static SpscRing<ScheduledPacket, SCHEDULED_PACKET_QUEUE_SIZE> scheduledPacketQueue;  // thread -> transmit path
+
+// Encoded packet cache
+// Test vectors send the same packets over and over, the expansion into timing classes is kept
+// for the last packets seen, direct mapped by a hash of everything it depends on. The
+// configured durations change when the command station starts or the timing is updated,
+// either clears it. Command station thread only.
+static_assert((PACKET_CACHE_ENTRIES & (PACKET_CACHE_ENTRIES - 1u)) == 0u, "PACKET_CACHE_ENTRIES must be a power of two");
+
+struct PacketCacheKey {
+  uint8_t length;
+  uint8_t bytes[PACKET_TIMING_MAX_BYTES];
+  uint8_t flags;
+  PacketTiming_t timing;
+};
+
+struct PacketCacheEntry {
+  bool valid;
+  PacketCacheKey key;
+  ScheduledPacket encoded;  // gap_us unused
+};
+
+static PacketCacheEntry packetCache[PACKET_CACHE_ENTRIES];
+static uint32_t packetCacheHits = 0;
+static uint32_t packetCacheMisses = 0;
+static uint32_t packetCacheGeneration = 0;  // txTimingGeneration the entries were encoded with
+
+// Configured timing, double buffered so it can change while running. The caller fills the spare
+// copy and sets txTimingPending, the transmit path swaps at the next packet boundary (a bit
+// boundary inside a preamble) and bumps txTimingGeneration. The library keeps the durations and
+// preamble it was started with: its half-bits are sent with the active durations instead, a
+// longer preamble is made up by one bits inserted into the library preamble.
+struct TxTiming {
+  uint16_t half[TX_CLASS_BASE][2];  // preamble with no packet due, base of the configured profile
+  uint8_t num_preamble;
+  uint8_t preamble_extra;           // one bits inserted into every library preamble
+  uint8_t bit1_duration;
+  uint8_t bit0_duration;
+};
+
+static TxTiming txTiming[2] FAST_RAM_DATA;
+static std::atomic<bool> txTimingPending{false};
+static std::atomic<uint32_t> txTimingGeneration{0};
+static uint8_t txLibPreamble = 0;
+
+// TIM2 handler state, everything the transmit path reads or writes for every half-bit
+struct TxIsrState {
+  // Library packets
+  bool currentPhaseIsP = true;          // Track current phase (P or N)
+  uint8_t trigger_first_bit = false;
+  uint8_t zerobitBitIndex = ZEROBIT_TABLE_BITS;  // 0 = packet start bit
+  int32_t const (*zerobitTable)[2] = zerobitDeltaTable[0];  // deltas of the packet being sent
+  uint8_t txLibBit1 = 0;                // as the library was started
+  uint8_t txLibBit0 = 0;
+  bool txPreambleExtended = false;      // current library preamble needs no more one bits
+  // DMA rendering
+  bool dmaRendering = false;            // trackOutputs() captures instead of driving the pins
+  uint32_t renderTrBsrr = 0;
+  uint32_t renderTrackBsrr = 0;
+  // Scheduled packets
+  TxSchedState txSchedState = TxSchedState::Idle;
+  uint8_t txSchedClass = TX_CLASS_ONE;
+  bool txSchedSecondHalf = false;
+  bool txSchedFirstBit = false;
+  bool txSchedBiDiCutout = false;
+  bool txSchedTrigger = false;          // scope trigger requested by the packet being sent
+  uint32_t txSchedOneRun = 0;           // consecutive one half-bits seen from the library
+  uint32_t txSchedElapsed = 0;          // us since the end of the previous packet
+  uint32_t txSchedPreambleBits = 0;     // one bits sent since the end of the previous packet
+  uint32_t txSchedBitIndex = 0;         // 0 = packet start bit
+  uint16_t const (*txSchedHalf)[2] = txTiming[0].half;  // table of the bit being sent
+  TxTiming const* volatile txTimingActive = &txTiming[0];
+  // Packets started since the command station started, tags RailCom frames
+  uint32_t txPacketSeq = 0;
+  bool volatile txPacketHooked = false;  // any hook installed, the framer runs
+  // Scope trigger
+  bool txStartBit = false;              // the half-bit just output starts a packet start bit
+  uint8_t volatile scopeCondition = SCOPE_TRIGGER_OFF;
+  bool volatile scopeFire = false;      // fired by the framer or a cutout, raised at the next bit start
+  uint16_t scopeHalfBits = 0;           // half-bits the pin stays high
+};
+
+static TxIsrState txIsr FAST_RAM_DATA;
+
+// Transmit path variants. Each feature a run may use is a template parameter of the half-bit
+// handler, the variant is picked when the command station starts and only ever widened while it
+// runs, when a feature is switched on, so the handler of a plain run has no branch for any.
+enum TxVariant : uint32_t {
+  TX_VARIANT_BIDI = 1u << 0,      // library RailCom cutouts
+  TX_VARIANT_SCOPE = 1u << 1,     // scope trigger output
+  TX_VARIANT_OVERRIDE = 1u << 2,  // zero bit override of library packets
+  TX_VARIANT_ALL = TX_VARIANT_BIDI | TX_VARIANT_SCOPE | TX_VARIANT_OVERRIDE,
+  TX_VARIANT_COUNT
+};
+static void txVariantAdd(uint32_t features);
+
+// Scope trigger condition, only written while txIsr.scopeCondition is off
+static ScopeTrigger_t scopeTrigger = {};
+static uint32_t volatile scopeFired = 0;
+static uint32_t volatile scopeLastSeq = 0;
+static const char* const kScopeTriggerNames[SCOPE_TRIGGER_COUNT] = {
+  "off", "packet_seq", "match", "override_bit", "railcom_error"
+};
+
+// Packet program execution (command station thread)
+static std::atomic<bool> programRunRequest{false};
+static std::atomic<bool> programStopRequest{false};
+static std::atomic<bool> programRunning{false};
+static uint16_t programPc = 0;
+static uint32_t programPacketsSent = 0;
+static uint16_t programLoopRemaining[PACKET_PROGRAM_MAX_ENTRIES];
+// A packet suite, fuzzer or test list run shares the program flags and stop
+static std::atomic<bool> suiteRunRequest{false};
+static uint8_t suiteProfile = PACKET_TIMING_PROFILE_CONFIGURED;
+static uint32_t suiteLoops = 1;
+static std::atomic<bool> fuzzRunRequest{false};
+static std::atomic<bool> accessoryRunRequest{false};
+static std::atomic<bool> testRunRequest{false};
+static std::atomic<bool> marginRunRequest{false};
+static std::atomic<bool> vmRunRequest{false};
+// Packets of the running VM program, PATCH changes this copy
+static PacketVmPacket_t vmPackets[PACKET_VM_MAX_PACKETS];
+
+// Transmitted packet framer for the packet hook, fed with the bits as they are sent
+static CommandStationPacketHook volatile txPacketHooks[COMMAND_STATION_HOOK_COUNT] = {};
+static struct {
+  uint8_t ones;       // preamble bits seen
+  uint8_t bits;       // bits of the current byte, 8 = separator due
+  uint8_t count;
+  bool inPacket;
+  uint8_t bytes[PACKET_TIMING_MAX_BYTES];
+} txLog;
+
+// Service mode operation (requested by CommandStation_ServiceMode, run by the command station thread)
+static std::atomic<bool> serviceRequestPending{false};
+static std::atomic<bool> serviceBusy{false};
+static osSemaphoreId_t serviceDone_sem;
+RTOS_SEMAPHORE(serviceDone_sem);
+static ServiceModeRequest_t serviceRequest;
+static ServiceModeResult_t serviceResult;
+
+// Command station thread event flags
+#define CS_EVENT_TRIGGER  (1u << 0)  // custom packet transmission triggered
+#define CS_EVENT_PACKET   (1u << 1)  // custom packet loaded
+#define CS_EVENT_STOP     (1u << 2)  // stop requested
+#define CS_EVENT_PROGRAM  (1u << 3)  // packet program run requested
+#define CS_EVENT_SERVICE  (1u << 4)  // service mode operation requested
+#define CS_EVENT_CANCEL   (1u << 5)  // custom packet transmission cancelled by a replace
+#define CS_EVENT_ALL      (CS_EVENT_TRIGGER | CS_EVENT_PACKET | CS_EVENT_STOP | CS_EVENT_PROGRAM | CS_EVENT_SERVICE | \
+                           CS_EVENT_CANCEL)
+
+// Every wait of the thread ends within a tick of a stop, the timeout only guards against a hang
+#define CS_STOP_TIMEOUT_MS 1000u
+// A timing update is taken in the next preamble, the longest packet with a scheduled gap is far below
+#define CS_TIMING_UPDATE_TIMEOUT_MS 100u
+// A cancelled transmission ends at its next wait, the packet being handed over is the longest part
+#define CS_CANCEL_TIMEOUT_MS 100u
+
+/* Definitions for cmdStationTask */
+RTOS_THREAD_MEMORY(cmdStationTask, 8192);
+const osThreadAttr_t cmdStationTask_attributes = {
+  .name = "cmdStationTask",
+  RTOS_THREAD_ATTR_MEMORY(cmdStationTask),
+  .priority = (osPriority_t) osPriorityHigh
+};
+
+
+void CommandStation::trackOutputs(bool N, bool P, bool first_bit) 
+{ 
+  uint32_t const tr_bsrr = (static_cast<uint32_t>(!N) << TR_N_BR_Pos) | (static_cast<uint32_t>(!P) << TR_P_BR_Pos) |
+                           (static_cast<uint32_t>(N) << TR_N_BS_Pos) | (static_cast<uint32_t>(P) << TR_P_BS_Pos);
+  uint32_t const track_bsrr = (static_cast<uint32_t>(!P) << TRACK_P_BR_Pos) |
+                              (static_cast<uint32_t>(P) << TRACK_P_BS_Pos);
+
+  if (txIsr.dmaRendering) {
+    txIsr.renderTrBsrr = tr_bsrr;
+    txIsr.renderTrackBsrr = track_bsrr;
+  }
+  else {
+    TR_P_GPIO_Port->BSRR = tr_bsrr;
+    TRACK_P_GPIO_Port->BSRR = track_bsrr;
+    edge_timing_output(P);
+  }
+  
+  // Track which phase we're in for delta adjustment
+  txIsr.currentPhaseIsP = P;
+  txIsr.txStartBit = P && first_bit;
+  
+  if (P)
+  {
+    if (first_bit)
+    {
+      if (zerobitTablePending.load(std::memory_order_acquire)) {
+        txIsr.zerobitTable = txIsr.zerobitTable == zerobitDeltaTable[0] ? zerobitDeltaTable[1] : zerobitDeltaTable[0];
+        zerobitTablePending.store(false, std::memory_order_release);
+      }
+      txIsr.zerobitBitIndex = 0;
+      txIsr.txPacketSeq++;
+    }
+    else if (txIsr.zerobitBitIndex < ZEROBIT_TABLE_BITS)
+      txIsr.zerobitBitIndex++;
+  }
+}
+
+void CommandStation::biDiStart() {
+  txIsr.txSchedBiDiCutout = true;
+  HAL_GPIO_WritePin(BR_ENABLE_GPIO_Port, BR_ENABLE_Pin, static_cast<GPIO_PinState>(GPIO_PIN_RESET));   // Set BR_ENABLE low
+  HAL_GPIO_WritePin(BIDIR_EN_GPIO_Port, BIDIR_EN_Pin, static_cast<GPIO_PinState>(GPIO_PIN_SET));   // Set BiDi high
+  railcom_cutout_start();
+}
+
+void CommandStation::biDiChannel1() {}
+
+void CommandStation::biDiChannel2() {
+  railcom_channel2_start();
+}
+
+void CommandStation::biDiEnd() {
+  railcom_cutout_end(txIsr.txPacketSeq);
+  if (txIsr.scopeCondition == SCOPE_TRIGGER_RAILCOM_ERROR &&
+      railcom_last_cutout(nullptr, nullptr) == RAILCOM_RESULT_INVALID) {
+    txIsr.scopeFire = true;
+  }
+  txIsr.txSchedBiDiCutout = false;
+  txIsr.txSchedOneRun = 0;
+  HAL_GPIO_WritePin(BIDIR_EN_GPIO_Port, BIDIR_EN_Pin, static_cast<GPIO_PinState>(GPIO_PIN_RESET)); // Set BiDi low
+  if (!track_guard_tripped()) {
+    HAL_GPIO_WritePin(BR_ENABLE_GPIO_Port, BR_ENABLE_Pin, static_cast<GPIO_PinState>(GPIO_PIN_SET));   // Set BR_ENABLE high
+  }
+}
+
+CommandStation command_station FAST_RAM_DATA;
+
+// Apply the RAM-only zero bit override to the half-bit that just started
+static inline uint32_t applyZerobitOverride(uint32_t arr)
+{
+  if (arr >= DCC_TX_MIN_BIT_0_TIMING) {  // only adjust Zero bits
+    arr += txIsr.zerobitTable[txIsr.zerobitBitIndex][txIsr.currentPhaseIsP ? 0u : 1u];
+  }
+  return arr;
+}
+
+// One caller at a time (RPC thread, or CommandStation_Start before the transmit path runs).
+// Withdrawing a pending update first keeps the transmit path off the spare table while it is
+// rebuilt, the rebuilt one carries the latest values anyway. Stopped, the table takes effect
+// at once, running it is taken at the next packet start bit, waited for like a timing update.
+static void rebuildZerobitTable(void)
+{
+  zerobitTablePending.store(false, std::memory_order_release);
+  int32_t (*spare)[2] = txIsr.zerobitTable == zerobitDeltaTable[0] ? zerobitDeltaTable[1] : zerobitDeltaTable[0];
+  for (uint32_t i = 0; i < ZEROBIT_TABLE_BITS; i++) {
+    bool const set = ((zerobitOverrideMask >> i) & 1u) != 0u;
+    spare[i][0] = set ? zerobitDeltaP : 0;
+    spare[i][1] = set ? zerobitDeltaN : 0;
+  }
+  spare[ZEROBIT_TABLE_BITS][0] = 0;
+  spare[ZEROBIT_TABLE_BITS][1] = 0;
+  if (zerobitOverrideMask != 0u && (zerobitDeltaP != 0 || zerobitDeltaN != 0)) {
+    txVariantAdd(TX_VARIANT_OVERRIDE);
+  }
+  if (!commandStationRunning) {
+    txIsr.zerobitTable = spare;
+    return;
+  }
+  zerobitTablePending.store(true, std::memory_order_release);
+
+  // Packets loaded after the return are sent with the new deltas
+  uint32_t const start = osKernelGetTickCount();
+  while (zerobitTablePending.load(std::memory_order_acquire) && commandStationRunning &&
+         osKernelGetTickCount() - start < CS_TIMING_UPDATE_TIMEOUT_MS) {
+    osDelay(1u);
+  }
+}
+
+static void txTimingFill(TxTiming& timing, uint8_t preamble_bits, uint8_t bit1_duration, uint8_t bit0_duration)
+{
+  for (uint32_t c = 0; c < TX_CLASS_BASE; c++) {
+    uint16_t const duration = (c & TX_CLASS_ZERO) ? bit0_duration : bit1_duration;
+    timing.half[c][0] = duration;
+    timing.half[c][1] = duration;
+  }
+  timing.num_preamble = preamble_bits;
+  timing.preamble_extra = preamble_bits > txLibPreamble ? static_cast<uint8_t>(preamble_bits - txLibPreamble) : 0u;
+  timing.bit1_duration = bit1_duration;
+  timing.bit0_duration = bit0_duration;
+}
+
+// The library is (re)initialised with the configured timing, no update pending
+static void txTimingStart(uint8_t preamble_bits, uint8_t bit1_duration, uint8_t bit0_duration)
+{
+  txLibPreamble = preamble_bits;
+  txIsr.txLibBit1 = bit1_duration;
+  txIsr.txLibBit0 = bit0_duration;
+  txTimingFill(txTiming[0], preamble_bits, bit1_duration, bit0_duration);
+  txIsr.txTimingActive = &txTiming[0];
+  txTimingPending.store(false, std::memory_order_release);
+  txTimingGeneration.fetch_add(1u, std::memory_order_release);
+  txIsr.txPreambleExtended = false;
+  txIsr.txSchedHalf = txTiming[0].half;
+}
+
+// Transmit path, between two packets: take a pending timing update
+static inline void txTimingSwap(void)
+{
+  if (txTimingPending.load(std::memory_order_acquire)) {
+    txIsr.txTimingActive = txIsr.txTimingActive == &txTiming[0] ? &txTiming[1] : &txTiming[0];
+    txTimingGeneration.fetch_add(1u, std::memory_order_release);
+    txTimingPending.store(false, std::memory_order_release);
+  }
+}
+
+// Decide the timing class of the next scheduled bit, may hand the stream back to the library
+static void txSchedStartBit(void)
+{
+  if (txIsr.txSchedState == TxSchedState::Packet) {
+    ScheduledPacket const* entry = scheduledPacketQueue.front();
+    if (++txIsr.txSchedBitIndex < entry->bits) {
+      txIsr.txSchedClass = entry->bit_class[txIsr.txSchedBitIndex];
+      return;
+    }
+    txIsr.txSchedTrigger = false;
+    scheduledPacketQueue.pop();
+    txIsr.txSchedState = TxSchedState::Gap;
+    txIsr.txSchedElapsed = 0;
+    txIsr.txSchedPreambleBits = 0;
+    txTimingSwap();
+  }
+
+  // Gap: preamble until the next packet is due, or a full preamble before handing back
+  ScheduledPacket const* entry = scheduledPacketQueue.front();
+  uint32_t const num_preamble = entry ? entry->num_preamble : txIsr.txTimingActive->num_preamble;
+  uint32_t remaining = txIsr.txSchedPreambleBits < num_preamble ? num_preamble - txIsr.txSchedPreambleBits : 0u;
+  if (!entry) {
+    if (remaining == 0u) {
+      // The preamble is complete, the rest of the library preamble gets no more one bits
+      txIsr.txPreambleExtended = true;
+      txIsr.txSchedState = TxSchedState::Idle;
+      return;
+    }
+    txIsr.txSchedHalf = txIsr.txTimingActive->half;
+    txIsr.txSchedClass = TX_CLASS_ONE;
+  }
+  else {
+    // One bits still to send so that less than half a bit is left when the start bit
+    // begins, the start bit is then the closest edge to the target
+    uint32_t const half = entry->half[TX_CLASS_ONE][0];
+    if (txIsr.txSchedElapsed + half < entry->gap_us) {
+      uint32_t const bit = half + entry->half[TX_CLASS_ONE][1];
+      uint32_t const bits = (entry->gap_us - txIsr.txSchedElapsed - half + bit - 1u) / bit;
+      remaining = bits > remaining ? bits : remaining;
+    }
+    txIsr.txSchedHalf = entry->half;
+    if (remaining == 0u) {
+      txIsr.txSchedState = TxSchedState::Packet;
+      txIsr.txSchedBitIndex = 0;
+      txIsr.txSchedClass = entry->bit_class[0];
+      txIsr.txSchedFirstBit = true;
+      txIsr.txSchedTrigger = (entry->flags & PACKET_PROGRAM_FLAG_TRIGGER) != 0;
+      if (entry->flags & PACKET_PROGRAM_FLAG_ACK) {
+        analog_ack_arm();
+      }
+      return;
+    }
+    // Preamble positions count backwards from the start bit
+    bool const overridden = remaining <= PACKET_TIMING_PREAMBLE_BITS && ((entry->preamble >> (remaining - 1u)) & 1u) != 0u;
+    txIsr.txSchedClass = overridden ? (TX_CLASS_ONE | TX_CLASS_OVERRIDE) : TX_CLASS_ONE;
+  }
+  txIsr.txSchedPreambleBits++;
+}
+
+// Rebuild the packet bytes from the bits sent, same rules as a decoder: 10 preamble
+// bits, a start bit, then bytes each followed by a separator
+static void txLogBit(bool one)
+{
+  if (!txLog.inPacket) {
+    if (one) {
+      txLog.ones = txLog.ones < 255u ? txLog.ones + 1u : 255u;
+    }
+    else {
+      txLog.inPacket = txLog.ones >= 10u;
+      txLog.bits = 0;
+      txLog.count = 0;
+      txLog.ones = 0;
+    }
+    return;
+  }
+
+  if (txLog.bits < 8u) {
+    if (txLog.bits == 0u) {
+      if (txLog.count == PACKET_TIMING_MAX_BYTES) {
+        txLog.inPacket = false;
+        return;
+      }
+      txLog.bytes[txLog.count++] = 0;
+    }
+    txLog.bytes[txLog.count - 1u] = static_cast<uint8_t>(txLog.bytes[txLog.count - 1u] << 1u | (one ? 1u : 0u));
+    txLog.bits++;
+    return;
+  }
+
+  if (one) {
+    // End bit, also the first bit of the next preamble
+    for (uint32_t h = 0; h < COMMAND_STATION_HOOK_COUNT; h++) {
+      CommandStationPacketHook const hook = txPacketHooks[h];
+      if (hook) {
+        hook(txIsr.txPacketSeq, txLog.bytes, txLog.count);
+      }
+    }
+    txLog.inPacket = false;
+    txLog.ones = 1;
+  }
+  else {
+    txLog.bits = 0;
+  }
+}
+
+// Pass a half-bit duration through, the first half of every bit feeds the packet framer
+static inline uint32_t txLogHalfBit(uint32_t arr)
+{
+  if (txIsr.txPacketHooked && txIsr.currentPhaseIsP) {
+    txLogBit(arr < DCC_TX_MIN_BIT_0_TIMING);
+  }
+  return arr;
+}
+
+static inline void scopeOutput(bool high)
+{
+  uint32_t const bsrr = high ? SCOPE_Pin : (static_cast<uint32_t>(SCOPE_Pin) << 16u);
+  if (txIsr.dmaRendering) {
+    // SCOPE shares the TR port, so the trigger rides along in the same BSRR word
+    txIsr.renderTrBsrr |= bsrr;
+  }
+  else {
+    SCOPE_GPIO_Port->BSRR = bsrr;
+  }
+}
+
+// Bit start of a packet matching the scope trigger, called from the framer at the end bit
+static void scopeMatchHook(uint32_t packet_seq, const uint8_t* bytes, uint8_t length)
+{
+  (void)packet_seq;
+  if (txIsr.scopeCondition == SCOPE_TRIGGER_MATCH && length >= scopeTrigger.match_length &&
+      std::memcmp(bytes, scopeTrigger.match, scopeTrigger.match_length) == 0) {
+    txIsr.scopeFire = true;
+  }
+}
+
+// Scope trigger for the half-bit that just started, the pin is only written on the pulse edges
+static inline uint32_t scopeHalfBit(uint32_t arr, bool scheduled)
+{
+  bool const start_bit = txIsr.txStartBit;
+  txIsr.txStartBit = false;
+  if (txIsr.scopeHalfBits != 0u) {
+    // What fires during a pulse is dropped
+    txIsr.scopeFire = false;
+    if (--txIsr.scopeHalfBits == 0u) {
+      scopeOutput(false);
+    }
+    return arr;
+  }
+  if (!txIsr.currentPhaseIsP) {
+    return arr;
+  }
+
+  uint32_t const condition = txIsr.scopeCondition;
+  bool fired = txIsr.scopeFire;
+  txIsr.scopeFire = false;
+  if (condition == SCOPE_TRIGGER_PACKET_SEQ) {
+    fired = start_bit && txIsr.txPacketSeq == scopeTrigger.packet_seq;
+  }
+  else if (condition == SCOPE_TRIGGER_OVERRIDE_BIT) {
+    uint32_t const bit = scopeTrigger.bit;
+    if (scheduled) {
+      fired = txIsr.txSchedState == TxSchedState::Packet && txIsr.txSchedBitIndex == bit &&
+              (txIsr.txSchedClass & TX_CLASS_OVERRIDE) != 0u;
+    }
+    else {
+      fired = bit < ZEROBIT_TABLE_BITS && txIsr.zerobitBitIndex == bit && arr >= DCC_TX_MIN_BIT_0_TIMING &&
+              ((zerobitOverrideMask >> bit) & 1u) != 0u;
+    }
+  }
+  bool const first_bit = start_bit && (txIsr.trigger_first_bit || txIsr.txSchedTrigger);
+  if (!fired && !first_bit) {
+    return arr;
+  }
+
+  uint32_t width_bits = 1u;
+  if (fired) {
+    width_bits = scopeTrigger.width_bits;
+    scopeFired = scopeFired + 1u;
+    scopeLastSeq = txIsr.txPacketSeq;
+    if (scopeTrigger.single) {
+      txIsr.scopeCondition = SCOPE_TRIGGER_OFF;
+    }
+  }
+  txIsr.scopeHalfBits = static_cast<uint16_t>(2u * width_bits);
+  scopeOutput(true);
+  return arr;
+}
+
+// Next half-bit duration of the track signal, either from the library or from the scheduler.
+// Runs from SRAM with the library transmit() and the helpers above inlined.
+template <uint32_t Variant>
+FAST_RAM_FLATTEN static uint32_t txNextHalfBit(void)
+{
+  constexpr bool bidi = (Variant & TX_VARIANT_BIDI) != 0u;
+  constexpr bool scope = (Variant & TX_VARIANT_SCOPE) != 0u;
+  constexpr bool zerobitOverride = (Variant & TX_VARIANT_OVERRIDE) != 0u;
+
+  if (txIsr.txSchedState != TxSchedState::Idle && !txIsr.txSchedSecondHalf) {
+    txSchedStartBit();
+  }
+
+  if (txIsr.txSchedState == TxSchedState::Idle) {
+    uint32_t arr{command_station.transmit()};
+    bool const one = arr < DCC_TX_MIN_BIT_0_TIMING;
+    bool const cutout = bidi && txIsr.txSchedBiDiCutout;
+    txIsr.txSchedOneRun = (one && !cutout) ? txIsr.txSchedOneRun + 1u : 0u;
+    if (!one) {
+      txIsr.txPreambleExtended = false;
+    }
+    // Between packets on a bit boundary (N half just sent) once inside a preamble
+    if (txIsr.txSchedOneRun >= TX_SCHED_TAKEOVER_HALF_BITS && !txIsr.currentPhaseIsP) {
+      txTimingSwap();
+      TxTiming const* const timing = txIsr.txTimingActive;
+      if (!scheduledPacketQueue.empty()) {
+        // Take over
+        txIsr.txSchedState = TxSchedState::Gap;
+        txIsr.txSchedElapsed = 0;
+        txIsr.txSchedPreambleBits = 0;
+        txIsr.txSchedSecondHalf = false;
+        txIsr.txSchedOneRun = 0;
+      }
+      else if (timing->preamble_extra > 0u && !txIsr.txPreambleExtended) {
+        // Insert the one bits of a preamble longer than the library one
+        txIsr.txSchedState = TxSchedState::Gap;
+        txIsr.txSchedElapsed = 0;
+        txIsr.txSchedPreambleBits = timing->num_preamble - timing->preamble_extra;
+        txIsr.txSchedSecondHalf = false;
+        txIsr.txSchedOneRun = 0;
+      }
+    }
+    if (!cutout) {
+      arr = arr == txIsr.txLibBit1 ? txIsr.txTimingActive->bit1_duration : arr == txIsr.txLibBit0 ? txIsr.txTimingActive->bit0_duration : arr;
+    }
+    if constexpr (zerobitOverride) {
+      arr = applyZerobitOverride(arr);
+    }
+    arr = txLogHalfBit(arr);
+    if constexpr (scope) {
+      arr = scopeHalfBit(arr, false);
+    }
+    return arr;
+  }
+
+  bool const first_half = !txIsr.txSchedSecondHalf;
+  uint32_t const half = txIsr.txSchedHalf[txIsr.txSchedClass][first_half ? 0u : 1u];
+  bool const level = first_half != ((half & TX_HALF_HOLD) != 0u);
+  command_station.trackOutputs(!level, level, txIsr.txSchedFirstBit && first_half);
+  txIsr.txSchedSecondHalf = first_half;
+  if (!first_half) {
+    txIsr.txSchedFirstBit = false;
+  }
+  uint32_t duration = half & TX_HALF_DURATION;
+  if (txIsr.txSchedState == TxSchedState::Gap) {
+    txIsr.txSchedElapsed += duration;
+  }
+  duration = txLogHalfBit(duration);
+  if constexpr (scope) {
+    duration = scopeHalfBit(duration, true);
+  }
+  return duration;
+}
+
+using TxHalfBitHandler = uint32_t (*)(void);
+
+static constexpr TxHalfBitHandler kTxVariants[TX_VARIANT_COUNT] = {
+  txNextHalfBit<0u>,
+  txNextHalfBit<TX_VARIANT_BIDI>,
+  txNextHalfBit<TX_VARIANT_SCOPE>,
+  txNextHalfBit<TX_VARIANT_SCOPE | TX_VARIANT_BIDI>,
+  txNextHalfBit<TX_VARIANT_OVERRIDE>,
+  txNextHalfBit<TX_VARIANT_OVERRIDE | TX_VARIANT_BIDI>,
+  txNextHalfBit<TX_VARIANT_OVERRIDE | TX_VARIANT_SCOPE>,
+  txNextHalfBit<TX_VARIANT_ALL>,
+};
+
+// Handler of the running variant, the pointer is swapped in one store between two half-bits
+static struct {
+  TxHalfBitHandler volatile nextHalfBit = kTxVariants[TX_VARIANT_ALL];
+  uint32_t variant = TX_VARIANT_ALL;
+} txHandler FAST_RAM_DATA;
+
+// Features the next start has to keep, the BiDi setting is added by the start itself
+static uint32_t txVariantFor(bool bidi)
+{
+  uint32_t variant = bidi ? TX_VARIANT_BIDI : 0u;
+  if (txIsr.trigger_first_bit || txIsr.scopeCondition != SCOPE_TRIGGER_OFF) {
+    variant |= TX_VARIANT_SCOPE;
+  }
+  if (zerobitOverrideMask != 0u && (zerobitDeltaP != 0 || zerobitDeltaN != 0)) {
+    variant |= TX_VARIANT_OVERRIDE;
+  }
+  return variant;
+}
+
+// Half-bit recording and replay, a wrapper handler around the running variant while active
+static struct {
+  uint8_t volatile state = COMMAND_STATION_RECORD_IDLE;
+  bool full = false;
+  bool level = false;             // level of the previous half-bit
+  bool boundaryLevel = false;     // boundary tracking, level of the previous half-bit seen
+  uint32_t ones = 0;              // consecutive one half-bits seen
+  uint32_t length = 0;            // entries
+  uint32_t entry = 0;             // replay position
+  uint32_t repeats = 0;           // replay: repeats left of the entry
+  uint32_t passes = 0;
+  uint32_t pass = 0;
+  uint64_t halfBits = 0;
+  uint64_t durationUs = 0;
+} txRecord FAST_RAM_DATA;
+
+static uint32_t txRecordEntries[COMMAND_STATION_RECORD_ENTRIES];
+
+static const char* const kRecordStateNames[COMMAND_STATION_RECORD_STATE_COUNT] = {
+  "idle", "armed", "recording", "stopping", "replay_armed", "replaying", "replay_stopping"
+};
+
+static void txVariantSelect(uint32_t variant)
+{
+  txHandler.variant = variant;
+  // A recording or replay calls the variant handler itself
+  if (txRecord.state == COMMAND_STATION_RECORD_IDLE) {
+    txHandler.nextHalfBit = kTxVariants[variant];
+  }
+}
+
+// A feature switched on while running, callers in several threads
+static void txVariantAdd(uint32_t features)
+{
+  uint32_t const primask = __get_PRIMASK();
+  __disable_irq();
+  if ((txHandler.variant & features) != features) {
+    txVariantSelect(txHandler.variant | features);
+  }
+  __set_PRIMASK(primask);
+}
+
+// True after the N half of the tenth one bit in a row, a bit boundary inside a preamble
+FAST_RAM_FUNC static bool txRecordBoundary(uint32_t arr, bool level)
+{
+  bool const one = arr < DCC_TX_MIN_BIT_0_TIMING && level != txRecord.boundaryLevel;
+  txRecord.boundaryLevel = level;
+  txRecord.ones = one ? txRecord.ones + 1u : 0u;
+  return txRecord.ones >= TX_SCHED_TAKEOVER_HALF_BITS && !level;
+}
+
+// Back to the variant handler, interrupts disabled or in the transmit path
+static void txRecordEnd(void)
+{
+  txRecord.state = COMMAND_STATION_RECORD_IDLE;
+  txHandler.nextHalfBit = kTxVariants[txHandler.variant];
+}
+
+FAST_RAM_FUNC static void txRecordAppend(uint32_t arr, bool level)
+{
+  uint32_t const half = (arr & COMMAND_STATION_RECORD_DURATION) |
+                        (level == txRecord.level ? COMMAND_STATION_RECORD_HOLD : 0u);
+  txRecord.level = level;
+  uint32_t const length = txRecord.length;
+  uint32_t const last = length > 0u ? txRecordEntries[length - 1u] : 0u;
+  if (length > 0u && (last & 0xFFFFu) == half && (last >> COMMAND_STATION_RECORD_REPEAT_SHIFT) < 0xFFFFu) {
+    txRecordEntries[length - 1u] = last + (1u << COMMAND_STATION_RECORD_REPEAT_SHIFT);
+  }
+  else if (length < COMMAND_STATION_RECORD_ENTRIES) {
+    txRecordEntries[length] = half;
+    txRecord.length = length + 1u;
+  }
+  else {
+    txRecord.full = true;
+    txRecordEnd();
+    return;
+  }
+  txRecord.halfBits++;
+  txRecord.durationUs += half & COMMAND_STATION_RECORD_DURATION;
+}
+
+// Recording: the half-bit of the variant handler, appended once a preamble has been seen
+FAST_RAM_FUNC static uint32_t txRecordHalfBit(void)
+{
+  uint32_t const arr{kTxVariants[txHandler.variant]()};
+  bool const level = txIsr.currentPhaseIsP;
+  bool const boundary = txRecordBoundary(arr, level);
+  uint8_t const state = txRecord.state;
+
+  if (state == COMMAND_STATION_RECORD_ARMED) {
+    if (boundary) {
+      txRecord.level = level;
+      txRecord.state = COMMAND_STATION_RECORD_RECORDING;
+    }
+    return arr;
+  }
+  txRecordAppend(arr, level);
+  if (state == COMMAND_STATION_RECORD_STOPPING && boundary) {
+    txRecordEnd();
+  }
+  return arr;
+}
+
+// Replay: the recording in place of the library and the scheduler, which resume afterwards
+FAST_RAM_FUNC static uint32_t txReplayHalfBit(void)
+{
+  if (txRecord.state == COMMAND_STATION_REPLAY_ARMED) {
+    uint32_t const arr{kTxVariants[txHandler.variant]()};
+    if (txRecordBoundary(arr, txIsr.currentPhaseIsP)) {
+      txRecord.level = false;
+      txRecord.entry = 0;
+      txRecord.repeats = txRecordEntries[0] >> COMMAND_STATION_RECORD_REPEAT_SHIFT;
+      txRecord.state = COMMAND_STATION_REPLAY_RUNNING;
+    }
+    return arr;
+  }
+
+  uint32_t const half = txRecordEntries[txRecord.entry];
+  bool const level = (half & COMMAND_STATION_RECORD_HOLD) ? txRecord.level : !txRecord.level;
+  uint32_t const duration = half & COMMAND_STATION_RECORD_DURATION;
+  // A zero bit after a preamble is a start bit, it counts the packet like the library one
+  bool const start_bit = level && duration >= DCC_TX_MIN_BIT_0_TIMING && txRecord.ones >= TX_SCHED_TAKEOVER_HALF_BITS;
+  txRecord.level = level;
+  command_station.trackOutputs(!level, level, start_bit);
+  bool const boundary = txRecordBoundary(duration, level);
+
+  if (txRecord.repeats > 0u) {
+    txRecord.repeats--;
+  }
+  else if (++txRecord.entry < txRecord.length) {
+    txRecord.repeats = txRecordEntries[txRecord.entry] >> COMMAND_STATION_RECORD_REPEAT_SHIFT;
+  }
+  else {
+    txRecord.pass++;
+    if (txRecord.state == COMMAND_STATION_REPLAY_STOPPING ||
+        (txRecord.passes != 0u && txRecord.pass >= txRecord.passes)) {
+      txRecordEnd();
+    }
+    else {
+      txRecord.entry = 0;
+      txRecord.repeats = txRecordEntries[0] >> COMMAND_STATION_RECORD_REPEAT_SHIFT;
+    }
+  }
+  if (txRecord.state == COMMAND_STATION_REPLAY_STOPPING && boundary) {
+    txRecordEnd();
+  }
+  return txLogHalfBit(duration);
+}
+
+// Render the next count half-bits into the DMA tables starting at offset
+static void dmaTxRender(uint32_t offset, uint32_t count)
+{
+  txIsr.dmaRendering = true;
+  for (uint32_t i = offset; i < offset + count; i++) {
+    uint32_t const arr{txHandler.nextHalfBit()};
+    dmaTxTables.arr[i] = arr;
+    dmaTxTables.tr_bsrr[i] = txIsr.renderTrBsrr;
+    dmaTxTables.track_bsrr[i] = txIsr.renderTrackBsrr;
+  }
+  txIsr.dmaRendering = false;
+}
+
+static void dmaTxHalfCplt(DMA_HandleTypeDef *hdma)
+{
+  (void)hdma;
+  dmaTxRender(0u, DMA_TX_HALF_SIZE);
+}
+
+static void dmaTxCplt(DMA_HandleTypeDef *hdma)
+{
+  (void)hdma;
+  dmaTxRender(DMA_TX_HALF_SIZE, DMA_TX_HALF_SIZE);
+}
+
+// Build a circular single node linked list queue which streams table to a peripheral register
+static bool dmaTxChannelInit(DMA_HandleTypeDef *hdma, DMA_Channel_TypeDef *instance, uint32_t request,
+                             DMA_QListTypeDef *queue, DMA_NodeTypeDef *node,
+                             uint32_t *table, volatile uint32_t *dst)
+{
+  DMA_NodeConfTypeDef nodeConfig = {};
+  nodeConfig.NodeType = DMA_GPDMA_LINEAR_NODE;
+  nodeConfig.Init.Request = request;
+  nodeConfig.Init.BlkHWRequest = DMA_BREQ_SINGLE_BURST;
+  nodeConfig.Init.Direction = DMA_MEMORY_TO_PERIPH;
+  nodeConfig.Init.SrcInc = DMA_SINC_INCREMENTED;
+  nodeConfig.Init.DestInc = DMA_DINC_FIXED;
+  nodeConfig.Init.SrcDataWidth = DMA_SRC_DATAWIDTH_WORD;
+  nodeConfig.Init.DestDataWidth = DMA_DEST_DATAWIDTH_WORD;
+  nodeConfig.Init.SrcBurstLength = 1;
+  nodeConfig.Init.DestBurstLength = 1;
+  nodeConfig.Init.TransferAllocatedPort = DMA_SRC_ALLOCATED_PORT0 | DMA_DEST_ALLOCATED_PORT0;
+  nodeConfig.Init.TransferEventMode = DMA_TCEM_BLOCK_TRANSFER;
+  nodeConfig.Init.Mode = DMA_NORMAL;
+  nodeConfig.TriggerConfig.TriggerPolarity = DMA_TRIG_POLARITY_MASKED;
+  nodeConfig.DataHandlingConfig.DataExchange = DMA_EXCHANGE_NONE;
+  nodeConfig.DataHandlingConfig.DataAlignment = DMA_DATA_RIGHTALIGN_ZEROPADDED;
+  nodeConfig.SrcAddress = reinterpret_cast<uint32_t>(table);
+  nodeConfig.DstAddress = reinterpret_cast<uint32_t>(dst);
+  nodeConfig.DataSize = DMA_TX_SIZE * sizeof(uint32_t);
+
+  if (HAL_DMAEx_List_BuildNode(&nodeConfig, node) != HAL_OK ||
+      HAL_DMAEx_List_ResetQ(queue) != HAL_OK ||
+      HAL_DMAEx_List_InsertNode(queue, NULL, node) != HAL_OK ||
+      HAL_DMAEx_List_SetCircularMode(queue) != HAL_OK) {
+    return false;
+  }
+
+  hdma->Instance = instance;
+  hdma->InitLinkedList.Priority = DMA_HIGH_PRIORITY;
+  hdma->InitLinkedList.LinkStepMode = DMA_LSM_FULL_EXECUTION;
+  hdma->InitLinkedList.LinkAllocatedPort = DMA_LINK_ALLOCATED_PORT0;
+  hdma->InitLinkedList.TransferEventMode = DMA_TCEM_BLOCK_TRANSFER;
+  hdma->InitLinkedList.LinkedListMode = DMA_LINKEDLIST_CIRCULAR;
+  if (HAL_DMAEx_List_Init(hdma) != HAL_OK ||
+      HAL_DMAEx_List_LinkQ(hdma, queue) != HAL_OK) {
+    return false;
+  }
+  return true;
+}
+
+// Start TIM2 in DMA transmit mode, returns false if the DMA channels could not be set up
+static bool dmaTransmitStart(void)
+{
+  if (!dmaTxChannelInit(&hdmaTxArr, DCC_TX_ARR_DMA_CHANNEL, DCC_TX_ARR_DMA_REQUEST,
+                        &dmaTxArrQueue, &dmaTxArrNode, dmaTxTables.arr, &htim2.Instance->ARR) ||
+      !dmaTxChannelInit(&hdmaTxTr, DCC_TX_TR_DMA_CHANNEL, DCC_TX_TR_DMA_REQUEST,
+                        &dmaTxTrQueue, &dmaTxTrNode, dmaTxTables.tr_bsrr, &TR_P_GPIO_Port->BSRR) ||
+      !dmaTxChannelInit(&hdmaTxTrack, DCC_TX_TRACK_DMA_CHANNEL, DCC_TX_TRACK_DMA_REQUEST,
+                        &dmaTxTrackQueue, &dmaTxTrackNode, dmaTxTables.track_bsrr, &TRACK_P_GPIO_Port->BSRR)) {
+    return false;
+  }
+  hdmaTxArr.XferHalfCpltCallback = dmaTxHalfCplt;
+  hdmaTxArr.XferCpltCallback = dmaTxCplt;
+
+  // Both halves are rendered up front, refills are done from the DMA interrupt
+  dmaTxRender(0u, DMA_TX_SIZE);
+
+  HAL_NVIC_SetPriority(DCC_TX_ARR_DMA_IRQn, 2, 0);
+  HAL_NVIC_EnableIRQ(DCC_TX_ARR_DMA_IRQn);
+  if (HAL_DMAEx_List_Start(&hdmaTxTr) != HAL_OK ||
+      HAL_DMAEx_List_Start(&hdmaTxTrack) != HAL_OK ||
+      HAL_DMAEx_List_Start_IT(&hdmaTxArr) != HAL_OK) {
+    return false;
+  }
+
+  // CC3/CC4 are used purely as DMA request sources just after each update event
+  htim2.Instance->CCR3 = DMA_TX_CC_DELAY;
+  htim2.Instance->CCR4 = DMA_TX_CC_DELAY;
+  __HAL_TIM_ENABLE_DMA(&htim2, TIM_DMA_UPDATE | TIM_DMA_CC3 | TIM_DMA_CC4);
+  HAL_TIM_Base_Start(&htim2);
+  return true;
+}
+
+static void dmaTransmitStop(void)
+{
+  HAL_TIM_Base_Stop(&htim2);
+  __HAL_TIM_DISABLE_DMA(&htim2, TIM_DMA_UPDATE | TIM_DMA_CC3 | TIM_DMA_CC4);
+  HAL_DMA_Abort(&hdmaTxArr);
+  HAL_DMA_Abort(&hdmaTxTr);
+  HAL_DMA_Abort(&hdmaTxTrack);
+  HAL_NVIC_DisableIRQ(DCC_TX_ARR_DMA_IRQn);
+  HAL_DMAEx_List_UnLinkQ(&hdmaTxArr);
+  HAL_DMAEx_List_UnLinkQ(&hdmaTxTr);
+  HAL_DMAEx_List_UnLinkQ(&hdmaTxTrack);
+  HAL_DMAEx_List_DeInit(&hdmaTxArr);
+  HAL_DMAEx_List_DeInit(&hdmaTxTr);
+  HAL_DMAEx_List_DeInit(&hdmaTxTrack);
+}
+
+/**
+  * @brief This function handles the DCC transmit ARR DMA channel interrupt.
+  */
+extern "C" void DCC_TX_ARR_DMA_IRQHandler(void)
+{
+  HAL_DMA_IRQHandler(&hdmaTxArr);
+}
+
+
+
+/**
+  * @brief This function handles TIM2 global interrupt.
+  */
+extern "C" FAST_RAM_FUNC void TIM2_IRQHandler(void)
+{
+  uint32_t const entry = DWT->CYCCNT;
+  uint32_t const profile = profiler_isr_enter();
+
+  uint32_t itsource = htim2.Instance->DIER;
+  uint32_t itflag   = htim2.Instance->SR;
+
+  /* Capture compare 1 event */
+  if ((itflag & (TIM_FLAG_CC1)) == (TIM_FLAG_CC1))
+  {
+    if ((itsource & (TIM_IT_CC1)) == (TIM_IT_CC1))
+    {
+      {
+        __HAL_TIM_CLEAR_FLAG(&htim2, TIM_FLAG_CC1);
+        htim2.Channel = HAL_TIM_ACTIVE_CHANNEL_1;
+        htim2.Channel = HAL_TIM_ACTIVE_CHANNEL_CLEARED;
+      }
+    }
+  }
+  /* TIM Update event */
+  if ((itflag & (TIM_FLAG_UPDATE)) == (TIM_FLAG_UPDATE))
+  {
+    if ((itsource & (TIM_IT_UPDATE)) == (TIM_IT_UPDATE))
+    {
+      __HAL_TIM_CLEAR_FLAG(&htim2, TIM_FLAG_UPDATE);
+      edge_timing_entry(entry);
+      auto arr{txHandler.nextHalfBit()};
+      htim2.Instance->ARR = arr; // Set auto-reload register for next interrupt
+      edge_timing_period(arr);
+    }
+  }
+  profiler_isr_exit(PROFILER_ISR_TIM2, profile);
+}
+
+// Timing of packets without their own, the configured profile with the global zero bit override
+static void globalPacketTiming(PacketTiming_t& timing)
+{
+  std::memset(&timing, 0, sizeof(timing));
+  timing.profile = PACKET_TIMING_PROFILE_CONFIGURED;
+  timing.zero_bits_only = 1u;
+  for (uint32_t i = 0; i < ZEROBIT_TABLE_BITS / 8u; i++) {
+    timing.bits[i] = static_cast<uint8_t>(zerobitOverrideMask >> (8u * i));
+  }
+  timing.deltaP = zerobitDeltaP;
+  timing.deltaN = zerobitDeltaN;
+}
+
+static uint16_t overrideHalf(uint32_t duration, int32_t delta)
+{
+  int32_t const adjusted = static_cast<int32_t>(duration) + delta;
+  if (adjusted < 1) {
+    return 1u;
+  }
+  return adjusted > PACKET_TIMING_MAX_HALF_US ? PACKET_TIMING_MAX_HALF_US : static_cast<uint16_t>(adjusted);
+}
+
+// Set of the fault rules changing the halves of a bit position
+static uint32_t faultRules(PacketTiming_t const& timing, uint32_t bit)
+{
+  uint32_t rules = 0;
+  for (uint32_t r = 0; r < PACKET_TIMING_MAX_FAULTS; r++) {
+    PacketFault_t const& fault = timing.faults[r];
+    if ((fault.type == PACKET_FAULT_STRETCH || fault.type == PACKET_FAULT_DROP) && bit >= fault.first &&
+        bit - fault.first < fault.count) {
+      rules |= 1u << r;
+    }
+  }
+  return rules;
+}
+
+static bool faultFlipped(PacketTiming_t const& timing, uint32_t bit)
+{
+  bool flipped = false;
+  for (PacketFault_t const& fault : timing.faults) {
+    if (fault.type == PACKET_FAULT_FLIP && bit >= fault.first && bit - fault.first < fault.count) {
+      flipped = !flipped;
+    }
+  }
+  return flipped;
+}
+
+static uint8_t bitClass(PacketTiming_t const& timing, uint32_t bit, bool one)
+{
+  one = one != faultFlipped(timing, bit);
+  bool const overridden = ((timing.bits[bit / 8u] >> (bit % 8u)) & 1u) != 0u && (!one || !timing.zero_bits_only);
+  return static_cast<uint8_t>((one ? TX_CLASS_ONE : TX_CLASS_ZERO) | (overridden ? TX_CLASS_OVERRIDE : 0u) |
+                              faultRules(timing, bit) << TX_CLASS_FAULT_SHIFT);
+}
+
+// Expand a packet into the per bit timing classes and duration table sent by the transmit path
+static void encodeScheduledPacket(ScheduledPacket& out, dcc::Packet const& packet, uint8_t flags,
+                                  PacketTiming_t const* timing)
+{
+  TxTiming const* const configured = txIsr.txTimingActive;
+  uint32_t base[2][2];
+  if (timing->profile == PACKET_TIMING_PROFILE_CONFIGURED || timing->profile >= PACKET_TIMING_PROFILE_COUNT) {
+    for (uint32_t c = 0; c < 2u; c++) {
+      base[c][0] = configured->half[c][0];
+      base[c][1] = configured->half[c][1];
+    }
+  }
+  else {
+    TimingProfile const& profile = timing_profiles[timing->profile];
+    base[TX_CLASS_ONE][0] = profile.one_p;
+    base[TX_CLASS_ONE][1] = profile.one_n;
+    base[TX_CLASS_ZERO][0] = profile.zero_p;
+    base[TX_CLASS_ZERO][1] = profile.zero_n;
+  }
+  for (uint32_t c = 0; c < 2u; c++) {
+    out.half[c][0] = base[c][0];
+    out.half[c][1] = base[c][1];
+    out.half[c | TX_CLASS_OVERRIDE][0] = overrideHalf(base[c][0], timing->deltaP);
+    out.half[c | TX_CLASS_OVERRIDE][1] = overrideHalf(base[c][1], timing->deltaN);
+  }
+  // Fault variants, rule r applies to the classes with bit r of the variant set, in rule order
+  for (uint32_t c = TX_CLASS_BASE; c < TX_CLASS_COUNT; c++) {
+    for (uint32_t h = 0; h < 2u; h++) {
+      uint32_t half = out.half[c % TX_CLASS_BASE][h];
+      for (uint32_t r = 0; r < PACKET_TIMING_MAX_FAULTS; r++) {
+        PacketFault_t const& fault = timing->faults[r];
+        if (!((c >> (TX_CLASS_FAULT_SHIFT + r)) & 1u) || !((fault.half >> h) & 1u)) {
+          continue;
+        }
+        if (fault.type == PACKET_FAULT_STRETCH && !(half & TX_HALF_HOLD)) {
+          half = overrideHalf(half & TX_HALF_DURATION, fault.value) | (half & TX_HALF_HOLD);
+        }
+        else if (fault.type == PACKET_FAULT_DROP) {
+          half = TX_HALF_HOLD | 1u;
+        }
+      }
+      out.half[c][h] = static_cast<uint16_t>(half);
+    }
+  }
+
+  uint8_t checksum_xor = 0;
+  for (PacketFault_t const& fault : timing->faults) {
+    if (fault.type == PACKET_FAULT_CHECKSUM) {
+      checksum_xor ^= static_cast<uint8_t>(fault.value);
+    }
+  }
+
+  // Start bit, then each byte MSB first followed by a separator, the last separator is the end bit
+  uint32_t bit = 0;
+  out.bit_class[bit] = bitClass(*timing, bit, false);
+  bit++;
+  for (size_t i = 0; i < packet.size(); i++) {
+    uint8_t const byte = static_cast<uint8_t>(i + 1u == packet.size() ? packet[i] ^ checksum_xor : packet[i]);
+    for (uint32_t b = 8u; b-- > 0u;) {
+      out.bit_class[bit] = bitClass(*timing, bit, ((byte >> b) & 1u) != 0u);
+      bit++;
+    }
+    out.bit_class[bit] = bitClass(*timing, bit, i + 1u == packet.size());
+    bit++;
+  }
+  out.bits = static_cast<uint16_t>(bit);
+  out.flags = flags;
+  out.preamble = timing->preamble;
+  out.num_preamble = configured->num_preamble;
+  for (PacketFault_t const& fault : timing->faults) {
+    if (fault.type == PACKET_FAULT_TRUNCATE_PREAMBLE && fault.value >= 0 && fault.value < out.num_preamble) {
+      out.num_preamble = static_cast<uint8_t>(fault.value);
+    }
+  }
+}
+
+// Packets with the same bytes, flags and timing encode the same, the timing of a packet without an
+// override is the global one at the time it is built
+static void packetCacheKey(PacketCacheKey& key, dcc::Packet const& packet, uint8_t flags,
+                           PacketTiming_t const& timing)
+{
+  // Compared with memcmp, padding included
+  std::memset(&key, 0, sizeof(key));
+  key.length = static_cast<uint8_t>(packet.size());
+  for (size_t i = 0; i < packet.size(); i++) {
+    key.bytes[i] = packet[i];
+  }
+  key.flags = flags;
+  key.timing.profile = timing.profile;
+  key.timing.zero_bits_only = timing.zero_bits_only;
+  std::memcpy(key.timing.bits, timing.bits, sizeof(key.timing.bits));
+  key.timing.preamble = timing.preamble;
+  key.timing.deltaP = timing.deltaP;
+  key.timing.deltaN = timing.deltaN;
+  for (uint32_t r = 0; r < PACKET_TIMING_MAX_FAULTS; r++) {
+    PacketFault_t const& fault = timing.faults[r];
+    key.timing.faults[r].type = fault.type;
+    key.timing.faults[r].half = fault.half;
+    key.timing.faults[r].first = fault.first;
+    key.timing.faults[r].count = fault.count;
+    key.timing.faults[r].value = fault.value;
+  }
+}
+
+static void packetCacheClear(void)
+{
+  for (PacketCacheEntry& entry : packetCache) {
+    entry.valid = false;
+  }
+}
+
+// Scheduled packet for the transmit path, from the cache if it was encoded before
+static void buildScheduledPacket(ScheduledPacket& out, dcc::Packet const& packet, uint32_t gap_us,
+                                 uint8_t flags, PacketTiming_t const& packet_timing)
+{
+  PacketTiming_t global_timing;
+  PacketTiming_t const* timing = &packet_timing;
+  if (flags & PACKET_PROGRAM_FLAG_TRIGGER) {
+    txVariantAdd(TX_VARIANT_SCOPE);
+  }
+  if (!(flags & PACKET_PROGRAM_FLAG_OVERRIDE)) {
+    globalPacketTiming(global_timing);
+    timing = &global_timing;
+  }
+
+  // Read before the configured timing is, an update in between only clears the cache once more
+  uint32_t const generation = txTimingGeneration.load(std::memory_order_acquire);
+  if (generation != packetCacheGeneration) {
+    packetCacheClear();
+    packetCacheGeneration = generation;
+  }
+
+  PacketCacheKey key;
+  packetCacheKey(key, packet, flags, *timing);
+  // FNV-1a
+  uint8_t const* const key_bytes = reinterpret_cast<uint8_t const*>(&key);
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < sizeof(key); i++) {
+    hash = (hash ^ key_bytes[i]) * 16777619u;
+  }
+  PacketCacheEntry& entry = packetCache[hash & (PACKET_CACHE_ENTRIES - 1u)];
+  if (entry.valid && std::memcmp(&entry.key, &key, sizeof(key)) == 0) {
+    packetCacheHits++;
+  }
+  else {
+    packetCacheMisses++;
+    encodeScheduledPacket(entry.encoded, packet, flags, timing);
+    entry.key = key;
+    entry.valid = true;
+  }
+  // Only the used part of the class table is copied
+  std::memcpy(out.half, entry.encoded.half, sizeof(out.half));
+  std::memcpy(out.bit_class, entry.encoded.bit_class, entry.encoded.bits);
+  out.bits = entry.encoded.bits;
+  out.flags = entry.encoded.flags;
+  out.preamble = entry.encoded.preamble;
+  out.num_preamble = entry.encoded.num_preamble;
+  out.gap_us = gap_us;
+}
+
+// Consumer side of a replace: drop the queued packets, packets already handed over are sent
+static bool customPacketsCancelled(void)
+{
+  if (!customPacketCancel.load(std::memory_order_acquire)) {
+    return false;
+  }
+  while (customPacketQueue.front()) {
+    customPacketQueue.pop();
+  }
+  return true;
+}
+
+// Drain the custom packet queue into the command station (consumer side)
+// Runs until the queue is empty, or in stream mode until streaming is ended by the producer.
+// In scheduled mode packets are handed to the transmit path which times the gaps itself.
+// A replace cancels the transmission, the remaining packets are dropped.
+static void transmitCustomPackets(void)
+{
+  bool const stream = customPacketStream.load(std::memory_order_acquire);
+  bool const scheduled = customPacketScheduled.load(std::memory_order_acquire);
+  uint32_t sent_packets = 0;
+
+  while (commandStationRunning) {
+    if (customPacketsCancelled()) {
+      break;
+    }
+    CustomPacket const* entry = customPacketQueue.front();
+    if (!entry) {
+      if (!customPacketStream.load(std::memory_order_acquire)) {
+        break;
+      }
+      // Producer fell behind the track
+      if (sent_packets > 0) {
+        customPacketUnderruns++;
+      }
+      osEventFlagsWait(commandStationEvents, CS_EVENT_ALL, osFlagsWaitAny, osWaitForever);
+      continue;
+    }
+
+    if (scheduled) {
+      ScheduledPacket* slot = scheduledPacketQueue.claim();
+      while (!slot && commandStationRunning && !customPacketCancel.load(std::memory_order_acquire)) {
+        osDelay(1u);
+        slot = scheduledPacketQueue.claim();
+      }
+      if (!slot) {
+        customPacketsCancelled();
+        break;
+      }
+      uint32_t const gap_us = entry->gap_us == CUSTOM_PACKET_GAP_DEFAULT ? customInterPacketGapUs : entry->gap_us;
+      buildScheduledPacket(*slot, entry->packet, gap_us, entry->flags, entry->timing);
+      scheduledPacketQueue.commit();
+    }
+    else {
+      // The library queue is short, wait for room instead of dropping the packet
+      bool queued = command_station.packet(entry->packet);
+      while (!queued && commandStationRunning && !customPacketCancel.load(std::memory_order_acquire)) {
+        osDelay(1u);
+        queued = command_station.packet(entry->packet);
+      }
+      if (!queued) {
+        customPacketsCancelled();
+        break;
+      }
+    }
+    sent_packets++;
+    customPacketsTransmitted++;
+
+    // Even deferred, the console is far slower than the track, so streams and schedules are not logged
+    if (!stream && !scheduled) {
+      // The trace log takes four words, the first eight bytes are logged packed
+      uint32_t words[2]{};
+      for (size_t j = 0; j < entry->packet.size() && j < 8u; j++) {
+        words[j / 4u] |= static_cast<uint32_t>(entry->packet[j]) << (24u - 8u * (j % 4u));
+      }
+      TRACE_INFO("Custom packet transmitted [%lu]: %u bytes %08lX %08lX\n", sent_packets,
+                 entry->packet.size(), words[0], words[1]);
+    }
+    customPacketQueue.pop();
+
+    if (!scheduled && customInterPacketDelay > 0 && !customPacketQueue.empty()) {
+      // Cut short by a stop or a replace
+      osEventFlagsWait(commandStationEvents, CS_EVENT_STOP | CS_EVENT_CANCEL, osFlagsWaitAny, customInterPacketDelay);
+    }
+  }
+  if (scheduled && !stream) {
+    printf("Custom packets scheduled: %lu\n", static_cast<unsigned long>(sent_packets));
+  }
+  customPacketTrigger.store(false, std::memory_order_release);
+}
+
+// Hand one packet to the scheduled transmit path, waits while the queue is full
+static ScheduledPacket* claimScheduledPacket(uint8_t const* bytes, uint8_t length, uint32_t gap_us,
+                                             uint8_t flags, PacketTiming_t const& timing)
+{
+  ScheduledPacket* slot = scheduledPacketQueue.claim();
+  while (!slot) {
+    if (!commandStationRunning || programStopRequest.load(std::memory_order_acquire)) {
+      return nullptr;
+    }
+    osDelay(1u);
+    slot = scheduledPacketQueue.claim();
+  }
+  dcc::Packet packet{};
+  for (uint8_t i = 0; i < length; i++) {
+    packet.push_back(bytes[i]);
+  }
+  buildScheduledPacket(*slot, packet, gap_us, flags, timing);
+  return slot;
+}
+
+static bool schedulePacket(uint8_t const* bytes, uint8_t length, uint32_t gap_us,
+                           uint8_t flags, PacketTiming_t const& timing)
+{
+  if (!claimScheduledPacket(bytes, length, gap_us, flags, timing)) {
+    return false;
+  }
+  scheduledPacketQueue.commit();
+  return true;
+}
+
+// Scheduled packet with all one and zero bits, its preamble included, of the given durations
+static bool scheduleTimedPacket(uint8_t const* bytes, uint8_t length, uint32_t gap_us,
+                                uint16_t bit1_us, uint16_t bit0_us)
+{
+  PacketTiming_t timing{};
+  ScheduledPacket* slot = claimScheduledPacket(bytes, length, gap_us, PACKET_PROGRAM_FLAG_OVERRIDE, timing);
+  if (!slot) {
+    return false;
+  }
+  for (uint32_t c = 0; c < TX_CLASS_BASE; c++) {
+    uint16_t const duration = (c & TX_CLASS_ZERO) ? bit0_us : bit1_us;
+    slot->half[c][0] = duration;
+    slot->half[c][1] = duration;
+  }
+  scheduledPacketQueue.commit();
+  return true;
+}
+
+static bool scheduleProgramPacket(PacketProgramEntry_t const* entry, uint32_t gap_us)
+{
+  return schedulePacket(entry->bytes, entry->length, gap_us, entry->flags, entry->timing);
+}
+
+// Execute the loaded packet program until END, the last entry, a stop request or command station stop
+static void runPacketProgram(void)
+{
+  PacketProgramEntry_t const* entries;
+  uint16_t const count = PacketProgram_Get(&entries);
+  uint32_t pending_gap_us = 0;
+  uint16_t pc = 0;
+
+  std::memset(programLoopRemaining, 0, sizeof(programLoopRemaining));
+  programPacketsSent = 0;
+  printf("Packet program started (%u entries)\n", static_cast<unsigned>(count));
+
+  while (pc < count && commandStationRunning && !programStopRequest.load(std::memory_order_acquire)) {
+    PacketProgramEntry_t const* entry = &entries[pc];
+    programPc = pc;
+
+    switch (entry->op) {
+      case PACKET_PROGRAM_OP_PACKET: {
+        uint16_t const repeat = entry->repeat ? entry->repeat : 1u;
+        for (uint16_t r = 0; r < repeat; r++) {
+          if (!scheduleProgramPacket(entry, pending_gap_us + entry->gap_us)) {
+            break;
+          }
+          pending_gap_us = 0;
+          programPacketsSent++;
+        }
+        pc++;
+        break;
+      }
+      case PACKET_PROGRAM_OP_DELAY:
+        pending_gap_us += entry->gap_us;
+        pc++;
+        break;
+      case PACKET_PROGRAM_OP_LOOP:
+        if (entry->repeat == 0) {
+          pc = entry->target;
+        }
+        else {
+          if (programLoopRemaining[pc] == 0) {
+            programLoopRemaining[pc] = entry->repeat;
+          }
+          pc = (--programLoopRemaining[pc] > 0) ? entry->target : pc + 1u;
+        }
+        break;
+      case PACKET_PROGRAM_OP_END:
+        pc = count;
+        break;
+      case PACKET_PROGRAM_OP_LABEL:
+      default:
+        pc++;
+        break;
+    }
+  }
 
-/* Definitions for cmdStationTask */
-const osThreadAttr_t cmdStationTask_attributes = {
-  .name = "cmdStationTask",
-  .stack_size = 8192,
-  .priority = (osPriority_t) osPriorityHigh
-};
+  printf("Packet program finished, %lu packets\n", static_cast<unsigned long>(programPacketsSent));
+  programStopRequest.store(false, std::memory_order_release);
+  programRunning.store(false, std::memory_order_release);
+}
 
+// Send the loaded packet suite suiteLoops times (0: until stopped) with suiteProfile timing
+static void runPacketSuite(void)
+{
+  PacketTiming_t timing{};
+  PacketSuiteVector_t vector;
+  int result = 0;
 
-void CommandStation::trackOutputs(bool N, bool P, bool first_bit) 
-{ 
-  TR_P_GPIO_Port->BSRR = (static_cast<uint32_t>(!N) << TR_N_BR_Pos) | (static_cast<uint32_t>(!P) << TR_P_BR_Pos) |
-                            (static_cast<uint32_t>(N) << TR_N_BS_Pos) | (static_cast<uint32_t>(P) << TR_P_BS_Pos);
-  TRACK_P_GPIO_Port->BSRR = (static_cast<uint32_t>(!P) << TRACK_P_BR_Pos) |
-                            (static_cast<uint32_t>(P) << TRACK_P_BS_Pos);
-  
-  // Track which phase we're in for delta adjustment
-  currentPhaseIsP = P;
-  
-  if (P)
-  {
-    if (first_bit)
-      bitCountMask = 1;
-    else
-      bitCountMask <<= 1;
+  timing.profile = suiteProfile;
+  programPc = 0;
+  programPacketsSent = 0;
+  printf("Packet suite started\n");
+
+  for (uint32_t pass = 0; suiteLoops == 0 || pass < suiteLoops; pass++) {
+    if (PacketSuite_Rewind() != 0) {
+      result = -1;
+      break;
+    }
+    while (commandStationRunning && !programStopRequest.load(std::memory_order_acquire) &&
+           (result = PacketSuite_Next(&vector)) > 0) {
+      uint16_t const repeat = vector.repeat ? vector.repeat : 1u;
+      for (uint16_t r = 0; r < repeat; r++) {
+        if (!schedulePacket(vector.bytes, vector.length, vector.gap_us, vector.flags, timing)) {
+          break;
+        }
+        programPacketsSent++;
+      }
+    }
+    if (result < 0 || !commandStationRunning || programStopRequest.load(std::memory_order_acquire)) {
+      break;
+    }
   }
 
-  if (trigger_first_bit)
-  {
-    first_bit ? HAL_GPIO_WritePin(SCOPE_GPIO_Port, SCOPE_Pin, GPIO_PIN_SET) : HAL_GPIO_WritePin(SCOPE_GPIO_Port, SCOPE_Pin, GPIO_PIN_RESET);
+  printf("Packet suite %s, %lu packets\n", result < 0 ? "failed" : "finished",
+         static_cast<unsigned long>(programPacketsSent));
+  programStopRequest.store(false, std::memory_order_release);
+  programRunning.store(false, std::memory_order_release);
+}
+
+// Send generated packets until the configured count, a stop request or command station stop
+static void runFuzzer(void)
+{
+  PacketFuzzPacket_t packet;
+
+  PacketFuzz_Rewind();
+  programPc = 0;
+  programPacketsSent = 0;
+  printf("Packet fuzzer started\n");
+
+  while (commandStationRunning && !programStopRequest.load(std::memory_order_acquire) && PacketFuzz_Next(&packet)) {
+    if (!schedulePacket(packet.bytes, packet.length, packet.gap_us, packet.flags, packet.timing)) {
+      break;
+    }
+    programPacketsSent++;
   }
+
+  printf("Packet fuzzer finished, %lu packets\n", static_cast<unsigned long>(programPacketsSent));
+  programStopRequest.store(false, std::memory_order_release);
+  programRunning.store(false, std::memory_order_release);
 }
 
-void CommandStation::biDiStart() {
-  HAL_GPIO_WritePin(BR_ENABLE_GPIO_Port, BR_ENABLE_Pin, static_cast<GPIO_PinState>(GPIO_PIN_RESET));   // Set BR_ENABLE low
-  HAL_GPIO_WritePin(BIDIR_EN_GPIO_Port, BIDIR_EN_Pin, static_cast<GPIO_PinState>(GPIO_PIN_SET));   // Set BiDi high
+// Switch the accessory range until the configured passes, a stop request or command station stop
+static void runAccessorySequence(void)
+{
+  AccessorySequencePacket_t packet;
+  PacketTiming_t timing{};
+
+  programPc = 0;
+  programPacketsSent = 0;
+  printf("Accessory sequence started\n");
+
+  while (commandStationRunning && !programStopRequest.load(std::memory_order_acquire) && AccessorySequence_Next(&packet)) {
+    if (!schedulePacket(packet.bytes, packet.length, packet.gap_us, 0u, timing)) {
+      break;
+    }
+    programPacketsSent++;
+  }
+
+  // Give the last commands time to go out and be answered, a stop drops them
+  while ((!scheduledPacketQueue.empty() || AccessorySequence_Pending()) && commandStationRunning &&
+         !programStopRequest.load(std::memory_order_acquire)) {
+    osDelay(1u);
+  }
+  AccessorySequence_Finish();
+
+  printf("Accessory sequence finished, %lu packets\n", static_cast<unsigned long>(programPacketsSent));
+  programStopRequest.store(false, std::memory_order_release);
+  programRunning.store(false, std::memory_order_release);
 }
 
-void CommandStation::biDiChannel1() {}
+// Send the packets of a test step, RailCom steps through the library for the cutout
+static bool sendTestStep(TestStep_t const& step)
+{
+  uint16_t const repeat = step.repeat ? step.repeat : 1u;
+  if (step.length == 0u) {
+    return true;
+  }
+  if (step.expect & TEST_EXPECT_RAILCOM) {
+    dcc::Packet packet{};
+    for (uint8_t i = 0; i < step.length; i++) {
+      packet.push_back(step.bytes[i]);
+    }
+    for (uint16_t r = 0; r < repeat; r++) {
+      while (!command_station.packet(packet)) {
+        if (!commandStationRunning || programStopRequest.load(std::memory_order_acquire)) {
+          return false;
+        }
+        osDelay(1u);
+      }
+    }
+    return true;
+  }
 
-void CommandStation::biDiChannel2() {}
+  PacketTiming_t timing{};
+  for (uint16_t r = 0; r < repeat; r++) {
+    uint8_t flags = step.flags & PACKET_PROGRAM_FLAG_TRIGGER;
+    if (r == 0u && (step.expect & TEST_EXPECT_ACK)) {
+      flags |= PACKET_PROGRAM_FLAG_ACK;
+    }
+    if (!schedulePacket(step.bytes, step.length, step.gap_us, flags, timing)) {
+      return false;
+    }
+  }
+  // The response is timed from the end of the last packet
+  while (!scheduledPacketQueue.empty()) {
+    if (!commandStationRunning) {
+      return false;
+    }
+    osDelay(1u);
+  }
+  return true;
+}
 
-void CommandStation::biDiEnd() {
-  HAL_GPIO_WritePin(BIDIR_EN_GPIO_Port, BIDIR_EN_Pin, static_cast<GPIO_PinState>(GPIO_PIN_RESET)); // Set BiDi low
-  HAL_GPIO_WritePin(BR_ENABLE_GPIO_Port, BR_ENABLE_Pin, static_cast<GPIO_PinState>(GPIO_PIN_SET));   // Set BR_ENABLE high
+// Wait for the expectations of a step, returns the ones not met
+static uint8_t evaluateTestStep(TestStep_t const& step, uint32_t railcom_base, TestProbe_t& probe,
+                                uint32_t& response_ms)
+{
+  uint32_t const start = HAL_GetTick();
+  bool const hold = (step.expect & TEST_EXPECT_HOLD) != 0u;
+  while (true) {
+    TestCase_Probe(&probe);
+    uint8_t failed = TestCase_Check(&step, &probe, railcom_base);
+    if ((step.expect & TEST_EXPECT_ACK) && !analog_ack_detected(nullptr)) {
+      failed |= TEST_EXPECT_ACK;
+    }
+    uint32_t const elapsed = HAL_GetTick() - start;
+    if (hold ? failed != 0u : failed == 0u) {
+      response_ms = elapsed;
+      return failed;
+    }
+    if (elapsed >= step.timeout_ms || !commandStationRunning || programStopRequest.load(std::memory_order_acquire)) {
+      response_ms = elapsed;
+      return failed;
+    }
+    osDelay(1u);
+  }
 }
 
-CommandStation command_station;
+// Execute the loaded test list, one result record per test case
+static void runTestList(void)
+{
+  TestStep_t const* steps;
+  uint16_t const count = TestCase_Get(&steps);
+  TestResult_t result{};
+  TestProbe_t probe{};
+  uint32_t case_start = 0;
+  bool case_failed = false;
 
+  TestCase_RunStart();
+  programPacketsSent = 0;
+  printf("Test list started (%u steps)\n", static_cast<unsigned>(count));
 
+  for (uint16_t i = 0; i < count && commandStationRunning && !programStopRequest.load(std::memory_order_acquire); i++) {
+    TestStep_t const& step = steps[i];
+    programPc = i;
+    TestCase_RunStep(i);
+    if (i == 0u || step.test != steps[i - 1u].test) {
+      result = {};
+      result.test = step.test;
+      result.passed = true;
+      case_start = HAL_GetTick();
+      case_failed = false;
+    }
 
-/**
-  * @brief This function handles TIM2 global interrupt.
-  */
-extern "C" void TIM2_IRQHandler(void)
+    // The rest of a failed case is skipped
+    if (!case_failed) {
+      TestCase_Probe(&probe);
+      uint32_t const railcom_base = probe.railcom_frames;
+      if (!sendTestStep(step)) {
+        break;
+      }
+      programPacketsSent += step.length ? (step.repeat ? step.repeat : 1u) : 0u;
+      result.step = i;
+      if (step.expect & TEST_EXPECT_ALL) {
+        uint8_t const failed = evaluateTestStep(step, railcom_base, probe, result.response_ms);
+        result.current_ma = probe.current_ma;
+        result.io = probe.io;
+        if (step.expect & TEST_EXPECT_ACK) {
+          analog_ack_disarm();
+        }
+        if (failed) {
+          result.passed = false;
+          result.failed = failed;
+          case_failed = true;
+        }
+      }
+    }
+
+    if (i + 1u == count || steps[i + 1u].test != step.test) {
+      result.elapsed_ms = HAL_GetTick() - case_start;
+      TestCase_AddResult(&result);
+    }
+  }
+
+  TestRunStatus_t status;
+  TestCase_RunEnd();
+  TestCase_GetStatus(&status);
+  printf("Test list finished, %lu passed, %lu failed\n", static_cast<unsigned long>(status.passed),
+         static_cast<unsigned long>(status.failed));
+  programStopRequest.store(false, std::memory_order_release);
+  programRunning.store(false, std::memory_order_release);
+}
+
+// Send the command or the rest packets of the margin sweep, returns once they are on the track
+static bool sendMarginPackets(MarginSweepConfig_t const& config, bool active, uint16_t bit1_us, uint16_t bit0_us)
 {
+  uint8_t bytes[MARGIN_SWEEP_MAX_PACKET];
+  uint8_t const length = MarginSweep_Command(active, bytes);
+  for (uint16_t i = 0; i < config.packets; i++) {
+    if (!scheduleTimedPacket(bytes, length, config.gap_us, bit1_us, bit0_us)) {
+      return false;
+    }
+  }
+  programPacketsSent += config.packets;
+  while (!scheduledPacketQueue.empty()) {
+    if (!commandStationRunning) {
+      return false;
+    }
+    osDelay(1u);
+  }
+  return true;
+}
 
-  uint32_t itsource = htim2.Instance->DIER;
-  uint32_t itflag   = htim2.Instance->SR;
+// Wait up to timeout_ms for the decoder to respond (rest=false) or to be back at rest
+static bool waitMarginState(bool rest, uint32_t timeout_ms)
+{
+  TestProbe_t probe{};
+  uint32_t const start = HAL_GetTick();
+  while (true) {
+    TestCase_Probe(&probe);
+    if (rest ? MarginSweep_AtRest(&probe) : MarginSweep_Responded(&probe)) {
+      return true;
+    }
+    if (HAL_GetTick() - start >= timeout_ms || !commandStationRunning ||
+        programStopRequest.load(std::memory_order_acquire)) {
+      return false;
+    }
+    osDelay(1u);
+  }
+}
 
-  /* Capture compare 1 event */
-  if ((itflag & (TIM_FLAG_CC1)) == (TIM_FLAG_CC1))
-  {
-    if ((itsource & (TIM_IT_CC1)) == (TIM_IT_CC1))
-    {
-      {
-        __HAL_TIM_CLEAR_FLAG(&htim2, TIM_FLAG_CC1);
-        htim2.Channel = HAL_TIM_ACTIVE_CHANNEL_1;
-        htim2.Channel = HAL_TIM_ACTIVE_CHANNEL_CLEARED;
+static bool marginStopped(void)
+{
+  return !commandStationRunning || programStopRequest.load(std::memory_order_acquire);
+}
+
+// Binary search of the timing margins, one trial at a time
+static void runMarginSweep(void)
+{
+  MarginSweepConfig_t config;
+  MarginSweep_GetConfig(&config);
+  TxTiming const* const configured = txIsr.txTimingActive;
+  uint16_t const nominal_bit1 = configured->bit1_duration;
+  uint16_t const nominal_bit0 = configured->bit0_duration;
+  const char* error = nullptr;
+
+  programPc = 0;
+  programPacketsSent = 0;
+  printf("Margin sweep started (bit1 %u us, bit0 %u us)\n", static_cast<unsigned>(nominal_bit1),
+         static_cast<unsigned>(nominal_bit0));
+
+  // Rest current with the decoder at rest
+  TestProbe_t probe{};
+  if (sendMarginPackets(config, false, nominal_bit1, nominal_bit0)) {
+    osDelay(config.settle_ms);
+  }
+  TestCase_Probe(&probe);
+  MarginSweep_Start(nominal_bit1, nominal_bit0, probe.current_ma);
+
+  uint16_t bit1_us = 0;
+  uint16_t bit0_us = 0;
+  while (!marginStopped() && MarginSweep_Next(&bit1_us, &bit0_us)) {
+    if (!sendMarginPackets(config, true, bit1_us, bit0_us)) {
+      break;
+    }
+    bool const passed = waitMarginState(false, config.timeout_ms);
+    if (marginStopped() || !sendMarginPackets(config, false, nominal_bit1, nominal_bit0)) {
+      break;
+    }
+    if (!waitMarginState(true, config.settle_ms)) {
+      if (!marginStopped()) {
+        error = "decoder did not return to rest";
       }
+      break;
     }
+    MarginSweep_Report(passed);
+    programPc++;
   }
-  /* TIM Update event */
-  if ((itflag & (TIM_FLAG_UPDATE)) == (TIM_FLAG_UPDATE))
-  {
-    if ((itsource & (TIM_IT_UPDATE)) == (TIM_IT_UPDATE))
-    {
-      __HAL_TIM_CLEAR_FLAG(&htim2, TIM_FLAG_UPDATE);
-      auto arr{command_station.transmit()};
-      if ((zerobitOverrideMask & bitCountMask) != 0) {
-        if (arr >= DCC_TX_MIN_BIT_0_TIMING) {  // only adjust Zero bits
-          // Adjust zero bit by deltaP or deltaN based on current phase
-          arr = arr + (currentPhaseIsP ? zerobitDeltaP : zerobitDeltaN);
+  if (marginStopped()) {
+    error = "stopped";
+  }
+
+  MarginSweep_End(error);
+  // A stopped sweep may leave the decoder running
+  programStopRequest.store(false, std::memory_order_release);
+  if (commandStationRunning) {
+    sendMarginPackets(config, false, nominal_bit1, nominal_bit0);
+  }
+  MarginSweepStatus_t status;
+  MarginSweep_GetStatus(&status);
+  printf("Margin sweep finished after %lu trials%s%s\n", static_cast<unsigned long>(status.trials),
+         status.error ? ": " : "", status.error ? status.error : "");
+  programStopRequest.store(false, std::memory_order_release);
+  programRunning.store(false, std::memory_order_release);
+}
+
+static bool vmStopped(void)
+{
+  return !commandStationRunning || programStopRequest.load(std::memory_order_acquire);
+}
+
+// Transmissions of a SEND, through the library when the RailCom cutout is wanted
+static bool vmSend(PacketVmInstruction_t const& in, uint32_t gap_us)
+{
+  PacketVmPacket_t const& packet = vmPackets[in.a];
+  uint16_t const repeat = static_cast<uint16_t>(in.c + 1u);
+  if (in.b & PACKET_VM_SEND_RAILCOM) {
+    dcc::Packet libPacket{};
+    for (uint8_t i = 0; i < packet.length; i++) {
+      libPacket.push_back(packet.bytes[i]);
+    }
+    for (uint16_t r = 0; r < repeat; r++) {
+      while (!command_station.packet(libPacket)) {
+        if (vmStopped()) {
+          return false;
         }
+        osDelay(1u);
       }
-      htim2.Instance->ARR = arr; // Set auto-reload register for next interrupt
+      programPacketsSent++;
+    }
+    return true;
+  }
+
+  if (in.b & PACKET_VM_SEND_ACK) {
+    analog_ack_disarm();
+  }
+  PacketTiming_t timing{};
+  for (uint16_t r = 0; r < repeat; r++) {
+    uint8_t flags = (in.b & PACKET_VM_SEND_TRIGGER) ? PACKET_PROGRAM_FLAG_TRIGGER : 0u;
+    if (r == 0u && (in.b & PACKET_VM_SEND_ACK)) {
+      flags |= PACKET_PROGRAM_FLAG_ACK;
+    }
+    if (!schedulePacket(packet.bytes, packet.length, gap_us + static_cast<uint32_t>(in.imm), flags, timing)) {
+      return false;
+    }
+    gap_us = 0;
+    programPacketsSent++;
+  }
+  return true;
+}
+
+// Until the scheduled packets are on the track, then us of idle time
+static bool vmWait(uint32_t us)
+{
+  while (!scheduledPacketQueue.empty()) {
+    if (vmStopped()) {
+      return false;
+    }
+    osDelay(1u);
+  }
+  uint32_t const start = HAL_GetTick();
+  while (HAL_GetTick() - start < us / 1000u) {
+    if (vmStopped()) {
+      return false;
+    }
+    osDelay(1u);
+  }
+  // The rest of a millisecond on the cycle counter
+  uint32_t const cycles = (us % 1000u) * (SystemCoreClock / 1000000u);
+  uint32_t const spin = DWT->CYCCNT;
+  while (DWT->CYCCNT - spin < cycles) {
+  }
+  return true;
+}
+
+static bool vmCondition(uint8_t cond, int32_t compare)
+{
+  switch (cond) {
+    case PACKET_VM_COND_EQ: return compare == 0;
+    case PACKET_VM_COND_NE: return compare != 0;
+    case PACKET_VM_COND_LT: return compare < 0;
+    case PACKET_VM_COND_LE: return compare <= 0;
+    case PACKET_VM_COND_GT: return compare > 0;
+    case PACKET_VM_COND_GE: return compare >= 0;
+    default: return true;
+  }
+}
+
+static int32_t vmCompare(int32_t left, int32_t right)
+{
+  return left < right ? -1 : (left > right ? 1 : 0);
+}
+
+// Register arithmetic wraps like the hardware does, without signed overflow
+static int32_t vmWrap(uint32_t value)
+{
+  return static_cast<int32_t>(value);
+}
+
+// Execute the loaded VM program until END, the last instruction, a stop request or command station stop.
+// PacketVm_Prepare verified every operand, the instructions are executed without further checks.
+static void runVmProgram(void)
+{
+  PacketVmInstruction_t const* code;
+  PacketVmPacket_t const* table;
+  uint16_t packetCount = 0;
+  uint16_t const count = PacketVm_Get(&code, &table, &packetCount);
+  std::memcpy(vmPackets, table, packetCount * sizeof(PacketVmPacket_t));
+
+  int32_t reg[PACKET_VM_REGISTERS] = {};
+  int32_t compare = 0;
+  int32_t exitCode = 0;
+  uint32_t const bit_us = 2u * txIsr.txTimingActive->bit1_duration;
+  uint32_t pending_gap_us = 0;
+  uint32_t executed = 0;
+  uint32_t yields = 0;
+  uint32_t slice = 0;
+  uint16_t pc = 0;
+
+  PacketVm_RunStart();
+  programPacketsSent = 0;
+  printf("VM program started (%u instructions)\n", static_cast<unsigned>(count));
+
+  while (pc < count && !vmStopped()) {
+    PacketVmInstruction_t const& in = code[pc];
+    uint16_t next = static_cast<uint16_t>(pc + 1u);
+    programPc = pc;
+    executed++;
+    slice++;
+
+    switch (in.op) {
+      case PACKET_VM_OP_END:
+        exitCode = in.imm;
+        next = count;
+        break;
+      case PACKET_VM_OP_SEND:
+        if (!vmSend(in, pending_gap_us)) {
+          next = count;
+        }
+        pending_gap_us = 0;
+        slice = 0;
+        break;
+      case PACKET_VM_OP_GAP:
+        pending_gap_us += static_cast<uint32_t>(in.imm) * bit_us;
+        slice = 0;
+        break;
+      case PACKET_VM_OP_WAIT:
+        if (!vmWait(static_cast<uint32_t>(in.imm) * bit_us)) {
+          next = count;
+        }
+        slice = 0;
+        break;
+      case PACKET_VM_OP_READ:
+        reg[in.a] = PacketVm_Read(in.b, programPacketsSent);
+        break;
+      case PACKET_VM_OP_LOAD:
+        reg[in.a] = in.imm;
+        break;
+      case PACKET_VM_OP_ADD:
+        reg[in.a] = vmWrap(static_cast<uint32_t>(reg[in.b]) + static_cast<uint32_t>(in.imm));
+        break;
+      case PACKET_VM_OP_ADDR:
+        reg[in.a] = vmWrap(static_cast<uint32_t>(reg[in.b]) + static_cast<uint32_t>(reg[in.c]));
+        break;
+      case PACKET_VM_OP_SUB:
+        reg[in.a] = vmWrap(static_cast<uint32_t>(reg[in.b]) - static_cast<uint32_t>(reg[in.c]));
+        break;
+      case PACKET_VM_OP_AND:
+        reg[in.a] = reg[in.b] & in.imm;
+        break;
+      case PACKET_VM_OP_SHR:
+        reg[in.a] = vmWrap(static_cast<uint32_t>(reg[in.b]) >> in.imm);
+        break;
+      case PACKET_VM_OP_CMP:
+        compare = vmCompare(reg[in.a], in.imm);
+        break;
+      case PACKET_VM_OP_CMPR:
+        compare = vmCompare(reg[in.a], reg[in.b]);
+        break;
+      case PACKET_VM_OP_BR:
+        if (vmCondition(in.a, compare)) {
+          next = static_cast<uint16_t>(in.imm);
+        }
+        break;
+      case PACKET_VM_OP_DJNZ:
+        reg[in.a] = vmWrap(static_cast<uint32_t>(reg[in.a]) - 1u);
+        if (reg[in.a] != 0) {
+          next = static_cast<uint16_t>(in.imm);
+        }
+        break;
+      case PACKET_VM_OP_PATCH: {
+        PacketVmPacket_t& packet = vmPackets[in.a];
+        packet.bytes[in.b] = static_cast<uint8_t>(reg[in.c]);
+        uint8_t checksum = 0;
+        for (uint8_t i = 0; i + 1u < packet.length; i++) {
+          checksum ^= packet.bytes[i];
+        }
+        packet.bytes[packet.length - 1u] = checksum;
+        break;
+      }
+      case PACKET_VM_OP_RECORD: {
+        PacketVmRecord_t record{};
+        record.pc = pc;
+        record.tag = in.a;
+        record.count = in.c;
+        record.tick_ms = HAL_GetTick();
+        std::memcpy(record.values, &reg[in.b], in.c * sizeof(int32_t));
+        PacketVm_AddRecord(&record);
+        break;
+      }
+      default:
+        next = count;
+        break;
+    }
+
+    // A loop without packets or waits polls once per millisecond
+    if (slice >= PACKET_VM_SLICE) {
+      osDelay(1u);
+      yields++;
+      slice = 0;
+    }
+    PacketVm_RunPc(pc, executed, yields);
+    pc = next;
+  }
+
+  bool const stopped = vmStopped();
+  analog_ack_disarm();
+  PacketVm_RunEnd(exitCode, stopped, reg);
+  printf("VM program finished, exit %ld, %lu instructions, %lu packets%s\n", static_cast<long>(exitCode),
+         static_cast<unsigned long>(executed), static_cast<unsigned long>(programPacketsSent),
+         stopped ? " (stopped)" : "");
+  programStopRequest.store(false, std::memory_order_release);
+  programRunning.store(false, std::memory_order_release);
+}
+
+// One direct mode verify: resets, verify packets, recovery resets, true if the decoder acknowledged
+static bool serviceVerify(uint8_t const (&bytes)[4], uint32_t& ack_delay_ms)
+{
+  static uint8_t const reset[3] = {0x00u, 0x00u, 0x00u};
+  PacketTiming_t timing{};
+  // Gap before each packet so that it gets the long service mode preamble
+  TxTiming const* const configured = txIsr.txTimingActive;
+  uint32_t const gap_us = SERVICE_MODE_PREAMBLE_BITS * (configured->half[TX_CLASS_ONE][0] + configured->half[TX_CLASS_ONE][1]);
+
+  for (uint32_t i = 0; i < SERVICE_MODE_RESET_PACKETS; i++) {
+    if (!schedulePacket(reset, sizeof(reset), gap_us, 0u, timing)) {
+      return false;
+    }
+  }
+  for (uint32_t i = 0; i < SERVICE_MODE_VERIFY_PACKETS; i++) {
+    if (!schedulePacket(bytes, sizeof(bytes), gap_us, i == 0u ? PACKET_PROGRAM_FLAG_ACK : 0u, timing)) {
+      return false;
+    }
+  }
+  for (uint32_t i = 0; i < SERVICE_MODE_RECOVERY_PACKETS; i++) {
+    if (!schedulePacket(reset, sizeof(reset), gap_us, 0u, timing)) {
+      return false;
+    }
+  }
+  // Transmission ends with the last recovery packet, give a pulse started in it time to qualify
+  while (!scheduledPacketQueue.empty() && commandStationRunning) {
+    osDelay(1u);
+  }
+  osDelay(ANALOG_ACK_MIN_MS + 1u);
+
+  bool const ack = analog_ack_detected(&ack_delay_ms);
+  analog_ack_disarm();
+  return ack;
+}
+
+// Verify packet of a direct mode instruction, cv is 1 based
+static void serviceVerifyPacket(uint8_t (&bytes)[4], uint8_t instruction, uint16_t cv, uint8_t data)
+{
+  uint16_t const address = static_cast<uint16_t>(cv - 1u);
+  bytes[0] = static_cast<uint8_t>(instruction | ((address >> 8) & 0x03u));
+  bytes[1] = static_cast<uint8_t>(address & 0xFFu);
+  bytes[2] = data;
+  bytes[3] = static_cast<uint8_t>(bytes[0] ^ bytes[1] ^ bytes[2]);
+}
+
+static void serviceVerifyByte(uint8_t (&bytes)[4], uint16_t cv, uint8_t value)
+{
+  serviceVerifyPacket(bytes, 0x74u, cv, value);  // 0111 01AA
+}
+
+static void serviceVerifyBit(uint8_t (&bytes)[4], uint16_t cv, uint8_t bit, uint8_t value)
+{
+  // 0111 10AA, data 111K DBBB with K=0 verify
+  serviceVerifyPacket(bytes, 0x78u, cv, static_cast<uint8_t>(0xE0u | ((value & 1u) << 3) | (bit & 0x07u)));
+}
+
+// Execute the requested service mode operation
+static void runServiceMode(void)
+{
+  ServiceModeRequest_t const& request = serviceRequest;
+  ServiceModeResult_t& result = serviceResult;
+  uint8_t bytes[4];
+  uint32_t const start = HAL_GetTick();
+
+  std::memset(&result, 0, sizeof(result));
+  switch (request.op) {
+    case SERVICE_MODE_VERIFY_BYTE:
+      serviceVerifyByte(bytes, request.cv, request.value);
+      result.ack = serviceVerify(bytes, result.ack_delay_ms);
+      result.verifies = 1u;
+      result.value = request.value;
+      break;
+    case SERVICE_MODE_VERIFY_BIT:
+      serviceVerifyBit(bytes, request.cv, request.bit, request.value);
+      result.ack = serviceVerify(bytes, result.ack_delay_ms);
+      result.verifies = 1u;
+      result.value = request.value;
+      break;
+    case SERVICE_MODE_READ_BYTE:
+    default: {
+      uint8_t value = 0;
+      for (uint8_t bit = 0; bit < 8u && commandStationRunning; bit++) {
+        serviceVerifyBit(bytes, request.cv, bit, 1u);
+        if (serviceVerify(bytes, result.ack_delay_ms)) {
+          value = static_cast<uint8_t>(value | (1u << bit));
+        }
+        result.verifies++;
+      }
+      // A missed ACK reads as a zero bit, the byte verify catches it
+      serviceVerifyByte(bytes, request.cv, value);
+      result.ack = serviceVerify(bytes, result.ack_delay_ms);
+      result.verifies++;
+      result.value = value;
+      break;
+    }
+  }
+  result.duration_ms = HAL_GetTick() - start;
+  TRACE_INFO("Service mode CV%u: value %u, ack %u, %lu ms\n", request.cv, result.value, result.ack ? 1u : 0u,
+             result.duration_ms);
+}
+
+// Refresh scheduler feed, loops 1, 3 and 4
+// The library queue is kept REFRESH_LOOKAHEAD packets ahead of the track, so a new command
+// waits for at most that many packets. Packets started beyond the ones handed over were idle
+// packets of an empty library queue and move the base forward.
+static constexpr uint32_t REFRESH_LOOKAHEAD = 2u;
+static uint32_t refreshHanded = 0;      // packets handed to the library since the loop started
+static uint32_t refreshSeqBase = 0;
+static uint8_t refreshBytes[REFRESH_PACKET_MAX];
+static uint8_t refreshLength = 0;       // packet taken from the scheduler, not yet accepted
+
+static void refreshFeedStart(void)
+{
+  refreshHanded = 0;
+  refreshSeqBase = txIsr.txPacketSeq;
+  refreshLength = 0;
+}
+
+static void refreshFeed(void)
+{
+  uint32_t const started = txIsr.txPacketSeq - refreshSeqBase;
+  if (started > refreshHanded) {
+    refreshSeqBase += started - refreshHanded;
+  }
+  while (refreshHanded - (txIsr.txPacketSeq - refreshSeqBase) < REFRESH_LOOKAHEAD) {
+    if (refreshLength == 0u) {
+      refreshLength = refresh_next(osKernelGetTickCount(), refreshBytes);
+      if (refreshLength == 0u) {
+        return;
+      }
+    }
+    dcc::Packet packet{};
+    for (uint8_t i = 0; i < refreshLength; i++) {
+      packet.push_back(refreshBytes[i]);
     }
+    if (!command_station.packet(packet)) {
+      return;
+    }
+    refreshLength = 0;
+    refreshHanded++;
   }
 }
 
+// Wait ms while the refresh scheduler fills the track
+static void refreshDelay(uint32_t ms)
+{
+  uint32_t const start = osKernelGetTickCount();
+  do {
+    refreshFeed();
+    osDelay(1u);
+  } while (commandStationRunning && osKernelGetTickCount() - start < ms);
+}
+
 void CommandStationThread(void *argument) {
   (void)argument;  // Unused parameter
 
@@ -129,17 +2201,21 @@ void CommandStationThread(void *argument) {
   uint8_t bit1_duration = 0;
   uint8_t bit0_duration = 0;
   uint8_t bidi = false;
+  uint8_t dma_transmit = false;
 
   while (true) {
     // Block until externally started
     osSemaphoreAcquire(commandStationStart_sem, osWaitForever);
+    osEventFlagsClear(commandStationEvents, CS_EVENT_ALL);
+    power_idle_hold(POWER_IDLE_HOLD_COMMAND_STATION, true);
 
     get_dcc_preamble_bits(&preamble_bits);
     get_dcc_bit1_duration(&bit1_duration);
     get_dcc_bit0_duration(&bit0_duration);
     get_dcc_bidi_enable(&bidi);
     get_dcc_bidi_dac(&dac_value);
-    get_dcc_trigger_first_bit(&trigger_first_bit);
+    get_dcc_trigger_first_bit(&txIsr.trigger_first_bit);
+    get_dcc_dma_transmit(&dma_transmit);
 
     // Initialize DCC Command Station
     if (bidi) {
@@ -157,11 +2233,46 @@ void CommandStationThread(void *argument) {
       .bit0_duration = bit0_duration,
       .flags = {.bidi = static_cast<bool>(bidi)},
     });
+    txVariantSelect(txVariantFor(bidi));
 
-  // Enable update interrupt
-    __HAL_TIM_ENABLE_IT(&htim2, TIM_IT_UPDATE);
-    HAL_TIM_PWM_Start_IT(&htim2, TIM_CHANNEL_1);
+    txIsr.txSchedState = TxSchedState::Idle;
+    txIsr.txSchedOneRun = 0;
+    txIsr.txSchedSecondHalf = false;
+    txIsr.txSchedBiDiCutout = false;
+    txIsr.txPacketSeq = 0;
+    txIsr.txStartBit = false;
+    txIsr.scopeFire = false;
+    txIsr.scopeHalfBits = 0;
+    SCOPE_GPIO_Port->BSRR = static_cast<uint32_t>(SCOPE_Pin) << 16u;
+    railcom_reset();
+    txTimingStart(preamble_bits, bit1_duration, bit0_duration);
+    packetCacheClear();
+    packetCacheHits = 0;
+    packetCacheMisses = 0;
+
+    // The BiDi cutout is timed by callbacks from transmit(), which would fire early while
+    // pre-rendering, so BiDi always uses the interrupt driven path
+    dmaTransmitActive = false;
+    if (dma_transmit && !bidi) {
+      dmaTransmitActive = dmaTransmitStart();
+      if (!dmaTransmitActive) {
+        printf("DMA transmit setup failed, using interrupt driven transmit\n");
+        dmaTransmitStop();
+      }
+    }
+    else if (dma_transmit) {
+      printf("DMA transmit not available with BiDi, using interrupt driven transmit\n");
+    }
+
+    if (!dmaTransmitActive) {
+      // TIM2 runs on the undivided core clock, a tick is PSC + 1 cycles
+      edge_timing_start(htim2.Instance->PSC + 1u);
+      // Enable update interrupt
+      __HAL_TIM_ENABLE_IT(&htim2, TIM_IT_UPDATE);
+      HAL_TIM_PWM_Start_IT(&htim2, TIM_CHANNEL_1);
+    }
     commandStationRunning = true;
+    refreshFeedStart();
     dcc::Packet packet{};
 
     osDelay(100u);  // Short delay to ensure everything is set up and running
@@ -170,30 +2281,38 @@ void CommandStationThread(void *argument) {
     if (commandStationLoop == 0) {
       printf("Command station started in custom packet mode\n");
       while (commandStationRunning) {
-        if (customPacketTrigger && customPacketQueueCount > 0) {
-          uint32_t total_packets = customPacketQueueCount;
-          uint32_t sent_packets = 0;
-          for (uint8_t index = 0; index < customPacketQueueCount; index++) {
-            const dcc::Packet& packet = customPacketQueue[index];
-            command_station.packet(packet);
-            sent_packets++;
-            printf("Custom packet transmitted [%lu/%lu] (packet %u/%u): ",
-                   static_cast<unsigned long>(sent_packets),
-                   static_cast<unsigned long>(total_packets),
-                   static_cast<unsigned>(index + 1),
-                   static_cast<unsigned>(customPacketQueueCount));
-            for (size_t j = 0; j < packet.size(); j++) {
-              printf("0x%02X ", packet[j]);
-            }
-            printf("lastIdlePacketCount: %u\n", command_station.lastIdlePacketCount());
-            printf("\n");
-            if (sent_packets < total_packets && customInterPacketDelay > 0) {
-              osDelay(customInterPacketDelay);
-            }
-          }
-          customPacketTrigger = false;
+        uint32_t const events = osEventFlagsWait(commandStationEvents, CS_EVENT_ALL, osFlagsWaitAny, osWaitForever);
+        if (events & osFlagsError) {
+          continue;
+        }
+        if (programRunRequest.exchange(false, std::memory_order_acq_rel)) {
+          runPacketProgram();
+        }
+        if (suiteRunRequest.exchange(false, std::memory_order_acq_rel)) {
+          runPacketSuite();
+        }
+        if (fuzzRunRequest.exchange(false, std::memory_order_acq_rel)) {
+          runFuzzer();
+        }
+        if (accessoryRunRequest.exchange(false, std::memory_order_acq_rel)) {
+          runAccessorySequence();
+        }
+        if (testRunRequest.exchange(false, std::memory_order_acq_rel)) {
+          runTestList();
+        }
+        if (marginRunRequest.exchange(false, std::memory_order_acq_rel)) {
+          runMarginSweep();
+        }
+        if (vmRunRequest.exchange(false, std::memory_order_acq_rel)) {
+          runVmProgram();
+        }
+        if (serviceRequestPending.exchange(false, std::memory_order_acq_rel)) {
+          runServiceMode();
+          osSemaphoreRelease(serviceDone_sem);
+        }
+        if (customPacketTrigger.load(std::memory_order_acquire)) {
+          transmitCustomPackets();
         }
-        osDelay(100u);
       }
     }
     else if (commandStationLoop == 1) {
@@ -201,30 +2320,26 @@ void CommandStationThread(void *argument) {
       // Test loop1: Basic function and speed control (address 3)
       printf("Starting test loop1: Basic function and speed control (address 3)\n");
 
-      printf("Loop1: stop\n");
+      TRACE_INFO("Loop1: stop\n");
       // required to set direction for some decoders 
       // (those that don't use the direction bit in the speed step packet but instead infer direction from speed 0 vs nonzero)
-      packet = dcc::make_128_speed_step_control_packet(3u, 0u);
-      command_station.packet(packet);
-      osDelay(100u);
+      refresh_set_speed(3u, 0u);
+      refreshDelay(100u);
       // Set function F0
-      printf("Loop1: set function F0 Headlight\n");
-      packet = dcc::make_f0_f4_packet(3u, 0b0'0001u);
-      command_station.packet(packet);
-      osDelay(100u);
+      TRACE_INFO("Loop1: set function F0 Headlight\n");
+      refresh_set_functions(3u, 0b0'0001u);
+      refreshDelay(100u);
       while (commandStationRunning) {
 
         // Accelerate forward
-        printf("Loop1: accelerate to speed step 42 forward\n");
-        packet = dcc::make_128_speed_step_control_packet(3u, 1u << 7u | 42u);
-        command_station.packet(packet);
-        osDelay(3000u);
+        TRACE_INFO("Loop1: accelerate to speed step 42 forward\n");
+        refresh_set_speed(3u, 1u << 7u | 42u);
+        refreshDelay(3000u);
 
         // Stop
-        printf("Loop1: stop (forward)\n");
+        TRACE_INFO("Loop1: stop (forward)\n");
 //printf("1 LastIdlePacketCount: %u\n", command_station.lastIdlePacketCount());
-        packet = dcc::make_128_speed_step_control_packet(3u, 1u << 7u | 0u);
-        command_station.packet(packet);
+        refresh_set_speed(3u, 1u << 7u | 0u);
 // note: last idle packet count is only updated after a full packet transmission
 // NOT immediately after command_station.packet() call! 
 // So it may still show the previous value here.
@@ -233,19 +2348,17 @@ void CommandStationThread(void *argument) {
 // lastIdlePacketCount should have updated by now
 //printf("3 LastIdlePacketCount: %u\n", command_station.lastIdlePacketCount());
 
-        osDelay(1000u);
+        refreshDelay(1000u);
 
         // Accelerate reverse
-        printf("Loop1: accelerate to speed step 42 reverse\n");
-        packet = dcc::make_128_speed_step_control_packet(3u, 42u);
-        command_station.packet(packet);
-        osDelay(3000u);
+        TRACE_INFO("Loop1: accelerate to speed step 42 reverse\n");
+        refresh_set_speed(3u, 42u);
+        refreshDelay(3000u);
 
         // Stop
-        printf("Loop1: stop (reverse)\n");
-        packet = dcc::make_128_speed_step_control_packet(3u, 0u);
-        command_station.packet(packet);
-        osDelay(1000u);
+        TRACE_INFO("Loop1: stop (reverse)\n");
+        refresh_set_speed(3u, 0u);
+        refreshDelay(1000u);
       }
     }
     else if (commandStationLoop == 2) {
@@ -253,7 +2366,7 @@ void CommandStationThread(void *argument) {
       printf("Starting test loop2: Packet Acceptance Test\n");
       BSP_LED_On(LED_GREEN);
       // Accelerate to speed 60 reverse
-      printf("Loop2: accelerate to speed 60 reverse\n");
+      TRACE_INFO("Loop2: accelerate to speed 60 reverse\n");
       for (uint8_t loop2_count = 0; loop2_count < 5; loop2_count++) {
         packet = dcc::make_128_speed_step_control_packet(3u, 60u);
         command_station.packet(packet);
@@ -263,11 +2376,11 @@ void CommandStationThread(void *argument) {
       // EMERGENCY STOP - Broadcast to all locomotives (address 0)
       packet = dcc::make_128_speed_step_control_packet(0u, 1u << 7u | 1u);  // Broadcast emergency stop
       command_station.packet(packet);
-      printf("Loop2: EMERGENCY STOP (broadcast)\n");
+      TRACE_INFO("Loop2: EMERGENCY STOP (broadcast)\n");
       osDelay(1000u);
       
       // Stop command station after test sequence
-      printf("Loop2: Test complete, stopping command station\n");
+      TRACE_INFO("Loop2: Test complete, stopping command station\n");
       BSP_LED_Off(LED_GREEN);
       commandStationRunning = false;
       
@@ -279,66 +2392,95 @@ void CommandStationThread(void *argument) {
         // Ramp up speed forward
         for (uint8_t speed = 0; speed <= 126 && commandStationRunning; speed += 10) {
           BSP_LED_Toggle(LED_GREEN);
-          packet = dcc::make_128_speed_step_control_packet(3u, 1u << 7u | speed);
-          command_station.packet(packet);
-          printf("Loop3: speed step %d forward\n", speed);
-          osDelay(500u);
+          refresh_set_speed(3u, 1u << 7u | speed);
+          TRACE_INFO("Loop3: speed step %d forward\n", speed);
+          refreshDelay(500u);
         }
 
-        osDelay(1000u);
+        refreshDelay(1000u);
 
         // Ramp down speed forward
         for (int8_t speed = 126; speed >= 0 && commandStationRunning; speed -= 10) {
           BSP_LED_Toggle(LED_GREEN);
-          packet = dcc::make_128_speed_step_control_packet(3u, 1u << 7u | speed);
-          command_station.packet(packet);
-          printf("Loop3: speed step %d forward\n", speed);
-          osDelay(500u);
+          refresh_set_speed(3u, 1u << 7u | speed);
+          TRACE_INFO("Loop3: speed step %d forward\n", speed);
+          refreshDelay(500u);
         }
 
-        osDelay(1000u);
+        refreshDelay(1000u);
 
         // Ramp up speed reverse
         for (uint8_t speed = 0; speed <= 126 && commandStationRunning; speed += 10) {
           BSP_LED_Toggle(LED_GREEN);
-          packet = dcc::make_128_speed_step_control_packet(3u, speed);
-          command_station.packet(packet);
-          printf("Loop3: speed step %d reverse\n", speed);
-          osDelay(500u);
+          refresh_set_speed(3u, speed);
+          TRACE_INFO("Loop3: speed step %d reverse\n", speed);
+          refreshDelay(500u);
         }
 
-        osDelay(1000u);
+        refreshDelay(1000u);
 
         // Ramp down speed reverse
         for (int8_t speed = 126; speed >= 0 && commandStationRunning; speed -= 10) {
           BSP_LED_Toggle(LED_GREEN);
-          packet = dcc::make_128_speed_step_control_packet(3u, speed);
-          command_station.packet(packet);
-          printf("Loop3: speed step %d reverse\n", speed);
-          osDelay(500u);
+          refresh_set_speed(3u, speed);
+          TRACE_INFO("Loop3: speed step %d reverse\n", speed);
+          refreshDelay(500u);
         }
 
-        osDelay(2000u);
+        refreshDelay(2000u);
+      }
+    }
+    else if (commandStationLoop == 4) {
+      // Refresh only, addresses and commands come from the RPC thread
+      printf("Command station started in refresh mode\n");
+      while (commandStationRunning) {
+        refreshDelay(100u);
       }
     }
     else {
       // Wait until stopped
       while (commandStationRunning) {
-        //TODO: test for (RPC) commands via queue to send packets
-        osDelay(100u);
+        osEventFlagsWait(commandStationEvents, CS_EVENT_STOP, osFlagsWaitAny, osWaitForever);
       }
     }
-    HAL_TIM_PWM_Stop_IT(&htim2, TIM_CHANNEL_1);
-    __HAL_TIM_DISABLE_IT(&htim2, TIM_IT_UPDATE);
-    customPacketQueueCount = 0;
-    customPacketTrigger = false;
+    if (dmaTransmitActive) {
+      dmaTransmitStop();
+      dmaTransmitActive = false;
+    }
+    else {
+      HAL_TIM_PWM_Stop_IT(&htim2, TIM_CHANNEL_1);
+      __HAL_TIM_DISABLE_IT(&htim2, TIM_IT_UPDATE);
+      edge_timing_stop();
+    }
+    customPacketQueue.reset();
+    scheduledPacketQueue.reset();
+    txIsr.txSchedState = TxSchedState::Idle;
+    txIsr.txSchedTrigger = false;
+    // The transmit path is off, the next start selects the variant handler again
+    txRecord.state = COMMAND_STATION_RECORD_IDLE;
+    programRunRequest.store(false, std::memory_order_release);
+    suiteRunRequest.store(false, std::memory_order_release);
+    fuzzRunRequest.store(false, std::memory_order_release);
+    if (accessoryRunRequest.exchange(false, std::memory_order_acq_rel)) {
+      AccessorySequence_Finish();
+    }
+    testRunRequest.store(false, std::memory_order_release);
+    marginRunRequest.store(false, std::memory_order_release);
+    vmRunRequest.store(false, std::memory_order_release);
+    programStopRequest.store(false, std::memory_order_release);
+    programRunning.store(false, std::memory_order_release);
+    serviceRequestPending.store(false, std::memory_order_release);
+    analog_ack_disarm();
+    customPacketTrigger.store(false, std::memory_order_release);
+    customPacketStream.store(false, std::memory_order_release);
     
     // Keep semaphore acquired to prevent auto-restart
     // Explicit CommandStation_Start() call is required to run again
     osSemaphoreAcquire(commandStationStart_sem, 0); // Non-blocking acquire
     HAL_GPIO_WritePin(BR_ENABLE_GPIO_Port, BR_ENABLE_Pin, static_cast<GPIO_PinState>(GPIO_PIN_RESET));
+    power_idle_hold(POWER_IDLE_HOLD_COMMAND_STATION, false);
     printf("Command station stopped\n");
-    osDelay(5u);
+    osSemaphoreRelease(commandStationStopped_sem);
   }
 
 }
@@ -346,12 +2488,18 @@ void CommandStationThread(void *argument) {
 // Called at system init
 extern "C" void CommandStation_Init(void)
 {
-    commandStationStart_sem = osSemaphoreNew(1, 0, NULL);  // Start locked
+    commandStationStart_sem = osSemaphoreNew(1, 0, &commandStationStart_sem_attr);  // Start locked
+    commandStationStopped_sem = osSemaphoreNew(1, 0, &commandStationStopped_sem_attr);
+    commandStationEvents = osEventFlagsNew(&commandStationEvents_attr);
+    serviceDone_sem = osSemaphoreNew(1, 0, &serviceDone_sem_attr);
+    if (railcom_init() != 0) {
+      printf("RailCom receiver init failed\n");
+    }
     commandStationThread_id = osThreadNew(CommandStationThread, NULL, &cmdStationTask_attributes);
 }
 
 // Can be called from anywhere
-// loop: 0=custom packet, 1=loop1 (basic), 2=loop2 (functions), 3=loop3 (speed ramp)
+// loop: 0=custom packet, 1=loop1 (basic), 2=loop2 (functions), 3=loop3 (speed ramp), 4=refresh scheduler
 // Returns true if started, false if already running
 extern "C" bool CommandStation_Start(uint8_t loop)
 {
@@ -362,7 +2510,17 @@ extern "C" bool CommandStation_Start(uint8_t loop)
     zerobitOverrideMask = 0;
     zerobitDeltaP = 0;
     zerobitDeltaN = 0;
+    rebuildZerobitTable();
+
+    // Queue statistics cover one run
+    customPacketsTransmitted = 0;
+    customPacketUnderruns = 0;
     
+    // Drop the completion of a run that ended by itself (loop 2), so a stop waits for this run
+    osSemaphoreAcquire(commandStationStopped_sem, 0);
+
+    // A short circuit or overcurrent trip of the last run ends here
+    track_guard_clear();
     HAL_GPIO_WritePin(BR_ENABLE_GPIO_Port, BR_ENABLE_Pin, static_cast<GPIO_PinState>(GPIO_PIN_SET));   // Set BR_ENABLE high
     osSemaphoreRelease(commandStationStart_sem);
     printf("Command station started (loop=%d)\n", loop);
@@ -374,42 +2532,460 @@ extern "C" bool CommandStation_Start(uint8_t loop)
   }
 }
 
+// Producer side of a replace: a transmission in progress is cancelled first, the consumer drops
+// what is left of the queue and clears customPacketTrigger, then the queue is reset
+static bool replaceCustomPackets(void)
+{
+  if (customPacketTrigger.load(std::memory_order_acquire)) {
+    customPacketCancel.store(true, std::memory_order_release);
+    osEventFlagsSet(commandStationEvents, CS_EVENT_CANCEL);
+    uint32_t const start = osKernelGetTickCount();
+    while (customPacketTrigger.load(std::memory_order_acquire) &&
+           osKernelGetTickCount() - start < CS_CANCEL_TIMEOUT_MS) {
+      osDelay(1u);
+    }
+    customPacketCancel.store(false, std::memory_order_release);
+    osEventFlagsClear(commandStationEvents, CS_EVENT_CANCEL);
+    if (customPacketTrigger.load(std::memory_order_acquire)) {
+      return false;
+    }
+  }
+  customPacketQueue.reset();
+  return true;
+}
+
+// Producer side of the custom packet queue (RPC thread)
+// replace discards queued packets, a transmission in progress is cancelled first
 extern "C" bool CommandStation_LoadCustomPacket(const uint8_t* bytes, uint8_t length, bool replace) {
+  return CommandStation_LoadCustomPacketEx(bytes, length, replace, CUSTOM_PACKET_GAP_DEFAULT);
+}
+
+// gap_us is only used by scheduled transmission, CUSTOM_PACKET_GAP_DEFAULT uses the trigger gap
+extern "C" bool CommandStation_LoadCustomPacketEx(const uint8_t* bytes, uint8_t length, bool replace, uint32_t gap_us) {
+  return CommandStation_LoadCustomPacketTimed(bytes, length, replace, gap_us, nullptr);
+}
+
+// timing replaces the global zero bit override for this packet, nullptr uses the global override
+extern "C" bool CommandStation_LoadCustomPacketTimed(const uint8_t* bytes, uint8_t length, bool replace,
+                                                     uint32_t gap_us, const PacketTiming_t* timing) {
   if (!bytes || length == 0 || length > DCC_MAX_PACKET_SIZE) {
     return false;
   }
-  if (replace) {
-    customPacketQueueCount = 0;
-    customPacketTrigger = false;
-  }
-  if (customPacketQueueCount >= CUSTOM_PACKET_QUEUE_MAX) {
+  if (replace && !replaceCustomPackets()) {
     return false;
   }
 
-  dcc::Packet& packet = customPacketQueue[customPacketQueueCount];
-  packet.clear();
+  CustomPacket* entry = customPacketQueue.claim();
+  if (!entry) {
+    return false;
+  }
+  entry->packet.clear();
   for (uint8_t i = 0; i < length; i++) {
-    packet.push_back(bytes[i]);
+    entry->packet.push_back(bytes[i]);
+  }
+  entry->gap_us = gap_us;
+  entry->flags = 0;
+  if (timing) {
+    entry->flags = PACKET_PROGRAM_FLAG_OVERRIDE;
+    entry->timing = *timing;
   }
-  customPacketQueueCount++;
-  customPacketTrigger = false;
+  customPacketQueue.commit();
+  osEventFlagsSet(commandStationEvents, CS_EVENT_PACKET);
 
   return true;
 }
 
-extern "C" void CommandStation_TriggerTransmit(uint32_t delay_ms) {
-  if (customPacketQueueCount > 0) {
+// Byte sources of a bulk load: raw bytes, or two hex digits a byte
+struct BulkBytes {
+  uint8_t const* data;
+  uint32_t size;
+  uint32_t pos;
+
+  bool done() const { return pos >= size; }
+
+  bool next(uint8_t& byte) {
+    if (pos >= size) {
+      return false;
+    }
+    byte = data[pos++];
+    return true;
+  }
+};
+
+struct BulkHex {
+  uint8_t const* data;
+  uint32_t size;
+  uint32_t pos;
+
+  static int nibble(uint8_t c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+  }
+
+  bool done() const { return pos >= size; }
+
+  bool next(uint8_t& byte) {
+    if (size - pos < 2u) {
+      return false;
+    }
+    int const high = nibble(data[pos]);
+    int const low = nibble(data[pos + 1u]);
+    if (high < 0 || low < 0) {
+      return false;
+    }
+    byte = static_cast<uint8_t>((high << 4) | low);
+    pos += 2u;
+    return true;
+  }
+};
+
+// Decode the records straight into free queue slots and publish them together, so a batch
+// costs one pass over the input and is queued completely or not at all
+template<typename Source>
+static int loadCustomPackets(Source& source, bool replace, uint32_t gap_us, uint32_t* loaded)
+{
+  uint32_t count = 0;
+  *loaded = 0;
+  if (replace && !replaceCustomPackets()) {
+    return -3;
+  }
+
+  while (!source.done()) {
+    *loaded = count;
+    CustomPacket* entry = customPacketQueue.claim(count);
+    if (!entry) {
+      return -2;
+    }
+    uint8_t length = 0;
+    if (!source.next(length) || length == 0u || length > DCC_MAX_PACKET_SIZE) {
+      return -1;
+    }
+    entry->packet.clear();
+    for (uint8_t i = 0; i < length; i++) {
+      uint8_t byte;
+      if (!source.next(byte)) {
+        return -1;
+      }
+      entry->packet.push_back(byte);
+    }
+    entry->gap_us = gap_us;
+    entry->flags = 0;
+    count++;
+  }
+
+  *loaded = count;
+  if (count > 0u) {
+    customPacketQueue.commit(count);
+    osEventFlagsSet(commandStationEvents, CS_EVENT_PACKET);
+  }
+  return 0;
+}
+
+extern "C" int CommandStation_LoadCustomPackets(const uint8_t* data, uint32_t size, bool hex, bool replace,
+                                                uint32_t gap_us, uint32_t* loaded) {
+  uint32_t dummy;
+  if (!loaded) {
+    loaded = &dummy;
+  }
+  if (!data && size > 0u) {
+    *loaded = 0;
+    return -1;
+  }
+  if (hex) {
+    BulkHex source{data, size, 0u};
+    return loadCustomPackets(source, replace, gap_us, loaded);
+  }
+  BulkBytes source{data, size, 0u};
+  return loadCustomPackets(source, replace, gap_us, loaded);
+}
+
+static void triggerTransmit(uint32_t delay_ms, uint32_t gap_us, bool scheduled, bool stream) {
+  if (stream || !customPacketQueue.empty()) {
     customInterPacketDelay = delay_ms;
-    customPacketTrigger = true;
+    customInterPacketGapUs = gap_us;
+    customPacketScheduled.store(scheduled, std::memory_order_release);
+    customPacketStream.store(stream, std::memory_order_release);
+    customPacketTrigger.store(true, std::memory_order_release);
+    osEventFlagsSet(commandStationEvents, CS_EVENT_TRIGGER);
+  }
+  else if (customPacketTrigger.load(std::memory_order_acquire)) {
+    // End a running stream
+    customPacketStream.store(false, std::memory_order_release);
+    osEventFlagsSet(commandStationEvents, CS_EVENT_TRIGGER);
   }
 }
 
+extern "C" void CommandStation_TriggerTransmit(uint32_t delay_ms) {
+  triggerTransmit(delay_ms, 0, false, false);
+}
+
+// stream=true keeps the transmission armed so packets are sent as soon as they are loaded,
+// a later trigger with stream=false ends the stream once the queue has drained
+extern "C" void CommandStation_TriggerTransmitEx(uint32_t delay_ms, bool stream) {
+  triggerTransmit(delay_ms, 0, false, stream);
+}
+
+// Gaps between packets are timed by the transmit path to one bit time instead of osDelay
+extern "C" void CommandStation_TriggerTransmitScheduled(uint32_t gap_us, bool stream) {
+  triggerTransmit(0, gap_us, true, stream);
+}
+
 extern "C" bool CommandStation_IsCustomPacketQueueFull(void) {
-  return customPacketQueueCount >= CUSTOM_PACKET_QUEUE_MAX;
+  return customPacketQueue.full();
 }
 
 extern "C" uint8_t CommandStation_GetCustomPacketQueueCount(void) {
-  return customPacketQueueCount;
+  size_t const count = customPacketQueue.size();
+  return count > UINT8_MAX ? UINT8_MAX : static_cast<uint8_t>(count);
+}
+
+extern "C" void CommandStation_GetCustomPacketQueueStats(CommandStationQueueStats_t* stats) {
+  if (!stats) {
+    return;
+  }
+  stats->count = static_cast<uint32_t>(customPacketQueue.size());
+  stats->capacity = static_cast<uint32_t>(customPacketQueue.capacity());
+  stats->high_water = customPacketQueue.highWater();
+  stats->underruns = customPacketUnderruns;
+  stats->transmitted = customPacketsTransmitted;
+  stats->streaming = customPacketStream.load(std::memory_order_acquire);
+  stats->cache_hits = packetCacheHits;
+  stats->cache_misses = packetCacheMisses;
+}
+
+extern "C" bool CommandStation_RunProgram(const char** error) {
+  const char* dummy;
+  if (!error) {
+    error = &dummy;
+  }
+  if (!commandStationRunning || commandStationLoop != 0) {
+    *error = "command station must be running with loop=0";
+    return false;
+  }
+  if (programRunning.load(std::memory_order_acquire)) {
+    *error = "program already running";
+    return false;
+  }
+  if (PacketProgram_Prepare(error) != 0) {
+    return false;
+  }
+  programStopRequest.store(false, std::memory_order_release);
+  programRunning.store(true, std::memory_order_release);
+  programRunRequest.store(true, std::memory_order_release);
+  osEventFlagsSet(commandStationEvents, CS_EVENT_PROGRAM);
+  return true;
+}
+
+extern "C" bool CommandStation_RunSuite(uint8_t profile, uint32_t loops, const char** error) {
+  const char* dummy;
+  if (!error) {
+    error = &dummy;
+  }
+  if (!commandStationRunning || commandStationLoop != 0) {
+    *error = "command station must be running with loop=0";
+    return false;
+  }
+  if (programRunning.load(std::memory_order_acquire)) {
+    *error = "program already running";
+    return false;
+  }
+  if (profile >= PACKET_TIMING_PROFILE_COUNT) {
+    *error = "unknown timing profile";
+    return false;
+  }
+  PacketSuiteStatus_t suite;
+  PacketSuite_GetStatus(&suite);
+  if (!suite.loaded) {
+    *error = "no packet suite loaded";
+    return false;
+  }
+  suiteProfile = profile;
+  suiteLoops = loops;
+  programStopRequest.store(false, std::memory_order_release);
+  programRunning.store(true, std::memory_order_release);
+  suiteRunRequest.store(true, std::memory_order_release);
+  osEventFlagsSet(commandStationEvents, CS_EVENT_PROGRAM);
+  return true;
+}
+
+extern "C" bool CommandStation_RunFuzzer(const char** error) {
+  const char* dummy;
+  if (!error) {
+    error = &dummy;
+  }
+  if (!commandStationRunning || commandStationLoop != 0) {
+    *error = "command station must be running with loop=0";
+    return false;
+  }
+  if (programRunning.load(std::memory_order_acquire)) {
+    *error = "program already running";
+    return false;
+  }
+  programStopRequest.store(false, std::memory_order_release);
+  programRunning.store(true, std::memory_order_release);
+  fuzzRunRequest.store(true, std::memory_order_release);
+  osEventFlagsSet(commandStationEvents, CS_EVENT_PROGRAM);
+  return true;
+}
+
+extern "C" bool CommandStation_RunAccessorySequence(uint16_t* conflicts, const char** error) {
+  const char* dummy;
+  if (!error) {
+    error = &dummy;
+  }
+  if (conflicts) {
+    *conflicts = 0;
+  }
+  if (!commandStationRunning || commandStationLoop != 0) {
+    *error = "command station must be running with loop=0";
+    return false;
+  }
+  if (programRunning.load(std::memory_order_acquire)) {
+    *error = "program already running";
+    return false;
+  }
+  if (AccessorySequence_Prepare(conflicts, error) != 0) {
+    return false;
+  }
+  programStopRequest.store(false, std::memory_order_release);
+  programRunning.store(true, std::memory_order_release);
+  accessoryRunRequest.store(true, std::memory_order_release);
+  osEventFlagsSet(commandStationEvents, CS_EVENT_PROGRAM);
+  return true;
+}
+
+extern "C" bool CommandStation_RunTests(const char** error) {
+  const char* dummy;
+  if (!error) {
+    error = &dummy;
+  }
+  if (!commandStationRunning || commandStationLoop != 0) {
+    *error = "command station must be running with loop=0";
+    return false;
+  }
+  if (programRunning.load(std::memory_order_acquire)) {
+    *error = "program already running";
+    return false;
+  }
+  if (TestCase_Prepare(error) != 0) {
+    return false;
+  }
+  programStopRequest.store(false, std::memory_order_release);
+  programRunning.store(true, std::memory_order_release);
+  testRunRequest.store(true, std::memory_order_release);
+  osEventFlagsSet(commandStationEvents, CS_EVENT_PROGRAM);
+  return true;
+}
+
+extern "C" bool CommandStation_RunMarginSweep(const char** error) {
+  const char* dummy;
+  if (!error) {
+    error = &dummy;
+  }
+  if (!commandStationRunning || commandStationLoop != 0) {
+    *error = "command station must be running with loop=0";
+    return false;
+  }
+  if (programRunning.load(std::memory_order_acquire)) {
+    *error = "program already running";
+    return false;
+  }
+  if (MarginSweep_Prepare(error) != 0) {
+    return false;
+  }
+  programStopRequest.store(false, std::memory_order_release);
+  programRunning.store(true, std::memory_order_release);
+  marginRunRequest.store(true, std::memory_order_release);
+  osEventFlagsSet(commandStationEvents, CS_EVENT_PROGRAM);
+  return true;
+}
+
+extern "C" bool CommandStation_RunVm(const char** error, uint16_t* pc) {
+  const char* dummy;
+  if (!error) {
+    error = &dummy;
+  }
+  if (!commandStationRunning || commandStationLoop != 0) {
+    *error = "command station must be running with loop=0";
+    return false;
+  }
+  if (programRunning.load(std::memory_order_acquire)) {
+    *error = "program already running";
+    return false;
+  }
+  if (PacketVm_Prepare(error, pc) != 0) {
+    return false;
+  }
+  programStopRequest.store(false, std::memory_order_release);
+  programRunning.store(true, std::memory_order_release);
+  vmRunRequest.store(true, std::memory_order_release);
+  osEventFlagsSet(commandStationEvents, CS_EVENT_PROGRAM);
+  return true;
+}
+
+extern "C" bool CommandStation_ServiceMode(const ServiceModeRequest_t* request, ServiceModeResult_t* result,
+                                           const char** error) {
+  const char* dummy;
+  if (!error) {
+    error = &dummy;
+  }
+  if (!request || !result) {
+    *error = "invalid arguments";
+    return false;
+  }
+  if (request->cv < 1u || request->cv > 1024u || request->bit > 7u ||
+      (request->op == SERVICE_MODE_VERIFY_BIT && request->value > 1u) || request->op > SERVICE_MODE_VERIFY_BIT) {
+    *error = "invalid request";
+    return false;
+  }
+  if (!commandStationRunning || commandStationLoop != 0) {
+    *error = "command station must be running with loop=0";
+    return false;
+  }
+  if (!analog_manager_is_streaming()) {
+    *error = "ACK detection requires continuous analog sampling";
+    return false;
+  }
+  if (programRunning.load(std::memory_order_acquire) || customPacketTrigger.load(std::memory_order_acquire)) {
+    *error = "packet transmission in progress";
+    return false;
+  }
+  if (serviceBusy.exchange(true, std::memory_order_acq_rel)) {
+    *error = "service mode operation in progress";
+    return false;
+  }
+
+  osSemaphoreAcquire(serviceDone_sem, 0);  // Drop a completion left by a timed out request
+  serviceRequest = *request;
+  serviceRequestPending.store(true, std::memory_order_release);
+  osEventFlagsSet(commandStationEvents, CS_EVENT_SERVICE);
+  bool const done = osSemaphoreAcquire(serviceDone_sem, SERVICE_MODE_TIMEOUT_MS) == osOK;
+  if (done) {
+    *result = serviceResult;
+  }
+  else {
+    *error = "service mode timeout";
+  }
+  serviceBusy.store(false, std::memory_order_release);
+  return done;
+}
+
+extern "C" void CommandStation_StopProgram(void) {
+  if (programRunning.load(std::memory_order_acquire)) {
+    programStopRequest.store(true, std::memory_order_release);
+  }
+}
+
+extern "C" void CommandStation_GetProgramStatus(PacketProgramStatus_t* status) {
+  if (!status) {
+    return;
+  }
+  status->entries = PacketProgram_Get(nullptr);
+  status->running = programRunning.load(std::memory_order_acquire);
+  status->pc = programPc;
+  status->packets_sent = programPacketsSent;
 }
 
 // Can be called from anywhere
@@ -419,11 +2995,9 @@ extern "C" bool CommandStation_Stop(void)
   if (commandStationRunning) {
     printf("Command station stopping\n");
     commandStationRunning = false;
-    // Brief delay to allow any pending responses to be sent
-    osDelay(10);
-    // Wait for thread to finish cleanup (it acquires the semaphore when done)
-    // Use timeout to avoid blocking forever
-    osStatus_t status = osSemaphoreAcquire(commandStationStart_sem, 1000);
+    osEventFlagsSet(commandStationEvents, CS_EVENT_STOP);
+    // Returns once the thread has cleaned up, the track is off and the queues are empty
+    osStatus_t status = osSemaphoreAcquire(commandStationStopped_sem, CS_STOP_TIMEOUT_MS);
     if (status != osOK) {
       printf("WARNING: Command station stop semaphore timeout\n");
     }
@@ -435,6 +3009,29 @@ extern "C" bool CommandStation_Stop(void)
   }
 }
 
+extern "C" uint32_t CommandStation_GetPacketSeq(void)
+{
+  return txIsr.txPacketSeq;
+}
+
+extern "C" void CommandStation_SetPacketHook(CommandStationHookSlot_t slot, CommandStationPacketHook hook)
+{
+  if (slot >= COMMAND_STATION_HOOK_COUNT) {
+    return;
+  }
+  // The framer only runs with a hook, the first one restarts it in the preamble hunt
+  if (!txIsr.txPacketHooked) {
+    txLog = {};
+  }
+  txPacketHooks[slot] = hook;
+  bool hooked = false;
+  for (uint32_t h = 0; h < COMMAND_STATION_HOOK_COUNT; h++) {
+    hooked = hooked || txPacketHooks[h] != nullptr;
+  }
+  std::atomic_signal_fence(std::memory_order_seq_cst);
+  txIsr.txPacketHooked = hooked;
+}
+
 // Can be called from anywhere
 extern "C" bool CommandStation_bidi_Threshold(uint16_t threshold)
 {
@@ -451,9 +3048,193 @@ extern "C" bool CommandStation_bidi_Threshold(uint16_t threshold)
 }
 
 // Getter/Setter functions for RAM-only override parameters
+extern "C" void CommandStation_SetScopeTrigger(const ScopeTrigger_t* trigger)
+{
+  // The transmit path reads none of the fields while the condition is off
+  txIsr.scopeCondition = SCOPE_TRIGGER_OFF;
+  CommandStation_SetPacketHook(COMMAND_STATION_HOOK_SCOPE, nullptr);
+  std::atomic_signal_fence(std::memory_order_seq_cst);
+
+  uint8_t const condition = trigger->condition < SCOPE_TRIGGER_COUNT ? trigger->condition : SCOPE_TRIGGER_OFF;
+  scopeTrigger = *trigger;
+  scopeTrigger.condition = condition;
+  scopeTrigger.width_bits = trigger->width_bits ? trigger->width_bits : 1u;
+  if (scopeTrigger.match_length > SCOPE_TRIGGER_MAX_MATCH) {
+    scopeTrigger.match_length = SCOPE_TRIGGER_MAX_MATCH;
+  }
+  scopeFired = 0;
+  scopeLastSeq = 0;
+  txIsr.scopeFire = false;
+  if (condition == SCOPE_TRIGGER_MATCH) {
+    CommandStation_SetPacketHook(COMMAND_STATION_HOOK_SCOPE, scopeMatchHook);
+  }
+  std::atomic_signal_fence(std::memory_order_seq_cst);
+  if (condition != SCOPE_TRIGGER_OFF) {
+    txVariantAdd(TX_VARIANT_SCOPE);
+  }
+  txIsr.scopeCondition = condition;
+}
+
+extern "C" void CommandStation_GetScopeTrigger(ScopeTrigger_t* trigger, ScopeTriggerStatus_t* status)
+{
+  *trigger = scopeTrigger;
+  // A single shot trigger is off once it fired
+  trigger->condition = txIsr.scopeCondition;
+  status->fired = scopeFired;
+  status->last_packet_seq = scopeLastSeq;
+}
+
+extern "C" const char* CommandStation_ScopeTriggerName(ScopeTriggerCondition_t condition)
+{
+  return static_cast<uint32_t>(condition) < SCOPE_TRIGGER_COUNT ? kScopeTriggerNames[condition] : "?";
+}
+
+extern "C" bool CommandStation_RecordStart(const char** error)
+{
+  const char* message = nullptr;
+  uint32_t const primask = __get_PRIMASK();
+  __disable_irq();
+  if (!commandStationRunning) {
+    message = "command station not running";
+  }
+  else if (txHandler.variant & TX_VARIANT_BIDI) {
+    message = "recording needs BiDi off";
+  }
+  else if (txRecord.state != COMMAND_STATION_RECORD_IDLE) {
+    message = "recording or replay active";
+  }
+  else {
+    txRecord.full = false;
+    txRecord.length = 0;
+    txRecord.halfBits = 0;
+    txRecord.durationUs = 0;
+    txRecord.ones = 0;
+    txRecord.boundaryLevel = txIsr.currentPhaseIsP;
+    txRecord.state = COMMAND_STATION_RECORD_ARMED;
+    txHandler.nextHalfBit = txRecordHalfBit;
+  }
+  __set_PRIMASK(primask);
+  if (message && error) {
+    *error = message;
+  }
+  return message == nullptr;
+}
+
+extern "C" bool CommandStation_ReplayStart(uint32_t passes, const char** error)
+{
+  const char* message = nullptr;
+  uint32_t const primask = __get_PRIMASK();
+  __disable_irq();
+  if (!commandStationRunning) {
+    message = "command station not running";
+  }
+  else if (txRecord.state != COMMAND_STATION_RECORD_IDLE) {
+    message = "recording or replay active";
+  }
+  else if (txRecord.length == 0u) {
+    message = "nothing recorded";
+  }
+  else {
+    txRecord.passes = passes;
+    txRecord.pass = 0;
+    txRecord.entry = 0;
+    txRecord.ones = 0;
+    txRecord.boundaryLevel = txIsr.currentPhaseIsP;
+    txRecord.state = COMMAND_STATION_REPLAY_ARMED;
+    txHandler.nextHalfBit = txReplayHalfBit;
+  }
+  __set_PRIMASK(primask);
+  if (message && error) {
+    *error = message;
+  }
+  return message == nullptr;
+}
+
+extern "C" void CommandStation_RecordStop(void)
+{
+  uint32_t const primask = __get_PRIMASK();
+  __disable_irq();
+  switch (txRecord.state) {
+    case COMMAND_STATION_RECORD_ARMED:
+    case COMMAND_STATION_REPLAY_ARMED:
+      txRecordEnd();
+      break;
+    case COMMAND_STATION_RECORD_RECORDING:
+      txRecord.state = COMMAND_STATION_RECORD_STOPPING;
+      break;
+    case COMMAND_STATION_REPLAY_RUNNING:
+      txRecord.state = COMMAND_STATION_REPLAY_STOPPING;
+      break;
+    default:
+      break;
+  }
+  __set_PRIMASK(primask);
+}
+
+extern "C" void CommandStation_GetRecordStatus(CommandStationRecordStatus_t* status)
+{
+  uint32_t const primask = __get_PRIMASK();
+  __disable_irq();
+  status->state = txRecord.state;
+  status->full = txRecord.full;
+  status->entries = txRecord.length;
+  status->half_bits = txRecord.halfBits;
+  status->duration_us = txRecord.durationUs;
+  status->passes = txRecord.passes;
+  status->pass = txRecord.pass;
+  status->entry = txRecord.entry;
+  __set_PRIMASK(primask);
+}
+
+extern "C" const char* CommandStation_RecordStateName(CommandStationRecordState_t state)
+{
+  return static_cast<uint32_t>(state) < COMMAND_STATION_RECORD_STATE_COUNT ? kRecordStateNames[state] : "?";
+}
+
+extern "C" uint32_t CommandStation_RecordRead(uint32_t first, uint32_t* entries, uint32_t max)
+{
+  uint32_t const length = txRecord.length;
+  if (first >= length) {
+    return 0;
+  }
+  uint32_t const count = max < length - first ? max : length - first;
+  std::memcpy(entries, &txRecordEntries[first], count * sizeof(uint32_t));
+  return count;
+}
+
+extern "C" int CommandStation_RecordWrite(uint32_t first, const uint32_t* entries, uint32_t count)
+{
+  if (txRecord.state != COMMAND_STATION_RECORD_IDLE) {
+    return -1;
+  }
+  if ((first != 0u && first != txRecord.length) || count > COMMAND_STATION_RECORD_ENTRIES - first) {
+    return -2;
+  }
+  for (uint32_t i = 0; i < count; i++) {
+    if ((entries[i] & COMMAND_STATION_RECORD_DURATION) == 0u) {
+      return -2;
+    }
+  }
+
+  if (first == 0u) {
+    txRecord.full = false;
+    txRecord.halfBits = 0;
+    txRecord.durationUs = 0;
+  }
+  for (uint32_t i = 0; i < count; i++) {
+    uint32_t const halves = (entries[i] >> COMMAND_STATION_RECORD_REPEAT_SHIFT) + 1u;
+    txRecordEntries[first + i] = entries[i];
+    txRecord.halfBits += halves;
+    txRecord.durationUs += static_cast<uint64_t>(entries[i] & COMMAND_STATION_RECORD_DURATION) * halves;
+  }
+  txRecord.length = first + count;
+  return 0;
+}
+
 extern "C" void CommandStation_SetZerobitOverrideMask(uint64_t mask)
 {
   zerobitOverrideMask = mask;
+  rebuildZerobitTable();
 }
 
 extern "C" uint64_t CommandStation_GetZerobitOverrideMask(void)
@@ -464,6 +3245,7 @@ extern "C" uint64_t CommandStation_GetZerobitOverrideMask(void)
 extern "C" void CommandStation_SetZerobitDeltaP(int32_t delta)
 {
   zerobitDeltaP = delta;
+  rebuildZerobitTable();
 }
 
 extern "C" int32_t CommandStation_GetZerobitDeltaP(void)
@@ -474,9 +3256,121 @@ extern "C" int32_t CommandStation_GetZerobitDeltaP(void)
 extern "C" void CommandStation_SetZerobitDeltaN(int32_t delta)
 {
   zerobitDeltaN = delta;
+  rebuildZerobitTable();
 }
 
 extern "C" int32_t CommandStation_GetZerobitDeltaN(void)
 {
   return zerobitDeltaN;
 }
+
+// One caller at a time (RPC thread). The spare copy is only written while no update is pending,
+// the command station thread reading the one swapped out has the higher priority and never
+// blocks while encoding, so it is done with it before this runs again.
+extern "C" int CommandStation_UpdateTiming(uint8_t preamble_bits, uint8_t bit1_duration, uint8_t bit0_duration,
+                                           const char** error)
+{
+  const char* dummy;
+  if (error == nullptr) {
+    error = &dummy;
+  }
+  if (!commandStationRunning) {
+    *error = "command station not running";
+    return -2;
+  }
+  // The transmit path tells one and zero bits apart by duration
+  if (bit1_duration == 0u || bit1_duration >= DCC_TX_MIN_BIT_0_TIMING || bit0_duration < DCC_TX_MIN_BIT_0_TIMING) {
+    *error = "bit1_duration must be below and bit0_duration at least the minimum zero bit duration";
+    return -1;
+  }
+  if (preamble_bits < txLibPreamble) {
+    *error = "preamble_bits below the value the command station started with needs a restart";
+    return -1;
+  }
+
+  uint32_t start = osKernelGetTickCount();
+  while (txTimingPending.load(std::memory_order_acquire)) {
+    if (!commandStationRunning || osKernelGetTickCount() - start >= CS_TIMING_UPDATE_TIMEOUT_MS) {
+      *error = "previous timing update not taken";
+      return -3;
+    }
+    osDelay(1u);
+  }
+  TxTiming& spare = txIsr.txTimingActive == &txTiming[0] ? txTiming[1] : txTiming[0];
+  txTimingFill(spare, preamble_bits, bit1_duration, bit0_duration);
+  txTimingPending.store(true, std::memory_order_release);
+
+  // Packets loaded after the return are sent with the new timing
+  start = osKernelGetTickCount();
+  while (txTimingPending.load(std::memory_order_acquire)) {
+    if (!commandStationRunning || osKernelGetTickCount() - start >= CS_TIMING_UPDATE_TIMEOUT_MS) {
+      *error = "timing update not taken";
+      return -3;
+    }
+    osDelay(1u);
+  }
+  return 0;
+}
+
+#ifdef DCC_TESTER_BENCHMARK
+extern "C" bool CommandStation_BenchmarkTransmit(uint32_t calls, BenchmarkStats_t* transmit, BenchmarkStats_t* half_bit)
+{
+  if (commandStationRunning) {
+    return false;
+  }
+
+  uint8_t preamble_bits = 0;
+  uint8_t bit1_duration = 0;
+  uint8_t bit0_duration = 0;
+  get_dcc_preamble_bits(&preamble_bits);
+  get_dcc_bit1_duration(&bit1_duration);
+  get_dcc_bit0_duration(&bit0_duration);
+  command_station.init({
+    .num_preamble = preamble_bits,
+    .bit1_duration = bit1_duration,
+    .bit0_duration = bit0_duration,
+    .flags = {.bidi = false},
+  });
+  command_station.packet(dcc::make_128_speed_step_control_packet(3u, 1u << 7u | 42u));
+  // The variant a start without BiDi would run with the current scope and override settings
+  TxHalfBitHandler const half_bit_handler = kTxVariants[txVariantFor(false)];
+
+  txIsr.txSchedState = TxSchedState::Idle;
+  txIsr.txSchedOneRun = 0;
+  txIsr.txSchedSecondHalf = false;
+  txIsr.txSchedBiDiCutout = false;
+  txIsr.txPacketSeq = 0;
+  txTimingStart(preamble_bits, bit1_duration, bit0_duration);
+
+  // Same as rendering the DMA tables, trackOutputs() captures the levels instead of driving the pins,
+  // the packet hooks (recorder, response latency) do not see the benchmark packets
+  bool const hooked = txIsr.txPacketHooked;
+  txIsr.txPacketHooked = false;
+  txIsr.dmaRendering = true;
+  for (uint32_t i = 0; i < calls; i++) {
+    uint32_t const start = DWT->CYCCNT;
+    uint32_t volatile const arr{command_station.transmit()};
+    benchmark_stats_add(transmit, DWT->CYCCNT - start);
+    (void)arr;
+  }
+  for (uint32_t i = 0; i < calls; i++) {
+    uint32_t const start = DWT->CYCCNT;
+    uint32_t volatile const arr{half_bit_handler()};
+    benchmark_stats_add(half_bit, DWT->CYCCNT - start);
+    (void)arr;
+  }
+  txIsr.dmaRendering = false;
+  txLog = {};
+  txIsr.txPacketHooked = hooked;
+
+  // Leave nothing queued for the next start
+  command_station.init({
+    .num_preamble = preamble_bits,
+    .bit1_duration = bit1_duration,
+    .bit0_duration = bit0_duration,
+    .flags = {.bidi = false},
+  });
+  txIsr.txPacketSeq = 0;
+  return true;
+}
+#endif
@@ -0,0 +1,147 @@
+/**
+ * @file console_uart.c
+ * @brief Buffered DMA transmit for the USART3 console
+ *
+ * Writers are serialized by the lock in _write, the only other party is the
+ * transmit complete callback. A transfer covers the contiguous part of the ring
+ * from the tail, the callback releases it and starts the next one, so the
+ * writer only starts DMA when the channel is idle.
+ */
+
+#include "console_uart.h"
+#include "cmsis_os2.h"
+#include "main.h"
+#include <stdbool.h>
+#include <stdio.h>
+
+_Static_assert((CONSOLE_TX_BUFFER_SIZE & (CONSOLE_TX_BUFFER_SIZE - 1u)) == 0u, "ring index is masked");
+
+extern UART_HandleTypeDef huart3;
+
+static uint8_t g_ring[CONSOLE_TX_BUFFER_SIZE];
+static volatile uint32_t g_head = 0;       // written by the writer
+static volatile uint32_t g_tail = 0;       // written by the transmit complete callback
+static volatile uint32_t g_txLength = 0;   // bytes of the running transfer, 0 when idle
+static bool g_enabled = false;
+static uint32_t g_dropped = 0;             // dropped since the last marker
+
+// Called with the channel idle, from the writer or the callback
+static void tx_start(void)
+{
+    uint32_t const tail = g_tail;
+    uint32_t length = g_head - tail;
+    if (length == 0u) {
+        g_txLength = 0u;
+        return;
+    }
+    uint32_t const offset = tail & (CONSOLE_TX_BUFFER_SIZE - 1u);
+    if (length > CONSOLE_TX_BUFFER_SIZE - offset) {
+        length = CONSOLE_TX_BUFFER_SIZE - offset;
+    }
+    g_txLength = length;
+    if (HAL_UART_Transmit_DMA(&huart3, &g_ring[offset], (uint16_t)length) != HAL_OK) {
+        // Discard rather than stall the console forever
+        g_tail = tail + length;
+        g_txLength = 0u;
+    }
+}
+
+void HAL_UART_TxCpltCallback(UART_HandleTypeDef *huart)
+{
+    if (huart != &huart3) {
+        return;
+    }
+    g_tail = g_tail + g_txLength;
+    tx_start();
+}
+
+void HAL_UART_ErrorCallback(UART_HandleTypeDef *huart)
+{
+    if (huart != &huart3 || g_txLength == 0u || huart->gState != HAL_UART_STATE_READY) {
+        return;
+    }
+    // The transfer was aborted, drop it and carry on with the rest
+    g_tail = g_tail + g_txLength;
+    tx_start();
+}
+
+static bool may_wait(void)
+{
+    return __get_IPSR() == 0u && __get_PRIMASK() == 0u;
+}
+
+static uint32_t ring_free(void)
+{
+    return CONSOLE_TX_BUFFER_SIZE - (g_head - g_tail);
+}
+
+static void ring_copy(const char *data, uint32_t len)
+{
+    uint32_t head = g_head;
+    for (uint32_t i = 0; i < len; i++) {
+        g_ring[(head + i) & (CONSOLE_TX_BUFFER_SIZE - 1u)] = (uint8_t)data[i];
+    }
+    __DMB();
+    g_head = head + len;
+}
+
+static void tx_kick(void)
+{
+    // g_head is updated before this check, so a callback finishing in between
+    // either sees the new bytes or leaves the channel idle for this writer
+    if (g_txLength == 0u) {
+        tx_start();
+    }
+}
+
+int console_write(const char *data, int len)
+{
+    if (len <= 0) {
+        return 0;
+    }
+    if (!g_enabled) {
+        HAL_UART_Transmit(&huart3, (const uint8_t *)data, (uint16_t)len, HAL_MAX_DELAY);
+        return len;
+    }
+
+    bool const wait = CONSOLE_TX_OVERFLOW == CONSOLE_TX_OVERFLOW_BLOCK && may_wait();
+
+    if (g_dropped != 0u) {
+        char marker[48];
+        int const n = snprintf(marker, sizeof(marker), "\n[console: %lu bytes dropped]\n", (unsigned long)g_dropped);
+        if (n > 0 && (uint32_t)n <= ring_free()) {
+            ring_copy(marker, (uint32_t)n);
+            g_dropped = 0u;
+        }
+    }
+
+    uint32_t remaining = (uint32_t)len;
+    while (remaining > 0u) {
+        uint32_t chunk = ring_free();
+        if (chunk > remaining) {
+            chunk = remaining;
+        }
+        if (chunk > 0u) {
+            ring_copy(data, chunk);
+            data += chunk;
+            remaining -= chunk;
+            tx_kick();
+            continue;
+        }
+        if (!wait) {
+            g_dropped += remaining;
+            break;
+        }
+        if (osKernelGetState() == osKernelRunning) {
+            osDelay(1u);
+        }
+    }
+    return len;
+}
+
+void console_init(void)
+{
+    // CubeMX puts the console DMA at priority 0, above the DCC transmit timer
+    HAL_NVIC_SetPriority(GPDMA1_Channel0_IRQn, 8, 0);
+    g_enabled = true;
+}
@@ -1,66 +1,218 @@
 #include "decoder.hpp"
+#include "decoder.h"
+#include <algorithm>
 #include <climits>
 #include <cstdio>
 #include "cmsis_os2.h"
+#include "rtos_static.h"
 #include "main.h"
+#include "dma_channels.h"
+#include "sniffer.h"
+#include "loco_tracker.h"
+#include "edge_stats.h"
+#include "trace_log.h"
+#include "profiler.h"
+#include "fast_ram.h"
+#include "boot.h"
+#include "power_idle.h"
+#include "cv_store.hpp"
+
+extern "C" TIM_HandleTypeDef htim14;
+extern "C" UART_HandleTypeDef huart4;
 
 static osThreadId_t decoderThread_id;
 static osSemaphoreId_t decoderStart_sem;
+static osEventFlagsId_t decoderEvents;
+RTOS_SEMAPHORE(decoderStart_sem);
+RTOS_EVENT_FLAGS(decoderEvents);
+static osMutexId_t decoderCvLock;           // CV store, the thread holds it around execute()
+RTOS_MUTEX(decoderCvLock);
 static bool decoderRunning = false;
 
+// Decoder thread event flags
+#define DECODER_EVENT_CAPTURE  (1u << 0)  // capture ring half filled
+#define DECODER_EVENT_STOP     (1u << 1)  // stop requested
+#define DECODER_EVENT_PACKET   (1u << 2)  // emulation: packet ended
+
+// CV1-29 after reset, also loaded by writing 8 to CV8 (RCN-225)
+static constexpr std::array<uint8_t, 29uz> kDefaultCvs{
+  3u,   1u,   2u, 1u,   1u,   1u,   4u, DCC_MANUFACTURER_ID,
+  55u,  0u,   0u, 117u, 128u, 195u, 0u, 0u,
+  192u, 128u, 0u, 0u,   0u,   0u,   0u, 0u,
+  0u,   0u,   0u, 131u, 14u};
+static constexpr uint32_t kCvVersion = 6u;        // CV7, read only
+static constexpr uint32_t kCvManufacturer = 7u;   // CV8, writing 8 resets
+
+// In .bss, not part of the decoder's interrupt hot state
+static CvStore<DECODER_CV_CAPACITY> cvStore;
+
+// What the next TIM14 update does
+enum : uint8_t {
+  EMULATION_TIMER_IDLE = 0,
+  EMULATION_TIMER_CH1,
+  EMULATION_TIMER_CH2,
+  EMULATION_TIMER_ACK,
+};
+
+// Emulation state of TIM15, TIM14 and the decoder thread
+struct EmulationState {
+  bool active;
+  bool ack;
+  bool railcom;
+  bool lastPacketEnd;
+  volatile uint8_t timerUse;
+  uint8_t channel;                    // cutout channel being transmitted
+  volatile uint32_t packetEndCycles;  // DWT at the last packet end
+  uint32_t packets;
+  uint32_t acks;
+  uint32_t ch1;
+  uint32_t ch2;
+  uint32_t bidiBusy;
+};
+static EmulationState emulation FAST_RAM_DATA;
+
+static bool emulationSelected = false;      // for the next start
+static DecoderEmulation_t emulationNext;
+static uint32_t responseLastUs = 0;
+static uint32_t responseMaxUs = 0;
+static uint32_t responseLate = 0;
+
+// DMA capture: TIM15 CCR1 holds the time since the previous edge (slave reset on both edges)
+static DMA_HandleTypeDef hdmaCapture;
+static DMA_QListTypeDef captureQueue;
+static DMA_NodeTypeDef captureNode;
+static uint16_t captureRing[DECODER_CAPTURE_SIZE];
+static uint32_t captureReadIndex = 0;
+static volatile uint32_t captureHalves = 0;  // half transfers completed by the DMA
+static uint32_t captureDrainedHalves = 0;    // captureHalves at the last drain
+static uint32_t captureOverruns = 0;
+static bool captureDma = false;             // current run uses the DMA path
+
 /* Definitions for decoderTask */
+RTOS_THREAD_MEMORY(decoderTask, 8192);
 const osThreadAttr_t decoderTask_attributes = {
   .name = "decoderTask",
-  .stack_size = 8192,
+  RTOS_THREAD_ATTR_MEMORY(decoderTask),
   .priority = (osPriority_t) osPriorityHigh
 };
 
 
 void Decoder::direction(uint16_t addr, bool dir) {}
 
+// No trace while the loco tracker measures a command station at full rate
 void Decoder::speed(uint16_t addr, int32_t speed) {
+  if (loco_tracker_enabled()) return;
   if (speed) {
-    printf("\nDecoder: accelerate to speed step %d\n", speed);
+    TRACE_INFO("\nDecoder: accelerate to speed step %d\n", speed);
   } else {
-    printf("Decoder: stop\n");
+    TRACE_INFO("Decoder: stop\n");
   }
 }
 
 void Decoder::function(uint16_t addr, uint32_t mask, uint32_t state) {
-  if (!(mask & 0b0'0001u)) return;
+  if (loco_tracker_enabled() || !(mask & 0b0'0001u)) return;
   else if (state & 0b0'0001u) {
-    printf("Decoder: set function F0\n");
+    TRACE_INFO("Decoder: set function F0\n");
   } else {
-    printf("Decoder: clear function F0\n");
+    TRACE_INFO("Decoder: clear function F0\n");
   }
 }
 
 void Decoder::serviceModeHook(bool service_mode) {}
 
-void Decoder::serviceAck() {}
+// TIM14 one pulse of us microseconds, its update interrupt then does use
+static inline void emulationTimerStart(uint32_t us, uint8_t use)
+{
+  TIM_TypeDef* const tim = htim14.Instance;
+  CLEAR_BIT(tim->CR1, TIM_CR1_CEN);
+  tim->ARR = us - 1u;
+  tim->CNT = 0u;
+  tim->SR = ~TIM_SR_UIF;
+  emulation.timerUse = use;
+  SET_BIT(tim->CR1, TIM_CR1_CEN);
+}
 
-void Decoder::transmitBiDi(std::span<uint8_t const> bytes) {}
+// Decoder thread, from execute(): switch the load on, TIM14 switches it off
+void Decoder::serviceAck() {
+  if (!emulation.ack) return;
+  uint32_t const primask = __get_PRIMASK();
+  __disable_irq();
+  DECODER_ACK_GPIO_Port->BSRR = DECODER_ACK_Pin;
+  emulationTimerStart(DECODER_ACK_US, EMULATION_TIMER_ACK);
+  __set_PRIMASK(primask);
+  emulation.acks++;
+}
+
+// TIM14 interrupt, in the channel slot
+void Decoder::transmitBiDi(std::span<uint8_t const> bytes) {
+  static uint8_t buffer[8];
+  if (bytes.empty()) return;
+  if (huart4.gState != HAL_UART_STATE_READY) {
+    emulation.bidiBusy++;
+    return;
+  }
+  size_t const count = std::min(bytes.size(), sizeof(buffer));
+  std::copy_n(bytes.begin(), count, buffer);
+  HAL_UART_Transmit_IT(&huart4, buffer, static_cast<uint16_t>(count));
+  if (emulation.channel == 1u) {
+    emulation.ch1++;
+  } else {
+    emulation.ch2++;
+  }
+}
 
-uint8_t Decoder::readCv(uint32_t cv_addr, uint8_t) {
-  if (cv_addr >= size(_cvs)) return 0u;
-  return _cvs[cv_addr];
+static void loadDefaultCvs(void)
+{
+  cvStore.clear();
+  for (uint32_t i = 0; i < size(kDefaultCvs); i++) {
+    cvStore.write(i, kDefaultCvs[i]);
+  }
 }
 
+uint8_t Decoder::readCv(uint32_t cv_addr, uint8_t) { return cvStore.read(cv_addr); }
+
+// Returns the value read back, a failed write (store full) is not acknowledged
 uint8_t Decoder::writeCv(uint32_t cv_addr, uint8_t byte) {
-  if (cv_addr >= size(_cvs)) return 0u;
-  return _cvs[cv_addr] = byte;
+  if (cv_addr == kCvManufacturer) {
+    if (byte == 8u) loadDefaultCvs();
+  } else if (cv_addr != kCvVersion) {
+    cvStore.write(cv_addr, byte);
+  }
+  return cvStore.read(cv_addr);
 }
 
-bool Decoder::readCv(uint32_t cv_addr, bool, uint32_t pos) { return false; }
+bool Decoder::readCv(uint32_t cv_addr, bool, uint32_t pos) {
+  return pos < 8u && (cvStore.read(cv_addr) >> pos) & 1u;
+}
 
 bool Decoder::writeCv(uint32_t cv_addr, bool bit, uint32_t pos) {
-  return false;
+  if (pos >= 8u) return false;
+  uint8_t const mask = static_cast<uint8_t>(1u << pos);
+  uint8_t const value = cvStore.read(cv_addr);
+  return writeCv(cv_addr, static_cast<uint8_t>(bit ? value | mask : value & ~mask)) & mask;
 }
 
-Decoder decoder;
+Decoder decoder FAST_RAM_DATA;
 
-extern "C" void TIM15_IRQHandler(void)
+// TIM15 interrupt after each edge: at the end of a packet time the cutout and have it executed at once
+static inline void emulationEdge(void)
 {
+  bool const end = decoder.packetEnd();
+  if (end && !emulation.lastPacketEnd) {
+    emulation.packetEndCycles = DWT->CYCCNT;
+    emulation.packets++;
+    if (emulation.railcom && emulation.timerUse == EMULATION_TIMER_IDLE) {
+      emulationTimerStart(DECODER_BIDI_CH1_US, EMULATION_TIMER_CH1);
+    }
+    osEventFlagsSet(decoderEvents, DECODER_EVENT_PACKET);
+  }
+  emulation.lastPacketEnd = end;
+}
+
+// Runs from SRAM with the library receive() inlined
+extern "C" FAST_RAM_FLATTEN void TIM15_IRQHandler(void)
+{
+  uint32_t const profile = profiler_isr_enter();
   uint32_t itsource = htim15.Instance->DIER;
   uint32_t itflag   = htim15.Instance->SR;
 
@@ -77,8 +229,15 @@ extern "C" void TIM15_IRQHandler(void)
         if ((htim15.Instance->CCMR1 & TIM_CCMR1_CC1S) != 0x00U)
         {
           // Get captured value (CH1)
-          uint32_t ccr = HAL_TIM_ReadCapturedValue(&htim15, TIM_CHANNEL_1);
+          uint32_t ccr = htim15.Instance->CCR1;
+          sniffer_edge(static_cast<uint16_t>(ccr));
+          edge_stats_add(static_cast<uint16_t>(ccr));
+          // The half which ended with this edge had the opposite of the current level
+          edge_stats_set_level((DEC_IN_GPIO_Port->IDR & DEC_IN_Pin) == 0u);
           decoder.receive(ccr);
+          if (emulation.active) {
+            emulationEdge();
+          }
         }
         htim15.Channel = HAL_TIM_ACTIVE_CHANNEL_CLEARED;
       }
@@ -92,8 +251,220 @@ extern "C" void TIM15_IRQHandler(void)
       __HAL_TIM_CLEAR_FLAG(&htim15, TIM_FLAG_UPDATE);
     }
   }
+  profiler_isr_exit(PROFILER_ISR_TIM15, profile);
+}
+
+// Emulation timer: cutout channel slots of the last packet, end of the ACK pulse
+extern "C" FAST_RAM_FLATTEN void TIM14_IRQHandler(void)
+{
+  TIM_TypeDef* const tim = htim14.Instance;
+  if ((tim->SR & TIM_SR_UIF) == 0u) {
+    return;
+  }
+  tim->SR = ~TIM_SR_UIF;
+
+  switch (emulation.timerUse) {
+    case EMULATION_TIMER_CH1:
+      emulationTimerStart(DECODER_BIDI_CH2_US - DECODER_BIDI_CH1_US, EMULATION_TIMER_CH2);
+      emulation.channel = 1u;
+      decoder.biDiChannel1();
+      break;
+    case EMULATION_TIMER_CH2:
+      emulation.timerUse = EMULATION_TIMER_IDLE;
+      emulation.channel = 2u;
+      decoder.biDiChannel2();
+      break;
+    case EMULATION_TIMER_ACK:
+      DECODER_ACK_GPIO_Port->BSRR = static_cast<uint32_t>(DECODER_ACK_Pin) << 16u;
+      emulation.timerUse = EMULATION_TIMER_IDLE;
+      break;
+    default:
+      break;
+  }
+}
+
+
+static void captureHalfCplt(DMA_HandleTypeDef *hdma)
+{
+  (void)hdma;
+  captureHalves = captureHalves + 1u;
+  osEventFlagsSet(decoderEvents, DECODER_EVENT_CAPTURE);
+}
+
+/**
+  * @brief This function handles the decoder capture DMA channel interrupt.
+  */
+extern "C" void DECODER_CAPTURE_DMA_IRQHandler(void)
+{
+  HAL_DMA_IRQHandler(&hdmaCapture);
+}
+
+// Start circular DMA of TIM15 captures into the ring, returns false if the channel could not be set up
+static bool captureDmaStart(void)
+{
+  DMA_NodeConfTypeDef nodeConfig = {};
+  nodeConfig.NodeType = DMA_GPDMA_LINEAR_NODE;
+  nodeConfig.Init.Request = DECODER_CAPTURE_DMA_REQUEST;
+  nodeConfig.Init.BlkHWRequest = DMA_BREQ_SINGLE_BURST;
+  nodeConfig.Init.Direction = DMA_PERIPH_TO_MEMORY;
+  nodeConfig.Init.SrcInc = DMA_SINC_FIXED;
+  nodeConfig.Init.DestInc = DMA_DINC_INCREMENTED;
+  nodeConfig.Init.SrcDataWidth = DMA_SRC_DATAWIDTH_HALFWORD;
+  nodeConfig.Init.DestDataWidth = DMA_DEST_DATAWIDTH_HALFWORD;
+  nodeConfig.Init.SrcBurstLength = 1;
+  nodeConfig.Init.DestBurstLength = 1;
+  nodeConfig.Init.TransferAllocatedPort = DMA_SRC_ALLOCATED_PORT0 | DMA_DEST_ALLOCATED_PORT0;
+  nodeConfig.Init.TransferEventMode = DMA_TCEM_BLOCK_TRANSFER;
+  nodeConfig.Init.Mode = DMA_NORMAL;
+  nodeConfig.TriggerConfig.TriggerPolarity = DMA_TRIG_POLARITY_MASKED;
+  nodeConfig.DataHandlingConfig.DataExchange = DMA_EXCHANGE_NONE;
+  nodeConfig.DataHandlingConfig.DataAlignment = DMA_DATA_RIGHTALIGN_ZEROPADDED;
+  nodeConfig.SrcAddress = reinterpret_cast<uint32_t>(&htim15.Instance->CCR1);
+  nodeConfig.DstAddress = reinterpret_cast<uint32_t>(captureRing);
+  nodeConfig.DataSize = sizeof(captureRing);
+
+  if (HAL_DMAEx_List_BuildNode(&nodeConfig, &captureNode) != HAL_OK ||
+      HAL_DMAEx_List_ResetQ(&captureQueue) != HAL_OK ||
+      HAL_DMAEx_List_InsertNode(&captureQueue, NULL, &captureNode) != HAL_OK ||
+      HAL_DMAEx_List_SetCircularMode(&captureQueue) != HAL_OK) {
+    return false;
+  }
+
+  hdmaCapture.Instance = DECODER_CAPTURE_DMA_CHANNEL;
+  hdmaCapture.InitLinkedList.Priority = DMA_HIGH_PRIORITY;
+  hdmaCapture.InitLinkedList.LinkStepMode = DMA_LSM_FULL_EXECUTION;
+  hdmaCapture.InitLinkedList.LinkAllocatedPort = DMA_LINK_ALLOCATED_PORT0;
+  hdmaCapture.InitLinkedList.TransferEventMode = DMA_TCEM_BLOCK_TRANSFER;
+  hdmaCapture.InitLinkedList.LinkedListMode = DMA_LINKEDLIST_CIRCULAR;
+  if (HAL_DMAEx_List_Init(&hdmaCapture) != HAL_OK ||
+      HAL_DMAEx_List_LinkQ(&hdmaCapture, &captureQueue) != HAL_OK) {
+    return false;
+  }
+  hdmaCapture.XferHalfCpltCallback = captureHalfCplt;
+  hdmaCapture.XferCpltCallback = captureHalfCplt;
+
+  captureReadIndex = 0;
+  captureHalves = 0;
+  captureDrainedHalves = 0;
+  captureOverruns = 0;
+
+  HAL_NVIC_SetPriority(DECODER_CAPTURE_DMA_IRQn, 6, 0);
+  HAL_NVIC_EnableIRQ(DECODER_CAPTURE_DMA_IRQn);
+  if (HAL_DMAEx_List_Start_IT(&hdmaCapture) != HAL_OK) {
+    return false;
+  }
+  __HAL_TIM_ENABLE_DMA(&htim15, TIM_DMA_CC1);
+  HAL_TIM_IC_Start(&htim15, TIM_CHANNEL_1);
+  return true;
+}
+
+static void captureDmaStop(void)
+{
+  HAL_TIM_IC_Stop(&htim15, TIM_CHANNEL_1);
+  __HAL_TIM_DISABLE_DMA(&htim15, TIM_DMA_CC1);
+  HAL_DMA_Abort(&hdmaCapture);
+  HAL_NVIC_DisableIRQ(DECODER_CAPTURE_DMA_IRQn);
+  HAL_DMAEx_List_UnLinkQ(&hdmaCapture);
+  HAL_DMAEx_List_DeInit(&hdmaCapture);
+}
+
+// Feed the edges written by the DMA since the last call to the decoder
+static void captureDrain(void)
+{
+  uint32_t const halves = captureHalves;
+  uint32_t const write_index =
+      (DECODER_CAPTURE_SIZE - __HAL_DMA_GET_COUNTER(&hdmaCapture) / sizeof(uint16_t)) % DECODER_CAPTURE_SIZE;
+  bool const level = HAL_GPIO_ReadPin(DEC_IN_GPIO_Port, DEC_IN_Pin) == GPIO_PIN_SET;
+
+  // More than a full lap since the last drain, the oldest edges were overwritten
+  if (halves - captureDrainedHalves > 2u) {
+    captureOverruns++;
+    captureReadIndex = write_index;
+  }
+  captureDrainedHalves = halves;
+
+  while (captureReadIndex != write_index) {
+    uint16_t const width = captureRing[captureReadIndex];
+    sniffer_edge(width);
+    edge_stats_add(width);
+    decoder.receive(width);
+    captureReadIndex = (captureReadIndex + 1u) % DECODER_CAPTURE_SIZE;
+  }
+  // Level sampled right after the DMA position, the last half drained had the opposite one
+  edge_stats_set_level(!level);
+}
+
+// The library calls readCv/writeCv from execute()
+static void decoderExecute(void)
+{
+  osMutexAcquire(decoderCvLock, osWaitForever);
+  decoder.execute();
+  osMutexRelease(decoderCvLock);
+}
+
+// ACK load on HL, driven only while emulating
+static void ackOutput(bool enable)
+{
+  GPIO_InitTypeDef init = {};
+  init.Pin = DECODER_ACK_Pin;
+  init.Mode = enable ? GPIO_MODE_OUTPUT_PP : GPIO_MODE_INPUT;
+  init.Pull = GPIO_NOPULL;
+  init.Speed = GPIO_SPEED_FREQ_LOW;
+  HAL_GPIO_WritePin(DECODER_ACK_GPIO_Port, DECODER_ACK_Pin, GPIO_PIN_RESET);
+  HAL_GPIO_Init(DECODER_ACK_GPIO_Port, &init);
+}
+
+static void emulationStart(void)
+{
+  emulation.active = emulationSelected;
+  emulation.ack = emulationSelected && emulationNext.ack;
+  emulation.railcom = emulationSelected && emulationNext.railcom;
+  emulation.lastPacketEnd = false;
+  emulation.timerUse = EMULATION_TIMER_IDLE;
+  emulation.packets = 0;
+  emulation.acks = 0;
+  emulation.ch1 = 0;
+  emulation.ch2 = 0;
+  emulation.bidiBusy = 0;
+  responseLastUs = 0;
+  responseMaxUs = 0;
+  responseLate = 0;
+  if (!emulation.active) {
+    return;
+  }
+  if (emulation.ack) {
+    ackOutput(true);
+  }
+  __HAL_TIM_CLEAR_FLAG(&htim14, TIM_FLAG_UPDATE);
+  __HAL_TIM_ENABLE_IT(&htim14, TIM_IT_UPDATE);
+}
+
+static void emulationStop(void)
+{
+  if (!emulation.active) {
+    return;
+  }
+  emulation.active = false;
+  __HAL_TIM_DISABLE_IT(&htim14, TIM_IT_UPDATE);
+  CLEAR_BIT(htim14.Instance->CR1, TIM_CR1_CEN);
+  emulation.timerUse = EMULATION_TIMER_IDLE;
+  if (emulation.ack) {
+    ackOutput(false);
+  }
 }
 
+// Packet end to executed, the RailCom reply to it is ready if this is before the channel 2 slot
+static void emulationResponded(void)
+{
+  uint32_t const us = (DWT->CYCCNT - emulation.packetEndCycles) / (SystemCoreClock / 1000000u);
+  responseLastUs = us;
+  if (us > responseMaxUs) {
+    responseMaxUs = us;
+  }
+  if (us >= DECODER_BIDI_CH2_US) {
+    responseLate++;
+  }
+}
 
 void DecoderThread(void *argument) {
   (void)argument;  // Unused parameter
@@ -101,20 +472,57 @@ void DecoderThread(void *argument) {
   while (true) {
     // Block until externally started
     osSemaphoreAcquire(decoderStart_sem, osWaitForever);
+    osEventFlagsClear(decoderEvents, DECODER_EVENT_CAPTURE | DECODER_EVENT_STOP | DECODER_EVENT_PACKET);
 
+    osMutexAcquire(decoderCvLock, osWaitForever);
     decoder.init();
+    osMutexRelease(decoderCvLock);
+    emulationStart();
 
     // Enable update interrupt
     __HAL_TIM_ENABLE_IT(&htim15, TIM_IT_UPDATE);
-    HAL_TIM_IC_Start_IT(&htim15, TIM_CHANNEL_1);
+    // Emulation decodes in the edge interrupt to see the packet end in time
+    captureDma = DECODER_DMA_CAPTURE && !emulation.active && captureDmaStart();
+    if (!captureDma) {
+      HAL_TIM_IC_Start_IT(&htim15, TIM_CHANNEL_1);
+    }
+    power_idle_hold(POWER_IDLE_HOLD_DECODER, true);
     decoderRunning = true;
 
     while (decoderRunning) {
-      decoder.execute();
-      osDelay(3u);
+      if (captureDma) {
+        // Woken per half ring, the timeout picks up the tail of a packet in a partly filled half
+        osEventFlagsWait(decoderEvents, DECODER_EVENT_CAPTURE | DECODER_EVENT_STOP, osFlagsWaitAny,
+                         DECODER_CAPTURE_FLUSH_MS);
+        captureDrain();
+        decoderExecute();
+      }
+      else if (emulation.active) {
+        // Woken by the packet end, executed before the next packet begins
+        uint32_t const flags = osEventFlagsWait(decoderEvents, DECODER_EVENT_PACKET | DECODER_EVENT_STOP,
+                                                osFlagsWaitAny, DECODER_CAPTURE_FLUSH_MS);
+        decoderExecute();
+        if ((flags & osFlagsError) == 0u && (flags & DECODER_EVENT_PACKET) != 0u) {
+          emulationResponded();
+        }
+      }
+      else {
+        decoderExecute();
+        osDelay(3u);
+      }
+    }
+    if (captureDma) {
+      captureDmaStop();
+      if (captureOverruns) {
+        printf("Decoder capture overruns: %lu\n", static_cast<unsigned long>(captureOverruns));
+      }
+    }
+    else {
+      HAL_TIM_IC_Stop_IT(&htim15, TIM_CHANNEL_1);
     }
-    HAL_TIM_IC_Stop_IT(&htim15, TIM_CHANNEL_1);
     __HAL_TIM_DISABLE_IT(&htim15, TIM_IT_UPDATE);
+    emulationStop();
+    power_idle_hold(POWER_IDLE_HOLD_DECODER, false);
     osSemaphoreRelease(decoderStart_sem);
     osDelay(5u); // Give some time for the semaphore to be released
   }
@@ -124,13 +532,17 @@ void DecoderThread(void *argument) {
 // Called at system init
 extern "C" void Decoder_Init(void)
 {
-    decoderStart_sem = osSemaphoreNew(1, 0, NULL);  // Start locked
+    decoderStart_sem = osSemaphoreNew(1, 0, &decoderStart_sem_attr);  // Start locked
+    decoderEvents = osEventFlagsNew(&decoderEvents_attr);
+    decoderCvLock = osMutexNew(&decoderCvLock_attr);
+    loadDefaultCvs();
     decoderThread_id = osThreadNew(DecoderThread, NULL, &decoderTask_attributes);
 }
 
 // Can be called from anywhere
 extern "C" void Decoder_Start(void)
 {
+  boot_require(BOOT_SUBSYSTEM_DECODER);
   if (!decoderRunning) {
     osSemaphoreRelease(decoderStart_sem);
     printf("Decoder started\n");
@@ -145,6 +557,7 @@ extern "C" void Decoder_Stop(void)
   if (decoderRunning) {
     printf("Decoder stopping\n");
     decoderRunning = false;
+    osEventFlagsSet(decoderEvents, DECODER_EVENT_STOP);
     osSemaphoreAcquire(decoderStart_sem, osWaitForever);
     printf("Decoder stopped\n");
   }
@@ -152,3 +565,101 @@ extern "C" void Decoder_Stop(void)
     printf("Decoder not running\n");
   }
 } 
+
+extern "C" void Decoder_SetEmulation(const DecoderEmulation_t* emulation_config)
+{
+  emulationSelected = emulation_config != NULL;
+  if (emulation_config != NULL) {
+    emulationNext = *emulation_config;
+  }
+}
+
+extern "C" void Decoder_GetEmulationStats(DecoderEmulationStats_t* stats)
+{
+  stats->running = decoderRunning;
+  stats->emulating = emulation.active;
+  stats->ack = emulation.active ? emulation.ack : (emulationSelected && emulationNext.ack);
+  stats->railcom = emulation.active ? emulation.railcom : (emulationSelected && emulationNext.railcom);
+  stats->packets = emulation.packets;
+  stats->acks = emulation.acks;
+  stats->ch1 = emulation.ch1;
+  stats->ch2 = emulation.ch2;
+  stats->bidi_busy = emulation.bidiBusy;
+  stats->last_response_us = responseLastUs;
+  stats->max_response_us = responseMaxUs;
+  stats->late = responseLate;
+  stats->cvs = static_cast<uint32_t>(cvStore.size());
+}
+
+extern "C" int Decoder_ReadCv(uint32_t cv, uint32_t page, uint8_t* value)
+{
+  if (cv < 1u || cv > CvStore<DECODER_CV_CAPACITY>::kCvs || (page > 0xFFFFu && page != DECODER_CV_PAGE_CURRENT)) {
+    return -1;
+  }
+  osMutexAcquire(decoderCvLock, osWaitForever);
+  *value = page == DECODER_CV_PAGE_CURRENT ? cvStore.read(cv - 1u)
+                                           : cvStore.read(cv - 1u, static_cast<uint16_t>(page));
+  osMutexRelease(decoderCvLock);
+  return 0;
+}
+
+// Written as given, CV7 and CV8 included: sets up the decoder the host wants to emulate
+extern "C" int Decoder_WriteCv(uint32_t cv, uint32_t page, uint8_t value)
+{
+  if (cv < 1u || cv > CvStore<DECODER_CV_CAPACITY>::kCvs || (page > 0xFFFFu && page != DECODER_CV_PAGE_CURRENT)) {
+    return -1;
+  }
+  osMutexAcquire(decoderCvLock, osWaitForever);
+  bool const ok = page == DECODER_CV_PAGE_CURRENT ? cvStore.write(cv - 1u, value)
+                                                  : cvStore.write(cv - 1u, static_cast<uint16_t>(page), value);
+  osMutexRelease(decoderCvLock);
+  return ok ? 0 : -1;
+}
+
+extern "C" void Decoder_ResetCvs(void)
+{
+  osMutexAcquire(decoderCvLock, osWaitForever);
+  loadDefaultCvs();
+  osMutexRelease(decoderCvLock);
+}
+
+#ifdef DCC_TESTER_BENCHMARK
+extern "C" bool Decoder_BenchmarkReceive(uint32_t edges, BenchmarkStats_t* stats)
+{
+  if (decoderRunning) {
+    return false;
+  }
+
+  // Idle packet: preamble, 0xFF 0x00 0xFF with their start bits and the end bit, two halves per bit
+  static constexpr uint8_t kIdle[] = {0xFFu, 0x00u, 0xFFu};
+  static constexpr uint16_t kOneHalfUs = 58u;
+  static constexpr uint16_t kZeroHalfUs = 100u;
+  uint16_t halves[2u * (14u + 9u * sizeof(kIdle) + 1u)];
+  uint32_t count = 0;
+  auto add_bit = [&](bool one) {
+    halves[count++] = one ? kOneHalfUs : kZeroHalfUs;
+    halves[count++] = one ? kOneHalfUs : kZeroHalfUs;
+  };
+  for (uint32_t i = 0; i < 14u; i++) {
+    add_bit(true);
+  }
+  for (uint8_t byte : kIdle) {
+    add_bit(false);
+    for (uint32_t bit = 0; bit < 8u; bit++) {
+      add_bit((byte << bit) & 0x80u);
+    }
+  }
+  add_bit(true);
+
+  decoder.init();
+  for (uint32_t i = 0; i < edges; i++) {
+    uint16_t const width = halves[i % count];
+    uint32_t const start = DWT->CYCCNT;
+    decoder.receive(width);
+    benchmark_stats_add(stats, DWT->CYCCNT - start);
+  }
+  // Decoder_Start initializes again, nothing received here is executed
+  decoder.init();
+  return true;
+}
+#endif
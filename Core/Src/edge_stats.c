@@ -0,0 +1,85 @@
+/**
+ * @file edge_stats.c
+ * @brief Half-bit duration statistics of the decoder input
+ */
+
+#include "edge_stats.h"
+#include "fast_ram.h"
+#include <string.h>
+
+_Static_assert((EDGE_STATS_ZERO_BIN_US & (EDGE_STATS_ZERO_BIN_US - 1u)) == 0u, "zero bins are selected by a shift");
+
+static EdgeStats_t g_stats = {
+    .phase = {{{0, 0, UINT16_MAX, 0}, {0, 0, UINT16_MAX, 0}},
+              {{0, 0, UINT16_MAX, 0}, {0, 0, UINT16_MAX, 0}}},
+};
+static volatile bool g_resetRequest = false;
+
+static void stats_clear(void)
+{
+    memset(&g_stats, 0, sizeof(g_stats));
+    for (uint32_t c = 0; c < EDGE_STATS_CLASSES; c++) {
+        g_stats.phase[c][0].min_us = UINT16_MAX;
+        g_stats.phase[c][1].min_us = UINT16_MAX;
+    }
+}
+
+FAST_RAM_FUNC void edge_stats_add(uint16_t width_us)
+{
+    if (g_resetRequest) {
+        g_resetRequest = false;
+        stats_clear();
+    }
+
+    uint32_t const phase = g_stats.edges & 1u;
+    g_stats.edges++;
+
+    if (width_us < EDGE_STATS_MIN_US) {
+        g_stats.glitches++;
+        return;
+    }
+
+    EdgeStatsPhase_t *p;
+    if (width_us <= EDGE_STATS_ONE_MAX_US) {
+        g_stats.one_bins[(width_us - EDGE_STATS_MIN_US) / EDGE_STATS_ONE_BIN_US]++;
+        p = &g_stats.phase[EDGE_STATS_ONE][phase];
+    } else {
+        uint32_t const bin = (width_us - EDGE_STATS_ZERO_FIRST_US) / EDGE_STATS_ZERO_BIN_US;
+        if (bin < EDGE_STATS_ZERO_BINS) {
+            g_stats.zero_bins[bin]++;
+        } else {
+            g_stats.zero_overflow++;
+        }
+        p = &g_stats.phase[EDGE_STATS_ZERO][phase];
+    }
+    p->count++;
+    p->sum_us += width_us;
+    if (width_us < p->min_us) {
+        p->min_us = width_us;
+    }
+    if (width_us > p->max_us) {
+        p->max_us = width_us;
+    }
+}
+
+FAST_RAM_FUNC void edge_stats_set_level(bool high)
+{
+    if (g_stats.edges == 0u) {
+        return;
+    }
+    uint32_t const last_phase = (g_stats.edges - 1u) & 1u;
+    g_stats.high_phase = (uint8_t)(high ? last_phase : last_phase ^ 1u);
+}
+
+void edge_stats_reset(void)
+{
+    g_resetRequest = true;
+}
+
+void edge_stats_get(EdgeStats_t *stats)
+{
+    if (stats == NULL) {
+        return;
+    }
+    memcpy(stats, &g_stats, sizeof(*stats));
+}
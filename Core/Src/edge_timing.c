@@ -0,0 +1,169 @@
+/**
+ * @file edge_timing.c
+ * @brief Latency and jitter of the interrupt driven track output
+ *
+ * Only the TIM2 handler updates the statistics, readers copy them. The handler
+ * cost is two cycle counter reads and a handful of integer operations.
+ */
+
+#include "edge_timing.h"
+#include "fast_ram.h"
+#include "stm32h5xx.h"
+#include <string.h>
+
+static EdgeTiming_t g_timing = {
+    .latency = {{0, 0, UINT32_MAX, 0}, {0, 0, UINT32_MAX, 0}},
+    .error = {{0, 0, INT32_MAX, INT32_MIN}, {0, 0, INT32_MAX, INT32_MIN}},
+};
+static volatile bool g_resetRequest = false;
+
+// Handler state
+static uint32_t g_entry = 0;
+static bool g_entryPending = false;     // entry seen, no output written yet
+static uint32_t g_lastWrite = 0;
+static bool g_lastValid = false;        // g_lastWrite starts the running half bit
+static uint32_t g_expected = 0;         // cycles programmed for the running half bit
+
+static void stats_clear(void)
+{
+    bool const active = g_timing.active;
+    uint32_t const cycles_per_tick = g_timing.cycles_per_tick;
+
+    memset(&g_timing, 0, sizeof(g_timing));
+    for (uint32_t p = 0; p < 2u; p++) {
+        g_timing.latency[p].min = UINT32_MAX;
+        g_timing.error[p].min = INT32_MAX;
+        g_timing.error[p].max = INT32_MIN;
+    }
+    g_timing.active = active;
+    g_timing.cycles_per_tick = cycles_per_tick;
+}
+
+static void add_latency(uint32_t phase, uint32_t cycles)
+{
+    EdgeTimingLatency_t *const l = &g_timing.latency[phase];
+    l->count++;
+    l->sum += cycles;
+    if (cycles < l->min) {
+        l->min = cycles;
+    }
+    if (cycles > l->max) {
+        l->max = cycles;
+    }
+
+    uint32_t const bin = cycles >> EDGE_TIMING_BIN_SHIFT;
+    if (bin < EDGE_TIMING_LATENCY_BINS) {
+        g_timing.latency_bins[bin]++;
+    } else {
+        g_timing.latency_overflow++;
+    }
+}
+
+static void add_error(uint32_t phase, int32_t cycles)
+{
+    EdgeTimingError_t *const e = &g_timing.error[phase];
+    e->count++;
+    e->sum += cycles;
+    if (cycles < e->min) {
+        e->min = cycles;
+    }
+    if (cycles > e->max) {
+        e->max = cycles;
+    }
+
+    if (cycles < EDGE_TIMING_ERROR_FIRST) {
+        g_timing.error_underflow++;
+        return;
+    }
+    uint32_t const bin = (uint32_t)(cycles - EDGE_TIMING_ERROR_FIRST) >> EDGE_TIMING_BIN_SHIFT;
+    if (bin < EDGE_TIMING_ERROR_BINS) {
+        g_timing.error_bins[bin]++;
+    } else {
+        g_timing.error_overflow++;
+    }
+}
+
+void edge_timing_start(uint32_t cycles_per_tick)
+{
+    g_entryPending = false;
+    g_lastValid = false;
+    g_timing.cycles_per_tick = cycles_per_tick;
+    g_timing.active = true;
+    if (g_resetRequest) {
+        g_resetRequest = false;
+        stats_clear();
+    }
+}
+
+void edge_timing_stop(void)
+{
+    g_timing.active = false;
+}
+
+FAST_RAM_FUNC void edge_timing_entry(uint32_t cycles)
+{
+    if (g_resetRequest) {
+        g_resetRequest = false;
+        stats_clear();
+        g_lastValid = false;
+    }
+    g_entry = cycles;
+    g_entryPending = true;
+}
+
+FAST_RAM_FUNC void edge_timing_output(bool p)
+{
+    // Outputs are also written outside the handler (idle levels, DMA rendering)
+    if (!g_entryPending) {
+        return;
+    }
+    uint32_t const now = DWT->CYCCNT;
+    uint32_t const phase = p ? 0u : 1u;
+    g_entryPending = false;
+
+    g_timing.half_bits++;
+    add_latency(phase, now - g_entry);
+
+    if (g_lastValid) {
+        // The half bit which ended with this write was the other phase
+        int32_t const error = (int32_t)(now - g_lastWrite - g_expected);
+        int32_t const limit = (int32_t)(g_expected / 2u);
+        if (error > limit || error < -limit) {
+            g_timing.late++;
+        } else {
+            add_error(phase ^ 1u, error);
+        }
+    }
+    g_lastWrite = now;
+    g_lastValid = true;
+}
+
+FAST_RAM_FUNC void edge_timing_period(uint32_t arr)
+{
+    if (g_entryPending) {
+        // No write for this half bit, the next interval spans more than one period
+        g_entryPending = false;
+        g_lastValid = false;
+        g_timing.missed++;
+        return;
+    }
+    g_expected = (arr + 1u) * g_timing.cycles_per_tick;
+}
+
+void edge_timing_reset(void)
+{
+    g_resetRequest = true;
+}
+
+void edge_timing_get(EdgeTiming_t *timing)
+{
+    if (timing == NULL) {
+        return;
+    }
+    if (!g_timing.active && g_resetRequest) {
+        // Nothing updates the statistics while the track is stopped
+        g_resetRequest = false;
+        stats_clear();
+    }
+    memcpy(timing, &g_timing, sizeof(*timing));
+}
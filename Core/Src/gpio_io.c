@@ -0,0 +1,316 @@
+/**
+ * @file gpio_io.c
+ * @brief Test header IO1-IO16: table driven access, snapshot reads and edge capture
+ *
+ * The EXTI handlers are the only producer of the capture ring, the RPC thread
+ * the only consumer.
+ */
+
+#include "gpio_io.h"
+#include "main.h"
+#include "stm32h5xx_nucleo.h"
+#include "command_station.h"
+#include "power_idle.h"
+#include "timebase.h"
+#include <string.h>
+
+typedef struct {
+    GPIO_TypeDef *port;
+    uint16_t pin;
+} GpioIoPin_t;
+
+// Indexed by IO number - 1
+static const GpioIoPin_t kPins[GPIO_IO_PIN_COUNT] = {
+    {IO1_GPIO_Port, IO1_Pin},
+    {IO2_GPIO_Port, IO2_Pin},
+    {IO3_GPIO_Port, IO3_Pin},
+    {IO4_GPIO_Port, IO4_Pin},
+    {IO5_GPIO_Port, IO5_Pin},
+    {IO6_GPIO_Port, IO6_Pin},
+    {IO7_GPIO_Port, IO7_Pin},
+    {IO8_GPIO_Port, IO8_Pin},
+    {IO9_GPIO_Port, IO9_Pin},
+    {IO10_GPIO_Port, IO10_Pin},
+    {IO11_GPIO_Port, IO11_Pin},
+    {IO12_GPIO_Port, IO12_Pin},
+    {IO13_GPIO_Port, IO13_Pin},
+    {IO14_GPIO_Port, IO14_Pin},
+    {IO15_GPIO_Port, IO15_Pin},
+};
+
+#define GPIO_IO_MAX_PORTS   GPIO_IO_PIN_COUNT
+
+static uint16_t g_outputs = 0;              // inputs reconfigured as outputs, bit 0 = IO1
+
+// Capture ring
+static GpioIoEdge_t g_ring[GPIO_IO_CAPTURE_RECORDS];
+static volatile uint32_t g_head = 0;        // written by the EXTI handlers
+static volatile uint32_t g_tail = 0;        // written by the reader
+static volatile uint32_t g_edges = 0;
+static volatile uint32_t g_overflows = 0;
+static volatile bool g_active = false;
+static uint16_t g_mask = 0;
+static uint8_t g_lineIo[16];                // EXTI line -> captured IO number, 0 if none
+static GpioIoEdgeHook volatile g_edgeHook = NULL;
+
+_Static_assert((GPIO_IO_CAPTURE_RECORDS & (GPIO_IO_CAPTURE_RECORDS - 1u)) == 0u,
+               "GPIO_IO_CAPTURE_RECORDS must be a power of two");
+
+static uint32_t pin_line(uint16_t pin)
+{
+    return (uint32_t)__builtin_ctz(pin);
+}
+
+// EXTI0_IRQn ... EXTI15_IRQn are consecutive vectors
+static IRQn_Type line_irq(uint32_t line)
+{
+    return (IRQn_Type)(EXTI0_IRQn + (int32_t)line);
+}
+
+int gpio_io_read(uint8_t io)
+{
+    if (io == GPIO_IO_COUNT) {
+        // IO16 is the user button, 1 while pressed
+        return BSP_PB_GetState(BUTTON_USER) ? 1 : 0;
+    }
+    if (io < 1u || io > GPIO_IO_PIN_COUNT) {
+        return -1;
+    }
+    const GpioIoPin_t *p = &kPins[io - 1u];
+    return (p->port->IDR & p->pin) ? 1 : 0;
+}
+
+uint16_t gpio_io_snapshot(void)
+{
+    GPIO_TypeDef *ports[GPIO_IO_MAX_PORTS];
+    uint32_t idr[GPIO_IO_MAX_PORTS];
+    uint32_t port_count = 0;
+    uint8_t port_of[GPIO_IO_PIN_COUNT];
+
+    // Distinct ports in table order
+    for (uint32_t i = 0; i < GPIO_IO_PIN_COUNT; i++) {
+        uint32_t p = 0;
+        while (p < port_count && ports[p] != kPins[i].port) {
+            p++;
+        }
+        if (p == port_count) {
+            ports[port_count++] = kPins[i].port;
+        }
+        port_of[i] = (uint8_t)p;
+    }
+
+    // One read per port, back to back
+    for (uint32_t p = 0; p < port_count; p++) {
+        idr[p] = ports[p]->IDR;
+    }
+
+    uint16_t word = 0;
+    for (uint32_t i = 0; i < GPIO_IO_PIN_COUNT; i++) {
+        if (idr[port_of[i]] & kPins[i].pin) {
+            word |= (uint16_t)(1u << i);
+        }
+    }
+    if (BSP_PB_GetState(BUTTON_USER)) {
+        word |= (uint16_t)(1u << (GPIO_IO_COUNT - 1u));
+    }
+    return word;
+}
+
+bool gpio_io_configure_output(uint8_t io, bool level)
+{
+    if (io < 1u || io > GPIO_IO_PIN_COUNT) {
+        return false;
+    }
+    uint16_t const bit = (uint16_t)(1u << (io - 1u));
+    if (g_active && (g_mask & bit)) {
+        return false;
+    }
+
+    const GpioIoPin_t *p = &kPins[io - 1u];
+    GPIO_InitTypeDef init = {0};
+    init.Pin = p->pin;
+    init.Mode = GPIO_MODE_OUTPUT_PP;
+    init.Pull = GPIO_NOPULL;
+    init.Speed = GPIO_SPEED_FREQ_LOW;
+
+    HAL_GPIO_WritePin(p->port, p->pin, level ? GPIO_PIN_SET : GPIO_PIN_RESET);
+    HAL_GPIO_Init(p->port, &init);
+    g_outputs |= bit;
+    return true;
+}
+
+bool gpio_io_write(uint8_t io, bool level)
+{
+    if (io < 1u || io > GPIO_IO_PIN_COUNT) {
+        return false;
+    }
+    const GpioIoPin_t *p = &kPins[io - 1u];
+    p->port->BSRR = level ? (uint32_t)p->pin : (uint32_t)p->pin << 16u;
+    return true;
+}
+
+bool gpio_io_output_bsrr(uint8_t io, volatile uint32_t **bsrr, uint32_t *mask)
+{
+    if (io < 1u || io > GPIO_IO_PIN_COUNT) {
+        return false;
+    }
+    const GpioIoPin_t *p = &kPins[io - 1u];
+    *bsrr = &p->port->BSRR;
+    *mask = p->pin;
+    return true;
+}
+
+static void record(uint64_t cycles, uint32_t packet_seq, uint8_t io, uint8_t level)
+{
+    uint32_t const head = g_head;
+    g_edges++;
+    GpioIoEdgeHook const hook = g_edgeHook;
+    if (hook) {
+        GpioIoEdge_t const edge = {cycles, packet_seq, io, level};
+        hook(&edge);
+    }
+    if (head - g_tail >= GPIO_IO_CAPTURE_RECORDS) {
+        g_overflows++;
+        return;
+    }
+    GpioIoEdge_t *edge = &g_ring[head & (GPIO_IO_CAPTURE_RECORDS - 1u)];
+    edge->cycles = cycles;
+    edge->packet_seq = packet_seq;
+    edge->io = io;
+    edge->level = level;
+    g_head = head + 1u;
+}
+
+static void exti_line(uint32_t line)
+{
+    uint64_t const now = timebase_cycles();
+    uint32_t const bit = 1u << line;
+    uint32_t const rising = EXTI->RPR1 & bit;
+    uint32_t const falling = EXTI->FPR1 & bit;
+    EXTI->RPR1 = rising;
+    EXTI->FPR1 = falling;
+
+    uint8_t const io = g_lineIo[line];
+    if (io == 0u || !g_active) {
+        return;
+    }
+    uint32_t const seq = CommandStation_GetPacketSeq();
+    const GpioIoPin_t *p = &kPins[io - 1u];
+    uint8_t const level = (p->port->IDR & p->pin) ? 1u : 0u;
+
+    if (rising && falling) {
+        // Pulse shorter than the interrupt latency, the first edge led away from the current level
+        record(now, seq, io, level ^ 1u);
+        record(now, seq, io, level);
+    }
+    else if (rising || falling) {
+        record(now, seq, io, rising ? 1u : 0u);
+    }
+}
+
+bool gpio_io_capture_start(uint16_t mask, uint16_t *conflicts)
+{
+    uint16_t bad = (uint16_t)(mask & (g_outputs | (1u << (GPIO_IO_COUNT - 1u))));
+    uint8_t line_io[16] = {0};
+
+    for (uint32_t i = 0; i < GPIO_IO_PIN_COUNT; i++) {
+        if (!(mask & (1u << i))) {
+            continue;
+        }
+        uint32_t const line = pin_line(kPins[i].pin);
+        if (line_io[line]) {
+            bad |= (uint16_t)((1u << i) | (1u << (line_io[line] - 1u)));
+        }
+        else {
+            line_io[line] = (uint8_t)(i + 1u);
+        }
+    }
+    if (conflicts) {
+        *conflicts = bad;
+    }
+    if (mask == 0u || bad) {
+        return false;
+    }
+
+    gpio_io_capture_stop();
+    g_tail = g_head;
+    g_edges = 0;
+    g_overflows = 0;
+    memcpy(g_lineIo, line_io, sizeof(g_lineIo));
+    g_mask = mask;
+    g_active = true;
+    power_idle_hold(POWER_IDLE_HOLD_CAPTURE, true);
+
+    GPIO_InitTypeDef init = {0};
+    init.Mode = GPIO_MODE_IT_RISING_FALLING;
+    init.Pull = GPIO_PULLUP;
+    for (uint32_t line = 0; line < 16u; line++) {
+        if (!line_io[line]) {
+            continue;
+        }
+        const GpioIoPin_t *p = &kPins[line_io[line] - 1u];
+        init.Pin = p->pin;
+        HAL_GPIO_Init(p->port, &init);
+        EXTI->RPR1 = 1u << line;
+        EXTI->FPR1 = 1u << line;
+        HAL_NVIC_SetPriority(line_irq(line), GPIO_IO_EXTI_PRIORITY, 0);
+        HAL_NVIC_EnableIRQ(line_irq(line));
+    }
+    return true;
+}
+
+void gpio_io_capture_stop(void)
+{
+    for (uint32_t line = 0; line < 16u; line++) {
+        if (!g_lineIo[line]) {
+            continue;
+        }
+        // The pin stays an input, only its EXTI line is disarmed
+        uint32_t const bit = 1u << line;
+        HAL_NVIC_DisableIRQ(line_irq(line));
+        EXTI->IMR1 &= ~bit;
+        EXTI->RTSR1 &= ~bit;
+        EXTI->FTSR1 &= ~bit;
+        EXTI->RPR1 = bit;
+        EXTI->FPR1 = bit;
+        g_lineIo[line] = 0;
+    }
+    g_active = false;
+    power_idle_hold(POWER_IDLE_HOLD_CAPTURE, false);
+}
+
+uint32_t gpio_io_capture_read(GpioIoEdge_t *edges, uint32_t max)
+{
+    uint32_t count = 0;
+    while (count < max && g_tail != g_head) {
+        edges[count++] = g_ring[g_tail & (GPIO_IO_CAPTURE_RECORDS - 1u)];
+        g_tail = g_tail + 1u;
+    }
+    return count;
+}
+
+void gpio_io_capture_stats(GpioIoCaptureStats_t *stats)
+{
+    stats->active = g_active;
+    stats->mask = g_active ? g_mask : 0u;
+    stats->edges = g_edges;
+    stats->overflows = g_overflows;
+    stats->pending = g_head - g_tail;
+}
+
+void gpio_io_set_edge_hook(GpioIoEdgeHook hook)
+{
+    g_edgeHook = hook;
+}
+
+// Handlers of the EXTI lines used by IO1-IO15
+void EXTI0_IRQHandler(void) { exti_line(0); }
+void EXTI1_IRQHandler(void) { exti_line(1); }
+void EXTI2_IRQHandler(void) { exti_line(2); }
+void EXTI7_IRQHandler(void) { exti_line(7); }
+void EXTI9_IRQHandler(void) { exti_line(9); }
+void EXTI11_IRQHandler(void) { exti_line(11); }
+void EXTI12_IRQHandler(void) { exti_line(12); }
+void EXTI13_IRQHandler(void) { exti_line(13); }
+void EXTI14_IRQHandler(void) { exti_line(14); }
+void EXTI15_IRQHandler(void) { exti_line(15); }
@@ -0,0 +1,283 @@
+/**
+ * @file loco_tracker.cpp
+ * @brief Multi-address decoder emulation for command station throughput tests
+ *
+ * loco_tracker_packet runs on the capture side (TIM15 interrupt, or the
+ * decoder thread with DMA capture) and is the only writer of the table and the
+ * counters. The RPC thread runs below both, it copies entries one at a time
+ * with interrupts disabled and only clears the table while sniffer_track is
+ * off, when no packet can be half way through an update.
+ */
+
+#include "loco_tracker.h"
+#include "sniffer.h"
+#include "fast_ram.h"
+#include <cstring>
+#include "main.h"
+
+static_assert((LOCO_TRACKER_CAPACITY & (LOCO_TRACKER_CAPACITY - 1u)) == 0u, "LOCO_TRACKER_CAPACITY must be a power of two");
+static_assert(LOCO_TRACKER_MAX_LOCOS < LOCO_TRACKER_CAPACITY, "the table needs an empty slot to end a probe run");
+
+namespace {
+
+// Address byte ranges of RCN-211
+constexpr uint8_t kBroadcast = 0u;
+constexpr uint8_t kShortLast = 127u;
+constexpr uint8_t kAccessoryLast = 191u;
+constexpr uint8_t kLongFirst = 192u;
+constexpr uint8_t kLongLast = 231u;
+constexpr uint8_t kIdle = 255u;
+
+// Instructions of RCN-212
+constexpr uint8_t kSpeed128 = 0x3Fu;
+constexpr uint8_t kF13F20 = 0xDEu;
+constexpr uint8_t kF21F28 = 0xDFu;
+constexpr uint8_t kF29F36 = 0xD8u;
+
+// Fibonacci hashing of the 16 bit key onto the slot bits
+constexpr uint32_t slotBits() {
+  uint32_t bits = 0;
+  while ((1u << bits) < LOCO_TRACKER_CAPACITY) bits++;
+  return bits;
+}
+
+uint32_t slotOf(uint16_t key) {
+  return (static_cast<uint32_t>(key) * 2654435769u) >> (32u - slotBits());
+}
+
+}  // namespace
+
+static LocoTrackerEntry_t table[LOCO_TRACKER_CAPACITY];
+static LocoTrackerStats_t stats;
+static uint32_t windowStart = 0;
+static uint32_t windowPackets = 0;
+static bool seen = false;         // first_us valid
+
+static void clear(void)
+{
+  std::memset(table, 0, sizeof(table));
+  std::memset(&stats, 0, sizeof(stats));
+  windowStart = 0;
+  windowPackets = 0;
+  seen = false;
+}
+
+// Entry of a key, inserted if new; nullptr with the table full
+static LocoTrackerEntry_t* lookup(uint16_t key)
+{
+  uint32_t slot = slotOf(key);
+  uint32_t probe = 0;
+  while (table[slot].address != 0u) {
+    if (table[slot].address == key) {
+      return &table[slot];
+    }
+    slot = (slot + 1u) & (LOCO_TRACKER_CAPACITY - 1u);
+    probe++;
+  }
+  if (stats.locos >= LOCO_TRACKER_MAX_LOCOS) {
+    return nullptr;
+  }
+  stats.locos++;
+  if (probe > stats.max_probe) {
+    stats.max_probe = static_cast<uint16_t>(probe);
+  }
+  table[slot].address = key;
+  return &table[slot];
+}
+
+static void setFunctions(LocoTrackerEntry_t* entry, uint32_t mask, uint32_t state)
+{
+  entry->functions = (entry->functions & ~mask) | (state & mask);
+}
+
+// First instruction of a packet to a multi function decoder
+static void execute(LocoTrackerEntry_t* entry, uint8_t const* data, uint32_t count)
+{
+  if (count == 0u) {
+    return;
+  }
+  uint8_t const instruction = data[0];
+
+  if ((instruction & 0xC0u) == 0x40u) {
+    // 28 speed steps, bit 4 is the least significant step bit
+    uint32_t const step = ((instruction & 0x0Fu) << 1) | ((instruction >> 4) & 1u);
+    uint8_t flags = LOCO_TRACKER_FLAG_SPEED;
+    if (instruction & 0x20u) flags |= LOCO_TRACKER_FLAG_FORWARD;
+    if (step == 2u || step == 3u) flags |= LOCO_TRACKER_FLAG_ESTOP;
+    entry->speed = static_cast<uint8_t>(step > 3u ? step - 3u : 0u);
+    entry->flags = flags;
+  }
+  else if (instruction == kSpeed128 && count >= 2u) {
+    uint32_t const step = data[1] & 0x7Fu;
+    uint8_t flags = LOCO_TRACKER_FLAG_SPEED | LOCO_TRACKER_FLAG_STEPS128;
+    if (data[1] & 0x80u) flags |= LOCO_TRACKER_FLAG_FORWARD;
+    if (step == 1u) flags |= LOCO_TRACKER_FLAG_ESTOP;
+    entry->speed = static_cast<uint8_t>(step > 1u ? step - 1u : 0u);
+    entry->flags = flags;
+  }
+  else if ((instruction & 0xE0u) == 0x80u) {
+    // F0 is bit 4, F1-F4 bits 0-3
+    setFunctions(entry, 0x1Fu, ((instruction & 0x0Fu) << 1) | ((instruction >> 4) & 1u));
+  }
+  else if ((instruction & 0xF0u) == 0xB0u) {
+    setFunctions(entry, 0x0Fu << 5, (instruction & 0x0Fu) << 5);
+  }
+  else if ((instruction & 0xF0u) == 0xA0u) {
+    setFunctions(entry, 0x0Fu << 9, (instruction & 0x0Fu) << 9);
+  }
+  else if (instruction == kF13F20 && count >= 2u) {
+    setFunctions(entry, 0xFFu << 13, static_cast<uint32_t>(data[1]) << 13);
+  }
+  else if (instruction == kF21F28 && count >= 2u) {
+    setFunctions(entry, 0xFFu << 21, static_cast<uint32_t>(data[1]) << 21);
+  }
+  else if (instruction == kF29F36 && count >= 2u) {
+    setFunctions(entry, 0x07u << 29, static_cast<uint32_t>(data[1] & 0x07u) << 29);
+  }
+}
+
+extern "C" FAST_RAM_FLATTEN void loco_tracker_packet(const uint8_t* bytes, uint32_t length, uint32_t time_us)
+{
+  if (length < 3u) {
+    return;
+  }
+  stats.packets++;
+  if (!seen) {
+    seen = true;
+    stats.first_us = time_us;
+    windowStart = time_us;
+  }
+  stats.last_us = time_us;
+
+  uint8_t const first = bytes[0];
+  uint16_t key;
+  uint32_t data;
+  if (first == kBroadcast) {
+    stats.broadcast_packets++;
+    return;
+  }
+  else if (first <= kShortLast) {
+    key = first;
+    data = 1u;
+  }
+  else if (first <= kAccessoryLast) {
+    stats.accessory_packets++;
+    return;
+  }
+  else if (first >= kLongFirst && first <= kLongLast && length >= 4u) {
+    key = static_cast<uint16_t>(LOCO_TRACKER_LONG | ((first & 0x3Fu) << 8) | bytes[1]);
+    data = 2u;
+  }
+  else if (first == kIdle) {
+    stats.idle_packets++;
+    return;
+  }
+  else {
+    stats.other_packets++;
+    return;
+  }
+
+  stats.loco_packets++;
+  windowPackets++;
+  uint32_t const window = time_us - windowStart;
+  if (window >= LOCO_TRACKER_WINDOW_US) {
+    stats.rate = static_cast<uint32_t>(static_cast<uint64_t>(windowPackets) * 1000000u / window);
+    if (stats.rate > stats.peak_rate) {
+      stats.peak_rate = stats.rate;
+    }
+    windowStart = time_us;
+    windowPackets = 0;
+  }
+
+  LocoTrackerEntry_t* const entry = lookup(key);
+  if (!entry) {
+    stats.full++;
+    return;
+  }
+  if (entry->refreshes == 0u) {
+    entry->first_us = time_us;
+  }
+  else {
+    uint32_t const interval = time_us - entry->last_us;
+    if (interval > entry->max_interval_us) {
+      entry->max_interval_us = interval;
+    }
+    if (interval > stats.max_interval_us) {
+      stats.max_interval_us = interval;
+      stats.max_interval_address = key;
+    }
+  }
+  entry->last_us = time_us;
+  entry->refreshes++;
+  // The checksum is not an instruction byte
+  execute(entry, &bytes[data], length - data - 1u);
+}
+
+extern "C" void loco_tracker_enable(bool enable)
+{
+  sniffer_track(false);
+  stats.enabled = false;
+  if (!enable) {
+    return;
+  }
+  clear();
+  stats.enabled = true;
+  sniffer_track(true);
+}
+
+extern "C" bool loco_tracker_enabled(void)
+{
+  return stats.enabled;
+}
+
+extern "C" void loco_tracker_get_stats(LocoTrackerStats_t* out)
+{
+  uint32_t const primask = __get_PRIMASK();
+  __disable_irq();
+  *out = stats;
+  __set_PRIMASK(primask);
+}
+
+extern "C" uint32_t loco_tracker_read(uint32_t slot, LocoTrackerEntry_t* entries, uint32_t max, uint32_t* next)
+{
+  uint32_t count = 0;
+  for (; slot < LOCO_TRACKER_CAPACITY && count < max; slot++) {
+    uint32_t const primask = __get_PRIMASK();
+    __disable_irq();
+    entries[count] = table[slot];
+    __set_PRIMASK(primask);
+    if (entries[count].address != 0u) {
+      count++;
+    }
+  }
+  // Skip the empty slots behind the last entry, the host stops at the end
+  while (slot < LOCO_TRACKER_CAPACITY && table[slot].address == 0u) {
+    slot++;
+  }
+  if (next) {
+    *next = slot;
+  }
+  return count;
+}
+
+extern "C" bool loco_tracker_find(uint16_t address, LocoTrackerEntry_t* entry)
+{
+  if (address == 0u) {
+    return false;
+  }
+  uint32_t slot = slotOf(address);
+  for (uint32_t probe = 0; probe < LOCO_TRACKER_CAPACITY; probe++) {
+    uint32_t const primask = __get_PRIMASK();
+    __disable_irq();
+    *entry = table[slot];
+    __set_PRIMASK(primask);
+    if (entry->address == 0u) {
+      return false;
+    }
+    if (entry->address == address) {
+      return true;
+    }
+    slot = (slot + 1u) & (LOCO_TRACKER_CAPACITY - 1u);
+  }
+  return false;
+}
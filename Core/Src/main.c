@@ -31,6 +31,8 @@
 #include "version.h"
 #include "decoder.h"
 #include "ux_device_descriptors.h"
+#include "console_uart.h"
+#include "boot.h"
 
 /* USER CODE END Includes */
 
@@ -97,12 +99,9 @@ static void MX_GPIO_Init(void);
 static void MX_ICACHE_Init(void);
 static void MX_ETH_Init(void);
 static void MX_TIM2_Init(void);
-static void MX_FDCAN1_Init(void);
 static void MX_USART2_UART_Init(void);
 static void MX_RTC_Init(void);
 static void MX_TIM15_Init(void);
-static void MX_SPI5_Init(void);
-static void MX_SPI2_Init(void);
 static void MX_DAC1_Init(void);
 static void MX_USART6_UART_Init(void);
 static void MX_ADC1_Init(void);
@@ -248,6 +247,7 @@ int main(void)
   HAL_Init();
 
   /* USER CODE BEGIN Init */
+  boot_profile_start();
 
   /* USER CODE END Init */
 
@@ -258,6 +258,7 @@ int main(void)
   PeriphCommonClock_Config();
 
   /* USER CODE BEGIN SysInit */
+  boot_mark("clock");
     __retarget_lock_init(&my_lock);
   /* USER CODE END SysInit */
 
@@ -267,12 +268,9 @@ int main(void)
   MX_ICACHE_Init();
   MX_ETH_Init();
   MX_TIM2_Init();
-  MX_FDCAN1_Init();
   MX_USART2_UART_Init();
   MX_RTC_Init();
   MX_TIM15_Init();
-  MX_SPI5_Init();
-  MX_SPI2_Init();
   MX_DAC1_Init();
   MX_USART6_UART_Init();
   MX_ADC1_Init();
@@ -281,6 +279,8 @@ int main(void)
   MX_UART4_Init();
   MX_ADC2_Init();
   /* USER CODE BEGIN 2 */
+  boot_mark("peripherals");
+
   /* MPU Configuration--------------------------------------------------------*/
   /* By default, all the AHB memory range is cacheable. For regions where caching is not
      practical (High-cycle data area), MPU has to be used to disable local cacheability.
@@ -294,6 +294,9 @@ int main(void)
   /* Initialize User push-button without interrupt mode. */
   BSP_PB_Init(BUTTON_USER, BUTTON_MODE_GPIO);
 
+  /* Console output is buffered and sent by DMA from here on */
+  console_init();
+
   /* -- Sample board code to send message over COM port ---- */
   printf("Welcome to DCC tester world !\n\r");
   printf("Firmware version: %s\n", FW_VERSION_STRING);
@@ -301,6 +304,7 @@ int main(void)
   printf("CPU ID: 0x%X\n", (unsigned int)HAL_GetDEVID());
   printf("Revision ID: 0x%X\n", (unsigned int)HAL_GetREVID());
   printf("Compiled at %s %s\n\n", __DATE__, __TIME__);
+  boot_mark("console");
 
   /* USER CODE END 2 */
 
@@ -654,7 +658,7 @@ static void MX_ETH_Init(void)
   * @param None
   * @retval None
   */
-static void MX_FDCAN1_Init(void)
+void MX_FDCAN1_Init(void)
 {
 
   /* USER CODE BEGIN FDCAN1_Init 0 */
@@ -736,12 +740,8 @@ static void MX_ICACHE_Init(void)
 
   /* USER CODE END ICACHE_Init 1 */
 
-  /** Enable instruction cache in 1-way (direct mapped cache)
+  /** Enable instruction cache (default 2-ways set associative cache)
   */
-  if (HAL_ICACHE_ConfigAssociativityMode(ICACHE_1WAY) != HAL_OK)
-  {
-    Error_Handler();
-  }
   if (HAL_ICACHE_Enable() != HAL_OK)
   {
     Error_Handler();
@@ -867,7 +867,7 @@ void MX_SDMMC1_SD_Init(void)
   * @param None
   * @retval None
   */
-static void MX_SPI2_Init(void)
+void MX_SPI2_Init(void)
 {
 
   /* USER CODE BEGIN SPI2_Init 0 */
@@ -914,7 +914,7 @@ static void MX_SPI2_Init(void)
   * @param None
   * @retval None
   */
-static void MX_SPI5_Init(void)
+void MX_SPI5_Init(void)
 {
 
   /* USER CODE BEGIN SPI5_Init 0 */
@@ -1330,12 +1330,18 @@ void MX_USB_PCD_Init(void)
     Error_Handler();
   }
   /* USER CODE BEGIN USB_Init 2 */
-  HAL_PCDEx_PMAConfig(&hpcd_USB_DRD_FS, 0x00, PCD_SNG_BUF, 0x20);
-  HAL_PCDEx_PMAConfig(&hpcd_USB_DRD_FS, 0x80, PCD_SNG_BUF, 0x60);
-  HAL_PCDEx_PMAConfig(&hpcd_USB_DRD_FS, USBD_CDCACM_EPINCMD_ADDR, PCD_SNG_BUF, 0xA0);
-  HAL_PCDEx_PMAConfig(&hpcd_USB_DRD_FS, USBD_CDCACM_EPOUT_ADDR, PCD_SNG_BUF, 0xE0);
-  HAL_PCDEx_PMAConfig(&hpcd_USB_DRD_FS, USBD_CDCACM_EPIN_ADDR, PCD_SNG_BUF, 0x120);
-  HAL_PCDEx_PMAConfig(&hpcd_USB_DRD_FS, 0x83, PCD_SNG_BUF, 0x140);
+  /* Buffers after the descriptor table, 8 bytes for each of the 8 endpoints */
+  HAL_PCDEx_PMAConfig(&hpcd_USB_DRD_FS, 0x00, PCD_SNG_BUF, 0x40);
+  HAL_PCDEx_PMAConfig(&hpcd_USB_DRD_FS, 0x80, PCD_SNG_BUF, 0x80);
+  HAL_PCDEx_PMAConfig(&hpcd_USB_DRD_FS, USBD_CDCACM_EPINCMD_ADDR, PCD_SNG_BUF, 0xC0);
+  HAL_PCDEx_PMAConfig(&hpcd_USB_DRD_FS, USBD_CDCACM_EPOUT_ADDR, PCD_SNG_BUF, 0xD0);
+  HAL_PCDEx_PMAConfig(&hpcd_USB_DRD_FS, USBD_CDCACM_EPIN_ADDR, PCD_SNG_BUF, 0x110);
+  HAL_PCDEx_PMAConfig(&hpcd_USB_DRD_FS, 0x83, PCD_SNG_BUF, 0x150);
+  /* Capture function, the bulk IN endpoint double buffered: one packet is sent
+     while the next is copied */
+  HAL_PCDEx_PMAConfig(&hpcd_USB_DRD_FS, USBD_CAPTURE_EPINCMD_ADDR, PCD_SNG_BUF, 0x190);
+  HAL_PCDEx_PMAConfig(&hpcd_USB_DRD_FS, USBD_CAPTURE_EPOUT_ADDR, PCD_SNG_BUF, 0x1A0);
+  HAL_PCDEx_PMAConfig(&hpcd_USB_DRD_FS, USBD_CAPTURE_EPIN_ADDR, PCD_DBL_BUF, 0x1E0U | (0x220U << 16));
   /* USER CODE END USB_Init 2 */
 
 }
@@ -1495,10 +1501,10 @@ int _write(int file, char *ptr, int len) {
   // Use mutex to ensure thread safety
 //    stm32_lock_acquire(&newlib_lock);
     __retarget_lock_acquire(my_lock);
-    HAL_StatusTypeDef status = HAL_UART_Transmit(&huart3, (uint8_t*)ptr, (uint16_t)len, HAL_MAX_DELAY);
+    int written = console_write(ptr, len);
 //    stm32_lock_release(&newlib_lock);
     __retarget_lock_release(my_lock);
-    return (status == HAL_OK) ? len : 0;
+    return written;
 }
 
 
@@ -1524,7 +1530,8 @@ PUTCHAR_PROTOTYPE
 {
   /* Place your implementation of putchar here */
   /* e.g. write a character to the USART3 and Loop until the end of transmission */
-  HAL_UART_Transmit(&huart3, (uint8_t *)&ch, 1, 0xFFFF);
+  char c = (char)ch;
+  console_write(&c, 1);
 
   return ch;
 }
@@ -0,0 +1,314 @@
+/**
+ * @file margin_sweep.c
+ * @brief Timing margin search: configuration, command packets, detectors and bisection
+ *
+ * The configuration is written by the RPC thread and only read by the command
+ * station thread while it runs, configuring is refused during a run. The
+ * search state and the results are written by the command station thread.
+ */
+
+#include "margin_sweep.h"
+#include "analog_manager.h"
+#include "main.h"
+#include "packet_program.h"
+#include <string.h>
+
+typedef enum {
+    PHASE_BASELINE = 0,
+    PHASE_LIMIT,
+    PHASE_BISECT,
+    PHASE_DONE
+} SweepPhase_t;
+
+static MarginSweepConfig_t g_config;
+static bool g_configured = false;
+static MarginSweepStatus_t g_status;
+static SweepPhase_t g_phase = PHASE_DONE;
+static uint16_t g_value = 0;        // duration under test on the current edge
+static uint8_t g_passes = 0;        // trials of g_value passed so far
+static uint32_t g_startMs = 0;
+
+static bool program_running(void)
+{
+    PacketProgramStatus_t status;
+    CommandStation_GetProgramStatus(&status);
+    return status.running;
+}
+
+int MarginSweep_Configure(const MarginSweepConfig_t *config, const char **error)
+{
+    const char *dummy;
+    if (error == NULL) {
+        error = &dummy;
+    }
+
+    if (program_running()) {
+        *error = "program already running";
+        return -1;
+    }
+    if (config->address == 0u || config->address > 10239u) {
+        *error = "address must be 1-10239";
+        return -1;
+    }
+    if (config->detector >= MARGIN_DETECT_COUNT) {
+        *error = "invalid detector";
+        return -1;
+    }
+    if (config->edges == 0u || (config->edges & ~MARGIN_EDGES_ALL) != 0u) {
+        *error = "invalid edges";
+        return -1;
+    }
+    if (config->trials == 0u || config->trials > MARGIN_SWEEP_MAX_TRIALS) {
+        *error = "trials must be 1-10";
+        return -1;
+    }
+    if (config->packets == 0u || config->packets > MARGIN_SWEEP_MAX_PACKETS) {
+        *error = "packets must be 1-100";
+        return -1;
+    }
+    if (config->resolution_us == 0u) {
+        *error = "resolution_us must be at least 1";
+        return -1;
+    }
+    if (config->timeout_ms > MARGIN_SWEEP_MAX_WAIT_MS || config->settle_ms > MARGIN_SWEEP_MAX_WAIT_MS) {
+        *error = "timeout_ms and settle_ms must be 0-10000";
+        return -1;
+    }
+    if (config->detector == MARGIN_DETECT_CURRENT && (config->current_delta_ma == 0u || (config->speed & 0x7Fu) < 2u)) {
+        *error = "current detector needs current_delta_ma and a speed step";
+        return -1;
+    }
+    if (config->detector == MARGIN_DETECT_IO && config->io_mask == 0u) {
+        *error = "io detector needs io_mask";
+        return -1;
+    }
+    for (uint32_t e = 0; e < MARGIN_EDGE_COUNT; e++) {
+        if (config->limit_us[e] == 0u || config->limit_us[e] > MARGIN_SWEEP_MAX_US) {
+            *error = "limits must be 1-10000 us";
+            return -1;
+        }
+    }
+
+    g_config = *config;
+    g_configured = true;
+    return 0;
+}
+
+int MarginSweep_Prepare(const char **error)
+{
+    const char *dummy;
+    if (error == NULL) {
+        error = &dummy;
+    }
+
+    if (!g_configured) {
+        *error = "no sweep configured";
+        return -1;
+    }
+    if (g_config.detector == MARGIN_DETECT_CURRENT && !analog_manager_is_streaming()) {
+        *error = "current detector requires continuous analog sampling";
+        return -1;
+    }
+    return 0;
+}
+
+void MarginSweep_GetConfig(MarginSweepConfig_t *config)
+{
+    *config = g_config;
+}
+
+uint8_t MarginSweep_Command(bool active, uint8_t *bytes)
+{
+    uint8_t length = 0;
+    if (g_config.address <= 127u) {
+        bytes[length++] = (uint8_t)g_config.address;
+    }
+    else {
+        bytes[length++] = (uint8_t)(0xC0u | (g_config.address >> 8));
+        bytes[length++] = (uint8_t)(g_config.address & 0xFFu);
+    }
+
+    if (g_config.detector == MARGIN_DETECT_CURRENT) {
+        // 128 speed steps, at rest keeps the direction
+        bytes[length++] = 0x3Fu;
+        bytes[length++] = active ? g_config.speed : (uint8_t)(g_config.speed & 0x80u);
+    }
+    else {
+        // Function group one, F0 is bit 4
+        bytes[length++] = active ? 0x90u : 0x80u;
+    }
+
+    uint8_t checksum = 0;
+    for (uint8_t i = 0; i < length; i++) {
+        checksum ^= bytes[i];
+    }
+    bytes[length++] = checksum;
+    return length;
+}
+
+bool MarginSweep_Responded(const TestProbe_t *probe)
+{
+    if (g_config.detector == MARGIN_DETECT_CURRENT) {
+        return probe->current_ma >= (uint32_t)g_status.rest_ma + g_config.current_delta_ma;
+    }
+    return (probe->io & g_config.io_mask) == (g_config.io_level & g_config.io_mask);
+}
+
+bool MarginSweep_AtRest(const TestProbe_t *probe)
+{
+    if (g_config.detector == MARGIN_DETECT_CURRENT) {
+        return probe->current_ma <= (uint32_t)g_status.rest_ma + g_config.current_delta_ma / 2u;
+    }
+    return (probe->io & g_config.io_mask) == (~g_config.io_level & g_config.io_mask);
+}
+
+static uint16_t nominal(uint8_t edge)
+{
+    return edge <= MARGIN_EDGE_BIT1_MAX ? g_status.nominal_bit1_us : g_status.nominal_bit0_us;
+}
+
+static uint16_t distance(uint16_t a, uint16_t b)
+{
+    return a > b ? (uint16_t)(a - b) : (uint16_t)(b - a);
+}
+
+// The limit on the wrong side of the configured value is the configured value
+static uint16_t edge_limit(uint8_t edge)
+{
+    uint16_t const limit = g_config.limit_us[edge];
+    uint16_t const start = nominal(edge);
+    bool const lower = edge == MARGIN_EDGE_BIT1_MIN || edge == MARGIN_EDGE_BIT0_MIN;
+    return (lower ? limit < start : limit > start) ? limit : start;
+}
+
+// Move on to the next enabled edge, or finish
+static void next_edge(uint8_t first)
+{
+    for (uint8_t edge = first; edge < MARGIN_EDGE_COUNT; edge++) {
+        if (!((g_config.edges >> edge) & 1u)) {
+            continue;
+        }
+        MarginEdgeResult_t *result = &g_status.edges[edge];
+        result->searched = true;
+        result->pass_us = nominal(edge);
+        uint16_t const limit = edge_limit(edge);
+        if (limit == result->pass_us) {
+            result->limited = true;
+            continue;
+        }
+        g_status.edge = edge;
+        g_phase = PHASE_LIMIT;
+        g_value = limit;
+        return;
+    }
+    g_phase = PHASE_DONE;
+    g_status.completed = true;
+}
+
+// Bisect the current edge, or store its result once pass and fail are close enough
+static void bisect(void)
+{
+    MarginEdgeResult_t *result = &g_status.edges[g_status.edge];
+    if (distance(result->pass_us, result->fail_us) <= g_config.resolution_us) {
+        next_edge((uint8_t)(g_status.edge + 1u));
+        return;
+    }
+    g_phase = PHASE_BISECT;
+    g_value = (uint16_t)(((uint32_t)result->pass_us + result->fail_us) / 2u);
+}
+
+void MarginSweep_Start(uint16_t bit1_us, uint16_t bit0_us, uint16_t rest_ma)
+{
+    memset(&g_status, 0, sizeof(g_status));
+    g_status.nominal_bit1_us = bit1_us;
+    g_status.nominal_bit0_us = bit0_us;
+    g_status.rest_ma = rest_ma;
+    g_phase = PHASE_BASELINE;
+    g_passes = 0;
+    g_startMs = HAL_GetTick();
+    g_status.running = true;
+}
+
+bool MarginSweep_Next(uint16_t *bit1_us, uint16_t *bit0_us)
+{
+    if (g_phase == PHASE_DONE) {
+        return false;
+    }
+    *bit1_us = g_status.nominal_bit1_us;
+    *bit0_us = g_status.nominal_bit0_us;
+    if (g_phase != PHASE_BASELINE) {
+        if (g_status.edge <= MARGIN_EDGE_BIT1_MAX) {
+            *bit1_us = g_value;
+        }
+        else {
+            *bit0_us = g_value;
+        }
+    }
+    g_status.bit1_us = *bit1_us;
+    g_status.bit0_us = *bit0_us;
+    return true;
+}
+
+void MarginSweep_Report(bool passed)
+{
+    g_status.trials++;
+    if (g_phase != PHASE_BASELINE) {
+        g_status.edges[g_status.edge].trials++;
+    }
+    if (passed && ++g_passes < g_config.trials) {
+        return;
+    }
+    g_passes = 0;
+
+    MarginEdgeResult_t *result = &g_status.edges[g_status.edge];
+    switch (g_phase) {
+    case PHASE_BASELINE:
+        if (!passed) {
+            g_status.error = "decoder does not respond at the configured timing";
+            g_phase = PHASE_DONE;
+            return;
+        }
+        next_edge(0u);
+        break;
+    case PHASE_LIMIT:
+        if (passed) {
+            result->pass_us = g_value;
+            result->limited = true;
+            next_edge((uint8_t)(g_status.edge + 1u));
+        }
+        else {
+            result->fail_us = g_value;
+            bisect();
+        }
+        break;
+    case PHASE_BISECT:
+        if (passed) {
+            result->pass_us = g_value;
+        }
+        else {
+            result->fail_us = g_value;
+        }
+        bisect();
+        break;
+    default:
+        break;
+    }
+}
+
+void MarginSweep_End(const char *error)
+{
+    if (error != NULL && g_status.error == NULL) {
+        g_status.error = error;
+    }
+    g_phase = PHASE_DONE;
+    g_status.elapsed_ms = HAL_GetTick() - g_startMs;
+    g_status.running = false;
+}
+
+void MarginSweep_GetStatus(MarginSweepStatus_t *status)
+{
+    *status = g_status;
+    if (status->running) {
+        status->elapsed_ms = HAL_GetTick() - g_startMs;
+    }
+}
@@ -0,0 +1,235 @@
+/**
+ * @file memory_map.c
+ * @brief Where the RAM went: linker sections and every RTOS object
+ *
+ * The created lists are walked with interrupts disabled, a few pointer hops
+ * and copies per object. Stack high water marks are scanned afterwards with
+ * interrupts enabled.
+ */
+
+#include "memory_map.h"
+#include "profiler.h"
+#include "rtos_static.h"
+#include "stm32h5xx.h"
+#include "tx_api.h"
+#include "tx_block_pool.h"
+#include "tx_byte_pool.h"
+#include "tx_event_flags.h"
+#include "tx_mutex.h"
+#include "tx_queue.h"
+#include "tx_semaphore.h"
+#include "tx_thread.h"
+#include "tx_timer.h"
+#include "nx_api.h"
+#include "nx_packet.h"
+#include <string.h>
+
+#define MEMORY_MAP_MAX_POOLS    8u
+
+// Linker script symbols (STM32H563xx_FLASH.ld)
+extern uint8_t _sdata[], _edata[], _sbss[], _ebss[], end[], _sstack[], _estack[];
+extern uint8_t _Min_Heap_Size[];
+
+static const char *const kTypeNames[MEMORY_OBJECT_COUNT] = {
+    "thread", "queue", "semaphore", "mutex", "event_flags", "timer",
+    "byte_pool", "block_pool", "packet_pool"
+};
+
+typedef struct {
+    uintptr_t start;
+    uint32_t size;
+    const char *name;
+} PoolArea_t;
+
+typedef struct {
+    uint32_t index;             // objects walked so far
+    uint32_t first;
+    uint32_t max;
+    uint32_t count;             // objects copied
+    MemoryObject_t *objects;
+    PoolArea_t pools[MEMORY_MAP_MAX_POOLS];
+    uint32_t pool_count;
+    uint32_t static_bytes;
+    uint32_t pool_bytes;
+    uint32_t pool_free_bytes;
+} Walk_t;
+
+static const char *pool_of(const Walk_t *walk, const void *address)
+{
+    uintptr_t const a = (uintptr_t)address;
+    for (uint32_t i = 0; i < walk->pool_count; i++) {
+        if (a >= walk->pools[i].start && a - walk->pools[i].start < walk->pools[i].size) {
+            return walk->pools[i].name;
+        }
+    }
+    return NULL;
+}
+
+static void walk_add(Walk_t *walk, MemoryObjectType_t type, const char *name,
+                     const void *address, uint32_t size, uint32_t used)
+{
+    const char *pool = NULL;
+    if (type == MEMORY_OBJECT_BYTE_POOL) {
+        walk->pool_bytes += size;
+        walk->pool_free_bytes += size - used;
+    }
+    else {
+        pool = pool_of(walk, address);
+        if (pool == NULL) {
+            walk->static_bytes += size;
+        }
+    }
+
+    uint32_t const index = walk->index++;
+    if (index < walk->first || walk->count >= walk->max) {
+        return;
+    }
+    MemoryObject_t *const object = &walk->objects[walk->count++];
+    memset(object, 0, sizeof(*object));
+    if (name != NULL) {
+        strncpy(object->name, name, MEMORY_MAP_NAME_LENGTH - 1u);
+    }
+    object->type = (uint8_t)type;
+    object->pool = pool;
+    object->address = (uint32_t)(uintptr_t)address;
+    object->size = size;
+    object->used = used;
+}
+
+// Interrupts disabled: the byte pool areas first, the placement of the others depends on them
+static void walk_objects(Walk_t *walk)
+{
+    TX_BYTE_POOL *byte_pool = _tx_byte_pool_created_ptr;
+    for (ULONG i = 0; i < _tx_byte_pool_created_count && byte_pool != NULL; i++) {
+        if (walk->pool_count < MEMORY_MAP_MAX_POOLS) {
+            PoolArea_t *const area = &walk->pools[walk->pool_count++];
+            area->start = (uintptr_t)byte_pool->tx_byte_pool_start;
+            area->size = (uint32_t)byte_pool->tx_byte_pool_size;
+            area->name = byte_pool->tx_byte_pool_name;
+        }
+        byte_pool = byte_pool->tx_byte_pool_created_next;
+    }
+
+    TX_THREAD *thread = _tx_thread_created_ptr;
+    for (ULONG i = 0; i < _tx_thread_created_count && thread != NULL; i++) {
+        walk_add(walk, MEMORY_OBJECT_THREAD, thread->tx_thread_name, thread->tx_thread_stack_start,
+                 (uint32_t)(sizeof(TX_THREAD) + thread->tx_thread_stack_size), 0u);
+        thread = thread->tx_thread_created_next;
+    }
+
+    TX_QUEUE *queue = _tx_queue_created_ptr;
+    for (ULONG i = 0; i < _tx_queue_created_count && queue != NULL; i++) {
+        uint32_t const message = (uint32_t)(queue->tx_queue_message_size * sizeof(ULONG));
+        walk_add(walk, MEMORY_OBJECT_QUEUE, queue->tx_queue_name, queue->tx_queue_start,
+                 (uint32_t)(sizeof(TX_QUEUE) + queue->tx_queue_capacity * message),
+                 (uint32_t)(queue->tx_queue_enqueued * message));
+        queue = queue->tx_queue_created_next;
+    }
+
+    TX_SEMAPHORE *semaphore = _tx_semaphore_created_ptr;
+    for (ULONG i = 0; i < _tx_semaphore_created_count && semaphore != NULL; i++) {
+        walk_add(walk, MEMORY_OBJECT_SEMAPHORE, semaphore->tx_semaphore_name, semaphore, sizeof(TX_SEMAPHORE), 0u);
+        semaphore = semaphore->tx_semaphore_created_next;
+    }
+
+    TX_MUTEX *mutex = _tx_mutex_created_ptr;
+    for (ULONG i = 0; i < _tx_mutex_created_count && mutex != NULL; i++) {
+        walk_add(walk, MEMORY_OBJECT_MUTEX, mutex->tx_mutex_name, mutex, sizeof(TX_MUTEX), 0u);
+        mutex = mutex->tx_mutex_created_next;
+    }
+
+    TX_EVENT_FLAGS_GROUP *group = _tx_event_flags_created_ptr;
+    for (ULONG i = 0; i < _tx_event_flags_created_count && group != NULL; i++) {
+        walk_add(walk, MEMORY_OBJECT_EVENT_FLAGS, group->tx_event_flags_group_name, group,
+                 sizeof(TX_EVENT_FLAGS_GROUP), 0u);
+        group = group->tx_event_flags_group_created_next;
+    }
+
+    TX_TIMER *timer = _tx_timer_created_ptr;
+    for (ULONG i = 0; i < _tx_timer_created_count && timer != NULL; i++) {
+        walk_add(walk, MEMORY_OBJECT_TIMER, timer->tx_timer_name, timer, sizeof(TX_TIMER), 0u);
+        timer = timer->tx_timer_created_next;
+    }
+
+    byte_pool = _tx_byte_pool_created_ptr;
+    for (ULONG i = 0; i < _tx_byte_pool_created_count && byte_pool != NULL; i++) {
+        uint32_t const size = (uint32_t)byte_pool->tx_byte_pool_size;
+        walk_add(walk, MEMORY_OBJECT_BYTE_POOL, byte_pool->tx_byte_pool_name, byte_pool->tx_byte_pool_start,
+                 size, size - (uint32_t)byte_pool->tx_byte_pool_available);
+        byte_pool = byte_pool->tx_byte_pool_created_next;
+    }
+
+    TX_BLOCK_POOL *block_pool = _tx_block_pool_created_ptr;
+    for (ULONG i = 0; i < _tx_block_pool_created_count && block_pool != NULL; i++) {
+        uint32_t const size = (uint32_t)block_pool->tx_block_pool_size;
+        uint32_t const total = (uint32_t)block_pool->tx_block_pool_total;
+        uint32_t const taken = total - (uint32_t)block_pool->tx_block_pool_available;
+        walk_add(walk, MEMORY_OBJECT_BLOCK_POOL, block_pool->tx_block_pool_name, block_pool->tx_block_pool_start,
+                 (uint32_t)sizeof(TX_BLOCK_POOL) + size, total ? size / total * taken : 0u);
+        block_pool = block_pool->tx_block_pool_created_next;
+    }
+
+    NX_PACKET_POOL *packet_pool = _nx_packet_pool_created_ptr;
+    for (ULONG i = 0; i < _nx_packet_pool_created_count && packet_pool != NULL; i++) {
+        uint32_t const size = (uint32_t)packet_pool->nx_packet_pool_size;
+        uint32_t const total = (uint32_t)packet_pool->nx_packet_pool_total;
+        uint32_t const taken = total - (uint32_t)packet_pool->nx_packet_pool_available;
+        walk_add(walk, MEMORY_OBJECT_PACKET_POOL, packet_pool->nx_packet_pool_name, packet_pool->nx_packet_pool_start,
+                 (uint32_t)sizeof(NX_PACKET_POOL) + size, total ? size / total * taken : 0u);
+        packet_pool = packet_pool->nx_packet_pool_created_next;
+    }
+}
+
+static void walk_locked(Walk_t *walk)
+{
+    uint32_t const primask = __get_PRIMASK();
+    __disable_irq();
+    walk_objects(walk);
+    __set_PRIMASK(primask);
+}
+
+void memory_map_summary(MemoryMapSummary_t *summary)
+{
+    Walk_t walk;
+    memset(&walk, 0, sizeof(walk));
+    walk_locked(&walk);
+
+    memset(summary, 0, sizeof(*summary));
+    summary->ram_start = (uint32_t)(uintptr_t)_sdata;
+    summary->ram_size = (uint32_t)(_estack - _sdata);
+    summary->data_bytes = (uint32_t)(_edata - _sdata);
+    summary->bss_bytes = (uint32_t)(_ebss - _sbss);
+    summary->heap_bytes = (uint32_t)(uintptr_t)_Min_Heap_Size;
+    summary->stack_bytes = (uint32_t)(_estack - _sstack);
+    summary->free_bytes = (uint32_t)(_sstack - (end + summary->heap_bytes));
+    summary->static_bytes = walk.static_bytes;
+    summary->pool_bytes = walk.pool_bytes;
+    summary->pool_free_bytes = walk.pool_free_bytes;
+    summary->objects = walk.index;
+    summary->static_allocation = RTOS_STATIC_ALLOCATION != 0;
+}
+
+uint32_t memory_map_objects(uint32_t first, MemoryObject_t *objects, uint32_t max)
+{
+    Walk_t walk;
+    memset(&walk, 0, sizeof(walk));
+    walk.first = first;
+    walk.max = max;
+    walk.objects = objects;
+    walk_locked(&walk);
+
+    // Scanning the stacks takes a while, interrupts stay enabled
+    for (uint32_t i = 0; i < walk.count; i++) {
+        MemoryObject_t *const object = &objects[i];
+        if (object->type == MEMORY_OBJECT_THREAD) {
+            object->used = profiler_stack_used((const void *)(uintptr_t)object->address,
+                                               object->size - (uint32_t)sizeof(TX_THREAD));
+        }
+    }
+    return walk.count;
+}
+
+const char *memory_map_type_name(MemoryObjectType_t type)
+{
+    return (uint32_t)type < MEMORY_OBJECT_COUNT ? kTypeNames[type] : "?";
+}
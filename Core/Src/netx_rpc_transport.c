@@ -0,0 +1,306 @@
+/**
+ * @file netx_rpc_transport.c
+ * @brief RPC over TCP and UDP on the NetXDuo Ethernet interface
+ *
+ * One thread serves the TCP socket, one the UDP socket. Both post request
+ * descriptors on the command bus (rpc_bus.h), the RPC thread sends the
+ * responses itself and returns the descriptors through freeQueue.
+ */
+
+#include "netx_rpc_transport.h"
+#include "app_netxduo.h"
+#include "cmsis_os2.h"
+#include "rtos_static.h"
+#include "parameter_manager.h"
+#include "rpc_bus.h"
+#include "rpc_server.h"
+#include <stdio.h>
+#include <string.h>
+
+#define NETX_RPC_REQUESTS      4u                           // descriptors in flight
+#define NETX_RPC_TCP_WINDOW    (4u * 1024u)
+#define NETX_RPC_UDP_QUEUE     4u                           // datagrams queued on the socket
+#define NETX_RPC_SEND_TIMEOUT  (NX_IP_PERIODIC_RATE / 10u)  // 100 ms
+
+_Static_assert(NETX_RPC_REQUESTS <= RPC_BUS_NET_REQUESTS, "the command bus must hold every descriptor");
+
+extern NX_IP NetXDuoEthIpInstance;
+extern NX_PACKET_POOL NxAppPool;
+
+static NX_TCP_SOCKET tcpSocket;
+static NX_UDP_SOCKET udpSocket;
+static uint16_t serverPort;
+static volatile bool tcpConnected = false;
+static volatile uint32_t tcpSession = 0;
+
+// Last UDP sender, receives the job notifications of UDP requests
+static volatile uint32_t udpPeerIp = 0;
+static volatile uint16_t udpPeerPort = 0;
+
+static NetxRpcRequest_t requests[NETX_RPC_REQUESTS];
+static osMessageQueueId_t freeQueue;
+
+// TCP requests split across segments, owned by the RPC thread while handed over
+static char reassembly[RX_BUFFER_SIZE];
+static uint32_t reassemblyLength = 0;
+static osSemaphoreId_t reassemblyDone_sem;
+RTOS_MESSAGE_QUEUE(netxRpcFreeQueue, NETX_RPC_REQUESTS, sizeof(NetxRpcRequest_t *));
+RTOS_SEMAPHORE(reassemblyDone_sem);
+
+static NetxRpcStats_t stats;
+
+RTOS_THREAD_MEMORY(rpcTcpTask, 2048);
+static const osThreadAttr_t rpcTcpTask_attributes = {
+    .name = "rpcTcpTask",
+    RTOS_THREAD_ATTR_MEMORY(rpcTcpTask),
+    .priority = osPriorityBelowNormal4
+};
+
+RTOS_THREAD_MEMORY(rpcUdpTask, 2048);
+static const osThreadAttr_t rpcUdpTask_attributes = {
+    .name = "rpcUdpTask",
+    RTOS_THREAD_ATTR_MEMORY(rpcUdpTask),
+    .priority = osPriorityBelowNormal4
+};
+
+static void submit(uint8_t origin, const char *data, uint32_t length, NX_PACKET *packet,
+                   uint32_t peer_ip, uint16_t peer_port)
+{
+    NetxRpcRequest_t *request;
+
+    // Blocks while the RPC thread is busy, TCP flow control pushes back on the host
+    osMessageQueueGet(freeQueue, &request, NULL, osWaitForever);
+    request->data = data;
+    request->length = length;
+    request->origin = origin;
+    request->session = tcpSession;
+    request->peer_ip = peer_ip;
+    request->peer_port = peer_port;
+    request->packet = packet;
+    stats.requests++;
+    // Every lane holds every descriptor, this cannot fail
+    RpcBus_Post(origin, request, data, length, RPC_FRAME_JSON);
+}
+
+// Hand every complete request of the reassembly buffer over and keep the partial rest
+static void reassembly_flush(void)
+{
+    uint32_t end = reassemblyLength;
+    while (end > 0u && reassembly[end - 1u] != '\n') {
+        end--;
+    }
+    if (end == 0u) {
+        return;
+    }
+
+    stats.reassembled++;
+    submit(RPC_ORIGIN_TCP, reassembly, end, NULL, 0u, 0u);
+    osSemaphoreAcquire(reassemblyDone_sem, osWaitForever);
+    reassemblyLength -= end;
+    memmove(reassembly, &reassembly[end], reassemblyLength);
+}
+
+static void tcp_receive(NX_PACKET *packet)
+{
+    // Usual case, whole requests in a single buffer: no copy
+    if (reassemblyLength == 0u && packet->nx_packet_next == NX_NULL && packet->nx_packet_length > 0u &&
+        packet->nx_packet_append_ptr[-1] == '\n') {
+        submit(RPC_ORIGIN_TCP, (const char *)packet->nx_packet_prepend_ptr, packet->nx_packet_length, packet, 0u, 0u);
+        return;
+    }
+
+    for (NX_PACKET *segment = packet; segment != NX_NULL; segment = segment->nx_packet_next) {
+        const char *data = (const char *)segment->nx_packet_prepend_ptr;
+        uint32_t length = (uint32_t)(segment->nx_packet_append_ptr - segment->nx_packet_prepend_ptr);
+        while (length > 0u) {
+            uint32_t chunk = RX_BUFFER_SIZE - reassemblyLength;
+            if (chunk > length) {
+                chunk = length;
+            }
+            memcpy(&reassembly[reassemblyLength], data, chunk);
+            reassemblyLength += chunk;
+            data += chunk;
+            length -= chunk;
+            reassembly_flush();
+            if (reassemblyLength == RX_BUFFER_SIZE) {
+                stats.overflows++;
+                reassemblyLength = 0u;
+            }
+        }
+    }
+    nx_packet_release(packet);
+}
+
+static void wait_for_address(void)
+{
+    ULONG status;
+    while (nx_ip_status_check(&NetXDuoEthIpInstance, NX_IP_ADDRESS_RESOLVED, &status, NX_WAIT_FOREVER) != NX_SUCCESS) {
+        osDelay(1000u);
+    }
+}
+
+static void NetxRpcTcpTask(void *argument)
+{
+    (void)argument;
+    NX_PACKET *packet;
+
+    wait_for_address();
+    if (nx_tcp_socket_create(&NetXDuoEthIpInstance, &tcpSocket, "RPC TCP Socket", NX_IP_NORMAL, NX_FRAGMENT_OKAY,
+                             NX_IP_TIME_TO_LIVE, NETX_RPC_TCP_WINDOW, NX_NULL, NX_NULL) != NX_SUCCESS ||
+        nx_tcp_server_socket_listen(&NetXDuoEthIpInstance, serverPort, &tcpSocket, 1, NX_NULL) != NX_SUCCESS) {
+        printf("Network RPC: TCP port %u unavailable\n", serverPort);
+        osThreadExit();
+    }
+    printf("Network RPC listening on port %u\n", serverPort);
+
+    for (;;) {
+        if (nx_tcp_server_socket_accept(&tcpSocket, NX_WAIT_FOREVER) == NX_SUCCESS) {
+            tcpSession++;
+            tcpConnected = true;
+            stats.connections++;
+            reassemblyLength = 0u;
+            printf("Network RPC client connected\n");
+
+            while (nx_tcp_socket_receive(&tcpSocket, &packet, NX_WAIT_FOREVER) == NX_SUCCESS) {
+                tcp_receive(packet);
+            }
+
+            tcpConnected = false;
+            printf("Network RPC client disconnected\n");
+            nx_tcp_socket_disconnect(&tcpSocket, NETX_RPC_SEND_TIMEOUT);
+        }
+        nx_tcp_server_socket_unaccept(&tcpSocket);
+        nx_tcp_server_socket_relisten(&NetXDuoEthIpInstance, serverPort, &tcpSocket);
+    }
+}
+
+static void NetxRpcUdpTask(void *argument)
+{
+    (void)argument;
+    NX_PACKET *packet;
+    ULONG peer_ip;
+    UINT peer_port;
+
+    wait_for_address();
+    if (nx_udp_socket_create(&NetXDuoEthIpInstance, &udpSocket, "RPC UDP Socket", NX_IP_NORMAL, NX_FRAGMENT_OKAY,
+                             NX_IP_TIME_TO_LIVE, NETX_RPC_UDP_QUEUE) != NX_SUCCESS ||
+        nx_udp_socket_bind(&udpSocket, serverPort, NX_WAIT_FOREVER) != NX_SUCCESS) {
+        printf("Network RPC: UDP port %u unavailable\n", serverPort);
+        osThreadExit();
+    }
+
+    for (;;) {
+        if (nx_udp_socket_receive(&udpSocket, &packet, NX_WAIT_FOREVER) != NX_SUCCESS) {
+            continue;
+        }
+        // A request has to fit one buffer, datagrams are not reassembled
+        if (packet->nx_packet_next != NX_NULL || packet->nx_packet_length == 0u ||
+            nx_udp_source_extract(packet, &peer_ip, &peer_port) != NX_SUCCESS) {
+            stats.dropped++;
+            nx_packet_release(packet);
+            continue;
+        }
+        udpPeerIp = peer_ip;
+        udpPeerPort = (uint16_t)peer_port;
+        submit(RPC_ORIGIN_UDP, (const char *)packet->nx_packet_prepend_ptr, packet->nx_packet_length, packet,
+               (uint32_t)peer_ip, (uint16_t)peer_port);
+    }
+}
+
+void NetxRpc_Init(void)
+{
+    if (get_network_port(&serverPort) != 0 || serverPort == 0u) {
+        serverPort = 2560u;
+    }
+
+    freeQueue = osMessageQueueNew(NETX_RPC_REQUESTS, sizeof(NetxRpcRequest_t *), &netxRpcFreeQueue_attr);
+    reassemblyDone_sem = osSemaphoreNew(1, 0, &reassemblyDone_sem_attr);
+    for (uint32_t i = 0; i < NETX_RPC_REQUESTS; i++) {
+        NetxRpcRequest_t *request = &requests[i];
+        osMessageQueuePut(freeQueue, &request, 0u, 0u);
+    }
+
+    if (osThreadNew(NetxRpcTcpTask, NULL, &rpcTcpTask_attributes) == NULL ||
+        osThreadNew(NetxRpcUdpTask, NULL, &rpcUdpTask_attributes) == NULL) {
+        printf("Failed to create network RPC threads\n");
+    }
+}
+
+static bool send_packet(uint8_t origin, uint32_t peer_ip, uint16_t peer_port, const uint8_t *data, uint32_t length)
+{
+    NX_PACKET *packet;
+    UINT status;
+
+    if (nx_packet_allocate(&NxAppPool, &packet, origin == RPC_ORIGIN_TCP ? NX_TCP_PACKET : NX_UDP_PACKET,
+                           NETX_RPC_SEND_TIMEOUT) != NX_SUCCESS) {
+        stats.tx_errors++;
+        return false;
+    }
+    // Responses larger than one buffer are chained
+    if (nx_packet_data_append(packet, (VOID *)data, length, &NxAppPool, NETX_RPC_SEND_TIMEOUT) != NX_SUCCESS) {
+        nx_packet_release(packet);
+        stats.tx_errors++;
+        return false;
+    }
+
+    if (origin == RPC_ORIGIN_TCP) {
+        status = nx_tcp_socket_send(&tcpSocket, packet, NETX_RPC_SEND_TIMEOUT);
+    } else {
+        status = nx_udp_socket_send(&udpSocket, packet, peer_ip, peer_port);
+    }
+    if (status != NX_SUCCESS) {
+        nx_packet_release(packet);
+        stats.tx_errors++;
+        return false;
+    }
+    return true;
+}
+
+bool NetxRpc_Send(const NetxRpcRequest_t *request, const uint8_t *data, uint32_t length)
+{
+    if (request->origin == RPC_ORIGIN_TCP) {
+        // The client which sent the request may be gone
+        if (!tcpConnected || request->session != tcpSession) {
+            return false;
+        }
+    }
+    return send_packet(request->origin, request->peer_ip, request->peer_port, data, length);
+}
+
+void NetxRpc_SendEvent(uint8_t origin, const uint8_t *data, uint32_t length)
+{
+    if (origin == RPC_ORIGIN_TCP) {
+        if (tcpConnected) {
+            send_packet(origin, 0u, 0u, data, length);
+        }
+    } else if (origin == RPC_ORIGIN_UDP && udpPeerPort != 0u) {
+        send_packet(origin, udpPeerIp, udpPeerPort, data, length);
+    }
+}
+
+void NetxRpc_Release(NetxRpcRequest_t *request)
+{
+    if (request->packet != NULL) {
+        nx_packet_release(request->packet);
+        request->packet = NULL;
+    } else {
+        osSemaphoreRelease(reassemblyDone_sem);
+    }
+    osMessageQueuePut(freeQueue, &request, 0u, 0u);
+}
+
+void NetxRpc_GetStats(NetxRpcStats_t *out)
+{
+    ULONG ip_address = 0;
+    ULONG net_mask = 0;
+
+    if (out == NULL) {
+        return;
+    }
+    *out = stats;
+    if (nx_ip_address_get(&NetXDuoEthIpInstance, &ip_address, &net_mask) == NX_SUCCESS) {
+        out->ip_address = (uint32_t)ip_address;
+    }
+    out->port = serverPort;
+    out->client_connected = tcpConnected;
+}
@@ -0,0 +1,141 @@
+/**
+ * @file packet_capture.c
+ * @brief Track current trace around one chosen packet
+ *
+ * The transmit interrupt takes the packet and fixes the window, the ADC DMA
+ * interrupt copies the samples out of the history once the window has been
+ * sampled. The state is written last, after a barrier, readers in thread
+ * context check it first.
+ */
+
+#include "packet_capture.h"
+#include "analog_manager.h"
+#include "command_station.h"
+#include "parameter_manager.h"
+#include "stm32h5xx.h"
+#include <string.h>
+
+static const char *const kStateNames[] = { "idle", "armed", "triggered", "done", "failed" };
+
+static PacketCaptureConfig_t g_config;
+static PacketCaptureInfo_t g_info;
+static volatile uint8_t g_state = PACKET_CAPTURE_IDLE;
+static uint32_t g_first = 0;        // sample number of the first sample
+static uint32_t g_oneUs = 116;      // nominal bit times
+static uint32_t g_zeroUs = 200;
+static uint32_t g_preambleBits = 16;
+static uint16_t g_samples[PACKET_CAPTURE_MAX_SAMPLES];
+
+static uint32_t samples_for(uint32_t us)
+{
+    return (us + ANALOG_SAMPLE_US / 2u) / ANALOG_SAMPLE_US;
+}
+
+// Transmit interrupt, end bit started
+static void capture_packet(uint32_t packet_seq, const uint8_t *bytes, uint8_t length)
+{
+    if (g_state != PACKET_CAPTURE_ARMED ||
+        (g_config.packet_seq != 0u && packet_seq != g_config.packet_seq) ||
+        length < g_config.match_length || memcmp(bytes, g_config.match, g_config.match_length) != 0) {
+        return;
+    }
+    uint32_t const now = analog_manager_current_sample();
+
+    // Preamble, then a start bit and eight data bits per byte
+    uint32_t packet_us = g_preambleBits * g_oneUs;
+    for (uint32_t i = 0; i < length; i++) {
+        uint32_t const ones = (uint32_t)__builtin_popcount(bytes[i]);
+        packet_us += ones * g_oneUs + (9u - ones) * g_zeroUs;
+    }
+    uint32_t const pre_us = g_config.pre_bits * g_oneUs;
+
+    g_first = now - samples_for(pre_us + packet_us);
+    g_info.packet_seq = packet_seq;
+    g_info.length = length < PACKET_CAPTURE_MAX_BYTES ? length : PACKET_CAPTURE_MAX_BYTES;
+    memcpy(g_info.bytes, bytes, g_info.length);
+    g_info.packet_us = packet_us;
+    g_info.count = (uint16_t)samples_for(pre_us + g_config.window_us);
+    g_info.packet_index = (uint16_t)samples_for(pre_us);
+    g_info.end_index = (uint16_t)samples_for(pre_us + packet_us);
+    __DMB();
+    g_state = PACKET_CAPTURE_TRIGGERED;
+}
+
+// ADC DMA interrupt, the samples of the buckets before this one can be read
+static void capture_bucket(uint32_t bucket, uint16_t voltage_raw, uint16_t current_raw)
+{
+    (void)bucket;
+    (void)voltage_raw;
+    (void)current_raw;
+    if (g_state != PACKET_CAPTURE_TRIGGERED) {
+        return;
+    }
+    uint32_t const n = analog_manager_read_current_samples(g_first, g_samples, g_info.count);
+    if (n == g_info.count) {
+        __DMB();
+        g_state = PACKET_CAPTURE_DONE;
+    }
+    else if ((int32_t)(analog_manager_current_sample() - g_first) > (int32_t)(ANALOG_RAW_HISTORY / 2u)) {
+        g_state = PACKET_CAPTURE_FAILED;
+    }
+}
+
+int packet_capture_arm(const PacketCaptureConfig_t *config)
+{
+    if (!analog_manager_is_streaming() || config->match_length > PACKET_CAPTURE_MAX_MATCH) {
+        return -1;
+    }
+    uint8_t preamble_bits = 0;
+    uint8_t bit1_duration = 0;
+    uint8_t bit0_duration = 0;
+    get_dcc_preamble_bits(&preamble_bits);
+    get_dcc_bit1_duration(&bit1_duration);
+    get_dcc_bit0_duration(&bit0_duration);
+    uint32_t const one_us = 2u * bit1_duration;
+    if (samples_for(config->pre_bits * one_us + config->window_us) > PACKET_CAPTURE_MAX_SAMPLES) {
+        return -1;
+    }
+
+    packet_capture_cancel();
+    g_config = *config;
+    g_oneUs = one_us;
+    g_zeroUs = 2u * bit0_duration;
+    g_preambleBits = preamble_bits;
+    memset(&g_info, 0, sizeof(g_info));
+    g_state = PACKET_CAPTURE_ARMED;
+    analog_manager_set_bucket_hook(ANALOG_HOOK_CAPTURE, capture_bucket);
+    CommandStation_SetPacketHook(COMMAND_STATION_HOOK_CAPTURE, capture_packet);
+    return 0;
+}
+
+void packet_capture_cancel(void)
+{
+    CommandStation_SetPacketHook(COMMAND_STATION_HOOK_CAPTURE, NULL);
+    analog_manager_set_bucket_hook(ANALOG_HOOK_CAPTURE, NULL);
+    if (g_state == PACKET_CAPTURE_ARMED || g_state == PACKET_CAPTURE_TRIGGERED) {
+        g_state = PACKET_CAPTURE_IDLE;
+    }
+}
+
+void packet_capture_get_info(PacketCaptureInfo_t *info)
+{
+    uint8_t const state = g_state;
+    __DMB();
+    *info = g_info;
+    info->state = state;
+}
+
+uint32_t packet_capture_read(uint32_t first, uint16_t *out, uint32_t max)
+{
+    if (g_state != PACKET_CAPTURE_DONE || first >= g_info.count) {
+        return 0;
+    }
+    uint32_t const n = g_info.count - first < max ? g_info.count - first : max;
+    memcpy(out, &g_samples[first], n * sizeof(uint16_t));
+    return n;
+}
+
+const char *packet_capture_state_name(PacketCaptureState_t state)
+{
+    return (uint32_t)state < sizeof(kStateNames) / sizeof(kStateNames[0]) ? kStateNames[state] : "?";
+}
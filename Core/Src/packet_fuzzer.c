@@ -0,0 +1,351 @@
+/**
+ * @file packet_fuzzer.c
+ * @brief Random packet generation, configuration and the replay log
+ *
+ * Everything a packet is made of is drawn from the generator in a fixed
+ * order (class, bytes, jitter, fault, gap), so the state before a packet and
+ * the configuration determine it completely. The configuration is written by
+ * the RPC thread between runs, packets are generated by the command station
+ * thread; the lock covers the state, counters and log.
+ */
+
+#include "packet_fuzzer.h"
+#include "packet_program.h"
+#include "cmsis_os2.h"
+#include "rtos_static.h"
+#include <string.h>
+
+#define FUZZ_MAX_ADDRESS        10239u
+#define FUZZ_MAX_GAP_US         1000000u
+#define FUZZ_MIN_PREAMBLE       10u         // below this the preamble is a fault
+
+_Static_assert((PACKET_FUZZ_LOG_SIZE & (PACKET_FUZZ_LOG_SIZE - 1u)) == 0u, "PACKET_FUZZ_LOG_SIZE must be a power of two");
+_Static_assert(PACKET_FUZZ_MAX_PACKET <= PACKET_TIMING_MAX_BYTES, "fuzz packets must fit the scheduled path");
+
+static osMutexId_t g_lock = NULL;
+RTOS_MUTEX(fuzzLock);
+static PacketFuzzConfig_t g_config = {
+    .seed = 1u,
+    .address_min = 1u,
+    .address_max = 127u,
+    .classes = PACKET_FUZZ_CLASSES_ALL,
+    .profile = PACKET_TIMING_PROFILE_CONFIGURED,
+};
+static uint8_t g_classList[PACKET_FUZZ_CLASS_COUNT];   // enabled classes
+static uint8_t g_classCount = PACKET_FUZZ_CLASS_COUNT;
+static uint32_t g_state = 1u;
+static uint32_t g_generated = 0;
+static uint32_t g_classStats[PACKET_FUZZ_CLASS_COUNT];
+static uint32_t g_faultStats[PACKET_FUZZ_FAULT_COUNT];
+static PacketFuzzLogEntry_t g_log[PACKET_FUZZ_LOG_SIZE];
+
+static void lock(void)
+{
+    osMutexAcquire(g_lock, osWaitForever);
+}
+
+static void unlock(void)
+{
+    osMutexRelease(g_lock);
+}
+
+// xorshift32, the state is never 0
+static uint32_t next_random(void)
+{
+    uint32_t x = g_state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    g_state = x;
+    return x;
+}
+
+// Uniform in 0..n-1 by multiply and shift, no division
+static uint32_t random_below(uint32_t n)
+{
+    return (uint32_t)(((uint64_t)next_random() * n) >> 32);
+}
+
+static void rewind_locked(void)
+{
+    g_state = g_config.seed;
+    g_generated = 0;
+    memset(g_classStats, 0, sizeof(g_classStats));
+    memset(g_faultStats, 0, sizeof(g_faultStats));
+}
+
+void PacketFuzz_Init(void)
+{
+    if (g_lock != NULL) {
+        return;
+    }
+    for (uint8_t c = 0; c < PACKET_FUZZ_CLASS_COUNT; c++) {
+        g_classList[c] = c;
+    }
+    rewind_locked();
+    g_lock = osMutexNew(&fuzzLock_attr);
+}
+
+int PacketFuzz_Configure(const PacketFuzzConfig_t *config, const char **error)
+{
+    const char *dummy;
+    if (error == NULL) {
+        error = &dummy;
+    }
+    if (config == NULL) {
+        *error = "invalid arguments";
+        return -1;
+    }
+    if (config->address_min > config->address_max || config->address_max > FUZZ_MAX_ADDRESS) {
+        *error = "address range must lie within 0-10239";
+        return -1;
+    }
+    if (config->classes == 0u || (config->classes & ~PACKET_FUZZ_CLASSES_ALL) != 0u) {
+        *error = "no valid packet class enabled";
+        return -1;
+    }
+    if (config->invalid_percent > 100u) {
+        *error = "invalid_percent must be 0-100";
+        return -1;
+    }
+    if (config->profile >= PACKET_TIMING_PROFILE_COUNT) {
+        *error = "unknown timing profile";
+        return -1;
+    }
+    if (config->jitter_us > PACKET_FUZZ_MAX_JITTER_US) {
+        *error = "jitter_us must be 0-1000";
+        return -1;
+    }
+    if (config->gap_min_us > config->gap_max_us || config->gap_max_us > FUZZ_MAX_GAP_US) {
+        *error = "gap range must lie within 0-1000000 us";
+        return -1;
+    }
+
+    lock();
+    g_config = *config;
+    if (g_config.seed == 0u) {
+        g_config.seed = (osKernelGetTickCount() + 1u) * 2654435761u;
+        if (g_config.seed == 0u) {
+            g_config.seed = 1u;
+        }
+    }
+    g_classCount = 0;
+    for (uint8_t c = 0; c < PACKET_FUZZ_CLASS_COUNT; c++) {
+        if (config->classes & (1u << c)) {
+            g_classList[g_classCount++] = c;
+        }
+    }
+    rewind_locked();
+    unlock();
+    return 0;
+}
+
+void PacketFuzz_Rewind(void)
+{
+    lock();
+    rewind_locked();
+    unlock();
+}
+
+// Loco address as sent: 0 broadcast, 1-127 short, above that the two byte long form
+static uint8_t put_address(uint8_t *bytes, uint16_t address)
+{
+    if (address < 128u) {
+        bytes[0] = (uint8_t)address;
+        return 1u;
+    }
+    bytes[0] = (uint8_t)(0xC0u | (address >> 8));
+    bytes[1] = (uint8_t)address;
+    return 2u;
+}
+
+// Packet bytes without the checksum
+static uint8_t generate_bytes(uint8_t packet_class, uint8_t *bytes)
+{
+    uint16_t const address =
+        (uint16_t)(g_config.address_min + random_below((uint32_t)(g_config.address_max - g_config.address_min) + 1u));
+    uint8_t length = 0;
+
+    switch (packet_class) {
+    case PACKET_FUZZ_CLASS_IDLE:
+        bytes[0] = random_below(2u) ? 0xFFu : 0x00u;
+        bytes[1] = 0x00u;
+        length = 2u;
+        break;
+    case PACKET_FUZZ_CLASS_SPEED:
+        length = put_address(bytes, address);
+        if (random_below(2u)) {
+            bytes[length++] = 0x3Fu;
+            bytes[length++] = (uint8_t)next_random();
+        }
+        else {
+            bytes[length++] = (uint8_t)(0x40u | (next_random() & 0x3Fu));
+        }
+        break;
+    case PACKET_FUZZ_CLASS_FUNCTION: {
+        static const uint8_t kGroupBase[3] = { 0x80u, 0xB0u, 0xA0u };
+        static const uint8_t kGroupMask[3] = { 0x1Fu, 0x0Fu, 0x0Fu };
+        uint32_t const group = random_below(5u);
+        length = put_address(bytes, address);
+        if (group < 3u) {
+            bytes[length++] = (uint8_t)(kGroupBase[group] | (next_random() & kGroupMask[group]));
+        }
+        else {
+            bytes[length++] = group == 3u ? 0xDEu : 0xDFu;
+            bytes[length++] = (uint8_t)next_random();
+        }
+        break;
+    }
+    case PACKET_FUZZ_CLASS_POM: {
+        uint32_t const operation = 1u + random_below(3u);   // verify, bit manipulation, write
+        uint32_t const cv = random_below(1024u);
+        length = put_address(bytes, address);
+        bytes[length++] = (uint8_t)(0xE0u | (operation << 2) | (cv >> 8));
+        bytes[length++] = (uint8_t)cv;
+        bytes[length++] = (uint8_t)next_random();
+        break;
+    }
+    case PACKET_FUZZ_CLASS_ACCESSORY: {
+        uint32_t const board = random_below(512u);
+        uint32_t const output = next_random() & 0x0Fu;     // activate and pair/output
+        bytes[0] = (uint8_t)(0x80u | (board & 0x3Fu));
+        bytes[1] = (uint8_t)(0x80u | ((~board >> 2) & 0x70u) | output);
+        length = 2u;
+        break;
+    }
+    case PACKET_FUZZ_CLASS_RANDOM:
+    default: {
+        length = put_address(bytes, address);
+        uint32_t const count = 1u + random_below(PACKET_FUZZ_MAX_PACKET - 1u - length);
+        for (uint32_t i = 0; i < count; i++) {
+            bytes[length++] = (uint8_t)next_random();
+        }
+        break;
+    }
+    }
+    return length;
+}
+
+static int16_t random_delta(uint32_t bound)
+{
+    return (int16_t)((int32_t)random_below(2u * bound + 1u) - (int32_t)bound);
+}
+
+static void generate_fault(uint8_t fault, uint32_t bits, PacketTiming_t *timing)
+{
+    PacketFault_t *const rule = &timing->faults[0];
+    switch (fault) {
+    case PACKET_FUZZ_FAULT_CHECKSUM:
+        rule->type = PACKET_FAULT_CHECKSUM;
+        rule->value = (int16_t)(1u + random_below(255u));
+        break;
+    case PACKET_FUZZ_FAULT_FLIP:
+        rule->type = PACKET_FAULT_FLIP;
+        rule->first = (uint8_t)random_below(bits);
+        rule->count = 1u;
+        break;
+    case PACKET_FUZZ_FAULT_PREAMBLE:
+        rule->type = PACKET_FAULT_TRUNCATE_PREAMBLE;
+        rule->value = (int16_t)random_below(FUZZ_MIN_PREAMBLE);
+        break;
+    case PACKET_FUZZ_FAULT_DROP:
+        rule->type = PACKET_FAULT_DROP;
+        rule->first = (uint8_t)random_below(bits);
+        rule->count = 1u;
+        rule->half = (uint8_t)(PACKET_FAULT_HALF_P + random_below(2u));
+        break;
+    case PACKET_FUZZ_FAULT_STRETCH:
+    default: {
+        int16_t const stretch = (int16_t)(g_config.jitter_us + PACKET_FUZZ_STRETCH_US);
+        rule->type = PACKET_FAULT_STRETCH;
+        rule->first = (uint8_t)random_below(bits);
+        rule->count = 1u;
+        rule->half = (uint8_t)(PACKET_FAULT_HALF_P + random_below(3u));
+        rule->value = random_below(2u) ? stretch : (int16_t)-stretch;
+        break;
+    }
+    }
+}
+
+bool PacketFuzz_Next(PacketFuzzPacket_t *packet)
+{
+    lock();
+    if (g_config.count != 0u && g_generated >= g_config.count) {
+        unlock();
+        return false;
+    }
+
+    PacketFuzzLogEntry_t *const log = &g_log[g_generated & (PACKET_FUZZ_LOG_SIZE - 1u)];
+    log->index = g_generated;
+    log->state = g_state;
+
+    memset(packet, 0, sizeof(*packet));
+    packet->timing.profile = g_config.profile;
+    packet->flags = PACKET_PROGRAM_FLAG_OVERRIDE;
+
+    uint8_t const packet_class = g_classList[random_below(g_classCount)];
+    uint8_t length = generate_bytes(packet_class, packet->bytes);
+    uint8_t checksum = 0;
+    for (uint8_t i = 0; i < length; i++) {
+        checksum ^= packet->bytes[i];
+    }
+    packet->bytes[length++] = checksum;
+    packet->length = length;
+
+    // Jitter: the P and N halves of a random half of the bits and preamble bits move by one delta each
+    if (g_config.jitter_us != 0u) {
+        packet->timing.deltaP = random_delta(g_config.jitter_us);
+        packet->timing.deltaN = random_delta(g_config.jitter_us);
+        for (uint32_t i = 0; i < sizeof(packet->timing.bits); i++) {
+            packet->timing.bits[i] = (uint8_t)next_random();
+        }
+        packet->timing.preamble = next_random();
+    }
+
+    uint8_t fault = PACKET_FUZZ_FAULT_NONE;
+    if (random_below(100u) < g_config.invalid_percent) {
+        fault = (uint8_t)(PACKET_FUZZ_FAULT_CHECKSUM + random_below(PACKET_FUZZ_FAULT_COUNT - 1u));
+        generate_fault(fault, 1u + 9u * length, &packet->timing);
+        if (g_config.trigger_invalid) {
+            packet->flags |= PACKET_PROGRAM_FLAG_TRIGGER;
+        }
+    }
+
+    packet->gap_us = g_config.gap_min_us + random_below(g_config.gap_max_us - g_config.gap_min_us + 1u);
+
+    log->packet_class = packet_class;
+    log->fault = fault;
+    log->length = length;
+    memcpy(log->bytes, packet->bytes, length);
+    log->deltaP = (int16_t)packet->timing.deltaP;
+    log->deltaN = (int16_t)packet->timing.deltaN;
+    log->gap_us = packet->gap_us;
+    g_classStats[packet_class]++;
+    g_faultStats[fault]++;
+    g_generated++;
+    unlock();
+    return true;
+}
+
+void PacketFuzz_GetStatus(PacketFuzzStatus_t *status)
+{
+    lock();
+    status->config = g_config;
+    status->state = g_state;
+    status->generated = g_generated;
+    memcpy(status->classes, g_classStats, sizeof(status->classes));
+    memcpy(status->faults, g_faultStats, sizeof(status->faults));
+    unlock();
+}
+
+uint32_t PacketFuzz_GetLog(uint32_t first, PacketFuzzLogEntry_t *entries, uint32_t max)
+{
+    uint32_t count = 0;
+    lock();
+    uint32_t const oldest = g_generated > PACKET_FUZZ_LOG_SIZE ? g_generated - PACKET_FUZZ_LOG_SIZE : 0u;
+    for (uint32_t index = first > oldest ? first : oldest; index < g_generated && count < max; index++) {
+        entries[count++] = g_log[index & (PACKET_FUZZ_LOG_SIZE - 1u)];
+    }
+    unlock();
+    return count;
+}
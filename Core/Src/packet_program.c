@@ -0,0 +1,124 @@
+/**
+ * @file packet_program.c
+ * @brief Packet program storage and validation
+ *
+ * The program is written by the RPC thread and only read by the command station
+ * thread while it runs, loading is refused during a run.
+ */
+
+#include "packet_program.h"
+#include <string.h>
+
+static PacketProgramEntry_t g_program[PACKET_PROGRAM_MAX_ENTRIES];
+static uint16_t g_programCount = 0;
+
+int PacketProgram_Clear(void)
+{
+    PacketProgramStatus_t status;
+    CommandStation_GetProgramStatus(&status);
+    if (status.running) {
+        return -1;
+    }
+    g_programCount = 0;
+    return 0;
+}
+
+int PacketProgram_Append(const PacketProgramEntry_t *entries, uint16_t count)
+{
+    PacketProgramStatus_t status;
+    CommandStation_GetProgramStatus(&status);
+    if (status.running || entries == NULL) {
+        return -1;
+    }
+    if (count > PACKET_PROGRAM_MAX_ENTRIES - g_programCount) {
+        return -1;
+    }
+    memcpy(&g_program[g_programCount], entries, count * sizeof(PacketProgramEntry_t));
+    g_programCount += count;
+    return 0;
+}
+
+int PacketProgram_Prepare(const char **error)
+{
+    const char *dummy;
+    if (error == NULL) {
+        error = &dummy;
+    }
+
+    if (g_programCount == 0) {
+        *error = "no program loaded";
+        return -1;
+    }
+
+    for (uint16_t i = 0; i < g_programCount; i++) {
+        PacketProgramEntry_t *entry = &g_program[i];
+
+        switch (entry->op) {
+        case PACKET_PROGRAM_OP_PACKET:
+            if (entry->length == 0 || entry->length > PACKET_PROGRAM_MAX_PACKET) {
+                *error = "invalid packet length";
+                return -1;
+            }
+            if ((entry->flags & PACKET_PROGRAM_FLAG_OVERRIDE) && entry->timing.profile >= PACKET_TIMING_PROFILE_COUNT) {
+                *error = "invalid timing profile";
+                return -1;
+            }
+            break;
+
+        case PACKET_PROGRAM_OP_LABEL:
+            for (uint16_t j = 0; j < i; j++) {
+                if (g_program[j].op == PACKET_PROGRAM_OP_LABEL && g_program[j].label == entry->label) {
+                    *error = "duplicate label";
+                    return -1;
+                }
+            }
+            break;
+
+        case PACKET_PROGRAM_OP_LOOP: {
+            // Loops only jump backwards, so the label has to come first
+            bool found = false;
+            for (uint16_t j = 0; j < i; j++) {
+                if (g_program[j].op == PACKET_PROGRAM_OP_LABEL && g_program[j].label == entry->label) {
+                    entry->target = j;
+                    found = true;
+                    break;
+                }
+            }
+            if (!found) {
+                *error = "loop label not defined before loop";
+                return -1;
+            }
+            // The thread only blocks while handing out packets, a loop without one would spin
+            found = false;
+            for (uint16_t j = entry->target; j < i; j++) {
+                if (g_program[j].op == PACKET_PROGRAM_OP_PACKET) {
+                    found = true;
+                    break;
+                }
+            }
+            if (!found) {
+                *error = "loop body contains no packet";
+                return -1;
+            }
+            break;
+        }
+
+        case PACKET_PROGRAM_OP_DELAY:
+        case PACKET_PROGRAM_OP_END:
+            break;
+
+        default:
+            *error = "invalid op";
+            return -1;
+        }
+    }
+    return 0;
+}
+
+uint16_t PacketProgram_Get(const PacketProgramEntry_t **entries)
+{
+    if (entries != NULL) {
+        *entries = g_program;
+    }
+    return g_programCount;
+}
@@ -0,0 +1,136 @@
+/**
+ * @file packet_stats.cpp
+ * @brief Packet validation counters of the decoder input
+ */
+
+#include "packet_stats.h"
+#include "sniffer.h"
+#include "fast_ram.h"
+#include <atomic>
+
+namespace {
+
+// Relaxed increments, only the totals matter
+struct Counters {
+  std::atomic<uint32_t> packets;
+  std::atomic<uint32_t> checksumErrors;
+  std::atomic<uint32_t> framingErrors;
+  std::atomic<uint32_t> shortPreambles;
+  std::atomic<uint32_t> timingErrors;
+  std::atomic<uint32_t> timingPackets;
+  std::atomic<uint32_t> minPreamble;
+  std::atomic<uint32_t> types[PACKET_STATS_TYPE_COUNT];
+};
+
+static_assert(std::atomic<uint32_t>::is_always_lock_free, "the counters are written from interrupts");
+
+void increment(std::atomic<uint32_t>& counter) {
+  counter.fetch_add(1u, std::memory_order_relaxed);
+}
+
+bool halfInSpec(uint16_t width_us, bool one) {
+  return one ? width_us >= PACKET_STATS_ONE_MIN_US && width_us <= PACKET_STATS_ONE_MAX_US
+             : width_us >= PACKET_STATS_ZERO_MIN_US && width_us <= PACKET_STATS_ZERO_MAX_US;
+}
+
+PacketStatsType_t typeOf(const uint8_t* bytes, uint32_t count) {
+  uint8_t const first = bytes[0];
+  if (first == 0xFFu) return PACKET_STATS_TYPE_IDLE;
+  if (first == 0u) {
+    return count == 3u && bytes[1] == 0u ? PACKET_STATS_TYPE_RESET : PACKET_STATS_TYPE_BROADCAST;
+  }
+  if (first <= 127u) return PACKET_STATS_TYPE_LOCO_SHORT;
+  if (first <= 191u) {
+    return (bytes[1] & 0x80u) ? PACKET_STATS_TYPE_ACCESSORY : PACKET_STATS_TYPE_EXT_ACCESSORY;
+  }
+  if (first <= 231u) return PACKET_STATS_TYPE_LOCO_LONG;
+  if (first <= 252u) return PACKET_STATS_TYPE_RESERVED;
+  return PACKET_STATS_TYPE_EXTENDED;
+}
+
+}  // namespace
+
+static Counters counters;
+
+extern "C" FAST_RAM_FLATTEN void packet_stats_packet(const uint8_t* bytes, uint32_t count, bool checksum_ok,
+                                                     uint32_t preamble, const uint16_t* halves, uint32_t half_count)
+{
+  increment(counters.packets);
+
+  // Both halves of a bit have the class of the framer, the limits are checked within it
+  uint32_t errors = 0;
+  for (uint32_t i = 0; i < half_count; i++) {
+    if (!halfInSpec(halves[i], halves[i] <= SNIFFER_HALF_ONE_MAX_US)) {
+      errors++;
+    }
+  }
+  if (errors) {
+    counters.timingErrors.fetch_add(errors, std::memory_order_relaxed);
+    increment(counters.timingPackets);
+  }
+
+  if (!checksum_ok || count < 2u) {
+    increment(counters.checksumErrors);
+    return;
+  }
+
+  uint32_t const shortest = counters.minPreamble.load(std::memory_order_relaxed);
+  if (shortest == 0u || preamble < shortest) {
+    counters.minPreamble.store(preamble, std::memory_order_relaxed);
+  }
+  increment(counters.types[typeOf(bytes, count)]);
+}
+
+extern "C" void packet_stats_framing_error(void)
+{
+  increment(counters.framingErrors);
+}
+
+extern "C" void packet_stats_short_preamble(void)
+{
+  increment(counters.shortPreambles);
+}
+
+extern "C" void packet_stats_get(PacketStats_t* stats)
+{
+  stats->packets = counters.packets.load(std::memory_order_relaxed);
+  stats->checksum_errors = counters.checksumErrors.load(std::memory_order_relaxed);
+  stats->framing_errors = counters.framingErrors.load(std::memory_order_relaxed);
+  stats->short_preambles = counters.shortPreambles.load(std::memory_order_relaxed);
+  stats->timing_errors = counters.timingErrors.load(std::memory_order_relaxed);
+  stats->timing_packets = counters.timingPackets.load(std::memory_order_relaxed);
+  stats->min_preamble = counters.minPreamble.load(std::memory_order_relaxed);
+  for (uint32_t i = 0; i < PACKET_STATS_TYPE_COUNT; i++) {
+    stats->types[i] = counters.types[i].load(std::memory_order_relaxed);
+  }
+}
+
+extern "C" void packet_stats_reset(void)
+{
+  counters.packets.store(0u, std::memory_order_relaxed);
+  counters.checksumErrors.store(0u, std::memory_order_relaxed);
+  counters.framingErrors.store(0u, std::memory_order_relaxed);
+  counters.shortPreambles.store(0u, std::memory_order_relaxed);
+  counters.timingErrors.store(0u, std::memory_order_relaxed);
+  counters.timingPackets.store(0u, std::memory_order_relaxed);
+  counters.minPreamble.store(0u, std::memory_order_relaxed);
+  for (auto& type : counters.types) {
+    type.store(0u, std::memory_order_relaxed);
+  }
+}
+
+extern "C" const char* packet_stats_type_name(PacketStatsType_t type)
+{
+  switch (type) {
+    case PACKET_STATS_TYPE_IDLE: return "idle";
+    case PACKET_STATS_TYPE_RESET: return "reset";
+    case PACKET_STATS_TYPE_BROADCAST: return "broadcast";
+    case PACKET_STATS_TYPE_LOCO_SHORT: return "loco_short";
+    case PACKET_STATS_TYPE_LOCO_LONG: return "loco_long";
+    case PACKET_STATS_TYPE_ACCESSORY: return "accessory";
+    case PACKET_STATS_TYPE_EXT_ACCESSORY: return "ext_accessory";
+    case PACKET_STATS_TYPE_EXTENDED: return "extended";
+    case PACKET_STATS_TYPE_RESERVED: return "reserved";
+    default: return "unknown";
+  }
+}
@@ -0,0 +1,368 @@
+/**
+ * @file packet_suite.cpp
+ * @brief Precompiled packet suites on the SD card
+ *
+ * The vectors of the loaded suite pass through buffer, a byte ring with free
+ * running indices: head is advanced by the reader thread (streamed) or by
+ * PacketSuite_Load (resident), tail by the command station thread. A rewind
+ * bumps rewindGen, the reader seeks back to the first vector, refills from the
+ * start and acknowledges through readerGen before the consumer reads again.
+ * fileLock keeps Load and Write away from the reader's file.
+ */
+
+#include "packet_suite.h"
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include "app_filex.h"
+#include "cmsis_os2.h"
+#include "rtos_static.h"
+#include "packet_program.h"
+
+static_assert(sizeof(PacketSuiteHeader_t) == 32u, "the suite header layout is part of the file format");
+static_assert((PACKET_SUITE_BUFFER_SIZE & (PACKET_SUITE_BUFFER_SIZE - 1u)) == 0u,
+              "PACKET_SUITE_BUFFER_SIZE must be a power of two");
+
+#define PACKET_SUITE_CHUNK      2048u   // bytes per card read while streaming
+#define PACKET_SUITE_POLL_MS    5u
+#define PACKET_SUITE_WAIT_MS    1000u   // longest wait for the card before a run fails
+#define SUITE_EVENT_WAKE        0x01u   // rewind or buffer space freed
+
+static_assert(PACKET_SUITE_BUFFER_SIZE % PACKET_SUITE_CHUNK == 0u, "reads must not wrap the buffer");
+
+static uint8_t buffer[PACKET_SUITE_BUFFER_SIZE];
+static std::atomic<uint32_t> head{0u};
+static std::atomic<uint32_t> tail{0u};
+static std::atomic<uint32_t> rewindGen{0u};
+static std::atomic<uint32_t> readerGen{0u};
+static std::atomic<bool> readError{false};
+static std::atomic<bool> streaming{false};
+
+static FX_MEDIA* volatile media = nullptr;
+static osMutexId_t fileLock;
+static osEventFlagsId_t readerEvents;
+RTOS_MUTEX(suiteFileLock);
+RTOS_EVENT_FLAGS(suiteReaderEvents);
+static FX_FILE file;                // streamed suite, kept open while loaded
+static FX_FILE uploadFile;
+static uint32_t fileOffset = 0;     // reader: vector bytes read from the file
+
+static PacketSuiteHeader_t header;
+static std::atomic<bool> loaded{false};
+static bool resident = false;
+static uint16_t loadedIndex = 0;
+static uint32_t bodySize = 0;
+static uint32_t defaultGapUs = 0;
+static uint32_t vectorsRead = 0;
+static uint32_t underruns = 0;
+
+RTOS_THREAD_MEMORY(suiteReaderTask, 1536);
+static const osThreadAttr_t suiteReaderTask_attributes = {
+  .name = "suiteReaderTask",
+  RTOS_THREAD_ATTR_MEMORY(suiteReaderTask),
+  .priority = (osPriority_t) osPriorityBelowNormal
+};
+
+static void suiteFileName(char* name, size_t size, uint16_t index)
+{
+  snprintf(name, size, "SUIT%04u.BIN", static_cast<unsigned>(index));
+}
+
+static void copyOut(uint32_t pos, uint8_t* dst, uint32_t length)
+{
+  for (uint32_t i = 0; i < length; i++) {
+    dst[i] = buffer[(pos + i) & (PACKET_SUITE_BUFFER_SIZE - 1u)];
+  }
+}
+
+// Reader thread, called with fileLock held
+static void readerFill(void)
+{
+  uint32_t const gen = rewindGen.load(std::memory_order_acquire);
+  if (gen != readerGen.load(std::memory_order_relaxed)) {
+    // The consumer has reset tail and waits for the acknowledge
+    readError.store(fx_file_seek(&file, header.header_size) != FX_SUCCESS, std::memory_order_relaxed);
+    fileOffset = 0;
+    head.store(0u, std::memory_order_relaxed);
+    readerGen.store(gen, std::memory_order_release);
+  }
+
+  while (!readError.load(std::memory_order_relaxed) && fileOffset < bodySize) {
+    uint32_t const h = head.load(std::memory_order_relaxed);
+    if (PACKET_SUITE_BUFFER_SIZE - (h - tail.load(std::memory_order_acquire)) < PACKET_SUITE_CHUNK) {
+      return;
+    }
+    uint32_t const length = bodySize - fileOffset < PACKET_SUITE_CHUNK ? bodySize - fileOffset : PACKET_SUITE_CHUNK;
+    ULONG actual = 0;
+    if (fx_file_read(&file, &buffer[h & (PACKET_SUITE_BUFFER_SIZE - 1u)], length, &actual) != FX_SUCCESS ||
+        actual != length) {
+      readError.store(true, std::memory_order_release);
+      return;
+    }
+    fileOffset += length;
+    head.store(h + length, std::memory_order_release);
+  }
+}
+
+static void SuiteReaderTask(void* argument)
+{
+  (void)argument;
+
+  for (;;) {
+    osEventFlagsWait(readerEvents, SUITE_EVENT_WAKE, osFlagsWaitAny, PACKET_SUITE_POLL_MS);
+    if (!streaming.load(std::memory_order_acquire)) {
+      continue;
+    }
+    osMutexAcquire(fileLock, osWaitForever);
+    if (streaming.load(std::memory_order_acquire)) {
+      readerFill();
+    }
+    osMutexRelease(fileLock);
+  }
+}
+
+// Called with fileLock held
+static void unload(void)
+{
+  streaming.store(false, std::memory_order_release);
+  if (loaded && !resident) {
+    fx_file_close(&file);
+  }
+  loaded = false;
+}
+
+extern "C" void PacketSuite_Init(void)
+{
+  fileLock = osMutexNew(&suiteFileLock_attr);
+  readerEvents = osEventFlagsNew(&suiteReaderEvents_attr);
+  if (!fileLock || !readerEvents || !osThreadNew(SuiteReaderTask, nullptr, &suiteReaderTask_attributes)) {
+    printf("Failed to create packet suite reader thread\n");
+  }
+}
+
+extern "C" void PacketSuite_SetMedia(void* fx_media)
+{
+  if (!fileLock) {
+    media = static_cast<FX_MEDIA*>(fx_media);
+    return;
+  }
+  osMutexAcquire(fileLock, osWaitForever);
+  if (!fx_media) {
+    // The file handle dies with the media, a running suite fails at its next read
+    unload();
+    readError.store(true, std::memory_order_release);
+  }
+  media = static_cast<FX_MEDIA*>(fx_media);
+  osMutexRelease(fileLock);
+}
+
+extern "C" int PacketSuite_Load(uint16_t index, uint32_t gap_us, const char** error)
+{
+  const char* dummy;
+  if (!error) {
+    error = &dummy;
+  }
+  if (!fileLock) {
+    *error = "no SD card mounted";
+    return -1;
+  }
+
+  char name[16];
+  suiteFileName(name, sizeof(name), index);
+  osMutexAcquire(fileLock, osWaitForever);
+  unload();
+  if (!media) {
+    osMutexRelease(fileLock);
+    *error = "no SD card mounted";
+    return -1;
+  }
+
+  ULONG actual = 0;
+  if (fx_file_open(media, &file, name, FX_OPEN_FOR_READ) != FX_SUCCESS) {
+    osMutexRelease(fileLock);
+    *error = "suite file not found";
+    return -1;
+  }
+  if (fx_file_read(&file, &header, sizeof(header), &actual) != FX_SUCCESS || actual != sizeof(header) ||
+      header.magic != PACKET_SUITE_MAGIC || header.version != PACKET_SUITE_VERSION ||
+      header.header_size < sizeof(header) || file.fx_file_current_file_size < header.header_size ||
+      file.fx_file_current_file_size - header.header_size > UINT32_MAX) {
+    fx_file_close(&file);
+    osMutexRelease(fileLock);
+    *error = "not a packet suite file";
+    return -1;
+  }
+
+  bodySize = static_cast<uint32_t>(file.fx_file_current_file_size - header.header_size);
+  defaultGapUs = gap_us ? gap_us : header.default_gap_us;
+  resident = bodySize <= PACKET_SUITE_BUFFER_SIZE;
+  tail.store(0u, std::memory_order_relaxed);
+  head.store(0u, std::memory_order_relaxed);
+  readerGen.store(rewindGen.load(std::memory_order_relaxed), std::memory_order_relaxed);
+  readError.store(false, std::memory_order_relaxed);
+  fileOffset = 0;
+
+  if (fx_file_seek(&file, header.header_size) != FX_SUCCESS) {
+    fx_file_close(&file);
+    osMutexRelease(fileLock);
+    *error = "suite file read error";
+    return -1;
+  }
+  if (resident) {
+    // Read once, runs replay it from RAM
+    if (bodySize > 0u && (fx_file_read(&file, buffer, bodySize, &actual) != FX_SUCCESS || actual != bodySize)) {
+      fx_file_close(&file);
+      osMutexRelease(fileLock);
+      *error = "suite file read error";
+      return -1;
+    }
+    fx_file_close(&file);
+    head.store(bodySize, std::memory_order_release);
+  }
+
+  loadedIndex = index;
+  vectorsRead = 0;
+  underruns = 0;
+  loaded = true;
+  streaming.store(!resident, std::memory_order_release);
+  osMutexRelease(fileLock);
+  if (!resident) {
+    osEventFlagsSet(readerEvents, SUITE_EVENT_WAKE);
+  }
+  printf("Packet suite %s loaded: %lu vectors, %s\n", name, static_cast<unsigned long>(header.vectors),
+         resident ? "resident" : "streamed");
+  return 0;
+}
+
+extern "C" int PacketSuite_Write(uint16_t index, uint32_t offset, const uint8_t* data, uint32_t length)
+{
+  if (!fileLock) {
+    return -1;
+  }
+
+  char name[16];
+  suiteFileName(name, sizeof(name), index);
+  osMutexAcquire(fileLock, osWaitForever);
+  if (!media) {
+    osMutexRelease(fileLock);
+    return -1;
+  }
+  if (loaded && loadedIndex == index) {
+    unload();
+  }
+
+  int result = 0;
+  if (offset == 0u) {
+    fx_file_delete(media, name);
+    if (fx_file_create(media, name) != FX_SUCCESS) {
+      osMutexRelease(fileLock);
+      return -3;
+    }
+  }
+  if (fx_file_open(media, &uploadFile, name, FX_OPEN_FOR_WRITE) != FX_SUCCESS) {
+    osMutexRelease(fileLock);
+    return offset == 0u ? -3 : -2;
+  }
+  if (uploadFile.fx_file_current_file_size != offset) {
+    result = -2;
+  }
+  else if (fx_file_seek(&uploadFile, offset) != FX_SUCCESS ||
+           fx_file_write(&uploadFile, const_cast<uint8_t*>(data), length) != FX_SUCCESS) {
+    result = -3;
+  }
+  fx_file_close(&uploadFile);
+  fx_media_flush(media);
+  osMutexRelease(fileLock);
+  return result;
+}
+
+extern "C" int PacketSuite_Rewind(void)
+{
+  if (!loaded) {
+    return -1;
+  }
+  vectorsRead = 0;
+  underruns = 0;
+  tail.store(0u, std::memory_order_release);
+  if (!resident) {
+    rewindGen.fetch_add(1u, std::memory_order_acq_rel);
+    osEventFlagsSet(readerEvents, SUITE_EVENT_WAKE);
+  }
+  return 0;
+}
+
+// Wait until length bytes past tail are buffered, false if they never will be
+static bool waitFor(uint32_t length)
+{
+  bool waited = false;
+  uint32_t const start = HAL_GetTick();
+
+  for (;;) {
+    bool const current = resident || readerGen.load(std::memory_order_acquire) == rewindGen.load(std::memory_order_relaxed);
+    uint32_t const h = head.load(std::memory_order_acquire);
+    if (current && h - tail.load(std::memory_order_relaxed) >= length) {
+      return true;
+    }
+    if (resident || readError.load(std::memory_order_acquire) || (current && h >= bodySize) ||
+        HAL_GetTick() - start >= PACKET_SUITE_WAIT_MS) {
+      return false;
+    }
+    if (!waited) {
+      underruns++;
+      waited = true;
+    }
+    osEventFlagsSet(readerEvents, SUITE_EVENT_WAKE);
+    osDelay(1u);
+  }
+}
+
+extern "C" int PacketSuite_Next(PacketSuiteVector_t* vector)
+{
+  if (!loaded) {
+    return -1;
+  }
+  if (vectorsRead >= header.vectors) {
+    return 0;
+  }
+
+  uint8_t raw[PACKET_SUITE_VECTOR_HEADER];
+  if (!waitFor(PACKET_SUITE_VECTOR_HEADER)) {
+    return -1;
+  }
+  uint32_t const t = tail.load(std::memory_order_relaxed);
+  copyOut(t, raw, sizeof(raw));
+  uint8_t const length = raw[0];
+  if (length == 0u || length > PACKET_TIMING_MAX_BYTES || !waitFor(PACKET_SUITE_VECTOR_HEADER + length)) {
+    return -1;
+  }
+  copyOut(t + PACKET_SUITE_VECTOR_HEADER, vector->bytes, length);
+  tail.store(t + PACKET_SUITE_VECTOR_HEADER + length, std::memory_order_release);
+
+  uint32_t const gap_us = raw[4] | (static_cast<uint32_t>(raw[5]) << 8) | (static_cast<uint32_t>(raw[6]) << 16) |
+                          (static_cast<uint32_t>(raw[7]) << 24);
+  vector->length = length;
+  vector->flags = raw[1] & (PACKET_PROGRAM_FLAG_TRIGGER | PACKET_PROGRAM_FLAG_ACK);
+  vector->repeat = static_cast<uint16_t>(raw[2] | (raw[3] << 8));
+  vector->gap_us = gap_us ? gap_us : defaultGapUs;
+  vectorsRead++;
+  if (!resident) {
+    osEventFlagsSet(readerEvents, SUITE_EVENT_WAKE);
+  }
+  return 1;
+}
+
+extern "C" void PacketSuite_GetStatus(PacketSuiteStatus_t* status)
+{
+  if (!status) {
+    return;
+  }
+  status->loaded = loaded;
+  status->resident = resident;
+  status->index = loadedIndex;
+  std::memcpy(status->name, header.name, sizeof(header.name));
+  status->name[sizeof(header.name)] = '\0';
+  status->vectors = loaded ? header.vectors : 0u;
+  status->size = loaded ? bodySize : 0u;
+  status->vectors_read = vectorsRead;
+  status->underruns = underruns;
+}
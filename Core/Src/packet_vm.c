@@ -0,0 +1,423 @@
+/**
+ * @file packet_vm.c
+ * @brief VM program storage, SD loading, the verifier, readings and run records
+ *
+ * The program is written by the RPC thread and only read by the command
+ * station thread while it runs, loading is refused during a run. The media
+ * pointer is shared with the FileX thread under the file lock. Records are
+ * written by the command station thread and published by the record count.
+ */
+
+#include "packet_vm.h"
+#include "analog_manager.h"
+#include "app_filex.h"
+#include "cmsis_os2.h"
+#include "rtos_static.h"
+#include "gpio_io.h"
+#include "main.h"
+#include "packet_program.h"
+#include "parameter_manager.h"
+#include "railcom.h"
+#include <stdio.h>
+#include <string.h>
+
+static PacketVmInstruction_t g_instructions[PACKET_VM_MAX_INSTRUCTIONS];
+static uint16_t g_instructionCount = 0;
+static PacketVmPacket_t g_packets[PACKET_VM_MAX_PACKETS];
+static uint16_t g_packetCount = 0;
+static int32_t g_file = -1;
+static char g_name[17] = "";
+
+static PacketVmRecord_t g_records[PACKET_VM_MAX_RECORDS];
+static volatile uint32_t g_recordCount = 0;
+static uint32_t g_dropped = 0;
+static volatile uint16_t g_runPc = 0;
+static volatile uint32_t g_executed = 0;
+static volatile uint32_t g_yields = 0;
+static int32_t g_exitCode = 0;
+static bool g_stopped = false;
+static int32_t g_registers[PACKET_VM_REGISTERS];
+static uint32_t g_runStartMs = 0;
+static uint32_t g_runEndMs = 0;
+static volatile bool g_runActive = false;
+
+static FX_MEDIA *volatile g_media = NULL;
+static FX_FILE g_fxFile;
+static osMutexId_t g_fileLock = NULL;
+RTOS_MUTEX(packetVmFileLock);
+
+static bool program_running(void)
+{
+    PacketProgramStatus_t status;
+    CommandStation_GetProgramStatus(&status);
+    return status.running;
+}
+
+void PacketVm_Init(void)
+{
+    if (g_fileLock == NULL) {
+        g_fileLock = osMutexNew(&packetVmFileLock_attr);
+    }
+}
+
+void PacketVm_SetMedia(void *media)
+{
+    if (g_fileLock == NULL) {
+        g_media = (FX_MEDIA *)media;
+        return;
+    }
+    osMutexAcquire(g_fileLock, osWaitForever);
+    g_media = (FX_MEDIA *)media;
+    osMutexRelease(g_fileLock);
+}
+
+int PacketVm_Clear(void)
+{
+    if (program_running()) {
+        return -1;
+    }
+    g_instructionCount = 0;
+    g_packetCount = 0;
+    g_file = -1;
+    g_name[0] = '\0';
+    return 0;
+}
+
+int PacketVm_Append(const PacketVmInstruction_t *instructions, uint16_t count,
+                    const PacketVmPacket_t *packets, uint16_t packet_count)
+{
+    if (program_running() || (count > 0u && instructions == NULL) || (packet_count > 0u && packets == NULL)) {
+        return -1;
+    }
+    if (count > PACKET_VM_MAX_INSTRUCTIONS - g_instructionCount ||
+        packet_count > PACKET_VM_MAX_PACKETS - g_packetCount) {
+        return -1;
+    }
+    for (uint16_t i = 0; i < packet_count; i++) {
+        if (packets[i].length == 0u || packets[i].length > PACKET_VM_MAX_PACKET) {
+            return -1;
+        }
+    }
+    memcpy(&g_instructions[g_instructionCount], instructions, count * sizeof(PacketVmInstruction_t));
+    memcpy(&g_packets[g_packetCount], packets, packet_count * sizeof(PacketVmPacket_t));
+    g_instructionCount += count;
+    g_packetCount += packet_count;
+    g_file = -1;
+    return 0;
+}
+
+// g_fileLock held, the program is cleared on any failure
+static int load_file(uint16_t index, const char **error)
+{
+    char name[16];
+    snprintf(name, sizeof(name), "VM%04u.BIN", (unsigned)index);
+    if (g_media == NULL) {
+        *error = "no SD card mounted";
+        return -1;
+    }
+    if (fx_file_open(g_media, &g_fxFile, name, FX_OPEN_FOR_READ) != FX_SUCCESS) {
+        *error = "VM file not found";
+        return -1;
+    }
+
+    PacketVmFileHeader_t header;
+    ULONG actual = 0;
+    int result = -1;
+    *error = "not a VM program file";
+    if (fx_file_read(&g_fxFile, &header, sizeof(header), &actual) == FX_SUCCESS && actual == sizeof(header) &&
+        header.magic == PACKET_VM_MAGIC && header.version == PACKET_VM_VERSION &&
+        header.header_size >= sizeof(header)) {
+        ULONG const code = header.instructions * sizeof(PacketVmInstruction_t);
+        ULONG const table = header.packets * sizeof(PacketVmPacket_t);
+        if (header.instructions == 0u || header.instructions > PACKET_VM_MAX_INSTRUCTIONS ||
+            header.packets > PACKET_VM_MAX_PACKETS) {
+            *error = "VM program too large";
+        }
+        else if (fx_file_seek(&g_fxFile, header.header_size) != FX_SUCCESS ||
+                 fx_file_read(&g_fxFile, g_instructions, code, &actual) != FX_SUCCESS || actual != code ||
+                 (table > 0u && (fx_file_read(&g_fxFile, g_packets, table, &actual) != FX_SUCCESS || actual != table))) {
+            *error = "VM file read error";
+        }
+        else {
+            result = 0;
+            for (uint16_t i = 0; i < header.packets; i++) {
+                if (g_packets[i].length == 0u || g_packets[i].length > PACKET_VM_MAX_PACKET) {
+                    *error = "invalid packet length";
+                    result = -1;
+                }
+            }
+        }
+    }
+    fx_file_close(&g_fxFile);
+    if (result != 0) {
+        return -1;
+    }
+
+    g_instructionCount = header.instructions;
+    g_packetCount = header.packets;
+    g_file = index;
+    memcpy(g_name, header.name, sizeof(header.name));
+    g_name[sizeof(header.name)] = '\0';
+    printf("VM program %s loaded: %u instructions, %u packets\n", name, (unsigned)g_instructionCount,
+           (unsigned)g_packetCount);
+    return 0;
+}
+
+int PacketVm_LoadFile(uint16_t index, const char **error)
+{
+    const char *dummy;
+    if (error == NULL) {
+        error = &dummy;
+    }
+    if (index > PACKET_VM_MAX_INDEX) {
+        *error = "file must be 0-9999";
+        return -1;
+    }
+    if (PacketVm_Clear() != 0) {
+        *error = "program already running";
+        return -1;
+    }
+    if (g_fileLock == NULL) {
+        *error = "no SD card mounted";
+        return -1;
+    }
+    osMutexAcquire(g_fileLock, osWaitForever);
+    int const result = load_file(index, error);
+    osMutexRelease(g_fileLock);
+    return result;
+}
+
+static bool is_register(uint8_t r)
+{
+    return r < PACKET_VM_REGISTERS;
+}
+
+static bool is_target(int32_t target)
+{
+    return target >= 0 && target < (int32_t)g_instructionCount;
+}
+
+// Operands of one instruction, returns NULL if they keep the VM in its sandbox
+static const char *verify(const PacketVmInstruction_t *in, bool bidi, bool streaming)
+{
+    switch (in->op) {
+    case PACKET_VM_OP_END:
+        return NULL;
+    case PACKET_VM_OP_SEND:
+        if (in->a >= g_packetCount) {
+            return "packet index out of range";
+        }
+        if ((in->b & ~PACKET_VM_SEND_ALL) != 0u || in->imm < 0) {
+            return "invalid send";
+        }
+        if ((in->b & PACKET_VM_SEND_RAILCOM) && !bidi) {
+            return "RailCom sends require BiDi";
+        }
+        // The library path has its own gaps and no per packet ACK arming
+        if ((in->b & PACKET_VM_SEND_RAILCOM) && (in->imm != 0 || (in->b & PACKET_VM_SEND_ACK))) {
+            return "RailCom sends take no gap and no ACK";
+        }
+        if ((in->b & PACKET_VM_SEND_ACK) && !streaming) {
+            return "ACK detection requires continuous analog sampling";
+        }
+        return NULL;
+    case PACKET_VM_OP_GAP:
+    case PACKET_VM_OP_WAIT:
+        return in->imm >= 0 && in->imm <= PACKET_VM_MAX_BITS ? NULL : "bits must be 0-1000000";
+    case PACKET_VM_OP_READ:
+        if (!is_register(in->a) || in->b >= PACKET_VM_SRC_COUNT) {
+            return "invalid read";
+        }
+        if ((in->b == PACKET_VM_SRC_CURRENT_MA || in->b == PACKET_VM_SRC_VOLTAGE_MV || in->b == PACKET_VM_SRC_ACK) &&
+            !streaming) {
+            return "analog readings require continuous analog sampling";
+        }
+        return NULL;
+    case PACKET_VM_OP_LOAD:
+    case PACKET_VM_OP_CMP:
+        return is_register(in->a) ? NULL : "register out of range";
+    case PACKET_VM_OP_ADD:
+    case PACKET_VM_OP_AND:
+    case PACKET_VM_OP_CMPR:
+        return is_register(in->a) && is_register(in->b) ? NULL : "register out of range";
+    case PACKET_VM_OP_SHR:
+        if (!is_register(in->a) || !is_register(in->b)) {
+            return "register out of range";
+        }
+        return in->imm >= 0 && in->imm < 32 ? NULL : "shift must be 0-31";
+    case PACKET_VM_OP_ADDR:
+    case PACKET_VM_OP_SUB:
+        return is_register(in->a) && is_register(in->b) && is_register(in->c) ? NULL : "register out of range";
+    case PACKET_VM_OP_BR:
+        if (in->a >= PACKET_VM_COND_COUNT) {
+            return "invalid condition";
+        }
+        return is_target(in->imm) ? NULL : "branch target out of range";
+    case PACKET_VM_OP_DJNZ:
+        if (!is_register(in->a)) {
+            return "register out of range";
+        }
+        return is_target(in->imm) ? NULL : "branch target out of range";
+    case PACKET_VM_OP_PATCH:
+        if (in->a >= g_packetCount || !is_register(in->c)) {
+            return "invalid patch";
+        }
+        // The last byte is the checksum
+        return in->b + 1u < g_packets[in->a].length ? NULL : "patch byte out of range";
+    case PACKET_VM_OP_RECORD:
+        if (in->c == 0u || in->c > PACKET_VM_RECORD_VALUES || in->b + in->c > PACKET_VM_REGISTERS) {
+            return "invalid record";
+        }
+        return NULL;
+    default:
+        return "unknown opcode";
+    }
+}
+
+int PacketVm_Prepare(const char **error, uint16_t *pc)
+{
+    const char *dummy;
+    uint16_t dummy_pc;
+    if (error == NULL) {
+        error = &dummy;
+    }
+    if (pc == NULL) {
+        pc = &dummy_pc;
+    }
+
+    if (g_instructionCount == 0) {
+        *error = "no VM program loaded";
+        return -1;
+    }
+
+    uint8_t bidi = 0;
+    get_dcc_bidi_enable(&bidi);
+    bool const streaming = analog_manager_is_streaming();
+    for (uint16_t i = 0; i < g_instructionCount; i++) {
+        const char *const failure = verify(&g_instructions[i], bidi != 0u, streaming);
+        if (failure != NULL) {
+            *error = failure;
+            *pc = i;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+uint16_t PacketVm_Get(const PacketVmInstruction_t **instructions, const PacketVmPacket_t **packets,
+                      uint16_t *packet_count)
+{
+    if (instructions != NULL) {
+        *instructions = g_instructions;
+    }
+    if (packets != NULL) {
+        *packets = g_packets;
+    }
+    if (packet_count != NULL) {
+        *packet_count = g_packetCount;
+    }
+    return g_instructionCount;
+}
+
+int32_t PacketVm_Read(uint8_t source, uint32_t packets_sent)
+{
+    uint16_t raw = 0;
+    switch (source) {
+    case PACKET_VM_SRC_CURRENT_MA:
+        return analog_manager_get_average(2, 2, PACKET_VM_WINDOW_MS, &raw) == 0 ? analog_counts_to_ma(raw) : 0;
+    case PACKET_VM_SRC_VOLTAGE_MV:
+        return analog_manager_get_average(1, 6, PACKET_VM_WINDOW_MS, &raw) == 0 ? analog_counts_to_mv(raw) : 0;
+    case PACKET_VM_SRC_IO:
+        return gpio_io_snapshot();
+    case PACKET_VM_SRC_RAILCOM_FRAMES: {
+        RailcomStats_t railcom;
+        railcom_get_stats(&railcom);
+        return (int32_t)(railcom.frames - railcom.invalid);
+    }
+    case PACKET_VM_SRC_RAILCOM_CH1: {
+        uint16_t ch1 = 0xFFFFu;
+        railcom_last_cutout(NULL, &ch1);
+        return ch1 == 0xFFFFu ? -1 : ch1;
+    }
+    case PACKET_VM_SRC_ACK: {
+        uint32_t delay_ms = 0;
+        return analog_ack_detected(&delay_ms) ? (int32_t)delay_ms : -1;
+    }
+    case PACKET_VM_SRC_TICK_MS:
+        return (int32_t)HAL_GetTick();
+    case PACKET_VM_SRC_PACKETS:
+        return (int32_t)packets_sent;
+    default:
+        return 0;
+    }
+}
+
+void PacketVm_RunStart(void)
+{
+    g_recordCount = 0;
+    g_dropped = 0;
+    g_runPc = 0;
+    g_executed = 0;
+    g_yields = 0;
+    g_exitCode = 0;
+    g_stopped = false;
+    g_runStartMs = HAL_GetTick();
+    g_runActive = true;
+}
+
+void PacketVm_RunPc(uint16_t pc, uint32_t executed, uint32_t yields)
+{
+    g_runPc = pc;
+    g_executed = executed;
+    g_yields = yields;
+}
+
+void PacketVm_AddRecord(const PacketVmRecord_t *record)
+{
+    uint32_t const count = g_recordCount;
+    if (count >= PACKET_VM_MAX_RECORDS) {
+        g_dropped++;
+        return;
+    }
+    g_records[count] = *record;
+    __DMB();
+    g_recordCount = count + 1u;
+}
+
+void PacketVm_RunEnd(int32_t exit_code, bool stopped, const int32_t *registers)
+{
+    g_exitCode = exit_code;
+    g_stopped = stopped;
+    memcpy(g_registers, registers, sizeof(g_registers));
+    g_runEndMs = HAL_GetTick();
+    g_runActive = false;
+}
+
+uint32_t PacketVm_GetRecords(uint32_t first, PacketVmRecord_t *records, uint32_t max)
+{
+    uint32_t const count = g_recordCount;
+    __DMB();
+    uint32_t copied = 0;
+    for (uint32_t i = first; i < count && copied < max; i++) {
+        records[copied++] = g_records[i];
+    }
+    return copied;
+}
+
+void PacketVm_GetStatus(PacketVmStatus_t *status)
+{
+    status->instructions = g_instructionCount;
+    status->packets = g_packetCount;
+    status->file = g_file;
+    memcpy(status->name, g_name, sizeof(status->name));
+    status->running = g_runActive;
+    status->pc = g_runPc;
+    status->executed = g_executed;
+    status->yields = g_yields;
+    status->records = g_recordCount;
+    status->dropped = g_dropped;
+    status->exit_code = g_exitCode;
+    status->stopped = g_stopped;
+    status->elapsed_ms = (g_runActive ? HAL_GetTick() : g_runEndMs) - g_runStartMs;
+    memcpy(status->registers, g_registers, sizeof(status->registers));
+}
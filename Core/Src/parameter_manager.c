@@ -9,9 +9,11 @@
  */
 
 #include "parameter_manager.h"
+#include "checksum.h"
 #include "stm32h5xx_hal.h"
 #include "tx_api.h"
 #include "main.h"
+#include <stddef.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <string.h>
@@ -30,6 +32,7 @@ static const uint8_t DEFAULT_DCC_BIT0_DURATION = 100; // 100 microseconds (NMRA
 static const uint8_t DEFAULT_DCC_BIDI_ENABLE = 0;     // BiDi disabled by default
 static const uint16_t DEFAULT_DCC_BIDI_DAC = DEFAULT_BIDIR_THRESHOLD;    // BiDi DAC threshold (12-bit: 0-4095)
 static const uint8_t DEFAULT_DCC_TRIGGER_FIRST_BIT = 0; // Trigger on first bit disabled by default
+static const uint8_t DEFAULT_DCC_DMA_TRANSMIT = 0;    // Interrupt driven transmit by default
 
 static const uint32_t DEFAULT_NETWORK_IP_ADDRESS = 0xC0A80164;  // 192.168.1.100
 static const uint32_t DEFAULT_NETWORK_SUBNET_MASK = 0xFFFFFF00;  // 255.255.255.0
@@ -66,7 +69,7 @@ typedef struct {
     uint8_t dcc_bit0_duration;  // "0" bit duration in microseconds
     uint8_t dcc_bidi_enable;    // BiDi (bidirectional) enable flag
     uint8_t dcc_trigger_first_bit; // Trigger on first bit enable flag
-    uint8_t _padding1[1];  // Alignment padding
+    uint8_t dcc_dma_transmit;   // DMA driven waveform generation enable flag
     uint16_t dcc_short_circuit_threshold;
     uint16_t dcc_bidi_dac;      // BiDi DAC threshold value (12-bit: 0-4095)
     uint8_t _padding1b[0];  // Alignment padding
@@ -99,6 +102,80 @@ typedef struct {
     uint8_t data[PARAM_DATA_SIZE];
 } FlashStorage_t;
 
+/*
+ * Saves append a change record per modified parameter behind the image, the
+ * sector is only erased and the image rewritten once the records no longer
+ * fit. Halfwords are programmed in order, check last, so a record torn by a
+ * reset never validates. Reading a never programmed EDATA halfword raises an
+ * ECC error (NMI), the end of the log is found with read_halfword().
+ */
+typedef struct {
+    uint16_t key;               // size << 12 | byte offset in data
+    uint16_t value_lo;
+    uint16_t value_hi;
+    uint16_t check;             // low half of the CRC32 of the fields above
+} ParamRecord_t;
+
+#define PARAM_LOG_ADDRESS       (PARAM_FLASH_ADDRESS + sizeof(FlashStorage_t))
+#define PARAM_LOG_END           (PARAM_FLASH_ADDRESS + PARAM_SECTOR_SIZE)
+#define PARAM_LOG_CAPACITY      ((PARAM_SECTOR_SIZE - sizeof(FlashStorage_t)) / sizeof(ParamRecord_t))
+
+/*
+ * Profiles take one sector each behind the parameter sector, so saving one
+ * erases nothing else. The magic is programmed last: a slot whose magic reads
+ * back is complete, a profile torn by a reset reads as an empty slot.
+ */
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t crc32;             // over everything behind dataSize
+    uint32_t dataSize;
+    ParameterOverrides_t overrides;
+    char name[PARAM_PROFILE_NAME_LENGTH];
+    uint8_t data[PARAM_DATA_SIZE];
+} ProfileStorage_t;
+
+#define PROFILE_MAGIC           0x50524F46  // 'PROF'
+#define PROFILE_FLASH_ADDRESS   (PARAM_FLASH_ADDRESS + PARAM_SECTOR_SIZE)
+
+_Static_assert(sizeof(ParameterData_t) <= PARAM_DATA_SIZE, "parameters exceed the flash image");
+_Static_assert(PARAM_FLASH_SECTOR + 1 + PARAM_PROFILE_SLOTS <= 8, "profiles exceed the EDATA sectors");
+_Static_assert(sizeof(ProfileStorage_t) % 2 == 0, "profiles are programmed in halfwords");
+_Static_assert(PARAM_DATA_SIZE <= 0x1000, "record keys hold a 12 bit offset");
+_Static_assert(sizeof(FlashStorage_t) % 2 == 0, "records must be halfword aligned");
+
+#define PARAM_FIELD(field, lo, hi) \
+    { #field, (uint16_t)offsetof(ParameterData_t, field), (uint8_t)sizeof(((ParameterData_t *)0)->field), (lo), (hi) }
+#define PARAM_RAM_ONLY(name)    { (name), 0, 0, 0, 0 }
+
+// Location and valid range of every stored parameter, indexed by ParameterId
+static const ParameterDescriptor_t g_paramTable[PARAM_COUNT] = {
+    [PARAM_DCC_TRACK_VOLTAGE]           = PARAM_FIELD(dcc_track_voltage, 0, 0xFFFF),
+    [PARAM_DCC_TRACK_CURRENT_LIMIT]     = PARAM_FIELD(dcc_track_current_limit, 0, 0xFFFF),
+    [PARAM_DCC_PREAMBLE_BITS]           = PARAM_FIELD(dcc_preamble_bits, 1, 0xFF),
+    [PARAM_DCC_BIT1_DURATION]           = PARAM_FIELD(dcc_bit1_duration, 1, 0xFF),
+    [PARAM_DCC_BIT0_DURATION]           = PARAM_FIELD(dcc_bit0_duration, 1, 0xFF),
+    [PARAM_DCC_BIDI_ENABLE]             = PARAM_FIELD(dcc_bidi_enable, 0, 1),
+    [PARAM_DCC_TRIGGER_FIRST_BIT]       = PARAM_FIELD(dcc_trigger_first_bit, 0, 1),
+    [PARAM_DCC_DMA_TRANSMIT]            = PARAM_FIELD(dcc_dma_transmit, 0, 1),
+    [PARAM_DCC_SHORT_CIRCUIT_THRESHOLD] = PARAM_FIELD(dcc_short_circuit_threshold, 0, 0xFFFF),
+    [PARAM_DCC_BIDI_DAC]                = PARAM_FIELD(dcc_bidi_dac, 0, 4095),
+    // Zero bit override parameters are RAM only, kept by the command station (size 0)
+    [PARAM_DCC_ZEROBIT_OVERRIDE_MASK]   = PARAM_RAM_ONLY("dcc_zerobit_override_mask"),
+    [PARAM_DCC_ZEROBIT_DELTAP]          = PARAM_RAM_ONLY("dcc_zerobit_deltap"),
+    [PARAM_DCC_ZEROBIT_DELTAN]          = PARAM_RAM_ONLY("dcc_zerobit_deltan"),
+    [PARAM_NETWORK_IP_ADDRESS]          = PARAM_FIELD(network_ip_address, 0, 0xFFFFFFFF),
+    [PARAM_NETWORK_SUBNET_MASK]         = PARAM_FIELD(network_subnet_mask, 0, 0xFFFFFFFF),
+    [PARAM_NETWORK_GATEWAY]             = PARAM_FIELD(network_gateway, 0, 0xFFFFFFFF),
+    [PARAM_NETWORK_PORT]                = PARAM_FIELD(network_port, 1, 0xFFFF),
+    [PARAM_SYSTEM_DEVICE_ID]            = PARAM_FIELD(system_device_id, 0, 0xFFFFFFFF),
+    [PARAM_SYSTEM_BAUD_RATE]            = PARAM_FIELD(system_baud_rate, 1, 0xFFFFFFFF),
+    [PARAM_SYSTEM_DEBUG_LEVEL]          = PARAM_FIELD(system_debug_level, 0, 4),
+    [PARAM_USER_PARAM_1]                = PARAM_FIELD(user_param_1, 0, 0xFFFFFFFF),
+    [PARAM_USER_PARAM_2]                = PARAM_FIELD(user_param_2, 0, 0xFFFFFFFF),
+    [PARAM_USER_PARAM_3]                = PARAM_FIELD(user_param_3, 0, 0xFFFFFFFF),
+};
+
 // Runtime parameter storage - use union for type-safe access
 static union {
     uint8_t bytes[PARAM_DATA_SIZE];
@@ -108,46 +185,22 @@ static union {
 static int g_initialized = 0;
 static int g_modified = 0;
 
-// Static storage buffer to avoid stack overflow
+// Static storage buffer to avoid stack overflow, mirrors the flash contents after a save or restore
 static FlashStorage_t g_flashStorage;
 
+// Profile being saved or activated
+static ProfileStorage_t g_profileStorage;
+
+// Next free record, 0 if the sector must be rewritten on the next save
+static uint32_t g_logNext = 0;
+static ParameterFlashStats_t g_flashStats = { 0, PARAM_LOG_CAPACITY, 0, 0 };
+
+// Set while read_halfword() probes the log, see parameter_manager_flash_nmi()
+static volatile uint8_t g_eccProbe = 0;
+static volatile uint8_t g_eccFault = 0;
+
 
 
-// CRC32 lookup table
-static const uint32_t crc32_table[256] = {
-    0x00000000, 0x77073096, 0xEE0E612C, 0x990951BA, 0x076DC419, 0x706AF48F, 0xE963A535, 0x9E6495A3,
-    0x0EDB8832, 0x79DCB8A4, 0xE0D5E91E, 0x97D2D988, 0x09B64C2B, 0x7EB17CBD, 0xE7B82D07, 0x90BF1D91,
-    0x1DB71064, 0x6AB020F2, 0xF3B97148, 0x84BE41DE, 0x1ADAD47D, 0x6DDDE4EB, 0xF4D4B551, 0x83D385C7,
-    0x136C9856, 0x646BA8C0, 0xFD62F97A, 0x8A65C9EC, 0x14015C4F, 0x63066CD9, 0xFA0F3D63, 0x8D080DF5,
-    0x3B6E20C8, 0x4C69105E, 0xD56041E4, 0xA2677172, 0x3C03E4D1, 0x4B04D447, 0xD20D85FD, 0xA50AB56B,
-    0x35B5A8FA, 0x42B2986C, 0xDBBBC9D6, 0xACBCF940, 0x32D86CE3, 0x45DF5C75, 0xDCD60DCF, 0xABD13D59,
-    0x26D930AC, 0x51DE003A, 0xC8D75180, 0xBFD06116, 0x21B4F4B5, 0x56B3C423, 0xCFBA9599, 0xB8BDA50F,
-    0x2802B89E, 0x5F058808, 0xC60CD9B2, 0xB10BE924, 0x2F6F7C87, 0x58684C11, 0xC1611DAB, 0xB6662D3D,
-    0x76DC4190, 0x01DB7106, 0x98D220BC, 0xEFD5102A, 0x71B18589, 0x06B6B51F, 0x9FBFE4A5, 0xE8B8D433,
-    0x7807C9A2, 0x0F00F934, 0x9609A88E, 0xE10E9818, 0x7F6A0DBB, 0x086D3D2D, 0x91646C97, 0xE6635C01,
-    0x6B6B51F4, 0x1C6C6162, 0x856530D8, 0xF262004E, 0x6C0695ED, 0x1B01A57B, 0x8208F4C1, 0xF50FC457,
-    0x65B0D9C6, 0x12B7E950, 0x8BBEB8EA, 0xFCB9887C, 0x62DD1DDF, 0x15DA2D49, 0x8CD37CF3, 0xFBD44C65,
-    0x4DB26158, 0x3AB551CE, 0xA3BC0074, 0xD4BB30E2, 0x4ADFA541, 0x3DD895D7, 0xA4D1C46D, 0xD3D6F4FB,
-    0x4369E96A, 0x346ED9FC, 0xAD678846, 0xDA60B8D0, 0x44042D73, 0x33031DE5, 0xAA0A4C5F, 0xDD0D7CC9,
-    0x5005713C, 0x270241AA, 0xBE0B1010, 0xC90C2086, 0x5768B525, 0x206F85B3, 0xB966D409, 0xCE61E49F,
-    0x5EDEF90E, 0x29D9C998, 0xB0D09822, 0xC7D7A8B4, 0x59B33D17, 0x2EB40D81, 0xB7BD5C3B, 0xC0BA6CAD,
-    0xEDB88320, 0x9ABFB3B6, 0x03B6E20C, 0x74B1D29A, 0xEAD54739, 0x9DD277AF, 0x04DB2615, 0x73DC1683,
-    0xE3630B12, 0x94643B84, 0x0D6D6A3E, 0x7A6A5AA8, 0xE40ECF0B, 0x9309FF9D, 0x0A00AE27, 0x7D079EB1,
-    0xF00F9344, 0x8708A3D2, 0x1E01F268, 0x6906C2FE, 0xF762575D, 0x806567CB, 0x196C3671, 0x6E6B06E7,
-    0xFED41B76, 0x89D32BE0, 0x10DA7A5A, 0x67DD4ACC, 0xF9B9DF6F, 0x8EBEEFF9, 0x17B7BE43, 0x60B08ED5,
-    0xD6D6A3E8, 0xA1D1937E, 0x38D8C2C4, 0x4FDFF252, 0xD1BB67F1, 0xA6BC5767, 0x3FB506DD, 0x48B2364B,
-    0xD80D2BDA, 0xAF0A1B4C, 0x36034AF6, 0x41047A60, 0xDF60EFC3, 0xA867DF55, 0x316E8EEF, 0x4669BE79,
-    0xCB61B38C, 0xBC66831A, 0x256FD2A0, 0x5268E236, 0xCC0C7795, 0xBB0B4703, 0x220216B9, 0x5505262F,
-    0xC5BA3BBE, 0xB2BD0B28, 0x2BB45A92, 0x5CB36A04, 0xC2D7FFA7, 0xB5D0CF31, 0x2CD99E8B, 0x5BDEAE1D,
-    0x9B64C2B0, 0xEC63F226, 0x756AA39C, 0x026D930A, 0x9C0906A9, 0xEB0E363F, 0x72076785, 0x05005713,
-    0x95BF4A82, 0xE2B87A14, 0x7BB12BAE, 0x0CB61B38, 0x92D28E9B, 0xE5D5BE0D, 0x7CDCEFB7, 0x0BDBDF21,
-    0x86D3D2D4, 0xF1D4E242, 0x68DDB3F8, 0x1FDA836E, 0x81BE16CD, 0xF6B9265B, 0x6FB077E1, 0x18B74777,
-    0x88085AE6, 0xFF0F6A70, 0x66063BCA, 0x11010B5C, 0x8F659EFF, 0xF862AE69, 0x616BFFD3, 0x166CCF45,
-    0xA00AE278, 0xD70DD2EE, 0x4E048354, 0x3903B3C2, 0xA7672661, 0xD06016F7, 0x4969474D, 0x3E6E77DB,
-    0xAED16A4A, 0xD9D65ADC, 0x40DF0B66, 0x37D83BF0, 0xA9BCAE53, 0xDEBB9EC5, 0x47B2CF7F, 0x30B5FFE9,
-    0xBDBDF21C, 0xCABAC28A, 0x53B39330, 0x24B4A3A6, 0xBAD03605, 0xCDD70693, 0x54DE5729, 0x23D967BF,
-    0xB3667A2E, 0xC4614AB8, 0x5D681B02, 0x2A6F2B94, 0xB40BBE37, 0xC30C8EA1, 0x5A05DF1B, 0x2D02EF8D
-};
 
 /**
  * @brief Calculate CRC32 checksum
@@ -158,15 +211,7 @@ static uint32_t calculate_crc32(const void* data, size_t length) {
         return 0;
     }
     
-    const uint8_t* bytes = (const uint8_t*)data;
-    uint32_t crc = 0xFFFFFFFF;
-    
-    for (size_t i = 0; i < length; i++) {
-        uint8_t index = (crc ^ bytes[i]) & 0xFF;
-        crc = (crc >> 8) ^ crc32_table[index];
-    }
-    
-    return ~crc;
+    return checksum_crc32(data, (uint32_t)length);
 }
 
 /**
@@ -186,6 +231,7 @@ static void load_defaults(void) {
     g_paramData.params.dcc_bit0_duration = DEFAULT_DCC_BIT0_DURATION;
     g_paramData.params.dcc_bidi_enable = DEFAULT_DCC_BIDI_ENABLE;
     g_paramData.params.dcc_trigger_first_bit = DEFAULT_DCC_TRIGGER_FIRST_BIT;
+    g_paramData.params.dcc_dma_transmit = DEFAULT_DCC_DMA_TRANSMIT;
     g_paramData.params.dcc_short_circuit_threshold = DEFAULT_DCC_SHORT_CIRCUIT_THRESHOLD;
     g_paramData.params.dcc_bidi_dac = DEFAULT_DCC_BIDI_DAC;
     
@@ -227,19 +273,14 @@ int parameter_manager_init(int force_defaults) {
 }
 
 /**
- * @brief Save parameters to flash
+ * @brief Erase the sector and write the full image of g_flashStorage.data
  */
-int parameter_manager_save(void) {
-    if (!g_initialized) {
-        return -1;
-    }
-    
-    // Use static storage buffer to avoid stack overflow
+static int write_image(void) {
     g_flashStorage.magic = MAGIC_NUMBER;
     g_flashStorage.version = VERSION;
     g_flashStorage.dataSize = PARAM_DATA_SIZE;
-    memcpy(g_flashStorage.data, g_paramData.bytes, PARAM_DATA_SIZE);
     g_flashStorage.crc32 = calculate_crc32(g_flashStorage.data, g_flashStorage.dataSize);
+    g_logNext = 0;
     
     // Unlock flash
     HAL_FLASH_Unlock();
@@ -262,6 +303,7 @@ int parameter_manager_save(void) {
         HAL_FLASH_Lock();
         return -1;
     }
+    g_flashStats.erases++;
 
     // Write the entire storage structure as halfwords (16-bit)
     uint32_t Address = PARAM_FLASH_ADDRESS;
@@ -280,13 +322,137 @@ int parameter_manager_save(void) {
     }
    
     HAL_FLASH_Lock();
-    
-    if (status == HAL_OK) {
-        g_modified = 0;
-        return 0;
+
+    g_logNext = PARAM_LOG_ADDRESS;
+    g_flashStats.records = 0;
+    return 0;
+}
+
+/**
+ * @brief Append a change record, flash must be unlocked
+ */
+static int append_record(const ParameterDescriptor_t *desc, uint32_t value) {
+    uint16_t record[4];
+    record[0] = (uint16_t)(((uint32_t)desc->size << 12) | desc->offset);
+    record[1] = (uint16_t)value;
+    record[2] = (uint16_t)(value >> 16);
+    record[3] = (uint16_t)calculate_crc32(record, 6);
+
+    for (size_t i = 0; i < 4; i++) {
+        if (HAL_FLASH_Program(FLASH_TYPEPROGRAM_HALFWORD_EDATA, g_logNext + 2 * i, (uint32_t)&record[i]) != HAL_OK) {
+            // The slot is partly programmed, the next save rewrites the sector
+            g_logNext = 0;
+            return -1;
+        }
+    }
+    g_logNext += sizeof(ParamRecord_t);
+    g_flashStats.records++;
+    return 0;
+}
+
+/**
+ * @brief Save parameters to flash
+ */
+int parameter_manager_save(void) {
+    if (!g_initialized) {
+        return -1;
     }
     
-    return -1;
+    // Parameters that differ from flash
+    uint32_t changes = 0;
+    for (size_t id = 0; id < PARAM_COUNT; id++) {
+        const ParameterDescriptor_t *desc = &g_paramTable[id];
+        if (desc->size != 0 &&
+            memcmp(&g_paramData.bytes[desc->offset], &g_flashStorage.data[desc->offset], desc->size) != 0) {
+            changes++;
+        }
+    }
+    g_flashStats.last_save_records = changes;
+
+    if (g_logNext != 0 && changes <= (PARAM_LOG_END - g_logNext) / sizeof(ParamRecord_t)) {
+        if (changes == 0 && memcmp(g_paramData.bytes, g_flashStorage.data, PARAM_DATA_SIZE) == 0) {
+            g_modified = 0;
+            return 0;
+        }
+
+        HAL_FLASH_Unlock();
+        for (size_t id = 0; id < PARAM_COUNT && g_logNext != 0; id++) {
+            const ParameterDescriptor_t *desc = &g_paramTable[id];
+            uint32_t value = 0;
+            if (desc->size == 0 ||
+                memcmp(&g_paramData.bytes[desc->offset], &g_flashStorage.data[desc->offset], desc->size) == 0) {
+                continue;
+            }
+            memcpy(&value, &g_paramData.bytes[desc->offset], desc->size);
+            if (append_record(desc, value) == 0) {
+                memcpy(&g_flashStorage.data[desc->offset], &g_paramData.bytes[desc->offset], desc->size);
+            }
+        }
+        HAL_FLASH_Lock();
+
+        // Bytes outside the table (padding) only reach flash with the image
+        if (g_logNext != 0 && memcmp(g_paramData.bytes, g_flashStorage.data, PARAM_DATA_SIZE) == 0) {
+            g_modified = 0;
+            return 0;
+        }
+    }
+
+    // No valid log, sector full or a record failed: rewrite the image
+    memcpy(g_flashStorage.data, g_paramData.bytes, PARAM_DATA_SIZE);
+    g_flashStats.last_save_records = 0;
+    if (write_image() != 0) {
+        return -1;
+    }
+    g_modified = 0;
+    return 0;
+}
+
+/**
+ * @brief Read a halfword that may never have been programmed
+ * @return 1 if read, 0 on an ECC error (erased halfword)
+ */
+static int read_halfword(uint32_t address, uint16_t *value) {
+    g_eccFault = 0;
+    g_eccProbe = 1;
+    __DSB();
+    *value = *(volatile const uint16_t *)address;
+    __DSB();
+    __ISB();
+    g_eccProbe = 0;
+    return !g_eccFault;
+}
+
+/**
+ * @brief Apply the change records behind the image to g_flashStorage.data
+ */
+static void apply_log(void) {
+    uint32_t address = PARAM_LOG_ADDRESS;
+    g_flashStats.records = 0;
+
+    while (address + sizeof(ParamRecord_t) <= PARAM_LOG_END) {
+        uint16_t record[4];
+        size_t programmed = 0;
+        while (programmed < 4 && read_halfword(address + 2 * programmed, &record[programmed])) {
+            programmed++;
+        }
+        if (programmed == 0 || (programmed == 4 && record[0] == 0xFFFF && record[3] == 0xFFFF)) {
+            break;  // end of the log
+        }
+
+        uint32_t size = record[0] >> 12;
+        uint32_t offset = record[0] & 0x0FFF;
+        if (programmed < 4 || record[3] != (uint16_t)calculate_crc32(record, 6) ||
+            (size != 1 && size != 2 && size != 4) || offset + size > PARAM_DATA_SIZE) {
+            // Torn or corrupt record, later records cannot be trusted
+            address = 0;
+            break;
+        }
+        uint32_t value = record[1] | ((uint32_t)record[2] << 16);
+        memcpy(&g_flashStorage.data[offset], &value, size);
+        g_flashStats.records++;
+        address += sizeof(ParamRecord_t);
+    }
+    g_logNext = address;
 }
 
 /**
@@ -325,25 +491,31 @@ int parameter_manager_restore(void) {
     
     // Validate magic number
     if (g_flashStorage.magic != MAGIC_NUMBER) {
+        g_logNext = 0;
         return -1;
     }
     
     // Validate version
     if (g_flashStorage.version != VERSION) {
+        g_logNext = 0;
         return -1;
     }
     
     // Validate data size
     if (g_flashStorage.dataSize != PARAM_DATA_SIZE) {
+        g_logNext = 0;
         return -1;
     }
     
     // Validate CRC
     uint32_t calculated_crc = calculate_crc32(g_flashStorage.data, g_flashStorage.dataSize);
     if (calculated_crc != g_flashStorage.crc32) {
+        g_logNext = 0;
         return -1;
     }
     
+    apply_log();
+    
     // Copy validated data to runtime parameter storage
     memcpy(g_paramData.bytes, g_flashStorage.data, PARAM_DATA_SIZE);
     g_modified = 0;
@@ -388,7 +560,8 @@ void parameter_manager_factory_reset(void) {
     HAL_FLASH_Lock();
 
 
-    // Reinitialize with forced defaults
+    // Reinitialize with forced defaults, the erased sector gets a new image
+    g_logNext = 0;
     int result = parameter_manager_init(1);
     
     if (result == 0) {
@@ -405,22 +578,260 @@ void parameter_manager_factory_reset(void) {
     printf("=================================\n\n");
 }
 
+/**
+ * @brief Clear an ECC error raised by read_halfword() (NMI handler)
+ * @return 1 if the NMI was caused by the probe, 0 otherwise
+ */
+int parameter_manager_flash_nmi(void) {
+    if (!g_eccProbe || !__HAL_FLASH_GET_FLAG(FLASH_FLAG_ECCD)) {
+        return 0;
+    }
+    __HAL_FLASH_CLEAR_FLAG(FLASH_FLAG_ECCD);
+    g_eccFault = 1;
+    return 1;
+}
+
+/**
+ * @brief Get the flash change log counters
+ */
+void parameter_manager_get_flash_stats(ParameterFlashStats_t *stats) {
+    if (stats != NULL) {
+        *stats = g_flashStats;
+    }
+}
+
 /* ============================================================================
- * ACCESSOR FUNCTIONS
+ * PROFILES
  * ============================================================================ */
 
+static uint32_t profile_address(uint32_t slot) {
+    return PROFILE_FLASH_ADDRESS + slot * PARAM_SECTOR_SIZE;
+}
+
 /**
- * @brief Set DCC track voltage parameter
- * @param voltage_mv Voltage in millivolts (e.g., 15000 for 15V)
- * @return 0 on success, -1 on failure
+ * @brief Whether a slot holds a complete profile
  */
-int set_dcc_track_voltage(uint16_t voltage_mv) {
-    if (!g_initialized) {
+static int profile_present(uint32_t slot) {
+    uint32_t const address = profile_address(slot);
+    uint16_t lo = 0;
+    uint16_t hi = 0;
+    return read_halfword(address, &lo) && read_halfword(address + 2, &hi) &&
+           (lo | ((uint32_t)hi << 16)) == PROFILE_MAGIC;
+}
+
+static uint32_t profile_crc(const ProfileStorage_t *profile) {
+    return checksum_crc32(&profile->overrides,
+                          (uint32_t)(sizeof(ProfileStorage_t) - offsetof(ProfileStorage_t, overrides)));
+}
+
+/**
+ * @brief Threads reading parameters never see a half copied block (thread context)
+ */
+static UINT lock_threads(void) {
+    TX_THREAD *const thread = tx_thread_identify();
+    UINT old = 0;
+    if (thread != TX_NULL) {
+        tx_thread_preemption_change(thread, 0, &old);
+    }
+    return old;
+}
+
+static void unlock_threads(UINT old) {
+    TX_THREAD *const thread = tx_thread_identify();
+    if (thread != TX_NULL) {
+        tx_thread_preemption_change(thread, old, &old);
+    }
+}
+
+/**
+ * @brief Erase one EDATA sector, flash must be unlocked
+ */
+static int erase_sector(uint32_t address) {
+    FLASH_EraseInitTypeDef EraseInitStruct;
+    EraseInitStruct.TypeErase = FLASH_TYPEERASE_SECTORS;
+    EraseInitStruct.Banks = GetBank_EDATA(address);
+    EraseInitStruct.Sector = GetSector_EDATA(address);
+    EraseInitStruct.NbSectors = 1;
+
+    uint32_t SectorError = 0;
+    if (HAL_FLASHEx_Erase(&EraseInitStruct, &SectorError) != HAL_OK) {
+        return -1;
+    }
+    g_flashStats.erases++;
+    return 0;
+}
+
+/**
+ * @brief Program halfwords first to last - 1 of data at the same offsets, flash must be unlocked
+ */
+static int program_halfwords(uint32_t address, const uint16_t *data, size_t first, size_t last) {
+    for (size_t i = first; i < last; i++) {
+        if (HAL_FLASH_Program(FLASH_TYPEPROGRAM_HALFWORD_EDATA, address + 2 * i, (uint32_t)&data[i]) != HAL_OK) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Store the parameters in RAM and the overrides as a named profile
+ */
+int parameter_profile_save(uint32_t slot, const char *name, const ParameterOverrides_t *overrides) {
+    size_t const length = name != NULL ? strlen(name) : 0;
+    if (!g_initialized || slot >= PARAM_PROFILE_SLOTS || overrides == NULL ||
+        length == 0 || length >= PARAM_PROFILE_NAME_LENGTH) {
+        return -1;
+    }
+
+    ProfileStorage_t *const profile = &g_profileStorage;
+    memset(profile, 0, sizeof(*profile));
+    profile->magic = PROFILE_MAGIC;
+    profile->version = VERSION;
+    profile->dataSize = PARAM_DATA_SIZE;
+    profile->overrides = *overrides;
+    memcpy(profile->name, name, length);
+    UINT const old = lock_threads();
+    memcpy(profile->data, g_paramData.bytes, PARAM_DATA_SIZE);
+    unlock_threads(old);
+    profile->crc32 = profile_crc(profile);
+
+    uint32_t const address = profile_address(slot);
+    const uint16_t *const halfwords = (const uint16_t *)profile;
+    size_t const magic = sizeof(profile->magic) / 2;
+
+    HAL_FLASH_Unlock();
+    int result = erase_sector(address);
+    if (result == 0) {
+        result = program_halfwords(address, halfwords, magic, sizeof(ProfileStorage_t) / 2);
+    }
+    if (result == 0) {
+        result = program_halfwords(address, halfwords, 0, magic);
+    }
+    HAL_FLASH_Lock();
+    return result;
+}
+
+/**
+ * @brief Replace the parameters in RAM by a profile
+ */
+int parameter_profile_activate(uint32_t slot, ParameterOverrides_t *overrides) {
+    if (!g_initialized || slot >= PARAM_PROFILE_SLOTS || overrides == NULL || !profile_present(slot)) {
+        return -1;
+    }
+
+    ProfileStorage_t *const profile = &g_profileStorage;
+    memcpy(profile, (const void *)profile_address(slot), sizeof(*profile));
+    if (profile->version != VERSION || profile->dataSize != PARAM_DATA_SIZE || profile->crc32 != profile_crc(profile)) {
+        return -1;
+    }
+
+    UINT const old = lock_threads();
+    memcpy(g_paramData.bytes, profile->data, PARAM_DATA_SIZE);
+    g_modified = 1;
+    unlock_threads(old);
+
+    *overrides = profile->overrides;
+    return 0;
+}
+
+/**
+ * @brief Name of the profile in a slot
+ */
+int parameter_profile_get_name(uint32_t slot, char *name) {
+    if (slot >= PARAM_PROFILE_SLOTS || name == NULL || !profile_present(slot)) {
+        return -1;
+    }
+    const ProfileStorage_t *const profile = (const ProfileStorage_t *)profile_address(slot);
+    memcpy(name, profile->name, PARAM_PROFILE_NAME_LENGTH);
+    name[PARAM_PROFILE_NAME_LENGTH - 1] = '\0';
+    return 0;
+}
+
+/**
+ * @brief Slot holding a profile by name
+ */
+int parameter_profile_find(const char *name) {
+    char stored[PARAM_PROFILE_NAME_LENGTH];
+    for (uint32_t slot = 0; name != NULL && slot < PARAM_PROFILE_SLOTS; slot++) {
+        if (parameter_profile_get_name(slot, stored) == 0 && strcmp(stored, name) == 0) {
+            return (int)slot;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Erase a profile slot
+ */
+int parameter_profile_delete(uint32_t slot) {
+    if (slot >= PARAM_PROFILE_SLOTS) {
+        return -1;
+    }
+    HAL_FLASH_Unlock();
+    int const result = erase_sector(profile_address(slot));
+    HAL_FLASH_Lock();
+    return result;
+}
+
+/* ============================================================================
+ * GENERIC ACCESS
+ * ============================================================================ */
+
+/**
+ * @brief Get the descriptor of a parameter
+ * @return Descriptor, NULL for an invalid id
+ */
+const ParameterDescriptor_t *parameter_get_descriptor(ParameterId id) {
+    if ((unsigned)id >= PARAM_COUNT) {
+        return NULL;
+    }
+    return &g_paramTable[id];
+}
+
+/**
+ * @brief Look up a parameter by its descriptor name
+ * @return Its id, PARAM_COUNT if there is none by that name
+ */
+ParameterId parameter_find(const char *name) {
+    for (size_t id = 0; name != NULL && id < PARAM_COUNT; id++) {
+        if (g_paramTable[id].name != NULL && strcmp(g_paramTable[id].name, name) == 0) {
+            return (ParameterId)id;
+        }
+    }
+    return PARAM_COUNT;
+}
+
+/**
+ * @brief Get any stored parameter
+ * @param value Pointer to store the value, zero extended
+ * @return 0 on success, -1 on failure (invalid id or not stored)
+ */
+int parameter_get(ParameterId id, uint32_t *value) {
+    if (value == NULL || !g_initialized || (unsigned)id >= PARAM_COUNT || g_paramTable[id].size == 0) {
         return -1;
     }
     
-    // Write directly to the parameter structure
-    g_paramData.params.dcc_track_voltage = voltage_mv;
+    *value = 0;
+    memcpy(value, &g_paramData.bytes[g_paramTable[id].offset], g_paramTable[id].size);
+    
+    return 0;
+}
+
+/**
+ * @brief Set any stored parameter
+ * @param value New value, must be within the descriptor range
+ * @return 0 on success, -1 on failure (invalid id, not stored or out of range)
+ */
+int parameter_set(ParameterId id, uint32_t value) {
+    if (!g_initialized || (unsigned)id >= PARAM_COUNT || g_paramTable[id].size == 0) {
+        return -1;
+    }
+    
+    const ParameterDescriptor_t *desc = &g_paramTable[id];
+    if (value < desc->min || value > desc->max) {
+        return -1;
+    }
+    memcpy(&g_paramData.bytes[desc->offset], &value, desc->size);
     
     // Mark as modified
     g_modified = 1;
@@ -428,6 +839,19 @@ int set_dcc_track_voltage(uint16_t voltage_mv) {
     return 0;
 }
 
+/* ============================================================================
+ * ACCESSOR FUNCTIONS
+ * ============================================================================ */
+
+/**
+ * @brief Set DCC track voltage parameter
+ * @param voltage_mv Voltage in millivolts (e.g., 15000 for 15V)
+ * @return 0 on success, -1 on failure
+ */
+int set_dcc_track_voltage(uint16_t voltage_mv) {
+    return parameter_set(PARAM_DCC_TRACK_VOLTAGE, voltage_mv);
+}
+
 /**
  * @brief Get DCC track voltage parameter
  * @param voltage_mv Pointer to store voltage in millivolts
@@ -450,17 +874,7 @@ int get_dcc_track_voltage(uint16_t *voltage_mv) {
  * @return 0 on success, -1 on failure
  */
 int set_dcc_bit1_duration(uint8_t duration_us) {
-    if (!g_initialized) {
-        return -1;
-    }
-    
-    // Write directly to the parameter structure
-    g_paramData.params.dcc_bit1_duration = duration_us;
-    
-    // Mark as modified
-    g_modified = 1;
-    
-    return 0;
+    return parameter_set(PARAM_DCC_BIT1_DURATION, duration_us);
 }
 
 /**
@@ -485,17 +899,7 @@ int get_dcc_bit1_duration(uint8_t *duration_us) {
  * @return 0 on success, -1 on failure
  */
 int set_dcc_bit0_duration(uint8_t duration_us) {
-    if (!g_initialized) {
-        return -1;
-    }
-    
-    // Write directly to the parameter structure
-    g_paramData.params.dcc_bit0_duration = duration_us;
-    
-    // Mark as modified
-    g_modified = 1;
-    
-    return 0;
+    return parameter_set(PARAM_DCC_BIT0_DURATION, duration_us);
 }
 
 /**
@@ -520,17 +924,7 @@ int get_dcc_bit0_duration(uint8_t *duration_us) {
  * @return 0 on success, -1 on failure
  */
 int set_dcc_bidi_enable(uint8_t enable) {
-    if (!g_initialized) {
-        return -1;
-    }
-    
-    // Write directly to the parameter structure
-    g_paramData.params.dcc_bidi_enable = enable ? 1 : 0;
-    
-    // Mark as modified
-    g_modified = 1;
-    
-    return 0;
+    return parameter_set(PARAM_DCC_BIDI_ENABLE, enable ? 1 : 0);
 }
 
 /**
@@ -555,17 +949,7 @@ int get_dcc_bidi_enable(uint8_t *enable) {
  * @return 0 on success, -1 on failure
  */
 int set_dcc_preamble_bits(uint8_t preamble_bits) {
-    if (!g_initialized) {
-        return -1;
-    }
-    
-    // Write directly to the parameter structure
-    g_paramData.params.dcc_preamble_bits = preamble_bits;
-    
-    // Mark as modified
-    g_modified = 1;
-    
-    return 0;
+    return parameter_set(PARAM_DCC_PREAMBLE_BITS, preamble_bits);
 }
 
 /**
@@ -590,17 +974,7 @@ int get_dcc_preamble_bits(uint8_t *preamble_bits) {
  * @return 0 on success, -1 on failure
  */
 int set_dcc_bidi_dac(uint16_t dac_value) {
-    if (!g_initialized) {
-        return -1;
-    }
-    
-    // Write directly to the parameter structure
-    g_paramData.params.dcc_bidi_dac = dac_value;
-    
-    // Mark as modified
-    g_modified = 1;
-    
-    return 0;
+    return parameter_set(PARAM_DCC_BIDI_DAC, dac_value);
 }
 
 /**
@@ -625,31 +999,96 @@ int get_dcc_bidi_dac(uint16_t *dac_value) {
  * @return 0 on success, -1 on failure
  */
 int set_dcc_trigger_first_bit(uint8_t enable) {
-    if (!g_initialized) {
+    return parameter_set(PARAM_DCC_TRIGGER_FIRST_BIT, enable ? 1 : 0);
+}
+
+/**
+ * @brief Get DCC trigger on first bit enable status
+ * @param enable Pointer to store enable status (0=disabled, 1=enabled)
+ * @return 0 on success, -1 on failure
+ */
+int get_dcc_trigger_first_bit(uint8_t *enable) {
+    if (enable == NULL || !g_initialized) {
         return -1;
     }
     
-    // Write directly to the parameter structure
-    g_paramData.params.dcc_trigger_first_bit = enable ? 1 : 0;
-    
-    // Mark as modified
-    g_modified = 1;
+    // Read directly from the parameter structure
+    *enable = g_paramData.params.dcc_trigger_first_bit;
     
     return 0;
 }
 
 /**
- * @brief Get DCC trigger on first bit enable status
- * @param enable Pointer to store enable status (0=disabled, 1=enabled)
+ * @brief Set DCC DMA transmit enable
+ * @param enable 0 for interrupt driven transmit, non-zero for DMA driven transmit
  * @return 0 on success, -1 on failure
  */
-int get_dcc_trigger_first_bit(uint8_t *enable) {
+int set_dcc_dma_transmit(uint8_t enable) {
+    return parameter_set(PARAM_DCC_DMA_TRANSMIT, enable ? 1 : 0);
+}
+
+/**
+ * @brief Get DCC DMA transmit enable status
+ * @param enable Pointer to store enable status (0=interrupt driven, 1=DMA driven)
+ * @return 0 on success, -1 on failure
+ */
+int get_dcc_dma_transmit(uint8_t *enable) {
     if (enable == NULL || !g_initialized) {
         return -1;
     }
     
     // Read directly from the parameter structure
-    *enable = g_paramData.params.dcc_trigger_first_bit;
+    *enable = g_paramData.params.dcc_dma_transmit;
+    
+    return 0;
+}
+
+/**
+ * @brief Set system debug level
+ * @param level Trace log level (0=errors only ... 4=verbose)
+ * @return 0 on success, -1 on failure
+ */
+int set_system_debug_level(uint8_t level) {
+    return parameter_set(PARAM_SYSTEM_DEBUG_LEVEL, level);
+}
+
+/**
+ * @brief Get system debug level
+ * @param level Pointer to store the debug level
+ * @return 0 on success, -1 on failure
+ */
+int get_system_debug_level(uint8_t *level) {
+    if (level == NULL || !g_initialized) {
+        return -1;
+    }
+    
+    // Read directly from the parameter structure
+    *level = g_paramData.params.system_debug_level;
+    
+    return 0;
+}
+
+/**
+ * @brief Set the TCP/UDP port of the network RPC server (applies after a reboot)
+ * @param port Port number (1-65535)
+ * @return 0 on success, -1 on failure
+ */
+int set_network_port(uint16_t port) {
+    return parameter_set(PARAM_NETWORK_PORT, port);
+}
+
+/**
+ * @brief Get the TCP/UDP port of the network RPC server
+ * @param port Pointer to store the port number
+ * @return 0 on success, -1 on failure
+ */
+int get_network_port(uint16_t *port) {
+    if (port == NULL || !g_initialized) {
+        return -1;
+    }
+    
+    // Read directly from the parameter structure
+    *port = g_paramData.params.network_port;
     
     return 0;
 }
@@ -0,0 +1,112 @@
+/**
+ * @file power_idle.c
+ * @brief Idle loop sleep (ThreadX TX_LOW_POWER hooks)
+ *
+ * SysTick runs from the processor clock (tx_initialize_low_level.S), its
+ * count down gives the cycles spent in WFI. The SysTick interrupt wakes the
+ * core at least once per reload, so one COUNTFLAG covers every wrap.
+ */
+
+#include "power_idle.h"
+#include "main.h"
+#include "profiler.h"
+#include "timebase.h"
+
+static volatile bool g_enabled = true;
+static volatile uint32_t g_holds = 0;
+
+// Written by the idle hooks only, interrupts disabled
+static bool g_asleep = false;
+static uint32_t g_sleepVal = 0;
+static uint32_t g_sleepCyccnt = 0;
+static uint32_t g_sleeps = 0;
+static uint32_t g_skipped = 0;
+static uint64_t g_asleepCycles = 0;
+
+static const char *const kHoldNames[POWER_IDLE_HOLD_COUNT] = {
+    "command_station",
+    "decoder",
+    "capture",
+};
+
+void power_idle_enable(bool enable)
+{
+    g_enabled = enable;
+}
+
+void power_idle_hold(PowerIdleHold_t hold, bool active)
+{
+    if ((uint32_t)hold >= POWER_IDLE_HOLD_COUNT) {
+        return;
+    }
+    uint32_t const primask = __get_PRIMASK();
+    __disable_irq();
+    if (active) {
+        g_holds |= 1u << hold;
+    }
+    else {
+        g_holds &= ~(1u << hold);
+    }
+    __set_PRIMASK(primask);
+}
+
+void power_idle_stats(PowerIdleStats_t *stats)
+{
+    uint32_t const primask = __get_PRIMASK();
+    __disable_irq();
+    stats->enabled = g_enabled;
+    stats->holds = g_holds;
+    stats->sleeps = g_sleeps;
+    stats->skipped = g_skipped;
+    stats->asleep_cycles = g_asleepCycles;
+    __set_PRIMASK(primask);
+    stats->cpu_hz = SystemCoreClock;
+}
+
+const char *power_idle_hold_name(PowerIdleHold_t hold)
+{
+    return ((uint32_t)hold < POWER_IDLE_HOLD_COUNT) ? kHoldNames[hold] : "unknown";
+}
+
+void tx_low_power_enter(void)
+{
+    if (!g_enabled || g_holds != 0u) {
+        g_skipped++;
+        return;
+    }
+
+    (void)SysTick->CTRL;        // clear COUNTFLAG
+    g_sleepVal = SysTick->VAL;
+    g_sleepCyccnt = DWT->CYCCNT;
+    g_asleep = true;
+
+    __DSB();
+    __WFI();
+    __ISB();
+}
+
+void tx_low_power_exit(void)
+{
+    if (!g_asleep) {
+        return;
+    }
+    g_asleep = false;
+
+    uint32_t const wrapped = SysTick->CTRL & SysTick_CTRL_COUNTFLAG_Msk;
+    uint32_t const val = SysTick->VAL;
+    uint32_t const cyccnt = DWT->CYCCNT;
+
+    // A reload between the two reads leaves COUNTFLAG clear but VAL above the start
+    uint32_t cycles = g_sleepVal - val;
+    if (wrapped || val > g_sleepVal) {
+        cycles += SysTick->LOAD + 1u;
+    }
+    g_sleeps++;
+    g_asleepCycles += cycles;
+
+    uint32_t const counted = cyccnt - g_sleepCyccnt;
+    if (cycles > counted) {
+        profiler_idle_add(cycles - counted);
+        timebase_sleep_add(cycles - counted);
+    }
+}
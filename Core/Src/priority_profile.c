@@ -0,0 +1,309 @@
+/**
+ * @file priority_profile.c
+ * @brief Run time thread priority profiles and the tick wake up latency probe
+ *
+ * Threads are found by name in the ThreadX created list. The built-in
+ * priority and threshold of a thread are kept the first time it is seen, an
+ * apply restores every kept thread before it changes those the profile names,
+ * so profiles do not stack.
+ */
+
+#include "priority_profile.h"
+#include "cmsis_os2.h"
+#include "rtos_static.h"
+#include "main.h"
+#include "tx_api.h"
+#include "tx_thread.h"
+#include <stdio.h>
+#include <string.h>
+
+#define PROBE_EVENT_START       (1u << 0)
+
+typedef struct {
+    const char *thread;
+    uint8_t priority;
+    uint8_t threshold;
+} PriorityProfileEntry_t;
+
+typedef struct {
+    const char *name;
+    const PriorityProfileEntry_t *entries;
+    uint32_t count;
+} PriorityProfile_t;
+
+// NetX, USBX and FileX threads run at 10-20, the application threads at 16-48 (osPriority mapped)
+
+// Track output and decoder ahead of the network and USB stacks
+static const PriorityProfileEntry_t kRealtime[] = {
+    { "cmdStationTask", 4, 4 },
+    { "decoderTask", 4, 4 },
+    { "canSyncTask", 6, 6 },
+};
+
+// RPC next to the stacks, a request being served is not preempted by them
+static const PriorityProfileEntry_t kTransport[] = {
+    { "rpcServerTask", 12, 10 },
+    { "rpcTcpTask", 12, 10 },
+    { "rpcUdpTask", 12, 10 },
+    { "rpcJobTask", 14, 14 },
+};
+
+// Capture streams ahead of RPC
+static const PriorityProfileEntry_t kStreaming[] = {
+    { "telemetryTask", 12, 12 },
+    { "usbCaptureTask", 12, 12 },
+    { "usbCaptureTxTask", 12, 12 },
+    { "recorderFillTask", 14, 14 },
+    { "recorderWriteTask", 14, 14 },
+};
+
+#define PROFILE(name, entries) { name, entries, sizeof(entries) / sizeof(entries[0]) }
+
+static const PriorityProfile_t kProfiles[] = {
+    { "default", NULL, 0 },
+    PROFILE("realtime", kRealtime),
+    PROFILE("transport", kTransport),
+    PROFILE("streaming", kStreaming),
+};
+
+#define PROFILE_COUNT   (sizeof(kProfiles) / sizeof(kProfiles[0]))
+
+typedef struct {
+    TX_THREAD *thread;
+    UINT priority;
+    UINT threshold;
+} BuiltinSetting_t;
+
+static BuiltinSetting_t g_builtin[PRIORITY_PROFILE_MAX_THREADS];
+static uint32_t g_builtinCount = 0;
+static const char *g_active = "default";
+
+static osMutexId_t g_lock = NULL;
+RTOS_MUTEX(priorityProfileLock);
+
+// Latency probe, the statistics are written by the probe thread only
+static osThreadId_t probeTaskHandle = NULL;
+static osEventFlagsId_t g_probeEvents = NULL;
+static volatile bool g_probeRunning = false;
+static PriorityProbeStats_t g_probe;
+RTOS_EVENT_FLAGS(priorityProbeEvents);
+
+RTOS_THREAD_MEMORY(prioProbeTask, 256 * 4);
+static const osThreadAttr_t prioProbeTask_attributes = {
+    .name = "prioProbeTask",
+    .priority = (osPriority_t) osPriorityLow,
+    RTOS_THREAD_ATTR_MEMORY(prioProbeTask)
+};
+
+// Keep the settings of threads not seen before, called with g_lock held
+static void capture_builtin(void)
+{
+    uint32_t const primask = __get_PRIMASK();
+    __disable_irq();
+    TX_THREAD *thread = _tx_thread_created_ptr;
+    for (ULONG i = 0; i < _tx_thread_created_count && thread != NULL; i++) {
+        bool known = false;
+        for (uint32_t k = 0; k < g_builtinCount; k++) {
+            known = known || g_builtin[k].thread == thread;
+        }
+        if (!known && g_builtinCount < PRIORITY_PROFILE_MAX_THREADS) {
+            g_builtin[g_builtinCount].thread = thread;
+            g_builtin[g_builtinCount].priority = thread->tx_thread_user_priority;
+            g_builtin[g_builtinCount].threshold = thread->tx_thread_user_preempt_threshold;
+            g_builtinCount++;
+        }
+        thread = thread->tx_thread_created_next;
+    }
+    __set_PRIMASK(primask);
+}
+
+static TX_THREAD *find_thread(const char *name)
+{
+    for (uint32_t k = 0; k < g_builtinCount; k++) {
+        const char *const thread_name = g_builtin[k].thread->tx_thread_name;
+        if (thread_name != NULL && strcmp(thread_name, name) == 0) {
+            return g_builtin[k].thread;
+        }
+    }
+    return NULL;
+}
+
+// The priority change sets the threshold to the new priority, the threshold follows
+static bool change(TX_THREAD *thread, UINT priority, UINT threshold)
+{
+    UINT old;
+    if (tx_thread_priority_change(thread, priority, &old) != TX_SUCCESS) {
+        return false;
+    }
+    return threshold == priority || tx_thread_preemption_change(thread, threshold, &old) == TX_SUCCESS;
+}
+
+void priority_profile_init(void)
+{
+    if (g_lock != NULL) {
+        return;
+    }
+    g_lock = osMutexNew(&priorityProfileLock_attr);
+    g_probeEvents = osEventFlagsNew(&priorityProbeEvents_attr);
+    memset(&g_probe, 0, sizeof(g_probe));
+    g_probe.min_cycles = UINT32_MAX;
+}
+
+int priority_profile_apply(const char *name)
+{
+    const PriorityProfile_t *profile = NULL;
+    for (uint32_t p = 0; p < PROFILE_COUNT; p++) {
+        if (strcmp(kProfiles[p].name, name) == 0) {
+            profile = &kProfiles[p];
+        }
+    }
+    if (profile == NULL || g_lock == NULL) {
+        return -1;
+    }
+
+    int result = 0;
+    osMutexAcquire(g_lock, osWaitForever);
+    capture_builtin();
+    for (uint32_t k = 0; k < g_builtinCount; k++) {
+        if (g_builtin[k].thread == (TX_THREAD *)probeTaskHandle) {
+            continue;   // runs at the priority under test
+        }
+        if (!change(g_builtin[k].thread, g_builtin[k].priority, g_builtin[k].threshold)) {
+            result = -2;
+        }
+    }
+    for (uint32_t e = 0; e < profile->count; e++) {
+        TX_THREAD *const thread = find_thread(profile->entries[e].thread);
+        // Threads of subsystems not started yet are left out
+        if (thread != NULL && !change(thread, profile->entries[e].priority, profile->entries[e].threshold)) {
+            result = -2;
+        }
+    }
+    g_active = profile->name;
+    osMutexRelease(g_lock);
+    return result;
+}
+
+int priority_profile_set(const char *thread_name, uint8_t priority, uint8_t threshold)
+{
+    if (priority > PRIORITY_PROFILE_LOWEST || threshold > priority) {
+        return -2;
+    }
+    if (g_lock == NULL) {
+        return -1;
+    }
+
+    osMutexAcquire(g_lock, osWaitForever);
+    capture_builtin();
+    TX_THREAD *const thread = find_thread(thread_name);
+    int result = -1;
+    if (thread != NULL) {
+        result = change(thread, priority, threshold) ? 0 : -3;
+        g_active = "custom";
+    }
+    osMutexRelease(g_lock);
+    return result;
+}
+
+const char *priority_profile_active(void)
+{
+    return g_active;
+}
+
+uint32_t priority_profile_count(void)
+{
+    return PROFILE_COUNT;
+}
+
+const char *priority_profile_name(uint32_t index)
+{
+    return index < PROFILE_COUNT ? kProfiles[index].name : NULL;
+}
+
+// Cycles since the tick which woke the thread, ticks late included
+static uint32_t probe_wake_cycles(ULONG slept_at, bool *late)
+{
+    ULONG now;
+    uint32_t val;
+    do {
+        now = tx_time_get();
+        val = SysTick->VAL;
+    } while (tx_time_get() != now);
+
+    uint32_t const reload = SysTick->LOAD + 1u;
+    ULONG const ticks = now - slept_at;
+    *late = ticks > 1u;
+    return (reload - 1u - val) + (ticks > 1u ? (uint32_t)(ticks - 1u) * reload : 0u);
+}
+
+static void PriorityProbeTask(void *argument)
+{
+    (void)argument;
+
+    for (;;) {
+        osEventFlagsWait(g_probeEvents, PROBE_EVENT_START, osFlagsWaitAny, osWaitForever);
+        while (g_probeRunning) {
+            ULONG const slept_at = tx_time_get();
+            tx_thread_sleep(1);
+            bool late = false;
+            uint32_t const cycles = probe_wake_cycles(slept_at, &late);
+
+            uint32_t const primask = __get_PRIMASK();
+            __disable_irq();
+            g_probe.samples++;
+            g_probe.sum_cycles += cycles;
+            if (late) {
+                g_probe.late++;
+            }
+            if (cycles < g_probe.min_cycles) {
+                g_probe.min_cycles = cycles;
+            }
+            if (cycles > g_probe.max_cycles) {
+                g_probe.max_cycles = cycles;
+            }
+            __set_PRIMASK(primask);
+        }
+    }
+}
+
+bool priority_probe_start(uint8_t priority)
+{
+    if (priority > PRIORITY_PROFILE_LOWEST || g_probeEvents == NULL) {
+        return false;
+    }
+    if (probeTaskHandle == NULL) {
+        probeTaskHandle = osThreadNew(PriorityProbeTask, NULL, &prioProbeTask_attributes);
+        if (probeTaskHandle == NULL) {
+            printf("Failed to create priority probe thread\n");
+            return false;
+        }
+    }
+
+    uint32_t const primask = __get_PRIMASK();
+    __disable_irq();
+    memset(&g_probe, 0, sizeof(g_probe));
+    g_probe.min_cycles = UINT32_MAX;
+    g_probe.priority = priority;
+    __set_PRIMASK(primask);
+
+    UINT old;
+    tx_thread_priority_change((TX_THREAD *)probeTaskHandle, priority, &old);
+    g_probeRunning = true;
+    osEventFlagsSet(g_probeEvents, PROBE_EVENT_START);
+    return true;
+}
+
+void priority_probe_stop(void)
+{
+    g_probeRunning = false;
+}
+
+void priority_probe_stats(PriorityProbeStats_t *stats)
+{
+    uint32_t const primask = __get_PRIMASK();
+    __disable_irq();
+    *stats = g_probe;
+    __set_PRIMASK(primask);
+    stats->running = g_probeRunning;
+    stats->cpu_hz = SystemCoreClock;
+}
@@ -0,0 +1,240 @@
+/**
+ * @file profiler.c
+ * @brief Per thread CPU load, interrupt time and stack high water marks
+ *
+ * The _tx_execution_* functions are the ThreadX execution change hooks, called
+ * by the scheduler (PendSV, lowest priority) and the kernel with interrupts
+ * disabled, and by instrumented interrupt handlers. A slice is charged to the
+ * thread when it ends, less the interrupt time which elapsed meanwhile, so the
+ * running thread is the only one whose count is incomplete; the snapshot adds
+ * its open slice.
+ *
+ * Thread counters live in the thread control block (TX_THREAD_USER_EXTENSION),
+ * the scheduler updates them without any lookup.
+ */
+
+#include "profiler.h"
+#include "fast_ram.h"
+#include "stm32h5xx.h"
+#include "tx_api.h"
+#include "tx_thread.h"
+#include <stdbool.h>
+#include <string.h>
+
+#ifndef TX_STACK_FILL
+#define TX_STACK_FILL           0xEFEFEFEFUL
+#endif
+
+// Thread slice in progress
+static TX_THREAD *g_running = NULL;
+static uint32_t g_sliceStart = 0;
+static uint32_t g_sliceIsr = 0;
+
+// No thread ready, the scheduler waits for an interrupt
+static bool g_idle = false;
+static uint32_t g_idleStart = 0;
+static uint32_t g_idleIsr = 0;
+static uint64_t g_idleCycles = 0;
+
+// Instrumented interrupts, only the outermost of nested ones is timed
+static uint32_t g_isrNesting = 0;
+static uint32_t g_isrStart = 0;
+static volatile uint32_t g_isrCycles = 0;   // wraps, slices subtract differences
+static uint64_t g_isrTotal = 0;
+static ProfilerIsrStats_t g_isrStats[PROFILER_ISR_COUNT];
+
+static const char *const kIsrNames[PROFILER_ISR_COUNT] = {
+    "TIM2",
+    "TIM15",
+};
+
+// Indexed by tx_thread_state, TX_READY ... TX_MUTEX_SUSP
+static const char *const kStateNames[] = {
+    "ready", "completed", "terminated", "suspended", "sleep", "queue", "semaphore",
+    "event_flags", "block_pool", "byte_pool", "io_driver", "file", "tcp_ip", "mutex",
+};
+
+void _tx_execution_initialize(void)
+{
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+void _tx_execution_thread_enter(void)
+{
+    uint32_t const now = DWT->CYCCNT;
+    uint32_t const isr = g_isrCycles;
+
+    if (g_idle) {
+        g_idleCycles += (uint32_t)(now - g_idleStart) - (uint32_t)(isr - g_idleIsr);
+        g_idle = false;
+    }
+    g_running = _tx_thread_current_ptr;
+    g_sliceStart = now;
+    g_sliceIsr = isr;
+}
+
+void _tx_execution_thread_exit(void)
+{
+    // The kernel reports a suspension before the scheduler switches, the second call finds no slice
+    TX_THREAD *const thread = g_running;
+    if (thread == NULL) {
+        return;
+    }
+
+    uint32_t const now = DWT->CYCCNT;
+    uint32_t const isr = g_isrCycles;
+
+    thread->tx_thread_profile_cycles += (uint32_t)(now - g_sliceStart) - (uint32_t)(isr - g_sliceIsr);
+    g_running = NULL;
+    g_idle = true;
+    g_idleStart = now;
+    g_idleIsr = isr;
+}
+
+FAST_RAM_FUNC void _tx_execution_isr_enter(void)
+{
+    uint32_t const primask = __get_PRIMASK();
+    __disable_irq();
+    if (g_isrNesting++ == 0u) {
+        g_isrStart = DWT->CYCCNT;
+    }
+    __set_PRIMASK(primask);
+}
+
+FAST_RAM_FUNC void _tx_execution_isr_exit(void)
+{
+    uint32_t const primask = __get_PRIMASK();
+    __disable_irq();
+    if (g_isrNesting == 1u) {
+        uint32_t const cycles = DWT->CYCCNT - g_isrStart;
+        g_isrCycles += cycles;
+        g_isrTotal += cycles;
+    }
+    if (g_isrNesting > 0u) {
+        g_isrNesting--;
+    }
+    __set_PRIMASK(primask);
+}
+
+FAST_RAM_FUNC uint32_t profiler_isr_enter(void)
+{
+    _tx_execution_isr_enter();
+    return DWT->CYCCNT;
+}
+
+FAST_RAM_FUNC void profiler_isr_exit(ProfilerIsr_t isr, uint32_t start)
+{
+    uint32_t const cycles = DWT->CYCCNT - start;
+    ProfilerIsrStats_t *const stats = &g_isrStats[isr];
+
+    stats->count++;
+    stats->cycles += cycles;
+    if (cycles > stats->max_cycles) {
+        stats->max_cycles = cycles;
+    }
+    _tx_execution_isr_exit();
+}
+
+void profiler_idle_add(uint32_t cycles)
+{
+    g_idleCycles += cycles;
+}
+
+void profiler_reset(void)
+{
+    uint32_t const primask = __get_PRIMASK();
+    __disable_irq();
+
+    TX_THREAD *thread = _tx_thread_created_ptr;
+    for (ULONG i = 0; i < _tx_thread_created_count && thread != NULL; i++) {
+        thread->tx_thread_profile_cycles = 0;
+        thread = thread->tx_thread_created_next;
+    }
+    memset(g_isrStats, 0, sizeof(g_isrStats));
+    g_isrTotal = 0;
+    g_idleCycles = 0;
+
+    // Restart the open slice (the caller's) from now
+    g_sliceStart = DWT->CYCCNT;
+    g_sliceIsr = g_isrCycles;
+
+    __set_PRIMASK(primask);
+}
+
+uint32_t profiler_stack_used(const void *start, uint32_t size)
+{
+    const uint32_t *word = (const uint32_t *)start;
+    const uint32_t *const end = word + size / sizeof(uint32_t);
+
+    while (word < end && *word == TX_STACK_FILL) {
+        word++;
+    }
+    return (uint32_t)((const uint8_t *)end - (const uint8_t *)word);
+}
+
+void profiler_snapshot(ProfilerSnapshot_t *snapshot)
+{
+    const void *stacks[PROFILER_MAX_THREADS];
+
+    memset(snapshot, 0, sizeof(*snapshot));
+    snapshot->cpu_hz = SystemCoreClock;
+
+    uint32_t const primask = __get_PRIMASK();
+    __disable_irq();
+
+    uint32_t const now = DWT->CYCCNT;
+    TX_THREAD *thread = _tx_thread_created_ptr;
+    for (ULONG i = 0; i < _tx_thread_created_count && thread != NULL; i++) {
+        uint64_t cycles = thread->tx_thread_profile_cycles;
+        if (thread == g_running) {
+            cycles += (uint32_t)(now - g_sliceStart) - (uint32_t)(g_isrCycles - g_sliceIsr);
+        }
+        snapshot->total_cycles += cycles;
+
+        if (snapshot->thread_count < PROFILER_MAX_THREADS) {
+            ProfilerThread_t *const entry = &snapshot->threads[snapshot->thread_count];
+            if (thread->tx_thread_name != NULL) {
+                strncpy(entry->name, thread->tx_thread_name, PROFILER_NAME_LENGTH - 1u);
+            }
+            entry->priority = (uint8_t)thread->tx_thread_priority;
+            entry->threshold = (uint8_t)thread->tx_thread_user_preempt_threshold;
+            entry->state = (uint8_t)thread->tx_thread_state;
+            entry->stack_size = (uint32_t)thread->tx_thread_stack_size;
+            entry->cycles = cycles;
+            stacks[snapshot->thread_count] = thread->tx_thread_stack_start;
+            snapshot->thread_count++;
+        }
+        else {
+            snapshot->threads_missing++;
+        }
+        thread = thread->tx_thread_created_next;
+    }
+    memcpy(snapshot->isr, g_isrStats, sizeof(snapshot->isr));
+    snapshot->isr_cycles = g_isrTotal;
+    snapshot->idle_cycles = g_idleCycles;
+
+    __set_PRIMASK(primask);
+
+    snapshot->total_cycles += snapshot->isr_cycles + snapshot->idle_cycles;
+
+    // Scanning the stacks takes a while, interrupts stay enabled
+    for (uint32_t i = 0; i < snapshot->thread_count; i++) {
+        snapshot->threads[i].stack_used = profiler_stack_used(stacks[i], snapshot->threads[i].stack_size);
+    }
+}
+
+uint32_t profiler_permille(uint64_t cycles, uint64_t total)
+{
+    return total ? (uint32_t)((cycles * 1000u + total / 2u) / total) : 0u;
+}
+
+const char *profiler_isr_name(ProfilerIsr_t isr)
+{
+    return (uint32_t)isr < PROFILER_ISR_COUNT ? kIsrNames[isr] : "?";
+}
+
+const char *profiler_thread_state_name(uint8_t state)
+{
+    return state < sizeof(kStateNames) / sizeof(kStateNames[0]) ? kStateNames[state] : "?";
+}
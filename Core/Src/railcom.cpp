@@ -0,0 +1,279 @@
+/**
+ * @file railcom.cpp
+ * @brief RailCom (BiDi) receiver of the command station
+ *
+ * The receive DMA channel is set up once, each cutout only rewrites its count and
+ * addresses so arming fits into the transmit interrupt. Decoding is a 256 entry
+ * table lookup per byte.
+ */
+
+#include "railcom.h"
+#include <array>
+#include <cstring>
+#include "main.h"
+#include "dma_channels.h"
+#include "spsc_ring.hpp"
+
+extern "C" UART_HandleTypeDef huart4;
+
+namespace {
+
+// 4-of-8 code of each 6 bit value (RCN-217 table 2)
+constexpr std::array<uint8_t, 64> encode_table{{
+  0xACu, 0xAAu, 0xA9u, 0xA5u, 0xA3u, 0xA6u, 0x9Cu, 0x9Au, 0x99u, 0x95u, 0x93u, 0x96u, 0x8Eu, 0x8Du, 0x8Bu, 0xB1u,
+  0xB2u, 0xB4u, 0xB8u, 0x74u, 0x72u, 0x6Cu, 0x6Au, 0x69u, 0x65u, 0x63u, 0x66u, 0x5Cu, 0x5Au, 0x59u, 0x55u, 0x53u,
+  0x56u, 0x4Eu, 0x4Du, 0x4Bu, 0x47u, 0x71u, 0xE8u, 0xE4u, 0xE2u, 0xD1u, 0xC9u, 0xC5u, 0xD8u, 0xD4u, 0xD2u, 0xCAu,
+  0xC6u, 0xCCu, 0x78u, 0x17u, 0x1Bu, 0x1Du, 0x1Eu, 0x2Eu, 0x36u, 0x3Au, 0x27u, 0x2Bu, 0x2Du, 0x35u, 0x39u, 0x33u,
+}};
+
+constexpr std::array<uint8_t, 256> make_decode_table() {
+  std::array<uint8_t, 256> table{};
+  for (auto& symbol : table) symbol = RAILCOM_SYMBOL_INVALID;
+  for (uint8_t i = 0u; i < encode_table.size(); i++) table[encode_table[i]] = i;
+  table[0x0Fu] = RAILCOM_SYMBOL_ACK;
+  table[0xF0u] = RAILCOM_SYMBOL_ACK;
+  table[0x3Cu] = RAILCOM_SYMBOL_NACK;
+  table[0xE1u] = RAILCOM_SYMBOL_BUSY;
+  return table;
+}
+
+constexpr std::array<uint8_t, 256> decode_table{make_decode_table()};
+
+static_assert(decode_table[0xACu] == 0u && decode_table[0x33u] == 63u, "4-of-8 table");
+static_assert(decode_table[0x00u] == RAILCOM_SYMBOL_INVALID, "4-of-8 table");
+
+constexpr uint8_t kNoSplit = 0xFFu;  // channel 2 not reached yet
+
+}  // namespace
+
+static DMA_HandleTypeDef hdmaRailcomRx;
+static uint8_t rxBuffer[RAILCOM_MAX_BYTES];
+static uint8_t ch1Count = kNoSplit;
+static bool armed = false;
+static bool ready = false;
+
+static SpscRing<RailcomFrame_t, RAILCOM_RING_SIZE> frameRing;
+static volatile uint32_t statCutouts = 0;
+static volatile uint32_t statFrames = 0;
+static volatile uint32_t statEmpty = 0;
+static volatile uint32_t statDropped = 0;
+static volatile uint32_t statInvalid = 0;
+
+// Most recent cutout, written by the transmit interrupt
+static volatile uint32_t lastSeq = 0;
+static volatile uint16_t lastCh1 = 0xFFFFu;
+static volatile uint8_t lastResult = RAILCOM_RESULT_NONE;
+
+static void setLast(uint32_t packet_seq, uint8_t result, uint16_t ch1)
+{
+  lastSeq = packet_seq;
+  lastCh1 = ch1;
+  lastResult = result;
+}
+
+// Bytes written by the receive DMA so far
+static uint8_t rxReceived(void)
+{
+  return static_cast<uint8_t>(RAILCOM_MAX_BYTES - (RAILCOM_RX_DMA_CHANNEL->CBR1 & DMA_CBR1_BNDT));
+}
+
+// Stop the receive DMA if it has not completed all RAILCOM_MAX_BYTES, returns the bytes received
+static uint8_t rxStop(void)
+{
+  DMA_Channel_TypeDef* const channel = RAILCOM_RX_DMA_CHANNEL;
+  if (channel->CCR & DMA_CCR_EN) {
+    channel->CCR |= DMA_CCR_SUSP;
+    for (uint32_t i = 0; i < 1000u && !(channel->CSR & DMA_CSR_SUSPF); i++) {
+    }
+  }
+  uint8_t const received = rxReceived();
+  channel->CCR |= DMA_CCR_RESET;
+  return received;
+}
+
+extern "C" int railcom_init(void)
+{
+  __HAL_RCC_GPDMA1_CLK_ENABLE();
+
+  hdmaRailcomRx.Instance = RAILCOM_RX_DMA_CHANNEL;
+  hdmaRailcomRx.Init.Request = RAILCOM_RX_DMA_REQUEST;
+  hdmaRailcomRx.Init.BlkHWRequest = DMA_BREQ_SINGLE_BURST;
+  hdmaRailcomRx.Init.Direction = DMA_PERIPH_TO_MEMORY;
+  hdmaRailcomRx.Init.SrcInc = DMA_SINC_FIXED;
+  hdmaRailcomRx.Init.DestInc = DMA_DINC_INCREMENTED;
+  hdmaRailcomRx.Init.SrcDataWidth = DMA_SRC_DATAWIDTH_BYTE;
+  hdmaRailcomRx.Init.DestDataWidth = DMA_DEST_DATAWIDTH_BYTE;
+  hdmaRailcomRx.Init.Priority = DMA_HIGH_PRIORITY;
+  hdmaRailcomRx.Init.SrcBurstLength = 1;
+  hdmaRailcomRx.Init.DestBurstLength = 1;
+  hdmaRailcomRx.Init.TransferAllocatedPort = DMA_SRC_ALLOCATED_PORT0 | DMA_DEST_ALLOCATED_PORT0;
+  hdmaRailcomRx.Init.TransferEventMode = DMA_TCEM_BLOCK_TRANSFER;
+  hdmaRailcomRx.Init.Mode = DMA_NORMAL;
+  if (HAL_DMA_Init(&hdmaRailcomRx) != HAL_OK) {
+    return -1;
+  }
+  __HAL_LINKDMA(&huart4, hdmarx, hdmaRailcomRx);
+
+  // CubeMX configures UART4 for transmission only (decoder side BiDi), add the receiver
+  huart4.Init.Mode = UART_MODE_TX_RX;
+  SET_BIT(huart4.Instance->CR1, USART_CR1_RE);
+  SET_BIT(huart4.Instance->CR3, USART_CR3_DMAR);
+  ready = true;
+  return 0;
+}
+
+extern "C" void railcom_reset(void)
+{
+  frameRing.reset();
+  statCutouts = 0;
+  statFrames = 0;
+  statEmpty = 0;
+  statDropped = 0;
+  statInvalid = 0;
+  setLast(0u, RAILCOM_RESULT_NONE, 0xFFFFu);
+}
+
+extern "C" void railcom_cutout_start(void)
+{
+  if (!ready) {
+    return;
+  }
+  DMA_Channel_TypeDef* const channel = RAILCOM_RX_DMA_CHANNEL;
+  USART_TypeDef* const uart = huart4.Instance;
+
+  if (channel->CCR & DMA_CCR_EN) {
+    rxStop();
+  }
+  // Drop whatever arrived outside the cutout
+  uart->ICR = USART_ICR_ORECF | USART_ICR_FECF | USART_ICR_NECF;
+  uart->RQR = USART_RQR_RXFRQ;
+
+  channel->CFCR = DMA_CFCR_TCF | DMA_CFCR_HTF | DMA_CFCR_DTEF | DMA_CFCR_ULEF | DMA_CFCR_USEF |
+                  DMA_CFCR_SUSPF | DMA_CFCR_TOF;
+  channel->CSAR = reinterpret_cast<uint32_t>(&uart->RDR);
+  channel->CDAR = reinterpret_cast<uint32_t>(rxBuffer);
+  channel->CBR1 = RAILCOM_MAX_BYTES;
+  channel->CCR |= DMA_CCR_EN;
+  ch1Count = kNoSplit;
+  armed = true;
+}
+
+extern "C" void railcom_channel2_start(void)
+{
+  if (armed) {
+    ch1Count = rxReceived();
+  }
+}
+
+extern "C" void railcom_cutout_end(uint32_t packet_seq)
+{
+  if (!armed) {
+    return;
+  }
+  armed = false;
+  uint8_t const received = rxStop();
+  uint32_t const errors = huart4.Instance->ISR & (USART_ISR_ORE | USART_ISR_FE | USART_ISR_NE);
+  statCutouts = statCutouts + 1u;
+
+  if (received == 0u) {
+    statEmpty = statEmpty + 1u;
+    setLast(packet_seq, RAILCOM_RESULT_EMPTY, 0xFFFFu);
+    return;
+  }
+
+  RailcomFrame_t* frame = frameRing.claim();
+  if (!frame) {
+    statDropped = statDropped + 1u;
+    setLast(packet_seq, RAILCOM_RESULT_DROPPED, 0xFFFFu);
+    return;
+  }
+
+  uint8_t const split = ch1Count == kNoSplit ? RAILCOM_CH1_BYTES : ch1Count;
+  uint8_t const ch1 = split < RAILCOM_CH1_BYTES ? split : RAILCOM_CH1_BYTES;
+  frame->packet_seq = packet_seq;
+  frame->tick_ms = HAL_GetTick();
+  frame->ch1_count = received < ch1 ? received : ch1;
+  frame->ch2_count = static_cast<uint8_t>(received - frame->ch1_count);
+  if (frame->ch2_count > RAILCOM_CH2_BYTES) {
+    frame->ch2_count = RAILCOM_CH2_BYTES;
+  }
+  frame->flags = errors ? RAILCOM_FLAG_UART_ERROR : 0u;
+
+  uint8_t const* byte = rxBuffer;
+  for (uint8_t i = 0; i < frame->ch1_count; i++) {
+    frame->ch1[i] = decode_table[*byte++];
+    frame->flags |= frame->ch1[i] == RAILCOM_SYMBOL_INVALID ? RAILCOM_FLAG_INVALID : 0u;
+  }
+  for (uint8_t i = 0; i < frame->ch2_count; i++) {
+    frame->ch2[i] = decode_table[*byte++];
+    frame->flags |= frame->ch2[i] == RAILCOM_SYMBOL_INVALID ? RAILCOM_FLAG_INVALID : 0u;
+  }
+  if (frame->flags & RAILCOM_FLAG_INVALID) {
+    statInvalid = statInvalid + 1u;
+  }
+  uint8_t id;
+  uint8_t data;
+  setLast(packet_seq, frame->flags ? RAILCOM_RESULT_INVALID : RAILCOM_RESULT_OK,
+          railcom_channel1_datagram(frame, &id, &data) ? static_cast<uint16_t>((id << 8) | data) : 0xFFFFu);
+  frameRing.commit();
+  statFrames = statFrames + 1u;
+}
+
+extern "C" uint32_t railcom_read(RailcomFrame_t* frames, uint32_t max)
+{
+  uint32_t count = 0;
+  while (count < max && frameRing.pop(frames[count])) {
+    count++;
+  }
+  return count;
+}
+
+extern "C" void railcom_get_stats(RailcomStats_t* stats)
+{
+  if (!stats) {
+    return;
+  }
+  stats->cutouts = statCutouts;
+  stats->frames = statFrames;
+  stats->empty = statEmpty;
+  stats->dropped = statDropped;
+  stats->invalid = statInvalid;
+  stats->pending = static_cast<uint32_t>(frameRing.size());
+  stats->high_water = static_cast<uint32_t>(frameRing.highWater());
+}
+
+extern "C" uint8_t railcom_last_cutout(uint32_t* packet_seq, uint16_t* ch1)
+{
+  // The interrupt may update between the reads, repeat until the sequence is stable
+  uint32_t seq;
+  uint16_t datagram;
+  uint8_t result;
+  do {
+    seq = lastSeq;
+    result = lastResult;
+    datagram = lastCh1;
+  } while (seq != lastSeq);
+
+  if (packet_seq) {
+    *packet_seq = seq;
+  }
+  if (ch1) {
+    *ch1 = datagram;
+  }
+  return result;
+}
+
+extern "C" bool railcom_channel1_datagram(const RailcomFrame_t* frame, uint8_t* id, uint8_t* data)
+{
+  if (!frame || frame->ch1_count != RAILCOM_CH1_BYTES ||
+      frame->ch1[0] >= encode_table.size() || frame->ch1[1] >= encode_table.size()) {
+    return false;
+  }
+  if (id) {
+    *id = static_cast<uint8_t>(frame->ch1[0] >> 2);
+  }
+  if (data) {
+    *data = static_cast<uint8_t>(((frame->ch1[0] & 0x03u) << 6) | frame->ch1[1]);
+  }
+  return true;
+}
@@ -0,0 +1,528 @@
+/**
+ * @file recorder.cpp
+ * @brief Recording to the SD card
+ *
+ * Interrupt producers only touch their ring and lost counter. The fill thread
+ * owns the block being filled, the writer thread the open file. Blocks travel
+ * freeQueue -> fill thread -> fullQueue -> writer -> freeQueue, a null block on
+ * fullQueue asks the writer to close the file.
+ */
+
+#include "recorder.h"
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include "analog_manager.h"
+#include "app_filex.h"
+#include "cmsis_os2.h"
+#include "rtos_static.h"
+#include "command_station.h"
+#include "sniffer.h"
+#include "timebase.h"
+#include "spsc_ring.hpp"
+
+static_assert(sizeof(RecorderFileHeader_t) <= RECORDER_HEADER_SIZE, "file header exceeds its sector");
+static_assert(sizeof(RecorderBlockHeader_t) == 32u, "the block header layout is part of the file format");
+static_assert(RECORDER_BLOCK_SIZE <= 0xFFFFu, "block offsets are 16 bit");
+
+#define RECORDER_POLL_MS        10u
+#define RECORDER_FLUSH_MS       1000u   // a partial block is written after this long
+#define RECORDER_STOP_MS        5000u
+#define RECORDER_RECORD_HEADER  4u
+#define RECORDER_MAX_FILE_INDEX 99999u
+
+namespace {
+
+enum class State : uint8_t { Idle, Recording, Stopping };
+
+struct AnalogEntry {
+  uint32_t bucket;
+  uint16_t voltage_mv;
+  uint16_t current_ma;
+};
+
+struct PacketEntry {
+  uint32_t cycles;
+  uint32_t seq;
+  uint8_t length;
+  uint8_t bytes[PACKET_TIMING_MAX_BYTES];
+};
+
+constexpr uint32_t align4(uint32_t value) { return (value + 3u) & ~3u; }
+
+}  // namespace
+
+// Filled in interrupts, 512 ms of analog buckets or about half a second of packets
+static SpscRing<AnalogEntry, 512> analogRing;
+static SpscRing<PacketEntry, 128> packetRing;
+static volatile uint32_t analogLost = 0;
+static volatile uint32_t packetLost = 0;
+
+alignas(32) static uint8_t blocks[2][RECORDER_BLOCK_SIZE];
+alignas(32) static uint8_t headerSector[RECORDER_HEADER_SIZE];
+static osMessageQueueId_t freeQueue;
+static osMessageQueueId_t fullQueue;
+static osSemaphoreId_t stopDone_sem;
+static osSemaphoreId_t start_sem;       // wakes the fill thread out of Idle
+static osMutexId_t control_lock;
+RTOS_MESSAGE_QUEUE(recorderFreeQueue, 2u, sizeof(uint8_t*));
+RTOS_MESSAGE_QUEUE(recorderFullQueue, 3u, sizeof(uint8_t*));
+RTOS_SEMAPHORE(recorderStopDone_sem);
+RTOS_SEMAPHORE(recorderStart_sem);
+RTOS_MUTEX(recorderControlLock);
+
+static std::atomic<State> state{State::Idle};
+static FX_MEDIA* volatile media = nullptr;
+static uint32_t channelMask = 0;
+static uint32_t maxFileBytes = 0;
+static uint32_t startTick = 0;
+static uint64_t startTimeNs = 0;
+static uint16_t startTimeSource = 0;
+
+// Fill thread
+static uint8_t* fillBlock = nullptr;
+static uint32_t fillUsed = 0;
+static uint32_t fillRecords = 0;
+static RecorderBlockHeader_t fillHeader;
+static uint32_t blockSeq = 0;
+static uint32_t lostReported = 0;
+static uint32_t lostSeen[RECORDER_CHANNELS];
+
+// Writer thread
+static FX_FILE file;
+static bool fileOpen = false;
+static uint32_t fileBytes = 0;
+static uint32_t fileBlocks = 0;
+static uint32_t nextFileIndex = 0;
+
+static RecorderStats_t stats;
+
+RTOS_THREAD_MEMORY(recorderFillTask, 1024);
+static const osThreadAttr_t recorderFillTask_attributes = {
+  .name = "recorderFillTask",
+  RTOS_THREAD_ATTR_MEMORY(recorderFillTask),
+  .priority = (osPriority_t) osPriorityBelowNormal
+};
+
+/* Below the fill thread, which keeps emptying the rings while a block is written */
+RTOS_THREAD_MEMORY(recorderWriteTask, 2048);
+static const osThreadAttr_t recorderWriteTask_attributes = {
+  .name = "recorderWriteTask",
+  RTOS_THREAD_ATTR_MEMORY(recorderWriteTask),
+  .priority = (osPriority_t) osPriorityLow
+};
+
+// ADC DMA interrupt
+static void recorderAnalog(uint32_t bucket, uint16_t voltage_raw, uint16_t current_raw)
+{
+  AnalogEntry* entry = analogRing.claim();
+  if (!entry) {
+    analogLost = analogLost + 1u;
+    return;
+  }
+  entry->bucket = bucket;
+  entry->voltage_mv = analog_counts_to_mv(voltage_raw);
+  entry->current_ma = analog_counts_to_ma(current_raw);
+  analogRing.commit();
+}
+
+// Command station transmit interrupt
+static void recorderPacket(uint32_t packet_seq, uint8_t const* bytes, uint8_t length)
+{
+  PacketEntry* entry = packetRing.claim();
+  if (!entry) {
+    packetLost = packetLost + 1u;
+    return;
+  }
+  entry->cycles = DWT->CYCCNT;
+  entry->seq = packet_seq;
+  entry->length = length;
+  std::memcpy(entry->bytes, bytes, length);
+  packetRing.commit();
+}
+
+static uint32_t channelLost(uint32_t channel)
+{
+  if (channel == RECORDER_CHANNEL_ANALOG) {
+    return analogLost;
+  }
+  if (channel == RECORDER_CHANNEL_PACKETS) {
+    return packetLost;
+  }
+  SnifferStats_t sniffer;
+  sniffer_get_stats(&sniffer);
+  return sniffer.dropped;
+}
+
+static uint32_t totalLost(void)
+{
+  uint32_t lost = analogLost + packetLost;
+  if (channelMask & (1u << RECORDER_CHANNEL_DECODER)) {
+    lost += channelLost(RECORDER_CHANNEL_DECODER);
+  }
+  return lost;
+}
+
+static void submitBlock(void)
+{
+  uint32_t const lost = totalLost();
+  fillHeader.used = static_cast<uint16_t>(fillUsed);
+  fillHeader.records = static_cast<uint16_t>(fillRecords);
+  fillHeader.lost = lost - lostReported;
+  lostReported = lost;
+  std::memcpy(fillBlock, &fillHeader, sizeof(fillHeader));
+  // fullQueue holds both blocks and the close request, this cannot fail
+  osMessageQueuePut(fullQueue, &fillBlock, 0u, 0u);
+  fillBlock = nullptr;
+}
+
+// Room for need bytes in the block being filled, nullptr while both blocks are busy
+static uint8_t* reserve(uint32_t need)
+{
+  if (fillBlock && fillUsed + need > RECORDER_BLOCK_SIZE) {
+    submitBlock();
+  }
+  if (!fillBlock) {
+    if (osMessageQueueGet(freeQueue, &fillBlock, nullptr, 0u) != osOK) {
+      fillBlock = nullptr;
+      return nullptr;
+    }
+    std::memset(fillBlock, 0, RECORDER_BLOCK_SIZE);
+    fillUsed = sizeof(RecorderBlockHeader_t);
+    fillRecords = 0;
+    fillHeader.magic = RECORDER_BLOCK_MAGIC;
+    fillHeader.seq = blockSeq++;
+    uint64_t const cycles = timebase_cycles();
+    fillHeader.tick_ms = HAL_GetTick();
+    fillHeader.cycles = static_cast<uint32_t>(cycles);
+    fillHeader.time_ns = timebase_ns(cycles);
+  }
+  return &fillBlock[fillUsed];
+}
+
+// Complete the record reserve() returned, payload already in place
+static void commitRecord(uint8_t* record, uint32_t channel, uint32_t payload)
+{
+  uint32_t const length = RECORDER_RECORD_HEADER + payload;
+  uint32_t const lost = channelLost(channel);
+  record[0] = static_cast<uint8_t>(length);
+  record[1] = static_cast<uint8_t>(length >> 8);
+  record[2] = static_cast<uint8_t>(channel);
+  record[3] = lost != lostSeen[channel] ? RECORDER_FLAG_LOST : 0u;
+  lostSeen[channel] = lost;
+  fillUsed += align4(length);
+  fillRecords++;
+  stats.records++;
+}
+
+static void drainRings(void)
+{
+  while (AnalogEntry const* entry = analogRing.front()) {
+    uint8_t* record = reserve(RECORDER_RECORD_HEADER + sizeof(AnalogEntry));
+    if (!record) {
+      return;
+    }
+    std::memcpy(&record[RECORDER_RECORD_HEADER], entry, sizeof(AnalogEntry));
+    analogRing.pop();
+    commitRecord(record, RECORDER_CHANNEL_ANALOG, sizeof(AnalogEntry));
+  }
+
+  while (PacketEntry const* entry = packetRing.front()) {
+    uint32_t const payload = 8u + entry->length;
+    uint8_t* record = reserve(align4(RECORDER_RECORD_HEADER + payload));
+    if (!record) {
+      return;
+    }
+    std::memcpy(&record[RECORDER_RECORD_HEADER], &entry->cycles, 4u);
+    std::memcpy(&record[RECORDER_RECORD_HEADER + 4u], &entry->seq, 4u);
+    std::memcpy(&record[RECORDER_RECORD_HEADER + 8u], entry->bytes, entry->length);
+    packetRing.pop();
+    commitRecord(record, RECORDER_CHANNEL_PACKETS, payload);
+  }
+
+  if (channelMask & (1u << RECORDER_CHANNEL_DECODER)) {
+    // Whatever the sniffer ring holds goes into one record, as many whole sniffer records as fit
+    for (;;) {
+      uint8_t* record = reserve(RECORDER_RECORD_HEADER + SNIFFER_MAX_RECORD);
+      if (!record) {
+        return;
+      }
+      uint32_t const room = RECORDER_BLOCK_SIZE - fillUsed - RECORDER_RECORD_HEADER;
+      uint32_t const copied = sniffer_read(&record[RECORDER_RECORD_HEADER], room, 0u, nullptr);
+      if (copied == 0u) {
+        return;
+      }
+      commitRecord(record, RECORDER_CHANNEL_DECODER, copied);
+    }
+  }
+}
+
+static void RecorderFillTask(void* argument)
+{
+  (void)argument;
+
+  for (;;) {
+    if (state.load(std::memory_order_acquire) == State::Idle) {
+      osSemaphoreAcquire(start_sem, osWaitForever);
+    }
+    osDelay(RECORDER_POLL_MS);
+    State const current = state.load(std::memory_order_acquire);
+    if (current == State::Idle) {
+      continue;
+    }
+
+    drainRings();
+
+    if (current == State::Stopping) {
+      // The hooks are gone, the rings are empty unless both blocks were busy
+      while (!analogRing.empty() || !packetRing.empty()) {
+        osDelay(RECORDER_POLL_MS);
+        drainRings();
+      }
+      if (fillBlock && fillRecords > 0u) {
+        submitBlock();
+      }
+      else if (fillBlock) {
+        osMessageQueuePut(freeQueue, &fillBlock, 0u, 0u);
+        fillBlock = nullptr;
+      }
+      uint8_t* close = nullptr;
+      osMessageQueuePut(fullQueue, &close, 0u, 0u);
+      state.store(State::Idle, std::memory_order_release);
+    }
+    else if (fillBlock && fillRecords > 0u && HAL_GetTick() - fillHeader.tick_ms >= RECORDER_FLUSH_MS) {
+      submitBlock();
+    }
+  }
+}
+
+static void buildHeader(uint32_t file_blocks)
+{
+  static char const* const names[RECORDER_CHANNELS] = {"analog", "packets", "decoder"};
+  static uint16_t const payloads[RECORDER_CHANNELS] = {sizeof(AnalogEntry), 0u, 0u};
+  RecorderFileHeader_t header{};
+
+  header.magic = RECORDER_MAGIC;
+  header.version = RECORDER_VERSION;
+  header.header_size = RECORDER_HEADER_SIZE;
+  header.block_size = RECORDER_BLOCK_SIZE;
+  header.file_index = stats.file_index;
+  header.blocks = file_blocks;
+  header.start_tick_ms = startTick;
+  header.cycle_hz = SystemCoreClock;
+  header.channel_mask = channelMask;
+  header.channel_count = RECORDER_CHANNELS;
+  header.time_source = startTimeSource;
+  header.start_time_ns = startTimeNs;
+  for (uint32_t i = 0; i < RECORDER_CHANNELS; i++) {
+    header.channels[i].id = static_cast<uint8_t>(i);
+    header.channels[i].enabled = (channelMask >> i) & 1u;
+    header.channels[i].payload_size = payloads[i];
+    std::strncpy(header.channels[i].name, names[i], sizeof(header.channels[i].name));
+  }
+  std::memset(headerSector, 0, sizeof(headerSector));
+  std::memcpy(headerSector, &header, sizeof(header));
+}
+
+static bool openFile(void)
+{
+  char name[16];
+  UINT status;
+
+  for (;;) {
+    if (nextFileIndex > RECORDER_MAX_FILE_INDEX) {
+      return false;
+    }
+    snprintf(name, sizeof(name), "REC%05lu.BIN", static_cast<unsigned long>(nextFileIndex));
+    status = fx_file_create(media, name);
+    if (status != FX_ALREADY_CREATED) {
+      break;
+    }
+    nextFileIndex++;
+  }
+  if (status != FX_SUCCESS || fx_file_open(media, &file, name, FX_OPEN_FOR_WRITE) != FX_SUCCESS) {
+    return false;
+  }
+
+  stats.file_index = nextFileIndex++;
+  stats.files++;
+  buildHeader(0u);
+  if (fx_file_write(&file, headerSector, RECORDER_HEADER_SIZE) != FX_SUCCESS) {
+    fx_file_close(&file);
+    return false;
+  }
+  fileOpen = true;
+  fileBytes = RECORDER_HEADER_SIZE;
+  fileBlocks = 0;
+  printf("Recording to %s\n", name);
+  return true;
+}
+
+// The block count in the header tells readers the file was closed cleanly
+static void closeFile(void)
+{
+  if (!fileOpen) {
+    return;
+  }
+  fileOpen = false;
+  buildHeader(fileBlocks);
+  if (fx_file_seek(&file, 0u) != FX_SUCCESS ||
+      fx_file_write(&file, headerSector, RECORDER_HEADER_SIZE) != FX_SUCCESS) {
+    stats.write_errors++;
+  }
+  fx_file_close(&file);
+  fx_media_flush(media);
+}
+
+static void writeBlock(uint8_t const* block)
+{
+  if (!media) {
+    stats.write_errors++;
+    return;
+  }
+  if (fileOpen && fileBytes + RECORDER_BLOCK_SIZE > maxFileBytes) {
+    closeFile();
+  }
+  if (!fileOpen && !openFile()) {
+    stats.write_errors++;
+    return;
+  }
+  if (fx_file_write(&file, const_cast<uint8_t*>(block), RECORDER_BLOCK_SIZE) != FX_SUCCESS) {
+    stats.write_errors++;
+    return;
+  }
+  fileBytes += RECORDER_BLOCK_SIZE;
+  fileBlocks++;
+  stats.blocks++;
+  stats.bytes += RECORDER_BLOCK_SIZE;
+}
+
+static void RecorderWriteTask(void* argument)
+{
+  (void)argument;
+  uint8_t* block;
+
+  for (;;) {
+    if (osMessageQueueGet(fullQueue, &block, nullptr, osWaitForever) != osOK) {
+      continue;
+    }
+    if (!block) {
+      closeFile();
+      osSemaphoreRelease(stopDone_sem);
+      continue;
+    }
+    writeBlock(block);
+    osMessageQueuePut(freeQueue, &block, 0u, 0u);
+  }
+}
+
+extern "C" void recorder_init(void)
+{
+  freeQueue = osMessageQueueNew(2u, sizeof(uint8_t*), &recorderFreeQueue_attr);
+  fullQueue = osMessageQueueNew(3u, sizeof(uint8_t*), &recorderFullQueue_attr);
+  stopDone_sem = osSemaphoreNew(1u, 0u, &recorderStopDone_sem_attr);
+  start_sem = osSemaphoreNew(1u, 0u, &recorderStart_sem_attr);
+  control_lock = osMutexNew(&recorderControlLock_attr);
+  for (auto& block : blocks) {
+    uint8_t* pointer = block;
+    osMessageQueuePut(freeQueue, &pointer, 0u, 0u);
+  }
+
+  if (!osThreadNew(RecorderFillTask, nullptr, &recorderFillTask_attributes) ||
+      !osThreadNew(RecorderWriteTask, nullptr, &recorderWriteTask_attributes)) {
+    printf("Failed to create recorder threads\n");
+  }
+}
+
+extern "C" void recorder_set_media(void* fx_media)
+{
+  if (!fx_media) {
+    recorder_stop();
+  }
+  media = static_cast<FX_MEDIA*>(fx_media);
+}
+
+extern "C" int recorder_start(uint32_t channel_mask, uint32_t max_file_mb, bool widths)
+{
+  if (!media) {
+    return -1;
+  }
+  if ((channel_mask & (1u << RECORDER_CHANNEL_ANALOG)) && !analog_manager_is_streaming()) {
+    return -2;
+  }
+
+  osMutexAcquire(control_lock, osWaitForever);
+  if (state.load(std::memory_order_acquire) != State::Idle) {
+    osMutexRelease(control_lock);
+    return -3;
+  }
+
+  // Neither side touches the rings while idle
+  analogRing.reset();
+  packetRing.reset();
+  analogLost = 0;
+  packetLost = 0;
+  std::memset(lostSeen, 0, sizeof(lostSeen));
+  lostReported = 0;
+  blockSeq = 0;
+  osSemaphoreAcquire(stopDone_sem, 0u);
+
+  channelMask = channel_mask & ((1u << RECORDER_CHANNELS) - 1u);
+  maxFileBytes = (max_file_mb ? max_file_mb : RECORDER_DEFAULT_FILE_MB) * 1024u * 1024u;
+  TimebaseStatus_t timebase;
+  timebase_status(&timebase);
+  startTick = timebase.tick_ms;
+  startTimeNs = timebase.time_ns;
+  startTimeSource = static_cast<uint16_t>(timebase.source);
+  uint32_t const file_index = stats.file_index;
+  stats = RecorderStats_t{};
+  stats.file_index = file_index;
+  stats.channel_mask = channelMask;
+
+  if (channelMask & (1u << RECORDER_CHANNEL_DECODER)) {
+    sniffer_enable(false, false);
+    sniffer_clear();
+    sniffer_enable(true, widths);
+  }
+  state.store(State::Recording, std::memory_order_release);
+  if (channelMask & (1u << RECORDER_CHANNEL_ANALOG)) {
+    analog_manager_set_bucket_hook(ANALOG_HOOK_RECORDER, recorderAnalog);
+  }
+  if (channelMask & (1u << RECORDER_CHANNEL_PACKETS)) {
+    CommandStation_SetPacketHook(COMMAND_STATION_HOOK_RECORDER, recorderPacket);
+  }
+  osSemaphoreRelease(start_sem);
+  osMutexRelease(control_lock);
+  return 0;
+}
+
+extern "C" void recorder_stop(void)
+{
+  if (!control_lock) {
+    return;
+  }
+  osMutexAcquire(control_lock, osWaitForever);
+  if (state.load(std::memory_order_acquire) == State::Recording) {
+    analog_manager_set_bucket_hook(ANALOG_HOOK_RECORDER, nullptr);
+    CommandStation_SetPacketHook(COMMAND_STATION_HOOK_RECORDER, nullptr);
+    if (channelMask & (1u << RECORDER_CHANNEL_DECODER)) {
+      sniffer_enable(false, false);
+    }
+    state.store(State::Stopping, std::memory_order_release);
+    if (osSemaphoreAcquire(stopDone_sem, RECORDER_STOP_MS) != osOK) {
+      printf("WARNING: Recorder stop timeout\n");
+    }
+  }
+  osMutexRelease(control_lock);
+}
+
+extern "C" void recorder_get_stats(RecorderStats_t* out)
+{
+  if (!out) {
+    return;
+  }
+  *out = stats;
+  out->active = state.load(std::memory_order_acquire) != State::Idle;
+  out->media = media != nullptr;
+  out->lost = totalLost();
+}
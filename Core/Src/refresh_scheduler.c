@@ -0,0 +1,440 @@
+/**
+ * @file refresh_scheduler.c
+ * @brief Operations mode packet scheduler: new commands by priority, refresh in between
+ *
+ * Address state lives in fixed slots, an index sorted by address finds the
+ * slot of an address by binary search and gives the round robin order. The
+ * command heap holds at most one entry per slot and packet kind; each slot
+ * knows the heap position of its entries, so a change to a queued kind only
+ * raises its priority, and a released address removes its entries directly.
+ * Packets are built from the slot state when they are taken, so a command
+ * always carries the latest state of its kind.
+ */
+
+#include "refresh_scheduler.h"
+#include "cmsis_os2.h"
+#include "rtos_static.h"
+#include <string.h>
+
+#define KIND_SPEED          0u
+#define KIND_GROUPS         5u      // F0-F4, F5-F8, F9-F12, F13-F20, F21-F28
+#define KIND_COUNT          (1u + KIND_GROUPS)
+#define HEAP_SIZE           (REFRESH_MAX_ADDRESSES * KIND_COUNT)
+#define HEAP_NONE           0xFFFFu
+#define FUNCTIONS_MASK      ((1u << 29) - 1u)
+
+_Static_assert(HEAP_SIZE < HEAP_NONE, "heap positions are 16 bit");
+
+typedef enum {
+    PRIORITY_ESTOP = 0,
+    PRIORITY_SPEED,
+    PRIORITY_FUNCTION,
+    PRIORITY_REPEAT                     // repeats of speed and function commands
+} Priority_t;
+
+typedef struct {
+    uint16_t address;
+    uint8_t speed;
+    uint8_t groups;                     // function groups in use, bit n = group n
+    uint32_t functions;
+    uint8_t phase;                      // refresh visits, odd visits send a function group
+    uint8_t next_group;
+    bool sent;                          // last_ms is valid
+    uint32_t last_ms;
+    uint8_t repeats[KIND_COUNT];        // transmissions left of the queued command
+    uint16_t heap_pos[KIND_COUNT];
+} Slot_t;
+
+typedef struct {
+    uint32_t seq;                       // arrival, wraps; live entries span far less than 2^31
+    uint16_t slot;
+    uint8_t kind;
+    uint8_t priority;
+} HeapEntry_t;
+
+static const uint32_t kGroupMask[KIND_GROUPS] = {
+    0x0000001Fu, 0x000001E0u, 0x00001E00u, 0x001FE000u, 0x1FE00000u
+};
+
+static osMutexId_t g_lock = NULL;
+RTOS_MUTEX(refreshLock);
+static Slot_t g_slots[REFRESH_MAX_ADDRESSES];
+static uint16_t g_order[REFRESH_MAX_ADDRESSES];     // slot indices sorted by address
+static uint16_t g_free[REFRESH_MAX_ADDRESSES];      // stack of unused slots
+static uint32_t g_count = 0;
+static uint32_t g_freeCount = 0;
+static uint32_t g_cursor = 0;                       // round robin position in g_order
+static HeapEntry_t g_heap[HEAP_SIZE];
+static uint32_t g_heapCount = 0;
+static uint32_t g_seq = 0;
+static RefreshStatus_t g_stats;
+
+static bool heap_before(const HeapEntry_t *a, const HeapEntry_t *b)
+{
+    if (a->priority != b->priority) {
+        return a->priority < b->priority;
+    }
+    return (int32_t)(a->seq - b->seq) < 0;
+}
+
+static void heap_place(uint32_t pos, const HeapEntry_t *entry)
+{
+    g_heap[pos] = *entry;
+    g_slots[entry->slot].heap_pos[entry->kind] = (uint16_t)pos;
+}
+
+static void heap_sift_up(uint32_t pos)
+{
+    HeapEntry_t const entry = g_heap[pos];
+    while (pos > 0u) {
+        uint32_t const parent = (pos - 1u) / 2u;
+        if (!heap_before(&entry, &g_heap[parent])) {
+            break;
+        }
+        heap_place(pos, &g_heap[parent]);
+        pos = parent;
+    }
+    heap_place(pos, &entry);
+}
+
+static void heap_sift_down(uint32_t pos)
+{
+    HeapEntry_t const entry = g_heap[pos];
+    for (;;) {
+        uint32_t child = 2u * pos + 1u;
+        if (child >= g_heapCount) {
+            break;
+        }
+        if (child + 1u < g_heapCount && heap_before(&g_heap[child + 1u], &g_heap[child])) {
+            child++;
+        }
+        if (!heap_before(&g_heap[child], &entry)) {
+            break;
+        }
+        heap_place(pos, &g_heap[child]);
+        pos = child;
+    }
+    heap_place(pos, &entry);
+}
+
+static void heap_push(uint16_t slot, uint8_t kind, uint8_t priority)
+{
+    HeapEntry_t const entry = {g_seq++, slot, kind, priority};
+    heap_place(g_heapCount++, &entry);
+    heap_sift_up(g_heapCount - 1u);
+}
+
+static void heap_remove(uint32_t pos)
+{
+    g_slots[g_heap[pos].slot].heap_pos[g_heap[pos].kind] = HEAP_NONE;
+    g_heapCount--;
+    if (pos == g_heapCount) {
+        return;
+    }
+    HeapEntry_t const last = g_heap[g_heapCount];
+    heap_place(pos, &last);
+    heap_sift_up(pos);
+    heap_sift_down(g_slots[last.slot].heap_pos[last.kind]);
+}
+
+// Queue a new command for one kind of a slot, merged with a queued one of the same kind
+static void queue_command(uint16_t slot, uint8_t kind, uint8_t priority)
+{
+    Slot_t *const s = &g_slots[slot];
+    s->repeats[kind] = REFRESH_COMMAND_REPEATS;
+    uint16_t const pos = s->heap_pos[kind];
+    if (pos == HEAP_NONE) {
+        heap_push(slot, kind, priority);
+        return;
+    }
+    g_stats.coalesced++;
+    if (priority < g_heap[pos].priority) {
+        g_heap[pos].priority = priority;
+        heap_sift_up(pos);
+    }
+}
+
+// Index in g_order of address, or its insertion point with found false
+static uint32_t find(uint16_t address, bool *found)
+{
+    uint32_t lo = 0;
+    uint32_t hi = g_count;
+    while (lo < hi) {
+        uint32_t const mid = (lo + hi) / 2u;
+        uint16_t const value = g_slots[g_order[mid]].address;
+        if (value == address) {
+            *found = true;
+            return mid;
+        }
+        if (value < address) {
+            lo = mid + 1u;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    *found = false;
+    return lo;
+}
+
+// Slot of address, added with stop forward and all functions off if new; -1 if the table is full
+static int32_t slot_of(uint16_t address)
+{
+    bool found;
+    uint32_t const index = find(address, &found);
+    if (found) {
+        return g_order[index];
+    }
+    if (g_freeCount == 0u) {
+        return -1;
+    }
+    uint16_t const slot = g_free[--g_freeCount];
+    Slot_t *const s = &g_slots[slot];
+    memset(s, 0, sizeof(*s));
+    memset(s->heap_pos, 0xFF, sizeof(s->heap_pos));
+    s->address = address;
+    s->speed = REFRESH_SPEED_FORWARD;
+    memmove(&g_order[index + 1u], &g_order[index], (g_count - index) * sizeof(g_order[0]));
+    g_order[index] = slot;
+    g_count++;
+    if (index < g_cursor) {
+        g_cursor++;
+    }
+    return slot;
+}
+
+static uint8_t build_packet(const Slot_t *s, uint8_t kind, uint8_t *bytes)
+{
+    uint8_t length = 0;
+    if (s->address > 127u) {
+        bytes[length++] = (uint8_t)(0xC0u | (s->address >> 8));
+    }
+    bytes[length++] = (uint8_t)s->address;
+
+    uint32_t const f = s->functions;
+    switch (kind) {
+    case KIND_SPEED:
+        bytes[length++] = 0x3Fu;
+        bytes[length++] = s->speed;
+        break;
+    case 1u:
+        bytes[length++] = (uint8_t)(0x80u | (f & 1u) << 4 | (f >> 1 & 0x0Fu));
+        break;
+    case 2u:
+        bytes[length++] = (uint8_t)(0xB0u | (f >> 5 & 0x0Fu));
+        break;
+    case 3u:
+        bytes[length++] = (uint8_t)(0xA0u | (f >> 9 & 0x0Fu));
+        break;
+    case 4u:
+        bytes[length++] = 0xDEu;
+        bytes[length++] = (uint8_t)(f >> 13);
+        break;
+    default:
+        bytes[length++] = 0xDFu;
+        bytes[length++] = (uint8_t)(f >> 21);
+        break;
+    }
+
+    uint8_t checksum = 0;
+    for (uint8_t i = 0; i < length; i++) {
+        checksum ^= bytes[i];
+    }
+    bytes[length++] = checksum;
+    return length;
+}
+
+static bool blocked(const Slot_t *s, uint32_t now_ms)
+{
+    return s->sent && now_ms - s->last_ms < REFRESH_ADDRESS_GAP_MS;
+}
+
+static void lock(void)
+{
+    osMutexAcquire(g_lock, osWaitForever);
+}
+
+static void unlock(void)
+{
+    osMutexRelease(g_lock);
+}
+
+static void reset(void)
+{
+    g_count = 0;
+    g_cursor = 0;
+    g_heapCount = 0;
+    g_freeCount = REFRESH_MAX_ADDRESSES;
+    for (uint32_t i = 0; i < REFRESH_MAX_ADDRESSES; i++) {
+        g_free[i] = (uint16_t)(REFRESH_MAX_ADDRESSES - 1u - i);
+    }
+    memset(&g_stats, 0, sizeof(g_stats));
+}
+
+void refresh_init(void)
+{
+    if (g_lock != NULL) {
+        return;
+    }
+    reset();
+    g_lock = osMutexNew(&refreshLock_attr);
+}
+
+int refresh_set_speed(uint16_t address, uint8_t speed)
+{
+    if (address == 0u || address > REFRESH_MAX_ADDRESS) {
+        return -1;
+    }
+    lock();
+    int32_t const slot = slot_of(address);
+    if (slot < 0) {
+        unlock();
+        return -2;
+    }
+    g_slots[slot].speed = speed;
+    queue_command((uint16_t)slot, KIND_SPEED,
+                  (speed & 0x7Fu) == REFRESH_SPEED_ESTOP ? PRIORITY_ESTOP : PRIORITY_SPEED);
+    unlock();
+    return 0;
+}
+
+int refresh_set_functions(uint16_t address, uint32_t functions)
+{
+    if (address == 0u || address > REFRESH_MAX_ADDRESS || (functions & ~FUNCTIONS_MASK) != 0u) {
+        return -1;
+    }
+    lock();
+    int32_t const slot = slot_of(address);
+    if (slot < 0) {
+        unlock();
+        return -2;
+    }
+    Slot_t *const s = &g_slots[slot];
+    uint32_t const changed = s->functions ^ functions;
+    s->functions = functions;
+    for (uint8_t group = 0; group < KIND_GROUPS; group++) {
+        if (changed & kGroupMask[group]) {
+            s->groups |= (uint8_t)(1u << group);
+            queue_command((uint16_t)slot, (uint8_t)(1u + group), PRIORITY_FUNCTION);
+        }
+    }
+    unlock();
+    return 0;
+}
+
+void refresh_emergency_stop(void)
+{
+    lock();
+    for (uint32_t i = 0; i < g_count; i++) {
+        uint16_t const slot = g_order[i];
+        g_slots[slot].speed = (uint8_t)((g_slots[slot].speed & REFRESH_SPEED_FORWARD) | REFRESH_SPEED_ESTOP);
+        queue_command(slot, KIND_SPEED, PRIORITY_ESTOP);
+    }
+    unlock();
+}
+
+int refresh_release(uint16_t address)
+{
+    lock();
+    bool found;
+    uint32_t const index = find(address, &found);
+    if (!found) {
+        unlock();
+        return -1;
+    }
+    uint16_t const slot = g_order[index];
+    for (uint8_t kind = 0; kind < KIND_COUNT; kind++) {
+        if (g_slots[slot].heap_pos[kind] != HEAP_NONE) {
+            heap_remove(g_slots[slot].heap_pos[kind]);
+        }
+    }
+    g_count--;
+    memmove(&g_order[index], &g_order[index + 1u], (g_count - index) * sizeof(g_order[0]));
+    g_free[g_freeCount++] = slot;
+    if (index < g_cursor) {
+        g_cursor--;
+    }
+    if (g_cursor >= g_count) {
+        g_cursor = 0;
+    }
+    unlock();
+    return 0;
+}
+
+void refresh_clear(void)
+{
+    lock();
+    reset();
+    unlock();
+}
+
+uint8_t refresh_next(uint32_t now_ms, uint8_t *bytes)
+{
+    uint8_t length = 0;
+    lock();
+    if (g_heapCount > 0u && !blocked(&g_slots[g_heap[0].slot], now_ms)) {
+        HeapEntry_t const entry = g_heap[0];
+        Slot_t *const s = &g_slots[entry.slot];
+        length = build_packet(s, entry.kind, bytes);
+        heap_remove(0);
+        if (--s->repeats[entry.kind] > 0u) {
+            // Repeats wait for the first transmission of every other command
+            heap_push(entry.slot, entry.kind,
+                      entry.priority == PRIORITY_ESTOP ? PRIORITY_ESTOP : PRIORITY_REPEAT);
+        }
+        s->sent = true;
+        s->last_ms = now_ms;
+        g_stats.commands++;
+        unlock();
+        return length;
+    }
+
+    for (uint32_t n = 0; n < g_count; n++) {
+        Slot_t *const s = &g_slots[g_order[g_cursor]];
+        g_cursor = g_cursor + 1u < g_count ? g_cursor + 1u : 0u;
+        if (blocked(s, now_ms)) {
+            continue;
+        }
+        uint8_t kind = KIND_SPEED;
+        if ((s->phase++ & 1u) && s->groups) {
+            while (!(s->groups & (1u << s->next_group))) {
+                s->next_group = (uint8_t)((s->next_group + 1u) % KIND_GROUPS);
+            }
+            kind = (uint8_t)(1u + s->next_group);
+            s->next_group = (uint8_t)((s->next_group + 1u) % KIND_GROUPS);
+        }
+        length = build_packet(s, kind, bytes);
+        s->sent = true;
+        s->last_ms = now_ms;
+        g_stats.refreshes++;
+        unlock();
+        return length;
+    }
+    g_stats.idles++;
+    unlock();
+    return 0;
+}
+
+void refresh_get_status(RefreshStatus_t *status)
+{
+    lock();
+    *status = g_stats;
+    status->addresses = g_count;
+    status->pending = g_heapCount;
+    unlock();
+}
+
+uint32_t refresh_get_entries(uint32_t first, RefreshEntry_t *entries, uint32_t max)
+{
+    uint32_t count = 0;
+    lock();
+    for (uint32_t i = first; i < g_count && count < max; i++) {
+        const Slot_t *const s = &g_slots[g_order[i]];
+        entries[count].address = s->address;
+        entries[count].speed = s->speed;
+        entries[count].functions = s->functions;
+        count++;
+    }
+    unlock();
+    return count;
+}
@@ -0,0 +1,297 @@
+/**
+ * @file response_latency.c
+ * @brief Packet to output response latency of a decoder under test
+ *
+ * The transmit interrupt opens trials, the EXTI and ADC DMA interrupts close
+ * their channels. Each hook updates the trial with interrupts disabled for a
+ * handful of instructions, readers copy the results.
+ */
+
+#include "response_latency.h"
+#include "analog_manager.h"
+#include "command_station.h"
+#include "gpio_io.h"
+#include "packet_timing.h"
+#include "parameter_manager.h"
+#include "stm32h5xx.h"
+#include <string.h>
+
+#define CURRENT_CHANNEL     (1u << RESPONSE_LATENCY_MAX_PINS)  // bit of the current in g_waiting
+
+static ResponseLatency_t g_results;
+static uint32_t g_cyclesPerUs = 1u;
+static uint32_t g_timeoutCycles = 0;
+static uint32_t g_currentThreshold = 0;     // counts
+static uint8_t g_ioChannel[GPIO_IO_PIN_COUNT + 1u];    // IO number -> pin channel + 1, 0 if none
+
+// Open trial
+static bool g_open = false;
+static uint32_t g_start = 0;                // cycle counter at the end bit
+static uint16_t g_waiting = 0;              // channels without response, bit n = pin channel n
+static uint32_t g_baseline = 0;             // current before the packet, counts
+static bool g_baselineValid = false;
+
+// Previous matching packet, trigger "change"
+static uint8_t g_last[PACKET_TIMING_MAX_BYTES];
+static uint8_t g_lastLength = 0;
+static bool g_lastValid = false;
+
+// Most recent current buckets for the baseline
+static uint16_t g_recent[RESPONSE_LATENCY_BASELINE_MS];
+static uint32_t g_recentCount = 0;
+
+static void channel_clear(ResponseLatencyChannel_t *channel)
+{
+    memset(channel, 0, sizeof(*channel));
+    channel->min_us = UINT32_MAX;
+}
+
+static void channel_add(ResponseLatencyChannel_t *channel, uint32_t cycles)
+{
+    uint32_t const us = cycles / g_cyclesPerUs;
+    channel->count++;
+    channel->sum_us += us;
+    if (us < channel->min_us) {
+        channel->min_us = us;
+    }
+    if (us > channel->max_us) {
+        channel->max_us = us;
+    }
+
+    uint32_t const bin = us / g_results.config.bin_us;
+    if (bin < RESPONSE_LATENCY_BINS) {
+        channel->bins[bin]++;
+    } else {
+        channel->overflow++;
+    }
+}
+
+static void trial_timeout(uint32_t now)
+{
+    if (!g_open || now - g_start < g_timeoutCycles) {
+        return;
+    }
+    for (uint32_t i = 0; i < g_results.pin_count; i++) {
+        if (g_waiting & (1u << i)) {
+            g_results.pin[i].timeouts++;
+        }
+    }
+    if (g_waiting & CURRENT_CHANNEL) {
+        g_results.current.timeouts++;
+    }
+    g_open = false;
+}
+
+static uint32_t recent_average(void)
+{
+    uint32_t const count = g_recentCount < RESPONSE_LATENCY_BASELINE_MS ? g_recentCount : RESPONSE_LATENCY_BASELINE_MS;
+    uint32_t sum = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        sum += g_recent[i];
+    }
+    return count ? sum / count : 0u;
+}
+
+static bool packet_matches(const uint8_t *bytes, uint8_t length)
+{
+    ResponseLatencyConfig_t const *const config = &g_results.config;
+    if (length < config->match_length || memcmp(bytes, config->match, config->match_length) != 0) {
+        return false;
+    }
+    if (config->trigger == RESPONSE_LATENCY_TRIGGER_CHANGE) {
+        if (g_lastValid && length == g_lastLength && memcmp(bytes, g_last, length) == 0) {
+            return false;
+        }
+        memcpy(g_last, bytes, length);
+        g_lastLength = length;
+        g_lastValid = true;
+    }
+    return true;
+}
+
+static void latency_packet(uint32_t packet_seq, const uint8_t *bytes, uint8_t length)
+{
+    (void)packet_seq;
+    uint32_t const now = DWT->CYCCNT;
+    uint32_t const primask = __get_PRIMASK();
+    __disable_irq();
+
+    trial_timeout(now);
+    if (packet_matches(bytes, length)) {
+        g_results.packets++;
+        if (g_open) {
+            g_results.ignored++;
+        } else {
+            g_open = true;
+            g_start = now;
+            g_waiting = (uint16_t)((1u << g_results.pin_count) - 1u);
+            if (g_currentThreshold) {
+                g_waiting |= CURRENT_CHANNEL;
+                g_baselineValid = g_recentCount != 0u;
+                g_baseline = recent_average();
+            }
+            g_results.trials++;
+        }
+    }
+
+    __set_PRIMASK(primask);
+}
+
+static void latency_edge(const GpioIoEdge_t *edge)
+{
+    uint8_t const channel = edge->io <= GPIO_IO_PIN_COUNT ? g_ioChannel[edge->io] : 0u;
+    if (channel == 0u) {
+        return;
+    }
+    uint32_t const bit = 1u << (channel - 1u);
+    uint32_t const primask = __get_PRIMASK();
+    __disable_irq();
+
+    // An edge stamped before the packet hook preempted its handler belongs to the previous state
+    uint32_t const cycles = (uint32_t)edge->cycles;
+    if (g_open && (g_waiting & bit) && (int32_t)(cycles - g_start) >= 0) {
+        channel_add(&g_results.pin[channel - 1u], cycles - g_start);
+        g_waiting &= (uint16_t)~bit;
+        g_open = g_waiting != 0u;
+    }
+    trial_timeout(DWT->CYCCNT);
+
+    __set_PRIMASK(primask);
+}
+
+static void latency_bucket(uint32_t bucket, uint16_t voltage_raw, uint16_t current_raw)
+{
+    (void)voltage_raw;
+    uint32_t const now = DWT->CYCCNT;
+    uint32_t const primask = __get_PRIMASK();
+    __disable_irq();
+
+    if (g_open && (g_waiting & CURRENT_CHANNEL)) {
+        if (!g_baselineValid) {
+            g_baseline = current_raw;
+            g_baselineValid = true;
+        } else {
+            uint32_t const step = current_raw > g_baseline ? current_raw - g_baseline : g_baseline - current_raw;
+            if (step >= g_currentThreshold) {
+                channel_add(&g_results.current, now - g_start);
+                g_waiting &= (uint16_t)~CURRENT_CHANNEL;
+                g_open = g_waiting != 0u;
+            }
+        }
+    }
+    g_recent[bucket % RESPONSE_LATENCY_BASELINE_MS] = current_raw;
+    g_recentCount++;
+    trial_timeout(now);
+
+    __set_PRIMASK(primask);
+}
+
+static uint32_t pin_count(uint16_t pins)
+{
+    return (uint32_t)__builtin_popcount(pins);
+}
+
+int response_latency_start(const ResponseLatencyConfig_t *config, uint16_t *conflicts)
+{
+    if (conflicts) {
+        *conflicts = 0;
+    }
+    uint16_t const valid_pins = (uint16_t)((1u << GPIO_IO_PIN_COUNT) - 1u);
+    if (config == NULL || (config->pins & ~valid_pins) || pin_count(config->pins) > RESPONSE_LATENCY_MAX_PINS ||
+        (config->pins == 0u && config->current_ma == 0u) ||
+        config->timeout_ms == 0u || config->timeout_ms > RESPONSE_LATENCY_MAX_TIMEOUT_MS ||
+        config->bin_us == 0u || config->bin_us > RESPONSE_LATENCY_MAX_BIN_US || config->match_length > RESPONSE_LATENCY_MAX_MATCH ||
+        config->trigger > RESPONSE_LATENCY_TRIGGER_EVERY) {
+        return -1;
+    }
+    uint8_t dma_transmit = 0;
+    if (get_dcc_dma_transmit(&dma_transmit) == 0 && dma_transmit) {
+        return -4;
+    }
+    if (config->current_ma && !analog_manager_is_streaming()) {
+        return -3;
+    }
+
+    response_latency_stop();
+    if (config->pins && !gpio_io_capture_start(config->pins, conflicts)) {
+        return -2;
+    }
+
+    memset(&g_results, 0, sizeof(g_results));
+    memset(g_ioChannel, 0, sizeof(g_ioChannel));
+    g_results.config = *config;
+    g_results.config.label[RESPONSE_LATENCY_LABEL_SIZE - 1u] = '\0';
+    for (uint32_t i = 0; i < GPIO_IO_PIN_COUNT; i++) {
+        if (config->pins & (1u << i)) {
+            g_results.pin_io[g_results.pin_count] = (uint8_t)(i + 1u);
+            g_ioChannel[i + 1u] = ++g_results.pin_count;
+        }
+    }
+    for (uint32_t i = 0; i < RESPONSE_LATENCY_MAX_PINS; i++) {
+        channel_clear(&g_results.pin[i]);
+    }
+    channel_clear(&g_results.current);
+
+    g_cyclesPerUs = SystemCoreClock / 1000000u;
+    g_timeoutCycles = config->timeout_ms * 1000u * g_cyclesPerUs;
+    g_currentThreshold = analog_ma_to_counts(config->current_ma);
+    g_open = false;
+    g_lastValid = false;
+    g_recentCount = 0;
+    g_results.active = true;
+
+    if (config->pins) {
+        gpio_io_set_edge_hook(latency_edge);
+    }
+    if (config->current_ma) {
+        analog_manager_set_bucket_hook(ANALOG_HOOK_LATENCY, latency_bucket);
+    }
+    CommandStation_SetPacketHook(COMMAND_STATION_HOOK_LATENCY, latency_packet);
+    return 0;
+}
+
+void response_latency_stop(void)
+{
+    if (!g_results.active) {
+        return;
+    }
+    CommandStation_SetPacketHook(COMMAND_STATION_HOOK_LATENCY, NULL);
+    analog_manager_set_bucket_hook(ANALOG_HOOK_LATENCY, NULL);
+    gpio_io_set_edge_hook(NULL);
+    if (g_results.config.pins) {
+        gpio_io_capture_stop();
+    }
+    g_open = false;
+    g_results.active = false;
+}
+
+bool response_latency_active(void)
+{
+    return g_results.active;
+}
+
+void response_latency_get(ResponseLatency_t *results)
+{
+    if (results == NULL) {
+        return;
+    }
+    memcpy(results, &g_results, sizeof(*results));
+}
+
+uint32_t response_latency_percentile(const ResponseLatencyChannel_t *channel, uint32_t bin_us, uint32_t percent)
+{
+    if (channel->count == 0u) {
+        return 0u;
+    }
+    // Rank of the percentile, rounded up
+    uint32_t const rank = (uint32_t)(((uint64_t)channel->count * percent + 99u) / 100u);
+    uint32_t seen = 0;
+    for (uint32_t bin = 0; bin < RESPONSE_LATENCY_BINS; bin++) {
+        seen += channel->bins[bin];
+        if (seen >= rank && seen != 0u) {
+            uint64_t const edge = (uint64_t)(bin + 1u) * bin_us;
+            return edge < channel->max_us ? (uint32_t)edge : channel->max_us;
+        }
+    }
+    return channel->max_us;
+}
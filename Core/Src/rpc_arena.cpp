@@ -0,0 +1,34 @@
+#include "rpc_arena.hpp"
+#include <cstdlib>
+
+alignas(8) static uint8_t arena[RPC_ARENA_SIZE];
+
+size_t RpcArena::_used = 0;
+size_t RpcArena::_peak = 0;
+uint32_t RpcArena::_heap_fallbacks = 0;
+
+void* RpcArena::allocate(size_t size, size_t align) {
+  size_t const offset = (_used + align - 1u) & ~(align - 1u);
+  if (offset + size <= RPC_ARENA_SIZE) {
+    _used = offset + size;
+    if (_used > _peak) _peak = _used;
+    return &arena[offset];
+  }
+
+  // Request too large for the arena, keep it working on the heap
+  _heap_fallbacks++;
+  void* p = std::malloc(size);
+  if (!p) std::abort();  // no exceptions, same as operator new
+  return p;
+}
+
+void RpcArena::deallocate(void* p) {
+  uint8_t* const bp = static_cast<uint8_t*>(p);
+  if (bp < arena || bp >= arena + RPC_ARENA_SIZE) {
+    std::free(p);
+  }
+}
+
+void RpcArena::reset() {
+  _used = 0;
+}
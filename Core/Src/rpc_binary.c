@@ -0,0 +1,51 @@
+/**
+ * @file rpc_binary.c
+ * @brief Binary framed RPC protocol helpers (framing and CRC)
+ *
+ * Shared by the CDC-ACM receive thread, which uses rpc_bin_frame_length() to
+ * cut frames out of the byte stream, and the RPC server, which checks the CRC
+ * and dispatches the opcode.
+ */
+
+#include "rpc_binary.h"
+#include "checksum.h"
+
+volatile uint8_t rpc_binary_enabled = 0;
+
+void RpcBinary_SetEnabled(bool enable)
+{
+    rpc_binary_enabled = enable ? 1u : 0u;
+}
+
+uint16_t rpc_bin_crc16(const uint8_t *data, uint32_t length)
+{
+    return checksum_crc16_ccitt(data, length);
+}
+
+int32_t rpc_bin_frame_length(const uint8_t *data, uint32_t available)
+{
+    if (available < RPC_BIN_HEADER_SIZE) {
+        return 0;
+    }
+
+    uint16_t payload_length = rpc_bin_get_u16(&data[3]);
+    if (payload_length > RPC_BIN_MAX_PAYLOAD) {
+        return -1;
+    }
+
+    uint32_t frame_length = RPC_BIN_OVERHEAD + payload_length;
+    return (available >= frame_length) ? (int32_t)frame_length : 0;
+}
+
+uint16_t rpc_bin_finish_frame(uint8_t *out, uint8_t opcode, uint8_t seq, uint16_t payload_length)
+{
+    out[0] = RPC_BIN_SOF;
+    out[1] = opcode;
+    out[2] = seq;
+    rpc_bin_put_u16(&out[3], payload_length);
+
+    uint16_t crc = rpc_bin_crc16(&out[1], RPC_BIN_HEADER_SIZE - 1u + payload_length);
+    rpc_bin_put_u16(&out[RPC_BIN_HEADER_SIZE + payload_length], crc);
+
+    return (uint16_t)(RPC_BIN_OVERHEAD + payload_length);
+}
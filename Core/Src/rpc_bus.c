@@ -0,0 +1,84 @@
+/**
+ * @file rpc_bus.c
+ * @brief Requests of every transport in priority lanes for the RPC thread
+ *
+ * One message queue per lane. The transports post from their own threads,
+ * only the RPC thread takes. The lane is that of the method named by the
+ * request (RpcServer_Lane), looked up without parsing the JSON.
+ */
+
+#include "rpc_bus.h"
+#include "cmsis_os2.h"
+#include "rtos_static.h"
+#include "rpc_server.h"
+#include "stm32h5xx_hal.h"
+
+static const char *const kLaneNames[RPC_LANE_COUNT] = { "urgent", "normal", "bulk" };
+
+RTOS_MESSAGE_QUEUE(rpcLaneUrgent, RPC_BUS_DEPTH, sizeof(RpcBusMessage_t));
+RTOS_MESSAGE_QUEUE(rpcLaneNormal, RPC_BUS_DEPTH, sizeof(RpcBusMessage_t));
+RTOS_MESSAGE_QUEUE(rpcLaneBulk, RPC_BUS_DEPTH, sizeof(RpcBusMessage_t));
+
+static osMessageQueueId_t lanes[RPC_LANE_COUNT];
+static RpcLaneStats_t stats[RPC_LANE_COUNT];
+
+void RpcBus_Init(void)
+{
+    lanes[RPC_LANE_URGENT] = osMessageQueueNew(RPC_BUS_DEPTH, sizeof(RpcBusMessage_t), &rpcLaneUrgent_attr);
+    lanes[RPC_LANE_NORMAL] = osMessageQueueNew(RPC_BUS_DEPTH, sizeof(RpcBusMessage_t), &rpcLaneNormal_attr);
+    lanes[RPC_LANE_BULK] = osMessageQueueNew(RPC_BUS_DEPTH, sizeof(RpcBusMessage_t), &rpcLaneBulk_attr);
+}
+
+bool RpcBus_Post(uint8_t origin, void *request, const char *data, uint32_t length, uint8_t type)
+{
+    RpcBusMessage_t message;
+    message.request = request;
+    message.origin = origin;
+    message.lane = RpcServer_Lane(data, length, type);
+    message.posted_ms = HAL_GetTick();
+    if (message.lane >= RPC_LANE_COUNT) {
+        message.lane = RPC_LANE_NORMAL;
+    }
+
+    RpcLaneStats_t *const lane = &stats[message.lane];
+    if (lanes[message.lane] == NULL || osMessageQueuePut(lanes[message.lane], &message, 0u, 0u) != osOK) {
+        lane->dropped++;
+        return false;
+    }
+    lane->posted++;
+    uint32_t const pending = osMessageQueueGetCount(lanes[message.lane]);
+    if (pending > lane->high_water) {
+        lane->high_water = pending;
+    }
+    RpcServer_Notify();
+    return true;
+}
+
+bool RpcBus_Take(RpcBusMessage_t *message, RpcLane_t lowest)
+{
+    for (uint32_t i = 0; i <= (uint32_t)lowest && i < RPC_LANE_COUNT; i++) {
+        if (lanes[i] != NULL && osMessageQueueGet(lanes[i], message, NULL, 0u) == osOK) {
+            RpcLaneStats_t *const lane = &stats[i];
+            uint32_t const wait = HAL_GetTick() - message->posted_ms;
+            lane->served++;
+            if (wait > lane->max_wait_ms) {
+                lane->max_wait_ms = wait;
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+void RpcBus_GetStats(RpcLaneStats_t out[RPC_LANE_COUNT])
+{
+    for (uint32_t i = 0; i < RPC_LANE_COUNT; i++) {
+        out[i] = stats[i];
+        out[i].pending = lanes[i] != NULL ? osMessageQueueGetCount(lanes[i]) : 0u;
+    }
+}
+
+const char *RpcBus_LaneName(RpcLane_t lane)
+{
+    return (uint32_t)lane < RPC_LANE_COUNT ? kLaneNames[lane] : "?";
+}
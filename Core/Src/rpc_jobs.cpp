@@ -0,0 +1,101 @@
+#include "rpc_jobs.hpp"
+#include "cmsis_os2.h"
+#include "rtos_static.h"
+#include "main.h"
+#include "rpc_server.h"
+#include <cstdio>
+
+// Slots are allocated and freed by the RPC thread only, a worker owns a slot
+// from QUEUED to DONE and hands it back through the completion queue
+static RpcJob jobs[RPC_JOB_SLOTS];
+static uint32_t nextJobId = 1u;
+static uint8_t currentOrigin = RPC_ORIGIN_USB;
+
+static osMessageQueueId_t jobQueue;
+static osMessageQueueId_t doneQueue;
+static osThreadId_t workerThread_id[RPC_JOB_WORKERS];
+RTOS_MESSAGE_QUEUE(jobQueue, RPC_JOB_SLOTS, sizeof(RpcJob*));
+RTOS_MESSAGE_QUEUE(doneQueue, RPC_JOB_SLOTS, sizeof(RpcJob*));
+
+/* Below the RPC thread, which keeps serving requests while a job runs */
+RTOS_THREAD_ARRAY_MEMORY(rpcJobTask, RPC_JOB_WORKERS, 4096);
+static const osThreadAttr_t rpcJobTask_attributes = {
+  .name = "rpcJobTask",
+  .stack_size = rpcJobTask_stack_size,
+  .priority = osPriorityBelowNormal
+};
+
+static void RpcJobWorker(void* argument) {
+    (void)argument;
+    RpcJob* job;
+
+    for (;;) {
+        if (osMessageQueueGet(jobQueue, &job, nullptr, osWaitForever) != osOK) {
+            continue;
+        }
+        job->state.store(RPC_JOB_RUNNING, std::memory_order_release);
+        job->run(*job);
+        job->duration_ms = HAL_GetTick() - job->queued_ms;
+        job->state.store(RPC_JOB_DONE, std::memory_order_release);
+        osMessageQueuePut(doneQueue, &job, 0u, 0u);
+        RpcServer_Notify();
+    }
+}
+
+void RpcJobs_Init(void) {
+    jobQueue = osMessageQueueNew(RPC_JOB_SLOTS, sizeof(RpcJob*), &jobQueue_attr);
+    doneQueue = osMessageQueueNew(RPC_JOB_SLOTS, sizeof(RpcJob*), &doneQueue_attr);
+    for (uint32_t i = 0; i < RPC_JOB_WORKERS; ++i) {
+        osThreadAttr_t attr = rpcJobTask_attributes;
+        RTOS_THREAD_ARRAY_ATTR(attr, rpcJobTask, i);
+        workerThread_id[i] = osThreadNew(RpcJobWorker, nullptr, &attr);
+        if (!workerThread_id[i]) {
+            printf("Failed to create RPC job worker %lu\n", static_cast<unsigned long>(i));
+        }
+    }
+}
+
+void RpcJobs_SetOrigin(uint8_t origin) {
+    currentOrigin = origin;
+}
+
+RpcJob* RpcJobs_Alloc(const char* method, RpcJobRunFn run, RpcJobResponseFn response) {
+    for (RpcJob& job : jobs) {
+        if (job.state.load(std::memory_order_acquire) == RPC_JOB_FREE) {
+            job.id = nextJobId++;
+            job.method = method;
+            job.run = run;
+            job.response = response;
+            job.origin = currentOrigin;
+            job.queued_ms = HAL_GetTick();
+            job.duration_ms = 0u;
+            return &job;
+        }
+    }
+    return nullptr;
+}
+
+bool RpcJobs_Submit(RpcJob* job) {
+    job->state.store(RPC_JOB_QUEUED, std::memory_order_release);
+    if (osMessageQueuePut(jobQueue, &job, 0u, 0u) != osOK) {
+        job->state.store(RPC_JOB_FREE, std::memory_order_release);
+        return false;
+    }
+    return true;
+}
+
+RpcJob* RpcJobs_Completed(void) {
+    RpcJob* job;
+    if (osMessageQueueGet(doneQueue, &job, nullptr, 0u) != osOK) {
+        return nullptr;
+    }
+    return job;
+}
+
+void RpcJobs_Free(RpcJob* job) {
+    job->state.store(RPC_JOB_FREE, std::memory_order_release);
+}
+
+const RpcJob& RpcJobs_Slot(size_t index) {
+    return jobs[index];
+}
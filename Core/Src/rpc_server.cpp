@@ -1,92 +1,411 @@
 #include "cmsis_os2.h"
+#include "rtos_static.h"
 #include "stm32h5xx_nucleo.h"
 #include "stm32h5xx_hal.h"
 #include "main.h"
 #include "parameter_manager.h"
 #include "command_station.h"
+#include "packet_program.h"
+#include "service_mode.h"
+#include "railcom.h"
+#include "sniffer.h"
+#include "loco_tracker.h"
+#include "packet_stats.h"
+#include "edge_stats.h"
+#include "edge_timing.h"
+#include "trace_log.h"
+#include "telemetry.h"
+#include "recorder.h"
+#include "packet_suite.h"
+#include "profiler.h"
+#include "power_idle.h"
+#include "priority_profile.h"
+#include "timebase.h"
+#include "gpio_io.h"
+#include "response_latency.h"
+#include "accessory_sequence.h"
+#include "packet_capture.h"
+#include "usb_capture.h"
+#include "SUSI.h"
+#include "can_sync.h"
+#include "aux_track.h"
+#include "refresh_scheduler.h"
+#include "packet_fuzzer.h"
+#include "test_case.h"
+#include "margin_sweep.h"
+#include "packet_vm.h"
+#include "memory_map.h"
+#include "boot.h"
+#ifdef DCC_TESTER_BENCHMARK
+#include "benchmark.h"
+#include "version.h"
+#endif
 #include "decoder.h"
 #include "parameter_manager.h"
 #include "analog_manager.h"
+#include "track_guard.h"
 #include "usbx_cdc_transport.h"
+#include "netx_rpc_transport.h"
 #include "rpc_transport_types.h"
+#include "rpc_binary.h"
+#include "rpc_bus.h"
 
 #include "rpc_server.hpp"
+#include "rpc_jobs.hpp"
+#include "timing_profiles.hpp"
 
+#include <algorithm>
 #include <cstring>
 #include <cstdio>
 
-extern TX_QUEUE rpc_rxqueue;
-
 static osThreadId_t rpcServerThread_id;
 static osSemaphoreId_t rpcServerStart_sem;
+static osEventFlagsId_t rpcServerEvents;
+RTOS_SEMAPHORE(rpcServerStart_sem);
+RTOS_EVENT_FLAGS(rpcServerEvents);
 static bool rpcServerRunning = false;
+RTOS_SEMAPHORE(rpcConsoleDone_sem);
+static osSemaphoreId_t rpcConsoleDone_sem;
+
+// Console request on the command bus, data is cleared if RpcServer_Console gave up on it
+struct RpcConsoleRequest {
+    const char* volatile data;
+    uint32_t length;
+};
+static RpcConsoleRequest rpcConsoleRequest;
+
+#define RPC_EVENT_WAKE 0x01u   // request queued or job finished
 
 /* Definitions for rpcServerTask */
+RTOS_THREAD_MEMORY(rpcServerTask, 8192);
 const osThreadAttr_t rpcServerTask_attributes = {
   .name = "rpcServerTask",
-  .stack_size = 8192,
+  RTOS_THREAD_ATTR_MEMORY(rpcServerTask),
   .priority = osPriorityBelowNormal4    //(osPriority_t) osPriorityHigh
 };
 
 
 // ---------------- RpcServer methods ----------------
 
-bool RpcServer::register_method(const char* name, RpcHandlerFn handler) {
-    if (!name || !handler) return false;
-    if (count >= kMaxMethods) return false;
+// nlohmann output adapter which serializes into a caller supplied buffer instead of a
+// std::string, running out of space is flagged rather than allocating
+class FixedBufferOutput : public nlohmann::detail::output_adapter_protocol<char> {
+public:
+    void reset(char* buf, size_t size) {
+        _buf = buf;
+        _size = size;
+        _pos = 0;
+        _overflow = false;
+    }
 
-    for (int i = 0; i < count; ++i) {
-        if (table[i].name && std::strcmp(table[i].name, name) == 0) {
-            table[i].handler = handler;
-            return true;
+    void write_character(char c) override {
+        if (_pos < _size) {
+            _buf[_pos++] = c;
+        } else {
+            _overflow = true;
         }
     }
 
-    table[count++] = {name, handler};
-    return true;
+    void write_characters(const char* s, std::size_t length) override {
+        if (length > _size - _pos) {
+            _overflow = true;
+            length = _size - _pos;
+        }
+        std::memcpy(&_buf[_pos], s, length);
+        _pos += length;
+    }
+
+    size_t length() const { return _pos; }
+    bool overflow() const { return _overflow; }
+
+private:
+    char* _buf = nullptr;
+    size_t _size = 0;
+    size_t _pos = 0;
+    bool _overflow = false;
+};
+
+static FixedBufferOutput fixed_output;
+
+size_t RpcServer::serialize(const json& response, char* out, size_t out_size) {
+    if (!out || out_size < 2u) return 0;
+
+    // Aliasing constructor: the adapter is static, so the shared_ptr owns nothing and allocates nothing
+    nlohmann::detail::output_adapter_t<char> adapter(std::shared_ptr<void>(), &fixed_output);
+    fixed_output.reset(out, out_size - 2u);  // room for CRLF
+    nlohmann::detail::serializer<json> serializer(adapter, ' ', nlohmann::detail::error_handler_t::replace);
+    serializer.dump(response, false, false, 0);
+    if (fixed_output.overflow()) return 0;
+
+    size_t length = fixed_output.length();
+    out[length++] = '\r';
+    out[length++] = '\n';
+    return length;
 }
 
-RpcHandlerFn RpcServer::find(const char* name) const {
-    if (!name) return nullptr;
-    for (int i = 0; i < count; ++i) {
-        if (table[i].name && std::strcmp(table[i].name, name) == 0) {
-            return table[i].handler;
+void RpcStream::start(const json* request_id) {
+    id = request_id;
+    pos = 0;
+    total = 0;
+    members = 0;
+    items = 0;
+    opened = false;
+    failed = false;
+}
+
+void RpcStream::put(const char* s, size_t length) {
+    while (length > 0 && !failed) {
+        size_t const n = length < size - pos ? length : size - pos;
+        std::memcpy(&buf[pos], s, n);
+        pos += n;
+        s += n;
+        length -= n;
+        if (pos == size) {
+            flush();
         }
     }
-    return nullptr;
 }
 
-std::string RpcServer::error_response(const char* msg) {
+void RpcStream::flush() {
+    if (pos > 0 && !failed) {
+        failed = !sink(context, buf, pos);
+        total += pos;
+    }
+    pos = 0;
+}
+
+// Member names are identifiers, written without escaping
+void RpcStream::key(const char* name) {
+    if (members++ > 0) {
+        put(",", 1u);
+    }
+    put("\"", 1u);
+    put(name, std::strlen(name));
+    put("\":", 2u);
+}
+
+void RpcStream::begin(const json& head, const char* array) {
+    // Aliasing constructor as in serialize(), the adapter is a member
+    nlohmann::detail::output_adapter_t<char> adapter(std::shared_ptr<void>(), &output);
+    serializer.emplace(adapter, ' ', nlohmann::detail::error_handler_t::replace);
+    opened = true;
+
+    put("{", 1u);
+    for (auto it = head.begin(); it != head.end(); ++it) {
+        key(it.key().c_str());
+        serializer->dump(it.value(), false, false, 0);
+    }
+    if (id != nullptr) {
+        key("id");
+        serializer->dump(*id, false, false, 0);
+    }
+    key(array);
+    put("[", 1u);
+}
+
+void RpcStream::item(const json& value) {
+    if (items++ > 0) {
+        put(",", 1u);
+    }
+    serializer->dump(value, false, false, 0);
+}
+
+void RpcStream::end(bool complete) {
+    put("]", 1u);
+    key("complete");
+    if (complete) {
+        put("true", 4u);
+    } else {
+        put("false", 5u);
+    }
+    put("}\r\n", 3u);
+    flush();
+    serializer.reset();
+}
+
+size_t RpcServer::error_response(const char* msg, char* out, size_t out_size) {
     json resp = {
         {"status", "error"},
         {"message", msg ? msg : "error"}
     };
-    return resp.dump();
+    return serialize(resp, out, out_size);
+}
+
+size_t RpcServer::handle(const char* request_str, size_t length, char* out, size_t out_size,
+                         RpcStream* stream) {
+    streaming = stream;
+    size_t response_length = dispatch(request_str, length, out, out_size);
+    if (stream != nullptr && stream->started()) {
+        response_length = 0;
+    }
+    streaming = nullptr;
+    // Every json value of this request has been destroyed by now
+    RpcArena::reset();
+    return response_length;
+}
+
+static json error_object(const char* msg) {
+    return {
+        {"status", "error"},
+        {"message", msg}
+    };
+}
+
+static bool response_ok(const json& response) {
+    auto status = response.find("status");
+    return status != response.end() && status->is_string() &&
+           status->get_ref<const json::string_t&>() == "ok";
+}
+
+size_t RpcServer::dispatch(const char* request_str, size_t length, char* out, size_t out_size) {
+    // Single exception free parse straight from the receive buffer
+    json request = json::parse(request_str, request_str + length, nullptr, false);
+    if (request.is_discarded()) {
+        return error_response("Invalid JSON", out, out_size);
+    }
+
+    json response = call(request, true);
+    size_t response_length = serialize(response, out, out_size);
+    if (response_length == 0) {
+        json overflow = error_object("Response too large");
+        auto id = request.is_object() ? request.find("id") : request.end();
+        if (id != request.end()) {
+            overflow["id"] = *id;
+        }
+        return serialize(overflow, out, out_size);
+    }
+    return response_length;
+}
+
+// Run one request object, an "id" member is copied into the response so that
+// pipelined requests can be matched to their responses
+json RpcServer::call(const json& request, bool allow_batch) {
+    if (!request.is_object()) {
+        return error_object("Malformed request");
+    }
+
+    json response;
+    auto method = request.find("method");
+    auto params = request.find("params");
+    if (method == request.end() || params == request.end()) {
+        response = error_object("Malformed request");
+    }
+    else if (!method->is_string()) {
+        response = error_object("Method must be string");
+    }
+    else if (method->get_ref<const json::string_t&>() == "batch") {
+        response = allow_batch ? batch(*params) : error_object("batch cannot be nested");
+    }
+    else {
+        const RpcEntry* entry = methods.find(method->get_ref<const json::string_t&>().c_str());
+        if (!entry) {
+            response = error_object("Unknown method");
+        }
+        else if (!entry->stream) {
+            response = entry->handler(*params);
+        }
+        else if (!streaming || !allow_batch) {
+            response = error_object("Streamed method, needs a direct request");
+        }
+        else {
+            auto id = request.find("id");
+            streaming->start(id != request.end() ? &*id : nullptr);
+            response = entry->stream(*params, *streaming);
+            if (streaming->started()) {
+                return json();
+            }
+        }
+    }
+
+    auto id = request.find("id");
+    if (id != request.end() && response.is_object()) {
+        response["id"] = *id;
+    }
+    return response;
 }
 
-std::string RpcServer::handle(const std::string& request_str) {
-    json request;
-    if (!json::accept(request_str)) {
-        return error_response("Invalid JSON");
+// params is either the array of calls or {"calls":[...],"stop_on_error":bool}
+json RpcServer::batch(const json& params) {
+    const json* calls = &params;
+    bool stop_on_error = false;
+    if (params.is_object()) {
+        auto it = params.find("calls");
+        if (it == params.end()) {
+            return error_object("calls is required");
+        }
+        calls = &*it;
+        auto stop = params.find("stop_on_error");
+        if (stop != params.end()) {
+            if (!stop->is_boolean()) {
+                return error_object("stop_on_error must be a boolean");
+            }
+            stop_on_error = stop->get<bool>();
+        }
+    }
+    if (!calls->is_array() || calls->empty()) {
+        return error_object("calls must be a non-empty array");
+    }
+    if (calls->size() > kMaxBatchCalls) {
+        return error_object("Too many calls");
     }
-    request = json::parse(request_str);
 
-    if (!request.contains("method") || !request.contains("params")) {
-        return error_response("Malformed request");
+    json results = json::array();
+    uint32_t failed = 0;
+    for (const json& c : *calls) {
+        json result = call(c, false);
+        bool const ok = response_ok(result);
+        results.push_back(std::move(result));
+        if (!ok) {
+            failed++;
+            if (stop_on_error) {
+                break;
+            }
+        }
     }
 
-    if (!request["method"].is_string()) {
-        return error_response("Method must be string");
+    return {
+        {"status", failed == 0 ? "ok" : "error"},
+        {"executed", results.size()},
+        {"failed", failed},
+        {"results", std::move(results)}
+    };
+}
+
+uint16_t RpcServer::handle_binary(const uint8_t* frame, uint16_t length, uint8_t* out, uint16_t out_size) {
+    if (!frame || length < RPC_BIN_OVERHEAD || !out || out_size < RPC_BIN_OVERHEAD + 1u) {
+        return 0;
     }
 
-    std::string method_str = request["method"].get<std::string>();
-    RpcHandlerFn handler = find(method_str.c_str());
-    if (!handler) {
-        return error_response("Unknown method");
+    uint8_t opcode = frame[1];
+    uint8_t seq = frame[2];
+    uint16_t payload_length = rpc_bin_get_u16(&frame[3]);
+    uint8_t* resp = &out[RPC_BIN_HEADER_SIZE];
+    uint16_t resp_length = 0;
+    uint8_t status;
+
+    if (length != RPC_BIN_OVERHEAD + payload_length) {
+        status = RPC_BIN_STATUS_BAD_LENGTH;
+    }
+    else if (rpc_bin_crc16(&frame[1], RPC_BIN_HEADER_SIZE - 1u + payload_length) !=
+             rpc_bin_get_u16(&frame[RPC_BIN_HEADER_SIZE + payload_length])) {
+        status = RPC_BIN_STATUS_BAD_CRC;
+    }
+    else {
+        const RpcEntry* entry = methods.find_binary(opcode);
+        if (!entry) {
+            status = RPC_BIN_STATUS_UNKNOWN_OPCODE;
+        }
+        else {
+            uint16_t resp_size = out_size - RPC_BIN_OVERHEAD - 1u;
+            status = entry->bin_handler(&frame[RPC_BIN_HEADER_SIZE], payload_length, &resp[1], resp_size, &resp_length);
+            if (status != RPC_BIN_STATUS_OK || resp_length > resp_size) {
+                resp_length = 0;
+            }
+        }
     }
 
-    json response = handler(request["params"]);
-    return response.dump();
+    resp[0] = status;
+    return rpc_bin_finish_frame(out, opcode | RPC_BIN_RESPONSE_FLAG, seq, resp_length + 1u);
 }
 
 // ---------------- Handlers ----------------
@@ -99,17 +418,17 @@ static json echo_handler(const json& params) {
 }
 
 static json command_station_start_handler(const json& params) {
-    uint8_t loop = 0;  // 0=no loop, 1=loop1, 2=loop2, 3=loop3
+    uint8_t loop = 0;  // 0=no loop, 1=loop1, 2=loop2, 3=loop3, 4=refresh
     
     // Check if params contains a "loop" field
     if (params.is_object() && params.contains("loop")) {
         if (params["loop"].is_number_unsigned()) {
             loop = params["loop"].get<uint8_t>();
             // Validate loop range
-            if (loop > 3) {
+            if (loop > 4) {
                 return {
                     {"status", "error"},
-                    {"message", "loop must be 0, 1, 2, or 3"}
+                    {"message", "loop must be 0, 1, 2, 3 or 4"}
                 };
             }
         }
@@ -120,7 +439,7 @@ static json command_station_start_handler(const json& params) {
         else {
             return {
                 {"status", "error"},
-                {"message", "loop must be a number (0-3) or boolean"}
+                {"message", "loop must be a number (0-4) or boolean"}
             };
         }
     }
@@ -139,10 +458,13 @@ static json command_station_start_handler(const json& params) {
     };
 }
 
-static json command_station_stop_handler(const json& params) {
-    (void)params;  // Unused parameter
-    
-    if (!CommandStation_Stop()) {
+// Stopping waits up to a second for the command station thread
+static void command_station_stop_run(RpcJob& job) {
+    rpc_job_data<bool>(job) = CommandStation_Stop();
+}
+
+static json command_station_stop_response(const RpcJob& job) {
+    if (!rpc_job_data<bool>(job)) {
         return {
             {"status", "error"},
             {"message", "Command station is not running"}
@@ -155,6 +477,183 @@ static json command_station_stop_handler(const json& params) {
     };
 }
 
+static json command_station_stop_handler(const json& params) {
+    return rpc_job_execute(params, "command_station_stop", command_station_stop_run, command_station_stop_response,
+                           false);
+}
+
+// Decode the fault rules of an override, see packet_timing.h
+static const char* parse_packet_faults(const json& faults, PacketTiming_t& timing) {
+    if (!faults.is_array() || faults.size() > PACKET_TIMING_MAX_FAULTS) {
+        return "faults must be an array of up to 4 rules";
+    }
+    static const char* const kFaultNames[PACKET_FAULT_COUNT] = {
+        "", "flip", "stretch", "drop", "truncate_preamble", "checksum"
+    };
+    for (size_t r = 0; r < faults.size(); ++r) {
+        const json& rule = faults[r];
+        PacketFault_t& fault = timing.faults[r];
+        if (!rule.is_object() || !rule.contains("type") || !rule["type"].is_string()) {
+            return "each fault needs a type";
+        }
+        const auto& type = rule["type"].get_ref<const json::string_t&>();
+        for (uint8_t t = PACKET_FAULT_FLIP; t < PACKET_FAULT_COUNT; t++) {
+            if (type == kFaultNames[t]) {
+                fault.type = t;
+            }
+        }
+        switch (fault.type) {
+        case PACKET_FAULT_FLIP:
+        case PACKET_FAULT_STRETCH:
+        case PACKET_FAULT_DROP: {
+            if (!rule.contains("first") || !rule["first"].is_number_unsigned() ||
+                rule["first"].get<uint64_t>() >= PACKET_TIMING_MAX_BITS) {
+                return "fault first must be a position 0-162";
+            }
+            uint64_t count = 1;
+            if (rule.contains("count")) {
+                if (!rule["count"].is_number_unsigned() || rule["count"].get<uint64_t>() == 0u ||
+                    rule["count"].get<uint64_t>() > PACKET_TIMING_MAX_BITS) {
+                    return "fault count must be 1-163";
+                }
+                count = rule["count"].get<uint64_t>();
+            }
+            fault.first = rule["first"].get<uint8_t>();
+            fault.count = static_cast<uint8_t>(count);
+            if (fault.type == PACKET_FAULT_FLIP) {
+                break;
+            }
+            fault.half = PACKET_FAULT_HALF_BOTH;
+            if (rule.contains("half")) {
+                const json& half = rule["half"];
+                if (half == "p") {
+                    fault.half = PACKET_FAULT_HALF_P;
+                } else if (half == "n") {
+                    fault.half = PACKET_FAULT_HALF_N;
+                } else if (half != "both") {
+                    return "fault half must be \"p\", \"n\" or \"both\"";
+                }
+            }
+            if (fault.type == PACKET_FAULT_STRETCH) {
+                if (!rule.contains("delta") || !rule["delta"].is_number_integer() ||
+                    rule["delta"].get<int64_t>() < -PACKET_TIMING_MAX_HALF_US ||
+                    rule["delta"].get<int64_t>() > PACKET_TIMING_MAX_HALF_US) {
+                    return "stretch delta must be an integer within +-32767";
+                }
+                fault.value = rule["delta"].get<int16_t>();
+            }
+            break;
+        }
+        case PACKET_FAULT_TRUNCATE_PREAMBLE:
+            if (!rule.contains("bits") || !rule["bits"].is_number_unsigned() || rule["bits"].get<uint64_t>() > 255u) {
+                return "truncate_preamble bits must be 0-255";
+            }
+            fault.value = rule["bits"].get<int16_t>();
+            break;
+        case PACKET_FAULT_CHECKSUM:
+            fault.value = 0xFF;
+            if (rule.contains("xor")) {
+                if (!rule["xor"].is_number_unsigned() || rule["xor"].get<uint64_t>() == 0u ||
+                    rule["xor"].get<uint64_t>() > 255u) {
+                    return "checksum xor must be 1-255";
+                }
+                fault.value = rule["xor"].get<int16_t>();
+            }
+            break;
+        default:
+            return "fault type must be flip, stretch, drop, truncate_preamble or checksum";
+        }
+    }
+    return nullptr;
+}
+
+// Decode the optional timing_profile and override of a scheduled packet
+// present is set if either was given, returns nullptr on success or an error message
+static const char* parse_packet_timing(const json& item, PacketTiming_t& timing, bool& present) {
+    std::memset(&timing, 0, sizeof(timing));
+    timing.profile = PACKET_TIMING_PROFILE_CONFIGURED;
+    timing.zero_bits_only = 1;
+    present = false;
+
+    if (item.contains("timing_profile")) {
+        if (!item["timing_profile"].is_string()) {
+            return "timing_profile must be a string";
+        }
+        timing.profile = timing_profile_from_name(item["timing_profile"].get_ref<const json::string_t&>().c_str());
+        if (timing.profile >= PACKET_TIMING_PROFILE_COUNT) {
+            return "unknown timing_profile";
+        }
+        present = true;
+    }
+
+    if (item.contains("override")) {
+        const json& ovr = item["override"];
+        if (!ovr.is_object()) {
+            return "override must be an object";
+        }
+        if (ovr.contains("zerobit_override_mask")) {
+            if (!ovr["zerobit_override_mask"].is_number_unsigned()) {
+                return "zerobit_override_mask must be an unsigned integer";
+            }
+            uint64_t mask = ovr["zerobit_override_mask"].get<uint64_t>();
+            for (uint32_t i = 0; i < 8; i++) {
+                timing.bits[i] = static_cast<uint8_t>(mask >> (8 * i));
+            }
+        }
+        // Positions beyond the 64-bit mask, counted from the start bit
+        if (ovr.contains("bits")) {
+            if (!ovr["bits"].is_array()) {
+                return "bits must be an array";
+            }
+            for (const auto& bit : ovr["bits"]) {
+                if (!bit.is_number_unsigned() || bit.get<uint32_t>() >= PACKET_TIMING_MAX_BITS) {
+                    return "bits positions must be 0-162";
+                }
+                uint32_t pos = bit.get<uint32_t>();
+                timing.bits[pos / 8] |= static_cast<uint8_t>(1u << (pos % 8));
+            }
+        }
+        // Preamble positions, 0 is the last preamble bit before the start bit
+        if (ovr.contains("preamble_bits")) {
+            if (!ovr["preamble_bits"].is_array()) {
+                return "preamble_bits must be an array";
+            }
+            for (const auto& bit : ovr["preamble_bits"]) {
+                if (!bit.is_number_unsigned() || bit.get<uint32_t>() >= PACKET_TIMING_PREAMBLE_BITS) {
+                    return "preamble_bits positions must be 0-31";
+                }
+                timing.preamble |= 1u << bit.get<uint32_t>();
+            }
+        }
+        if (ovr.contains("zerobit_deltaP")) {
+            if (!ovr["zerobit_deltaP"].is_number_integer()) {
+                return "zerobit_deltaP must be an integer";
+            }
+            timing.deltaP = ovr["zerobit_deltaP"].get<int32_t>();
+        }
+        if (ovr.contains("zerobit_deltaN")) {
+            if (!ovr["zerobit_deltaN"].is_number_integer()) {
+                return "zerobit_deltaN must be an integer";
+            }
+            timing.deltaN = ovr["zerobit_deltaN"].get<int32_t>();
+        }
+        if (ovr.contains("zero_bits_only")) {
+            if (!ovr["zero_bits_only"].is_boolean()) {
+                return "zero_bits_only must be a boolean";
+            }
+            timing.zero_bits_only = ovr["zero_bits_only"].get<bool>() ? 1 : 0;
+        }
+        if (ovr.contains("faults")) {
+            const char* error = parse_packet_faults(ovr["faults"], timing);
+            if (error) {
+                return error;
+            }
+        }
+        present = true;
+    }
+    return nullptr;
+}
+
 static json command_station_load_packet_handler(const json& params) {
     if (!params.is_object() || !params.contains("bytes")) {
         return {
@@ -170,7 +669,7 @@ static json command_station_load_packet_handler(const json& params) {
         };
     }
     
-    auto bytes_array = params["bytes"];
+    const json& bytes_array = params["bytes"];
     if (bytes_array.empty() || bytes_array.size() > DCC_MAX_PACKET_SIZE) {
         return {
             {"status", "error"},
@@ -189,6 +688,29 @@ static json command_station_load_packet_handler(const json& params) {
         replace = params["replace"].get<bool>();
     }
 
+    // Optional per packet gap for scheduled transmission
+    uint32_t gap_us = CUSTOM_PACKET_GAP_DEFAULT;
+    if (params.contains("gap_us")) {
+        if (!params["gap_us"].is_number_unsigned()) {
+            return {
+                {"status", "error"},
+                {"message", "gap_us must be an unsigned integer"}
+            };
+        }
+        gap_us = params["gap_us"].get<uint32_t>();
+    }
+
+    // Optional timing for scheduled transmission
+    PacketTiming_t timing;
+    bool has_timing = false;
+    const char* timing_error = parse_packet_timing(params, timing, has_timing);
+    if (timing_error) {
+        return {
+            {"status", "error"},
+            {"message", timing_error}
+        };
+    }
+
     uint8_t bytes[DCC_MAX_PACKET_SIZE];
     uint8_t length = 0;
     
@@ -209,12 +731,21 @@ static json command_station_load_packet_handler(const json& params) {
         bytes[length++] = static_cast<uint8_t>(val);
     }
     
-    if (!CommandStation_LoadCustomPacket(bytes, length, replace)) {
-        if (CommandStation_IsCustomPacketQueueFull()) {
+    if (!CommandStation_LoadCustomPacketTimed(bytes, length, replace, gap_us, has_timing ? &timing : nullptr)) {
+        CommandStationQueueStats_t stats;
+        CommandStation_GetCustomPacketQueueStats(&stats);
+        if (stats.count >= stats.capacity) {
+            return {
+                {"status", "error"},
+                {"message", "Custom packet queue is full"},
+                {"queue_count", stats.count},
+                {"queue_capacity", stats.capacity}
+            };
+        }
+        if (replace) {
             return {
                 {"status", "error"},
-                {"message", "Custom packet queue is full (max 3 packets)"},
-                {"queue_count", CommandStation_GetCustomPacketQueueCount()}
+                {"message", "Transmission in progress did not stop for the replace"}
             };
         }
         return {
@@ -231,1068 +762,6500 @@ static json command_station_load_packet_handler(const json& params) {
     };
 }
 
-static json command_station_transmit_packet_handler(const json& params) {
-    uint32_t delay_ms = 100;  // Default to 100ms delay
-    
-    // Parse optional delay_ms parameter
-    if (params.contains("delay_ms")) {
-        delay_ms = params["delay_ms"].get<uint32_t>();
+static const char* load_packets_error(int result) {
+    switch (result) {
+    case -1: return "malformed packet record";
+    case -2: return "Custom packet queue cannot take all packets";
+    case -3: return "Transmission in progress did not stop for the replace";
+    default: return "Failed to load packets";
     }
-    
-    CommandStation_TriggerTransmit(delay_ms);
-    
-    return {
-        {"status", "ok"},
-        {"message", "Packet transmission triggered"},
-        {"delay_ms", delay_ms}
-    };
-}
-
-static json decoder_start_handler(const json& params) {
-    (void)params;  // Unused parameter
-    
-    Decoder_Start();
-    
-    return {
-        {"status", "ok"},
-        {"message", "Decoder started"}
-    };
-}
-
-static json decoder_stop_handler(const json& params) {
-    (void)params;  // Unused parameter
-    
-    Decoder_Stop();
-    
-    return {
-        {"status", "ok"},
-        {"message", "Decoder stopped"}
-    };
 }
 
-static json command_station_params_handler(const json& params) {
-    // Check if params is an object
-    if (!params.is_object()) {
+// Many packets in one request: "hex" holds records of a length byte and the packet bytes
+static json command_station_load_packets_handler(const json& params) {
+    if (!params.is_object() || !params.contains("hex") || !params["hex"].is_string()) {
         return {
             {"status", "error"},
-            {"message", "Params must be an object"}
+            {"message", "params must contain a 'hex' string"}
         };
     }
-    
-    // Set preamble bits if provided
-    if (params.contains("preamble_bits")) {
-        if (!params["preamble_bits"].is_number_unsigned()) {
-            return {
-                {"status", "error"},
-                {"message", "preamble_bits must be a positive integer"}
-            };
-        }
-        uint8_t preamble = params["preamble_bits"].get<uint8_t>();
-        if (set_dcc_preamble_bits(preamble) != 0) {
+
+    bool replace = false;
+    if (params.contains("replace")) {
+        if (!params["replace"].is_boolean()) {
             return {
                 {"status", "error"},
-                {"message", "Failed to set preamble_bits"}
+                {"message", "replace must be a boolean"}
             };
         }
+        replace = params["replace"].get<bool>();
     }
-    
-    // Set bit1 duration if provided
-    if (params.contains("bit1_duration")) {
-        if (!params["bit1_duration"].is_number_unsigned()) {
-            return {
-                {"status", "error"},
-                {"message", "bit1_duration must be a positive integer"}
-            };
-        }
-        uint8_t bit1 = params["bit1_duration"].get<uint8_t>();
-        if (set_dcc_bit1_duration(bit1) != 0) {
+
+    uint32_t gap_us = CUSTOM_PACKET_GAP_DEFAULT;
+    if (params.contains("gap_us")) {
+        if (!params["gap_us"].is_number_unsigned()) {
             return {
                 {"status", "error"},
-                {"message", "Failed to set bit1_duration"}
+                {"message", "gap_us must be an unsigned integer"}
             };
         }
+        gap_us = params["gap_us"].get<uint32_t>();
     }
-    
-    // Set bit0 duration if provided
-    if (params.contains("bit0_duration")) {
-        if (!params["bit0_duration"].is_number_unsigned()) {
-            return {
-                {"status", "error"},
-                {"message", "bit0_duration must be a positive integer"}
-            };
-        }
-        uint8_t bit0 = params["bit0_duration"].get<uint8_t>();
-        if (set_dcc_bit0_duration(bit0) != 0) {
-            return {
-                {"status", "error"},
-                {"message", "Failed to set bit0_duration"}
-            };
-        }
+
+    // Decoded straight from the string held by the request
+    const json::string_t& hex = params["hex"].get_ref<const json::string_t&>();
+    uint32_t loaded = 0;
+    int const result = CommandStation_LoadCustomPackets(reinterpret_cast<const uint8_t*>(hex.data()),
+                                                        static_cast<uint32_t>(hex.size()), true, replace, gap_us, &loaded);
+    if (result != 0) {
+        return {
+            {"status", "error"},
+            {"message", load_packets_error(result)},
+            {"index", loaded}
+        };
     }
+
+    CommandStationQueueStats_t stats;
+    CommandStation_GetCustomPacketQueueStats(&stats);
+    return {
+        {"status", "ok"},
+        {"message", "Packets loaded"},
+        {"loaded", loaded},
+        {"queue_count", stats.count}
+    };
+}
+
+static json command_station_transmit_packet_handler(const json& params) {
+    uint32_t delay_ms = 100;  // Default to 100ms delay
     
-    // Set BiDi enable if provided
-    if (params.contains("bidi_enable")) {
-        if (!params["bidi_enable"].is_boolean()) {
-            return {
-                {"status", "error"},
-                {"message", "bidi_enable must be a boolean"}
-            };
-        }
-        uint8_t bidi = params["bidi_enable"].get<bool>() ? 1 : 0;
-        if (set_dcc_bidi_enable(bidi) != 0) {
+    // Parse optional delay_ms parameter
+    if (params.contains("delay_ms")) {
+        delay_ms = params["delay_ms"].get<uint32_t>();
+    }
+
+    // Parse optional stream parameter
+    bool stream = false;
+    if (params.contains("stream")) {
+        if (!params["stream"].is_boolean()) {
             return {
                 {"status", "error"},
-                {"message", "Failed to set bidi_enable"}
+                {"message", "stream must be a boolean"}
             };
         }
+        stream = params["stream"].get<bool>();
     }
     
-    // Set trigger first bit if provided
-    if (params.contains("trigger_first_bit")) {
-        if (!params["trigger_first_bit"].is_boolean()) {
+    // delay_us selects scheduled transmission, gaps are then timed by the transmit path
+    if (params.contains("delay_us")) {
+        if (params.contains("delay_ms")) {
             return {
                 {"status", "error"},
-                {"message", "trigger_first_bit must be a boolean"}
+                {"message", "delay_ms and delay_us are mutually exclusive"}
             };
         }
-        uint8_t trigger = params["trigger_first_bit"].get<bool>() ? 1 : 0;
-        if (set_dcc_trigger_first_bit(trigger) != 0) {
+        if (!params["delay_us"].is_number_unsigned()) {
             return {
                 {"status", "error"},
-                {"message", "Failed to set trigger_first_bit"}
+                {"message", "delay_us must be an unsigned integer"}
             };
         }
+        uint32_t delay_us = params["delay_us"].get<uint32_t>();
+        CommandStation_TriggerTransmitScheduled(delay_us, stream);
+
+        return {
+            {"status", "ok"},
+            {"message", "Scheduled packet transmission triggered"},
+            {"delay_us", delay_us},
+            {"stream", stream}
+        };
     }
+
+    CommandStation_TriggerTransmitEx(delay_ms, stream);
     
     return {
         {"status", "ok"},
-        {"message", "Command station parameters updated"}
+        {"message", "Packet transmission triggered"},
+        {"delay_ms", delay_ms},
+        {"stream", stream}
     };
 }
 
-static json command_station_packet_override_handler(const json& params) {
-    // Check if params is an object
-    if (!params.is_object()) {
-        return {
+static json command_station_queue_status_handler(const json& params) {
+    (void)params;  // Unused parameter
+
+    CommandStationQueueStats_t stats;
+    CommandStation_GetCustomPacketQueueStats(&stats);
+
+    return {
+        {"status", "ok"},
+        {"count", stats.count},
+        {"capacity", stats.capacity},
+        {"high_water", stats.high_water},
+        {"underruns", stats.underruns},
+        {"transmitted", stats.transmitted},
+        {"stream", stats.streaming},
+        {"cache_hits", stats.cache_hits},
+        {"cache_misses", stats.cache_misses}
+    };
+}
+
+// Decode one program entry, returns nullptr on success or an error message
+static const char* parse_program_entry(const json& item, PacketProgramEntry_t& entry) {
+    std::memset(&entry, 0, sizeof(entry));
+    if (!item.is_object() || !item.contains("op") || !item["op"].is_string()) {
+        return "each entry must be an object with an 'op' string";
+    }
+
+    const json::string_t& op = item["op"].get_ref<const json::string_t&>();
+    if (op == "packet") {
+        entry.op = PACKET_PROGRAM_OP_PACKET;
+        if (!item.contains("bytes") || !item["bytes"].is_array() ||
+            item["bytes"].empty() || item["bytes"].size() > PACKET_PROGRAM_MAX_PACKET) {
+            return "packet 'bytes' must be an array of 1-18 elements";
+        }
+        for (const auto& byte : item["bytes"]) {
+            if (!byte.is_number_unsigned() || byte.get<uint32_t>() > 0xFF) {
+                return "byte values must be 0-255";
+            }
+            entry.bytes[entry.length++] = byte.get<uint8_t>();
+        }
+        entry.repeat = 1;
+        if (item.contains("repeat")) {
+            if (!item["repeat"].is_number_unsigned() || item["repeat"].get<uint32_t>() == 0 ||
+                item["repeat"].get<uint32_t>() > UINT16_MAX) {
+                return "repeat must be 1-65535";
+            }
+            entry.repeat = item["repeat"].get<uint16_t>();
+        }
+        if (item.contains("gap_us")) {
+            if (!item["gap_us"].is_number_unsigned()) {
+                return "gap_us must be an unsigned integer";
+            }
+            entry.gap_us = item["gap_us"].get<uint32_t>();
+        }
+        if (item.contains("trigger")) {
+            if (!item["trigger"].is_boolean()) {
+                return "trigger must be a boolean";
+            }
+            if (item["trigger"].get<bool>()) {
+                entry.flags |= PACKET_PROGRAM_FLAG_TRIGGER;
+            }
+        }
+        bool has_timing = false;
+        const char* error = parse_packet_timing(item, entry.timing, has_timing);
+        if (error) {
+            return error;
+        }
+        if (has_timing) {
+            entry.flags |= PACKET_PROGRAM_FLAG_OVERRIDE;
+        }
+    }
+    else if (op == "delay") {
+        entry.op = PACKET_PROGRAM_OP_DELAY;
+        if (item.contains("us") && item["us"].is_number_unsigned()) {
+            entry.gap_us = item["us"].get<uint32_t>();
+        }
+        else if (item.contains("ms") && item["ms"].is_number_unsigned() && item["ms"].get<uint32_t>() <= UINT32_MAX / 1000u) {
+            entry.gap_us = item["ms"].get<uint32_t>() * 1000u;
+        }
+        else {
+            return "delay needs unsigned 'us' or 'ms'";
+        }
+    }
+    else if (op == "label" || op == "loop") {
+        entry.op = (op == "label") ? PACKET_PROGRAM_OP_LABEL : PACKET_PROGRAM_OP_LOOP;
+        if (!item.contains("label") || !item["label"].is_number_unsigned() || item["label"].get<uint32_t>() > 0xFF) {
+            return "label must be 0-255";
+        }
+        entry.label = item["label"].get<uint8_t>();
+        if (entry.op == PACKET_PROGRAM_OP_LOOP) {
+            if (!item.contains("count") || !item["count"].is_number_unsigned() ||
+                item["count"].get<uint32_t>() > UINT16_MAX) {
+                return "loop count must be 0-65535 (0 = forever)";
+            }
+            entry.repeat = item["count"].get<uint16_t>();
+        }
+    }
+    else if (op == "end") {
+        entry.op = PACKET_PROGRAM_OP_END;
+    }
+    else {
+        return "op must be packet, delay, label, loop or end";
+    }
+    return nullptr;
+}
+
+static json command_station_program_load_handler(const json& params) {
+    if (!params.is_object() || !params.contains("entries") || !params["entries"].is_array()) {
+        return {
             {"status", "error"},
-            {"message", "Params must be an object"}
+            {"message", "params must contain 'entries' array"}
         };
     }
-    
-    // Set zero bit override mask if provided
-    if (params.contains("zerobit_override_mask")) {
-        if (!params["zerobit_override_mask"].is_number_unsigned()) {
+
+    bool append = false;
+    if (params.contains("append")) {
+        if (!params["append"].is_boolean()) {
             return {
                 {"status", "error"},
-                {"message", "zerobit_override_mask must be a positive integer"}
+                {"message", "append must be a boolean"}
             };
         }
-        uint64_t mask = params["zerobit_override_mask"].get<uint64_t>();
-        CommandStation_SetZerobitOverrideMask(mask);
+        append = params["append"].get<bool>();
     }
-    
-    // Set zero bit deltaP if provided
-    if (params.contains("zerobit_deltaP") || params.contains("zerobit_delta")) {
-        // Support both old name (zerobit_delta) and new name (zerobit_deltaP) for backwards compatibility
-        const char* key = params.contains("zerobit_deltaP") ? "zerobit_deltaP" : "zerobit_delta";
-        if (!params[key].is_number_integer()) {
+
+    if (!append && PacketProgram_Clear() != 0) {
+        return {
+            {"status", "error"},
+            {"message", "Cannot load program while it is running"}
+        };
+    }
+
+    uint16_t index = 0;
+    for (const auto& item : params["entries"]) {
+        PacketProgramEntry_t entry;
+        const char* error = parse_program_entry(item, entry);
+        if (error) {
             return {
                 {"status", "error"},
-                {"message", "zerobit_deltaP must be an integer"}
+                {"message", error},
+                {"index", index}
             };
         }
-        int32_t delta = params[key].get<int32_t>();
-        CommandStation_SetZerobitDeltaP(delta);
-    }
-    
-    // Set zero bit deltaN if provided
-    if (params.contains("zerobit_deltaN")) {
-        if (!params["zerobit_deltaN"].is_number_integer()) {
+        if (PacketProgram_Append(&entry, 1) != 0) {
             return {
                 {"status", "error"},
-                {"message", "zerobit_deltaN must be an integer"}
+                {"message", "Program full or running"},
+                {"index", index},
+                {"max_entries", PACKET_PROGRAM_MAX_ENTRIES}
             };
         }
-        int32_t delta = params["zerobit_deltaN"].get<int32_t>();
-        CommandStation_SetZerobitDeltaN(delta);
+        index++;
     }
-    
+
     return {
         {"status", "ok"},
-        {"message", "Packet override parameters updated"}
+        {"message", "Program loaded"},
+        {"loaded", index},
+        {"entries", PacketProgram_Get(nullptr)}
     };
 }
 
-static json command_station_packet_reset_override_handler(const json& params) {
+static json command_station_program_run_handler(const json& params) {
     (void)params;  // Unused parameter
-    
-    // Reset all override parameters to 0
-    CommandStation_SetZerobitOverrideMask(0);
-    CommandStation_SetZerobitDeltaP(0);
-    CommandStation_SetZerobitDeltaN(0);
-    
+
+    const char* error = nullptr;
+    if (!CommandStation_RunProgram(&error)) {
+        return {
+            {"status", "error"},
+            {"message", error ? error : "Failed to start program"}
+        };
+    }
+
     return {
         {"status", "ok"},
-        {"message", "Packet override parameters reset to 0"}
+        {"message", "Program started"}
     };
 }
 
-static json command_station_packet_get_override_handler(const json& params) {
+static json command_station_program_stop_handler(const json& params) {
     (void)params;  // Unused parameter
-    
-    // Get current override parameters
-    uint64_t mask = CommandStation_GetZerobitOverrideMask();
-    int32_t deltaP = CommandStation_GetZerobitDeltaP();
-    int32_t deltaN = CommandStation_GetZerobitDeltaN();
-    
-    // Format mask as hex string for readability
-    char mask_str[20];
-    snprintf(mask_str, sizeof(mask_str), "0x%016llX", (unsigned long long)mask);
-    
+
+    CommandStation_StopProgram();
+
     return {
         {"status", "ok"},
-        {"zerobit_override_mask", mask_str},
-        {"zerobit_override_mask_decimal", mask},
-        {"zerobit_deltaP", deltaP},
-        {"zerobit_deltaN", deltaN}
+        {"message", "Program stop requested"}
     };
 }
 
-static json parameters_save_handler(const json& params) {
+static json command_station_program_status_handler(const json& params) {
     (void)params;  // Unused parameter
-    
-    if (parameter_manager_save() != 0) {
-        return {
-            {"status", "error"},
-            {"message", "Failed to save parameters to flash"}
-        };
-    }
-    
+
+    PacketProgramStatus_t status;
+    CommandStation_GetProgramStatus(&status);
+
     return {
         {"status", "ok"},
-        {"message", "Parameters saved to flash"}
+        {"entries", status.entries},
+        {"running", status.running},
+        {"pc", status.pc},
+        {"packets_sent", status.packets_sent}
     };
 }
 
-static json parameters_restore_handler(const json& params) {
+static json command_station_timing_profiles_handler(const json& params) {
     (void)params;  // Unused parameter
-    
-    if (parameter_manager_restore() != 0) {
-        return {
-            {"status", "error"},
-            {"message", "Failed to restore parameters from flash"}
-        };
+
+    uint8_t bit1_duration = 0;
+    uint8_t bit0_duration = 0;
+    get_dcc_bit1_duration(&bit1_duration);
+    get_dcc_bit0_duration(&bit0_duration);
+
+    json profiles = json::array();
+    for (const TimingProfile& profile : timing_profiles) {
+        bool configured = &profile == &timing_profiles[PACKET_TIMING_PROFILE_CONFIGURED];
+        profiles.push_back({
+            {"name", profile.name},
+            {"one_p", configured ? bit1_duration : profile.one_p},
+            {"one_n", configured ? bit1_duration : profile.one_n},
+            {"zero_p", configured ? bit0_duration : profile.zero_p},
+            {"zero_n", configured ? bit0_duration : profile.zero_n}
+        });
     }
-    
+
     return {
         {"status", "ok"},
-        {"message", "Parameters restored from flash"}
+        {"profiles", profiles}
     };
 }
 
-static json parameters_factory_reset_handler(const json& params) {
-    (void)params;  // Unused parameter
-    
-    parameter_manager_factory_reset();
-    
-    return {
-        {"status", "ok"},
-        {"message", "Factory reset completed - all parameters restored to defaults"}
-    };
+struct CvReadJob {
+    ServiceModeRequest_t request;
+    ServiceModeResult_t result;
+    const char* error;
+    bool ok;
+};
+
+// A byte read sends up to nine verify sequences
+static void command_station_cv_read_run(RpcJob& job) {
+    CvReadJob& cv = rpc_job_data<CvReadJob>(job);
+    cv.error = nullptr;
+    cv.ok = CommandStation_ServiceMode(&cv.request, &cv.result, &cv.error);
 }
 
-static json system_reboot_handler(const json& params) {
-    (void)params;  // Unused parameter
-    
-    // Return success response before rebooting
+static json command_station_cv_read_response(const RpcJob& job) {
+    const CvReadJob& cv = rpc_job_data<CvReadJob>(job);
+    const ServiceModeRequest_t& request = cv.request;
+    const ServiceModeResult_t& result = cv.result;
+    if (!cv.ok) {
+        return {
+            {"status", "error"},
+            {"message", cv.error ? cv.error : "Service mode operation failed"}
+        };
+    }
+
     json response = {
         {"status", "ok"},
-        {"message", "System rebooting..."}
+        {"cv", request.cv},
+        {"ack", result.ack},
+        {"verifies", result.verifies},
+        {"duration_ms", result.duration_ms}
     };
-    
-    // Small delay to allow response to be sent
-    //TODO: ...probably will never send response before rebooting
-    osDelay(100);
-    
-    // Perform system reset
-    NVIC_SystemReset();
-    
-    // This line will never be reached
+    if (request.op == SERVICE_MODE_READ_BYTE) {
+        response["value"] = result.value;
+    }
+    if (result.ack) {
+        response["ack_delay_ms"] = result.ack_delay_ms;
+    }
     return response;
 }
 
-static json get_voltage_feedback_mv_handler(const json& params) {
-    uint16_t voltage_mv = 0;
-    
-    // Check if averaging parameters are provided
-    if (params.contains("num_samples") && params.contains("sample_delay_ms")) {
-        // Validate num_samples
-        if (!params["num_samples"].is_number_unsigned()) {
+static json command_station_cv_read_handler(const json& params) {
+    ServiceModeRequest_t request = {};
+    request.op = SERVICE_MODE_READ_BYTE;
+
+    if (!params.contains("cv") || !params["cv"].is_number_unsigned() ||
+        params["cv"].get<uint64_t>() > 1024u) {
+        return {
+            {"status", "error"},
+            {"message", "Missing or invalid 'cv' parameter"}
+        };
+    }
+    uint32_t cv = params["cv"].get<uint32_t>();
+    if (cv < 1 || cv > 1024) {
+        return {
+            {"status", "error"},
+            {"message", "cv must be 1-1024"}
+        };
+    }
+    request.cv = static_cast<uint16_t>(cv);
+
+    if (params.contains("mode")) {
+        if (!params["mode"].is_string()) {
             return {
                 {"status", "error"},
-                {"message", "num_samples must be a positive integer"}
+                {"message", "mode must be a string"}
             };
         }
-        
-        // Validate sample_delay_ms
-        if (!params["sample_delay_ms"].is_number_unsigned()) {
+        const json::string_t& mode = params["mode"].get_ref<const json::string_t&>();
+        if (mode == "read") {
+            request.op = SERVICE_MODE_READ_BYTE;
+        } else if (mode == "verify_byte") {
+            request.op = SERVICE_MODE_VERIFY_BYTE;
+        } else if (mode == "verify_bit") {
+            request.op = SERVICE_MODE_VERIFY_BIT;
+        } else {
             return {
                 {"status", "error"},
-                {"message", "sample_delay_ms must be a positive integer"}
+                {"message", "mode must be read, verify_byte or verify_bit"}
             };
         }
-        
-        uint8_t num_samples = params["num_samples"].get<uint8_t>();
-        uint32_t sample_delay_ms = params["sample_delay_ms"].get<uint32_t>();
-        
-        // Validate parameter limits
-        if (num_samples > 16) {
+    }
+
+    if (request.op != SERVICE_MODE_READ_BYTE) {
+        uint32_t limit = request.op == SERVICE_MODE_VERIFY_BIT ? 1 : 255;
+        if (!params.contains("value") || !params["value"].is_number_unsigned() ||
+            params["value"].get<uint32_t>() > limit) {
             return {
                 {"status", "error"},
-                {"message", "num_samples must be between 1 and 16"}
+                {"message", request.op == SERVICE_MODE_VERIFY_BIT ? "value must be 0 or 1" : "value must be 0-255"}
             };
         }
-        
-        if (sample_delay_ms > 1000) {
+        request.value = params["value"].get<uint8_t>();
+    }
+    if (request.op == SERVICE_MODE_VERIFY_BIT) {
+        if (!params.contains("bit") || !params["bit"].is_number_unsigned() || params["bit"].get<uint32_t>() > 7) {
             return {
                 {"status", "error"},
-                {"message", "sample_delay_ms must be between 0 and 1000"}
+                {"message", "bit must be 0-7"}
             };
         }
-        
-        // Call the averaged version
-        if (get_voltage_feedback_mv_averaged(&voltage_mv, num_samples, sample_delay_ms) != 0) {
+        request.bit = params["bit"].get<uint8_t>();
+    }
+
+    CvReadJob job = {};
+    job.request = request;
+    return rpc_job_execute(params, "command_station_cv_read", command_station_cv_read_run,
+                           command_station_cv_read_response, job);
+}
+
+// RailCom frames per JSON response, limited by RPC_TX_BUFFER_SIZE
+#define RAILCOM_JSON_MAX_FRAMES 16u
+
+static json railcom_read_handler(const json& params) {
+    uint32_t max = RAILCOM_JSON_MAX_FRAMES;
+    if (params.contains("max")) {
+        if (!params["max"].is_number_unsigned() || params["max"].get<uint32_t>() == 0 ||
+            params["max"].get<uint32_t>() > RAILCOM_JSON_MAX_FRAMES) {
             return {
                 {"status", "error"},
-                {"message", "Failed to read voltage feedback (averaged)"}
+                {"message", "max must be 1-16"}
             };
         }
-        
-        return {
-            {"status", "ok"},
-            {"voltage_mv", voltage_mv},
-            {"averaged", true},
-            {"num_samples", num_samples},
-            {"sample_delay_ms", sample_delay_ms}
-        };
+        max = params["max"].get<uint32_t>();
     }
-    
-    // No averaging parameters, use the basic version
-    if (get_voltage_feedback_mv(&voltage_mv) != 0) {
-        return {
-            {"status", "error"},
-            {"message", "Failed to read voltage feedback"}
+
+    RailcomFrame_t frames[RAILCOM_JSON_MAX_FRAMES];
+    uint32_t count = railcom_read(frames, max);
+
+    json list = json::array();
+    for (uint32_t i = 0; i < count; i++) {
+        const RailcomFrame_t& frame = frames[i];
+        json item = {
+            {"seq", frame.packet_seq},
+            {"tick_ms", frame.tick_ms},
+            {"flags", frame.flags},
+            {"ch1", json::array()},
+            {"ch2", json::array()}
         };
+        for (uint8_t j = 0; j < frame.ch1_count; j++) {
+            item["ch1"].push_back(frame.ch1[j]);
+        }
+        for (uint8_t j = 0; j < frame.ch2_count; j++) {
+            item["ch2"].push_back(frame.ch2[j]);
+        }
+        uint8_t id = 0;
+        uint8_t data = 0;
+        if (railcom_channel1_datagram(&frame, &id, &data)) {
+            item["id"] = id;
+            item["data"] = data;
+        }
+        list.push_back(item);
     }
-    
+
+    RailcomStats_t stats;
+    railcom_get_stats(&stats);
     return {
         {"status", "ok"},
-        {"voltage_mv", voltage_mv}
+        {"frames", list},
+        {"pending", stats.pending}
     };
 }
 
-static json get_current_feedback_ma_handler(const json& params) {
-    uint16_t current_ma = 0;
-    
-    // Check if averaging parameters are provided
-    if (params.contains("num_samples") && params.contains("sample_delay_ms")) {
-        // Validate num_samples
-        if (!params["num_samples"].is_number_unsigned()) {
+static json railcom_status_handler(const json& params) {
+    (void)params;  // Unused parameter
+
+    RailcomStats_t stats;
+    railcom_get_stats(&stats);
+    return {
+        {"status", "ok"},
+        {"cutouts", stats.cutouts},
+        {"frames", stats.frames},
+        {"empty", stats.empty},
+        {"dropped", stats.dropped},
+        {"invalid", stats.invalid},
+        {"pending", stats.pending},
+        {"high_water", stats.high_water},
+        {"capacity", RAILCOM_RING_SIZE}
+    };
+}
+
+static json sniffer_control_handler(const json& params) {
+    if (!params.contains("enable") || !params["enable"].is_boolean()) {
+        return {
+            {"status", "error"},
+            {"message", "Missing or invalid 'enable' parameter"}
+        };
+    }
+    bool enable = params["enable"].get<bool>();
+
+    bool widths = false;
+    if (params.contains("widths")) {
+        if (!params["widths"].is_boolean()) {
             return {
                 {"status", "error"},
-                {"message", "num_samples must be a positive integer"}
+                {"message", "widths must be a boolean"}
             };
         }
-        
-        // Validate sample_delay_ms
-        if (!params["sample_delay_ms"].is_number_unsigned()) {
+        widths = params["widths"].get<bool>();
+    }
+
+    bool clear = false;
+    if (params.contains("clear")) {
+        if (!params["clear"].is_boolean()) {
             return {
                 {"status", "error"},
-                {"message", "sample_delay_ms must be a positive integer"}
+                {"message", "clear must be a boolean"}
             };
         }
-        
-        uint8_t num_samples = params["num_samples"].get<uint8_t>();
-        uint32_t sample_delay_ms = params["sample_delay_ms"].get<uint32_t>();
-        
-        // Validate parameter limits
-        if (num_samples > 16) {
-            return {
-                {"status", "error"},
-                {"message", "num_samples must be between 1 and 16"}
-            };
-        }
-        
-        if (sample_delay_ms > 1000) {
+        clear = params["clear"].get<bool>();
+    }
+
+    sniffer_enable(false, false);
+    if (clear) {
+        sniffer_clear();
+    }
+    if (enable) {
+        sniffer_enable(true, widths);
+    }
+
+    return {
+        {"status", "ok"},
+        {"message", enable ? "Sniffer enabled" : "Sniffer disabled"}
+    };
+}
+
+static json sniffer_status_handler(const json& params) {
+    (void)params;  // Unused parameter
+
+    SnifferStats_t stats;
+    sniffer_get_stats(&stats);
+    return {
+        {"status", "ok"},
+        {"enabled", stats.enabled},
+        {"widths", stats.widths},
+        {"packets", stats.packets},
+        {"checksum_errors", stats.checksum_errors},
+        {"framing_errors", stats.framing_errors},
+        {"dropped", stats.dropped},
+        {"used", stats.used},
+        {"capacity", stats.capacity}
+    };
+}
+
+// Sniffer records per JSON response, limited by RPC_TX_BUFFER_SIZE
+#define SNIFFER_JSON_MAX_RECORDS 8u
+
+static json sniffer_read_handler(const json& params) {
+    uint32_t max = SNIFFER_JSON_MAX_RECORDS;
+    if (params.contains("max")) {
+        if (!params["max"].is_number_unsigned() || params["max"].get<uint32_t>() == 0 ||
+            params["max"].get<uint32_t>() > SNIFFER_JSON_MAX_RECORDS) {
             return {
                 {"status", "error"},
-                {"message", "sample_delay_ms must be between 0 and 1000"}
+                {"message", "max must be 1-8"}
             };
         }
-        
-        // Call the averaged version
-        if (get_current_feedback_ma_averaged(&current_ma, num_samples, sample_delay_ms) != 0) {
+        max = params["max"].get<uint32_t>();
+    }
+
+    static uint8_t buffer[SNIFFER_JSON_MAX_RECORDS * SNIFFER_MAX_RECORD];
+    uint32_t records = 0;
+    uint32_t length = sniffer_read(buffer, sizeof(buffer), max, &records);
+
+    // Half bit durations are left out, the binary opcode delivers them
+    json packets = json::array();
+    for (uint32_t offset = 0; offset < length;) {
+        const uint8_t* record = &buffer[offset];
+        uint8_t count = record[12];
+        json bytes = json::array();
+        for (uint8_t i = 0; i < count; i++) {
+            bytes.push_back(record[SNIFFER_HEADER_SIZE + i]);
+        }
+        packets.push_back({
+            {"time_us", rpc_bin_get_u32(&record[2])},
+            {"tick_ms", rpc_bin_get_u32(&record[6])},
+            {"checksum_ok", (record[10] & SNIFFER_FLAG_CHECKSUM_OK) != 0},
+            {"preamble", record[11]},
+            {"bytes", bytes}
+        });
+        offset += rpc_bin_get_u16(record);
+    }
+
+    SnifferStats_t stats;
+    sniffer_get_stats(&stats);
+    return {
+        {"status", "ok"},
+        {"packets", packets},
+        {"used", stats.used}
+    };
+}
+
+// Histogram bins from the first to the last non-empty one
+static json edge_histogram(const uint32_t* bins, uint32_t count, uint32_t first_us, uint32_t bin_us) {
+    uint32_t first = 0;
+    while (first < count && bins[first] == 0) {
+        first++;
+    }
+    uint32_t last = count;
+    while (last > first && bins[last - 1] == 0) {
+        last--;
+    }
+    json counts = json::array();
+    for (uint32_t i = first; i < last; i++) {
+        counts.push_back(bins[i]);
+    }
+    return {
+        {"first_us", first_us + first * bin_us},
+        {"bin_us", bin_us},
+        {"counts", counts}
+    };
+}
+
+static double edge_mean(const EdgeStatsPhase_t& phase) {
+    return phase.count ? static_cast<double>(phase.sum_us) / phase.count : 0.0;
+}
+
+static json edge_class_stats(const EdgeStats_t& stats, uint32_t cls) {
+    const EdgeStatsPhase_t& p = stats.phase[cls][stats.high_phase];
+    const EdgeStatsPhase_t& n = stats.phase[cls][stats.high_phase ^ 1u];
+    uint32_t count = p.count + n.count;
+    uint16_t min_us = p.min_us < n.min_us ? p.min_us : n.min_us;
+    uint16_t max_us = p.max_us > n.max_us ? p.max_us : n.max_us;
+    double mean = count ? static_cast<double>(p.sum_us + n.sum_us) / count : 0.0;
+
+    json result = {
+        {"count", count},
+        {"min_us", count ? min_us : 0},
+        {"max_us", max_us},
+        {"mean_us", mean},
+        {"p_count", p.count},
+        {"p_mean_us", edge_mean(p)},
+        {"n_count", n.count},
+        {"n_mean_us", edge_mean(n)},
+        {"asymmetry_us", (p.count && n.count) ? edge_mean(p) - edge_mean(n) : 0.0}
+    };
+    if (cls == EDGE_STATS_ONE) {
+        result["histogram"] = edge_histogram(stats.one_bins, EDGE_STATS_ONE_BINS,
+                                             EDGE_STATS_MIN_US, EDGE_STATS_ONE_BIN_US);
+    } else {
+        result["histogram"] = edge_histogram(stats.zero_bins, EDGE_STATS_ZERO_BINS,
+                                             EDGE_STATS_ZERO_FIRST_US, EDGE_STATS_ZERO_BIN_US);
+        result["overflow"] = stats.zero_overflow;
+    }
+    return result;
+}
+
+static json decoder_edge_stats_handler(const json& params) {
+    bool reset = false;
+    if (params.contains("reset")) {
+        if (!params["reset"].is_boolean()) {
             return {
                 {"status", "error"},
-                {"message", "Failed to read current feedback (averaged)"}
+                {"message", "reset must be a boolean"}
             };
         }
-        
-        return {
-            {"status", "ok"},
-            {"current_ma", current_ma},
-            {"averaged", true},
-            {"num_samples", num_samples},
-            {"sample_delay_ms", sample_delay_ms}
-        };
+        reset = params["reset"].get<bool>();
     }
-    
-    // No averaging parameters, use the basic version
-    if (get_current_feedback_ma(&current_ma) != 0) {
-        return {
-            {"status", "error"},
-            {"message", "Failed to read current feedback"}
-        };
+
+    static EdgeStats_t stats;
+    edge_stats_get(&stats);
+    if (reset) {
+        edge_stats_reset();
     }
-    
+
     return {
         {"status", "ok"},
-        {"current_ma", current_ma}
+        {"edges", stats.edges},
+        {"glitches", stats.glitches},
+        {"one", edge_class_stats(stats, EDGE_STATS_ONE)},
+        {"zero", edge_class_stats(stats, EDGE_STATS_ZERO)}
     };
 }
 
-static json get_gpio_input_handler(const json& params) {
-    // Check if pin parameter exists
-    if (!params.contains("pin") || !params["pin"].is_number_integer()) {
-        return {
-            {"status", "error"},
-            {"message", "Missing or invalid 'pin' parameter (must be 1-16)"}
-        };
+// Histogram bins from the first to the last non-empty one, in cycles
+static json timing_histogram(const uint32_t* bins, uint32_t count, int32_t first_cycles) {
+    uint32_t first = 0;
+    while (first < count && bins[first] == 0) {
+        first++;
     }
-    
-    int pin_num = params["pin"].get<int>();
-    
-    // Validate pin number
-    if (pin_num < 1 || pin_num > 16) {
-        return {
-            {"status", "error"},
-            {"message", "Pin number must be between 1 and 16"}
-        };
+    uint32_t last = count;
+    while (last > first && bins[last - 1] == 0) {
+        last--;
     }
-    
-    int value = 0;
-    
-    // IO16 is mapped to BUTTON_USER (read-only)
-    // BSP_PB_GetState returns: 0=not pressed, 1=pressed
-    // We return: 0=not pushed, 1=pushed (no inversion needed)
-    if (pin_num == 16) {
-        // Read button state directly
-        value = BSP_PB_GetState(BUTTON_USER);
-    } else {
-        GPIO_PinState state = GPIO_PIN_RESET;
-        
-        // Read the appropriate GPIO pin based on pin number
-        switch (pin_num) {
-            case 1:  state = HAL_GPIO_ReadPin(IO1_GPIO_Port, IO1_Pin); break;
-            case 2:  state = HAL_GPIO_ReadPin(IO2_GPIO_Port, IO2_Pin); break;
-            case 3:  state = HAL_GPIO_ReadPin(IO3_GPIO_Port, IO3_Pin); break;
-            case 4:  state = HAL_GPIO_ReadPin(IO4_GPIO_Port, IO4_Pin); break;
-            case 5:  state = HAL_GPIO_ReadPin(IO5_GPIO_Port, IO5_Pin); break;
-            case 6:  state = HAL_GPIO_ReadPin(IO6_GPIO_Port, IO6_Pin); break;
-            case 7:  state = HAL_GPIO_ReadPin(IO7_GPIO_Port, IO7_Pin); break;
-            case 8:  state = HAL_GPIO_ReadPin(IO8_GPIO_Port, IO8_Pin); break;
-            case 9:  state = HAL_GPIO_ReadPin(IO9_GPIO_Port, IO9_Pin); break;
-            case 10: state = HAL_GPIO_ReadPin(IO10_GPIO_Port, IO10_Pin); break;
-            case 11: state = HAL_GPIO_ReadPin(IO11_GPIO_Port, IO11_Pin); break;
-            case 12: state = HAL_GPIO_ReadPin(IO12_GPIO_Port, IO12_Pin); break;
-            case 13: state = HAL_GPIO_ReadPin(IO13_GPIO_Port, IO13_Pin); break;
-            case 14: state = HAL_GPIO_ReadPin(IO14_GPIO_Port, IO14_Pin); break;
-            case 15: state = HAL_GPIO_ReadPin(IO15_GPIO_Port, IO15_Pin); break;
-            default:
+    json counts = json::array();
+    for (uint32_t i = first; i < last; i++) {
+        counts.push_back(bins[i]);
+    }
+    return {
+        {"first_cycles", first_cycles + static_cast<int32_t>(first * EDGE_TIMING_BIN_CYCLES)},
+        {"bin_cycles", EDGE_TIMING_BIN_CYCLES},
+        {"counts", counts}
+    };
+}
+
+static json latency_stats(const EdgeTimingLatency_t& l) {
+    return {
+        {"count", l.count},
+        {"min_cycles", l.count ? l.min : 0u},
+        {"max_cycles", l.max},
+        {"mean_cycles", l.count ? static_cast<double>(l.sum) / l.count : 0.0}
+    };
+}
+
+static json error_stats(const EdgeTimingError_t& e) {
+    return {
+        {"count", e.count},
+        {"min_cycles", e.count ? e.min : 0},
+        {"max_cycles", e.count ? e.max : 0},
+        {"mean_cycles", e.count ? static_cast<double>(e.sum) / e.count : 0.0}
+    };
+}
+
+static json command_station_edge_timing_handler(const json& params) {
+    bool reset = false;
+    if (params.contains("reset")) {
+        if (!params["reset"].is_boolean()) {
+            return {
+                {"status", "error"},
+                {"message", "reset must be a boolean"}
+            };
+        }
+        reset = params["reset"].get<bool>();
+    }
+
+    static EdgeTiming_t timing;
+    edge_timing_get(&timing);
+    if (reset) {
+        edge_timing_reset();
+    }
+
+    return {
+        {"status", "ok"},
+        {"active", timing.active},
+        {"cpu_hz", SystemCoreClock},
+        {"cycles_per_tick", timing.cycles_per_tick},
+        {"half_bits", timing.half_bits},
+        {"missed", timing.missed},
+        {"late", timing.late},
+        {"latency", {
+            {"p", latency_stats(timing.latency[0])},
+            {"n", latency_stats(timing.latency[1])},
+            {"histogram", timing_histogram(timing.latency_bins, EDGE_TIMING_LATENCY_BINS, 0)},
+            {"overflow", timing.latency_overflow}
+        }},
+        {"error", {
+            {"p", error_stats(timing.error[0])},
+            {"n", error_stats(timing.error[1])},
+            {"histogram", timing_histogram(timing.error_bins, EDGE_TIMING_ERROR_BINS, EDGE_TIMING_ERROR_FIRST)},
+            {"underflow", timing.error_underflow},
+            {"overflow", timing.error_overflow}
+        }}
+    };
+}
+
+// Set the scope trigger when "condition" is given, report it either way
+static json command_station_scope_trigger_handler(const json& params) {
+    if (params.contains("condition")) {
+        ScopeTrigger_t trigger = {};
+        trigger.width_bits = 1;
+
+        bool found = false;
+        if (params["condition"].is_string()) {
+            const auto& name = params["condition"].get_ref<const json::string_t&>();
+            for (uint32_t c = 0; c < SCOPE_TRIGGER_COUNT; ++c) {
+                if (name == CommandStation_ScopeTriggerName(static_cast<ScopeTriggerCondition_t>(c))) {
+                    trigger.condition = static_cast<uint8_t>(c);
+                    found = true;
+                }
+            }
+        }
+        if (!found) {
+            return {
+                {"status", "error"},
+                {"message", "condition must be off, packet_seq, match, override_bit or railcom_error"}
+            };
+        }
+
+        if (params.contains("single")) {
+            if (!params["single"].is_boolean()) {
                 return {
                     {"status", "error"},
-                    {"message", "Invalid pin number"}
+                    {"message", "single must be a boolean"}
                 };
+            }
+            trigger.single = params["single"].get<bool>();
+        }
+        if (params.contains("width_bits")) {
+            if (!params["width_bits"].is_number_unsigned() || params["width_bits"].get<uint64_t>() == 0u ||
+                params["width_bits"].get<uint64_t>() > 255u) {
+                return {
+                    {"status", "error"},
+                    {"message", "width_bits must be 1-255"}
+                };
+            }
+            trigger.width_bits = params["width_bits"].get<uint8_t>();
+        }
+
+        if (trigger.condition == SCOPE_TRIGGER_PACKET_SEQ) {
+            if (!params.contains("packet_seq") || !params["packet_seq"].is_number_unsigned() ||
+                params["packet_seq"].get<uint64_t>() == 0u || params["packet_seq"].get<uint64_t>() > UINT32_MAX) {
+                return {
+                    {"status", "error"},
+                    {"message", "packet_seq must be 1-4294967295"}
+                };
+            }
+            trigger.packet_seq = params["packet_seq"].get<uint32_t>();
+        }
+        else if (trigger.condition == SCOPE_TRIGGER_MATCH) {
+            if (!params.contains("match") || !params["match"].is_array() || params["match"].empty() ||
+                params["match"].size() > SCOPE_TRIGGER_MAX_MATCH) {
+                return {
+                    {"status", "error"},
+                    {"message", "match must be an array of 1-6 bytes"}
+                };
+            }
+            for (const auto& byte : params["match"]) {
+                if (!byte.is_number_unsigned() || byte.get<uint64_t>() > 255u) {
+                    return {
+                        {"status", "error"},
+                        {"message", "match must be an array of 1-6 bytes"}
+                    };
+                }
+                trigger.match[trigger.match_length++] = byte.get<uint8_t>();
+            }
+        }
+        else if (trigger.condition == SCOPE_TRIGGER_OVERRIDE_BIT) {
+            if (!params.contains("bit") || !params["bit"].is_number_unsigned() ||
+                params["bit"].get<uint64_t>() >= PACKET_TIMING_MAX_BITS) {
+                return {
+                    {"status", "error"},
+                    {"message", "bit must be a bit position of the packet, 0 = start bit"}
+                };
+            }
+            trigger.bit = params["bit"].get<uint16_t>();
+        }
+
+        CommandStation_SetScopeTrigger(&trigger);
+    }
+
+    ScopeTrigger_t trigger;
+    ScopeTriggerStatus_t status;
+    CommandStation_GetScopeTrigger(&trigger, &status);
+    json response = {
+        {"status", "ok"},
+        {"condition", CommandStation_ScopeTriggerName(static_cast<ScopeTriggerCondition_t>(trigger.condition))},
+        {"single", trigger.single},
+        {"width_bits", trigger.width_bits},
+        {"fired", status.fired},
+        {"last_packet_seq", status.last_packet_seq}
+    };
+    if (trigger.condition == SCOPE_TRIGGER_PACKET_SEQ) {
+        response["packet_seq"] = trigger.packet_seq;
+    }
+    else if (trigger.condition == SCOPE_TRIGGER_MATCH) {
+        json match = json::array();
+        for (uint32_t i = 0; i < trigger.match_length; ++i) {
+            match.push_back(trigger.match[i]);
+        }
+        response["match"] = match;
+    }
+    else if (trigger.condition == SCOPE_TRIGGER_OVERRIDE_BIT) {
+        response["bit"] = trigger.bit;
+    }
+    return response;
+}
+
+static json trace_log_status_handler(const json& params) {
+    if (params.contains("level")) {
+        if (!params["level"].is_number_unsigned() || params["level"].get<uint32_t>() > TRACE_LEVEL_VERBOSE) {
+            return {
+                {"status", "error"},
+                {"message", "level must be 0-4"}
+            };
+        }
+        if (trace_log_set_level(params["level"].get<uint8_t>()) != 0) {
+            return {
+                {"status", "error"},
+                {"message", "Failed to set level"}
+            };
+        }
+    }
+
+    TraceLogStats_t stats;
+    trace_log_get_stats(&stats);
+    return {
+        {"status", "ok"},
+        {"level", stats.level},
+        {"records", stats.records},
+        {"dropped", stats.dropped},
+        {"filtered", stats.filtered},
+        {"pending", stats.pending},
+        {"high_water", stats.high_water},
+        {"capacity", TRACE_LOG_RECORDS}
+    };
+}
+
+// Counters up to this call, reset clears them after reading
+static json decoder_packet_stats_handler(const json& params) {
+    bool reset = false;
+    if (params.contains("reset")) {
+        if (!params["reset"].is_boolean()) {
+            return {
+                {"status", "error"},
+                {"message", "reset must be a boolean"}
+            };
+        }
+        reset = params["reset"].get<bool>();
+    }
+
+    PacketStats_t stats;
+    packet_stats_get(&stats);
+    if (reset) {
+        packet_stats_reset();
+    }
+
+    json types = json::object();
+    for (uint32_t i = 0; i < PACKET_STATS_TYPE_COUNT; i++) {
+        types[packet_stats_type_name(static_cast<PacketStatsType_t>(i))] = stats.types[i];
+    }
+    return {
+        {"status", "ok"},
+        {"packets", stats.packets},
+        {"checksum_errors", stats.checksum_errors},
+        {"framing_errors", stats.framing_errors},
+        {"short_preambles", stats.short_preambles},
+        {"timing_errors", stats.timing_errors},
+        {"timing_packets", stats.timing_packets},
+        {"min_preamble", stats.min_preamble},
+        {"types", types}
+    };
+}
+
+// emulate selects the decoder emulation for this start, ack and railcom its responses
+static json decoder_start_handler(const json& params) {
+    bool emulate = false;
+    DecoderEmulation_t emulation = {true, true};
+    for (const char* key : {"emulate", "ack", "railcom"}) {
+        if (params.contains(key) && !params[key].is_boolean()) {
+            return {
+                {"status", "error"},
+                {"message", std::string(key) + " must be a boolean"}
+            };
         }
-        
-        value = (state == GPIO_PIN_SET) ? 1 : 0;
     }
+    if (params.contains("emulate")) {
+        emulate = params["emulate"].get<bool>();
+    }
+    if (params.contains("ack")) {
+        emulation.ack = params["ack"].get<bool>();
+    }
+    if (params.contains("railcom")) {
+        emulation.railcom = params["railcom"].get<bool>();
+    }
+
+    Decoder_SetEmulation(emulate ? &emulation : nullptr);
+    Decoder_Start();
     
     return {
         {"status", "ok"},
-        {"pin", pin_num},
-        {"value", value}
+        {"message", emulate ? "Decoder emulation started" : "Decoder started"}
     };
 }
 
-static json get_gpio_inputs_handler(const json& params) {
+static json decoder_stop_handler(const json& params) {
     (void)params;  // Unused parameter
     
-    uint16_t gpio_word = 0;
-    
-    // Read all GPIO inputs and pack into a 16-bit word
-    // Bit 0 = IO1, Bit 1 = IO2, ..., Bit 15 = IO16
-    if (HAL_GPIO_ReadPin(IO1_GPIO_Port, IO1_Pin) == GPIO_PIN_SET)   gpio_word |= (1 << 0);
-    if (HAL_GPIO_ReadPin(IO2_GPIO_Port, IO2_Pin) == GPIO_PIN_SET)   gpio_word |= (1 << 1);
-    if (HAL_GPIO_ReadPin(IO3_GPIO_Port, IO3_Pin) == GPIO_PIN_SET)   gpio_word |= (1 << 2);
-    if (HAL_GPIO_ReadPin(IO4_GPIO_Port, IO4_Pin) == GPIO_PIN_SET)   gpio_word |= (1 << 3);
-    if (HAL_GPIO_ReadPin(IO5_GPIO_Port, IO5_Pin) == GPIO_PIN_SET)   gpio_word |= (1 << 4);
-    if (HAL_GPIO_ReadPin(IO6_GPIO_Port, IO6_Pin) == GPIO_PIN_SET)   gpio_word |= (1 << 5);
-    if (HAL_GPIO_ReadPin(IO7_GPIO_Port, IO7_Pin) == GPIO_PIN_SET)   gpio_word |= (1 << 6);
-    if (HAL_GPIO_ReadPin(IO8_GPIO_Port, IO8_Pin) == GPIO_PIN_SET)   gpio_word |= (1 << 7);
-    if (HAL_GPIO_ReadPin(IO9_GPIO_Port, IO9_Pin) == GPIO_PIN_SET)   gpio_word |= (1 << 8);
-    if (HAL_GPIO_ReadPin(IO10_GPIO_Port, IO10_Pin) == GPIO_PIN_SET) gpio_word |= (1 << 9);
-    if (HAL_GPIO_ReadPin(IO11_GPIO_Port, IO11_Pin) == GPIO_PIN_SET) gpio_word |= (1 << 10);
-    if (HAL_GPIO_ReadPin(IO12_GPIO_Port, IO12_Pin) == GPIO_PIN_SET) gpio_word |= (1 << 11);
-    if (HAL_GPIO_ReadPin(IO13_GPIO_Port, IO13_Pin) == GPIO_PIN_SET) gpio_word |= (1 << 12);
-    if (HAL_GPIO_ReadPin(IO14_GPIO_Port, IO14_Pin) == GPIO_PIN_SET) gpio_word |= (1 << 13);
-    if (HAL_GPIO_ReadPin(IO15_GPIO_Port, IO15_Pin) == GPIO_PIN_SET) gpio_word |= (1 << 14);
-    // IO16 is mapped to BUTTON_USER (BSP_PB_GetState: 0=not pressed, 1=pressed)
-    // We set bit when pressed
-    if (BSP_PB_GetState(BUTTON_USER) == 1) gpio_word |= (1 << 15);
-    
-    // Format as hex string for easy reading
-    char hex_str[7];  // "0x" + 4 hex digits + null terminator
-    snprintf(hex_str, sizeof(hex_str), "0x%04X", gpio_word);
+    Decoder_Stop();
     
     return {
         {"status", "ok"},
-        {"value", gpio_word},
-        {"hex", hex_str}
+        {"message", "Decoder stopped"}
     };
 }
 
-static json configure_gpio_output_handler(const json& params) {
-    // Check if pin parameter exists
-    if (!params.contains("pin") || !params["pin"].is_number_integer()) {
+static json decoder_emulator_status_handler(const json& params) {
+    (void)params;
+
+    DecoderEmulationStats_t stats;
+    Decoder_GetEmulationStats(&stats);
+
+    return {
+        {"status", "ok"},
+        {"running", stats.running},
+        {"emulating", stats.emulating},
+        {"ack", stats.ack},
+        {"railcom", stats.railcom},
+        {"packets", stats.packets},
+        {"acks", stats.acks},
+        {"ch1", stats.ch1},
+        {"ch2", stats.ch2},
+        {"bidi_busy", stats.bidi_busy},
+        {"last_response_us", stats.last_response_us},
+        {"max_response_us", stats.max_response_us},
+        {"late", stats.late},
+        {"cvs", stats.cvs},
+        {"capacity", DECODER_CV_CAPACITY}
+    };
+}
+
+// Read or write one CV of the emulated decoder, index selects the page of CV257-512
+static json decoder_cv_handler(const json& params) {
+    if (params.contains("reset")) {
+        if (!params["reset"].is_boolean()) {
+            return {
+                {"status", "error"},
+                {"message", "reset must be a boolean"}
+            };
+        }
+        if (params["reset"].get<bool>()) {
+            Decoder_ResetCvs();
+            return {
+                {"status", "ok"},
+                {"message", "CVs reset to the defaults"}
+            };
+        }
+    }
+
+    if (!params.contains("cv") || !params["cv"].is_number_unsigned() ||
+        params["cv"].get<uint64_t>() > 1024u) {
         return {
             {"status", "error"},
-            {"message", "Missing or invalid 'pin' parameter (must be 1-16)"}
+            {"message", "Missing or invalid cv (1-1024)"}
         };
     }
-    
-    // Check if state parameter exists
-    if (!params.contains("state") || !params["state"].is_number_integer()) {
+    uint32_t const cv = params["cv"].get<uint32_t>();
+
+    uint32_t page = DECODER_CV_PAGE_CURRENT;
+    if (params.contains("index")) {
+        if (!params["index"].is_number_unsigned() || params["index"].get<uint64_t>() > 0xFFFFu) {
+            return {
+                {"status", "error"},
+                {"message", "index must be 0-65535"}
+            };
+        }
+        page = params["index"].get<uint32_t>();
+    }
+
+    if (params.contains("value")) {
+        if (!params["value"].is_number_unsigned() || params["value"].get<uint64_t>() > 255u) {
+            return {
+                {"status", "error"},
+                {"message", "value must be 0-255"}
+            };
+        }
+        if (Decoder_WriteCv(cv, page, static_cast<uint8_t>(params["value"].get<uint32_t>())) != 0) {
+            return {
+                {"status", "error"},
+                {"message", "Invalid cv or CV store full"}
+            };
+        }
+    }
+
+    uint8_t value = 0;
+    if (Decoder_ReadCv(cv, page, &value) != 0) {
         return {
             {"status", "error"},
-            {"message", "Missing or invalid 'state' parameter (must be 0 or 1)"}
+            {"message", "Missing or invalid cv (1-1024)"}
         };
     }
-    
-    int pin_num = params["pin"].get<int>();
-    int state = params["state"].get<int>();
-    
-    // Validate pin number
-    if (pin_num < 1 || pin_num > 16) {
-        return {
-            {"status", "error"},
-            {"message", "Pin number must be between 1 and 16"}
-        };
+
+    json result = {
+        {"status", "ok"},
+        {"cv", cv},
+        {"value", value}
+    };
+    if (page != DECODER_CV_PAGE_CURRENT) {
+        result["index"] = page;
     }
-    
-    // IO16 is mapped to BUTTON_USER and cannot be configured as output
-    if (pin_num == 16) {
+    return result;
+}
+
+static json decoder_track_handler(const json& params) {
+    if (!params.contains("enable") || !params["enable"].is_boolean()) {
         return {
             {"status", "error"},
-            {"message", "IO16 is mapped to BUTTON_USER and is read-only"}
+            {"message", "Missing or invalid 'enable' parameter"}
         };
     }
-    
-    // Validate state
-    if (state != 0 && state != 1) {
-        return {
-            {"status", "error"},
-            {"message", "State must be 0 (low) or 1 (high)"}
-        };
+    bool const enable = params["enable"].get<bool>();
+
+    loco_tracker_enable(enable);
+
+    return {
+        {"status", "ok"},
+        {"message", enable ? "Loco tracking started" : "Loco tracking stopped"}
+    };
+}
+
+static json loco_address_json(uint16_t address) {
+    return (address & LOCO_TRACKER_LONG) ? json(address & ~LOCO_TRACKER_LONG) : json(address);
+}
+
+static json decoder_track_status_handler(const json& params) {
+    (void)params;
+
+    LocoTrackerStats_t stats;
+    loco_tracker_get_stats(&stats);
+
+    // Loco packets per second over the whole run
+    uint32_t const span_us = stats.last_us - stats.first_us;
+    uint32_t const mean_rate = span_us ? static_cast<uint32_t>(
+        static_cast<uint64_t>(stats.loco_packets) * 1000000u / span_us) : 0u;
+
+    json result = {
+        {"status", "ok"},
+        {"enabled", stats.enabled},
+        {"packets", stats.packets},
+        {"loco_packets", stats.loco_packets},
+        {"idle_packets", stats.idle_packets},
+        {"broadcast_packets", stats.broadcast_packets},
+        {"accessory_packets", stats.accessory_packets},
+        {"other_packets", stats.other_packets},
+        {"locos", stats.locos},
+        {"max_locos", LOCO_TRACKER_MAX_LOCOS},
+        {"full", stats.full},
+        {"span_us", span_us},
+        {"rate", stats.rate},
+        {"peak_rate", stats.peak_rate},
+        {"mean_rate", mean_rate},
+        {"max_interval_us", stats.max_interval_us},
+        {"max_probe", stats.max_probe}
+    };
+    if (stats.max_interval_us) {
+        result["max_interval_address"] = loco_address_json(stats.max_interval_address);
+        result["max_interval_long"] = (stats.max_interval_address & LOCO_TRACKER_LONG) != 0;
     }
-    
-    GPIO_InitTypeDef GPIO_InitStruct = {0};
-    GPIO_InitStruct.Mode = GPIO_MODE_OUTPUT_PP;
-    GPIO_InitStruct.Pull = GPIO_NOPULL;
-    GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_LOW;
-    
-    GPIO_PinState initial_state = (state == 1) ? GPIO_PIN_SET : GPIO_PIN_RESET;
-    
-    // Configure the appropriate GPIO pin as output and set initial state
-    switch (pin_num) {
-        case 1:
-            HAL_GPIO_WritePin(IO1_GPIO_Port, IO1_Pin, initial_state);
-            GPIO_InitStruct.Pin = IO1_Pin;
-            HAL_GPIO_Init(IO1_GPIO_Port, &GPIO_InitStruct);
-            break;
-        case 2:
-            HAL_GPIO_WritePin(IO2_GPIO_Port, IO2_Pin, initial_state);
-            GPIO_InitStruct.Pin = IO2_Pin;
-            HAL_GPIO_Init(IO2_GPIO_Port, &GPIO_InitStruct);
-            break;
-        case 3:
-            HAL_GPIO_WritePin(IO3_GPIO_Port, IO3_Pin, initial_state);
-            GPIO_InitStruct.Pin = IO3_Pin;
-            HAL_GPIO_Init(IO3_GPIO_Port, &GPIO_InitStruct);
-            break;
-        case 4:
-            HAL_GPIO_WritePin(IO4_GPIO_Port, IO4_Pin, initial_state);
-            GPIO_InitStruct.Pin = IO4_Pin;
-            HAL_GPIO_Init(IO4_GPIO_Port, &GPIO_InitStruct);
-            break;
-        case 5:
-            HAL_GPIO_WritePin(IO5_GPIO_Port, IO5_Pin, initial_state);
-            GPIO_InitStruct.Pin = IO5_Pin;
-            HAL_GPIO_Init(IO5_GPIO_Port, &GPIO_InitStruct);
-            break;
-        case 6:
-            HAL_GPIO_WritePin(IO6_GPIO_Port, IO6_Pin, initial_state);
-            GPIO_InitStruct.Pin = IO6_Pin;
-            HAL_GPIO_Init(IO6_GPIO_Port, &GPIO_InitStruct);
-            break;
-        case 7:
-            HAL_GPIO_WritePin(IO7_GPIO_Port, IO7_Pin, initial_state);
-            GPIO_InitStruct.Pin = IO7_Pin;
-            HAL_GPIO_Init(IO7_GPIO_Port, &GPIO_InitStruct);
-            break;
-        case 8:
-            HAL_GPIO_WritePin(IO8_GPIO_Port, IO8_Pin, initial_state);
-            GPIO_InitStruct.Pin = IO8_Pin;
-            HAL_GPIO_Init(IO8_GPIO_Port, &GPIO_InitStruct);
-            break;
-        case 9:
-            HAL_GPIO_WritePin(IO9_GPIO_Port, IO9_Pin, initial_state);
-            GPIO_InitStruct.Pin = IO9_Pin;
-            HAL_GPIO_Init(IO9_GPIO_Port, &GPIO_InitStruct);
-            break;
-        case 10:
-            HAL_GPIO_WritePin(IO10_GPIO_Port, IO10_Pin, initial_state);
-            GPIO_InitStruct.Pin = IO10_Pin;
-            HAL_GPIO_Init(IO10_GPIO_Port, &GPIO_InitStruct);
-            break;
-        case 11:
-            HAL_GPIO_WritePin(IO11_GPIO_Port, IO11_Pin, initial_state);
-            GPIO_InitStruct.Pin = IO11_Pin;
-            HAL_GPIO_Init(IO11_GPIO_Port, &GPIO_InitStruct);
-            break;
-        case 12:
-            HAL_GPIO_WritePin(IO12_GPIO_Port, IO12_Pin, initial_state);
-            GPIO_InitStruct.Pin = IO12_Pin;
-            HAL_GPIO_Init(IO12_GPIO_Port, &GPIO_InitStruct);
-            break;
-        case 13:
-            HAL_GPIO_WritePin(IO13_GPIO_Port, IO13_Pin, initial_state);
-            GPIO_InitStruct.Pin = IO13_Pin;
-            HAL_GPIO_Init(IO13_GPIO_Port, &GPIO_InitStruct);
-            break;
-        case 14:
-            HAL_GPIO_WritePin(IO14_GPIO_Port, IO14_Pin, initial_state);
-            GPIO_InitStruct.Pin = IO14_Pin;
-            HAL_GPIO_Init(IO14_GPIO_Port, &GPIO_InitStruct);
-            break;
-        case 15:
-            HAL_GPIO_WritePin(IO15_GPIO_Port, IO15_Pin, initial_state);
-            GPIO_InitStruct.Pin = IO15_Pin;
-            HAL_GPIO_Init(IO15_GPIO_Port, &GPIO_InitStruct);
-            break;
-        default:
+    return result;
+}
+
+#define LOCO_TRACKER_JSON_MAX_ENTRIES 32u
+
+static json loco_entry_json(const LocoTrackerEntry_t& entry, uint32_t now_us) {
+    json result = {
+        {"address", loco_address_json(entry.address)},
+        {"long", (entry.address & LOCO_TRACKER_LONG) != 0},
+        {"functions", entry.functions},
+        {"refreshes", entry.refreshes},
+        {"age_us", now_us - entry.last_us},
+        {"max_interval_us", entry.max_interval_us},
+        {"mean_interval_us", entry.refreshes > 1u ? (entry.last_us - entry.first_us) / (entry.refreshes - 1u) : 0u}
+    };
+    if (entry.flags & LOCO_TRACKER_FLAG_SPEED) {
+        result["speed"] = entry.speed;
+        result["steps"] = (entry.flags & LOCO_TRACKER_FLAG_STEPS128) ? 128 : 28;
+        result["forward"] = (entry.flags & LOCO_TRACKER_FLAG_FORWARD) != 0;
+        result["estop"] = (entry.flags & LOCO_TRACKER_FLAG_ESTOP) != 0;
+    }
+    return result;
+}
+
+// One address, or the table in slot order from "slot" on, "next" continues
+static json decoder_track_read_handler(const json& params) {
+    LocoTrackerStats_t stats;
+    loco_tracker_get_stats(&stats);
+
+    if (params.contains("address")) {
+        if (!params["address"].is_number_unsigned() || params["address"].get<uint64_t>() > 10239u) {
             return {
                 {"status", "error"},
-                {"message", "Invalid pin number"}
+                {"message", "address must be 0-10239"}
             };
+        }
+        bool is_long = params["address"].get<uint32_t>() > 127u;
+        if (params.contains("long")) {
+            if (!params["long"].is_boolean()) {
+                return {
+                    {"status", "error"},
+                    {"message", "long must be a boolean"}
+                };
+            }
+            is_long = is_long || params["long"].get<bool>();
+        }
+        uint16_t const address = static_cast<uint16_t>(params["address"].get<uint32_t>() |
+                                                       (is_long ? LOCO_TRACKER_LONG : 0u));
+        LocoTrackerEntry_t entry;
+        if (!loco_tracker_find(address, &entry)) {
+            return {
+                {"status", "error"},
+                {"message", "Address not seen"}
+            };
+        }
+        json result = loco_entry_json(entry, stats.last_us);
+        result["status"] = "ok";
+        return result;
     }
-    
-    return {
+
+    uint32_t slot = 0;
+    if (params.contains("slot")) {
+        if (!params["slot"].is_number_unsigned() || params["slot"].get<uint64_t>() > LOCO_TRACKER_CAPACITY) {
+            return {
+                {"status", "error"},
+                {"message", "slot must be 0-4096"}
+            };
+        }
+        slot = params["slot"].get<uint32_t>();
+    }
+    uint32_t max = LOCO_TRACKER_JSON_MAX_ENTRIES;
+    if (params.contains("max")) {
+        if (!params["max"].is_number_unsigned() || params["max"].get<uint64_t>() == 0 ||
+            params["max"].get<uint64_t>() > LOCO_TRACKER_JSON_MAX_ENTRIES) {
+            return {
+                {"status", "error"},
+                {"message", "max must be 1-32"}
+            };
+        }
+        max = params["max"].get<uint32_t>();
+    }
+
+    static LocoTrackerEntry_t entries[LOCO_TRACKER_JSON_MAX_ENTRIES];
+    uint32_t next = LOCO_TRACKER_CAPACITY;
+    uint32_t const count = loco_tracker_read(slot, entries, max, &next);
+
+    json locos = json::array();
+    for (uint32_t i = 0; i < count; i++) {
+        locos.push_back(loco_entry_json(entries[i], stats.last_us));
+    }
+    json result = {
         {"status", "ok"},
-        {"message", "GPIO configured as output"},
-        {"pin", pin_num},
-        {"state", state}
+        {"locos", locos}
     };
+    if (next < LOCO_TRACKER_CAPACITY) {
+        result["next"] = next;
+    }
+    return result;
 }
 
-static json set_gpio_output_handler(const json& params) {
-    // Check if pin parameter exists
-    if (!params.contains("pin") || !params["pin"].is_number_integer()) {
-        return {
-            {"status", "error"},
-            {"message", "Missing or invalid 'pin' parameter (must be 1-16)"}
-        };
+// A running command station takes the timing at the next packet boundary, BiDi and DMA
+// transmit only change with the next start
+static void apply_live_timing(json& response) {
+    uint8_t preamble_bits = 0;
+    uint8_t bit1_duration = 0;
+    uint8_t bit0_duration = 0;
+    get_dcc_preamble_bits(&preamble_bits);
+    get_dcc_bit1_duration(&bit1_duration);
+    get_dcc_bit0_duration(&bit0_duration);
+    const char* error = nullptr;
+    int const result = CommandStation_UpdateTiming(preamble_bits, bit1_duration, bit0_duration, &error);
+    if (result != -2) {
+        response["live"] = result == 0;
+        if (result != 0) {
+            response["live_error"] = error;
+        }
     }
-    
-    // Check if state parameter exists
-    if (!params.contains("state") || !params["state"].is_number_integer()) {
+}
+
+static json command_station_params_handler(const json& params) {
+    // Check if params is an object
+    if (!params.is_object()) {
         return {
             {"status", "error"},
-            {"message", "Missing or invalid 'state' parameter (must be 0 or 1)"}
+            {"message", "Params must be an object"}
         };
     }
-    
-    int pin_num = params["pin"].get<int>();
-    int state = params["state"].get<int>();
-    
-    // Validate pin number
-    if (pin_num < 1 || pin_num > 16) {
+
+    struct ParamField {
+        const char* name;
+        ParameterId id;
+        bool boolean;
+    };
+    static const ParamField kFields[] = {
+        {"preamble_bits", PARAM_DCC_PREAMBLE_BITS, false},
+        {"bit1_duration", PARAM_DCC_BIT1_DURATION, false},
+        {"bit0_duration", PARAM_DCC_BIT0_DURATION, false},
+        {"bidi_enable", PARAM_DCC_BIDI_ENABLE, true},
+        {"trigger_first_bit", PARAM_DCC_TRIGGER_FIRST_BIT, true},
+        {"dma_transmit", PARAM_DCC_DMA_TRANSMIT, true},
+    };
+
+    // Validate every field before the first one is set
+    uint32_t values[std::size(kFields)];
+    char message[64];
+    for (size_t i = 0; i < std::size(kFields); ++i) {
+        const ParamField& field = kFields[i];
+        if (!params.contains(field.name)) {
+            continue;
+        }
+        const json& value = params[field.name];
+        if (field.boolean) {
+            if (!value.is_boolean()) {
+                snprintf(message, sizeof(message), "%s must be a boolean", field.name);
+                return {
+                    {"status", "error"},
+                    {"message", message}
+                };
+            }
+            values[i] = value.get<bool>() ? 1u : 0u;
+            continue;
+        }
+        const ParameterDescriptor_t* desc = parameter_get_descriptor(field.id);
+        if (!value.is_number_unsigned() || value.get<uint64_t>() < desc->min || value.get<uint64_t>() > desc->max) {
+            snprintf(message, sizeof(message), "%s must be %lu-%lu", field.name,
+                     static_cast<unsigned long>(desc->min), static_cast<unsigned long>(desc->max));
+            return {
+                {"status", "error"},
+                {"message", message}
+            };
+        }
+        values[i] = value.get<uint32_t>();
+    }
+
+    for (size_t i = 0; i < std::size(kFields); ++i) {
+        if (params.contains(kFields[i].name) && parameter_set(kFields[i].id, values[i]) != 0) {
+            snprintf(message, sizeof(message), "Failed to set %s", kFields[i].name);
+            return {
+                {"status", "error"},
+                {"message", message}
+            };
+        }
+    }
+
+    json response = {
+        {"status", "ok"},
+        {"message", "Command station parameters updated"}
+    };
+
+    if (params.contains("preamble_bits") || params.contains("bit1_duration") || params.contains("bit0_duration")) {
+        apply_live_timing(response);
+    }
+    return response;
+}
+
+static json command_station_packet_override_handler(const json& params) {
+    // Check if params is an object
+    if (!params.is_object()) {
         return {
             {"status", "error"},
-            {"message", "Pin number must be between 1 and 16"}
+            {"message", "Params must be an object"}
         };
     }
     
-    // IO16 is mapped to BUTTON_USER and cannot be set as output
-    if (pin_num == 16) {
-        return {
-            {"status", "error"},
-            {"message", "IO16 is mapped to BUTTON_USER and is read-only"}
-        };
+    // Set zero bit override mask if provided
+    if (params.contains("zerobit_override_mask")) {
+        if (!params["zerobit_override_mask"].is_number_unsigned()) {
+            return {
+                {"status", "error"},
+                {"message", "zerobit_override_mask must be a positive integer"}
+            };
+        }
+        uint64_t mask = params["zerobit_override_mask"].get<uint64_t>();
+        CommandStation_SetZerobitOverrideMask(mask);
     }
     
-    // Validate state
-    if (state != 0 && state != 1) {
-        return {
-            {"status", "error"},
-            {"message", "State must be 0 (low) or 1 (high)"}
-        };
+    // Set zero bit deltaP if provided
+    if (params.contains("zerobit_deltaP") || params.contains("zerobit_delta")) {
+        // Support both old name (zerobit_delta) and new name (zerobit_deltaP) for backwards compatibility
+        const char* key = params.contains("zerobit_deltaP") ? "zerobit_deltaP" : "zerobit_delta";
+        if (!params[key].is_number_integer()) {
+            return {
+                {"status", "error"},
+                {"message", "zerobit_deltaP must be an integer"}
+            };
+        }
+        int32_t delta = params[key].get<int32_t>();
+        CommandStation_SetZerobitDeltaP(delta);
     }
     
-    GPIO_PinState new_state = (state == 1) ? GPIO_PIN_SET : GPIO_PIN_RESET;
-    
-    // Set the appropriate GPIO pin output state
-    switch (pin_num) {
-        case 1:  HAL_GPIO_WritePin(IO1_GPIO_Port, IO1_Pin, new_state); break;
-        case 2:  HAL_GPIO_WritePin(IO2_GPIO_Port, IO2_Pin, new_state); break;
-        case 3:  HAL_GPIO_WritePin(IO3_GPIO_Port, IO3_Pin, new_state); break;
-        case 4:  HAL_GPIO_WritePin(IO4_GPIO_Port, IO4_Pin, new_state); break;
-        case 5:  HAL_GPIO_WritePin(IO5_GPIO_Port, IO5_Pin, new_state); break;
-        case 6:  HAL_GPIO_WritePin(IO6_GPIO_Port, IO6_Pin, new_state); break;
-        case 7:  HAL_GPIO_WritePin(IO7_GPIO_Port, IO7_Pin, new_state); break;
-        case 8:  HAL_GPIO_WritePin(IO8_GPIO_Port, IO8_Pin, new_state); break;
-        case 9:  HAL_GPIO_WritePin(IO9_GPIO_Port, IO9_Pin, new_state); break;
-        case 10: HAL_GPIO_WritePin(IO10_GPIO_Port, IO10_Pin, new_state); break;
-        case 11: HAL_GPIO_WritePin(IO11_GPIO_Port, IO11_Pin, new_state); break;
-        case 12: HAL_GPIO_WritePin(IO12_GPIO_Port, IO12_Pin, new_state); break;
-        case 13: HAL_GPIO_WritePin(IO13_GPIO_Port, IO13_Pin, new_state); break;
-        case 14: HAL_GPIO_WritePin(IO14_GPIO_Port, IO14_Pin, new_state); break;
-        case 15: HAL_GPIO_WritePin(IO15_GPIO_Port, IO15_Pin, new_state); break;
-        default:
+    // Set zero bit deltaN if provided
+    if (params.contains("zerobit_deltaN")) {
+        if (!params["zerobit_deltaN"].is_number_integer()) {
             return {
                 {"status", "error"},
-                {"message", "Invalid pin number"}
+                {"message", "zerobit_deltaN must be an integer"}
             };
+        }
+        int32_t delta = params["zerobit_deltaN"].get<int32_t>();
+        CommandStation_SetZerobitDeltaN(delta);
     }
     
     return {
         {"status", "ok"},
-        {"message", "GPIO output state set"},
-        {"pin", pin_num},
-        {"state", state}
+        {"message", "Packet override parameters updated"}
     };
 }
 
-static json get_rtc_datetime_handler(const json& params) {
+static json command_station_packet_reset_override_handler(const json& params) {
     (void)params;  // Unused parameter
     
-    RTC_TimeTypeDef sTime = {0};
-    RTC_DateTypeDef sDate = {0};
+    // Reset all override parameters to 0
+    CommandStation_SetZerobitOverrideMask(0);
+    CommandStation_SetZerobitDeltaP(0);
+    CommandStation_SetZerobitDeltaN(0);
     
-    // Read time and date from RTC
-    if (HAL_RTC_GetTime(&hrtc, &sTime, RTC_FORMAT_BIN) != HAL_OK) {
+    return {
+        {"status", "ok"},
+        {"message", "Packet override parameters reset to 0"}
+    };
+}
+
+static json command_station_packet_get_override_handler(const json& params) {
+    (void)params;  // Unused parameter
+    
+    // Get current override parameters
+    uint64_t mask = CommandStation_GetZerobitOverrideMask();
+    int32_t deltaP = CommandStation_GetZerobitDeltaP();
+    int32_t deltaN = CommandStation_GetZerobitDeltaN();
+    
+    // Format mask as hex string for readability
+    char mask_str[20];
+    snprintf(mask_str, sizeof(mask_str), "0x%016llX", (unsigned long long)mask);
+    
+    return {
+        {"status", "ok"},
+        {"zerobit_override_mask", mask_str},
+        {"zerobit_override_mask_decimal", mask},
+        {"zerobit_deltaP", deltaP},
+        {"zerobit_deltaN", deltaN}
+    };
+}
+
+static json parameters_save_handler(const json& params) {
+    (void)params;  // Unused parameter
+    
+    if (parameter_manager_save() != 0) {
         return {
             {"status", "error"},
-            {"message", "Failed to read RTC time"}
+            {"message", "Failed to save parameters to flash"}
         };
     }
     
-    if (HAL_RTC_GetDate(&hrtc, &sDate, RTC_FORMAT_BIN) != HAL_OK) {
+    ParameterFlashStats_t stats;
+    parameter_manager_get_flash_stats(&stats);
+    return {
+        {"status", "ok"},
+        {"message", "Parameters saved to flash"},
+        {"records_written", stats.last_save_records},
+        {"log_records", stats.records},
+        {"log_capacity", stats.capacity}
+    };
+}
+
+static json parameters_restore_handler(const json& params) {
+    (void)params;  // Unused parameter
+    
+    if (parameter_manager_restore() != 0) {
         return {
             {"status", "error"},
-            {"message", "Failed to read RTC date"}
+            {"message", "Failed to restore parameters from flash"}
         };
     }
-    
-    // Format date and time strings
-    char date_str[16];
-    char time_str[16];
-    snprintf(date_str, sizeof(date_str), "20%02d-%02d-%02d", 
-             sDate.Year, sDate.Month, sDate.Date);
-    snprintf(time_str, sizeof(time_str), "%02d:%02d:%02d", 
-             sTime.Hours, sTime.Minutes, sTime.Seconds);
+    track_guard_configure();
     
     return {
         {"status", "ok"},
-        {"date", date_str},
-        {"time", time_str},
-        {"year", sDate.Year + 2000},
-        {"month", sDate.Month},
-        {"day", sDate.Date},
-        {"weekday", sDate.WeekDay},
-        {"hours", sTime.Hours},
-        {"minutes", sTime.Minutes},
-        {"seconds", sTime.Seconds}
+        {"message", "Parameters restored from flash"}
     };
 }
 
-static json set_rtc_datetime_handler(const json& params) {
-    RTC_TimeTypeDef sTime = {0};
-    RTC_DateTypeDef sDate = {0};
-    bool set_date = false;
-    bool set_time = false;
+static json parameters_factory_reset_handler(const json& params) {
+    (void)params;  // Unused parameter
     
-    // Check for date parameters
-    if (params.contains("year") && params.contains("month") && params.contains("day")) {
-        if (!params["year"].is_number_integer() || 
-            !params["month"].is_number_integer() || 
-            !params["day"].is_number_integer()) {
-            return {
-                {"status", "error"},
-                {"message", "Date parameters must be integers"}
-            };
-        }
-        
-        int year = params["year"].get<int>();
-        int month = params["month"].get<int>();
-        int day = params["day"].get<int>();
-        
-        // Validate date ranges
-        if (year < 2000 || year > 2099) {
-            return {
-                {"status", "error"},
-                {"message", "Year must be between 2000 and 2099"}
-            };
+    parameter_manager_factory_reset();
+    track_guard_configure();
+    
+    return {
+        {"status", "ok"},
+        {"message", "Factory reset completed - all parameters restored to defaults"}
+    };
+}
+
+// Value of any parameter, the RAM-only zero bit overrides come from the command station
+static json parameter_value(ParameterId id) {
+    switch (id) {
+    case PARAM_DCC_ZEROBIT_OVERRIDE_MASK:
+        return CommandStation_GetZerobitOverrideMask();
+    case PARAM_DCC_ZEROBIT_DELTAP:
+        return CommandStation_GetZerobitDeltaP();
+    case PARAM_DCC_ZEROBIT_DELTAN:
+        return CommandStation_GetZerobitDeltaN();
+    default: {
+        uint32_t value = 0;
+        parameter_get(id, &value);
+        return value;
+    }
+    }
+}
+
+// nullptr if the value is valid for the parameter, it is stored in *value
+static const char* parameter_validate(ParameterId id, const json& item, uint64_t* value) {
+    if (id == PARAM_DCC_ZEROBIT_OVERRIDE_MASK) {
+        if (!item.is_number_unsigned()) {
+            return "must be a positive integer";
         }
-        if (month < 1 || month > 12) {
-            return {
-                {"status", "error"},
-                {"message", "Month must be between 1 and 12"}
-            };
+        *value = item.get<uint64_t>();
+        return nullptr;
+    }
+    if (id == PARAM_DCC_ZEROBIT_DELTAP || id == PARAM_DCC_ZEROBIT_DELTAN) {
+        if (!item.is_number_integer() || item.get<int64_t>() < INT32_MIN || item.get<int64_t>() > INT32_MAX) {
+            return "must be a 32 bit integer";
         }
-        if (day < 1 || day > 31) {
+        *value = static_cast<uint32_t>(item.get<int32_t>());
+        return nullptr;
+    }
+
+    const ParameterDescriptor_t* desc = parameter_get_descriptor(id);
+    if (item.is_boolean() && desc->max == 1u) {
+        *value = item.get<bool>() ? 1u : 0u;
+        return nullptr;
+    }
+    if (!item.is_number_unsigned() || item.get<uint64_t>() < desc->min || item.get<uint64_t>() > desc->max) {
+        return "out of range";
+    }
+    *value = item.get<uint64_t>();
+    return nullptr;
+}
+
+static void parameter_apply(ParameterId id, uint64_t value) {
+    switch (id) {
+    case PARAM_DCC_ZEROBIT_OVERRIDE_MASK:
+        CommandStation_SetZerobitOverrideMask(value);
+        break;
+    case PARAM_DCC_ZEROBIT_DELTAP:
+        CommandStation_SetZerobitDeltaP(static_cast<int32_t>(static_cast<uint32_t>(value)));
+        break;
+    case PARAM_DCC_ZEROBIT_DELTAN:
+        CommandStation_SetZerobitDeltaN(static_cast<int32_t>(static_cast<uint32_t>(value)));
+        break;
+    default:
+        parameter_set(id, static_cast<uint32_t>(value));
+        break;
+    }
+}
+
+static json parameters_get_handler(const json& params) {
+    json values = json::object();
+    if (params.is_object() && params.contains("names")) {
+        if (!params["names"].is_array()) {
             return {
                 {"status", "error"},
-                {"message", "Day must be between 1 and 31"}
+                {"message", "names must be an array"}
             };
         }
-        
-        sDate.Year = year - 2000;
-        sDate.Month = month;
-        sDate.Date = day;
-        
-        // Optional weekday parameter (1-7, Monday=1)
-        if (params.contains("weekday") && params["weekday"].is_number_integer()) {
-            int weekday = params["weekday"].get<int>();
-            if (weekday < 1 || weekday > 7) {
+        for (const auto& item : params["names"]) {
+            ParameterId const id = item.is_string() ? parameter_find(item.get_ref<const json::string_t&>().c_str())
+                                                    : PARAM_COUNT;
+            if (id == PARAM_COUNT) {
                 return {
                     {"status", "error"},
-                    {"message", "Weekday must be between 1 (Monday) and 7 (Sunday)"}
+                    {"message", "Unknown parameter name"},
+                    {"name", item}
                 };
             }
-            sDate.WeekDay = weekday;
-        } else {
-            sDate.WeekDay = RTC_WEEKDAY_MONDAY;  // Default
+            values[parameter_get_descriptor(id)->name] = parameter_value(id);
+        }
+    } else {
+        for (int id = 0; id < PARAM_COUNT; id++) {
+            values[parameter_get_descriptor(static_cast<ParameterId>(id))->name] =
+                parameter_value(static_cast<ParameterId>(id));
         }
-        
-        set_date = true;
     }
-    
-    // Check for time parameters
-    if (params.contains("hours") && params.contains("minutes") && params.contains("seconds")) {
-        if (!params["hours"].is_number_integer() || 
-            !params["minutes"].is_number_integer() || 
-            !params["seconds"].is_number_integer()) {
+    return {
+        {"status", "ok"},
+        {"parameters", values}
+    };
+}
+
+static json parameters_set_handler(const json& params) {
+    if (!params.is_object() || !params.contains("parameters") || !params["parameters"].is_object()) {
+        return {
+            {"status", "error"},
+            {"message", "parameters must be an object"}
+        };
+    }
+    const json& items = params["parameters"];
+    bool commit = false;
+    if (params.contains("commit")) {
+        if (!params["commit"].is_boolean()) {
             return {
                 {"status", "error"},
-                {"message", "Time parameters must be integers"}
+                {"message", "commit must be a boolean"}
             };
         }
-        
-        int hours = params["hours"].get<int>();
-        int minutes = params["minutes"].get<int>();
-        int seconds = params["seconds"].get<int>();
-        
-        // Validate time ranges
-        if (hours < 0 || hours > 23) {
+        commit = params["commit"].get<bool>();
+    }
+
+    // Validate every value before the first one is set
+    ParameterId ids[PARAM_COUNT];
+    uint64_t values[PARAM_COUNT];
+    size_t count = 0;
+    for (auto it = items.begin(); it != items.end(); ++it) {
+        ParameterId const id = parameter_find(it.key().c_str());
+        if (id == PARAM_COUNT || count == PARAM_COUNT) {
             return {
                 {"status", "error"},
-                {"message", "Hours must be between 0 and 23"}
+                {"message", "Unknown parameter name"},
+                {"name", it.key()}
             };
         }
-        if (minutes < 0 || minutes > 59) {
-            return {
+        const char* error = parameter_validate(id, it.value(), &values[count]);
+        if (error != nullptr) {
+            const ParameterDescriptor_t* desc = parameter_get_descriptor(id);
+            json response = {
                 {"status", "error"},
-                {"message", "Minutes must be between 0 and 59"}
+                {"message", error},
+                {"name", it.key()}
             };
+            if (desc->size != 0) {
+                response["min"] = desc->min;
+                response["max"] = desc->max;
+            }
+            return response;
         }
-        if (seconds < 0 || seconds > 59) {
-            return {
-                {"status", "error"},
-                {"message", "Seconds must be between 0 and 59"}
-            };
+        ids[count++] = id;
+    }
+
+    bool timing = false;
+    for (size_t i = 0; i < count; i++) {
+        parameter_apply(ids[i], values[i]);
+        timing = timing || ids[i] == PARAM_DCC_PREAMBLE_BITS || ids[i] == PARAM_DCC_BIT1_DURATION ||
+                 ids[i] == PARAM_DCC_BIT0_DURATION;
+    }
+
+    json response = {
+        {"status", "ok"},
+        {"updated", count}
+    };
+    if (timing) {
+        apply_live_timing(response);
+    }
+    track_guard_configure();
+
+    // One save for the whole set, a change record per changed stored parameter
+    if (commit) {
+        if (parameter_manager_save() != 0) {
+            response["status"] = "error";
+            response["message"] = "Parameters set, failed to save them to flash";
+            return response;
         }
-        
-        sTime.Hours = hours;
-        sTime.Minutes = minutes;
-        sTime.Seconds = seconds;
-        sTime.DayLightSaving = RTC_DAYLIGHTSAVING_NONE;
-        sTime.StoreOperation = RTC_STOREOPERATION_RESET;
-        
-        set_time = true;
+        ParameterFlashStats_t stats;
+        parameter_manager_get_flash_stats(&stats);
+        response["records_written"] = stats.last_save_records;
     }
-    
-    // Check if at least date or time was provided
-    if (!set_date && !set_time) {
+    return response;
+}
+
+// Profile addressed by "slot" or "name", -1 with an error message otherwise
+static int profile_slot_param(const json& params, const char** error) {
+    if (params.contains("slot")) {
+        if (!params["slot"].is_number_unsigned() || params["slot"].get<uint64_t>() >= PARAM_PROFILE_SLOTS) {
+            *error = "slot must be 0-6";
+            return -1;
+        }
+        return params["slot"].get<int>();
+    }
+    if (!params.contains("name") || !params["name"].is_string()) {
+        *error = "Missing slot or name";
+        return -1;
+    }
+    int const slot = parameter_profile_find(params["name"].get_ref<const json::string_t&>().c_str());
+    if (slot < 0) {
+        *error = "No profile by that name";
+    }
+    return slot;
+}
+
+static json parameters_profile_save_handler(const json& params) {
+    if (!params.is_object() || !params.contains("name") || !params["name"].is_string()) {
         return {
             {"status", "error"},
-            {"message", "Must provide date (year, month, day) and/or time (hours, minutes, seconds)"}
+            {"message", "Missing name"}
         };
     }
-    
-    // Set date if provided
-    if (set_date) {
-        if (HAL_RTC_SetDate(&hrtc, &sDate, RTC_FORMAT_BIN) != HAL_OK) {
+    const auto& name = params["name"].get_ref<const json::string_t&>();
+    if (name.empty() || name.size() >= PARAM_PROFILE_NAME_LENGTH) {
+        return {
+            {"status", "error"},
+            {"message", "name must be 1-23 characters"}
+        };
+    }
+
+    // Explicit slot, else the one holding this name, else the first empty one
+    int slot = -1;
+    if (params.contains("slot")) {
+        const char* error = nullptr;
+        slot = profile_slot_param(params, &error);
+        if (slot < 0) {
             return {
                 {"status", "error"},
-                {"message", "Failed to set RTC date"}
+                {"message", error}
             };
         }
-    }
-    
-    // Set time if provided
-    if (set_time) {
-        if (HAL_RTC_SetTime(&hrtc, &sTime, RTC_FORMAT_BIN) != HAL_OK) {
+    } else {
+        slot = parameter_profile_find(name.c_str());
+        char stored[PARAM_PROFILE_NAME_LENGTH];
+        for (uint32_t i = 0; slot < 0 && i < PARAM_PROFILE_SLOTS; i++) {
+            if (parameter_profile_get_name(i, stored) != 0) {
+                slot = static_cast<int>(i);
+            }
+        }
+        if (slot < 0) {
             return {
                 {"status", "error"},
-                {"message", "Failed to set RTC time"}
+                {"message", "All profile slots are in use"}
             };
         }
     }
-    
-    json response = {
-        {"status", "ok"},
-        {"message", "RTC updated successfully"}
-    };
-    
-    if (set_date) {
-        response["date_set"] = true;
-    }
-    if (set_time) {
-        response["time_set"] = true;
-    }
-    
-    return response;
-}
 
-static json command_station_get_params_handler(const json& params) {
-    (void)params;  // Unused parameter
-    
-    // Retrieve all command station parameters
-    uint16_t track_voltage = 0;
-    uint8_t preamble_bits = 0;
-    uint8_t bit1_duration = 0;
-    uint8_t bit0_duration = 0;
-    uint8_t bidi_enable = 0;
-    uint16_t bidi_dac = 0;
-    uint8_t trigger_first_bit = 0;
-    
-    // Get persistent parameters from parameter manager
-    if (get_dcc_track_voltage(&track_voltage) != 0 ||
-        get_dcc_preamble_bits(&preamble_bits) != 0 ||
-        get_dcc_bit1_duration(&bit1_duration) != 0 ||
-        get_dcc_bit0_duration(&bit0_duration) != 0 ||
-        get_dcc_bidi_enable(&bidi_enable) != 0 ||
-        get_dcc_bidi_dac(&bidi_dac) != 0 ||
-        get_dcc_trigger_first_bit(&trigger_first_bit) != 0) {
+    ParameterOverrides_t overrides;
+    overrides.zerobit_override_mask = CommandStation_GetZerobitOverrideMask();
+    overrides.zerobit_deltap = CommandStation_GetZerobitDeltaP();
+    overrides.zerobit_deltan = CommandStation_GetZerobitDeltaN();
+    if (parameter_profile_save(static_cast<uint32_t>(slot), name.c_str(), &overrides) != 0) {
         return {
             {"status", "error"},
-            {"message", "Failed to retrieve one or more parameters"}
+            {"message", "Failed to save profile to flash"}
         };
     }
-    
-    // Get RAM-only override parameters from command station
-    uint64_t zerobit_override_mask = CommandStation_GetZerobitOverrideMask();
-    int32_t zerobit_deltaP = CommandStation_GetZerobitDeltaP();
-    int32_t zerobit_deltaN = CommandStation_GetZerobitDeltaN();
-    
-    // Convert uint64_t to hex string for JSON compatibility
-    char mask_str[19];  // "0x" + 16 hex digits + null terminator
-    snprintf(mask_str, sizeof(mask_str), "0x%016llX", (unsigned long long)zerobit_override_mask);
-    
+
     return {
         {"status", "ok"},
-        {"parameters", {
-            {"track_voltage", track_voltage},
-            {"preamble_bits", preamble_bits},
-            {"bit1_duration", bit1_duration},
-            {"bit0_duration", bit0_duration},
-            {"bidi_enable", bidi_enable != 0},
-            {"bidi_dac", bidi_dac},
-            {"trigger_first_bit", trigger_first_bit != 0},
-            {"zerobit_override_mask", mask_str},
-            {"zerobit_deltaP", zerobit_deltaP},
-            {"zerobit_deltaN", zerobit_deltaN}
-        }}
+        {"message", "Profile saved"},
+        {"slot", slot},
+        {"name", name}
     };
 }
 
-static json system_usb_status_handler(const json& params) {
-    (void)params;
+static json parameters_profile_activate_handler(const json& params) {
+    const char* error = nullptr;
+    int const slot = params.is_object() ? profile_slot_param(params, &error) : -1;
+    if (slot < 0) {
+        return {
+            {"status", "error"},
+            {"message", error != nullptr ? error : "Params must be an object"}
+        };
+    }
 
-    uint32_t device_configured = 0;
-    uint32_t cdc_active = 0;
-    UsbCdcAcm_GetStatus(&device_configured, &cdc_active);
+    ParameterOverrides_t overrides;
+    if (parameter_profile_activate(static_cast<uint32_t>(slot), &overrides) != 0) {
+        return {
+            {"status", "error"},
+            {"message", "Profile slot is empty or corrupt"}
+        };
+    }
+    CommandStation_SetZerobitOverrideMask(overrides.zerobit_override_mask);
+    CommandStation_SetZerobitDeltaP(overrides.zerobit_deltap);
+    CommandStation_SetZerobitDeltaN(overrides.zerobit_deltan);
 
-    return {
+    char name[PARAM_PROFILE_NAME_LENGTH];
+    parameter_profile_get_name(static_cast<uint32_t>(slot), name);
+    json response = {
         {"status", "ok"},
-        {"usb", {
-            {"device_configured", device_configured != 0U},
-            {"cdc_active", cdc_active != 0U}
-        }}
+        {"message", "Profile activated"},
+        {"slot", slot},
+        {"name", name}
     };
+    apply_live_timing(response);
+    track_guard_configure();
+    return response;
+}
+
+static json parameters_profile_list_handler(const json& params) {
+    (void)params;  // Unused parameter
+
+    json profiles = json::array();
+    char name[PARAM_PROFILE_NAME_LENGTH];
+    for (uint32_t slot = 0; slot < PARAM_PROFILE_SLOTS; slot++) {
+        if (parameter_profile_get_name(slot, name) == 0) {
+            profiles.push_back({
+                {"slot", slot},
+                {"name", name}
+            });
+        }
+    }
+    return {
+        {"status", "ok"},
+        {"slots", PARAM_PROFILE_SLOTS},
+        {"profiles", profiles}
+    };
+}
+
+static json parameters_profile_delete_handler(const json& params) {
+    const char* error = nullptr;
+    int const slot = params.is_object() ? profile_slot_param(params, &error) : -1;
+    if (slot < 0) {
+        return {
+            {"status", "error"},
+            {"message", error != nullptr ? error : "Params must be an object"}
+        };
+    }
+    if (parameter_profile_delete(static_cast<uint32_t>(slot)) != 0) {
+        return {
+            {"status", "error"},
+            {"message", "Failed to erase profile slot"}
+        };
+    }
+    return {
+        {"status", "ok"},
+        {"message", "Profile deleted"},
+        {"slot", slot}
+    };
+}
+
+static json system_reboot_handler(const json& params) {
+    (void)params;  // Unused parameter
+    
+    // Return success response before rebooting
+    json response = {
+        {"status", "ok"},
+        {"message", "System rebooting..."}
+    };
+    
+    // Small delay to allow response to be sent
+    //TODO: ...probably will never send response before rebooting
+    osDelay(100);
+    
+    // Perform system reset
+    NVIC_SystemReset();
+    
+    // This line will never be reached
+    return response;
+}
+
+enum FeedbackKind : uint8_t {
+    FEEDBACK_VOLTAGE,
+    FEEDBACK_CURRENT
+};
+
+struct FeedbackJob {
+    uint32_t sample_delay_ms;
+    uint16_t value;
+    uint8_t num_samples;
+    uint8_t kind;               // FeedbackKind
+    int rc;
+};
+
+static void feedback_averaged_run(RpcJob& job) {
+    FeedbackJob& fb = rpc_job_data<FeedbackJob>(job);
+    if (fb.kind == FEEDBACK_VOLTAGE) {
+        fb.rc = get_voltage_feedback_mv_averaged(&fb.value, fb.num_samples, fb.sample_delay_ms);
+    } else {
+        fb.rc = get_current_feedback_ma_averaged(&fb.value, fb.num_samples, fb.sample_delay_ms);
+    }
+}
+
+static json feedback_averaged_response(const RpcJob& job) {
+    const FeedbackJob& fb = rpc_job_data<FeedbackJob>(job);
+    bool voltage = fb.kind == FEEDBACK_VOLTAGE;
+    if (fb.rc != 0) {
+        return {
+            {"status", "error"},
+            {"message", voltage ? "Failed to read voltage feedback (averaged)" : "Failed to read current feedback (averaged)"}
+        };
+    }
+    
+    return {
+        {"status", "ok"},
+        {voltage ? "voltage_mv" : "current_ma", fb.value},
+        {"averaged", true},
+        {"num_samples", fb.num_samples},
+        {"sample_delay_ms", fb.sample_delay_ms}
+    };
+}
+
+static json get_voltage_feedback_mv_handler(const json& params) {
+    uint16_t voltage_mv = 0;
+    
+    // Check if averaging parameters are provided
+    if (params.contains("num_samples") && params.contains("sample_delay_ms")) {
+        // Validate num_samples
+        if (!params["num_samples"].is_number_unsigned()) {
+            return {
+                {"status", "error"},
+                {"message", "num_samples must be a positive integer"}
+            };
+        }
+        
+        // Validate sample_delay_ms
+        if (!params["sample_delay_ms"].is_number_unsigned()) {
+            return {
+                {"status", "error"},
+                {"message", "sample_delay_ms must be a positive integer"}
+            };
+        }
+        
+        uint8_t num_samples = params["num_samples"].get<uint8_t>();
+        uint32_t sample_delay_ms = params["sample_delay_ms"].get<uint32_t>();
+        
+        // Validate parameter limits
+        if (num_samples > 16) {
+            return {
+                {"status", "error"},
+                {"message", "num_samples must be between 1 and 16"}
+            };
+        }
+        
+        if (sample_delay_ms > 1000) {
+            return {
+                {"status", "error"},
+                {"message", "sample_delay_ms must be between 0 and 1000"}
+            };
+        }
+        
+        // The averaged version sleeps between samples, up to 16 s
+        FeedbackJob job = {sample_delay_ms, 0, num_samples, FEEDBACK_VOLTAGE, 0};
+        return rpc_job_execute(params, "get_voltage_feedback_mv", feedback_averaged_run, feedback_averaged_response, job);
+    }
+    
+    // No averaging parameters, use the basic version
+    if (get_voltage_feedback_mv(&voltage_mv) != 0) {
+        return {
+            {"status", "error"},
+            {"message", "Failed to read voltage feedback"}
+        };
+    }
+    
+    return {
+        {"status", "ok"},
+        {"voltage_mv", voltage_mv}
+    };
+}
+
+static json get_current_feedback_ma_handler(const json& params) {
+    uint16_t current_ma = 0;
+    
+    // Check if averaging parameters are provided
+    if (params.contains("num_samples") && params.contains("sample_delay_ms")) {
+        // Validate num_samples
+        if (!params["num_samples"].is_number_unsigned()) {
+            return {
+                {"status", "error"},
+                {"message", "num_samples must be a positive integer"}
+            };
+        }
+        
+        // Validate sample_delay_ms
+        if (!params["sample_delay_ms"].is_number_unsigned()) {
+            return {
+                {"status", "error"},
+                {"message", "sample_delay_ms must be a positive integer"}
+            };
+        }
+        
+        uint8_t num_samples = params["num_samples"].get<uint8_t>();
+        uint32_t sample_delay_ms = params["sample_delay_ms"].get<uint32_t>();
+        
+        // Validate parameter limits
+        if (num_samples > 16) {
+            return {
+                {"status", "error"},
+                {"message", "num_samples must be between 1 and 16"}
+            };
+        }
+        
+        if (sample_delay_ms > 1000) {
+            return {
+                {"status", "error"},
+                {"message", "sample_delay_ms must be between 0 and 1000"}
+            };
+        }
+        
+        // The averaged version sleeps between samples, up to 16 s
+        FeedbackJob job = {sample_delay_ms, 0, num_samples, FEEDBACK_CURRENT, 0};
+        return rpc_job_execute(params, "get_current_feedback_ma", feedback_averaged_run, feedback_averaged_response, job);
+    }
+    
+    // No averaging parameters, use the basic version
+    if (get_current_feedback_ma(&current_ma) != 0) {
+        return {
+            {"status", "error"},
+            {"message", "Failed to read current feedback"}
+        };
+    }
+    
+    return {
+        {"status", "ok"},
+        {"current_ma", current_ma}
+    };
+}
+
+static json track_fault_json(const TrackFault_t& fault) {
+    return {
+        {"number", fault.number},
+        {"source", track_guard_source_name(static_cast<TrackFaultSource_t>(fault.source))},
+        {"tick_ms", fault.tick_ms},
+        {"packet_seq", fault.packet_seq},
+        {"current_ma", fault.current_ma}
+    };
+}
+
+static json track_guard_status_handler(const json& params) {
+    (void)params;
+
+    TrackGuardStatus_t status;
+    track_guard_get_status(&status);
+    json faults = json::array();
+    for (uint32_t i = 0; i < status.fault_count; ++i) {
+        faults.push_back(track_fault_json(status.faults[i]));
+    }
+
+    return {
+        {"status", "ok"},
+        {"armed", status.armed},
+        {"tripped", status.tripped},
+        {"short_circuit_ma", status.short_circuit_ma},
+        {"current_limit_ma", status.current_limit_ma},
+        {"limit_ms", TRACK_GUARD_LIMIT_MS},
+        {"trips", status.trips},
+        {"faults", faults}
+    };
+}
+
+static json get_gpio_input_handler(const json& params) {
+    // Check if pin parameter exists
+    if (!params.contains("pin") || !params["pin"].is_number_integer()) {
+        return {
+            {"status", "error"},
+            {"message", "Missing or invalid 'pin' parameter (must be 1-16)"}
+        };
+    }
+    
+    int pin_num = params["pin"].get<int>();
+    
+    // Validate pin number
+    if (pin_num < 1 || pin_num > 16) {
+        return {
+            {"status", "error"},
+            {"message", "Pin number must be between 1 and 16"}
+        };
+    }
+    
+    // IO16 is mapped to BUTTON_USER (read-only), 1 while pushed
+    int value = gpio_io_read(static_cast<uint8_t>(pin_num));
+    
+    return {
+        {"status", "ok"},
+        {"pin", pin_num},
+        {"value", value}
+    };
+}
+
+static json get_gpio_inputs_handler(const json& params) {
+    (void)params;  // Unused parameter
+    
+    // Bit 0 = IO1, Bit 1 = IO2, ..., Bit 15 = IO16 (BUTTON_USER, set when pressed),
+    // every port read once
+    uint16_t gpio_word = gpio_io_snapshot();
+    
+    // Format as hex string for easy reading
+    char hex_str[7];  // "0x" + 4 hex digits + null terminator
+    snprintf(hex_str, sizeof(hex_str), "0x%04X", gpio_word);
+    
+    return {
+        {"status", "ok"},
+        {"value", gpio_word},
+        {"hex", hex_str}
+    };
+}
+
+static json configure_gpio_output_handler(const json& params) {
+    // Check if pin parameter exists
+    if (!params.contains("pin") || !params["pin"].is_number_integer()) {
+        return {
+            {"status", "error"},
+            {"message", "Missing or invalid 'pin' parameter (must be 1-16)"}
+        };
+    }
+    
+    // Check if state parameter exists
+    if (!params.contains("state") || !params["state"].is_number_integer()) {
+        return {
+            {"status", "error"},
+            {"message", "Missing or invalid 'state' parameter (must be 0 or 1)"}
+        };
+    }
+    
+    int pin_num = params["pin"].get<int>();
+    int state = params["state"].get<int>();
+    
+    // Validate pin number
+    if (pin_num < 1 || pin_num > 16) {
+        return {
+            {"status", "error"},
+            {"message", "Pin number must be between 1 and 16"}
+        };
+    }
+    
+    // IO16 is mapped to BUTTON_USER and cannot be configured as output
+    if (pin_num == 16) {
+        return {
+            {"status", "error"},
+            {"message", "IO16 is mapped to BUTTON_USER and is read-only"}
+        };
+    }
+    
+    // Validate state
+    if (state != 0 && state != 1) {
+        return {
+            {"status", "error"},
+            {"message", "State must be 0 (low) or 1 (high)"}
+        };
+    }
+    
+    // Configure the GPIO pin as output and set initial state
+    if (!gpio_io_configure_output(static_cast<uint8_t>(pin_num), state == 1)) {
+        return {
+            {"status", "error"},
+            {"message", "Pin is armed for edge capture"}
+        };
+    }
+    
+    return {
+        {"status", "ok"},
+        {"message", "GPIO configured as output"},
+        {"pin", pin_num},
+        {"state", state}
+    };
+}
+
+static json set_gpio_output_handler(const json& params) {
+    // Check if pin parameter exists
+    if (!params.contains("pin") || !params["pin"].is_number_integer()) {
+        return {
+            {"status", "error"},
+            {"message", "Missing or invalid 'pin' parameter (must be 1-16)"}
+        };
+    }
+    
+    // Check if state parameter exists
+    if (!params.contains("state") || !params["state"].is_number_integer()) {
+        return {
+            {"status", "error"},
+            {"message", "Missing or invalid 'state' parameter (must be 0 or 1)"}
+        };
+    }
+    
+    int pin_num = params["pin"].get<int>();
+    int state = params["state"].get<int>();
+    
+    // Validate pin number
+    if (pin_num < 1 || pin_num > 16) {
+        return {
+            {"status", "error"},
+            {"message", "Pin number must be between 1 and 16"}
+        };
+    }
+    
+    // IO16 is mapped to BUTTON_USER and cannot be set as output
+    if (pin_num == 16) {
+        return {
+            {"status", "error"},
+            {"message", "IO16 is mapped to BUTTON_USER and is read-only"}
+        };
+    }
+    
+    // Validate state
+    if (state != 0 && state != 1) {
+        return {
+            {"status", "error"},
+            {"message", "State must be 0 (low) or 1 (high)"}
+        };
+    }
+    
+    gpio_io_write(static_cast<uint8_t>(pin_num), state == 1);
+    
+    return {
+        {"status", "ok"},
+        {"message", "GPIO output state set"},
+        {"pin", pin_num},
+        {"state", state}
+    };
+}
+
+// Edges per gpio_capture_read response
+static constexpr uint32_t kGpioCaptureJsonMax = 24u;
+
+// Bit 0 = IO1 as an array of IO numbers
+static json gpio_io_list(uint16_t mask) {
+    json list = json::array();
+    for (uint32_t i = 0; i < GPIO_IO_COUNT; ++i) {
+        if (mask & (1u << i)) {
+            list.push_back(i + 1u);
+        }
+    }
+    return list;
+}
+
+static json gpio_capture_control_handler(const json& params) {
+    if (!params.contains("enable") || !params["enable"].is_boolean()) {
+        return {
+            {"status", "error"},
+            {"message", "Missing or invalid 'enable' parameter"}
+        };
+    }
+    if (!params["enable"].get<bool>()) {
+        gpio_io_capture_stop();
+        return {
+            {"status", "ok"},
+            {"message", "GPIO capture disabled"}
+        };
+    }
+
+    if (!params.contains("pins") || !params["pins"].is_array() || params["pins"].empty()) {
+        return {
+            {"status", "error"},
+            {"message", "pins must be a non-empty array of IO numbers (1-15)"}
+        };
+    }
+    uint16_t mask = 0;
+    for (const auto& pin : params["pins"]) {
+        if (!pin.is_number_unsigned() || pin.get<uint64_t>() < 1u || pin.get<uint64_t>() > GPIO_IO_PIN_COUNT) {
+            return {
+                {"status", "error"},
+                {"message", "pins must be a non-empty array of IO numbers (1-15)"}
+            };
+        }
+        mask |= static_cast<uint16_t>(1u << (pin.get<uint32_t>() - 1u));
+    }
+
+    uint16_t conflicts = 0;
+    if (!gpio_io_capture_start(mask, &conflicts)) {
+        return {
+            {"status", "error"},
+            {"message", "Pins are outputs or share an EXTI line"},
+            {"conflicts", gpio_io_list(conflicts)}
+        };
+    }
+    return {
+        {"status", "ok"},
+        {"message", "GPIO capture enabled"},
+        {"pins", gpio_io_list(mask)}
+    };
+}
+
+static json gpio_capture_read_handler(const json& params) {
+    uint32_t max = kGpioCaptureJsonMax;
+    if (params.contains("max")) {
+        if (!params["max"].is_number_unsigned() || params["max"].get<uint64_t>() == 0u ||
+            params["max"].get<uint64_t>() > kGpioCaptureJsonMax) {
+            return {
+                {"status", "error"},
+                {"message", "max must be 1-24"}
+            };
+        }
+        max = params["max"].get<uint32_t>();
+    }
+
+    GpioIoEdge_t edges[kGpioCaptureJsonMax];
+    uint32_t const count = gpio_io_capture_read(edges, max);
+    GpioIoCaptureStats_t stats;
+    gpio_io_capture_stats(&stats);
+
+    json list = json::array();
+    for (uint32_t i = 0; i < count; ++i) {
+        list.push_back({
+            {"io", edges[i].io},
+            {"level", edges[i].level},
+            {"cycles", static_cast<uint32_t>(edges[i].cycles)},
+            {"time_ns", timebase_ns(edges[i].cycles)},
+            {"packet_seq", edges[i].packet_seq}
+        });
+    }
+
+    return {
+        {"status", "ok"},
+        {"active", stats.active},
+        {"pins", gpio_io_list(stats.mask)},
+        {"cpu_hz", SystemCoreClock},
+        {"edges_total", stats.edges},
+        {"overflows", stats.overflows},
+        {"pending", stats.pending},
+        {"edges", list}
+    };
+}
+
+static json response_latency_start_handler(const json& params) {
+    ResponseLatencyConfig_t config = {};
+    config.timeout_ms = RESPONSE_LATENCY_DEFAULT_TIMEOUT_MS;
+    config.bin_us = RESPONSE_LATENCY_DEFAULT_BIN_US;
+    config.trigger = RESPONSE_LATENCY_TRIGGER_CHANGE;
+
+    if (params.contains("label")) {
+        if (!params["label"].is_string() || params["label"].get_ref<const json::string_t&>().size() >= RESPONSE_LATENCY_LABEL_SIZE) {
+            return {
+                {"status", "error"},
+                {"message", "label must be a string of at most 23 characters"}
+            };
+        }
+        const auto& label = params["label"].get_ref<const json::string_t&>();
+        std::memcpy(config.label, label.data(), label.size());
+    }
+
+    if (params.contains("pins")) {
+        if (!params["pins"].is_array() || params["pins"].size() > RESPONSE_LATENCY_MAX_PINS) {
+            return {
+                {"status", "error"},
+                {"message", "pins must be an array of up to 4 IO numbers (1-15)"}
+            };
+        }
+        for (const auto& pin : params["pins"]) {
+            if (!pin.is_number_unsigned() || pin.get<uint64_t>() < 1u || pin.get<uint64_t>() > GPIO_IO_PIN_COUNT) {
+                return {
+                    {"status", "error"},
+                    {"message", "pins must be an array of up to 4 IO numbers (1-15)"}
+                };
+            }
+            config.pins |= static_cast<uint16_t>(1u << (pin.get<uint32_t>() - 1u));
+        }
+    }
+
+    if (params.contains("current_ma")) {
+        if (!params["current_ma"].is_number_unsigned() || params["current_ma"].get<uint64_t>() > 10000u) {
+            return {
+                {"status", "error"},
+                {"message", "current_ma must be 0-10000"}
+            };
+        }
+        config.current_ma = params["current_ma"].get<uint16_t>();
+    }
+
+    if (params.contains("timeout_ms")) {
+        if (!params["timeout_ms"].is_number_unsigned() || params["timeout_ms"].get<uint64_t>() == 0u ||
+            params["timeout_ms"].get<uint64_t>() > RESPONSE_LATENCY_MAX_TIMEOUT_MS) {
+            return {
+                {"status", "error"},
+                {"message", "timeout_ms must be 1-10000"}
+            };
+        }
+        config.timeout_ms = params["timeout_ms"].get<uint32_t>();
+    }
+
+    if (params.contains("bin_us")) {
+        if (!params["bin_us"].is_number_unsigned() || params["bin_us"].get<uint64_t>() == 0u ||
+            params["bin_us"].get<uint64_t>() > RESPONSE_LATENCY_MAX_BIN_US) {
+            return {
+                {"status", "error"},
+                {"message", "bin_us must be 1-100000"}
+            };
+        }
+        config.bin_us = params["bin_us"].get<uint32_t>();
+    }
+
+    if (params.contains("match")) {
+        if (!params["match"].is_array() || params["match"].size() > RESPONSE_LATENCY_MAX_MATCH) {
+            return {
+                {"status", "error"},
+                {"message", "match must be an array of up to 6 bytes"}
+            };
+        }
+        for (const auto& byte : params["match"]) {
+            if (!byte.is_number_unsigned() || byte.get<uint64_t>() > 255u) {
+                return {
+                    {"status", "error"},
+                    {"message", "match must be an array of up to 6 bytes"}
+                };
+            }
+            config.match[config.match_length++] = byte.get<uint8_t>();
+        }
+    }
+
+    if (params.contains("trigger")) {
+        const json& trigger = params["trigger"];
+        if (trigger.is_string() && trigger.get_ref<const json::string_t&>() == "change") {
+            config.trigger = RESPONSE_LATENCY_TRIGGER_CHANGE;
+        }
+        else if (trigger.is_string() && trigger.get_ref<const json::string_t&>() == "every") {
+            config.trigger = RESPONSE_LATENCY_TRIGGER_EVERY;
+        }
+        else {
+            return {
+                {"status", "error"},
+                {"message", "trigger must be change or every"}
+            };
+        }
+    }
+
+    if (config.pins == 0u && config.current_ma == 0u) {
+        return {
+            {"status", "error"},
+            {"message", "Nothing to measure, give pins and/or current_ma"}
+        };
+    }
+
+    if (AccessorySequence_Measuring()) {
+        return {
+            {"status", "error"},
+            {"message", "An accessory sequence is measuring with the edge capture"}
+        };
+    }
+
+    uint16_t conflicts = 0;
+    switch (response_latency_start(&config, &conflicts)) {
+    case 0:
+        return {
+            {"status", "ok"},
+            {"message", "Response latency test started"},
+            {"pins", gpio_io_list(config.pins)}
+        };
+    case -2:
+        return {
+            {"status", "error"},
+            {"message", "Pins are outputs or share an EXTI line"},
+            {"conflicts", gpio_io_list(conflicts)}
+        };
+    case -3:
+        return {
+            {"status", "error"},
+            {"message", "current_ma requires continuous analog sampling"}
+        };
+    case -4:
+        return {
+            {"status", "error"},
+            {"message", "Response latency requires interrupt driven transmit (dcc_dma_transmit 0)"}
+        };
+    default:
+        return {
+            {"status", "error"},
+            {"message", "Invalid configuration"}
+        };
+    }
+}
+
+static json response_latency_stop_handler(const json& params) {
+    (void)params;
+    response_latency_stop();
+    return {
+        {"status", "ok"},
+        {"message", "Response latency test stopped"}
+    };
+}
+
+static json response_latency_channel(const ResponseLatencyChannel_t& channel, uint32_t bin_us) {
+    return {
+        {"count", channel.count},
+        {"timeouts", channel.timeouts},
+        {"min_us", channel.count ? channel.min_us : 0u},
+        {"max_us", channel.max_us},
+        {"mean_us", channel.count ? static_cast<double>(channel.sum_us) / channel.count : 0.0},
+        {"p50_us", response_latency_percentile(&channel, bin_us, 50u)},
+        {"p90_us", response_latency_percentile(&channel, bin_us, 90u)},
+        {"p99_us", response_latency_percentile(&channel, bin_us, 99u)}
+    };
+}
+
+static json response_latency_results_handler(const json& params) {
+    static ResponseLatency_t results;
+    response_latency_get(&results);
+    uint32_t const bin_us = results.config.bin_us;
+
+    // One histogram per response, selected by IO number or "current"
+    const ResponseLatencyChannel_t* histogram = nullptr;
+    if (params.contains("histogram")) {
+        const json& selected = params["histogram"];
+        if (selected.is_string() && selected.get_ref<const json::string_t&>() == "current" && results.config.current_ma) {
+            histogram = &results.current;
+        }
+        else if (selected.is_number_unsigned()) {
+            for (uint32_t i = 0; i < results.pin_count; ++i) {
+                if (results.pin_io[i] == selected.get<uint64_t>()) {
+                    histogram = &results.pin[i];
+                }
+            }
+        }
+        if (!histogram) {
+            return {
+                {"status", "error"},
+                {"message", "histogram must be a measured IO number or current"}
+            };
+        }
+    }
+
+    json pins = json::array();
+    for (uint32_t i = 0; i < results.pin_count; ++i) {
+        json channel = response_latency_channel(results.pin[i], bin_us);
+        channel["io"] = results.pin_io[i];
+        pins.push_back(channel);
+    }
+
+    json response = {
+        {"status", "ok"},
+        {"active", results.active},
+        {"label", results.config.label},
+        {"packets", results.packets},
+        {"trials", results.trials},
+        {"ignored", results.ignored},
+        {"bin_us", bin_us},
+        {"pins", pins}
+    };
+    if (results.config.current_ma) {
+        response["current"] = response_latency_channel(results.current, bin_us);
+        response["current"]["threshold_ma"] = results.config.current_ma;
+    }
+    if (histogram) {
+        uint32_t last = RESPONSE_LATENCY_BINS;
+        while (last > 0u && histogram->bins[last - 1u] == 0u) {
+            last--;
+        }
+        json counts = json::array();
+        for (uint32_t i = 0; i < last; ++i) {
+            counts.push_back(histogram->bins[i]);
+        }
+        response["histogram"] = {
+            {"counts", counts},
+            {"overflow", histogram->overflow}
+        };
+    }
+    return response;
+}
+
+static json packet_capture_arm_handler(const json& params) {
+    PacketCaptureConfig_t config = {};
+    config.pre_bits = 20;
+    config.window_us = 20000;
+
+    if (params.contains("match")) {
+        if (!params["match"].is_array() || params["match"].size() > PACKET_CAPTURE_MAX_MATCH) {
+            return {
+                {"status", "error"},
+                {"message", "match must be an array of up to 6 bytes"}
+            };
+        }
+        for (const auto& byte : params["match"]) {
+            if (!byte.is_number_unsigned() || byte.get<uint64_t>() > 255u) {
+                return {
+                    {"status", "error"},
+                    {"message", "match must be an array of up to 6 bytes"}
+                };
+            }
+            config.match[config.match_length++] = byte.get<uint8_t>();
+        }
+    }
+
+    if (params.contains("packet_seq")) {
+        if (!params["packet_seq"].is_number_unsigned() || params["packet_seq"].get<uint64_t>() > UINT32_MAX) {
+            return {
+                {"status", "error"},
+                {"message", "packet_seq must be an unsigned 32-bit integer"}
+            };
+        }
+        config.packet_seq = params["packet_seq"].get<uint32_t>();
+    }
+
+    if (params.contains("pre_bits")) {
+        if (!params["pre_bits"].is_number_unsigned() || params["pre_bits"].get<uint64_t>() > 200u) {
+            return {
+                {"status", "error"},
+                {"message", "pre_bits must be 0-200"}
+            };
+        }
+        config.pre_bits = params["pre_bits"].get<uint16_t>();
+    }
+
+    if (params.contains("window_us")) {
+        if (!params["window_us"].is_number_unsigned() || params["window_us"].get<uint64_t>() == 0u ||
+            params["window_us"].get<uint64_t>() > PACKET_CAPTURE_MAX_SAMPLES * ANALOG_SAMPLE_US) {
+            return {
+                {"status", "error"},
+                {"message", "window_us must be 1-48000"}
+            };
+        }
+        config.window_us = params["window_us"].get<uint32_t>();
+    }
+
+    if (packet_capture_arm(&config) != 0) {
+        return {
+            {"status", "error"},
+            {"message", analog_manager_is_streaming() ? "pre_bits and window_us exceed 480 samples"
+                                                      : "Needs continuous analog sampling"}
+        };
+    }
+    return {
+        {"status", "ok"},
+        {"sample_us", ANALOG_SAMPLE_US}
+    };
+}
+
+static json packet_capture_cancel_handler(const json& params) {
+    (void)params;
+    packet_capture_cancel();
+    return {{"status", "ok"}};
+}
+
+static json packet_capture_status_handler(const json& params) {
+    (void)params;
+
+    PacketCaptureInfo_t info;
+    packet_capture_get_info(&info);
+    json response = {
+        {"status", "ok"},
+        {"state", packet_capture_state_name(static_cast<PacketCaptureState_t>(info.state))},
+        {"sample_us", ANALOG_SAMPLE_US}
+    };
+    if (info.state >= PACKET_CAPTURE_TRIGGERED) {
+        json bytes = json::array();
+        for (uint32_t i = 0; i < info.length; ++i) {
+            bytes.push_back(info.bytes[i]);
+        }
+        response["packet_seq"] = info.packet_seq;
+        response["bytes"] = bytes;
+        response["packet_us"] = info.packet_us;
+        response["count"] = info.count;
+        response["packet_index"] = info.packet_index;
+        response["end_index"] = info.end_index;
+    }
+    return response;
+}
+
+// The samples in mA, a page at a time; the binary opcode returns all of them in counts
+static json packet_capture_read_handler(const json& params) {
+    uint32_t first = 0;
+    uint32_t count = 200;
+    if (params.contains("first")) {
+        if (!params["first"].is_number_unsigned() || params["first"].get<uint64_t>() >= PACKET_CAPTURE_MAX_SAMPLES) {
+            return {
+                {"status", "error"},
+                {"message", "first must be 0-479"}
+            };
+        }
+        first = params["first"].get<uint32_t>();
+    }
+    if (params.contains("count")) {
+        if (!params["count"].is_number_unsigned() || params["count"].get<uint64_t>() == 0u ||
+            params["count"].get<uint64_t>() > 200u) {
+            return {
+                {"status", "error"},
+                {"message", "count must be 1-200"}
+            };
+        }
+        count = params["count"].get<uint32_t>();
+    }
+
+    uint16_t samples[200];
+    uint32_t const n = packet_capture_read(first, samples, count);
+    if (n == 0u) {
+        return {
+            {"status", "error"},
+            {"message", "No finished capture or first beyond it"}
+        };
+    }
+    json current = json::array();
+    for (uint32_t i = 0; i < n; ++i) {
+        current.push_back(analog_counts_to_ma(samples[i]));
+    }
+    return {
+        {"status", "ok"},
+        {"first", first},
+        {"current_ma", current}
+    };
+}
+
+// The last single track current conversions, streamed: all of them are some 20 KB of JSON
+static json analog_current_history_stream(const json& params, RpcStream& stream) {
+    constexpr uint32_t kMaxCount = 4000u;  // read back right after the buckets have been taken
+    uint32_t count = kMaxCount;
+    if (params.contains("count")) {
+        if (!params["count"].is_number_unsigned() || params["count"].get<uint64_t>() == 0u ||
+            params["count"].get<uint64_t>() > kMaxCount) {
+            return {
+                {"status", "error"},
+                {"message", "count must be 1-4000"}
+            };
+        }
+        count = params["count"].get<uint32_t>();
+    }
+
+    // Copied in one go, the history is overwritten long before a slow client has it all
+    static uint16_t samples[kMaxCount];
+    uint32_t const first = analog_manager_current_sample() - 2u * ANALOG_STREAM_BUCKET_SCANS - count;
+    if (analog_manager_read_current_samples(first, samples, count) != count) {
+        return {
+            {"status", "error"},
+            {"message", "Needs continuous analog sampling"}
+        };
+    }
+
+    stream.begin({
+        {"status", "ok"},
+        {"first", first},
+        {"sample_us", ANALOG_SAMPLE_US}
+    }, "current_ma");
+    for (uint32_t i = 0; i < count && stream.ok(); ++i) {
+        stream.item(analog_counts_to_ma(samples[i]));
+    }
+    stream.end(stream.ok());
+    return json();
+}
+
+static json susi_master_start_handler(const json& params) {
+    uint32_t gap_us = SUSI_MASTER_DEFAULT_GAP_US;
+    if (params.contains("gap_us")) {
+        if (!params["gap_us"].is_number_unsigned() || params["gap_us"].get<uint64_t>() == 0u ||
+            params["gap_us"].get<uint64_t>() > SUSI_MASTER_MAX_GAP_US) {
+            return {
+                {"status", "error"},
+                {"message", "gap_us must be 1-65535"}
+            };
+        }
+        gap_us = params["gap_us"].get<uint32_t>();
+    }
+
+    uint8_t byte_idle = SUSI_MASTER_DEFAULT_BYTE_IDLE;
+    if (params.contains("byte_idle")) {
+        if (!params["byte_idle"].is_number_unsigned() || params["byte_idle"].get<uint64_t>() > SUSI_MASTER_MAX_BYTE_IDLE) {
+            return {
+                {"status", "error"},
+                {"message", "byte_idle must be 0-15"}
+            };
+        }
+        byte_idle = params["byte_idle"].get<uint8_t>();
+    }
+
+    uint16_t mirror_address = 0;
+    if (params.contains("mirror_address")) {
+        if (!params["mirror_address"].is_number_unsigned() || params["mirror_address"].get<uint64_t>() > 10239u) {
+            return {
+                {"status", "error"},
+                {"message", "mirror_address must be 0-10239"}
+            };
+        }
+        mirror_address = params["mirror_address"].get<uint16_t>();
+    }
+
+    if (!SUSI_Master_StartEx(gap_us, byte_idle, mirror_address)) {
+        return {
+            {"status", "error"},
+            {"message", "SUSI master setup failed"}
+        };
+    }
+    return {
+        {"status", "ok"},
+        {"message", "SUSI master started"},
+        {"gap_us", gap_us},
+        {"byte_idle", byte_idle},
+        {"mirror_address", mirror_address}
+    };
+}
+
+static json susi_master_stop_handler(const json& params) {
+    (void)params;
+    SUSI_Master_Stop();
+    return {
+        {"status", "ok"},
+        {"message", "SUSI master stopped"}
+    };
+}
+
+static json susi_master_send_handler(const json& params) {
+    if (!params.contains("packets") || !params["packets"].is_array() || params["packets"].empty() ||
+        params["packets"].size() > SUSI_MASTER_QUEUE_SIZE) {
+        return {
+            {"status", "error"},
+            {"message", "packets must be an array of 1-64 packets"}
+        };
+    }
+
+    static SusiPacket_t packets[SUSI_MASTER_QUEUE_SIZE];
+    uint32_t count = 0;
+    for (const auto& item : params["packets"]) {
+        SusiPacket_t& packet = packets[count];
+        packet.length = 0;
+        bool valid = item.is_array() && (item.size() == 2u || item.size() == 3u);
+        for (size_t i = 0; valid && i < item.size(); ++i) {
+            valid = item[i].is_number_unsigned() && item[i].get<uint64_t>() <= 255u;
+            if (valid) {
+                packet.bytes[packet.length++] = item[i].get<uint8_t>();
+            }
+        }
+        if (!valid || packet.length != SUSI_PacketLength(packet.bytes[0])) {
+            return {
+                {"status", "error"},
+                {"message", "Each packet must be 2 bytes, 3 for commands 0x70-0x7F"},
+                {"index", count}
+            };
+        }
+        count++;
+    }
+
+    if (!SUSI_Master_Queue(packets, count)) {
+        return {
+            {"status", "error"},
+            {"message", "SUSI queue full"}
+        };
+    }
+    SusiMasterStats_t stats;
+    SUSI_Master_GetStats(&stats);
+    return {
+        {"status", "ok"},
+        {"queued", count},
+        {"count", stats.queued},
+        {"running", stats.running}
+    };
+}
+
+static json susi_master_status_handler(const json& params) {
+    (void)params;
+    SusiMasterStats_t stats;
+    SUSI_Master_GetStats(&stats);
+    return {
+        {"status", "ok"},
+        {"running", stats.running},
+        {"gap_us", stats.gap_us},
+        {"byte_idle", stats.byte_idle},
+        {"mirror_address", stats.mirror_address},
+        {"count", stats.queued},
+        {"capacity", stats.capacity},
+        {"high_water", stats.high_water},
+        {"sent", stats.sent},
+        {"mirrored", stats.mirrored},
+        {"errors", stats.errors}
+    };
+}
+
+static json susi_slave_start_handler(const json& params) {
+    (void)params;
+    if (!SUSI_Slave_Start()) {
+        return {
+            {"status", "error"},
+            {"message", "SUSI slave setup failed"}
+        };
+    }
+    return {
+        {"status", "ok"},
+        {"message", "SUSI slave started"}
+    };
+}
+
+static json susi_slave_stop_handler(const json& params) {
+    (void)params;
+    SUSI_Slave_Stop();
+    return {
+        {"status", "ok"},
+        {"message", "SUSI slave stopped"}
+    };
+}
+
+static json susi_slave_status_handler(const json& params) {
+    (void)params;
+    SusiSlaveStats_t stats;
+    SUSI_Slave_GetStats(&stats);
+    json groups = json::array();
+    for (uint32_t i = 0; i < SUSI_FG_COUNT; ++i) {
+        groups.push_back(stats.function_groups[i]);
+    }
+    return {
+        {"status", "ok"},
+        {"running", stats.running},
+        {"time_us", stats.time_us},
+        {"frames", stats.frames},
+        {"bytes", stats.bytes},
+        {"resyncs", stats.resyncs},
+        {"overflows", stats.overflows},
+        {"errors", stats.errors},
+        {"pending", stats.pending},
+        {"capacity", stats.capacity},
+        {"function_groups", groups}
+    };
+}
+
+// Frames per susi_slave_read response
+static constexpr uint32_t kSusiSlaveJsonMax = 32u;
+
+static json susi_slave_read_handler(const json& params) {
+    uint32_t max = kSusiSlaveJsonMax;
+    if (params.contains("max")) {
+        if (!params["max"].is_number_unsigned() || params["max"].get<uint64_t>() == 0u ||
+            params["max"].get<uint64_t>() > kSusiSlaveJsonMax) {
+            return {
+                {"status", "error"},
+                {"message", "max must be 1-32"}
+            };
+        }
+        max = params["max"].get<uint32_t>();
+    }
+
+    SusiFrame_t frames[kSusiSlaveJsonMax];
+    uint32_t const count = SUSI_Slave_Read(frames, max);
+    SusiSlaveStats_t stats;
+    SUSI_Slave_GetStats(&stats);
+
+    json list = json::array();
+    for (uint32_t i = 0; i < count; ++i) {
+        json bytes = json::array();
+        for (uint8_t b = 0; b < frames[i].length; ++b) {
+            bytes.push_back(frames[i].bytes[b]);
+        }
+        list.push_back({
+            {"time_us", frames[i].time_us},
+            {"bytes", bytes}
+        });
+    }
+
+    return {
+        {"status", "ok"},
+        {"running", stats.running},
+        {"overflows", stats.overflows},
+        {"pending", stats.pending},
+        {"frames", list}
+    };
+}
+
+static const char* can_sync_role_name(uint8_t role) {
+    switch (role) {
+    case CAN_SYNC_ROLE_MASTER: return "master";
+    case CAN_SYNC_ROLE_FOLLOWER: return "follower";
+    default: return "off";
+    }
+}
+
+static json can_sync_result_json(const CanSyncResult_t& result) {
+    return {
+        {"started", result.started},
+        {"running", result.running},
+        {"packets", result.packets},
+        {"matched", result.matched},
+        {"missed", result.missed},
+        {"min_us", result.min_us},
+        {"max_us", result.max_us},
+        {"mean_us", result.mean_us}
+    };
+}
+
+static json can_sync_config_handler(const json& params) {
+    if (!params.contains("role") || !params["role"].is_string()) {
+        return {
+            {"status", "error"},
+            {"message", "role must be \"master\", \"follower\" or \"off\""}
+        };
+    }
+    const auto& name = params["role"].get_ref<const json::string_t&>();
+    CanSyncRole_t role;
+    if (name == "master") {
+        role = CAN_SYNC_ROLE_MASTER;
+    } else if (name == "follower") {
+        role = CAN_SYNC_ROLE_FOLLOWER;
+    } else if (name == "off") {
+        role = CAN_SYNC_ROLE_OFF;
+    } else {
+        return {
+            {"status", "error"},
+            {"message", "role must be \"master\", \"follower\" or \"off\""}
+        };
+    }
+    uint8_t node = 0;
+    if (role == CAN_SYNC_ROLE_FOLLOWER) {
+        if (!params.contains("node") || !params["node"].is_number_unsigned() ||
+            params["node"].get<uint64_t>() == 0u || params["node"].get<uint64_t>() >= CAN_SYNC_MAX_NODES) {
+            return {
+                {"status", "error"},
+                {"message", "node must be 1-15 for a follower"}
+            };
+        }
+        node = params["node"].get<uint8_t>();
+    }
+
+    switch (can_sync_configure(role, node)) {
+    case 0:
+        break;
+    case -2:
+        return {
+            {"status", "error"},
+            {"message", "FDCAN failed to start"}
+        };
+    default:
+        return {
+            {"status", "error"},
+            {"message", "FDCAN not available"}
+        };
+    }
+    return {
+        {"status", "ok"},
+        {"role", can_sync_role_name(role)},
+        {"node", node}
+    };
+}
+
+static json can_sync_start_handler(const json& params) {
+    uint32_t lead_ms = CAN_SYNC_DEFAULT_LEAD_MS;
+    if (params.contains("lead_ms")) {
+        if (!params["lead_ms"].is_number_unsigned() || params["lead_ms"].get<uint64_t>() < CAN_SYNC_MIN_LEAD_MS ||
+            params["lead_ms"].get<uint64_t>() > CAN_SYNC_MAX_LEAD_MS) {
+            return {
+                {"status", "error"},
+                {"message", "lead_ms must be 5-5000"}
+            };
+        }
+        lead_ms = params["lead_ms"].get<uint32_t>();
+    }
+
+    switch (can_sync_start(lead_ms)) {
+    case 0:
+        break;
+    case -2:
+        return {
+            {"status", "error"},
+            {"message", "START could not be queued"}
+        };
+    default:
+        return {
+            {"status", "error"},
+            {"message", "Not configured as CAN sync master"}
+        };
+    }
+    CanSyncStatus_t status;
+    can_sync_get_status(&status);
+    return {
+        {"status", "ok"},
+        {"session", status.session},
+        {"lead_ms", lead_ms}
+    };
+}
+
+static json can_sync_stop_handler(const json& params) {
+    (void)params;
+    if (can_sync_stop() != 0) {
+        return {
+            {"status", "error"},
+            {"message", "Not configured as CAN sync master"}
+        };
+    }
+    return {
+        {"status", "ok"},
+        {"message", "CAN sync session stopped"}
+    };
+}
+
+static json can_sync_collect_handler(const json& params) {
+    (void)params;
+    static CanSyncResult_t results[CAN_SYNC_MAX_NODES];
+    if (can_sync_collect(results) != 0) {
+        return {
+            {"status", "error"},
+            {"message", "Not configured as CAN sync master"}
+        };
+    }
+    CanSyncStatus_t status;
+    can_sync_get_status(&status);
+
+    json nodes = json::array();
+    for (uint32_t node = 0; node < CAN_SYNC_MAX_NODES; ++node) {
+        if (results[node].valid) {
+            json entry = can_sync_result_json(results[node]);
+            entry["node"] = node;
+            nodes.push_back(entry);
+        }
+    }
+    return {
+        {"status", "ok"},
+        {"session", status.session},
+        {"nodes", nodes}
+    };
+}
+
+static json can_sync_status_handler(const json& params) {
+    (void)params;
+    CanSyncStatus_t status;
+    can_sync_get_status(&status);
+    json result = {
+        {"status", "ok"},
+        {"role", can_sync_role_name(status.role)},
+        {"node", status.node},
+        {"session", status.session},
+        {"lead_ms", status.lead_ms},
+        {"started", status.started},
+        {"tx_frames", status.tx_frames},
+        {"rx_frames", status.rx_frames},
+        {"tx_dropped", status.tx_dropped},
+        {"markers", status.markers},
+        {"bus_off", status.bus_off},
+        {"tx_errors", status.tx_error_count},
+        {"rx_errors", status.rx_error_count},
+        {"local", can_sync_result_json(status.local)}
+    };
+    if (status.start_error) {
+        result["start_error"] = status.start_error;
+    }
+    return result;
+}
+
+static json aux_track_start_handler(const json& params) {
+    AuxTrackConfig_t config = {
+        AUX_TRACK_DEFAULT_P_IO, AUX_TRACK_DEFAULT_N_IO, PACKET_TIMING_PROFILE_CONFIGURED, AUX_TRACK_MIN_PREAMBLE
+    };
+    uint8_t* const pins[] = {&config.p_io, &config.n_io};
+    const char* const keys[] = {"p_io", "n_io"};
+    for (size_t i = 0; i < 2u; ++i) {
+        if (params.contains(keys[i])) {
+            const json& value = params[keys[i]];
+            if (!value.is_number_unsigned() || value.get<uint64_t>() == 0u || value.get<uint64_t>() > GPIO_IO_PIN_COUNT) {
+                return {
+                    {"status", "error"},
+                    {"message", "p_io and n_io must be 1-15"}
+                };
+            }
+            *pins[i] = value.get<uint8_t>();
+        }
+    }
+    if (params.contains("preamble_bits")) {
+        if (!params["preamble_bits"].is_number_unsigned() ||
+            params["preamble_bits"].get<uint64_t>() < AUX_TRACK_MIN_PREAMBLE ||
+            params["preamble_bits"].get<uint64_t>() > AUX_TRACK_MAX_PREAMBLE) {
+            return {
+                {"status", "error"},
+                {"message", "preamble_bits must be 14-30"}
+            };
+        }
+        config.preamble_bits = params["preamble_bits"].get<uint8_t>();
+    }
+    if (params.contains("timing_profile")) {
+        if (!params["timing_profile"].is_string()) {
+            return {
+                {"status", "error"},
+                {"message", "timing_profile must be a string"}
+            };
+        }
+        config.profile = timing_profile_from_name(params["timing_profile"].get_ref<const json::string_t&>().c_str());
+        if (config.profile >= PACKET_TIMING_PROFILE_COUNT) {
+            return {
+                {"status", "error"},
+                {"message", "unknown timing_profile"}
+            };
+        }
+    }
+
+    switch (AuxTrack_Start(&config)) {
+    case 0:
+        break;
+    case -2:
+        return {
+            {"status", "error"},
+            {"message", "Output pin is captured"}
+        };
+    case -3:
+        return {
+            {"status", "error"},
+            {"message", "Aux track already running"}
+        };
+    default:
+        return {
+            {"status", "error"},
+            {"message", "Invalid configuration (pins must differ, profile halves must be symmetric)"}
+        };
+    }
+    AuxTrackStatus_t status;
+    AuxTrack_GetStatus(&status);
+    return {
+        {"status", "ok"},
+        {"p_io", status.config.p_io},
+        {"n_io", status.config.n_io},
+        {"timing_profile", timing_profiles[status.config.profile].name},
+        {"preamble_bits", status.config.preamble_bits},
+        {"bit1_us", status.bit1_us},
+        {"bit0_us", status.bit0_us}
+    };
+}
+
+static json aux_track_send_handler(const json& params) {
+    if (!params.contains("packets") || !params["packets"].is_array() || params["packets"].empty()) {
+        return {
+            {"status", "error"},
+            {"message", "packets must be a non-empty array of byte arrays"}
+        };
+    }
+    uint8_t bytes[DCC_MAX_PACKET_SIZE];
+    uint32_t queued = 0;
+    for (const auto& item : params["packets"]) {
+        bool valid = item.is_array() && !item.empty() && item.size() <= DCC_MAX_PACKET_SIZE;
+        uint8_t length = 0;
+        for (size_t i = 0; valid && i < item.size(); ++i) {
+            valid = item[i].is_number_unsigned() && item[i].get<uint64_t>() <= 255u;
+            if (valid) {
+                bytes[length++] = item[i].get<uint8_t>();
+            }
+        }
+        if (!valid) {
+            return {
+                {"status", "error"},
+                {"message", "Each packet must be 1-18 bytes 0-255"},
+                {"index", queued}
+            };
+        }
+        if (!AuxTrack_Send(bytes, length)) {
+            AuxTrackStatus_t status;
+            AuxTrack_GetStatus(&status);
+            return {
+                {"status", "error"},
+                {"message", status.running ? "Aux track queue full" : "Aux track not running"},
+                {"queued", queued}
+            };
+        }
+        queued++;
+    }
+    return {
+        {"status", "ok"},
+        {"queued", queued}
+    };
+}
+
+static json aux_track_stop_handler(const json& params) {
+    (void)params;
+    AuxTrack_Stop();
+    return {
+        {"status", "ok"},
+        {"message", "Aux track stopped"}
+    };
+}
+
+static json aux_track_status_handler(const json& params) {
+    (void)params;
+    AuxTrackStatus_t status;
+    AuxTrack_GetStatus(&status);
+    json result = {
+        {"status", "ok"},
+        {"running", status.running},
+        {"accepted", status.accepted},
+        {"rejected", status.rejected},
+        {"transmitted", status.transmitted}
+    };
+    if (status.running) {
+        result["p_io"] = status.config.p_io;
+        result["n_io"] = status.config.n_io;
+        result["timing_profile"] = timing_profiles[status.config.profile].name;
+        result["preamble_bits"] = status.config.preamble_bits;
+        result["bit1_us"] = status.bit1_us;
+        result["bit0_us"] = status.bit0_us;
+    }
+    return result;
+}
+
+static bool refresh_address_param(const json& params, uint16_t& address) {
+    if (!params.contains("address") || !params["address"].is_number_unsigned() ||
+        params["address"].get<uint64_t>() == 0u || params["address"].get<uint64_t>() > REFRESH_MAX_ADDRESS) {
+        return false;
+    }
+    address = params["address"].get<uint16_t>();
+    return true;
+}
+
+static json refresh_table_full() {
+    return {
+        {"status", "error"},
+        {"message", "Refresh table full (256 addresses)"}
+    };
+}
+
+static json refresh_speed_handler(const json& params) {
+    uint16_t address;
+    if (!refresh_address_param(params, address)) {
+        return {
+            {"status", "error"},
+            {"message", "address must be 1-10239"}
+        };
+    }
+    bool forward = true;
+    if (params.contains("forward")) {
+        if (!params["forward"].is_boolean()) {
+            return {
+                {"status", "error"},
+                {"message", "forward must be a boolean"}
+            };
+        }
+        forward = params["forward"].get<bool>();
+    }
+    uint8_t speed;
+    if (params.contains("estop") && params["estop"].is_boolean() && params["estop"].get<bool>()) {
+        speed = REFRESH_SPEED_ESTOP;
+    } else {
+        if (!params.contains("speed") || !params["speed"].is_number_unsigned() || params["speed"].get<uint64_t>() > 126u) {
+            return {
+                {"status", "error"},
+                {"message", "speed must be 0-126 (or estop true)"}
+            };
+        }
+        // Speed step n is sent as n + 1, 1 is the emergency stop
+        uint8_t const step = params["speed"].get<uint8_t>();
+        speed = step == 0u ? 0u : static_cast<uint8_t>(step + 1u);
+    }
+    if (forward) {
+        speed |= REFRESH_SPEED_FORWARD;
+    }
+
+    if (refresh_set_speed(address, speed) != 0) {
+        return refresh_table_full();
+    }
+    return {
+        {"status", "ok"},
+        {"address", address},
+        {"speed_byte", speed}
+    };
+}
+
+static json refresh_functions_handler(const json& params) {
+    uint16_t address;
+    if (!refresh_address_param(params, address)) {
+        return {
+            {"status", "error"},
+            {"message", "address must be 1-10239"}
+        };
+    }
+    if (!params.contains("functions") || !params["functions"].is_number_unsigned() ||
+        params["functions"].get<uint64_t>() >= (1u << 29)) {
+        return {
+            {"status", "error"},
+            {"message", "functions must be a bit mask of F0-F28"}
+        };
+    }
+    uint32_t const functions = params["functions"].get<uint32_t>();
+    if (refresh_set_functions(address, functions) != 0) {
+        return refresh_table_full();
+    }
+    return {
+        {"status", "ok"},
+        {"address", address},
+        {"functions", functions}
+    };
+}
+
+static json refresh_estop_handler(const json& params) {
+    (void)params;
+    refresh_emergency_stop();
+    return {
+        {"status", "ok"},
+        {"message", "Emergency stop queued for all addresses"}
+    };
+}
+
+static json refresh_release_handler(const json& params) {
+    uint16_t address;
+    if (!refresh_address_param(params, address)) {
+        return {
+            {"status", "error"},
+            {"message", "address must be 1-10239"}
+        };
+    }
+    if (refresh_release(address) != 0) {
+        return {
+            {"status", "error"},
+            {"message", "Address not in the refresh table"}
+        };
+    }
+    return {
+        {"status", "ok"},
+        {"address", address}
+    };
+}
+
+static json refresh_clear_handler(const json& params) {
+    (void)params;
+    refresh_clear();
+    return {
+        {"status", "ok"},
+        {"message", "Refresh table cleared"}
+    };
+}
+
+static constexpr uint32_t kRefreshJsonMax = 32;
+
+static json refresh_status_handler(const json& params) {
+    uint32_t first = 0;
+    if (params.contains("first")) {
+        if (!params["first"].is_number_unsigned() || params["first"].get<uint64_t>() >= REFRESH_MAX_ADDRESSES) {
+            return {
+                {"status", "error"},
+                {"message", "first must be 0-255"}
+            };
+        }
+        first = params["first"].get<uint32_t>();
+    }
+    RefreshStatus_t status;
+    refresh_get_status(&status);
+    static RefreshEntry_t entries[kRefreshJsonMax];
+    uint32_t const count = refresh_get_entries(first, entries, kRefreshJsonMax);
+
+    json table = json::array();
+    for (uint32_t i = 0; i < count; ++i) {
+        uint8_t const speed = entries[i].speed;
+        uint8_t const step = speed & 0x7Fu;
+        json entry = {
+            {"address", entries[i].address},
+            {"forward", (speed & REFRESH_SPEED_FORWARD) != 0u},
+            {"speed", step > 1u ? step - 1u : 0u},
+            {"functions", entries[i].functions}
+        };
+        if (step == REFRESH_SPEED_ESTOP) {
+            entry["estop"] = true;
+        }
+        table.push_back(entry);
+    }
+    return {
+        {"status", "ok"},
+        {"addresses", status.addresses},
+        {"pending", status.pending},
+        {"commands", status.commands},
+        {"refreshes", status.refreshes},
+        {"idles", status.idles},
+        {"coalesced", status.coalesced},
+        {"first", first},
+        {"entries", table}
+    };
+}
+
+static const char* const kFuzzClassNames[PACKET_FUZZ_CLASS_COUNT] = {
+    "idle", "speed", "function", "pom", "accessory", "random"
+};
+static const char* const kFuzzFaultNames[PACKET_FUZZ_FAULT_COUNT] = {
+    "none", "checksum", "flip", "preamble", "drop", "stretch"
+};
+
+// Optional unsigned parameter up to max, value keeps its default when absent
+static bool fuzz_unsigned_param(const json& params, const char* key, uint32_t max, uint32_t& value) {
+    if (!params.contains(key)) {
+        return true;
+    }
+    if (!params[key].is_number_unsigned() || params[key].get<uint64_t>() > max) {
+        return false;
+    }
+    value = params[key].get<uint32_t>();
+    return true;
+}
+
+static const char* parse_fuzz_config(const json& params, PacketFuzzConfig_t& config) {
+    uint32_t seed = 0;
+    uint32_t count = 0;
+    uint32_t address_min = 1;
+    uint32_t address_max = 127;
+    uint32_t invalid_percent = 0;
+    uint32_t jitter_us = 0;
+    uint32_t gap_min_us = 0;
+    uint32_t gap_max_us = 0;
+    if (!fuzz_unsigned_param(params, "seed", UINT32_MAX, seed)) {
+        return "seed must be a 32-bit unsigned integer";
+    }
+    if (!fuzz_unsigned_param(params, "count", UINT32_MAX, count)) {
+        return "count must be an unsigned integer (0 runs until stopped)";
+    }
+    if (!fuzz_unsigned_param(params, "address_min", UINT16_MAX, address_min) ||
+        !fuzz_unsigned_param(params, "address_max", UINT16_MAX, address_max)) {
+        return "address_min and address_max must be 0-10239";
+    }
+    if (!fuzz_unsigned_param(params, "invalid_percent", UINT8_MAX, invalid_percent)) {
+        return "invalid_percent must be 0-100";
+    }
+    if (!fuzz_unsigned_param(params, "jitter_us", UINT16_MAX, jitter_us)) {
+        return "jitter_us must be 0-1000";
+    }
+    if (!fuzz_unsigned_param(params, "gap_min_us", UINT32_MAX, gap_min_us) ||
+        !fuzz_unsigned_param(params, "gap_max_us", UINT32_MAX, gap_max_us)) {
+        return "gap_min_us and gap_max_us must be unsigned integers";
+    }
+    if (params.contains("gap_min_us") && !params.contains("gap_max_us")) {
+        gap_max_us = gap_min_us;
+    }
+
+    config = {};
+    config.seed = seed;
+    config.count = count;
+    config.address_min = static_cast<uint16_t>(address_min);
+    config.address_max = static_cast<uint16_t>(address_max);
+    config.invalid_percent = static_cast<uint8_t>(invalid_percent);
+    config.jitter_us = static_cast<uint16_t>(jitter_us);
+    config.gap_min_us = gap_min_us;
+    config.gap_max_us = gap_max_us;
+    config.profile = PACKET_TIMING_PROFILE_CONFIGURED;
+    config.classes = PACKET_FUZZ_CLASSES_ALL;
+
+    if (params.contains("classes")) {
+        const json& classes = params["classes"];
+        if (!classes.is_array() || classes.empty()) {
+            return "classes must be a non-empty array of class names";
+        }
+        config.classes = 0;
+        for (const auto& name : classes) {
+            uint8_t c = 0;
+            while (c < PACKET_FUZZ_CLASS_COUNT && !(name.is_string() && name == kFuzzClassNames[c])) {
+                c++;
+            }
+            if (c == PACKET_FUZZ_CLASS_COUNT) {
+                return "unknown packet class";
+            }
+            config.classes |= static_cast<uint8_t>(1u << c);
+        }
+    }
+    if (params.contains("timing_profile")) {
+        if (!params["timing_profile"].is_string()) {
+            return "timing_profile must be a string";
+        }
+        config.profile = timing_profile_from_name(params["timing_profile"].get_ref<const json::string_t&>().c_str());
+        if (config.profile >= PACKET_TIMING_PROFILE_COUNT) {
+            return "unknown timing_profile";
+        }
+    }
+    if (params.contains("trigger_invalid")) {
+        if (!params["trigger_invalid"].is_boolean()) {
+            return "trigger_invalid must be a boolean";
+        }
+        config.trigger_invalid = params["trigger_invalid"].get<bool>();
+    }
+    return nullptr;
+}
+
+static json packet_fuzz_start_handler(const json& params) {
+    PacketFuzzConfig_t config;
+    const char* error = parse_fuzz_config(params, config);
+    if (error) {
+        return {
+            {"status", "error"},
+            {"message", error}
+        };
+    }
+
+    // The configuration of a running fuzzer must not change under it, replays depend on it
+    PacketProgramStatus_t program;
+    CommandStation_GetProgramStatus(&program);
+    if (program.running) {
+        return {
+            {"status", "error"},
+            {"message", "program already running"}
+        };
+    }
+    if (PacketFuzz_Configure(&config, &error) != 0 || !CommandStation_RunFuzzer(&error)) {
+        return {
+            {"status", "error"},
+            {"message", error ? error : "Failed to start fuzzer"}
+        };
+    }
+
+    PacketFuzzStatus_t status;
+    PacketFuzz_GetStatus(&status);
+    return {
+        {"status", "ok"},
+        {"message", "Fuzzer started"},
+        {"seed", status.config.seed}
+    };
+}
+
+static json packet_fuzz_stop_handler(const json& params) {
+    (void)params;
+    CommandStation_StopProgram();
+    return {
+        {"status", "ok"},
+        {"message", "Fuzzer stop requested"}
+    };
+}
+
+static json packet_fuzz_status_handler(const json& params) {
+    (void)params;
+
+    PacketFuzzStatus_t status;
+    PacketProgramStatus_t program;
+    PacketFuzz_GetStatus(&status);
+    CommandStation_GetProgramStatus(&program);
+
+    json classes = json::object();
+    for (uint8_t c = 0; c < PACKET_FUZZ_CLASS_COUNT; c++) {
+        classes[kFuzzClassNames[c]] = status.classes[c];
+    }
+    json faults = json::object();
+    for (uint8_t f = PACKET_FUZZ_FAULT_CHECKSUM; f < PACKET_FUZZ_FAULT_COUNT; f++) {
+        faults[kFuzzFaultNames[f]] = status.faults[f];
+    }
+    return {
+        {"status", "ok"},
+        {"running", program.running},
+        {"seed", status.config.seed},
+        {"state", status.state},
+        {"count", status.config.count},
+        {"generated", status.generated},
+        {"sent", program.packets_sent},
+        {"valid", status.faults[PACKET_FUZZ_FAULT_NONE]},
+        {"invalid", status.generated - status.faults[PACKET_FUZZ_FAULT_NONE]},
+        {"classes", classes},
+        {"faults", faults}
+    };
+}
+
+static constexpr uint32_t kFuzzLogJsonMax = 16;
+
+static json packet_fuzz_log_handler(const json& params) {
+    uint32_t first = 0;
+    if (!fuzz_unsigned_param(params, "first", UINT32_MAX, first)) {
+        return {
+            {"status", "error"},
+            {"message", "first must be an unsigned integer"}
+        };
+    }
+    static PacketFuzzLogEntry_t entries[kFuzzLogJsonMax];
+    uint32_t const count = PacketFuzz_GetLog(first, entries, kFuzzLogJsonMax);
+
+    json log = json::array();
+    for (uint32_t i = 0; i < count; ++i) {
+        PacketFuzzLogEntry_t const& entry = entries[i];
+        json bytes = json::array();
+        for (uint8_t b = 0; b < entry.length; ++b) {
+            bytes.push_back(entry.bytes[b]);
+        }
+        log.push_back({
+            {"index", entry.index},
+            {"state", entry.state},
+            {"class", kFuzzClassNames[entry.packet_class]},
+            {"fault", kFuzzFaultNames[entry.fault]},
+            {"bytes", bytes},
+            {"deltaP", entry.deltaP},
+            {"deltaN", entry.deltaN},
+            {"gap_us", entry.gap_us}
+        });
+    }
+    return {
+        {"status", "ok"},
+        {"entries", log}
+    };
+}
+
+static const char* parse_accessory_sequence_config(const json& params, AccessorySequenceConfig_t& config) {
+    uint32_t address_first = 0;
+    uint32_t address_count = 1;
+    uint32_t output = 0;
+    uint32_t aspect_on = 1;
+    uint32_t aspect_off = 0;
+    uint32_t packets = 1;
+    uint32_t on_ms = 100;
+    uint32_t off_ms = 100;
+    uint32_t passes = 1;
+    uint32_t timeout_ms = 500;
+    if (!fuzz_unsigned_param(params, "address_first", UINT16_MAX, address_first) ||
+        !fuzz_unsigned_param(params, "address_count", UINT16_MAX, address_count)) {
+        return "address_first and address_count must describe a range within 0-2047";
+    }
+    if (!fuzz_unsigned_param(params, "output", 1u, output)) {
+        return "output must be 0 or 1";
+    }
+    if (!fuzz_unsigned_param(params, "aspect_on", UINT8_MAX, aspect_on) ||
+        !fuzz_unsigned_param(params, "aspect_off", UINT8_MAX, aspect_off)) {
+        return "aspect_on and aspect_off must be 0-255";
+    }
+    if (!fuzz_unsigned_param(params, "packets", UINT8_MAX, packets)) {
+        return "packets must be 1-16";
+    }
+    if (!fuzz_unsigned_param(params, "on_ms", UINT32_MAX, on_ms) ||
+        !fuzz_unsigned_param(params, "off_ms", UINT32_MAX, off_ms)) {
+        return "on_ms and off_ms must be 0-60000";
+    }
+    if (!fuzz_unsigned_param(params, "passes", UINT32_MAX, passes)) {
+        return "passes must be an unsigned integer (0 runs until stopped)";
+    }
+    if (!fuzz_unsigned_param(params, "timeout_ms", UINT32_MAX, timeout_ms)) {
+        return "timeout_ms must be 1-10000";
+    }
+
+    config = {};
+    config.type = ACCESSORY_SEQUENCE_BASIC;
+    config.address_first = static_cast<uint16_t>(address_first);
+    config.address_count = static_cast<uint16_t>(address_count);
+    config.output = static_cast<uint8_t>(output);
+    config.aspect_on = static_cast<uint8_t>(aspect_on);
+    config.aspect_off = static_cast<uint8_t>(aspect_off);
+    config.packets = static_cast<uint8_t>(packets);
+    config.on_ms = on_ms;
+    config.off_ms = off_ms;
+    config.passes = passes;
+    config.timeout_ms = timeout_ms;
+
+    if (params.contains("type")) {
+        if (!params["type"].is_string()) {
+            return "type must be basic or extended";
+        }
+        const auto& type = params["type"].get_ref<const json::string_t&>();
+        if (type == "extended") {
+            config.type = ACCESSORY_SEQUENCE_EXTENDED;
+        }
+        else if (type != "basic") {
+            return "type must be basic or extended";
+        }
+    }
+    if (params.contains("pins")) {
+        if (!params["pins"].is_array() || params["pins"].size() > ACCESSORY_SEQUENCE_MAX_PINS) {
+            return "pins must be an array of up to 15 IO numbers (1-15)";
+        }
+        for (const auto& pin : params["pins"]) {
+            if (!pin.is_number_unsigned() || pin.get<uint64_t>() < 1u || pin.get<uint64_t>() > GPIO_IO_PIN_COUNT) {
+                return "pins must be an array of up to 15 IO numbers (1-15)";
+            }
+            config.pins[config.pin_count++] = pin.get<uint8_t>();
+        }
+    }
+    return nullptr;
+}
+
+static json accessory_sequence_latency(const AccessorySequenceLatency_t& latency) {
+    return {
+        {"count", latency.count},
+        {"timeouts", latency.timeouts},
+        {"min_us", latency.count ? latency.min_us : 0u},
+        {"max_us", latency.max_us},
+        {"mean_us", latency.count ? static_cast<double>(latency.sum_us) / latency.count : 0.0}
+    };
+}
+
+static json accessory_sequence_start_handler(const json& params) {
+    AccessorySequenceConfig_t config;
+    const char* error = parse_accessory_sequence_config(params, config);
+    if (error) {
+        return {
+            {"status", "error"},
+            {"message", error}
+        };
+    }
+
+    PacketProgramStatus_t program;
+    CommandStation_GetProgramStatus(&program);
+    if (program.running) {
+        return {
+            {"status", "error"},
+            {"message", "program already running"}
+        };
+    }
+    uint16_t conflicts = 0;
+    if (AccessorySequence_Configure(&config, &error) != 0 || !CommandStation_RunAccessorySequence(&conflicts, &error)) {
+        json response = {
+            {"status", "error"},
+            {"message", error ? error : "Failed to start accessory sequence"}
+        };
+        if (conflicts) {
+            response["conflicts"] = gpio_io_list(conflicts);
+        }
+        return response;
+    }
+
+    json pins = json::array();
+    for (uint8_t i = 0; i < config.pin_count; ++i) {
+        pins.push_back(config.pins[i]);
+    }
+    return {
+        {"status", "ok"},
+        {"message", "Accessory sequence started"},
+        {"pins", pins}
+    };
+}
+
+static json accessory_sequence_stop_handler(const json& params) {
+    (void)params;
+    CommandStation_StopProgram();
+    return {
+        {"status", "ok"},
+        {"message", "Accessory sequence stop requested"}
+    };
+}
+
+static json accessory_sequence_status_handler(const json& params) {
+    (void)params;
+
+    static AccessorySequenceStatus_t status;
+    PacketProgramStatus_t program;
+    AccessorySequence_GetStatus(&status);
+    CommandStation_GetProgramStatus(&program);
+
+    json pins = json::array();
+    for (uint8_t i = 0; i < status.config.pin_count; ++i) {
+        AccessorySequenceChannel_t const& channel = status.channel[i];
+        pins.push_back({
+            {"io", status.config.pins[i]},
+            {"on", accessory_sequence_latency(channel.on)},
+            {"off", accessory_sequence_latency(channel.off)},
+            {"extra_edges", channel.extra_edges}
+        });
+    }
+    return {
+        {"status", "ok"},
+        {"running", status.running},
+        {"measuring", status.measuring},
+        {"type", status.config.type == ACCESSORY_SEQUENCE_EXTENDED ? "extended" : "basic"},
+        {"address_first", status.config.address_first},
+        {"address_count", status.config.address_count},
+        {"passes", status.config.passes},
+        {"pass", status.pass},
+        {"address", status.address},
+        {"commands", status.commands},
+        {"sent", program.packets_sent},
+        {"trials", status.trials},
+        {"pins", pins}
+    };
+}
+
+static constexpr uint32_t kRecordEntriesJsonMax = 256;
+
+static json command_station_record_start_handler(const json& params) {
+    (void)params;
+    const char* error = nullptr;
+    if (!CommandStation_RecordStart(&error)) {
+        return {{"status", "error"}, {"message", error}};
+    }
+    return {{"status", "ok"}, {"message", "Recording from the next preamble"}};
+}
+
+static json command_station_replay_start_handler(const json& params) {
+    uint32_t passes = 1;
+    if (!fuzz_unsigned_param(params, "passes", UINT32_MAX, passes)) {
+        return {{"status", "error"}, {"message", "passes must be a 32-bit unsigned integer"}};
+    }
+    const char* error = nullptr;
+    if (!CommandStation_ReplayStart(passes, &error)) {
+        return {{"status", "error"}, {"message", error}};
+    }
+    return {{"status", "ok"}, {"message", "Replay from the next preamble"}};
+}
+
+static json command_station_record_stop_handler(const json& params) {
+    (void)params;
+    CommandStation_RecordStop();
+    return {{"status", "ok"}, {"message", "Stop at the next preamble"}};
+}
+
+static json command_station_record_status_handler(const json& params) {
+    (void)params;
+    CommandStationRecordStatus_t status;
+    CommandStation_GetRecordStatus(&status);
+    return {
+        {"status", "ok"},
+        {"state", CommandStation_RecordStateName(static_cast<CommandStationRecordState_t>(status.state))},
+        {"full", status.full},
+        {"entries", status.entries},
+        {"capacity", COMMAND_STATION_RECORD_ENTRIES},
+        {"half_bits", status.half_bits},
+        {"duration_us", status.duration_us},
+        {"passes", status.passes},
+        {"pass", status.pass},
+        {"entry", status.entry}
+    };
+}
+
+static json command_station_record_read_handler(const json& params) {
+    uint32_t first = 0;
+    uint32_t count = kRecordEntriesJsonMax;
+    if (!fuzz_unsigned_param(params, "first", UINT32_MAX, first)) {
+        return {{"status", "error"}, {"message", "first must be a 32-bit unsigned integer"}};
+    }
+    if (!fuzz_unsigned_param(params, "count", kRecordEntriesJsonMax, count)) {
+        return {{"status", "error"}, {"message", "count must be 0-256"}};
+    }
+
+    static uint32_t entries[kRecordEntriesJsonMax];
+    uint32_t const read = CommandStation_RecordRead(first, entries, count);
+    json list = json::array();
+    for (uint32_t i = 0; i < read; ++i) {
+        list.push_back(entries[i]);
+    }
+    CommandStationRecordStatus_t status;
+    CommandStation_GetRecordStatus(&status);
+    return {
+        {"status", "ok"},
+        {"first", first},
+        {"total", status.entries},
+        {"entries", list}
+    };
+}
+
+static json command_station_record_write_handler(const json& params) {
+    uint32_t first = 0;
+    if (!fuzz_unsigned_param(params, "first", UINT32_MAX, first)) {
+        return {{"status", "error"}, {"message", "first must be a 32-bit unsigned integer"}};
+    }
+    if (!params.contains("entries") || !params["entries"].is_array() ||
+        params["entries"].size() > kRecordEntriesJsonMax) {
+        return {{"status", "error"}, {"message", "entries must be an array of up to 256 elements"}};
+    }
+
+    static uint32_t entries[kRecordEntriesJsonMax];
+    uint32_t count = 0;
+    for (const auto& entry : params["entries"]) {
+        if (!entry.is_number_unsigned() || entry.get<uint64_t>() > UINT32_MAX) {
+            return {{"status", "error"}, {"message", "entries must be 32-bit unsigned integers"}};
+        }
+        entries[count++] = entry.get<uint32_t>();
+    }
+    int const result = CommandStation_RecordWrite(first, entries, count);
+    if (result == -1) {
+        return {{"status", "error"}, {"message", "recording or replay active"}};
+    }
+    if (result != 0) {
+        return {
+            {"status", "error"},
+            {"message", "first must be 0 or the current length, entries must fit and have a duration"}
+        };
+    }
+    return {{"status", "ok"}, {"entries", first + count}};
+}
+
+// Decode one test step, returns nullptr on success or an error message
+static const char* parse_test_step(const json& item, TestStep_t& step) {
+    std::memset(&step, 0, sizeof(step));
+    if (!item.is_object()) {
+        return "each step must be an object";
+    }
+    if (!item.contains("test") || !item["test"].is_number_unsigned() || item["test"].get<uint64_t>() > 0xFFu) {
+        return "test must be 0-255";
+    }
+    step.test = item["test"].get<uint8_t>();
+    if (item.contains("bytes")) {
+        if (!item["bytes"].is_array() || item["bytes"].size() > TEST_CASE_MAX_PACKET) {
+            return "bytes must be an array of up to 18 elements";
+        }
+        for (const auto& byte : item["bytes"]) {
+            if (!byte.is_number_unsigned() || byte.get<uint32_t>() > 0xFF) {
+                return "byte values must be 0-255";
+            }
+            step.bytes[step.length++] = byte.get<uint8_t>();
+        }
+    }
+    if (item.contains("repeat")) {
+        if (!item["repeat"].is_number_unsigned() || item["repeat"].get<uint32_t>() == 0 ||
+            item["repeat"].get<uint32_t>() > UINT16_MAX) {
+            return "repeat must be 1-65535";
+        }
+        step.repeat = item["repeat"].get<uint16_t>();
+    }
+    if (item.contains("gap_us")) {
+        if (!item["gap_us"].is_number_unsigned()) {
+            return "gap_us must be an unsigned integer";
+        }
+        step.gap_us = item["gap_us"].get<uint32_t>();
+    }
+    if (item.contains("trigger")) {
+        if (!item["trigger"].is_boolean()) {
+            return "trigger must be a boolean";
+        }
+        if (item["trigger"].get<bool>()) {
+            step.flags |= PACKET_PROGRAM_FLAG_TRIGGER;
+        }
+    }
+    if (item.contains("timeout_ms")) {
+        if (!item["timeout_ms"].is_number_unsigned() || item["timeout_ms"].get<uint64_t>() > TEST_CASE_MAX_TIMEOUT_MS) {
+            return "timeout_ms must be 0-10000";
+        }
+        step.timeout_ms = item["timeout_ms"].get<uint16_t>();
+    }
+    if (item.contains("current_ma")) {
+        const json& range = item["current_ma"];
+        if (!range.is_array() || range.size() != 2 || !range[0].is_number_unsigned() || !range[1].is_number_unsigned() ||
+            range[0].get<uint64_t>() > range[1].get<uint64_t>() || range[1].get<uint64_t>() > UINT16_MAX) {
+            return "current_ma must be [min, max] in mA";
+        }
+        step.expect |= TEST_EXPECT_CURRENT;
+        step.current_min_ma = range[0].get<uint16_t>();
+        step.current_max_ma = range[1].get<uint16_t>();
+    }
+    if (item.contains("io")) {
+        const json& io = item["io"];
+        if (!io.is_object() || !io.contains("mask") || !io["mask"].is_number_unsigned() || io["mask"].get<uint64_t>() == 0 ||
+            io["mask"].get<uint64_t>() > UINT16_MAX || !io.contains("level") || !io["level"].is_number_unsigned() ||
+            io["level"].get<uint64_t>() > UINT16_MAX) {
+            return "io must be {\"mask\": 1-65535, \"level\": 0-65535}";
+        }
+        step.expect |= TEST_EXPECT_IO;
+        step.io_mask = io["mask"].get<uint16_t>();
+        step.io_level = io["level"].get<uint16_t>();
+    }
+    static const struct {
+        const char* key;
+        uint8_t expect;
+    } kFlags[] = {
+        {"ack", TEST_EXPECT_ACK},
+        {"railcom", TEST_EXPECT_RAILCOM},
+        {"hold", TEST_EXPECT_HOLD},
+    };
+    for (const auto& flag : kFlags) {
+        if (item.contains(flag.key)) {
+            if (!item[flag.key].is_boolean()) {
+                return "ack, railcom and hold must be booleans";
+            }
+            if (item[flag.key].get<bool>()) {
+                step.expect |= flag.expect;
+            }
+        }
+    }
+    if (step.length == 0 && !(step.expect & TEST_EXPECT_ALL)) {
+        return "a step needs bytes or an expectation";
+    }
+    return nullptr;
+}
+
+static json test_case_load_handler(const json& params) {
+    if (!params.is_object() || !params.contains("steps") || !params["steps"].is_array()) {
+        return {
+            {"status", "error"},
+            {"message", "params must contain 'steps' array"}
+        };
+    }
+
+    bool append = false;
+    if (params.contains("append")) {
+        if (!params["append"].is_boolean()) {
+            return {
+                {"status", "error"},
+                {"message", "append must be a boolean"}
+            };
+        }
+        append = params["append"].get<bool>();
+    }
+
+    if (!append && TestCase_Clear() != 0) {
+        return {
+            {"status", "error"},
+            {"message", "Cannot load tests while a run is in progress"}
+        };
+    }
+
+    uint16_t index = 0;
+    for (const auto& item : params["steps"]) {
+        TestStep_t step;
+        const char* error = parse_test_step(item, step);
+        if (error) {
+            return {
+                {"status", "error"},
+                {"message", error},
+                {"index", index}
+            };
+        }
+        if (TestCase_Append(&step, 1) != 0) {
+            return {
+                {"status", "error"},
+                {"message", "Test list full or running"},
+                {"index", index},
+                {"max_steps", TEST_CASE_MAX_STEPS}
+            };
+        }
+        index++;
+    }
+
+    return {
+        {"status", "ok"},
+        {"message", "Tests loaded"},
+        {"loaded", index},
+        {"steps", TestCase_Get(nullptr)}
+    };
+}
+
+static json test_case_run_handler(const json& params) {
+    (void)params;
+
+    const char* error = nullptr;
+    if (!CommandStation_RunTests(&error)) {
+        return {
+            {"status", "error"},
+            {"message", error ? error : "Failed to start tests"}
+        };
+    }
+    return {
+        {"status", "ok"},
+        {"message", "Tests started"}
+    };
+}
+
+static json test_case_stop_handler(const json& params) {
+    (void)params;
+    CommandStation_StopProgram();
+    return {
+        {"status", "ok"},
+        {"message", "Test stop requested"}
+    };
+}
+
+static json test_case_status_handler(const json& params) {
+    (void)params;
+
+    TestRunStatus_t status;
+    TestCase_GetStatus(&status);
+    return {
+        {"status", "ok"},
+        {"steps", status.steps},
+        {"running", status.running},
+        {"step", status.step},
+        {"results", status.results},
+        {"passed", status.passed},
+        {"failed", status.failed},
+        {"elapsed_ms", status.elapsed_ms}
+    };
+}
+
+static constexpr uint32_t kTestResultsJsonMax = 32;
+
+static json test_case_results_handler(const json& params) {
+    uint32_t first = 0;
+    if (params.contains("first")) {
+        if (!params["first"].is_number_unsigned() || params["first"].get<uint64_t>() >= TEST_CASE_MAX_RESULTS) {
+            return {
+                {"status", "error"},
+                {"message", "first must be 0-127"}
+            };
+        }
+        first = params["first"].get<uint32_t>();
+    }
+    static TestResult_t results[kTestResultsJsonMax];
+    uint32_t const count = TestCase_GetResults(first, results, kTestResultsJsonMax);
+
+    // Compact records: [test, passed, step, failed, current_ma, io, response_ms, elapsed_ms]
+    json list = json::array();
+    for (uint32_t i = 0; i < count; ++i) {
+        TestResult_t const& result = results[i];
+        list.push_back({result.test, result.passed ? 1 : 0, result.step, result.failed, result.current_ma,
+                        result.io, result.response_ms, result.elapsed_ms});
+    }
+
+    TestRunStatus_t status;
+    TestCase_GetStatus(&status);
+    return {
+        {"status", "ok"},
+        {"running", status.running},
+        {"first", first},
+        {"results", list}
+    };
+}
+
+static const char* const kMarginEdgeNames[MARGIN_EDGE_COUNT] = {
+    "bit1_min", "bit1_max", "bit0_min", "bit0_max"
+};
+
+static const char* parse_margin_config(const json& params, MarginSweepConfig_t& config) {
+    if (!params.is_object()) {
+        return "Params must be an object";
+    }
+    uint32_t address = 3;
+    uint32_t speed = 0x80u | 40u;
+    uint32_t trials = 1;
+    uint32_t resolution_us = 1;
+    uint32_t packets = 10;
+    uint32_t gap_us = 5000;
+    uint32_t timeout_ms = 1000;
+    uint32_t settle_ms = 2000;
+    uint32_t current_delta_ma = 20;
+    uint32_t io_mask = 0;
+    uint32_t io_level = 0;
+    uint32_t limits[MARGIN_EDGE_COUNT] = {30, 90, 60, 1000};
+    if (!fuzz_unsigned_param(params, "address", UINT16_MAX, address) ||
+        !fuzz_unsigned_param(params, "speed", UINT8_MAX, speed) ||
+        !fuzz_unsigned_param(params, "trials", UINT8_MAX, trials) ||
+        !fuzz_unsigned_param(params, "resolution_us", UINT8_MAX, resolution_us) ||
+        !fuzz_unsigned_param(params, "packets", UINT16_MAX, packets) ||
+        !fuzz_unsigned_param(params, "gap_us", UINT32_MAX, gap_us) ||
+        !fuzz_unsigned_param(params, "timeout_ms", UINT16_MAX, timeout_ms) ||
+        !fuzz_unsigned_param(params, "settle_ms", UINT16_MAX, settle_ms) ||
+        !fuzz_unsigned_param(params, "current_delta_ma", UINT16_MAX, current_delta_ma) ||
+        !fuzz_unsigned_param(params, "io_mask", UINT16_MAX, io_mask) ||
+        !fuzz_unsigned_param(params, "io_level", UINT16_MAX, io_level)) {
+        return "numeric parameters must be unsigned integers in range";
+    }
+    char key[24];
+    for (uint32_t e = 0; e < MARGIN_EDGE_COUNT; ++e) {
+        snprintf(key, sizeof(key), "%s_us", kMarginEdgeNames[e]);
+        if (!fuzz_unsigned_param(params, key, UINT16_MAX, limits[e])) {
+            return "limits must be unsigned integers";
+        }
+    }
+
+    config = {};
+    config.detector = MARGIN_DETECT_CURRENT;
+    if (params.contains("detector")) {
+        if (!params["detector"].is_string()) {
+            return "detector must be current or io";
+        }
+        const json::string_t& detector = params["detector"].get_ref<const json::string_t&>();
+        if (detector == "io") {
+            config.detector = MARGIN_DETECT_IO;
+        }
+        else if (detector != "current") {
+            return "detector must be current or io";
+        }
+    }
+    config.edges = MARGIN_EDGES_ALL;
+    if (params.contains("edges")) {
+        const json& edges = params["edges"];
+        if (!edges.is_array()) {
+            return "edges must be an array of edge names";
+        }
+        config.edges = 0;
+        for (const json& edge : edges) {
+            uint8_t bit = MARGIN_EDGE_COUNT;
+            for (uint8_t e = 0; e < MARGIN_EDGE_COUNT && edge.is_string(); ++e) {
+                if (edge.get_ref<const json::string_t&>() == kMarginEdgeNames[e]) {
+                    bit = e;
+                }
+            }
+            if (bit == MARGIN_EDGE_COUNT) {
+                return "edges must be bit1_min, bit1_max, bit0_min or bit0_max";
+            }
+            config.edges |= static_cast<uint8_t>(1u << bit);
+        }
+    }
+    config.address = static_cast<uint16_t>(address);
+    config.speed = static_cast<uint8_t>(speed);
+    config.trials = static_cast<uint8_t>(trials);
+    config.resolution_us = static_cast<uint8_t>(resolution_us);
+    config.packets = static_cast<uint16_t>(packets);
+    config.gap_us = gap_us;
+    config.timeout_ms = static_cast<uint16_t>(timeout_ms);
+    config.settle_ms = static_cast<uint16_t>(settle_ms);
+    config.current_delta_ma = static_cast<uint16_t>(current_delta_ma);
+    config.io_mask = static_cast<uint16_t>(io_mask);
+    config.io_level = static_cast<uint16_t>(io_level);
+    for (uint32_t e = 0; e < MARGIN_EDGE_COUNT; ++e) {
+        config.limit_us[e] = static_cast<uint16_t>(limits[e]);
+    }
+    return nullptr;
+}
+
+static json margin_sweep_json(const MarginSweepStatus_t& status) {
+    json edges = json::object();
+    for (uint32_t e = 0; e < MARGIN_EDGE_COUNT; ++e) {
+        const MarginEdgeResult_t& edge = status.edges[e];
+        if (!edge.searched) {
+            continue;
+        }
+        edges[kMarginEdgeNames[e]] = {
+            {"pass_us", edge.pass_us},
+            {"fail_us", edge.fail_us},
+            {"limited", edge.limited},
+            {"trials", edge.trials}
+        };
+    }
+    json response = {
+        {"status", "ok"},
+        {"running", status.running},
+        {"completed", status.completed},
+        {"nominal_bit1_us", status.nominal_bit1_us},
+        {"nominal_bit0_us", status.nominal_bit0_us},
+        {"rest_ma", status.rest_ma},
+        {"trials", status.trials},
+        {"elapsed_ms", status.elapsed_ms},
+        {"edges", edges}
+    };
+    if (status.running) {
+        response["edge"] = kMarginEdgeNames[status.edge];
+        response["bit1_us"] = status.bit1_us;
+        response["bit0_us"] = status.bit0_us;
+    }
+    if (status.error) {
+        response["error"] = status.error;
+    }
+    return response;
+}
+
+struct MarginSweepJob {
+    const char* error;
+};
+
+// Start the sweep and wait for it to end, a sweep takes minutes
+static void margin_sweep_run_run(RpcJob& job) {
+    MarginSweepJob& sweep = rpc_job_data<MarginSweepJob>(job);
+    sweep.error = nullptr;
+    if (!CommandStation_RunMarginSweep(&sweep.error)) {
+        return;
+    }
+    PacketProgramStatus_t program;
+    do {
+        osDelay(10);
+        CommandStation_GetProgramStatus(&program);
+    } while (program.running);
+}
+
+static json margin_sweep_run_response(const RpcJob& job) {
+    const MarginSweepJob& sweep = rpc_job_data<MarginSweepJob>(job);
+    if (sweep.error) {
+        return {
+            {"status", "error"},
+            {"message", sweep.error}
+        };
+    }
+    MarginSweepStatus_t status;
+    MarginSweep_GetStatus(&status);
+    return margin_sweep_json(status);
+}
+
+static json margin_sweep_run_handler(const json& params) {
+    MarginSweepConfig_t config;
+    const char* error = parse_margin_config(params, config);
+    if (error || MarginSweep_Configure(&config, &error) != 0) {
+        return {
+            {"status", "error"},
+            {"message", error}
+        };
+    }
+    MarginSweepJob job = {};
+    return rpc_job_execute(params, "margin_sweep_run", margin_sweep_run_run, margin_sweep_run_response, job);
+}
+
+static json margin_sweep_stop_handler(const json& params) {
+    (void)params;
+    CommandStation_StopProgram();
+    return {
+        {"status", "ok"},
+        {"message", "Margin sweep stop requested"}
+    };
+}
+
+static json margin_sweep_status_handler(const json& params) {
+    (void)params;
+    MarginSweepStatus_t status;
+    MarginSweep_GetStatus(&status);
+    return margin_sweep_json(status);
+}
+
+static const char* const kVmOpNames[PACKET_VM_OP_COUNT] = {
+    "end", "send", "gap", "wait", "read", "load", "add", "addr", "sub",
+    "and", "shr", "cmp", "cmpr", "br", "djnz", "patch", "record"
+};
+
+// One instruction: [op, a, b, c, imm], op by name, missing operands are 0
+static const char* parse_vm_instruction(const json& item, PacketVmInstruction_t& in) {
+    in = {};
+    if (!item.is_array() || item.empty() || item.size() > 5 || !item[0].is_string()) {
+        return "an instruction must be [op, a, b, c, imm]";
+    }
+    const auto& op = item[0].get_ref<const json::string_t&>();
+    in.op = PACKET_VM_OP_COUNT;
+    for (uint8_t i = 0; i < PACKET_VM_OP_COUNT; i++) {
+        if (op == kVmOpNames[i]) {
+            in.op = i;
+        }
+    }
+    if (in.op == PACKET_VM_OP_COUNT) {
+        return "unknown opcode";
+    }
+    uint8_t* const operands[3] = {&in.a, &in.b, &in.c};
+    for (size_t i = 1; i < item.size() && i < 4; i++) {
+        if (!item[i].is_number_unsigned() || item[i].get<uint64_t>() > 0xFF) {
+            return "a, b and c must be 0-255";
+        }
+        *operands[i - 1] = item[i].get<uint8_t>();
+    }
+    if (item.size() == 5) {
+        if (!item[4].is_number_integer() || item[4].get<int64_t>() < INT32_MIN || item[4].get<int64_t>() > INT32_MAX) {
+            return "imm must be a 32-bit integer";
+        }
+        in.imm = item[4].get<int32_t>();
+    }
+    return nullptr;
+}
+
+static const char* parse_vm_packet(const json& item, PacketVmPacket_t& packet) {
+    packet = {};
+    if (!item.is_array() || item.empty() || item.size() > PACKET_VM_MAX_PACKET) {
+        return "a packet must be 1-18 bytes, checksum included";
+    }
+    for (const auto& byte : item) {
+        if (!byte.is_number_unsigned() || byte.get<uint32_t>() > 0xFF) {
+            return "byte values must be 0-255";
+        }
+        packet.bytes[packet.length++] = byte.get<uint8_t>();
+    }
+    return nullptr;
+}
+
+static json packet_vm_load_handler(const json& params) {
+    if (!params.is_object()) {
+        return {
+            {"status", "error"},
+            {"message", "Params must be an object"}
+        };
+    }
+
+    if (params.contains("file")) {
+        if (!params["file"].is_number_unsigned() || params["file"].get<uint64_t>() > PACKET_VM_MAX_INDEX) {
+            return {
+                {"status", "error"},
+                {"message", "file must be 0-9999"}
+            };
+        }
+        const char* error = nullptr;
+        if (PacketVm_LoadFile(params["file"].get<uint16_t>(), &error) != 0) {
+            return {
+                {"status", "error"},
+                {"message", error ? error : "Failed to load VM program"}
+            };
+        }
+    }
+    else {
+        if (!params.contains("program") || !params["program"].is_array()) {
+            return {
+                {"status", "error"},
+                {"message", "params must contain 'program' array or 'file'"}
+            };
+        }
+        if (params.contains("packets") && !params["packets"].is_array()) {
+            return {
+                {"status", "error"},
+                {"message", "packets must be an array"}
+            };
+        }
+
+        bool append = false;
+        if (params.contains("append")) {
+            if (!params["append"].is_boolean()) {
+                return {
+                    {"status", "error"},
+                    {"message", "append must be a boolean"}
+                };
+            }
+            append = params["append"].get<bool>();
+        }
+        if (!append && PacketVm_Clear() != 0) {
+            return {
+                {"status", "error"},
+                {"message", "Cannot load a VM program while a run is in progress"}
+            };
+        }
+
+        if (params.contains("packets")) {
+            uint16_t index = 0;
+            for (const auto& item : params["packets"]) {
+                PacketVmPacket_t packet;
+                const char* error = parse_vm_packet(item, packet);
+                if (error) {
+                    return {
+                        {"status", "error"},
+                        {"message", error},
+                        {"packet", index}
+                    };
+                }
+                if (PacketVm_Append(nullptr, 0, &packet, 1) != 0) {
+                    return {
+                        {"status", "error"},
+                        {"message", "Packet table full or running"},
+                        {"packet", index},
+                        {"max_packets", PACKET_VM_MAX_PACKETS}
+                    };
+                }
+                index++;
+            }
+        }
+
+        uint16_t index = 0;
+        for (const auto& item : params["program"]) {
+            PacketVmInstruction_t in;
+            const char* error = parse_vm_instruction(item, in);
+            if (error) {
+                return {
+                    {"status", "error"},
+                    {"message", error},
+                    {"index", index}
+                };
+            }
+            if (PacketVm_Append(&in, 1, nullptr, 0) != 0) {
+                return {
+                    {"status", "error"},
+                    {"message", "VM program full or running"},
+                    {"index", index},
+                    {"max_instructions", PACKET_VM_MAX_INSTRUCTIONS}
+                };
+            }
+            index++;
+        }
+    }
+
+    PacketVmStatus_t status;
+    PacketVm_GetStatus(&status);
+    return {
+        {"status", "ok"},
+        {"message", "VM program loaded"},
+        {"instructions", status.instructions},
+        {"packets", status.packets},
+        {"name", status.name}
+    };
+}
+
+static json packet_vm_run_handler(const json& params) {
+    (void)params;
+
+    const char* error = nullptr;
+    uint16_t pc = UINT16_MAX;  // set by the verifier only
+    if (!CommandStation_RunVm(&error, &pc)) {
+        json response = {
+            {"status", "error"},
+            {"message", error ? error : "Failed to start VM program"}
+        };
+        if (pc != UINT16_MAX) {
+            response["pc"] = pc;
+        }
+        return response;
+    }
+    return {
+        {"status", "ok"},
+        {"message", "VM program started"}
+    };
+}
+
+static json packet_vm_stop_handler(const json& params) {
+    (void)params;
+    CommandStation_StopProgram();
+    return {
+        {"status", "ok"},
+        {"message", "VM stop requested"}
+    };
+}
+
+static json packet_vm_status_handler(const json& params) {
+    (void)params;
+
+    PacketVmStatus_t status;
+    PacketProgramStatus_t program;
+    PacketVm_GetStatus(&status);
+    CommandStation_GetProgramStatus(&program);
+    json registers = json::array();
+    for (int32_t value : status.registers) {
+        registers.push_back(value);
+    }
+    json response = {
+        {"status", "ok"},
+        {"instructions", status.instructions},
+        {"packets", status.packets},
+        {"name", status.name},
+        {"running", status.running},
+        {"pc", status.pc},
+        {"executed", status.executed},
+        {"yields", status.yields},
+        {"records", status.records},
+        {"dropped", status.dropped},
+        {"exit_code", status.exit_code},
+        {"stopped", status.stopped},
+        {"elapsed_ms", status.elapsed_ms},
+        {"packets_sent", program.packets_sent},
+        {"registers", registers}
+    };
+    if (status.file >= 0) {
+        response["file"] = status.file;
+    }
+    return response;
+}
+
+static constexpr uint32_t kVmRecordsJsonMax = 32;
+
+static json packet_vm_records_handler(const json& params) {
+    uint32_t first = 0;
+    if (params.contains("first")) {
+        if (!params["first"].is_number_unsigned() || params["first"].get<uint64_t>() >= PACKET_VM_MAX_RECORDS) {
+            return {
+                {"status", "error"},
+                {"message", "first must be 0-255"}
+            };
+        }
+        first = params["first"].get<uint32_t>();
+    }
+    static PacketVmRecord_t records[kVmRecordsJsonMax];
+    uint32_t const count = PacketVm_GetRecords(first, records, kVmRecordsJsonMax);
+
+    // Compact records: [pc, tag, tick_ms, values...]
+    json list = json::array();
+    for (uint32_t i = 0; i < count; ++i) {
+        PacketVmRecord_t const& record = records[i];
+        json entry = {record.pc, record.tag, record.tick_ms};
+        for (uint8_t v = 0; v < record.count; v++) {
+            entry.push_back(record.values[v]);
+        }
+        list.push_back(entry);
+    }
+
+    PacketVmStatus_t status;
+    PacketVm_GetStatus(&status);
+    return {
+        {"status", "ok"},
+        {"running", status.running},
+        {"first", first},
+        {"records", list}
+    };
+}
+
+static json get_rtc_datetime_handler(const json& params) {
+    (void)params;  // Unused parameter
+    
+    RTC_TimeTypeDef sTime = {0};
+    RTC_DateTypeDef sDate = {0};
+    
+    // Read time and date from RTC
+    if (HAL_RTC_GetTime(&hrtc, &sTime, RTC_FORMAT_BIN) != HAL_OK) {
+        return {
+            {"status", "error"},
+            {"message", "Failed to read RTC time"}
+        };
+    }
+    
+    if (HAL_RTC_GetDate(&hrtc, &sDate, RTC_FORMAT_BIN) != HAL_OK) {
+        return {
+            {"status", "error"},
+            {"message", "Failed to read RTC date"}
+        };
+    }
+    
+    // Format date and time strings
+    char date_str[16];
+    char time_str[16];
+    snprintf(date_str, sizeof(date_str), "20%02d-%02d-%02d", 
+             sDate.Year, sDate.Month, sDate.Date);
+    snprintf(time_str, sizeof(time_str), "%02d:%02d:%02d", 
+             sTime.Hours, sTime.Minutes, sTime.Seconds);
+    
+    return {
+        {"status", "ok"},
+        {"date", date_str},
+        {"time", time_str},
+        {"year", sDate.Year + 2000},
+        {"month", sDate.Month},
+        {"day", sDate.Date},
+        {"weekday", sDate.WeekDay},
+        {"hours", sTime.Hours},
+        {"minutes", sTime.Minutes},
+        {"seconds", sTime.Seconds}
+    };
+}
+
+static json set_rtc_datetime_handler(const json& params) {
+    RTC_TimeTypeDef sTime = {0};
+    RTC_DateTypeDef sDate = {0};
+    bool set_date = false;
+    bool set_time = false;
+    
+    // Check for date parameters
+    if (params.contains("year") && params.contains("month") && params.contains("day")) {
+        if (!params["year"].is_number_integer() || 
+            !params["month"].is_number_integer() || 
+            !params["day"].is_number_integer()) {
+            return {
+                {"status", "error"},
+                {"message", "Date parameters must be integers"}
+            };
+        }
+        
+        int year = params["year"].get<int>();
+        int month = params["month"].get<int>();
+        int day = params["day"].get<int>();
+        
+        // Validate date ranges
+        if (year < 2000 || year > 2099) {
+            return {
+                {"status", "error"},
+                {"message", "Year must be between 2000 and 2099"}
+            };
+        }
+        if (month < 1 || month > 12) {
+            return {
+                {"status", "error"},
+                {"message", "Month must be between 1 and 12"}
+            };
+        }
+        if (day < 1 || day > 31) {
+            return {
+                {"status", "error"},
+                {"message", "Day must be between 1 and 31"}
+            };
+        }
+        
+        sDate.Year = year - 2000;
+        sDate.Month = month;
+        sDate.Date = day;
+        
+        // Optional weekday parameter (1-7, Monday=1)
+        if (params.contains("weekday") && params["weekday"].is_number_integer()) {
+            int weekday = params["weekday"].get<int>();
+            if (weekday < 1 || weekday > 7) {
+                return {
+                    {"status", "error"},
+                    {"message", "Weekday must be between 1 (Monday) and 7 (Sunday)"}
+                };
+            }
+            sDate.WeekDay = weekday;
+        } else {
+            sDate.WeekDay = RTC_WEEKDAY_MONDAY;  // Default
+        }
+        
+        set_date = true;
+    }
+    
+    // Check for time parameters
+    if (params.contains("hours") && params.contains("minutes") && params.contains("seconds")) {
+        if (!params["hours"].is_number_integer() || 
+            !params["minutes"].is_number_integer() || 
+            !params["seconds"].is_number_integer()) {
+            return {
+                {"status", "error"},
+                {"message", "Time parameters must be integers"}
+            };
+        }
+        
+        int hours = params["hours"].get<int>();
+        int minutes = params["minutes"].get<int>();
+        int seconds = params["seconds"].get<int>();
+        
+        // Validate time ranges
+        if (hours < 0 || hours > 23) {
+            return {
+                {"status", "error"},
+                {"message", "Hours must be between 0 and 23"}
+            };
+        }
+        if (minutes < 0 || minutes > 59) {
+            return {
+                {"status", "error"},
+                {"message", "Minutes must be between 0 and 59"}
+            };
+        }
+        if (seconds < 0 || seconds > 59) {
+            return {
+                {"status", "error"},
+                {"message", "Seconds must be between 0 and 59"}
+            };
+        }
+        
+        sTime.Hours = hours;
+        sTime.Minutes = minutes;
+        sTime.Seconds = seconds;
+        sTime.DayLightSaving = RTC_DAYLIGHTSAVING_NONE;
+        sTime.StoreOperation = RTC_STOREOPERATION_RESET;
+        
+        set_time = true;
+    }
+    
+    // Check if at least date or time was provided
+    if (!set_date && !set_time) {
+        return {
+            {"status", "error"},
+            {"message", "Must provide date (year, month, day) and/or time (hours, minutes, seconds)"}
+        };
+    }
+    
+    // Set date if provided
+    if (set_date) {
+        if (HAL_RTC_SetDate(&hrtc, &sDate, RTC_FORMAT_BIN) != HAL_OK) {
+            return {
+                {"status", "error"},
+                {"message", "Failed to set RTC date"}
+            };
+        }
+    }
+    
+    // Set time if provided
+    if (set_time) {
+        if (HAL_RTC_SetTime(&hrtc, &sTime, RTC_FORMAT_BIN) != HAL_OK) {
+            return {
+                {"status", "error"},
+                {"message", "Failed to set RTC time"}
+            };
+        }
+    }
+    
+    timebase_rtc_changed();
+
+    json response = {
+        {"status", "ok"},
+        {"message", "RTC updated successfully"}
+    };
+    
+    if (set_date) {
+        response["date_set"] = true;
+    }
+    if (set_time) {
+        response["time_set"] = true;
+    }
+    
+    return response;
+}
+
+static json command_station_get_params_handler(const json& params) {
+    (void)params;  // Unused parameter
+    
+    // Retrieve all command station parameters
+    uint16_t track_voltage = 0;
+    uint8_t preamble_bits = 0;
+    uint8_t bit1_duration = 0;
+    uint8_t bit0_duration = 0;
+    uint8_t bidi_enable = 0;
+    uint16_t bidi_dac = 0;
+    uint8_t trigger_first_bit = 0;
+    uint8_t dma_transmit = 0;
+    
+    // Get persistent parameters from parameter manager
+    if (get_dcc_track_voltage(&track_voltage) != 0 ||
+        get_dcc_preamble_bits(&preamble_bits) != 0 ||
+        get_dcc_bit1_duration(&bit1_duration) != 0 ||
+        get_dcc_bit0_duration(&bit0_duration) != 0 ||
+        get_dcc_bidi_enable(&bidi_enable) != 0 ||
+        get_dcc_bidi_dac(&bidi_dac) != 0 ||
+        get_dcc_trigger_first_bit(&trigger_first_bit) != 0 ||
+        get_dcc_dma_transmit(&dma_transmit) != 0) {
+        return {
+            {"status", "error"},
+            {"message", "Failed to retrieve one or more parameters"}
+        };
+    }
+    
+    // Get RAM-only override parameters from command station
+    uint64_t zerobit_override_mask = CommandStation_GetZerobitOverrideMask();
+    int32_t zerobit_deltaP = CommandStation_GetZerobitDeltaP();
+    int32_t zerobit_deltaN = CommandStation_GetZerobitDeltaN();
+    
+    // Convert uint64_t to hex string for JSON compatibility
+    char mask_str[19];  // "0x" + 16 hex digits + null terminator
+    snprintf(mask_str, sizeof(mask_str), "0x%016llX", (unsigned long long)zerobit_override_mask);
+    
+    return {
+        {"status", "ok"},
+        {"parameters", {
+            {"track_voltage", track_voltage},
+            {"preamble_bits", preamble_bits},
+            {"bit1_duration", bit1_duration},
+            {"bit0_duration", bit0_duration},
+            {"bidi_enable", bidi_enable != 0},
+            {"bidi_dac", bidi_dac},
+            {"trigger_first_bit", trigger_first_bit != 0},
+            {"dma_transmit", dma_transmit != 0},
+            {"zerobit_override_mask", mask_str},
+            {"zerobit_deltaP", zerobit_deltaP},
+            {"zerobit_deltaN", zerobit_deltaN}
+        }}
+    };
+}
+
+static json system_usb_status_handler(const json& params) {
+    (void)params;
+
+    uint32_t device_configured = 0;
+    uint32_t cdc_active = 0;
+    UsbCdcAcm_GetStatus(&device_configured, &cdc_active);
+    UsbCdcRxStats_t rx;
+    UsbCdcAcm_GetRxStats(&rx);
+
+    return {
+        {"status", "ok"},
+        {"usb", {
+            {"device_configured", device_configured != 0U},
+            {"cdc_active", cdc_active != 0U}
+        }},
+        {"rx", {
+            {"frames", rx.frames},
+            {"dropped", rx.dropped},
+            {"overflows", rx.overflows},
+            {"resyncs", rx.resyncs},
+            {"stalls", rx.stalls},
+            {"free_buffers", rx.free_buffers}
+        }}
+    };
+}
+
+static json network_status_handler(const json& params) {
+    (void)params;
+
+    NetxRpcStats_t net;
+    NetxRpc_GetStats(&net);
+    char ip_address[16];
+    snprintf(ip_address, sizeof(ip_address), "%lu.%lu.%lu.%lu", (net.ip_address >> 24) & 0xffUL,
+             (net.ip_address >> 16) & 0xffUL, (net.ip_address >> 8) & 0xffUL, net.ip_address & 0xffUL);
+
+    return {
+        {"status", "ok"},
+        {"ip_address", ip_address},
+        {"port", net.port},
+        {"client_connected", net.client_connected},
+        {"stats", {
+            {"connections", net.connections},
+            {"requests", net.requests},
+            {"reassembled", net.reassembled},
+            {"overflows", net.overflows},
+            {"dropped", net.dropped},
+            {"tx_errors", net.tx_errors}
+        }}
+    };
+}
+
+// Dotted quad to a NetX address (host order), returns false if malformed
+static bool parse_ipv4(const char* text, uint32_t& address) {
+    address = 0;
+    for (int part = 0; part < 4; ++part) {
+        if (*text < '0' || *text > '9') {
+            return false;
+        }
+        uint32_t value = 0;
+        while (*text >= '0' && *text <= '9') {
+            value = value * 10u + static_cast<uint32_t>(*text++ - '0');
+            if (value > 255u) {
+                return false;
+            }
+        }
+        if (*text != (part < 3 ? '.' : '\0')) {
+            return false;
+        }
+        if (part < 3) {
+            text++;
+        }
+        address = (address << 8) | value;
+    }
+    return true;
+}
+
+static json telemetry_control_handler(const json& params) {
+    if (!params.contains("enable") || !params["enable"].is_boolean()) {
+        return {
+            {"status", "error"},
+            {"message", "Missing or invalid 'enable' parameter"}
+        };
+    }
+    if (!params["enable"].get<bool>()) {
+        telemetry_stop();
+        return {
+            {"status", "ok"},
+            {"message", "Telemetry disabled"}
+        };
+    }
+
+    uint32_t host_ip = 0;
+    if (!params.contains("host") || !params["host"].is_string() ||
+        !parse_ipv4(params["host"].get_ref<const json::string_t&>().c_str(), host_ip) || host_ip == 0) {
+        return {
+            {"status", "error"},
+            {"message", "host must be an IPv4 address"}
+        };
+    }
+
+    uint16_t network_port = 2560;
+    get_network_port(&network_port);
+    uint32_t port = network_port + 1u;
+    if (params.contains("port")) {
+        if (!params["port"].is_number_unsigned() || params["port"].get<uint32_t>() == 0 ||
+            params["port"].get<uint32_t>() > 65535u) {
+            return {
+                {"status", "error"},
+                {"message", "port must be 1-65535"}
+            };
+        }
+        port = params["port"].get<uint32_t>();
+    }
+
+    uint32_t decimation = 1;
+    if (params.contains("decimation")) {
+        if (!params["decimation"].is_number_unsigned() || params["decimation"].get<uint32_t>() == 0 ||
+            params["decimation"].get<uint32_t>() > 1000u) {
+            return {
+                {"status", "error"},
+                {"message", "decimation must be 1-1000"}
+            };
+        }
+        decimation = params["decimation"].get<uint32_t>();
+    }
+
+    uint32_t latency_ms = TELEMETRY_DEFAULT_LATENCY_MS;
+    if (params.contains("latency_ms")) {
+        if (!params["latency_ms"].is_number_unsigned() || params["latency_ms"].get<uint32_t>() > 1000u) {
+            return {
+                {"status", "error"},
+                {"message", "latency_ms must be 0-1000"}
+            };
+        }
+        latency_ms = params["latency_ms"].get<uint32_t>();
+    }
+
+    if (telemetry_start(host_ip, static_cast<uint16_t>(port), static_cast<uint16_t>(decimation), latency_ms) != 0) {
+        return {
+            {"status", "error"},
+            {"message", "Telemetry requires continuous analog sampling and the network"}
+        };
+    }
+
+    return {
+        {"status", "ok"},
+        {"message", "Telemetry enabled"},
+        {"port", port},
+        {"rate_hz", 1000u / decimation}
+    };
+}
+
+static json telemetry_status_handler(const json& params) {
+    (void)params;
+
+    TelemetryStats_t stats;
+    telemetry_get_stats(&stats);
+    char host[16];
+    snprintf(host, sizeof(host), "%lu.%lu.%lu.%lu", (stats.host_ip >> 24) & 0xffUL, (stats.host_ip >> 16) & 0xffUL,
+             (stats.host_ip >> 8) & 0xffUL, stats.host_ip & 0xffUL);
+
+    return {
+        {"status", "ok"},
+        {"enabled", stats.enabled},
+        {"host", host},
+        {"port", stats.host_port},
+        {"decimation", stats.decimation},
+        {"records", stats.records},
+        {"datagrams", stats.datagrams},
+        {"lost", stats.lost},
+        {"tx_errors", stats.tx_errors}
+    };
+}
+
+static json usb_capture_start_handler(const json& params) {
+    uint32_t mask = 1u << USB_CAPTURE_SOURCE_CURRENT;
+    if (params.contains("sources")) {
+        if (!params["sources"].is_array() || params["sources"].empty()) {
+            return {
+                {"status", "error"},
+                {"message", "sources must be a non-empty array"}
+            };
+        }
+        mask = 0;
+        for (const auto& source : params["sources"]) {
+            uint32_t i = 0;
+            while (i < USB_CAPTURE_SOURCE_COUNT &&
+                   !(source.is_string() && source.get_ref<const json::string_t&>() ==
+                                               usb_capture_source_name(static_cast<UsbCaptureSource_t>(i)))) {
+                ++i;
+            }
+            if (i == USB_CAPTURE_SOURCE_COUNT) {
+                return {
+                    {"status", "error"},
+                    {"message", "sources may contain current and sniffer"}
+                };
+            }
+            mask |= 1u << i;
+        }
+    }
+
+    if (usb_capture_start(mask) != 0) {
+        return {
+            {"status", "error"},
+            {"message", "The current source requires continuous analog sampling"}
+        };
+    }
+
+    return {
+        {"status", "ok"},
+        {"message", "USB capture started"},
+        {"source_mask", mask},
+        {"block_size", USB_CAPTURE_BLOCK_SIZE}
+    };
+}
+
+static json usb_capture_stop_handler(const json& params) {
+    (void)params;
+
+    usb_capture_stop();
+    return {
+        {"status", "ok"},
+        {"message", "USB capture stopped"}
+    };
+}
+
+static json usb_capture_status_handler(const json& params) {
+    (void)params;
+
+    UsbCaptureStats_t stats;
+    usb_capture_get_stats(&stats);
+    json sources = json::array();
+    for (uint32_t i = 0; i < USB_CAPTURE_SOURCE_COUNT; i++) {
+        if (stats.sources & (1u << i)) {
+            sources.push_back(usb_capture_source_name(static_cast<UsbCaptureSource_t>(i)));
+        }
+    }
+
+    return {
+        {"status", "ok"},
+        {"enabled", stats.enabled},
+        {"listening", stats.listening},
+        {"sources", sources},
+        {"blocks", stats.blocks},
+        {"bytes", stats.bytes},
+        {"gaps", stats.gaps},
+        {"lost_samples", stats.lost_samples},
+        {"discarded", stats.discarded},
+        {"tx_errors", stats.tx_errors},
+        {"free_blocks", stats.free_blocks}
+    };
+}
+
+static json recorder_start_handler(const json& params) {
+    static const char* const kChannelNames[RECORDER_CHANNELS] = {"analog", "packets", "decoder"};
+
+    uint32_t mask = (1u << RECORDER_CHANNEL_ANALOG) | (1u << RECORDER_CHANNEL_PACKETS);
+    if (params.contains("channels")) {
+        if (!params["channels"].is_array() || params["channels"].empty()) {
+            return {
+                {"status", "error"},
+                {"message", "channels must be a non-empty array"}
+            };
+        }
+        mask = 0;
+        for (const auto& channel : params["channels"]) {
+            uint32_t i = 0;
+            while (i < RECORDER_CHANNELS && !(channel.is_string() && channel.get_ref<const json::string_t&>() == kChannelNames[i])) {
+                ++i;
+            }
+            if (i == RECORDER_CHANNELS) {
+                return {
+                    {"status", "error"},
+                    {"message", "channels may contain analog, packets and decoder"}
+                };
+            }
+            mask |= 1u << i;
+        }
+    }
+
+    uint32_t max_file_mb = RECORDER_DEFAULT_FILE_MB;
+    if (params.contains("max_file_mb")) {
+        if (!params["max_file_mb"].is_number_unsigned() || params["max_file_mb"].get<uint32_t>() == 0 ||
+            params["max_file_mb"].get<uint32_t>() > RECORDER_MAX_FILE_MB) {
+            return {
+                {"status", "error"},
+                {"message", "max_file_mb must be 1-4000"}
+            };
+        }
+        max_file_mb = params["max_file_mb"].get<uint32_t>();
+    }
+
+    bool widths = false;
+    if (params.contains("widths")) {
+        if (!params["widths"].is_boolean()) {
+            return {
+                {"status", "error"},
+                {"message", "widths must be a boolean"}
+            };
+        }
+        widths = params["widths"].get<bool>();
+    }
+
+    switch (recorder_start(mask, max_file_mb, widths)) {
+    case 0:
+        return {
+            {"status", "ok"},
+            {"message", "Recording started"},
+            {"channel_mask", mask}
+        };
+    case -1:
+        return {
+            {"status", "error"},
+            {"message", "No SD card mounted"}
+        };
+    case -2:
+        return {
+            {"status", "error"},
+            {"message", "The analog channel requires continuous analog sampling"}
+        };
+    default:
+        return {
+            {"status", "error"},
+            {"message", "Already recording"}
+        };
+    }
+}
+
+static json recorder_stop_handler(const json& params) {
+    (void)params;
+    recorder_stop();
+    return {
+        {"status", "ok"},
+        {"message", "Recording stopped"}
+    };
+}
+
+static json recorder_status_handler(const json& params) {
+    (void)params;
+
+    RecorderStats_t stats;
+    recorder_get_stats(&stats);
+    return {
+        {"status", "ok"},
+        {"active", stats.active},
+        {"media", stats.media},
+        {"channel_mask", stats.channel_mask},
+        {"file_index", stats.file_index},
+        {"files", stats.files},
+        {"blocks", stats.blocks},
+        {"bytes", stats.bytes},
+        {"records", stats.records},
+        {"lost", stats.lost},
+        {"write_errors", stats.write_errors}
+    };
+}
+
+static json packet_suite_run_handler(const json& params) {
+    if (!params.contains("suite") || !params["suite"].is_number_unsigned() ||
+        params["suite"].get<uint32_t>() > PACKET_SUITE_MAX_INDEX) {
+        return {
+            {"status", "error"},
+            {"message", "suite must be 0-9999"}
+        };
+    }
+    uint16_t suite = static_cast<uint16_t>(params["suite"].get<uint32_t>());
+
+    uint8_t profile = PACKET_TIMING_PROFILE_CONFIGURED;
+    if (params.contains("timing_profile")) {
+        if (!params["timing_profile"].is_string()) {
+            return {
+                {"status", "error"},
+                {"message", "timing_profile must be a string"}
+            };
+        }
+        profile = timing_profile_from_name(params["timing_profile"].get_ref<const json::string_t&>().c_str());
+        if (profile >= PACKET_TIMING_PROFILE_COUNT) {
+            return {
+                {"status", "error"},
+                {"message", "unknown timing_profile"}
+            };
+        }
+    }
+
+    uint32_t loops = 1;
+    if (params.contains("loops")) {
+        if (!params["loops"].is_number_unsigned()) {
+            return {
+                {"status", "error"},
+                {"message", "loops must be an unsigned integer (0 repeats until stopped)"}
+            };
+        }
+        loops = params["loops"].get<uint32_t>();
+    }
+
+    uint32_t gap_us = 0;
+    if (params.contains("gap_us")) {
+        if (!params["gap_us"].is_number_unsigned() || params["gap_us"].get<uint32_t>() == 0) {
+            return {
+                {"status", "error"},
+                {"message", "gap_us must be a positive integer"}
+            };
+        }
+        gap_us = params["gap_us"].get<uint32_t>();
+    }
+
+    PacketProgramStatus_t program;
+    CommandStation_GetProgramStatus(&program);
+    if (program.running) {
+        return {
+            {"status", "error"},
+            {"message", "program already running"}
+        };
+    }
+
+    // A loaded suite is reused, resident suites then run without touching the card
+    const char* error = nullptr;
+    PacketSuiteStatus_t status;
+    PacketSuite_GetStatus(&status);
+    if ((!status.loaded || status.index != suite || gap_us != 0) && PacketSuite_Load(suite, gap_us, &error) != 0) {
+        return {
+            {"status", "error"},
+            {"message", error ? error : "Failed to load suite"}
+        };
+    }
+    if (!CommandStation_RunSuite(profile, loops, &error)) {
+        return {
+            {"status", "error"},
+            {"message", error ? error : "Failed to start suite"}
+        };
+    }
+
+    PacketSuite_GetStatus(&status);
+    return {
+        {"status", "ok"},
+        {"message", "Suite started"},
+        {"vectors", status.vectors},
+        {"resident", status.resident}
+    };
+}
+
+static json packet_suite_stop_handler(const json& params) {
+    (void)params;
+    CommandStation_StopProgram();
+    return {
+        {"status", "ok"},
+        {"message", "Suite stop requested"}
+    };
+}
+
+static json packet_suite_status_handler(const json& params) {
+    (void)params;
+
+    PacketSuiteStatus_t status;
+    PacketProgramStatus_t program;
+    PacketSuite_GetStatus(&status);
+    CommandStation_GetProgramStatus(&program);
+    return {
+        {"status", "ok"},
+        {"loaded", status.loaded},
+        {"suite", status.index},
+        {"name", status.name},
+        {"resident", status.resident},
+        {"vectors", status.vectors},
+        {"size", status.size},
+        {"vectors_read", status.vectors_read},
+        {"underruns", status.underruns},
+        {"running", program.running},
+        {"packets_sent", program.packets_sent}
+    };
+}
+
+static int hex_digit(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+static const char* packet_suite_write_error(int result) {
+    switch (result) {
+    case -1: return "No SD card mounted";
+    case -2: return "offset must equal the current file size";
+    default: return "SD card write error";
+    }
+}
+
+static json packet_suite_write_handler(const json& params) {
+    static constexpr size_t kMaxChunk = 1024;
+
+    if (!params.contains("suite") || !params["suite"].is_number_unsigned() ||
+        params["suite"].get<uint32_t>() > PACKET_SUITE_MAX_INDEX) {
+        return {
+            {"status", "error"},
+            {"message", "suite must be 0-9999"}
+        };
+    }
+    if (!params.contains("offset") || !params["offset"].is_number_unsigned()) {
+        return {
+            {"status", "error"},
+            {"message", "offset must be an unsigned integer"}
+        };
+    }
+    if (!params.contains("data") || !params["data"].is_string()) {
+        return {
+            {"status", "error"},
+            {"message", "data must be a hex string"}
+        };
+    }
+
+    const json::string_t& hex = params["data"].get_ref<const json::string_t&>();
+    if (hex.size() % 2u != 0 || hex.size() / 2u > kMaxChunk) {
+        return {
+            {"status", "error"},
+            {"message", "data must be an even number of hex digits, at most 1024 bytes"}
+        };
+    }
+    uint8_t data[kMaxChunk];
+    size_t length = hex.size() / 2u;
+    for (size_t i = 0; i < length; ++i) {
+        int high = hex_digit(hex[2u * i]);
+        int low = hex_digit(hex[2u * i + 1u]);
+        if (high < 0 || low < 0) {
+            return {
+                {"status", "error"},
+                {"message", "data must be a hex string"}
+            };
+        }
+        data[i] = static_cast<uint8_t>((high << 4) | low);
+    }
+
+    uint32_t offset = params["offset"].get<uint32_t>();
+    int result = PacketSuite_Write(static_cast<uint16_t>(params["suite"].get<uint32_t>()), offset, data,
+                                   static_cast<uint32_t>(length));
+    if (result != 0) {
+        return {
+            {"status", "error"},
+            {"message", packet_suite_write_error(result)}
+        };
+    }
+    return {
+        {"status", "ok"},
+        {"size", offset + length}
+    };
+}
+
+static json rpc_binary_mode_handler(const json& params) {
+    bool enable = true;
+    if (params.is_object() && params.contains("enable")) {
+        if (!params["enable"].is_boolean()) {
+            return {
+                {"status", "error"},
+                {"message", "enable must be a boolean"}
+            };
+        }
+        enable = params["enable"].get<bool>();
+    }
+
+    RpcBinary_SetEnabled(enable);
+
+    return {
+        {"status", "ok"},
+        {"binary", enable},
+        {"version", RPC_BIN_VERSION},
+        {"max_payload", RPC_BIN_MAX_PAYLOAD}
+    };
+}
+
+static json rpc_arena_status_handler(const json& params) {
+    (void)params;
+
+    return {
+        {"status", "ok"},
+        {"arena", {
+            {"capacity", RpcArena::capacity()},
+            {"used", RpcArena::used()},
+            {"peak", RpcArena::peak()},
+            {"heap_fallbacks", RpcArena::heapFallbacks()}
+        }}
+    };
+}
+
+static json rpc_jobs_status_handler(const json& params) {
+    (void)params;
+
+    static const char* const kStateNames[] = {"free", "queued", "running", "done"};
+    json jobs = json::array();
+    uint32_t now = HAL_GetTick();
+    for (size_t i = 0; i < RPC_JOB_SLOTS; ++i) {
+        const RpcJob& job = RpcJobs_Slot(i);
+        uint8_t state = job.state.load(std::memory_order_acquire);
+        if (state == RPC_JOB_FREE) {
+            continue;
+        }
+        jobs.push_back({
+            {"job_id", job.id},
+            {"method", job.method},
+            {"state", kStateNames[state]},
+            {"elapsed_ms", state == RPC_JOB_DONE ? job.duration_ms : now - job.queued_ms}
+        });
+    }
+
+    return {
+        {"status", "ok"},
+        {"slots", RPC_JOB_SLOTS},
+        {"workers", RPC_JOB_WORKERS},
+        {"jobs", jobs}
+    };
+}
+
+static json rpc_bus_status_handler(const json& params) {
+    (void)params;
+
+    RpcLaneStats_t stats[RPC_LANE_COUNT];
+    RpcBus_GetStats(stats);
+    json lanes = json::object();
+    for (uint32_t i = 0; i < RPC_LANE_COUNT; ++i) {
+        lanes[RpcBus_LaneName(static_cast<RpcLane_t>(i))] = {
+            {"posted", stats[i].posted},
+            {"served", stats[i].served},
+            {"pending", stats[i].pending},
+            {"high_water", stats[i].high_water},
+            {"max_wait_ms", stats[i].max_wait_ms},
+            {"dropped", stats[i].dropped}
+        };
+    }
+
+    return {
+        {"status", "ok"},
+        {"depth", RPC_BUS_DEPTH},
+        {"lanes", lanes}
+    };
+}
+
+static json system_profile_handler(const json& params) {
+    bool reset = false;
+    if (params.contains("reset")) {
+        if (!params["reset"].is_boolean()) {
+            return {{"status", "error"}, {"message", "reset must be a boolean"}};
+        }
+        reset = params["reset"].get<bool>();
+    }
+
+    ProfilerSnapshot_t snapshot;
+    profiler_snapshot(&snapshot);
+    if (reset) {
+        profiler_reset();
+    }
+
+    auto percent = [&snapshot](uint64_t cycles) {
+        return profiler_permille(cycles, snapshot.total_cycles) / 10.0;
+    };
+    auto microseconds = [&snapshot](uint64_t cycles) {
+        return snapshot.cpu_hz ? static_cast<uint32_t>(cycles * 1000000u / snapshot.cpu_hz) : 0u;
+    };
+
+    json threads = json::array();
+    for (uint32_t i = 0; i < snapshot.thread_count; ++i) {
+        const ProfilerThread_t& thread = snapshot.threads[i];
+        threads.push_back({
+            {"name", thread.name},
+            {"priority", thread.priority},
+            {"threshold", thread.threshold},
+            {"state", profiler_thread_state_name(thread.state)},
+            {"cpu_percent", percent(thread.cycles)},
+            {"cycles", thread.cycles},
+            {"stack_size", thread.stack_size},
+            {"stack_used", thread.stack_used}
+        });
+    }
+
+    json handlers = json::array();
+    for (uint32_t i = 0; i < PROFILER_ISR_COUNT; ++i) {
+        const ProfilerIsrStats_t& isr = snapshot.isr[i];
+        handlers.push_back({
+            {"name", profiler_isr_name(static_cast<ProfilerIsr_t>(i))},
+            {"count", isr.count},
+            {"cpu_percent", percent(isr.cycles)},
+            {"cycles", isr.cycles},
+            {"mean_cycles", isr.count ? static_cast<uint32_t>(isr.cycles / isr.count) : 0u},
+            {"max_cycles", isr.max_cycles},
+            {"max_us", microseconds(isr.max_cycles)}
+        });
+    }
+
+    return {
+        {"status", "ok"},
+        {"cpu_hz", snapshot.cpu_hz},
+        {"window_ms", snapshot.cpu_hz >= 1000u ? static_cast<uint32_t>(snapshot.total_cycles / (snapshot.cpu_hz / 1000u)) : 0u},
+        {"total_cycles", snapshot.total_cycles},
+        {"idle", {
+            {"cpu_percent", percent(snapshot.idle_cycles)},
+            {"cycles", snapshot.idle_cycles}
+        }},
+        {"isr", {
+            {"cpu_percent", percent(snapshot.isr_cycles)},
+            {"cycles", snapshot.isr_cycles},
+            {"handlers", handlers}
+        }},
+        {"threads", threads},
+        {"threads_missing", snapshot.threads_missing}
+    };
+}
+
+static json system_power_handler(const json& params) {
+    if (params.contains("enable")) {
+        if (!params["enable"].is_boolean()) {
+            return {{"status", "error"}, {"message", "enable must be a boolean"}};
+        }
+        power_idle_enable(params["enable"].get<bool>());
+    }
+
+    PowerIdleStats_t stats;
+    power_idle_stats(&stats);
+
+    json holds = json::array();
+    for (uint32_t i = 0; i < POWER_IDLE_HOLD_COUNT; ++i) {
+        if (stats.holds & (1u << i)) {
+            holds.push_back(power_idle_hold_name(static_cast<PowerIdleHold_t>(i)));
+        }
+    }
+    return {
+        {"status", "ok"},
+        {"enabled", stats.enabled},
+        {"sleeping", stats.enabled && stats.holds == 0u},
+        {"holds", holds},
+        {"sleeps", stats.sleeps},
+        {"skipped", stats.skipped},
+        {"asleep_ms", stats.cpu_hz >= 1000u ? static_cast<uint32_t>(stats.asleep_cycles / (stats.cpu_hz / 1000u)) : 0u}
+    };
+}
+
+static json system_priority_handler(const json& params) {
+    if (params.contains("profile")) {
+        if (!params["profile"].is_string()) {
+            return {{"status", "error"}, {"message", "profile must be a string"}};
+        }
+        int const result = priority_profile_apply(params["profile"].get_ref<const json::string_t&>().c_str());
+        if (result == -1) {
+            return {{"status", "error"}, {"message", "unknown profile"}};
+        }
+        if (result != 0) {
+            return {{"status", "error"}, {"message", "a thread refused its setting"}};
+        }
+    }
+    else if (params.contains("thread")) {
+        if (!params["thread"].is_string()) {
+            return {{"status", "error"}, {"message", "thread must be a string"}};
+        }
+        uint32_t priority = 0;
+        if (!params.contains("priority") ||
+            !fuzz_unsigned_param(params, "priority", PRIORITY_PROFILE_LOWEST, priority)) {
+            return {{"status", "error"}, {"message", "priority must be 0-63"}};
+        }
+        uint32_t threshold = priority;
+        if (!fuzz_unsigned_param(params, "threshold", priority, threshold)) {
+            return {{"status", "error"}, {"message", "threshold must be 0 up to the priority"}};
+        }
+        int const result = priority_profile_set(params["thread"].get_ref<const json::string_t&>().c_str(),
+                                                static_cast<uint8_t>(priority), static_cast<uint8_t>(threshold));
+        if (result == -1) {
+            return {{"status", "error"}, {"message", "unknown thread"}};
+        }
+        if (result != 0) {
+            return {{"status", "error"}, {"message", "the kernel refused the setting"}};
+        }
+    }
+
+    json profiles = json::array();
+    for (uint32_t i = 0; i < priority_profile_count(); ++i) {
+        profiles.push_back(priority_profile_name(i));
+    }
+    return {
+        {"status", "ok"},
+        {"active", priority_profile_active()},
+        {"profiles", profiles}
+    };
+}
+
+static json system_priority_probe_handler(const json& params) {
+    if (params.contains("stop")) {
+        if (!params["stop"].is_boolean()) {
+            return {{"status", "error"}, {"message", "stop must be a boolean"}};
+        }
+        if (params["stop"].get<bool>()) {
+            priority_probe_stop();
+        }
+    }
+    if (params.contains("priority")) {
+        uint32_t priority = 0;
+        if (!fuzz_unsigned_param(params, "priority", PRIORITY_PROFILE_LOWEST, priority) ||
+            !priority_probe_start(static_cast<uint8_t>(priority))) {
+            return {{"status", "error"}, {"message", "priority must be 0-63"}};
+        }
+    }
+
+    PriorityProbeStats_t stats;
+    priority_probe_stats(&stats);
+    auto microseconds = [&stats](uint64_t cycles) {
+        return stats.cpu_hz ? static_cast<double>(cycles) * 1000000.0 / stats.cpu_hz : 0.0;
+    };
+    return {
+        {"status", "ok"},
+        {"running", stats.running},
+        {"priority", stats.priority},
+        {"samples", stats.samples},
+        {"late", stats.late},
+        {"min_us", stats.samples ? microseconds(stats.min_cycles) : 0.0},
+        {"mean_us", stats.samples ? microseconds(stats.sum_cycles / stats.samples) : 0.0},
+        {"max_us", microseconds(stats.max_cycles)}
+    };
+}
+
+static json system_timebase_handler(const json& params) {
+    (void)params;
+
+    TimebaseStatus_t status;
+    timebase_status(&status);
+    return {
+        {"status", "ok"},
+        {"source", timebase_source_name(status.source)},
+        {"time_ns", status.time_ns},
+        {"cycles", status.cycles},
+        {"tick_ms", status.tick_ms},
+        {"cpu_hz", status.cpu_hz},
+        {"syncs", status.syncs},
+        {"steps", status.steps},
+        {"last_offset_us", static_cast<double>(status.last_offset_ns) / 1000.0},
+        {"last_sync_ns", status.last_sync_ns},
+        {"freq_ppb", status.freq_ppb},
+        {"slewing", status.slewing}
+    };
+}
+
+static constexpr uint32_t kMemoryObjectsJsonMax = 16;
+
+static json system_memory_handler(const json& params) {
+    uint32_t first = 0;
+    if (params.contains("first")) {
+        if (!params["first"].is_number_unsigned()) {
+            return {{"status", "error"}, {"message", "first must be an unsigned integer"}};
+        }
+        first = params["first"].get<uint32_t>();
+    }
+
+    MemoryMapSummary_t summary;
+    memory_map_summary(&summary);
+
+    static MemoryObject_t objects[kMemoryObjectsJsonMax];
+    uint32_t const count = memory_map_objects(first, objects, kMemoryObjectsJsonMax);
+
+    json list = json::array();
+    for (uint32_t i = 0; i < count; ++i) {
+        MemoryObject_t const& object = objects[i];
+        list.push_back({
+            {"name", object.name},
+            {"type", memory_map_type_name(static_cast<MemoryObjectType_t>(object.type))},
+            {"address", object.address},
+            {"size", object.size},
+            {"used", object.used},
+            {"pool", object.pool != nullptr ? object.pool : "static"}
+        });
+    }
+
+    return {
+        {"status", "ok"},
+        {"ram", {
+            {"start", summary.ram_start},
+            {"size", summary.ram_size},
+            {"data", summary.data_bytes},
+            {"bss", summary.bss_bytes},
+            {"heap", summary.heap_bytes},
+            {"main_stack", summary.stack_bytes},
+            {"free", summary.free_bytes}
+        }},
+        {"rtos", {
+            {"static_allocation", summary.static_allocation},
+            {"static_bytes", summary.static_bytes},
+            {"pool_bytes", summary.pool_bytes},
+            {"pool_free", summary.pool_free_bytes}
+        }},
+        {"total", summary.objects},
+        {"first", first},
+        {"objects", list}
+    };
+}
+
+static json system_boot_handler(const json& params) {
+    (void)params;
+    BootProfile_t profile;
+    boot_get_profile(&profile);
+
+    json steps = json::array();
+    for (uint32_t i = 0; i < profile.step_count; ++i) {
+        steps.push_back({
+            {"name", profile.steps[i].name},
+            {"us", profile.steps[i].us},
+            {"end_us", profile.steps[i].end_us}
+        });
+    }
+
+    json events = json::object();
+    for (uint32_t i = 0; i < BOOT_EVENT_COUNT; ++i) {
+        uint32_t const ms = profile.event_ms[i];
+        events[boot_event_name(static_cast<BootEvent_t>(i))] = ms ? json(ms) : json(nullptr);
+    }
+
+    json subsystems = json::object();
+    for (uint32_t i = 0; i < BOOT_SUBSYSTEM_COUNT; ++i) {
+        BootSubsystemState_t const& state = profile.subsystems[i];
+        json entry = {{"ready", state.ready}};
+        if (state.ready) {
+            entry["init_us"] = state.init_us;
+            entry["at_ms"] = state.at_ms;
+        }
+        subsystems[boot_subsystem_name(static_cast<BootSubsystem_t>(i))] = entry;
+    }
+
+    return {
+        {"status", "ok"},
+        {"lazy_init", profile.lazy},
+        {"scheduler_us", profile.step_count ? profile.steps[profile.step_count - 1u].end_us : 0u},
+        {"steps", steps},
+        {"events_ms", events},
+        {"subsystems", subsystems}
+    };
+}
+
+#ifdef DCC_TESTER_BENCHMARK
+static json benchmark_run_handler(const json& params) {
+    uint32_t iterations = BENCHMARK_DEFAULT_ITERATIONS;
+    bool flash = false;
+    if (params.contains("iterations")) {
+        if (!params["iterations"].is_number_unsigned() || params["iterations"].get<uint64_t>() == 0u ||
+            params["iterations"].get<uint64_t>() > BENCHMARK_MAX_ITERATIONS) {
+            return {{"status", "error"}, {"message", "iterations must be 1-10000"}};
+        }
+        iterations = params["iterations"].get<uint32_t>();
+    }
+    if (params.contains("flash")) {
+        if (!params["flash"].is_boolean()) {
+            return {{"status", "error"}, {"message", "flash must be a boolean"}};
+        }
+        flash = params["flash"].get<bool>();
+    }
+
+    // Runs in this thread once the response has been sent
+    if (!Benchmark_Request(iterations, flash)) {
+        return {{"status", "error"}, {"message", "Benchmark already running"}};
+    }
+    return {
+        {"status", "ok"},
+        {"iterations", iterations},
+        {"flash", flash}
+    };
+}
+
+// Results per response, a page stays well inside the transmit buffer
+static constexpr uint32_t kBenchmarkPage = 12u;
+
+static json benchmark_results_handler(const json& params) {
+    uint32_t first = 0;
+    if (params.contains("first")) {
+        if (!params["first"].is_number_unsigned()) {
+            return {{"status", "error"}, {"message", "first must be a non-negative integer"}};
+        }
+        first = params["first"].get<uint32_t>();
+    }
+
+    if (Benchmark_Busy()) {
+        return {{"status", "ok"}, {"running", true}};
+    }
+    const BenchmarkResult_t* list = nullptr;
+    uint32_t iterations = 0;
+    uint32_t const count = Benchmark_GetResults(&list, &iterations);
+
+    json results = json::array();
+    for (uint32_t i = first; i < count && i < first + kBenchmarkPage; ++i) {
+        const BenchmarkResult_t& r = list[i];
+        json entry = {
+            {"group", r.group},
+            {"name", r.name},
+            {"status", Benchmark_StatusName(r.status)},
+            {"runs", r.stats.runs}
+        };
+        if (r.stats.runs) {
+            entry["min_cycles"] = r.stats.min_cycles;
+            entry["mean_cycles"] = static_cast<uint32_t>(r.stats.total_cycles / r.stats.runs);
+            entry["max_cycles"] = r.stats.max_cycles;
+        }
+        results.push_back(entry);
+    }
+
+    return {
+        {"status", "ok"},
+        {"running", false},
+        {"firmware", FW_VERSION_STRING},
+        {"cpu_hz", SystemCoreClock},
+        {"iterations", iterations},
+        {"total", count},
+        {"first", first},
+        {"results", results}
+    };
+}
+#endif
+
+// ---------------- Binary handlers ----------------
+
+static uint8_t echo_bin_handler(const uint8_t* req, uint16_t req_length,
+                                uint8_t* resp, uint16_t resp_size, uint16_t* resp_length) {
+    if (req_length > resp_size) {
+        return RPC_BIN_STATUS_BAD_LENGTH;
+    }
+    std::memcpy(resp, req, req_length);
+    *resp_length = req_length;
+    return RPC_BIN_STATUS_OK;
+}
+
+// flags (bit0 replace), packet bytes -> queue count u16
+static uint8_t command_station_load_packet_bin_handler(const uint8_t* req, uint16_t req_length,
+                                                       uint8_t* resp, uint16_t resp_size, uint16_t* resp_length) {
+    (void)resp_size;
+    if (req_length < 2u || req_length > 1u + DCC_MAX_PACKET_SIZE) {
+        return RPC_BIN_STATUS_BAD_LENGTH;
+    }
+
+    bool replace = (req[0] & 0x01u) != 0;
+    if (!CommandStation_LoadCustomPacket(&req[1], static_cast<uint8_t>(req_length - 1u), replace)) {
+        return RPC_BIN_STATUS_FAILED;
+    }
+
+    CommandStationQueueStats_t stats;
+    CommandStation_GetCustomPacketQueueStats(&stats);
+    rpc_bin_put_u16(resp, static_cast<uint16_t>(stats.count));
+    *resp_length = 2;
+    return RPC_BIN_STATUS_OK;
+}
+
+// flags (bit0 replace), records of a length byte and the packet bytes
+static uint8_t command_station_load_packets_bin_handler(const uint8_t* req, uint16_t req_length,
+                                                        uint8_t* resp, uint16_t resp_size, uint16_t* resp_length) {
+    (void)resp_size;
+    if (req_length < 1u) {
+        return RPC_BIN_STATUS_BAD_LENGTH;
+    }
+
+    bool replace = (req[0] & 0x01u) != 0;
+    uint32_t loaded = 0;
+    int const result = CommandStation_LoadCustomPackets(&req[1], req_length - 1u, false, replace,
+                                                        CUSTOM_PACKET_GAP_DEFAULT, &loaded);
+    if (result == -1) {
+        return RPC_BIN_STATUS_INVALID_PARAM;
+    }
+    if (result != 0) {
+        return RPC_BIN_STATUS_FAILED;
+    }
+
+    CommandStationQueueStats_t stats;
+    CommandStation_GetCustomPacketQueueStats(&stats);
+    rpc_bin_put_u16(resp, static_cast<uint16_t>(loaded));
+    rpc_bin_put_u16(resp + 2, static_cast<uint16_t>(stats.count));
+    *resp_length = 4;
+    return RPC_BIN_STATUS_OK;
+}
+
+// flags (bit0 stream, bit1 delay in us), delay u32
+static uint8_t command_station_transmit_packet_bin_handler(const uint8_t* req, uint16_t req_length,
+                                                           uint8_t* resp, uint16_t resp_size, uint16_t* resp_length) {
+    (void)resp;
+    (void)resp_size;
+    if (req_length != 5u) {
+        return RPC_BIN_STATUS_BAD_LENGTH;
+    }
+
+    bool stream = (req[0] & 0x01u) != 0;
+    uint32_t delay = rpc_bin_get_u32(&req[1]);
+    if (req[0] & 0x02u) {
+        CommandStation_TriggerTransmitScheduled(delay, stream);
+    }
+    else {
+        CommandStation_TriggerTransmitEx(delay, stream);
+    }
+    *resp_length = 0;
+    return RPC_BIN_STATUS_OK;
+}
+
+static uint8_t command_station_queue_status_bin_handler(const uint8_t* req, uint16_t req_length,
+                                                        uint8_t* resp, uint16_t resp_size, uint16_t* resp_length) {
+    (void)req;
+    (void)req_length;
+    if (resp_size < 21u) {
+        return RPC_BIN_STATUS_FAILED;
+    }
+
+    CommandStationQueueStats_t stats;
+    CommandStation_GetCustomPacketQueueStats(&stats);
+    rpc_bin_put_u32(&resp[0], stats.count);
+    rpc_bin_put_u32(&resp[4], stats.capacity);
+    rpc_bin_put_u32(&resp[8], stats.high_water);
+    rpc_bin_put_u32(&resp[12], stats.underruns);
+    rpc_bin_put_u32(&resp[16], stats.transmitted);
+    resp[20] = stats.streaming ? 1u : 0u;
+    *resp_length = 21;
+    return RPC_BIN_STATUS_OK;
+}
+
+static uint8_t get_voltage_feedback_mv_bin_handler(const uint8_t* req, uint16_t req_length,
+                                                   uint8_t* resp, uint16_t resp_size, uint16_t* resp_length) {
+    (void)req;
+    (void)req_length;
+    (void)resp_size;
+
+    uint16_t voltage_mv = 0;
+    if (get_voltage_feedback_mv(&voltage_mv) != 0) {
+        return RPC_BIN_STATUS_FAILED;
+    }
+    rpc_bin_put_u16(resp, voltage_mv);
+    *resp_length = 2;
+    return RPC_BIN_STATUS_OK;
+}
+
+static uint8_t get_current_feedback_ma_bin_handler(const uint8_t* req, uint16_t req_length,
+                                                   uint8_t* resp, uint16_t resp_size, uint16_t* resp_length) {
+    (void)req;
+    (void)req_length;
+    (void)resp_size;
+
+    uint16_t current_ma = 0;
+    if (get_current_feedback_ma(&current_ma) != 0) {
+        return RPC_BIN_STATUS_FAILED;
+    }
+    rpc_bin_put_u16(resp, current_ma);
+    *resp_length = 2;
+    return RPC_BIN_STATUS_OK;
+}
+
+static uint8_t railcom_read_bin_handler(const uint8_t* req, uint16_t req_length,
+                                        uint8_t* resp, uint16_t resp_size, uint16_t* resp_length) {
+    if (req_length > 1u) {
+        return RPC_BIN_STATUS_BAD_LENGTH;
+    }
+    uint32_t max = resp_size > 0u ? (resp_size - 1u) / RPC_BIN_RAILCOM_FRAME_SIZE : 0u;
+    if (req_length == 1u && req[0] != 0u && req[0] < max) {
+        max = req[0];
+    }
+
+    RailcomFrame_t frame;
+    uint16_t length = 1;
+    uint8_t count = 0;
+    while (count < max && railcom_read(&frame, 1u) == 1u) {
+        uint8_t* p = &resp[length];
+        rpc_bin_put_u32(&p[0], frame.packet_seq);
+        rpc_bin_put_u32(&p[4], frame.tick_ms);
+        p[8] = frame.flags;
+        p[9] = frame.ch1_count;
+        p[10] = frame.ch2_count;
+        std::memcpy(&p[11], frame.ch1, RAILCOM_CH1_BYTES);
+        std::memcpy(&p[11 + RAILCOM_CH1_BYTES], frame.ch2, RAILCOM_CH2_BYTES);
+        length += RPC_BIN_RAILCOM_FRAME_SIZE;
+        count++;
+    }
+    resp[0] = count;
+    *resp_length = length;
+    return RPC_BIN_STATUS_OK;
+}
+
+static uint8_t sniffer_read_bin_handler(const uint8_t* req, uint16_t req_length,
+                                        uint8_t* resp, uint16_t resp_size, uint16_t* resp_length) {
+    (void)req;
+    if (req_length != 0u) {
+        return RPC_BIN_STATUS_BAD_LENGTH;
+    }
+    if (resp_size < 1u + SNIFFER_MAX_RECORD) {
+        return RPC_BIN_STATUS_FAILED;
+    }
+
+    uint32_t records = 0;
+    uint32_t length = sniffer_read(&resp[1], resp_size - 1u, UINT8_MAX, &records);
+    resp[0] = static_cast<uint8_t>(records);
+    *resp_length = static_cast<uint16_t>(1u + length);
+    return RPC_BIN_STATUS_OK;
+}
+
+// first u16 (optional) -> state u8, packet_seq u32, count u16, packet_index u16, end_index u16,
+// sample_us u16, n u16, n samples u16 in counts
+static uint8_t packet_capture_read_bin_handler(const uint8_t* req, uint16_t req_length,
+                                               uint8_t* resp, uint16_t resp_size, uint16_t* resp_length) {
+    constexpr uint16_t kHeader = 15u;
+    if (req_length != 0u && req_length != 2u) {
+        return RPC_BIN_STATUS_BAD_LENGTH;
+    }
+    if (resp_size < kHeader) {
+        return RPC_BIN_STATUS_FAILED;
+    }
+    uint32_t const first = req_length == 2u ? rpc_bin_get_u16(req) : 0u;
+
+    PacketCaptureInfo_t info;
+    packet_capture_get_info(&info);
+    uint32_t n = 0;
+    if (info.state == PACKET_CAPTURE_DONE && first < info.count) {
+        static uint16_t samples[PACKET_CAPTURE_MAX_SAMPLES];
+        n = packet_capture_read(first, samples, (resp_size - kHeader) / 2u);
+        for (uint32_t i = 0; i < n; ++i) {
+            rpc_bin_put_u16(&resp[kHeader + 2u * i], samples[i]);
+        }
+    }
+    resp[0] = info.state;
+    rpc_bin_put_u32(&resp[1], info.packet_seq);
+    rpc_bin_put_u16(&resp[5], info.count);
+    rpc_bin_put_u16(&resp[7], info.packet_index);
+    rpc_bin_put_u16(&resp[9], info.end_index);
+    rpc_bin_put_u16(&resp[11], static_cast<uint16_t>(ANALOG_SAMPLE_US));
+    rpc_bin_put_u16(&resp[13], static_cast<uint16_t>(n));
+    *resp_length = static_cast<uint16_t>(kHeader + 2u * n);
+    return RPC_BIN_STATUS_OK;
 }
 
+// suite u16, offset u32, data -> file size u32
+static uint8_t packet_suite_write_bin_handler(const uint8_t* req, uint16_t req_length,
+                                              uint8_t* resp, uint16_t resp_size, uint16_t* resp_length) {
+    (void)resp_size;
+    if (req_length < 7u) {
+        return RPC_BIN_STATUS_BAD_LENGTH;
+    }
+
+    uint16_t suite = rpc_bin_get_u16(&req[0]);
+    uint32_t offset = rpc_bin_get_u32(&req[2]);
+    if (suite > PACKET_SUITE_MAX_INDEX) {
+        return RPC_BIN_STATUS_INVALID_PARAM;
+    }
+    if (PacketSuite_Write(suite, offset, &req[6], req_length - 6u) != 0) {
+        return RPC_BIN_STATUS_FAILED;
+    }
+    rpc_bin_put_u32(resp, offset + (req_length - 6u));
+    *resp_length = 4;
+    return RPC_BIN_STATUS_OK;
+}
+
+// ---------------- Method table ----------------
+
+// Resolved at compile time, see RpcMethodTable
+static constexpr RpcMethodTable kMethods{std::to_array<RpcEntry>({
+    {"echo", echo_handler, echo_bin_handler, RPC_BIN_OP_ECHO},
+    {"command_station_start", command_station_start_handler, nullptr, 0},
+    {"command_station_stop", command_station_stop_handler, nullptr, 0, RPC_LANE_URGENT},
+    {"command_station_load_packet", command_station_load_packet_handler, command_station_load_packet_bin_handler, RPC_BIN_OP_LOAD_PACKET},
+    {"command_station_load_packets", command_station_load_packets_handler, command_station_load_packets_bin_handler, RPC_BIN_OP_LOAD_PACKETS, RPC_LANE_BULK},
+    {"command_station_transmit_packet", command_station_transmit_packet_handler, command_station_transmit_packet_bin_handler, RPC_BIN_OP_TRANSMIT_PACKET},
+    {"command_station_queue_status", command_station_queue_status_handler, command_station_queue_status_bin_handler, RPC_BIN_OP_QUEUE_STATUS},
+    {"command_station_program_load", command_station_program_load_handler, nullptr, 0, RPC_LANE_BULK},
+    {"command_station_program_run", command_station_program_run_handler, nullptr, 0},
+    {"command_station_program_stop", command_station_program_stop_handler, nullptr, 0, RPC_LANE_URGENT},
+    {"command_station_program_status", command_station_program_status_handler, nullptr, 0},
+    {"command_station_timing_profiles", command_station_timing_profiles_handler, nullptr, 0},
+    {"command_station_cv_read", command_station_cv_read_handler, nullptr, 0},
+    {"railcom_read", railcom_read_handler, railcom_read_bin_handler, RPC_BIN_OP_RAILCOM_READ},
+    {"railcom_status", railcom_status_handler, nullptr, 0},
+    {"sniffer_control", sniffer_control_handler, nullptr, 0},
+    {"sniffer_status", sniffer_status_handler, nullptr, 0},
+    {"sniffer_read", sniffer_read_handler, sniffer_read_bin_handler, RPC_BIN_OP_SNIFFER_READ},
+    {"decoder_edge_stats", decoder_edge_stats_handler, nullptr, 0},
+    {"decoder_packet_stats", decoder_packet_stats_handler, nullptr, 0},
+    {"accessory_sequence_start", accessory_sequence_start_handler, nullptr, 0},
+    {"accessory_sequence_stop", accessory_sequence_stop_handler, nullptr, 0, RPC_LANE_URGENT},
+    {"accessory_sequence_status", accessory_sequence_status_handler, nullptr, 0},
+    {"command_station_edge_timing", command_station_edge_timing_handler, nullptr, 0},
+    {"command_station_scope_trigger", command_station_scope_trigger_handler, nullptr, 0},
+    {"command_station_record_start", command_station_record_start_handler, nullptr, 0},
+    {"command_station_replay_start", command_station_replay_start_handler, nullptr, 0},
+    {"command_station_record_stop", command_station_record_stop_handler, nullptr, 0, RPC_LANE_URGENT},
+    {"command_station_record_status", command_station_record_status_handler, nullptr, 0},
+    {"command_station_record_read", command_station_record_read_handler, nullptr, 0},
+    {"command_station_record_write", command_station_record_write_handler, nullptr, 0, RPC_LANE_BULK},
+    {"trace_log_status", trace_log_status_handler, nullptr, 0},
+    {"command_station_params", command_station_params_handler, nullptr, 0},
+    {"command_station_packet_override", command_station_packet_override_handler, nullptr, 0},
+    {"command_station_packet_reset_override", command_station_packet_reset_override_handler, nullptr, 0},
+    {"command_station_packet_get_override", command_station_packet_get_override_handler, nullptr, 0},
+    {"command_station_get_params", command_station_get_params_handler, nullptr, 0},
+    {"decoder_start", decoder_start_handler, nullptr, 0},
+    {"decoder_stop", decoder_stop_handler, nullptr, 0},
+    {"decoder_emulator_status", decoder_emulator_status_handler, nullptr, 0},
+    {"decoder_cv", decoder_cv_handler, nullptr, 0},
+    {"decoder_track", decoder_track_handler, nullptr, 0},
+    {"decoder_track_status", decoder_track_status_handler, nullptr, 0},
+    {"decoder_track_read", decoder_track_read_handler, nullptr, 0},
+    {"parameters_save", parameters_save_handler, nullptr, 0},
+    {"parameters_restore", parameters_restore_handler, nullptr, 0},
+    {"parameters_factory_reset", parameters_factory_reset_handler, nullptr, 0},
+    {"parameters_get", parameters_get_handler, nullptr, 0},
+    {"parameters_set", parameters_set_handler, nullptr, 0},
+    {"parameters_profile_save", parameters_profile_save_handler, nullptr, 0},
+    {"parameters_profile_activate", parameters_profile_activate_handler, nullptr, 0},
+    {"parameters_profile_list", parameters_profile_list_handler, nullptr, 0},
+    {"parameters_profile_delete", parameters_profile_delete_handler, nullptr, 0},
+    {"system_reboot", system_reboot_handler, nullptr, 0},
+    {"get_voltage_feedback_mv", get_voltage_feedback_mv_handler, get_voltage_feedback_mv_bin_handler, RPC_BIN_OP_GET_VOLTAGE_MV},
+    {"get_current_feedback_ma", get_current_feedback_ma_handler, get_current_feedback_ma_bin_handler, RPC_BIN_OP_GET_CURRENT_MA},
+    {"track_guard_status", track_guard_status_handler, nullptr, 0},
+    {"get_gpio_input", get_gpio_input_handler, nullptr, 0},
+    {"get_gpio_inputs", get_gpio_inputs_handler, nullptr, 0},
+    {"configure_gpio_output", configure_gpio_output_handler, nullptr, 0},
+    {"set_gpio_output", set_gpio_output_handler, nullptr, 0},
+    {"gpio_capture_control", gpio_capture_control_handler, nullptr, 0},
+    {"gpio_capture_read", gpio_capture_read_handler, nullptr, 0},
+    {"response_latency_start", response_latency_start_handler, nullptr, 0},
+    {"response_latency_stop", response_latency_stop_handler, nullptr, 0},
+    {"response_latency_results", response_latency_results_handler, nullptr, 0},
+    {"packet_capture_arm", packet_capture_arm_handler, nullptr, 0},
+    {"packet_capture_cancel", packet_capture_cancel_handler, nullptr, 0},
+    {"packet_capture_status", packet_capture_status_handler, nullptr, 0},
+    {"packet_capture_read", packet_capture_read_handler, packet_capture_read_bin_handler, RPC_BIN_OP_CAPTURE_READ},
+    {"analog_current_history", nullptr, nullptr, 0, RPC_LANE_BULK, analog_current_history_stream},
+    {"susi_master_start", susi_master_start_handler, nullptr, 0},
+    {"susi_master_stop", susi_master_stop_handler, nullptr, 0},
+    {"susi_master_send", susi_master_send_handler, nullptr, 0},
+    {"susi_master_status", susi_master_status_handler, nullptr, 0},
+    {"susi_slave_start", susi_slave_start_handler, nullptr, 0},
+    {"susi_slave_stop", susi_slave_stop_handler, nullptr, 0},
+    {"susi_slave_status", susi_slave_status_handler, nullptr, 0},
+    {"susi_slave_read", susi_slave_read_handler, nullptr, 0},
+    {"can_sync_config", can_sync_config_handler, nullptr, 0},
+    {"can_sync_start", can_sync_start_handler, nullptr, 0},
+    {"can_sync_stop", can_sync_stop_handler, nullptr, 0},
+    {"can_sync_collect", can_sync_collect_handler, nullptr, 0},
+    {"can_sync_status", can_sync_status_handler, nullptr, 0},
+    {"aux_track_start", aux_track_start_handler, nullptr, 0},
+    {"aux_track_send", aux_track_send_handler, nullptr, 0},
+    {"aux_track_stop", aux_track_stop_handler, nullptr, 0, RPC_LANE_URGENT},
+    {"aux_track_status", aux_track_status_handler, nullptr, 0},
+    {"refresh_speed", refresh_speed_handler, nullptr, 0},
+    {"refresh_functions", refresh_functions_handler, nullptr, 0},
+    {"refresh_estop", refresh_estop_handler, nullptr, 0, RPC_LANE_URGENT},
+    {"refresh_release", refresh_release_handler, nullptr, 0},
+    {"refresh_clear", refresh_clear_handler, nullptr, 0},
+    {"refresh_status", refresh_status_handler, nullptr, 0},
+    {"packet_fuzz_start", packet_fuzz_start_handler, nullptr, 0},
+    {"packet_fuzz_stop", packet_fuzz_stop_handler, nullptr, 0, RPC_LANE_URGENT},
+    {"packet_fuzz_status", packet_fuzz_status_handler, nullptr, 0},
+    {"packet_fuzz_log", packet_fuzz_log_handler, nullptr, 0},
+    {"test_case_load", test_case_load_handler, nullptr, 0, RPC_LANE_BULK},
+    {"test_case_run", test_case_run_handler, nullptr, 0},
+    {"test_case_stop", test_case_stop_handler, nullptr, 0, RPC_LANE_URGENT},
+    {"test_case_status", test_case_status_handler, nullptr, 0},
+    {"test_case_results", test_case_results_handler, nullptr, 0},
+    {"margin_sweep_run", margin_sweep_run_handler, nullptr, 0},
+    {"margin_sweep_stop", margin_sweep_stop_handler, nullptr, 0, RPC_LANE_URGENT},
+    {"margin_sweep_status", margin_sweep_status_handler, nullptr, 0},
+    {"packet_vm_load", packet_vm_load_handler, nullptr, 0, RPC_LANE_BULK},
+    {"packet_vm_run", packet_vm_run_handler, nullptr, 0},
+    {"packet_vm_stop", packet_vm_stop_handler, nullptr, 0, RPC_LANE_URGENT},
+    {"packet_vm_status", packet_vm_status_handler, nullptr, 0},
+    {"packet_vm_records", packet_vm_records_handler, nullptr, 0},
+    {"get_rtc_datetime", get_rtc_datetime_handler, nullptr, 0},
+    {"set_rtc_datetime", set_rtc_datetime_handler, nullptr, 0},
+    {"system_usb_status", system_usb_status_handler, nullptr, 0},
+    {"network_status", network_status_handler, nullptr, 0},
+    {"telemetry_control", telemetry_control_handler, nullptr, 0},
+    {"telemetry_status", telemetry_status_handler, nullptr, 0},
+    {"usb_capture_start", usb_capture_start_handler, nullptr, 0},
+    {"usb_capture_stop", usb_capture_stop_handler, nullptr, 0, RPC_LANE_URGENT},
+    {"usb_capture_status", usb_capture_status_handler, nullptr, 0},
+    {"recorder_start", recorder_start_handler, nullptr, 0},
+    {"recorder_stop", recorder_stop_handler, nullptr, 0},
+    {"recorder_status", recorder_status_handler, nullptr, 0},
+    {"packet_suite_run", packet_suite_run_handler, nullptr, 0},
+    {"packet_suite_stop", packet_suite_stop_handler, nullptr, 0, RPC_LANE_URGENT},
+    {"packet_suite_status", packet_suite_status_handler, nullptr, 0},
+    {"packet_suite_write", packet_suite_write_handler, packet_suite_write_bin_handler, RPC_BIN_OP_SUITE_WRITE, RPC_LANE_BULK},
+    {"rpc_binary_mode", rpc_binary_mode_handler, nullptr, 0},
+    {"rpc_arena_status", rpc_arena_status_handler, nullptr, 0},
+    {"rpc_jobs_status", rpc_jobs_status_handler, nullptr, 0},
+    {"rpc_bus_status", rpc_bus_status_handler, nullptr, 0},
+    {"system_profile", system_profile_handler, nullptr, 0},
+    {"system_power", system_power_handler, nullptr, 0},
+    {"system_priority", system_priority_handler, nullptr, 0},
+    {"system_priority_probe", system_priority_probe_handler, nullptr, 0},
+    {"system_timebase", system_timebase_handler, nullptr, 0},
+    {"system_memory", system_memory_handler, nullptr, 0},
+    {"system_boot", system_boot_handler, nullptr, 0},
+#ifdef DCC_TESTER_BENCHMARK
+    {"benchmark_run", benchmark_run_handler, nullptr, 0},
+    {"benchmark_results", benchmark_results_handler, nullptr, 0},
+#endif
+})};
+static_assert(kMethods.ok(), "duplicate RPC method name or binary opcode");
+
+RpcServer server(kMethods.view());
+
+#ifdef DCC_TESTER_BENCHMARK
+RpcServer& rpc_server_instance() {
+    return server;
+}
+#endif
+
 // ---------------- RTOS Task ----------------
 
-RpcServer server;
+static char rpc_txbuffer[RPC_TX_BUFFER_SIZE];
+static uint8_t bin_response[RPC_BIN_OVERHEAD + 1u + RPC_BIN_MAX_RESPONSE];
+
+// Send a job_complete notification for every job the workers have finished
+static void send_job_events(void) {
+    RpcJob* job;
+    uint32_t actual_length;
+
+    while ((job = RpcJobs_Completed()) != nullptr) {
+        size_t length;
+        {
+            json event = {
+                {"event", "job_complete"},
+                {"job_id", job->id},
+                {"method", job->method},
+                {"duration_ms", job->duration_ms},
+                {"result", job->response(*job)}
+            };
+            length = server.notify(event, rpc_txbuffer, sizeof(rpc_txbuffer));
+            if (length == 0) {
+                event["result"] = error_object("Response too large");
+                length = server.notify(event, rpc_txbuffer, sizeof(rpc_txbuffer));
+            }
+        }
+        RpcArena::reset();
+        uint8_t origin = job->origin;
+        RpcJobs_Free(job);
+        if (length == 0) {
+            continue;
+        }
+        if (origin == RPC_ORIGIN_USB) {
+            UsbCdcAcm_Write(reinterpret_cast<const uint8_t*>(rpc_txbuffer), static_cast<uint32_t>(length),
+                            &actual_length);
+        } else if (origin == RPC_ORIGIN_CLI) {
+            printf("%.*s", static_cast<int>(length), rpc_txbuffer);
+        } else {
+            NetxRpc_SendEvent(origin, reinterpret_cast<const uint8_t*>(rpc_txbuffer), static_cast<uint32_t>(length));
+        }
+    }
+}
+
+// Send a track_fault event to every client for each trip, then stop the command station,
+// whose output the guard has already switched off
+static void send_track_events(void) {
+    TrackFault_t fault;
+    bool tripped = false;
+    uint32_t actual_length;
+
+    while (track_guard_take_fault(&fault)) {
+        tripped = true;
+        size_t length;
+        {
+            json event = track_fault_json(fault);
+            event["event"] = "track_fault";
+            length = server.notify(event, rpc_txbuffer, sizeof(rpc_txbuffer));
+        }
+        RpcArena::reset();
+        if (length == 0) {
+            continue;
+        }
+        UsbCdcAcm_Write(reinterpret_cast<const uint8_t*>(rpc_txbuffer), static_cast<uint32_t>(length), &actual_length);
+        NetxRpc_SendEvent(RPC_ORIGIN_TCP, reinterpret_cast<const uint8_t*>(rpc_txbuffer), static_cast<uint32_t>(length));
+        NetxRpc_SendEvent(RPC_ORIGIN_UDP, reinterpret_cast<const uint8_t*>(rpc_txbuffer), static_cast<uint32_t>(length));
+    }
+    if (tripped && track_guard_tripped()) {
+        CommandStation_Stop();
+    }
+}
+
+// Stream sinks, one per transport, all block until the chunk has been taken
+static bool usb_stream_sink(void* context, const char* data, size_t length) {
+    (void)context;
+    uint32_t actual_length = 0;
+    return UsbCdcAcm_Write(reinterpret_cast<const uint8_t*>(data), static_cast<uint32_t>(length),
+                           &actual_length) == 0u && actual_length == length;
+}
+
+static bool network_stream_sink(void* context, const char* data, size_t length) {
+    return NetxRpc_Send(static_cast<const NetxRpcRequest_t*>(context), reinterpret_cast<const uint8_t*>(data),
+                        static_cast<uint32_t>(length));
+}
+
+static bool console_stream_sink(void* context, const char* data, size_t length) {
+    (void)context;
+    printf("%.*s", static_cast<int>(length), data);
+    return true;
+}
+
+static void serve(const RpcBusMessage_t& message);
+
+// Urgent requests posted meanwhile go ahead of the rest of the buffer being handled
+static void serve_urgent(void) {
+    static bool serving = false;
+    RpcBusMessage_t message;
+    if (serving) {
+        return;
+    }
+    serving = true;
+    while (RpcBus_Take(&message, RPC_LANE_URGENT)) {
+        serve(message);
+    }
+    serving = false;
+}
+
+// A network buffer holds one or more LF terminated requests, the last request of a
+// UDP datagram may be unterminated
+static void handle_network_request(NetxRpcRequest_t* request) {
+    const char* data = request->data;
+    const char* end = data + request->length;
+
+    while (data < end) {
+        const char* eol = static_cast<const char*>(std::memchr(data, '\n', static_cast<size_t>(end - data)));
+        const char* line_end = eol ? eol : end;
+        size_t length = static_cast<size_t>(line_end - data);
+        if (length > 0 && data[length - 1] == '\r') {
+            length--;
+        }
+        if (length > 0) {
+            RpcJobs_SetOrigin(request->origin);
+            RpcStream stream(rpc_txbuffer, sizeof(rpc_txbuffer), network_stream_sink, request);
+            size_t response_length = server.handle(data, length, rpc_txbuffer, sizeof(rpc_txbuffer), &stream);
+            if (response_length > 0) {
+                NetxRpc_Send(request, reinterpret_cast<const uint8_t*>(rpc_txbuffer),
+                             static_cast<uint32_t>(response_length));
+            }
+        }
+        data = eol ? eol + 1 : end;
+        if (data < end) {
+            serve_urgent();
+        }
+    }
+    NetxRpc_Release(request);
+}
+
+static void handle_usb_request(rpc_rxbuffer_t* msg) {
+    uint32_t actual_length;
+
+    if (msg->type == RPC_FRAME_BINARY) {
+        uint16_t length = server.handle_binary(reinterpret_cast<const uint8_t*>(msg->data), msg->length,
+                                               bin_response, sizeof(bin_response));
+        UsbCdcAcm_ReleaseRx(msg);
+        if (length > 0) {
+            UsbCdcAcm_Write(bin_response, length, &actual_length);
+        }
+        return;
+    }
+    RpcStream stream(rpc_txbuffer, sizeof(rpc_txbuffer), usb_stream_sink, nullptr);
+    size_t length = server.handle(msg->data, msg->length, rpc_txbuffer, sizeof(rpc_txbuffer), &stream);
+    UsbCdcAcm_ReleaseRx(msg);
+    if (length > 0) {
+        UsbCdcAcm_Write(reinterpret_cast<const uint8_t*>(rpc_txbuffer), static_cast<uint32_t>(length),
+                        &actual_length);
+    }
+}
+
+// The console thread waits until the response has been printed, a long one holds the
+// RPC thread for the time it takes on the UART
+static void handle_console_request(void) {
+    const char* const data = rpcConsoleRequest.data;
+    if (data == nullptr) {
+        return;
+    }
+    RpcStream stream(rpc_txbuffer, sizeof(rpc_txbuffer), console_stream_sink, nullptr);
+    size_t length = server.handle(data, rpcConsoleRequest.length, rpc_txbuffer, sizeof(rpc_txbuffer), &stream);
+    if (length > 0) {
+        printf("%.*s", static_cast<int>(length), rpc_txbuffer);
+    }
+    rpcConsoleRequest.data = nullptr;
+    osSemaphoreRelease(rpcConsoleDone_sem);
+}
+
+static void serve(const RpcBusMessage_t& message) {
+    RpcJobs_SetOrigin(message.origin);
+    switch (message.origin) {
+    case RPC_ORIGIN_USB:
+        boot_event(BOOT_EVENT_FIRST_REQUEST);
+        handle_usb_request(static_cast<rpc_rxbuffer_t*>(message.request));
+        break;
+    case RPC_ORIGIN_CLI:
+        handle_console_request();
+        break;
+    default:
+        boot_event(BOOT_EVENT_FIRST_REQUEST);
+        handle_network_request(static_cast<NetxRpcRequest_t*>(message.request));
+        break;
+    }
+}
+
+// Method name of a JSON request, copied out of "method":"..." without parsing the request
+static bool request_method(const char* data, uint32_t length, char* name, size_t size) {
+    static constexpr char kKey[] = "\"method\"";
+    const char* const end = data + length;
+    const char* p = std::search(data, end, kKey, kKey + sizeof(kKey) - 1u);
+    if (p == end) {
+        return false;
+    }
+    p += sizeof(kKey) - 1u;
+    while (p < end && (*p == ' ' || *p == ':' || *p == '\t')) {
+        ++p;
+    }
+    if (p == end || *p++ != '"') {
+        return false;
+    }
+    size_t n = 0;
+    while (p < end && *p != '"') {
+        if (n + 1u >= size) {
+            return false;
+        }
+        name[n++] = *p++;
+    }
+    name[n] = '\0';
+    return p < end;
+}
+
+extern "C" uint8_t RpcServer_Lane(const char* data, uint32_t length, uint8_t type) {
+    static constexpr RpcMethodView kView = kMethods.view();
+    const RpcEntry* entry = nullptr;
+    if (type == RPC_FRAME_BINARY) {
+        entry = length > 1u ? kView.find_binary(static_cast<uint8_t>(data[1])) : nullptr;
+    } else {
+        char name[48];
+        if (request_method(data, length, name, sizeof(name))) {
+            entry = kView.find(name);
+        }
+    }
+    return entry != nullptr ? entry->lane : static_cast<uint8_t>(RPC_LANE_NORMAL);
+}
 
 void RpcServerThread(void* argument) {
     (void)argument;
-    rpc_rxbuffer_t* msg;
-    uint32_t actual_length;
+    RpcBusMessage_t message;
 
     osSemaphoreAcquire(rpcServerStart_sem, osWaitForever);
     rpcServerRunning = true;
-
-    server.register_method("echo", echo_handler);
-    server.register_method("command_station_start", command_station_start_handler);
-    server.register_method("command_station_stop", command_station_stop_handler);
-    server.register_method("command_station_load_packet", command_station_load_packet_handler);
-    server.register_method("command_station_transmit_packet", command_station_transmit_packet_handler);
-    server.register_method("command_station_params", command_station_params_handler);
-    server.register_method("command_station_packet_override", command_station_packet_override_handler);
-    server.register_method("command_station_packet_reset_override", command_station_packet_reset_override_handler);
-    server.register_method("command_station_packet_get_override", command_station_packet_get_override_handler);
-    server.register_method("command_station_get_params", command_station_get_params_handler);
-    server.register_method("decoder_start", decoder_start_handler);
-    server.register_method("decoder_stop", decoder_stop_handler);
-    server.register_method("parameters_save", parameters_save_handler);
-    server.register_method("parameters_restore", parameters_restore_handler);
-    server.register_method("parameters_factory_reset", parameters_factory_reset_handler);
-    server.register_method("system_reboot", system_reboot_handler);
-    server.register_method("get_voltage_feedback_mv", get_voltage_feedback_mv_handler);
-    server.register_method("get_current_feedback_ma", get_current_feedback_ma_handler);
-    server.register_method("get_gpio_input", get_gpio_input_handler);
-    server.register_method("get_gpio_inputs", get_gpio_inputs_handler);
-    server.register_method("configure_gpio_output", configure_gpio_output_handler);
-    server.register_method("set_gpio_output", set_gpio_output_handler);
-    server.register_method("get_rtc_datetime", get_rtc_datetime_handler);
-    server.register_method("set_rtc_datetime", set_rtc_datetime_handler);
-    server.register_method("system_usb_status", system_usb_status_handler);
+    boot_event(BOOT_EVENT_RPC_READY);
 
     while (rpcServerRunning) {
-        std::string request;
-        // Block until a message pointer is available from RX thread
-        if (tx_queue_receive(&rpc_rxqueue, &msg, 10) == TX_SUCCESS)
-        {
-            std::string request(msg->data, msg->length);
-            std::string response = server.handle(request) + "\r\n";
-            /* transport_send(response);*/
-            /* Send response data over the class cdc_acm_write */
-            UsbCdcAcm_Write((const uint8_t *)response.c_str(),
-                            (uint32_t)response.size(),
-                            &actual_length);
+        send_job_events();
+        send_track_events();
+#ifdef DCC_TESTER_BENCHMARK
+        Benchmark_Poll();
+#endif
+
+        // Block until a transport, a job worker, the track guard, a benchmark or a stop request has something
+        osEventFlagsWait(rpcServerEvents, RPC_EVENT_WAKE, osFlagsWaitAny, osWaitForever);
+
+        // Highest lane first, urgent requests posted meanwhile overtake the remaining ones
+        while (RpcBus_Take(&message, RPC_LANE_BULK)) {
+            serve(message);
         }
     }
     osSemaphoreRelease(rpcServerStart_sem);
@@ -1302,10 +7265,39 @@ void RpcServerThread(void* argument) {
 // ---------------- Init / Start / Stop ----------------
 
 extern "C" void RpcServer_Init(void) {
-    rpcServerStart_sem = osSemaphoreNew(1, 1, NULL);
+    rpcServerStart_sem = osSemaphoreNew(1, 1, &rpcServerStart_sem_attr);
+    rpcServerEvents = osEventFlagsNew(&rpcServerEvents_attr);
+    rpcConsoleDone_sem = osSemaphoreNew(1, 0, &rpcConsoleDone_sem_attr);
+    RpcBus_Init();
+    RpcJobs_Init();
     rpcServerThread_id = osThreadNew(RpcServerThread, NULL, &rpcServerTask_attributes);
 }
 
+extern "C" void RpcServer_Notify(void) {
+    if (rpcServerEvents) {
+        osEventFlagsSet(rpcServerEvents, RPC_EVENT_WAKE);
+    }
+}
+
+extern "C" bool RpcServer_Console(const char* request, uint32_t length) {
+    if (!rpcServerRunning) {
+        return false;
+    }
+    rpcConsoleRequest.length = length;
+    rpcConsoleRequest.data = request;
+    if (!RpcBus_Post(RPC_ORIGIN_CLI, &rpcConsoleRequest, request, length, RPC_FRAME_JSON)) {
+        rpcConsoleRequest.data = nullptr;
+        return false;
+    }
+    while (osSemaphoreAcquire(rpcConsoleDone_sem, 100u) != osOK) {
+        if (!rpcServerRunning) {
+            rpcConsoleRequest.data = nullptr;
+            return false;
+        }
+    }
+    return true;
+}
+
 extern "C" void RpcServer_Start(bool test_mode) {
     if (!rpcServerRunning) {
         osSemaphoreRelease(rpcServerStart_sem);
@@ -1319,6 +7311,7 @@ extern "C" void RpcServer_Stop(void) {
     if (rpcServerRunning) {
         printf("RPC Server stopping\n");
         rpcServerRunning = false;
+        RpcServer_Notify();
         osSemaphoreAcquire(rpcServerStart_sem, osWaitForever);
         printf("RPC Server stopped\n");
     } else {
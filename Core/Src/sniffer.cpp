@@ -0,0 +1,298 @@
+/**
+ * @file sniffer.cpp
+ * @brief DCC sniffer of the on-board decoder input
+ *
+ * The framer works on half bits: a run of one halves is the preamble, two zero
+ * halves the start bit, then bytes of eight bits each followed by a separator
+ * bit until a one separator (end bit) completes the packet. Both halves of a
+ * bit must have the same class, otherwise the packet is dropped as framing error
+ * and the framer resynchronises on the next preamble. It runs on every edge,
+ * packets and framing errors go to packet_stats whether recording or not.
+ *
+ * Records are written into a byte ring by the capture side (decoder thread, or
+ * the TIM15 interrupt without DMA capture) and read by the RPC thread.
+ */
+
+#include "sniffer.h"
+#include "loco_tracker.h"
+#include "packet_stats.h"
+#include "fast_ram.h"
+#include <atomic>
+#include <cstring>
+#include "main.h"
+
+static_assert((SNIFFER_BUFFER_SIZE & (SNIFFER_BUFFER_SIZE - 1u)) == 0u, "SNIFFER_BUFFER_SIZE must be a power of two");
+
+namespace {
+
+enum class HalfClass : uint8_t { One, Zero, Invalid };
+enum class FramerState : uint8_t { Preamble, StartBit, Data };
+
+constexpr uint32_t kMaxHalves = 2u * (1u + 9u * SNIFFER_MAX_BYTES);
+
+HalfClass classify(uint16_t width_us) {
+  if (width_us < SNIFFER_HALF_MIN_US || width_us > SNIFFER_HALF_ZERO_MAX_US) return HalfClass::Invalid;
+  return width_us <= SNIFFER_HALF_ONE_MAX_US ? HalfClass::One : HalfClass::Zero;
+}
+
+}  // namespace
+
+static uint8_t ring[SNIFFER_BUFFER_SIZE];
+static std::atomic<uint32_t> ringHead{0u};
+static std::atomic<uint32_t> ringTail{0u};
+
+static volatile bool enabled = false;
+static volatile bool tracking = false;    // framed packets go to the loco tracker
+static bool recordWidths = false;
+static uint32_t statPackets = 0;
+static uint32_t statChecksumErrors = 0;
+static uint32_t statFramingErrors = 0;
+static uint32_t statDropped = 0;
+
+// Framer state, only touched by the capture side
+static FramerState framerState = FramerState::Preamble;
+static uint32_t preambleHalves = 0;
+static bool synced = false;              // the last packet ended with its end bit
+static uint32_t edgeClock = 0;           // never reset, records are relative to enableClock
+static uint32_t enableClock = 0;
+static uint32_t startTime = 0;
+static uint16_t halves[kMaxHalves];
+static uint32_t halfCount = 0;
+static uint8_t bytes[SNIFFER_MAX_BYTES];
+static uint32_t byteCount = 0;
+static uint32_t bitInByte = 0;
+static uint8_t currentByte = 0;
+
+static void ringWrite(uint32_t pos, void const* src, uint32_t length)
+{
+  uint32_t const offset = pos & (SNIFFER_BUFFER_SIZE - 1u);
+  uint32_t const first = length < SNIFFER_BUFFER_SIZE - offset ? length : SNIFFER_BUFFER_SIZE - offset;
+  std::memcpy(&ring[offset], src, first);
+  std::memcpy(ring, static_cast<uint8_t const*>(src) + first, length - first);
+}
+
+static void ringRead(uint32_t pos, void* dst, uint32_t length)
+{
+  uint32_t const offset = pos & (SNIFFER_BUFFER_SIZE - 1u);
+  uint32_t const first = length < SNIFFER_BUFFER_SIZE - offset ? length : SNIFFER_BUFFER_SIZE - offset;
+  std::memcpy(dst, &ring[offset], first);
+  std::memcpy(static_cast<uint8_t*>(dst) + first, ring, length - first);
+}
+
+// Framing broke, resynchronise on the next preamble
+static void framingError(HalfClass last)
+{
+  if (enabled) {
+    statFramingErrors++;
+  }
+  packet_stats_framing_error();
+  synced = false;
+  framerState = FramerState::Preamble;
+  preambleHalves = last == HalfClass::One ? 1u : 0u;
+}
+
+static void emitPacket(void)
+{
+  uint8_t checksum = 0;
+  for (uint32_t i = 0; i < byteCount; i++) {
+    checksum ^= bytes[i];
+  }
+
+  uint32_t const preamble = preambleHalves / 2u;
+  packet_stats_packet(bytes, byteCount, checksum == 0u, preamble, halves, halfCount);
+  if (tracking && checksum == 0u) {
+    loco_tracker_packet(bytes, byteCount, startTime);
+  }
+  if (!enabled) {
+    return;
+  }
+
+  uint8_t flags = checksum == 0u ? SNIFFER_FLAG_CHECKSUM_OK : 0u;
+  uint32_t length = SNIFFER_HEADER_SIZE + byteCount;
+  if (recordWidths) {
+    flags |= SNIFFER_FLAG_WIDTHS;
+    length += halfCount * sizeof(uint16_t);
+  }
+
+  statPackets++;
+  if (!(flags & SNIFFER_FLAG_CHECKSUM_OK)) {
+    statChecksumErrors++;
+  }
+
+  uint32_t const head = ringHead.load(std::memory_order_relaxed);
+  if (length > SNIFFER_BUFFER_SIZE - (head - ringTail.load(std::memory_order_acquire))) {
+    statDropped++;
+    return;
+  }
+
+  uint32_t const tick = HAL_GetTick();
+  uint32_t const time = startTime - enableClock;
+  uint8_t header[SNIFFER_HEADER_SIZE];
+  header[0] = static_cast<uint8_t>(length);
+  header[1] = static_cast<uint8_t>(length >> 8);
+  std::memcpy(&header[2], &time, sizeof(time));
+  std::memcpy(&header[6], &tick, sizeof(tick));
+  header[10] = flags;
+  header[11] = static_cast<uint8_t>(preamble > 255u ? 255u : preamble);
+  header[12] = static_cast<uint8_t>(byteCount);
+
+  ringWrite(head, header, sizeof(header));
+  ringWrite(head + sizeof(header), bytes, byteCount);
+  if (recordWidths) {
+    ringWrite(head + sizeof(header) + byteCount, halves, halfCount * sizeof(uint16_t));
+  }
+  ringHead.store(head + length, std::memory_order_release);
+}
+
+extern "C" FAST_RAM_FUNC void sniffer_edge(uint16_t width_us)
+{
+  edgeClock += width_us;
+  HalfClass const cls = classify(width_us);
+
+  switch (framerState) {
+    case FramerState::Preamble:
+      if (cls == HalfClass::One) {
+        preambleHalves++;
+      }
+      else if (cls == HalfClass::Zero && preambleHalves >= 2u * SNIFFER_MIN_PREAMBLE) {
+        framerState = FramerState::StartBit;
+        startTime = edgeClock - width_us;
+        halves[0] = width_us;
+        halfCount = 1;
+      }
+      else {
+        // A zero after some preamble which followed a whole packet is a short preamble, not noise
+        if (cls == HalfClass::Zero && synced && preambleHalves >= 2u) {
+          packet_stats_short_preamble();
+        }
+        synced = false;
+        preambleHalves = 0;
+      }
+      break;
+
+    case FramerState::StartBit:
+      if (cls != HalfClass::Zero) {
+        framingError(cls);
+        break;
+      }
+      halves[halfCount++] = width_us;
+      framerState = FramerState::Data;
+      byteCount = 0;
+      bitInByte = 0;
+      currentByte = 0;
+      break;
+
+    case FramerState::Data: {
+      if (cls == HalfClass::Invalid || halfCount >= kMaxHalves) {
+        framingError(cls);
+        break;
+      }
+      halves[halfCount++] = width_us;
+      if (halfCount & 1u) {
+        break;  // first half of a bit
+      }
+      if (classify(halves[halfCount - 2u]) != cls) {
+        framingError(cls);
+        break;
+      }
+
+      bool const one = cls == HalfClass::One;
+      if (bitInByte < 8u) {
+        currentByte = static_cast<uint8_t>((currentByte << 1) | (one ? 1u : 0u));
+        if (++bitInByte == 8u) {
+          bytes[byteCount++] = currentByte;
+        }
+      }
+      else if (!one) {
+        // Byte separator, another byte follows
+        if (byteCount >= SNIFFER_MAX_BYTES) {
+          framingError(cls);
+          break;
+        }
+        bitInByte = 0;
+        currentByte = 0;
+      }
+      else {
+        emitPacket();
+        synced = true;
+        // The end bit may already count as preamble of the next packet
+        framerState = FramerState::Preamble;
+        preambleHalves = 2u;
+      }
+      break;
+    }
+  }
+}
+
+extern "C" void sniffer_enable(bool enable, bool widths)
+{
+  enabled = false;
+  if (!enable) {
+    return;
+  }
+  recordWidths = widths;
+  enableClock = edgeClock;
+  statPackets = 0;
+  statChecksumErrors = 0;
+  statFramingErrors = 0;
+  statDropped = 0;
+  enabled = true;
+}
+
+extern "C" void sniffer_track(bool enable)
+{
+  tracking = enable;
+}
+
+extern "C" int sniffer_clear(void)
+{
+  if (enabled) {
+    return -1;
+  }
+  ringTail.store(ringHead.load(std::memory_order_acquire), std::memory_order_release);
+  statPackets = 0;
+  statChecksumErrors = 0;
+  statFramingErrors = 0;
+  statDropped = 0;
+  return 0;
+}
+
+extern "C" uint32_t sniffer_read(uint8_t* out, uint32_t size, uint32_t max_records, uint32_t* records)
+{
+  uint32_t copied = 0;
+  uint32_t count = 0;
+  uint32_t tail = ringTail.load(std::memory_order_relaxed);
+
+  while (out && (max_records == 0u || count < max_records) && tail != ringHead.load(std::memory_order_acquire)) {
+    uint8_t length_bytes[2];
+    ringRead(tail, length_bytes, sizeof(length_bytes));
+    uint32_t const length = length_bytes[0] | (static_cast<uint32_t>(length_bytes[1]) << 8);
+    if (copied + length > size) {
+      break;
+    }
+    ringRead(tail, &out[copied], length);
+    copied += length;
+    count++;
+    tail += length;
+    ringTail.store(tail, std::memory_order_release);
+  }
+  if (records) {
+    *records = count;
+  }
+  return copied;
+}
+
+extern "C" void sniffer_get_stats(SnifferStats_t* stats)
+{
+  if (!stats) {
+    return;
+  }
+  stats->enabled = enabled;
+  stats->widths = recordWidths;
+  stats->packets = statPackets;
+  stats->checksum_errors = statChecksumErrors;
+  stats->framing_errors = statFramingErrors;
+  stats->dropped = statDropped;
+  stats->used = ringHead.load(std::memory_order_acquire) - ringTail.load(std::memory_order_acquire);
+  stats->capacity = SNIFFER_BUFFER_SIZE;
+}
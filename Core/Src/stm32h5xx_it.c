@@ -24,6 +24,8 @@
 /* USER CODE BEGIN Includes */
 #include "cli_app.h"
 #include "SUSI.h"
+#include "parameter_manager.h"
+#include "timebase.h"
 
 /* USER CODE END Includes */
 
@@ -55,10 +57,17 @@ static char rx_char;
 /* Private user code ---------------------------------------------------------*/
 /* USER CODE BEGIN 0 */
 
-void HAL_SPI_RxCpltCallback(SPI_HandleTypeDef *hspi)
+void HAL_SPI_TxCpltCallback(SPI_HandleTypeDef *hspi)
 {
-    if (hspi->Instance == SPI2) {
-        SUSI_S_SPI_RxCpltCallback(hspi);
+    if (hspi->Instance == SPI5) {
+        SUSI_M_SPI_TxCpltCallback(hspi);
+    }
+}
+
+void HAL_SPI_ErrorCallback(SPI_HandleTypeDef *hspi)
+{
+    if (hspi->Instance == SPI5) {
+        SUSI_M_SPI_ErrorCallback(hspi);
     }
 }
 /* USER CODE END 0 */
@@ -87,6 +96,10 @@ extern TIM_HandleTypeDef htim6;
 void NMI_Handler(void)
 {
   /* USER CODE BEGIN NonMaskableInt_IRQn 0 */
+  if (parameter_manager_flash_nmi())
+  {
+    return;
+  }
 
   /* USER CODE END NonMaskableInt_IRQn 0 */
   /* USER CODE BEGIN NonMaskableInt_IRQn 1 */
@@ -200,7 +213,8 @@ void TIM6_IRQHandler(void)
   /* USER CODE END TIM6_IRQn 0 */
   HAL_TIM_IRQHandler(&htim6);
   /* USER CODE BEGIN TIM6_IRQn 1 */
-
+  /* HAL tick: at least one read per cycle counter wrap */
+  timebase_tick();
   /* USER CODE END TIM6_IRQn 1 */
 }
 
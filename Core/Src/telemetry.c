@@ -0,0 +1,291 @@
+/**
+ * @file telemetry.c
+ * @brief Streaming telemetry over UDP
+ *
+ * The ADC DMA interrupt is the only producer of the record ring, the telemetry
+ * thread the only consumer. The thread copies records into the payload of the
+ * packet being filled, the header is written in front of them when it is sent.
+ * Settings and the open packet are protected by a mutex shared with the RPC
+ * thread. While telemetry is off the thread blocks until the next start.
+ */
+
+#include "telemetry.h"
+#include "analog_manager.h"
+#include "app_netxduo.h"
+#include "cmsis_os2.h"
+#include "rtos_static.h"
+#include "command_station.h"
+#include "main.h"
+#include "railcom.h"
+#include "timebase.h"
+#include <stdio.h>
+#include <string.h>
+
+_Static_assert(sizeof(TelemetryRecord_t) == 16u, "the record layout is part of the protocol");
+_Static_assert(TELEMETRY_HEADER_SIZE + TELEMETRY_RECORDS_PER_DATAGRAM * sizeof(TelemetryRecord_t) <= 1472u,
+               "datagram exceeds a 1500 byte MTU");
+_Static_assert((TELEMETRY_RING_RECORDS & (TELEMETRY_RING_RECORDS - 1u)) == 0u, "ring index is masked");
+
+#define TELEMETRY_POLL_MS       5u
+#define TELEMETRY_EVENT_START   (1u << 0)
+
+extern NX_IP NetXDuoEthIpInstance;
+extern NX_PACKET_POOL NxAppPool;
+
+static TelemetryRecord_t g_ring[TELEMETRY_RING_RECORDS];
+static volatile uint32_t g_head = 0;        // written by the ADC interrupt
+static volatile uint32_t g_tail = 0;        // written by the telemetry thread
+static volatile uint32_t g_ringLost = 0;    // records the interrupt found no room for
+static volatile uint16_t g_decimation = 1;
+static uint16_t g_phase = 0;
+
+static osMutexId_t g_lock = NULL;
+static osThreadId_t telemetryTaskHandle = NULL;
+static osEventFlagsId_t g_events = NULL;
+RTOS_MUTEX(telemetryLock);
+RTOS_EVENT_FLAGS(telemetryEvents);
+static NX_UDP_SOCKET g_socket;
+static bool g_socketReady = false;
+static bool g_enabled = false;
+static uint32_t g_hostIp = 0;
+static uint16_t g_hostPort = 0;
+static uint32_t g_latencyMs = TELEMETRY_DEFAULT_LATENCY_MS;
+
+// Datagram being filled
+static NX_PACKET *g_packet = NULL;
+static uint32_t g_count = 0;
+static uint32_t g_openedMs = 0;
+
+static uint32_t g_seq = 0;
+static uint32_t g_records = 0;
+static uint32_t g_datagrams = 0;
+static uint32_t g_allocLost = 0;            // records discarded for lack of a packet
+static uint32_t g_lostReported = 0;
+static uint32_t g_txErrors = 0;
+
+RTOS_THREAD_MEMORY(telemetryTask, 512 * 4);
+static const osThreadAttr_t telemetryTask_attributes = {
+    .name = "telemetryTask",
+    .priority = (osPriority_t) osPriorityBelowNormal,
+    RTOS_THREAD_ATTR_MEMORY(telemetryTask)
+};
+
+// ADC DMA interrupt, once per bucket
+static void telemetry_bucket(uint32_t bucket, uint16_t voltage_raw, uint16_t current_raw)
+{
+    if (++g_phase < g_decimation) {
+        return;
+    }
+    g_phase = 0;
+
+    uint32_t const head = g_head;
+    if (head - g_tail >= TELEMETRY_RING_RECORDS) {
+        g_ringLost = g_ringLost + 1u;
+        return;
+    }
+
+    TelemetryRecord_t *record = &g_ring[head & (TELEMETRY_RING_RECORDS - 1u)];
+    uint32_t cutout_seq;
+    uint16_t ch1;
+    record->sample = bucket;
+    record->packet_seq = CommandStation_GetPacketSeq();
+    record->voltage_mv = analog_counts_to_mv(voltage_raw);
+    record->current_ma = analog_counts_to_ma(current_raw);
+    record->railcom = railcom_last_cutout(&cutout_seq, &ch1);
+    uint32_t const lag = record->packet_seq - cutout_seq;
+    record->railcom_lag = (uint8_t)(lag > 255u ? 255u : lag);
+    record->railcom_ch1 = ch1;
+    __DMB();
+    g_head = head + 1u;
+}
+
+static void put16(uint8_t *p, uint16_t value)
+{
+    p[0] = (uint8_t)value;
+    p[1] = (uint8_t)(value >> 8);
+}
+
+static void put32(uint8_t *p, uint32_t value)
+{
+    put16(p, (uint16_t)value);
+    put16(p + 2, (uint16_t)(value >> 16));
+}
+
+static void put64(uint8_t *p, uint64_t value)
+{
+    put32(p, (uint32_t)value);
+    put32(p + 4, (uint32_t)(value >> 32));
+}
+
+// Called with g_lock held
+static void datagram_send(void)
+{
+    NX_PACKET *packet = g_packet;
+    uint8_t *header = packet->nx_packet_prepend_ptr;
+    uint32_t const lost_total = g_ringLost + g_allocLost;
+    uint32_t const lost = lost_total - g_lostReported;
+
+    g_packet = NULL;
+    g_lostReported = lost_total;
+    put16(&header[0], TELEMETRY_MAGIC);
+    header[2] = TELEMETRY_VERSION;
+    header[3] = (uint8_t)sizeof(TelemetryRecord_t);
+    put16(&header[4], (uint16_t)g_count);
+    put16(&header[6], (uint16_t)(lost > 0xFFFFu ? 0xFFFFu : lost));
+    put32(&header[8], g_seq++);
+    uint64_t const cycles = timebase_cycles();
+    put32(&header[12], HAL_GetTick());
+    put32(&header[16], (uint32_t)cycles);
+    put64(&header[20], timebase_ns(cycles));
+    packet->nx_packet_length = (ULONG)(packet->nx_packet_append_ptr - packet->nx_packet_prepend_ptr);
+
+    if (nx_udp_socket_send(&g_socket, packet, g_hostIp, g_hostPort) != NX_SUCCESS) {
+        nx_packet_release(packet);
+        g_txErrors++;
+        return;
+    }
+    g_datagrams++;
+    g_records += g_count;
+}
+
+// Called with g_lock held, moves the ring into datagrams
+static void telemetry_drain(void)
+{
+    while (g_tail != g_head) {
+        if (g_packet == NULL) {
+            if (nx_packet_allocate(&NxAppPool, &g_packet, NX_UDP_PACKET, NX_NO_WAIT) != NX_SUCCESS) {
+                g_packet = NULL;
+                g_allocLost += g_head - g_tail;
+                g_tail = g_head;
+                return;
+            }
+            // The header goes in front of the records when the datagram is sent
+            g_packet->nx_packet_append_ptr = g_packet->nx_packet_prepend_ptr + TELEMETRY_HEADER_SIZE;
+            g_count = 0;
+            g_openedMs = HAL_GetTick();
+        }
+
+        memcpy(g_packet->nx_packet_append_ptr, &g_ring[g_tail & (TELEMETRY_RING_RECORDS - 1u)],
+               sizeof(TelemetryRecord_t));
+        g_packet->nx_packet_append_ptr += sizeof(TelemetryRecord_t);
+        g_count++;
+        __DMB();
+        g_tail = g_tail + 1u;
+
+        if (g_count == TELEMETRY_RECORDS_PER_DATAGRAM) {
+            datagram_send();
+        }
+    }
+
+    if (g_packet != NULL && HAL_GetTick() - g_openedMs >= g_latencyMs) {
+        datagram_send();
+    }
+}
+
+static void TelemetryTask(void *argument)
+{
+    (void)argument;
+
+    for (;;) {
+        if (!g_enabled) {
+            osEventFlagsWait(g_events, TELEMETRY_EVENT_START, osFlagsWaitAny, osWaitForever);
+        }
+        osDelay(TELEMETRY_POLL_MS);
+        osMutexAcquire(g_lock, osWaitForever);
+        if (g_enabled) {
+            telemetry_drain();
+        }
+        osMutexRelease(g_lock);
+    }
+}
+
+void telemetry_init(void)
+{
+    if (telemetryTaskHandle != NULL) {
+        return;
+    }
+    g_lock = osMutexNew(&telemetryLock_attr);
+    g_events = osEventFlagsNew(&telemetryEvents_attr);
+    telemetryTaskHandle = osThreadNew(TelemetryTask, NULL, &telemetryTask_attributes);
+    if (g_lock == NULL || g_events == NULL || telemetryTaskHandle == NULL) {
+        printf("Failed to create telemetry thread\n");
+    }
+}
+
+// Called with g_lock held
+static void telemetry_halt(void)
+{
+    analog_manager_set_bucket_hook(ANALOG_HOOK_TELEMETRY, NULL);
+    g_enabled = false;
+    if (g_packet != NULL) {
+        nx_packet_release(g_packet);
+        g_packet = NULL;
+    }
+}
+
+int telemetry_start(uint32_t host_ip, uint16_t host_port, uint16_t decimation, uint32_t latency_ms)
+{
+    if (g_lock == NULL || !analog_manager_is_streaming() || host_ip == 0u || host_port == 0u) {
+        return -1;
+    }
+
+    osMutexAcquire(g_lock, osWaitForever);
+    telemetry_halt();
+    if (!g_socketReady) {
+        if (nx_udp_socket_create(&NetXDuoEthIpInstance, &g_socket, "Telemetry Socket", NX_IP_NORMAL,
+                                 NX_DONT_FRAGMENT, NX_IP_TIME_TO_LIVE, 1) != NX_SUCCESS) {
+            osMutexRelease(g_lock);
+            return -1;
+        }
+        if (nx_udp_socket_bind(&g_socket, NX_ANY_PORT, NX_NO_WAIT) != NX_SUCCESS) {
+            nx_udp_socket_delete(&g_socket);
+            osMutexRelease(g_lock);
+            return -1;
+        }
+        g_socketReady = true;
+    }
+
+    g_hostIp = host_ip;
+    g_hostPort = host_port;
+    g_decimation = decimation ? decimation : 1u;
+    g_latencyMs = latency_ms;
+    g_phase = 0;
+    g_tail = g_head;
+    g_seq = 0;
+    g_records = 0;
+    g_datagrams = 0;
+    g_ringLost = 0;
+    g_allocLost = 0;
+    g_lostReported = 0;
+    g_txErrors = 0;
+    g_enabled = true;
+    analog_manager_set_bucket_hook(ANALOG_HOOK_TELEMETRY, telemetry_bucket);
+    osMutexRelease(g_lock);
+    osEventFlagsSet(g_events, TELEMETRY_EVENT_START);
+    return 0;
+}
+
+void telemetry_stop(void)
+{
+    if (g_lock == NULL) {
+        return;
+    }
+    osMutexAcquire(g_lock, osWaitForever);
+    telemetry_halt();
+    osMutexRelease(g_lock);
+}
+
+void telemetry_get_stats(TelemetryStats_t *stats)
+{
+    if (stats == NULL) {
+        return;
+    }
+    stats->enabled = g_enabled;
+    stats->host_ip = g_hostIp;
+    stats->host_port = g_hostPort;
+    stats->decimation = g_decimation;
+    stats->records = g_records;
+    stats->datagrams = g_datagrams;
+    stats->lost = g_ringLost + g_allocLost;
+    stats->tx_errors = g_txErrors;
+}
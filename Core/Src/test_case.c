@@ -0,0 +1,201 @@
+/**
+ * @file test_case.c
+ * @brief Test list storage, validation, response evaluation and result records
+ *
+ * The list is written by the RPC thread and only read by the command station
+ * thread while it runs, loading is refused during a run. Result records are
+ * written by the command station thread and published by the record count,
+ * so the RPC thread can read the finished ones during a run.
+ */
+
+#include "test_case.h"
+#include "analog_manager.h"
+#include "gpio_io.h"
+#include "main.h"
+#include "packet_program.h"
+#include "parameter_manager.h"
+#include "railcom.h"
+#include <string.h>
+
+static TestStep_t g_steps[TEST_CASE_MAX_STEPS];
+static uint16_t g_stepCount = 0;
+static TestResult_t g_results[TEST_CASE_MAX_RESULTS];
+static volatile uint32_t g_resultCount = 0;
+static volatile uint16_t g_runStep = 0;
+static uint32_t g_passed = 0;
+static uint32_t g_failed = 0;
+static uint32_t g_runStartMs = 0;
+static uint32_t g_runEndMs = 0;
+static volatile bool g_runActive = false;
+
+static bool program_running(void)
+{
+    PacketProgramStatus_t status;
+    CommandStation_GetProgramStatus(&status);
+    return status.running;
+}
+
+int TestCase_Clear(void)
+{
+    if (program_running()) {
+        return -1;
+    }
+    g_stepCount = 0;
+    return 0;
+}
+
+int TestCase_Append(const TestStep_t *steps, uint16_t count)
+{
+    if (program_running() || steps == NULL) {
+        return -1;
+    }
+    if (count > TEST_CASE_MAX_STEPS - g_stepCount) {
+        return -1;
+    }
+    memcpy(&g_steps[g_stepCount], steps, count * sizeof(TestStep_t));
+    g_stepCount += count;
+    return 0;
+}
+
+int TestCase_Prepare(const char **error)
+{
+    const char *dummy;
+    if (error == NULL) {
+        error = &dummy;
+    }
+
+    if (g_stepCount == 0) {
+        *error = "no test steps loaded";
+        return -1;
+    }
+
+    uint8_t bidi = 0;
+    get_dcc_bidi_enable(&bidi);
+    for (uint16_t i = 0; i < g_stepCount; i++) {
+        const TestStep_t *step = &g_steps[i];
+        if (step->length > TEST_CASE_MAX_PACKET || (step->length == 0 && (step->expect & (TEST_EXPECT_ACK | TEST_EXPECT_RAILCOM)))) {
+            *error = "invalid packet length";
+            return -1;
+        }
+        if ((step->expect & ~(TEST_EXPECT_ALL | TEST_EXPECT_HOLD)) != 0u || step->timeout_ms > TEST_CASE_MAX_TIMEOUT_MS) {
+            *error = "invalid expectation";
+            return -1;
+        }
+        if ((step->expect & TEST_EXPECT_CURRENT) && step->current_min_ma > step->current_max_ma) {
+            *error = "current_min_ma above current_max_ma";
+            return -1;
+        }
+        if ((step->expect & (TEST_EXPECT_CURRENT | TEST_EXPECT_ACK)) && !analog_manager_is_streaming()) {
+            *error = "current expectations require continuous analog sampling";
+            return -1;
+        }
+        if ((step->expect & TEST_EXPECT_RAILCOM) && !bidi) {
+            *error = "RailCom expectations require BiDi";
+            return -1;
+        }
+        // An ACK or a RailCom reply is an event, it cannot be held
+        if ((step->expect & TEST_EXPECT_HOLD) && (step->expect & (TEST_EXPECT_ACK | TEST_EXPECT_RAILCOM))) {
+            *error = "ACK and RailCom cannot be combined with hold";
+            return -1;
+        }
+    }
+    return 0;
+}
+
+uint16_t TestCase_Get(const TestStep_t **steps)
+{
+    if (steps != NULL) {
+        *steps = g_steps;
+    }
+    return g_stepCount;
+}
+
+void TestCase_Probe(TestProbe_t *probe)
+{
+    uint16_t raw = 0;
+    RailcomStats_t railcom;
+
+    probe->current_ma = 0;
+    if (analog_manager_get_average(2, 2, TEST_CASE_CURRENT_WINDOW_MS, &raw) == 0) {
+        probe->current_ma = analog_counts_to_ma(raw);
+    }
+    probe->io = gpio_io_snapshot();
+    railcom_get_stats(&railcom);
+    probe->railcom_frames = railcom.frames - railcom.invalid;
+}
+
+uint8_t TestCase_Check(const TestStep_t *step, const TestProbe_t *probe, uint32_t railcom_base)
+{
+    uint8_t failed = 0;
+    if ((step->expect & TEST_EXPECT_CURRENT) &&
+        (probe->current_ma < step->current_min_ma || probe->current_ma > step->current_max_ma)) {
+        failed |= TEST_EXPECT_CURRENT;
+    }
+    if ((step->expect & TEST_EXPECT_IO) && (probe->io & step->io_mask) != (step->io_level & step->io_mask)) {
+        failed |= TEST_EXPECT_IO;
+    }
+    if ((step->expect & TEST_EXPECT_RAILCOM) && probe->railcom_frames == railcom_base) {
+        failed |= TEST_EXPECT_RAILCOM;
+    }
+    return failed;
+}
+
+void TestCase_RunStart(void)
+{
+    g_resultCount = 0;
+    g_runStep = 0;
+    g_passed = 0;
+    g_failed = 0;
+    g_runStartMs = HAL_GetTick();
+    g_runActive = true;
+}
+
+void TestCase_RunStep(uint16_t step)
+{
+    g_runStep = step;
+}
+
+void TestCase_AddResult(const TestResult_t *result)
+{
+    uint32_t const count = g_resultCount;
+    if (count >= TEST_CASE_MAX_RESULTS) {
+        return;
+    }
+    g_results[count] = *result;
+    if (result->passed) {
+        g_passed++;
+    }
+    else {
+        g_failed++;
+    }
+    __DMB();
+    g_resultCount = count + 1u;
+}
+
+void TestCase_RunEnd(void)
+{
+    g_runEndMs = HAL_GetTick();
+    g_runActive = false;
+}
+
+uint32_t TestCase_GetResults(uint32_t first, TestResult_t *results, uint32_t max)
+{
+    uint32_t const count = g_resultCount;
+    __DMB();
+    uint32_t copied = 0;
+    for (uint32_t i = first; i < count && copied < max; i++) {
+        results[copied++] = g_results[i];
+    }
+    return copied;
+}
+
+void TestCase_GetStatus(TestRunStatus_t *status)
+{
+    status->steps = g_stepCount;
+    status->running = g_runActive;
+    status->step = g_runStep;
+    status->results = g_resultCount;
+    status->passed = g_passed;
+    status->failed = g_failed;
+    status->elapsed_ms = (g_runActive ? HAL_GetTick() : g_runEndMs) - g_runStartMs;
+}
@@ -0,0 +1,281 @@
+/**
+ * @file timebase.c
+ * @brief Monotonic 64-bit capture timebase disciplined to UTC by SNTP
+ *
+ * The wrap count and the segment are read from interrupts, they are only
+ * touched with interrupts disabled; a reader copies the segment and converts
+ * outside. The discipline state belongs to the SNTP sample and RTC paths,
+ * serialised by a mutex.
+ */
+
+#include "timebase.h"
+#include "cmsis_os2.h"
+#include "rtos_static.h"
+#include "main.h"
+
+#define NTP_UNIX_OFFSET_S   2208988800u     // 1900-01-01 to 1970-01-01
+#define NS_PER_S            1000000000ull
+
+typedef struct {
+    uint64_t base_cycles;
+    uint64_t base_ns;           // UTC at base_cycles
+    uint64_t slew_cycles;       // cycles after the base at slew_scale
+    uint64_t slew_scale;        // ns per cycle, 32.32 fixed point
+    uint64_t scale;             // ns per cycle from then on
+} Segment_t;
+
+// Any context, interrupts disabled
+static uint32_t g_high = 0;
+static uint32_t g_last = 0;
+static Segment_t g_segment;
+static uint64_t g_slept = 0;        // cycles the counter missed in WFI, see timebase_sleep_add
+
+// Discipline, g_lock held
+static osMutexId_t g_lock = NULL;
+RTOS_MUTEX(timebaseLock);
+static TimebaseSource_t g_source = TIMEBASE_SOURCE_NONE;
+static uint64_t g_refCycles = 0;    // first SNTP sample since the last step, sleeps included
+static uint64_t g_refNs = 0;
+static int32_t g_freqPpb = 0;
+static uint32_t g_syncs = 0;
+static uint32_t g_steps = 0;
+static int64_t g_lastOffset = 0;
+static uint64_t g_lastSyncNs = 0;
+
+static const char *const kSourceNames[] = { "none", "rtc", "sntp" };
+
+uint64_t timebase_cycles(void)
+{
+    uint32_t const primask = __get_PRIMASK();
+    __disable_irq();
+    uint32_t const now = DWT->CYCCNT;
+    if (now < g_last) {
+        g_high++;
+    }
+    g_last = now;
+    uint64_t const cycles = ((uint64_t)g_high << 32) | now;
+    __set_PRIMASK(primask);
+    return cycles;
+}
+
+void timebase_tick(void)
+{
+    (void)timebase_cycles();
+}
+
+static uint64_t cycles_to_ns(uint64_t cycles, uint64_t scale)
+{
+    uint64_t const high = cycles >> 32;
+    uint64_t const low = cycles & 0xFFFFFFFFu;
+    return high * scale + low * (scale >> 32) + ((low * (scale & 0xFFFFFFFFu)) >> 32);
+}
+
+static uint64_t segment_ns(const Segment_t *segment, uint64_t cycles)
+{
+    if (cycles < segment->base_cycles) {
+        uint64_t const back = cycles_to_ns(segment->base_cycles - cycles, segment->scale);
+        return back < segment->base_ns ? segment->base_ns - back : 0u;
+    }
+    uint64_t const delta = cycles - segment->base_cycles;
+    uint64_t const slewed = delta < segment->slew_cycles ? delta : segment->slew_cycles;
+    return segment->base_ns + cycles_to_ns(slewed, segment->slew_scale) +
+           cycles_to_ns(delta - slewed, segment->scale);
+}
+
+uint64_t timebase_ns(uint64_t cycles)
+{
+    uint32_t const primask = __get_PRIMASK();
+    __disable_irq();
+    Segment_t const segment = g_segment;
+    __set_PRIMASK(primask);
+    return segment_ns(&segment, cycles);
+}
+
+uint64_t timebase_now_ns(void)
+{
+    return timebase_ns(timebase_cycles());
+}
+
+void timebase_sleep_add(uint32_t cycles)
+{
+    uint32_t const primask = __get_PRIMASK();
+    __disable_irq();
+    g_segment.base_ns += cycles_to_ns(cycles, g_segment.scale);
+    g_slept += cycles;
+    __set_PRIMASK(primask);
+}
+
+// Cycles as if the counter had run through every sleep
+static uint64_t awake_cycles(uint64_t cycles)
+{
+    uint32_t const primask = __get_PRIMASK();
+    __disable_irq();
+    uint64_t const slept = g_slept;
+    __set_PRIMASK(primask);
+    return cycles + slept;
+}
+
+// ns per cycle, 32.32, of the cycle counter running ppb fast
+static uint64_t rate_scale(int32_t ppb)
+{
+    double const hz = (double)SystemCoreClock * (1.0 + (double)ppb * 1e-9);
+    return (uint64_t)((double)NS_PER_S * 4294967296.0 / hz + 0.5);
+}
+
+static void segment_set(const Segment_t *segment)
+{
+    uint32_t const primask = __get_PRIMASK();
+    __disable_irq();
+    g_segment = *segment;
+    __set_PRIMASK(primask);
+}
+
+// g_lock held
+static void step_to(uint64_t cycles, uint64_t utc_ns, TimebaseSource_t source)
+{
+    uint64_t const scale = rate_scale(g_freqPpb);
+    Segment_t const segment = { cycles, utc_ns, 0u, scale, scale };
+    segment_set(&segment);
+    g_refCycles = awake_cycles(cycles);
+    g_refNs = utc_ns;
+    g_source = source;
+    g_steps++;
+}
+
+static uint32_t days_from_civil(uint32_t year, uint32_t month, uint32_t day)
+{
+    // Days since 1970-01-01 of a proleptic Gregorian date
+    year -= month <= 2u ? 1u : 0u;
+    uint32_t const era = year / 400u;
+    uint32_t const yoe = year - era * 400u;
+    uint32_t const doy = (153u * (month > 2u ? month - 3u : month + 9u) + 2u) / 5u + day - 1u;
+    uint32_t const doe = yoe * 365u + yoe / 4u - yoe / 100u + doy;
+    return era * 146097u + doe - 719468u;
+}
+
+static bool rtc_utc_ns(uint64_t *utc_ns)
+{
+    RTC_TimeTypeDef time = {0};
+    RTC_DateTypeDef date = {0};
+    // The date read unlocks the shadow registers the time read froze
+    if (HAL_RTC_GetTime(&hrtc, &time, RTC_FORMAT_BIN) != HAL_OK ||
+        HAL_RTC_GetDate(&hrtc, &date, RTC_FORMAT_BIN) != HAL_OK) {
+        return false;
+    }
+    uint64_t const seconds = (uint64_t)days_from_civil(2000u + date.Year, date.Month, date.Date) * 86400u +
+                             time.Hours * 3600u + time.Minutes * 60u + time.Seconds;
+    uint64_t fraction_ns = 0;
+    if (time.SubSeconds <= time.SecondFraction) {
+        fraction_ns = (uint64_t)(time.SecondFraction - time.SubSeconds) * NS_PER_S / (time.SecondFraction + 1u);
+    }
+    *utc_ns = seconds * NS_PER_S + fraction_ns;
+    return true;
+}
+
+void timebase_init(void)
+{
+    if (g_lock != NULL) {
+        return;
+    }
+    g_lock = osMutexNew(&timebaseLock_attr);
+
+    uint64_t const cycles = timebase_cycles();
+    uint64_t utc_ns = 0;
+    if (rtc_utc_ns(&utc_ns)) {
+        step_to(cycles, utc_ns, TIMEBASE_SOURCE_RTC);
+    }
+    else {
+        // Time since boot until a source is available
+        step_to(0u, 0u, TIMEBASE_SOURCE_NONE);
+    }
+    g_steps = 0;
+}
+
+void timebase_sntp_sample(uint32_t ntp_seconds, uint32_t ntp_fraction, uint64_t cycles)
+{
+    if (g_lock == NULL || ntp_seconds < NTP_UNIX_OFFSET_S) {
+        return;
+    }
+    uint64_t const utc_ns = (uint64_t)(ntp_seconds - NTP_UNIX_OFFSET_S) * NS_PER_S +
+                            (((uint64_t)ntp_fraction * NS_PER_S) >> 32);
+
+    osMutexAcquire(g_lock, osWaitForever);
+    uint64_t const predicted = timebase_ns(cycles);
+    int64_t const offset = (int64_t)(utc_ns - predicted);
+    uint64_t const magnitude = offset < 0 ? (uint64_t)-offset : (uint64_t)offset;
+    g_syncs++;
+    g_lastOffset = offset;
+    g_lastSyncNs = utc_ns;
+
+    if (g_source != TIMEBASE_SOURCE_SNTP || magnitude > TIMEBASE_STEP_NS) {
+        step_to(cycles, utc_ns, TIMEBASE_SOURCE_SNTP);
+        osMutexRelease(g_lock);
+        return;
+    }
+
+    // Frequency over the whole baseline, SNTP jitter shrinks with its length
+    if (utc_ns > g_refNs && utc_ns - g_refNs >= TIMEBASE_FREQ_MIN_NS) {
+        double const ratio = (double)(awake_cycles(cycles) - g_refCycles) * (double)NS_PER_S /
+                             ((double)(utc_ns - g_refNs) * (double)SystemCoreClock);
+        double ppb = (ratio - 1.0) * 1e9;
+        ppb = ppb > TIMEBASE_MAX_SLEW_PPB ? TIMEBASE_MAX_SLEW_PPB : ppb;
+        ppb = ppb < -TIMEBASE_MAX_SLEW_PPB ? -TIMEBASE_MAX_SLEW_PPB : ppb;
+        g_freqPpb = (int32_t)ppb;
+    }
+
+    // Continue from where the timebase is, absorb the offset in the rate
+    uint64_t slew_ns = magnitude * (NS_PER_S / TIMEBASE_MAX_SLEW_PPB);
+    slew_ns = slew_ns < TIMEBASE_SLEW_NS ? TIMEBASE_SLEW_NS : slew_ns;
+    double const slew_cycles = (double)slew_ns * (double)SystemCoreClock / (double)NS_PER_S;
+    uint64_t const scale = rate_scale(g_freqPpb);
+    double const slew_scale = (double)scale + (double)offset * 4294967296.0 / slew_cycles;
+    Segment_t const segment = {
+        cycles, predicted, (uint64_t)slew_cycles, (uint64_t)(slew_scale + 0.5), scale
+    };
+    segment_set(&segment);
+    osMutexRelease(g_lock);
+}
+
+void timebase_rtc_changed(void)
+{
+    if (g_lock == NULL) {
+        return;
+    }
+    osMutexAcquire(g_lock, osWaitForever);
+    uint64_t utc_ns = 0;
+    if (g_source != TIMEBASE_SOURCE_SNTP && rtc_utc_ns(&utc_ns)) {
+        step_to(timebase_cycles(), utc_ns, TIMEBASE_SOURCE_RTC);
+    }
+    osMutexRelease(g_lock);
+}
+
+void timebase_status(TimebaseStatus_t *status)
+{
+    if (g_lock != NULL) {
+        osMutexAcquire(g_lock, osWaitForever);
+    }
+    status->source = g_source;
+    status->syncs = g_syncs;
+    status->steps = g_steps;
+    status->last_offset_ns = g_lastOffset;
+    status->freq_ppb = g_freqPpb;
+    status->last_sync_ns = g_lastSyncNs;
+    if (g_lock != NULL) {
+        osMutexRelease(g_lock);
+    }
+    status->cpu_hz = SystemCoreClock;
+
+    uint32_t const primask = __get_PRIMASK();
+    __disable_irq();
+    status->tick_ms = HAL_GetTick();
+    status->cycles = timebase_cycles();
+    Segment_t const segment = g_segment;
+    __set_PRIMASK(primask);
+    status->time_ns = segment_ns(&segment, status->cycles);
+    status->slewing = status->cycles - segment.base_cycles < segment.slew_cycles;
+}
+
+const char *timebase_source_name(TimebaseSource_t source)
+{
+    return (uint32_t)source < sizeof(kSourceNames) / sizeof(kSourceNames[0]) ? kSourceNames[source] : "unknown";
+}
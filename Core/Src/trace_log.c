@@ -0,0 +1,162 @@
+/**
+ * @file trace_log.c
+ * @brief Deferred binary trace log
+ *
+ * Producers copy a record into the ring with interrupts masked so that a thread
+ * and the interrupts preempting it can log at the same time, the single consumer
+ * is the drain thread which formats the records with printf. The drain thread
+ * sleeps on an event flag, set when a record goes into an empty ring.
+ */
+
+#include "trace_log.h"
+#include "cmsis_os2.h"
+#include "rtos_static.h"
+#include "main.h"
+#include "parameter_manager.h"
+#include <stdio.h>
+
+_Static_assert((TRACE_LOG_RECORDS & (TRACE_LOG_RECORDS - 1u)) == 0u, "ring index is masked");
+
+typedef struct {
+    const char *fmt;
+    uint32_t tick_ms;
+    uint32_t args[TRACE_LOG_MAX_ARGS];
+} TraceRecord_t;
+
+static TraceRecord_t g_ring[TRACE_LOG_RECORDS];
+static volatile uint32_t g_head = 0;      // written by producers
+static volatile uint32_t g_tail = 0;      // written by the drain thread
+static volatile uint8_t g_level = TRACE_LEVEL_INFO;
+static volatile uint32_t g_records = 0;
+static volatile uint32_t g_dropped = 0;
+static volatile uint32_t g_filtered = 0;
+static volatile uint16_t g_highWater = 0;
+
+static osThreadId_t traceTaskHandle = NULL;
+static osEventFlagsId_t traceEvents = NULL;
+
+#define TRACE_EVENT_RECORD    (1u << 0)
+
+RTOS_EVENT_FLAGS(traceEvents);
+
+RTOS_THREAD_MEMORY(traceTask, 512 * 4);
+static const osThreadAttr_t traceTask_attributes = {
+    .name = "traceTask",
+    .priority = (osPriority_t) osPriorityLow,
+    RTOS_THREAD_ATTR_MEMORY(traceTask)
+};
+
+void trace_log_write(uint8_t level, const char *fmt, uint32_t a0, uint32_t a1, uint32_t a2, uint32_t a3)
+{
+    if (level > g_level) {
+        g_filtered++;
+        return;
+    }
+
+    uint32_t const tick = HAL_GetTick();
+    uint32_t const primask = __get_PRIMASK();
+    __disable_irq();
+    uint32_t const head = g_head;
+    uint32_t const pending = head - g_tail;
+    if (pending >= TRACE_LOG_RECORDS) {
+        g_dropped++;
+        __set_PRIMASK(primask);
+        return;
+    }
+    TraceRecord_t *record = &g_ring[head & (TRACE_LOG_RECORDS - 1u)];
+    record->fmt = fmt;
+    record->tick_ms = tick;
+    record->args[0] = a0;
+    record->args[1] = a1;
+    record->args[2] = a2;
+    record->args[3] = a3;
+    g_head = head + 1u;
+    g_records++;
+    if (pending + 1u > g_highWater) {
+        g_highWater = (uint16_t)(pending + 1u);
+    }
+    __set_PRIMASK(primask);
+
+    // A non-empty ring has woken the drain thread already
+    if (pending == 0u && traceEvents != NULL) {
+        osEventFlagsSet(traceEvents, TRACE_EVENT_RECORD);
+    }
+}
+
+static void trace_drain(void)
+{
+    static uint32_t reportedDrops = 0;
+
+    while (g_tail != g_head) {
+        // Copy the record out before releasing its slot
+        TraceRecord_t record = g_ring[g_tail & (TRACE_LOG_RECORDS - 1u)];
+        __DMB();
+        g_tail = g_tail + 1u;
+
+        printf("[%lu] ", (unsigned long)record.tick_ms);
+        printf(record.fmt, record.args[0], record.args[1], record.args[2], record.args[3]);
+    }
+
+    uint32_t const dropped = g_dropped;
+    if (dropped != reportedDrops) {
+        printf("Trace log: %lu records dropped\n", (unsigned long)(dropped - reportedDrops));
+        reportedDrops = dropped;
+    }
+}
+
+static void TraceLogTask(void *argument)
+{
+    (void)argument;
+
+    for (;;) {
+        osEventFlagsWait(traceEvents, TRACE_EVENT_RECORD, osFlagsWaitAny, osWaitForever);
+        osDelay(TRACE_LOG_DRAIN_MS);
+        trace_drain();
+    }
+}
+
+void trace_log_init(void)
+{
+    if (traceTaskHandle != NULL) {
+        return;
+    }
+
+    uint8_t level;
+    if (get_system_debug_level(&level) == 0) {
+        g_level = level;
+    }
+
+    traceEvents = osEventFlagsNew(&traceEvents_attr);
+    if (traceEvents != NULL) {
+        osEventFlagsSet(traceEvents, TRACE_EVENT_RECORD);   // records logged before init
+    }
+    traceTaskHandle = osThreadNew(TraceLogTask, NULL, &traceTask_attributes);
+    if (traceTaskHandle == NULL) {
+        printf("Failed to create trace log thread\n");
+    }
+}
+
+int trace_log_set_level(uint8_t level)
+{
+    if (level > TRACE_LEVEL_VERBOSE) {
+        return -1;
+    }
+    if (set_system_debug_level(level) != 0) {
+        return -1;
+    }
+    g_level = level;
+    return 0;
+}
+
+void trace_log_get_stats(TraceLogStats_t *stats)
+{
+    if (stats == NULL) {
+        return;
+    }
+    stats->records = g_records;
+    stats->dropped = g_dropped;
+    stats->filtered = g_filtered;
+    stats->pending = (uint16_t)(g_head - g_tail);
+    stats->high_water = g_highWater;
+    stats->level = g_level;
+}
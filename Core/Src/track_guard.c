@@ -0,0 +1,182 @@
+/**
+ * @file track_guard.c
+ * @brief Track short circuit and overcurrent protection in interrupt context
+ *
+ * The watchdog interrupt does not read the conversion, the data register
+ * belongs to the DMA stream, so a short is logged with its threshold. Both trip
+ * paths write the log with interrupts masked for the copy, the watchdog
+ * interrupt may preempt the bucket interrupt.
+ */
+
+#include "track_guard.h"
+#include "analog_manager.h"
+#include "command_station.h"
+#include "parameter_manager.h"
+#include "rpc_server.h"
+#include "trace_log.h"
+#include "main.h"
+#include "stm32h5xx_ll_adc.h"
+#include <stdio.h>
+#include <string.h>
+
+#define GUARD_FULL_SCALE        0xFFFu      // 12-bit conversion
+
+static const char *const kSourceNames[TRACK_FAULT_COUNT] = { "short", "overcurrent" };
+
+static volatile bool g_tripped = false;
+static bool g_armed = false;
+static uint16_t g_shortMa = 0;
+static uint16_t g_limitMa = 0;
+static uint16_t g_shortRaw = 0;     // 0: short circuit trip off
+static uint16_t g_limitRaw = 0;     // 0: overcurrent trip off
+static uint32_t g_overRun = 0;      // consecutive buckets above the limit
+static volatile uint32_t g_trips = 0;
+static uint32_t g_reported = 0;     // RPC thread
+static TrackFault_t g_log[TRACK_GUARD_LOG];
+
+static uint16_t threshold_raw(uint32_t ma)
+{
+    uint32_t const raw = analog_ma_to_counts(ma);
+    // A saturated conversion still crosses a threshold beyond the range
+    return (uint16_t)(raw < GUARD_FULL_SCALE ? raw : GUARD_FULL_SCALE - 1u);
+}
+
+static inline void track_off(void)
+{
+    BR_ENABLE_GPIO_Port->BSRR = (uint32_t)BR_ENABLE_Pin << 16u;
+}
+
+// Interrupt context, the track is already off
+static void trip(TrackFaultSource_t source, uint16_t current_ma)
+{
+    uint32_t const primask = __get_PRIMASK();
+    __disable_irq();
+    bool const first = !g_tripped;
+    g_tripped = true;
+    uint32_t const number = g_trips + 1u;
+    g_trips = number;
+    TrackFault_t *const entry = &g_log[(number - 1u) % TRACK_GUARD_LOG];
+    entry->number = number;
+    entry->tick_ms = HAL_GetTick();
+    entry->packet_seq = CommandStation_GetPacketSeq();
+    entry->current_ma = current_ma;
+    entry->source = (uint8_t)source;
+    __set_PRIMASK(primask);
+
+    if (first) {
+        TRACE_ERROR("Track off: %s at %u mA\n", kSourceNames[source], current_ma);
+        RpcServer_Notify();
+    }
+}
+
+/**
+  * @brief This function handles the ADC2 interrupt, only the analog watchdog is enabled.
+  */
+void ADC2_IRQHandler(void)
+{
+    if (LL_ADC_IsActiveFlag_AWD1(ADC2) && LL_ADC_IsEnabledIT_AWD1(ADC2)) {
+        track_off();
+        // Stays off until the next start, a short keeps crossing the threshold
+        LL_ADC_DisableIT_AWD1(ADC2);
+        LL_ADC_ClearFlag_AWD1(ADC2);
+        trip(TRACK_FAULT_SHORT, g_shortMa);
+    }
+}
+
+// ADC DMA interrupt, every 1 ms bucket
+static void guard_bucket(uint32_t bucket, uint16_t voltage_raw, uint16_t current_raw)
+{
+    (void)bucket;
+    (void)voltage_raw;
+    if (g_limitRaw == 0u || g_tripped || current_raw <= g_limitRaw) {
+        g_overRun = 0;
+        return;
+    }
+    if (++g_overRun >= TRACK_GUARD_LIMIT_MS) {
+        track_off();
+        g_overRun = 0;
+        trip(TRACK_FAULT_OVERCURRENT, analog_counts_to_ma(current_raw));
+    }
+}
+
+void track_guard_configure(void)
+{
+    uint32_t short_ma = 0;
+    uint32_t limit_ma = 0;
+    parameter_get(PARAM_DCC_SHORT_CIRCUIT_THRESHOLD, &short_ma);
+    parameter_get(PARAM_DCC_TRACK_CURRENT_LIMIT, &limit_ma);
+
+    g_shortMa = (uint16_t)short_ma;
+    g_limitMa = (uint16_t)limit_ma;
+    g_shortRaw = short_ma ? threshold_raw(short_ma) : 0u;
+    g_limitRaw = limit_ma ? threshold_raw(limit_ma) : 0u;
+    g_overRun = 0;
+
+    // While tripped the watchdog interrupt stays off until the next start
+    g_armed = analog_manager_set_current_watchdog(g_shortRaw ? g_shortRaw : GUARD_FULL_SCALE,
+                                                  g_shortRaw != 0u && !g_tripped) == 0;
+}
+
+void track_guard_init(void)
+{
+    track_guard_configure();
+    if (!g_armed) {
+        printf("Track guard not armed, needs continuous analog sampling\n");
+        return;
+    }
+    analog_manager_set_bucket_hook(ANALOG_HOOK_GUARD, guard_bucket);
+    HAL_NVIC_SetPriority(ADC2_IRQn, TRACK_GUARD_IRQ_PRIORITY, 0);
+    HAL_NVIC_EnableIRQ(ADC2_IRQn);
+}
+
+void track_guard_clear(void)
+{
+    g_tripped = false;
+    track_guard_configure();
+}
+
+bool track_guard_tripped(void)
+{
+    return g_tripped;
+}
+
+bool track_guard_take_fault(TrackFault_t *fault)
+{
+    uint32_t const trips = g_trips;
+    if (g_reported == trips) {
+        return false;
+    }
+    // Trips overwritten in the log meanwhile are skipped
+    if (trips - g_reported > TRACK_GUARD_LOG) {
+        g_reported = trips - TRACK_GUARD_LOG;
+    }
+    uint32_t const primask = __get_PRIMASK();
+    __disable_irq();
+    *fault = g_log[g_reported % TRACK_GUARD_LOG];
+    __set_PRIMASK(primask);
+    g_reported++;
+    return true;
+}
+
+void track_guard_get_status(TrackGuardStatus_t *status)
+{
+    memset(status, 0, sizeof(*status));
+    status->armed = g_armed;
+    status->short_circuit_ma = g_shortMa;
+    status->current_limit_ma = g_limitMa;
+
+    uint32_t const primask = __get_PRIMASK();
+    __disable_irq();
+    status->tripped = g_tripped;
+    status->trips = g_trips;
+    status->fault_count = g_trips < TRACK_GUARD_LOG ? g_trips : TRACK_GUARD_LOG;
+    for (uint32_t i = 0; i < status->fault_count; i++) {
+        status->faults[i] = g_log[(g_trips - status->fault_count + i) % TRACK_GUARD_LOG];
+    }
+    __set_PRIMASK(primask);
+}
+
+const char *track_guard_source_name(TrackFaultSource_t source)
+{
+    return (uint32_t)source < TRACK_FAULT_COUNT ? kSourceNames[source] : "?";
+}
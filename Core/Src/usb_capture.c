@@ -0,0 +1,408 @@
+/**
+ * @file usb_capture.c
+ * @brief Binary capture stream on a second USB CDC ACM function
+ *
+ * Blocks circulate between two queues: the fill thread takes free blocks,
+ * keeps one open per source and posts it to the write thread when it is full
+ * or old enough, the write thread sends it and returns it. The sources are
+ * rings of their own, read by polling, so the fill thread is the only reader
+ * and a queued block never holds up sampling. Settings and the open blocks
+ * are protected by a mutex shared with the RPC thread, the write thread only
+ * touches the block it has taken. While capture is off the fill thread blocks
+ * until the next start.
+ */
+
+#include "usb_capture.h"
+#include "analog_manager.h"
+#include "cmsis_os2.h"
+#include "rtos_static.h"
+#include "sniffer.h"
+#include "timebase.h"
+#include "main.h"
+#include "ux_api.h"
+#include "ux_device_class_cdc_acm.h"
+#include <stdio.h>
+#include <string.h>
+
+_Static_assert(USB_CAPTURE_BLOCK_SIZE - USB_CAPTURE_HEADER_SIZE >= SNIFFER_MAX_RECORD, "a sniffer record fits a block");
+
+#define USB_CAPTURE_POLL_MS     10u
+#define USB_CAPTURE_EVENT_START (1u << 0)
+#define CURRENT_CHUNK           ANALOG_STREAM_BUCKET_SCANS  // samples are available per bucket
+
+typedef struct {
+    uint8_t data[USB_CAPTURE_BLOCK_SIZE];
+    uint32_t length;            // header included
+    uint32_t items;             // sniffer records
+    uint32_t first;             // first sample
+    uint32_t opened_ms;         // first data in
+    uint64_t opened_ns;         // timebase UTC of the first data
+    uint16_t flags;
+    uint8_t source;
+} CaptureBlock_t;
+
+static const char *const kSourceNames[USB_CAPTURE_SOURCE_COUNT] = { "current", "sniffer" };
+
+static CaptureBlock_t g_blocks[USB_CAPTURE_BLOCKS];
+static CaptureBlock_t *g_open[USB_CAPTURE_SOURCE_COUNT];
+static bool g_gap[USB_CAPTURE_SOURCE_COUNT];
+
+static osMutexId_t g_lock = NULL;
+static osMessageQueueId_t g_free = NULL;
+static osMessageQueueId_t g_full = NULL;
+static osThreadId_t usbCaptureTaskHandle = NULL;
+static osThreadId_t usbCaptureTxTaskHandle = NULL;
+static osEventFlagsId_t g_events = NULL;
+RTOS_MUTEX(usbCaptureLock);
+RTOS_EVENT_FLAGS(usbCaptureEvents);
+RTOS_MESSAGE_QUEUE(usbCaptureFree, USB_CAPTURE_BLOCKS, sizeof(CaptureBlock_t *));
+RTOS_MESSAGE_QUEUE(usbCaptureFull, USB_CAPTURE_BLOCKS, sizeof(CaptureBlock_t *));
+
+static UX_SLAVE_CLASS_CDC_ACM *volatile g_cdc = NULL;
+static bool g_enabled = false;
+static uint8_t g_sources = 0;
+static uint32_t g_nextSample = 0;       // next current sample to take
+static uint32_t g_snifferDropped = 0;   // sniffer drops already flagged
+
+static uint32_t g_seq = 0;
+static volatile uint32_t g_sent = 0;    // write thread
+static volatile uint32_t g_bytes = 0;
+static volatile uint32_t g_discarded = 0;
+static volatile uint32_t g_txErrors = 0;
+static uint32_t g_gaps = 0;
+static uint32_t g_lostSamples = 0;
+
+RTOS_THREAD_MEMORY(usbCaptureTask, 512 * 4);
+static const osThreadAttr_t usbCaptureTask_attributes = {
+    .name = "usbCaptureTask",
+    .priority = (osPriority_t) osPriorityBelowNormal,
+    RTOS_THREAD_ATTR_MEMORY(usbCaptureTask)
+};
+
+RTOS_THREAD_MEMORY(usbCaptureTxTask, 512 * 4);
+static const osThreadAttr_t usbCaptureTxTask_attributes = {
+    .name = "usbCaptureTxTask",
+    .priority = (osPriority_t) osPriorityBelowNormal,
+    RTOS_THREAD_ATTR_MEMORY(usbCaptureTxTask)
+};
+
+static void put16(uint8_t *p, uint16_t value)
+{
+    p[0] = (uint8_t)value;
+    p[1] = (uint8_t)(value >> 8);
+}
+
+static void put32(uint8_t *p, uint32_t value)
+{
+    put16(p, (uint16_t)value);
+    put16(p + 2, (uint16_t)(value >> 16));
+}
+
+static void put64(uint8_t *p, uint64_t value)
+{
+    put32(p, (uint32_t)value);
+    put32(p + 4, (uint32_t)(value >> 32));
+}
+
+static bool host_listening(void)
+{
+    UX_SLAVE_CLASS_CDC_ACM *const cdc = g_cdc;
+    return cdc != NULL && cdc->ux_slave_class_cdc_acm_data_dtr_state != 0u;
+}
+
+// Called with g_lock held, NULL while all blocks are queued or on the bus
+static CaptureBlock_t *block_open(UsbCaptureSource_t source)
+{
+    CaptureBlock_t *block = g_open[source];
+    if (block != NULL) {
+        return block;
+    }
+    if (osMessageQueueGet(g_free, &block, NULL, 0u) != osOK) {
+        return NULL;
+    }
+    block->length = USB_CAPTURE_HEADER_SIZE;
+    block->items = 0;
+    block->first = g_nextSample;
+    block->source = (uint8_t)source;
+    block->flags = g_gap[source] ? USB_CAPTURE_FLAG_GAP : 0u;
+    g_gap[source] = false;
+    g_open[source] = block;
+    return block;
+}
+
+// Called with g_lock held
+static void block_send(UsbCaptureSource_t source)
+{
+    CaptureBlock_t *const block = g_open[source];
+    uint8_t *const header = block->data;
+
+    g_open[source] = NULL;
+    put16(&header[0], USB_CAPTURE_MAGIC);
+    header[2] = USB_CAPTURE_VERSION;
+    header[3] = block->source;
+    put16(&header[4], (uint16_t)block->length);
+    put16(&header[6], block->flags);
+    put32(&header[8], g_seq++);
+    put32(&header[12], source == USB_CAPTURE_SOURCE_CURRENT ? block->first : block->items);
+    put64(&header[16], block->opened_ns);
+    if (block->flags & USB_CAPTURE_FLAG_GAP) {
+        g_gaps++;
+    }
+    osMessageQueuePut(g_full, &block, 0u, 0u);
+}
+
+// Called with g_lock held
+static void block_drop(UsbCaptureSource_t source)
+{
+    CaptureBlock_t *const block = g_open[source];
+    if (block != NULL) {
+        g_open[source] = NULL;
+        osMessageQueuePut(g_free, &block, 0u, 0u);
+    }
+}
+
+// Called with g_lock held, whole buckets of samples as they become available
+static void fill_current(void)
+{
+    uint32_t const now = analog_manager_current_sample();
+    if (now - g_nextSample > ANALOG_RAW_HISTORY - 2u * CURRENT_CHUNK) {
+        // Fell behind the history, the samples in the open block stay contiguous
+        if (g_open[USB_CAPTURE_SOURCE_CURRENT] != NULL) {
+            block_send(USB_CAPTURE_SOURCE_CURRENT);
+        }
+        uint32_t const resume = now - now % CURRENT_CHUNK - CURRENT_CHUNK;
+        g_lostSamples += resume - g_nextSample;
+        g_nextSample = resume;
+        g_gap[USB_CAPTURE_SOURCE_CURRENT] = true;
+    }
+
+    for (;;) {
+        CaptureBlock_t *const block = block_open(USB_CAPTURE_SOURCE_CURRENT);
+        if (block == NULL) {
+            return;
+        }
+        uint16_t *const out = (uint16_t *)&block->data[block->length];
+        if (analog_manager_read_current_samples(g_nextSample, out, CURRENT_CHUNK) == 0u) {
+            return;
+        }
+        if (block->length == USB_CAPTURE_HEADER_SIZE) {
+            block->opened_ms = HAL_GetTick();
+            block->opened_ns = timebase_now_ns();
+        }
+        block->length += CURRENT_CHUNK * sizeof(uint16_t);
+        g_nextSample += CURRENT_CHUNK;
+        if (USB_CAPTURE_BLOCK_SIZE - block->length < CURRENT_CHUNK * sizeof(uint16_t)) {
+            block_send(USB_CAPTURE_SOURCE_CURRENT);
+        }
+    }
+}
+
+// Called with g_lock held
+static void fill_sniffer(void)
+{
+    SnifferStats_t stats;
+    sniffer_get_stats(&stats);
+    if (stats.used == 0u) {
+        return;
+    }
+    if (stats.dropped != g_snifferDropped) {
+        g_snifferDropped = stats.dropped;
+        g_gap[USB_CAPTURE_SOURCE_SNIFFER] = true;
+    }
+
+    for (;;) {
+        CaptureBlock_t *const block = block_open(USB_CAPTURE_SOURCE_SNIFFER);
+        if (block == NULL) {
+            return;
+        }
+        uint32_t records = 0;
+        uint32_t const n = sniffer_read(&block->data[block->length], USB_CAPTURE_BLOCK_SIZE - block->length,
+                                        0u, &records);
+        if (n == 0u) {
+            return;
+        }
+        if (block->items == 0u) {
+            block->opened_ms = HAL_GetTick();
+            block->opened_ns = timebase_now_ns();
+        }
+        block->length += n;
+        block->items += records;
+        if (USB_CAPTURE_BLOCK_SIZE - block->length < SNIFFER_MAX_RECORD) {
+            block_send(USB_CAPTURE_SOURCE_SNIFFER);
+        }
+    }
+}
+
+static void UsbCaptureTask(void *argument)
+{
+    (void)argument;
+
+    for (;;) {
+        if (!g_enabled) {
+            osEventFlagsWait(g_events, USB_CAPTURE_EVENT_START, osFlagsWaitAny, osWaitForever);
+        }
+        osDelay(USB_CAPTURE_POLL_MS);
+        osMutexAcquire(g_lock, osWaitForever);
+        if (g_enabled && !host_listening()) {
+            // Nobody reads: the sniffer keeps its records, the current goes on from now
+            for (uint32_t i = 0; i < USB_CAPTURE_SOURCE_COUNT; i++) {
+                block_drop((UsbCaptureSource_t)i);
+            }
+            uint32_t const now = analog_manager_current_sample();
+            g_nextSample = now - now % CURRENT_CHUNK;
+        }
+        else if (g_enabled) {
+            if (g_sources & (1u << USB_CAPTURE_SOURCE_CURRENT)) {
+                fill_current();
+            }
+            if (g_sources & (1u << USB_CAPTURE_SOURCE_SNIFFER)) {
+                fill_sniffer();
+            }
+            for (uint32_t i = 0; i < USB_CAPTURE_SOURCE_COUNT; i++) {
+                CaptureBlock_t *const block = g_open[i];
+                if (block != NULL && block->length > USB_CAPTURE_HEADER_SIZE &&
+                    HAL_GetTick() - block->opened_ms >= USB_CAPTURE_FLUSH_MS) {
+                    block_send((UsbCaptureSource_t)i);
+                }
+            }
+        }
+        osMutexRelease(g_lock);
+    }
+}
+
+static void UsbCaptureTxTask(void *argument)
+{
+    (void)argument;
+
+    for (;;) {
+        CaptureBlock_t *block = NULL;
+        if (osMessageQueueGet(g_full, &block, NULL, osWaitForever) != osOK) {
+            continue;
+        }
+        UX_SLAVE_CLASS_CDC_ACM *const cdc = g_cdc;
+        if (cdc == NULL || cdc->ux_slave_class_cdc_acm_data_dtr_state == 0u) {
+            g_discarded = g_discarded + 1u;
+        }
+        else {
+            // Blocks until the host has read it, split into USB transfers by the class
+            ULONG written = 0;
+            if (ux_device_class_cdc_acm_write(cdc, block->data, block->length, &written) != UX_SUCCESS ||
+                written != block->length) {
+                g_txErrors = g_txErrors + 1u;
+            }
+            else {
+                g_sent = g_sent + 1u;
+                g_bytes = g_bytes + block->length;
+            }
+        }
+        osMessageQueuePut(g_free, &block, 0u, 0u);
+    }
+}
+
+void usb_capture_init(void)
+{
+    if (usbCaptureTaskHandle != NULL) {
+        return;
+    }
+    g_lock = osMutexNew(&usbCaptureLock_attr);
+    g_free = osMessageQueueNew(USB_CAPTURE_BLOCKS, sizeof(CaptureBlock_t *), &usbCaptureFree_attr);
+    g_full = osMessageQueueNew(USB_CAPTURE_BLOCKS, sizeof(CaptureBlock_t *), &usbCaptureFull_attr);
+    g_events = osEventFlagsNew(&usbCaptureEvents_attr);
+    if (g_lock == NULL || g_free == NULL || g_full == NULL || g_events == NULL) {
+        printf("Failed to create USB capture queues\n");
+        return;
+    }
+    for (uint32_t i = 0; i < USB_CAPTURE_BLOCKS; i++) {
+        CaptureBlock_t *block = &g_blocks[i];
+        osMessageQueuePut(g_free, &block, 0u, 0u);
+    }
+    usbCaptureTaskHandle = osThreadNew(UsbCaptureTask, NULL, &usbCaptureTask_attributes);
+    usbCaptureTxTaskHandle = osThreadNew(UsbCaptureTxTask, NULL, &usbCaptureTxTask_attributes);
+    if (usbCaptureTaskHandle == NULL || usbCaptureTxTaskHandle == NULL) {
+        printf("Failed to create USB capture threads\n");
+    }
+}
+
+// Called with g_lock held
+static void usb_capture_halt(void)
+{
+    g_enabled = false;
+    for (uint32_t i = 0; i < USB_CAPTURE_SOURCE_COUNT; i++) {
+        block_drop((UsbCaptureSource_t)i);
+    }
+}
+
+int usb_capture_start(uint32_t sources)
+{
+    sources &= (1u << USB_CAPTURE_SOURCE_COUNT) - 1u;
+    if (g_lock == NULL || sources == 0u ||
+        ((sources & (1u << USB_CAPTURE_SOURCE_CURRENT)) && !analog_manager_is_streaming())) {
+        return -1;
+    }
+
+    osMutexAcquire(g_lock, osWaitForever);
+    usb_capture_halt();
+    SnifferStats_t stats;
+    sniffer_get_stats(&stats);
+    uint32_t const now = analog_manager_current_sample();
+    g_nextSample = now - now % CURRENT_CHUNK;
+    g_snifferDropped = stats.dropped;
+    g_gap[USB_CAPTURE_SOURCE_CURRENT] = false;
+    g_gap[USB_CAPTURE_SOURCE_SNIFFER] = false;
+    g_sources = (uint8_t)sources;
+    g_seq = 0;
+    g_sent = 0;
+    g_bytes = 0;
+    g_discarded = 0;
+    g_txErrors = 0;
+    g_gaps = 0;
+    g_lostSamples = 0;
+    g_enabled = true;
+    osMutexRelease(g_lock);
+    osEventFlagsSet(g_events, USB_CAPTURE_EVENT_START);
+    return 0;
+}
+
+void usb_capture_stop(void)
+{
+    if (g_lock == NULL) {
+        return;
+    }
+    osMutexAcquire(g_lock, osWaitForever);
+    usb_capture_halt();
+    osMutexRelease(g_lock);
+}
+
+void usb_capture_get_stats(UsbCaptureStats_t *stats)
+{
+    if (stats == NULL) {
+        return;
+    }
+    stats->enabled = g_enabled;
+    stats->listening = host_listening();
+    stats->sources = g_sources;
+    stats->blocks = g_sent;
+    stats->bytes = g_bytes;
+    stats->gaps = g_gaps;
+    stats->lost_samples = g_lostSamples;
+    stats->discarded = g_discarded;
+    stats->tx_errors = g_txErrors;
+    stats->free_blocks = g_free != NULL ? osMessageQueueGetCount(g_free) : 0u;
+}
+
+const char *usb_capture_source_name(UsbCaptureSource_t source)
+{
+    return (uint32_t)source < USB_CAPTURE_SOURCE_COUNT ? kSourceNames[source] : "?";
+}
+
+void usb_capture_activate(void *cdc_acm_instance)
+{
+    g_cdc = (UX_SLAVE_CLASS_CDC_ACM *)cdc_acm_instance;
+}
+
+void usb_capture_deactivate(void *cdc_acm_instance)
+{
+    (void)cdc_acm_instance;
+    // A write in progress returns with an error when the stack aborts it
+    g_cdc = NULL;
+}
@@ -24,6 +24,9 @@
 /* Private includes ----------------------------------------------------------*/
 /* USER CODE BEGIN Includes */
 #include <stdio.h>
+#include "packet_suite.h"
+#include "packet_vm.h"
+#include "recorder.h"
 /* USER CODE END Includes */
 
 /* Private typedef -----------------------------------------------------------*/
@@ -66,7 +69,7 @@ FX_MEDIA    sdio_disk;
 FX_FILE     fx_file;
 /* Define ThreadX global data structures. */
 TX_QUEUE    tx_msg_queue;
-static UINT     media_status;
+static UINT     media_status = MEDIA_CLOSED;
 
 /* USER CODE END PV */
 
@@ -120,6 +123,13 @@ UINT MX_FileX_Init(VOID *memory_ptr)
 
 /* USER CODE BEGIN MX_FileX_Init */
 
+  /* The queue needs memory of its own, pointer is the thread stack */
+  ret = tx_byte_allocate(byte_pool, &pointer, DEFAULT_QUEUE_LENGTH * sizeof(ULONG), TX_NO_WAIT);
+  if (ret != TX_SUCCESS)
+  {
+    return TX_POOL_ERROR;
+  }
+
   /* Create the message queue */
   ret = tx_queue_create(&tx_msg_queue, "sd_event_queue", TX_1_ULONG, pointer, DEFAULT_QUEUE_LENGTH * sizeof(ULONG));
   /* Check main thread creation */
@@ -133,7 +143,9 @@ UINT MX_FileX_Init(VOID *memory_ptr)
   fx_system_initialize();
 
 /* USER CODE BEGIN MX_FileX_Init 1*/
-
+  recorder_init();
+  PacketSuite_Init();
+  PacketVm_Init();
 /* USER CODE END MX_FileX_Init 1*/
 
   return ret;
@@ -153,9 +165,6 @@ UINT MX_FileX_Init(VOID *memory_ptr)
   ULONG r_msg;
   ULONG s_msg = CARD_STATUS_CHANGED;
   ULONG last_status = CARD_STATUS_DISCONNECTED;
-  ULONG bytes_read;
-  CHAR read_buffer[32];
-  CHAR data[] = "This is FileX working on STM32";
   UINT sd_status = FX_SUCCESS;
 
   fx_media_close_notify_set(&sdio_disk, media_close_callback);
@@ -201,17 +210,30 @@ UINT MX_FileX_Init(VOID *memory_ptr)
 
         /* Check the media open sd_status */
         sd_status = fx_media_open(&sdio_disk, FX_SD_VOLUME_NAME, fx_stm32_sd_driver, (VOID *)FX_NULL, (VOID *) fx_sd_media_memory, sizeof(fx_sd_media_memory));
+        /* Update last known sd_status */
+        last_status = CARD_STATUS_CONNECTED;
         if (sd_status != FX_SUCCESS)
         {
-          Error_Handler();
+          /* An unformatted card must not stop the tester, wait for it to be replaced */
+          printf("SD CARD could not be mounted (%u)\r\n", sd_status);
+          continue;
         }
         media_status = MEDIA_OPENED;
-        /* Update last known sd_status */
-        last_status = CARD_STATUS_CONNECTED;
+        recorder_set_media(&sdio_disk);
+        PacketSuite_SetMedia(&sdio_disk);
+        PacketVm_SetMedia(&sdio_disk);
         printf("SD CARD inserted!!\r\n");
       }
       else
       {
+        /* Ends a recording before the driver goes away */
+        recorder_set_media(NULL);
+        PacketSuite_SetMedia(NULL);
+        PacketVm_SetMedia(NULL);
+        if (media_status == MEDIA_OPENED)
+        {
+          fx_media_close(&sdio_disk);
+        }
         HAL_SD_DeInit(&hsd1);
         /* Update last known sd_status */
         last_status = CARD_STATUS_DISCONNECTED;
@@ -223,135 +245,7 @@ UINT MX_FileX_Init(VOID *memory_ptr)
       continue;
     }
 
-    /* Create a file called STM32.TXT in the root directory. */
-    if (media_status == MEDIA_CLOSED)
-    {
-      sd_status = fx_media_open(&sdio_disk, FX_SD_VOLUME_NAME, fx_stm32_sd_driver, (VOID *)FX_NULL, (VOID *) fx_sd_media_memory, sizeof(fx_sd_media_memory));
-      /* Check the media open sd_status */
-      if (sd_status != FX_SUCCESS)
-      {
-        /* USER CODE BEGIN SD DRIVER get info error */
-        Error_Handler();
-        /* USER CODE END SD DRIVER get info error */
-      }
-      media_status = MEDIA_OPENED;
-    }
-
-    sd_status =  fx_file_create(&sdio_disk, "STM32.TXT");
-
-    /* Check the create sd_status. */
-    if (sd_status != FX_SUCCESS)
-    {
-      /* Check for an already created sd_status. This is expected on the
-      second pass of this loop! */
-      if (sd_status != FX_ALREADY_CREATED)
-      {
-        /* Create error, call error handler.  */
-        Error_Handler();
-      }
-    }
-
-    /* Open the test file. */
-    sd_status =  fx_file_open(&sdio_disk, &fx_file, "STM32.TXT", FX_OPEN_FOR_WRITE);
-
-    /* Check the file open sd_status. */
-    if (sd_status != FX_SUCCESS)
-    {
-      /* Error opening file, call error handler. */
-      Error_Handler();
-    }
-
-    /* Seek to the beginning of the test file. */
-    sd_status =  fx_file_seek(&fx_file, 0);
-
-    /* Check the file seek sd_status. */
-    if (sd_status != FX_SUCCESS)
-    {
-      /* Error performing file seek, call error handler. */
-      Error_Handler();
-    }
-
-    /* Write a string to the test file. */
-    sd_status =  fx_file_write(&fx_file, data, sizeof(data));
-
-    /* Check the file write sd_status. */
-    if (sd_status != FX_SUCCESS)
-    {
-      /* Error writing to a file, call error handler. */
-      Error_Handler();
-    }
-
-    /* Close the test file. */
-    sd_status =  fx_file_close(&fx_file);
-
-    /* Check the file close sd_status. */
-    if (sd_status != FX_SUCCESS)
-    {
-      /* Error closing the file, call error handler. */
-      Error_Handler();
-    }
-
-    sd_status = fx_media_flush(&sdio_disk);
-
-    /* Check the media flush  sd_status. */
-    if (sd_status != FX_SUCCESS)
-    {
-      /* Error closing the file, call error handler. */
-      Error_Handler();
-    }
-
-    /* Open the test file.  */
-    sd_status =  fx_file_open(&sdio_disk, &fx_file, "STM32.TXT", FX_OPEN_FOR_READ);
-
-    /* Check the file open sd_status. */
-    if (sd_status != FX_SUCCESS)
-    {
-      /* Error opening file, call error handler. */
-      Error_Handler();
-    }
-
-    /* Seek to the beginning of the test file. */
-    sd_status =  fx_file_seek(&fx_file, 0);
-
-    /* Check the file seek sd_status. */
-    if (sd_status != FX_SUCCESS)
-    {
-      /* Error performing file seek, call error handler. */
-      Error_Handler();
-    }
-
-    /* Read the first 28 bytes of the test file. */
-    sd_status =  fx_file_read(&fx_file, read_buffer, sizeof(data), &bytes_read);
-
-    /* Check the file read sd_status. */
-    if ((sd_status != FX_SUCCESS) || (bytes_read != sizeof(data)))
-    {
-      /* Error reading file, call error handler. */
-      Error_Handler();
-    }
-
-    /* Close the test file. */
-    sd_status =  fx_file_close(&fx_file);
-
-    /* Check the file close sd_status.  */
-    if (sd_status != FX_SUCCESS)
-    {
-      /* Error closing the file, call error handler. */
-      Error_Handler();
-    }
-
-    /* Close the media. */
-    sd_status =  fx_media_close(&sdio_disk);
-
-    /* Check the media close sd_status. */
-    if (sd_status != FX_SUCCESS)
-    {
-      /* Error closing the media, call error handler. */
-      Error_Handler();
-    }
-
-    printf("FileX SD card example completed successfully!\r\n");
-    printf("Read data: %s\r\n", read_buffer);
+    /* The media stays open for the recorder until the card is removed */
 
   }
 
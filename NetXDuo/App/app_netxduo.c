@@ -28,6 +28,9 @@
 #include "nx_stm32_eth_config.h"
 #include "stm32h5xx_nucleo.h"
 #include "stm32h5xx_hal_rtc.h"
+#include "netx_rpc_transport.h"
+#include "telemetry.h"
+#include "timebase.h"
 #include <time.h>
 /* USER CODE END Includes */
 
@@ -265,6 +268,10 @@ UINT MX_NetXDuo_Init(VOID *memory_ptr)
   {
     return NX_NOT_ENABLED;
   }
+
+  /* RPC server on TCP/UDP (its threads wait for the DHCP address) and telemetry */
+  NetxRpc_Init();
+  telemetry_init();
   /* USER CODE END MX_NetXDuo_Init */
 
   return ret;
@@ -489,19 +496,8 @@ static void App_SNTP_Thread_Entry(ULONG info)
   /* Set Current time from SNTP TO RTC */
   rtc_time_update(&SntpClient);
 
-  /* We can stop the SNTP service if for example we think the SNTP server has stopped sending updates */
-  ret = nx_sntp_client_stop(&SntpClient);
-  if (ret != NX_SUCCESS)
-  {
-    Error_Handler();
-  }
-
-  /* When done with the SNTP Client, we delete it */
-  ret = nx_sntp_client_delete(&SntpClient);
-  if (ret != NX_SUCCESS)
-  {
-    Error_Handler();
-  }
+  /* The client keeps running: every poll disciplines the capture timebase
+     (time_update_callback), the RTC was set once above */
 
   display_rtc_time();
 
@@ -576,9 +572,12 @@ static UINT kiss_of_death_handler(NX_SNTP_CLIENT *client_ptr, UINT KOD_code)
 /* This application defined handler for notifying SNTP time update event.  */
 static VOID time_update_callback(NX_SNTP_TIME_MESSAGE *time_update_ptr, NX_SNTP_TIME *local_time)
 {
-  NX_PARAMETER_NOT_USED(time_update_ptr);
+  /* Stamp first: the server transmit time is taken as the time the reply arrived */
+  uint64_t const cycles = timebase_cycles();
   NX_PARAMETER_NOT_USED(local_time);
 
+  timebase_sntp_sample(time_update_ptr->transmit_time.seconds, time_update_ptr->transmit_time.fraction, cycles);
+
   tx_event_flags_set(&SntpFlags, SNTP_UPDATE_EVENT, TX_OR);
 }
 
@@ -120,7 +120,7 @@ UINT MX_NetXDuo_Init(VOID *memory_ptr);
 
 #define NX_APP_DEFAULT_TIMEOUT               (10 * NX_IP_PERIODIC_RATE)
 
-#define NX_APP_PACKET_POOL_SIZE              ((DEFAULT_PAYLOAD_SIZE + sizeof(NX_PACKET)) * 5)
+#define NX_APP_PACKET_POOL_SIZE              ((DEFAULT_PAYLOAD_SIZE + sizeof(NX_PACKET)) * 12)
 
 #define NX_APP_THREAD_STACK_SIZE             2 * 1024
 
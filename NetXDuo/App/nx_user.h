@@ -2153,9 +2153,7 @@
 
 /* The starting poll interval (seconds) on which the Client sends a unicast
    request to its SNTP server. The NetX Duo SNTP Client default is 3600. */
-/*
-#define NX_SNTP_CLIENT_UNICAST_POLL_INTERVAL    3600
-*/
+#define NX_SNTP_CLIENT_UNICAST_POLL_INTERVAL    256  /* disciplines the capture timebase */
 
 /* The factor by which the current Client unicast poll interval is increased.
    When the Client fails to receive a server time update, or receiving
@@ -9,59 +9,10 @@ DCC speed command packets using the DCC_tester command station.
 Test: Send 3 half-speed reverse packets with 100ms delay between them
 """
 
-import json
 import serial
 import time
 import sys
-
-
-class DCCTesterRPC:
-    """RPC client for DCC_tester command station."""
-    
-    def __init__(self, port, baudrate=115200, timeout=2):
-        """
-        Initialize RPC client.
-        
-        Args:
-            port: Serial port (e.g., 'COM3' on Windows or '/dev/ttyACM0' on Linux)
-            baudrate: Serial baud rate (default: 115200)
-            timeout: Serial timeout in seconds (default: 2)
-        """
-        self.ser = serial.Serial(port, baudrate, timeout=timeout)
-        time.sleep(0.5)  # Allow time for connection to establish
-        
-    def send_rpc(self, method, params):
-        """
-        Send an RPC request and return the response.
-        
-        Args:
-            method: RPC method name
-            params: Dictionary of parameters
-            
-        Returns:
-            Response dictionary
-        """
-        request = {
-            "method": method,
-            "params": params
-        }
-        
-        request_json = json.dumps(request) + '\r\n'
-        print(f"→ {request_json.strip()}")
-        
-        self.ser.write(request_json.encode('utf-8'))
-        
-        # Read response
-        response_line = self.ser.readline().decode('utf-8').strip()
-        print(f"← {response_line}")
-        
-        if response_line:
-            return json.loads(response_line)
-        return None
-    
-    def close(self):
-        """Close serial connection."""
-        self.ser.close()
+from RpcClient import DCCTesterRPC
 
 
 def calculate_dcc_checksum(bytes_list):
@@ -15,68 +15,13 @@ Hardware connections:
 - IO14: Output that mirrors IO13 when button is pressed
 """
 
-import json
+import os
 import serial
-import time
 import sys
+import time
 
-
-class DCCTesterRPC:
-    """RPC client for DCC_tester command station."""
-    
-    def __init__(self, port, baudrate=115200, timeout=2):
-        """
-        Initialize RPC client.
-        
-        Args:
-            port: Serial port (e.g., 'COM3' on Windows or '/dev/ttyACM0' on Linux)
-            baudrate: Serial baud rate (default: 115200)
-            timeout: Serial timeout in seconds (default: 2)
-        """
-        self.ser = serial.Serial(port, baudrate, timeout=timeout)
-        time.sleep(0.5)  # Allow time for connection to establish
-        # Flush any initial output
-        self.ser.reset_input_buffer()
-        
-    def send_rpc(self, method, params, verbose=True):
-        """
-        Send an RPC request and return the response.
-        
-        Args:
-            method: RPC method name
-            params: Dictionary of parameters
-            verbose: Print request/response (default: True)
-            
-        Returns:
-            Response dictionary or None on error
-        """
-        request = {
-            "method": method,
-            "params": params
-        }
-        
-        request_json = json.dumps(request) + '\r\n'
-        if verbose:
-            print(f"→ {request_json.strip()}")
-        
-        self.ser.write(request_json.encode('utf-8'))
-        
-        # Read response
-        response_line = self.ser.readline().decode('utf-8').strip()
-        if verbose:
-            print(f"← {response_line}")
-        
-        if response_line:
-            try:
-                return json.loads(response_line)
-            except json.JSONDecodeError:
-                print(f"Error: Invalid JSON response: {response_line}")
-                return None
-        return None
-    
-    def close(self):
-        """Close serial connection."""
-        self.ser.close()
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), ".."))
+from RpcClient import DCCTesterRPC
 
 
 def main():
@@ -123,7 +68,7 @@ def main():
         
         while True:
             # Read button state (IO16)
-            response = rpc.send_rpc("get_gpio_input", {"pin": 16}, verbose=False)
+            response = rpc.send_rpc("get_gpio_input", {"pin": 16}, quiet=True)
             
             if response is None or response.get("status") != "ok":
                 print(f"WARNING: Failed to read button state: {response}")
@@ -137,7 +82,7 @@ def main():
                 print("→ Button PRESSED!")
                 
                 # Read IO13 input state
-                response = rpc.send_rpc("get_gpio_input", {"pin": 13}, verbose=True)
+                response = rpc.send_rpc("get_gpio_input", {"pin": 13})
                 
                 if response is None or response.get("status") != "ok":
                     print(f"ERROR: Failed to read IO13: {response}")
@@ -146,7 +91,7 @@ def main():
                     print(f"  IO13 state: {io13_state}")
                     
                     # Set IO14 to match IO13
-                    response = rpc.send_rpc("set_gpio_output", {"pin": 14, "state": io13_state}, verbose=True)
+                    response = rpc.send_rpc("set_gpio_output", {"pin": 14, "state": io13_state})
                     
                     if response is None or response.get("status") != "ok":
                         print(f"ERROR: Failed to set IO14: {response}")
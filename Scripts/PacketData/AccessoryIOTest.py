@@ -6,11 +6,15 @@ AccessoryIOTest Script
 This script tests inter-packet delay timing for accessory IO control.
 """
 
-import json
+import os
 import serial
+import sys
 import time
 from datetime import datetime
 
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), ".."))
+import RpcClient
+
 
 LOG_LEVEL = 1  # 0 = none, 1 = minimum, 2 = verbose
 
@@ -34,53 +38,11 @@ def log(level, message):
             print(message)
 
 
-class DCCTesterRPC:
-    """RPC client for DCC_tester command station."""
+class DCCTesterRPC(RpcClient.DCCTesterRPC):
+    """RPC client for DCC_tester command station, traced at log level 2."""
 
     def __init__(self, port, baudrate=115200, timeout=2):
-        """
-        Initialize RPC client.
-
-        Args:
-            port: Serial port (e.g., 'COM3' on Windows or '/dev/ttyACM0' on Linux)
-            baudrate: Serial baud rate (default: 115200)
-            timeout: Serial timeout in seconds (default: 2)
-        """
-        self.ser = serial.Serial(port, baudrate, timeout=timeout)
-        time.sleep(0.5)  # Allow time for connection to establish
-
-    def send_rpc(self, method, params):
-        """
-        Send an RPC request and return the response.
-
-        Args:
-            method: RPC method name
-            params: Dictionary of parameters
-
-        Returns:
-            Response dictionary
-        """
-        request = {
-            "method": method,
-            "params": params
-        }
-
-        request_json = json.dumps(request) + '\r\n'
-        log(2, f"→ {request_json.strip()}")
-
-        self.ser.write(request_json.encode('utf-8'))
-
-        # Read response
-        response_line = self.ser.readline().decode('utf-8').strip()
-        log(2, f"← {response_line}")
-
-        if response_line:
-            return json.loads(response_line)
-        return None
-
-    def close(self):
-        """Close serial connection."""
-        self.ser.close()
+        super().__init__(port, baudrate, timeout, trace=lambda line: log(2, line))
 
 
 def calculate_dcc_checksum(bytes_list):
@@ -8,11 +8,15 @@ voltage feedback (IO13/IO14). Uses the in_circuit_motor flag to select
 measurement mode.
 """
 
-import json
+import os
 import serial
+import sys
 import time
 from datetime import datetime
 
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), ".."))
+import RpcClient
+
 
 LOG_LEVEL = 1  # 0 = none, 1 = minimum, 2 = verbose
 
@@ -36,52 +40,11 @@ def log(level, message):
             print(message)
 
 
-class DCCTesterRPC:
-    """RPC client for DCC_tester command station."""
+class DCCTesterRPC(RpcClient.DCCTesterRPC):
+    """RPC client for DCC_tester command station, traced at log level 2."""
 
     def __init__(self, port, baudrate=115200, timeout=2):
-        """
-        Initialize RPC client.
-
-        Args:
-            port: Serial port (e.g., 'COM3' on Windows or '/dev/ttyACM0' on Linux)
-            baudrate: Serial baud rate (default: 115200)
-            timeout: Serial timeout in seconds (default: 2)
-        """
-        self.ser = serial.Serial(port, baudrate, timeout=timeout)
-        time.sleep(0.5)  # Allow time for connection to establish
-
-    def send_rpc(self, method, params):
-        """
-        Send an RPC request and return the response.
-
-        Args:
-            method: RPC method name
-            params: Dictionary of parameters
-
-        Returns:
-            Response dictionary
-        """
-        request = {
-            "method": method,
-            "params": params
-        }
-
-        request_json = json.dumps(request) + "\r\n"
-        log(2, f"→ {request_json.strip()}")
-
-        self.ser.write(request_json.encode("utf-8"))
-
-        response_line = self.ser.readline().decode("utf-8").strip()
-        log(2, f"← {response_line}")
-
-        if response_line:
-            return json.loads(response_line)
-        return None
-
-    def close(self):
-        """Close serial connection."""
-        self.ser.close()
+        super().__init__(port, baudrate, timeout, trace=lambda line: log(2, line))
 
 
 def calculate_dcc_checksum(bytes_list):
@@ -249,14 +212,18 @@ def run_packet_acceptance_test(
         start_packet = make_speed_packet(loco_address, HALF_SPEED, forward=False)
 
         log(1, "Step 4: Loading and transmitting motor start packet...")
-        response = rpc.send_rpc("command_station_load_packet", {"bytes": start_packet, "replace": True})
+        # Load and transmit in one round trip, the transmit is skipped if the load fails
+        response, transmit_response = rpc.send_batch([
+            ("command_station_load_packet", {"bytes": start_packet, "replace": True}),
+            ("command_station_transmit_packet", {"delay_ms": 0}),
+        ])
 
         if response is None or response.get("status") != "ok":
             log(1, f"ERROR: Failed to load packet: {response}")
             rpc.close()
             return {"status": "FAIL", "error": "Failed to load packet"}
 
-        response = rpc.send_rpc("command_station_transmit_packet", {"delay_ms": 0})
+        response = transmit_response
 
         if response is None or response.get("status") != "ok":
             log(1, f"ERROR: Failed to transmit packet: {response}")
@@ -287,13 +254,17 @@ def run_packet_acceptance_test(
         log(1, f"Step 7: Sending emergency stop packet to address {loco_address}...")
         estop_packet = make_emergency_stop_packet(loco_address)
 
-        response = rpc.send_rpc("command_station_load_packet", {"bytes": estop_packet, "replace": True})
+        # Load and transmit in one round trip, the transmit is skipped if the load fails
+        response, transmit_response = rpc.send_batch([
+            ("command_station_load_packet", {"bytes": estop_packet, "replace": True}),
+            ("command_station_transmit_packet", {"delay_ms": 0}),
+        ])
         if response is None or response.get("status") != "ok":
             log(1, f"ERROR: Failed to load emergency stop packet: {response}")
             rpc.close()
             return {"status": "FAIL", "error": "Failed to load emergency stop packet"}
         log(2, "✓ Emergency stop packet loaded\n")
-        response = rpc.send_rpc("command_station_transmit_packet", {"delay_ms": 0})
+        response = transmit_response
         if response is None or response.get("status") != "ok":
             log(1, f"ERROR: Failed to transmit emergency stop packet: {response}")
             rpc.close()
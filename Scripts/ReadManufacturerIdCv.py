@@ -7,12 +7,12 @@ Best-effort read of CV8 (manufacturer ID) using service mode direct bit verify
 packets and current feedback for ACK detection.
 """
 
-import json
 import os
 import sys
 import time
 import serial
 from datetime import datetime
+import RpcClient
 
 LOG_LEVEL = 1  # 0 = none, 1 = minimum, 2 = verbose
 
@@ -36,32 +36,11 @@ def log(level, message):
             print(message)
 
 
-class DCCTesterRPC:
-    """RPC client for DCC_tester command station."""
+class DCCTesterRPC(RpcClient.DCCTesterRPC):
+    """RPC client for DCC_tester command station, traced at log level 2."""
 
     def __init__(self, port, baudrate=115200, timeout=2):
-        self.ser = serial.Serial(port, baudrate, timeout=timeout)
-        time.sleep(0.5)
-
-    def send_rpc(self, method, params, quiet=False):
-        request = {
-            "method": method,
-            "params": params,
-        }
-        request_json = json.dumps(request) + "\r\n"
-        if not quiet:
-            log(2, f"→ {request_json.strip()}")
-        self.ser.write(request_json.encode("utf-8"))
-
-        response_line = self.ser.readline().decode("utf-8").strip()
-        if not quiet:
-            log(2, f"← {response_line}")
-        if response_line:
-            return json.loads(response_line)
-        return None
-
-    def close(self):
-        self.ser.close()
+        super().__init__(port, baudrate, timeout, trace=lambda line: log(2, line))
 
 
 def _parse_int(value, key):
@@ -0,0 +1,607 @@
+#!/usr/bin/env python3
+"""
+RpcClient
+=========
+
+Shared host client for the DCC_tester RPC server, see
+Doc/RPC_TEST_MESSAGES.txt for the methods and the wire formats.
+
+A background thread reads everything the device sends, so requests do not
+wait for each other:
+    - every JSON request carries an "id" and its response is matched by it
+      (section 23), several requests may be in flight at once
+    - binary frames (section 18) are matched by their sequence number
+    - unsolicited messages ("event": job_complete, track_fault, ...) go to
+      the callbacks registered with on_event() and to wait_event()
+
+Example:
+    with RpcClient() as rpc:                        # serial_port from SystemConfig.txt
+        print(rpc.call("echo", {"value": 1}))
+        loaded, sent = rpc.pipeline([
+            ("command_station_load_packet", {"bytes": [3, 63, 16, 44], "replace": True}),
+            ("command_station_transmit_packet", {"delay_ms": 0}),
+        ])
+        rpc.binary_enable()
+        status, data = rpc.call_binary(OP_GET_CURRENT_MA)
+
+TelemetryReceiver collects the UDP telemetry stream (section 26) on a thread
+of its own.
+"""
+
+import json
+import socket
+import struct
+import sys
+import threading
+import time
+from collections import deque, namedtuple
+from concurrent.futures import Future
+from concurrent.futures import TimeoutError as FutureTimeout
+from pathlib import Path
+
+SCRIPT_DIR = Path(__file__).resolve().parent
+
+DEFAULT_BAUDRATE = 115200
+DEFAULT_TIMEOUT = 2.0
+DEFAULT_TCP_PORT = 2560
+
+# Binary framed protocol
+BIN_SOF = 0xD5
+BIN_HEADER_SIZE = 5
+BIN_CRC_SIZE = 2
+BIN_RESPONSE_FLAG = 0x80
+
+OP_ECHO = 0x00
+OP_LOAD_PACKET = 0x01
+OP_TRANSMIT_PACKET = 0x02
+OP_QUEUE_STATUS = 0x03
+OP_GET_VOLTAGE_MV = 0x04
+OP_GET_CURRENT_MA = 0x05
+OP_RAILCOM_READ = 0x06
+OP_SNIFFER_READ = 0x07
+OP_SUITE_WRITE = 0x08
+OP_LOAD_PACKETS = 0x09
+OP_CAPTURE_READ = 0x0A
+
+BIN_STATUS_OK = 0x00
+BIN_STATUS_NAMES = {
+    0x00: "ok",
+    0x01: "bad CRC",
+    0x02: "bad length",
+    0x03: "unknown opcode",
+    0x04: "invalid parameter",
+    0x05: "failed",
+}
+
+
+class RpcError(Exception):
+    """Request could not be completed."""
+
+
+class RpcTimeout(RpcError):
+    """No response within the timeout."""
+
+
+def crc16_ccitt(data, crc=0xFFFF):
+    """CRC-16/CCITT (poly 0x1021, init 0xFFFF) as used by the binary frames."""
+    for byte in data:
+        crc ^= byte << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) if crc & 0x8000 else (crc << 1)
+            crc &= 0xFFFF
+    return crc
+
+
+def make_binary_frame(opcode, seq, payload=b""):
+    """Build a binary request frame."""
+    body = struct.pack("<BBH", opcode, seq, len(payload)) + bytes(payload)
+    return bytes([BIN_SOF]) + body + struct.pack("<H", crc16_ccitt(body))
+
+
+def default_serial_port():
+    """serial_port from SystemConfig.txt."""
+    sys.path.insert(0, str(SCRIPT_DIR))
+    import System
+    return System.get_config().serial_port
+
+
+class _SerialLink:
+    def __init__(self, port, baudrate):
+        import serial
+        self.ser = serial.Serial(port, baudrate, timeout=0.05, write_timeout=5)
+        self.ser.reset_input_buffer()
+
+    def write(self, data):
+        self.ser.write(data)
+
+    def read(self):
+        return self.ser.read(self.ser.in_waiting or 1)
+
+    def close(self):
+        self.ser.close()
+
+
+class _TcpLink:
+    def __init__(self, host, port):
+        self.sock = socket.create_connection((host, port), timeout=5)
+        self.sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        self.sock.settimeout(0.05)
+
+    def write(self, data):
+        self.sock.sendall(data)
+
+    def read(self):
+        try:
+            data = self.sock.recv(4096)
+        except socket.timeout:
+            return b""
+        if not data:
+            raise ConnectionError("connection closed by the device")
+        return data
+
+    def close(self):
+        try:
+            self.sock.shutdown(socket.SHUT_RDWR)
+        except OSError:
+            pass
+        self.sock.close()
+
+
+class RpcClient:
+    """Pipelined RPC client over USB CDC (serial port) or TCP."""
+
+    def __init__(self, port=None, host=None, tcp_port=DEFAULT_TCP_PORT,
+                 baudrate=DEFAULT_BAUDRATE, timeout=DEFAULT_TIMEOUT, trace=None):
+        """
+        Open the connection and start the reader thread.
+
+        Args:
+            port: Serial port (e.g. 'COM6' or '/dev/ttyACM0'), default from SystemConfig.txt
+            host: Device IP address, connects over TCP instead of the serial port
+            tcp_port: TCP port of the RPC server (PARAM_NETWORK_PORT)
+            baudrate: Serial baud rate, ignored by the USB CDC link
+            timeout: Default response timeout in seconds
+            trace: Optional callable getting one line per request and response
+        """
+        if host is not None:
+            self.link = _TcpLink(host, tcp_port)
+        else:
+            self.link = _SerialLink(port if port is not None else default_serial_port(), baudrate)
+        self.timeout = timeout
+        self.trace = trace
+
+        self._write_lock = threading.Lock()
+        self._lock = threading.Lock()
+        self._next_id = 1
+        self._next_seq = 0
+        self._pending = {}              # id -> (Future, method)
+        self._order = deque()           # ids in request order, for responses without an id
+        self._pending_bin = {}          # seq -> Future
+        self._binary = False
+        self._handlers = []             # (event name or None, callback)
+        self._events = deque(maxlen=256)
+        self._event_cond = threading.Condition(self._lock)
+        self._closed = False
+        self.error = None               # what stopped the reader
+
+        self._reader = threading.Thread(target=self._read_loop, name="RpcClient reader", daemon=True)
+        self._reader.start()
+
+    # ------------------------------------------------------------------
+    # JSON requests
+
+    def call_async(self, method, params=None):
+        """
+        Send a request without waiting.
+
+        Returns:
+            Future resolving to the response dictionary
+        """
+        future = Future()
+        with self._lock:
+            if self._closed:
+                raise RpcError(f"connection closed: {self.error}")
+            request_id = self._next_id
+            self._next_id += 1
+            self._pending[request_id] = (future, method)
+            self._order.append(request_id)
+        request = {"id": request_id, "method": method, "params": params if params is not None else {}}
+        line = json.dumps(request, separators=(",", ":"))
+        self._trace(f"→ {line}")
+        try:
+            with self._write_lock:
+                self.link.write(line.encode("utf-8") + b"\r\n")
+        except Exception as exc:
+            self._forget(request_id)
+            raise RpcError(f"write failed: {exc}") from exc
+        return future
+
+    def call(self, method, params=None, timeout=None):
+        """
+        Send a request and wait for its response.
+
+        Raises:
+            RpcTimeout: no response within timeout (default: self.timeout)
+        """
+        return self.result(self.call_async(method, params), timeout)
+
+    def result(self, future, timeout=None):
+        """Wait for a future returned by call_async or call_binary_async."""
+        try:
+            return future.result(self.timeout if timeout is None else timeout)
+        except FutureTimeout:
+            raise RpcTimeout("no response") from None
+
+    def pipeline(self, calls, timeout=None):
+        """
+        Send all calls at once, then collect the responses in order.
+
+        Args:
+            calls: Iterable of (method, params) tuples
+            timeout: Seconds to wait for each response after the previous one
+
+        Returns:
+            List of response dictionaries, None for calls without a response
+        """
+        futures = [self.call_async(method, params) for method, params in calls]
+        timeout = self.timeout if timeout is None else timeout
+        results = []
+        for future in futures:
+            # The device answers in order: each response gets timeout after the one before
+            try:
+                results.append(future.result(timeout))
+            except FutureTimeout:
+                results.append(None)
+        return results
+
+    def batch(self, calls, stop_on_error=False, timeout=None):
+        """
+        Run calls in one "batch" request, one round trip and one response.
+
+        Returns:
+            The batch response, its "results" hold one entry per executed call
+        """
+        request = {
+            "stop_on_error": stop_on_error,
+            "calls": [{"method": method, "params": params if params is not None else {}}
+                      for method, params in calls],
+        }
+        return self.call("batch", request, timeout)
+
+    # ------------------------------------------------------------------
+    # Binary frames (USB only)
+
+    def binary_enable(self, enable=True):
+        """Switch binary framing on or off for this USB session."""
+        response = self.call("rpc_binary_mode", {"enable": enable})
+        if response.get("status") != "ok":
+            raise RpcError(f"rpc_binary_mode failed: {response}")
+        self._binary = enable
+        return response
+
+    def call_binary_async(self, opcode, payload=b""):
+        """
+        Send a binary frame without waiting.
+
+        Returns:
+            Future resolving to (status, data)
+        """
+        future = Future()
+        with self._lock:
+            if self._closed:
+                raise RpcError(f"connection closed: {self.error}")
+            for _ in range(256):
+                seq = self._next_seq
+                self._next_seq = (self._next_seq + 1) & 0xFF
+                if seq not in self._pending_bin:
+                    break
+            else:
+                raise RpcError("256 binary requests in flight")
+            self._pending_bin[seq] = future
+        frame = make_binary_frame(opcode, seq, payload)
+        self._trace(f"→ bin op 0x{opcode:02X} seq {seq} {bytes(payload).hex(' ')}")
+        with self._write_lock:
+            self.link.write(frame)
+        return future
+
+    def call_binary(self, opcode, payload=b"", timeout=None):
+        """
+        Send a binary frame and wait for its response.
+
+        Returns:
+            Tuple (status, data), status BIN_STATUS_OK or one of BIN_STATUS_NAMES
+        """
+        return self.result(self.call_binary_async(opcode, payload), timeout)
+
+    # ------------------------------------------------------------------
+    # Unsolicited messages
+
+    def on_event(self, callback, event=None):
+        """
+        Call callback(message) on the reader thread for every unsolicited
+        message, or only those whose "event" is event.
+        """
+        with self._lock:
+            self._handlers.append((event, callback))
+
+    def wait_event(self, event=None, timeout=None):
+        """
+        Take the oldest unsolicited message (with "event" == event, if given).
+
+        Returns:
+            The message dictionary, None on timeout
+        """
+        deadline = time.monotonic() + (self.timeout if timeout is None else timeout)
+        with self._event_cond:
+            while True:
+                for message in self._events:
+                    if event is None or message.get("event") == event:
+                        self._events.remove(message)
+                        return message
+                remaining = deadline - time.monotonic()
+                if remaining <= 0 or self._closed:
+                    return None
+                self._event_cond.wait(remaining)
+
+    # ------------------------------------------------------------------
+
+    def close(self):
+        """Stop the reader and close the connection, pending calls fail."""
+        with self._lock:
+            if self._closed:
+                return
+            self._closed = True
+        self._reader.join(timeout=1.0)
+        self.link.close()
+        self._fail_pending(RpcError("connection closed"))
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, exc_type, exc, tb):
+        self.close()
+
+    def _trace(self, line):
+        if self.trace is not None:
+            self.trace(line)
+
+    def _forget(self, request_id):
+        with self._lock:
+            self._pending.pop(request_id, None)
+            try:
+                self._order.remove(request_id)
+            except ValueError:
+                pass
+
+    def _fail_pending(self, exc):
+        with self._lock:
+            futures = [future for future, _ in self._pending.values()] + list(self._pending_bin.values())
+            self._pending.clear()
+            self._order.clear()
+            self._pending_bin.clear()
+            self._event_cond.notify_all()
+        for future in futures:
+            if not future.done():
+                future.set_exception(exc)
+
+    def _read_loop(self):
+        buffer = bytearray()
+        try:
+            while not self._closed:
+                data = self.link.read()
+                if not data:
+                    continue
+                buffer += data
+                self._parse(buffer)
+        except Exception as exc:
+            self.error = exc
+            with self._lock:
+                self._closed = True
+            self._fail_pending(RpcError(f"reader stopped: {exc}"))
+
+    def _parse(self, buffer):
+        while buffer:
+            if buffer[0] == BIN_SOF and self._binary:
+                if len(buffer) < BIN_HEADER_SIZE:
+                    return
+                length = buffer[3] | (buffer[4] << 8)
+                total = BIN_HEADER_SIZE + length + BIN_CRC_SIZE
+                if len(buffer) < total:
+                    return
+                frame = bytes(buffer[:total])
+                del buffer[:total]
+                self._binary_frame(frame)
+                continue
+
+            end = buffer.find(b"\r\n")
+            if buffer[0] != ord("{"):
+                # Not the start of a frame: skip to the next one
+                start = buffer.find(b"{")
+                if self._binary:
+                    sof = buffer.find(bytes([BIN_SOF]))
+                    if sof >= 0 and (start < 0 or sof < start):
+                        start = sof
+                del buffer[:start if start >= 0 else len(buffer)]
+                continue
+            if end < 0:
+                return
+            line = bytes(buffer[:end]).decode("utf-8", errors="replace")
+            del buffer[:end + 2]
+            self._json_line(line)
+
+    def _binary_frame(self, frame):
+        body = frame[1:-BIN_CRC_SIZE]
+        crc = frame[-2] | (frame[-1] << 8)
+        opcode, seq = frame[1], frame[2]
+        self._trace(f"← bin op 0x{opcode:02X} seq {seq} {frame[BIN_HEADER_SIZE:-BIN_CRC_SIZE].hex(' ')}")
+        with self._lock:
+            future = self._pending_bin.pop(seq, None)
+        if future is None:
+            return
+        if crc16_ccitt(body) != crc or not opcode & BIN_RESPONSE_FLAG or len(body) < BIN_HEADER_SIZE:
+            future.set_exception(RpcError("corrupt binary response"))
+            return
+        payload = frame[BIN_HEADER_SIZE:-BIN_CRC_SIZE]
+        future.set_result((payload[0], payload[1:]))
+
+    def _json_line(self, line):
+        self._trace(f"← {line}")
+        try:
+            message = json.loads(line)
+        except json.JSONDecodeError:
+            return
+        if not isinstance(message, dict):
+            return
+
+        with self._lock:
+            entry = None
+            request_id = message.get("id")
+            if request_id is not None:
+                entry = self._pending.pop(request_id, None)
+                if entry is not None:
+                    self._order.remove(request_id)
+            elif "event" not in message and self._order:
+                # Requests which failed to parse are answered without an id, in order
+                entry = self._pending.pop(self._order.popleft())
+            if entry is None:
+                self._events.append(message)
+                handlers = [callback for event, callback in self._handlers
+                            if event is None or event == message.get("event")]
+                self._event_cond.notify_all()
+        if entry is not None:
+            entry[0].set_result(message)
+            return
+        for callback in handlers:
+            callback(message)
+
+
+class DCCTesterRPC(RpcClient):
+    """
+    The send_rpc interface of the test scripts on top of RpcClient: one
+    request, wait for its response, None if there was none.
+    """
+
+    def __init__(self, port, baudrate=DEFAULT_BAUDRATE, timeout=DEFAULT_TIMEOUT, trace=print):
+        super().__init__(port=port, baudrate=baudrate, timeout=timeout, trace=None)
+        self.log = trace
+
+    def send_rpc(self, method, params, quiet=False):
+        """
+        Send an RPC request and return the response.
+
+        Args:
+            method: RPC method name
+            params: Dictionary of parameters
+            quiet: Do not log request and response
+
+        Returns:
+            Response dictionary, None on timeout
+        """
+        self.trace = None if quiet else self.log
+        try:
+            return self.call(method, params)
+        except RpcTimeout:
+            return None
+
+    def send_rpcs(self, calls, quiet=False):
+        """
+        Send several requests back to back and return their responses in
+        order, None for a request without a response.
+        """
+        self.trace = None if quiet else self.log
+        return self.pipeline(calls)
+
+    def send_batch(self, calls, quiet=False):
+        """
+        Run several requests in one batch, stopping at the first failure.
+
+        Returns:
+            List of responses in order, None for a request that was not executed
+        """
+        calls = list(calls)
+        self.trace = None if quiet else self.log
+        try:
+            results = list(self.batch(calls, stop_on_error=True).get("results", []))
+        except RpcTimeout:
+            results = []
+        return results + [None] * (len(calls) - len(results))
+
+
+TelemetryRecord = namedtuple("TelemetryRecord", "sample packet_seq voltage_mv current_ma railcom railcom_lag railcom_ch1")
+
+TELEMETRY_MAGIC = 0x4D54
+TELEMETRY_HEADER_V1 = struct.Struct("<HBBHHIII")
+TELEMETRY_HEADER = struct.Struct("<HBBHHIIIQ")    # version 2: u64 time_ns, UTC since 1970
+TELEMETRY_RECORD = struct.Struct("<IIHHBBH")
+
+
+class TelemetryReceiver:
+    """Receives the UDP telemetry stream on a background thread."""
+
+    def __init__(self, port=DEFAULT_TCP_PORT + 1, callback=None, max_records=100000):
+        """
+        Args:
+            port: Local UDP port, the "port" of telemetry_control (default 2561)
+            callback: Optional callable(records, header) per datagram, on the receiver thread;
+                header is (magic, version, record_size, count, lost, seq, tick_ms,
+                cycles, time_ns), time_ns None from version 1 devices
+            max_records: Records kept for read() when no callback is given
+        """
+        self.callback = callback
+        self.records = deque(maxlen=max_records)
+        self.datagrams = 0
+        self.lost = 0
+        self.last_seq = None
+        self.sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        self.sock.bind(("", port))
+        self.sock.settimeout(0.2)
+        self._running = True
+        self._thread = threading.Thread(target=self._run, name="TelemetryReceiver", daemon=True)
+        self._thread.start()
+
+    def _run(self):
+        while self._running:
+            try:
+                data = self.sock.recv(2048)
+            except socket.timeout:
+                continue
+            except OSError:
+                break
+            if len(data) < TELEMETRY_HEADER_V1.size:
+                continue
+            layout = TELEMETRY_HEADER if data[2] >= 2 else TELEMETRY_HEADER_V1
+            if len(data) < layout.size:
+                continue
+            header = layout.unpack_from(data)
+            if layout is TELEMETRY_HEADER_V1:
+                header = header + (None,)
+            magic, _version, size, count, lost, seq, _tick, _cycles, _time_ns = header
+            if magic != TELEMETRY_MAGIC or size < TELEMETRY_RECORD.size:
+                continue
+            records = [TelemetryRecord(*TELEMETRY_RECORD.unpack_from(data, layout.size + i * size))
+                       for i in range(count) if layout.size + (i + 1) * size <= len(data)]
+            self.datagrams += 1
+            self.lost += lost
+            self.last_seq = seq
+            if self.callback is not None:
+                self.callback(records, header)
+            else:
+                self.records.extend(records)
+
+    def read(self):
+        """Take the records received so far."""
+        records = []
+        while self.records:
+            records.append(self.records.popleft())
+        return records
+
+    def close(self):
+        self._running = False
+        self._thread.join(timeout=1.0)
+        self.sock.close()
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, exc_type, exc, tb):
+        self.close()
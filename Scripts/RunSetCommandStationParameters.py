@@ -7,11 +7,10 @@ This script sets command station parameters via RPC.
 Configuration is read from RunSetCommandStationParametersConfig.txt.
 """
 
-import json
 import os
 import sys
-import time
 import serial
+import RpcClient
 
 
 LOG_LEVEL = 1  # 0 = none, 1 = minimum, 2 = verbose
@@ -36,30 +35,11 @@ def log(level, message):
             print(message)
 
 
-class DCCTesterRPC:
-    """RPC client for DCC_tester command station."""
+class DCCTesterRPC(RpcClient.DCCTesterRPC):
+    """RPC client for DCC_tester command station, traced at log level 2."""
 
     def __init__(self, port, baudrate=115200, timeout=2):
-        self.ser = serial.Serial(port, baudrate, timeout=timeout)
-        time.sleep(0.5)  # Allow time for connection to establish
-
-    def send_rpc(self, method, params):
-        request = {
-            "method": method,
-            "params": params,
-        }
-        request_json = json.dumps(request) + "\r\n"
-        log(2, f"→ {request_json.strip()}")
-        self.ser.write(request_json.encode("utf-8"))
-
-        response_line = self.ser.readline().decode("utf-8").strip()
-        log(2, f"← {response_line}")
-        if response_line:
-            return json.loads(response_line)
-        return None
-
-    def close(self):
-        self.ser.close()
+        super().__init__(port, baudrate, timeout, trace=lambda line: log(2, line))
 
 
 def _parse_bool(value, key):
@@ -5,12 +5,18 @@ DCC Tester System Menu
 
 Top-level menu system for running DCC tester scripts.
 Provides centralized configuration management.
+
+With several testers connected, the parallel runner (menu P) finds the
+boards, identifies each by its system_device_id parameter and runs the
+selected test runners on all of them at once, one worker per board.
 """
 
 import sys
 import os
+import queue
 import subprocess
 import threading
+import time
 from pathlib import Path
 from datetime import datetime
 
@@ -30,12 +36,31 @@ if sys.stderr.encoding != 'utf-8':
 SCRIPT_DIR = Path(__file__).parent
 CONFIG_FILE = SCRIPT_DIR / "SystemConfig.txt"
 
+# Overrides serial_port, set by the parallel runner for each board's runner
+SERIAL_PORT_ENV = "DCC_TESTER_SERIAL_PORT"
+
+# DCC_tester USB IDs (USBD_VID / USBD_PID)
+USB_VID = 0x0483
+USB_PID = 0x5710
+
+# Runners that need no keyboard input, for the parallel runner
+PARALLEL_TESTS = {
+    "1": ("Packet Acceptance Test", "RunPacketAcceptanceTest.py"),
+    "2": ("Timing Margin Test", "RunTimingMarginTest.py"),
+    "3": ("Inter-Packet Acceptance Test", "RunInterPacketAcceptanceTest.py"),
+    "4": ("Bad Bit Test", "RunBadBitTest.py"),
+    "5": ("Function I/O Test", "RunFunctionIOTest.py"),
+    "6": ("Accessory I/O Test", "RunAccessoryIOTest.py"),
+    "8": ("Set Command Station Parameters", "RunSetCommandStationParameters.py"),
+}
+
 
 class SystemConfig:
     """Manages system-level configuration."""
     
     def __init__(self):
         self.serial_port = "COM6"
+        self.serial_ports = []  # parallel runner, empty = search USB
         self.in_circuit_motor = False
         self.logging_level = 1
         self.monitor_index = 2
@@ -66,6 +91,7 @@ class SystemConfig:
         """Load configuration from SystemConfig.txt."""
         if not CONFIG_FILE.exists():
             print(f"Warning: {CONFIG_FILE} not found. Using defaults.")
+            self._apply_environment()
             return
         
         try:
@@ -82,6 +108,7 @@ class SystemConfig:
             
             # Parse configuration values
             self.serial_port = config.get("serial_port", "COM6")
+            self.serial_ports = [port.strip() for port in config.get("serial_ports", "").split(",") if port.strip()]
             self.in_circuit_motor = self._parse_bool(config.get("in_circuit_motor", "false"))
             self.logging_level = self._parse_int(config.get("logging_level", "1"), default=1)
             self.monitor_index = self._parse_int(config.get("monitor_index", "2"), default=2)
@@ -92,6 +119,14 @@ class SystemConfig:
         except Exception as e:
             print(f"Warning: Error loading config file: {e}")
             print("Using default values.")
+        
+        self._apply_environment()
+    
+    def _apply_environment(self):
+        """Apply the serial port chosen by the parallel runner."""
+        port = os.environ.get(SERIAL_PORT_ENV, "").strip()
+        if port:
+            self.serial_port = port
     
     def display(self):
         """Display current configuration."""
@@ -99,6 +134,7 @@ class SystemConfig:
         print("System Configuration:")
         print("=" * 70)
         print(f"  Serial port:         {self.serial_port}")
+        print(f"  Parallel ports:      {', '.join(self.serial_ports) if self.serial_ports else 'search USB'}")
         print(f"  In-circuit motor:    {self.in_circuit_motor}")
         print(f"  Logging level:       {self.logging_level}")
         print(f"  Save logs:           {self.save_logs}")
@@ -380,6 +416,218 @@ def run_script(script_name):
         return 1
 
 
+def find_serial_ports():
+    """List the serial ports of DCC_tester boards.
+    
+    Returns serial_ports from the config if set, otherwise every USB port
+    with the DCC_tester VID/PID. Each board has two: RPC and capture stream.
+    """
+    config = get_config()
+    if config.serial_ports:
+        return list(config.serial_ports)
+    
+    from serial.tools import list_ports
+    return sorted(port.device for port in list_ports.comports()
+                  if port.vid == USB_VID and port.pid == USB_PID)
+
+
+def probe_board(port, timeout=1.0):
+    """Read system_device_id on a port.
+    
+    Returns:
+        Device ID, or None if no RPC server answers on the port
+    """
+    from RpcClient import RpcClient, RpcError
+    try:
+        with RpcClient(port=port, timeout=timeout) as rpc:
+            response = rpc.call("parameters_get", {"names": ["system_device_id"]})
+    except (RpcError, OSError, ValueError):
+        return None
+    except Exception as e:
+        # serial.SerialException: port busy or gone
+        print(f"  {port}: {e}")
+        return None
+    if response.get("status") != "ok":
+        return None
+    return response.get("parameters", {}).get("system_device_id")
+
+
+def discover_boards():
+    """Find the connected boards.
+    
+    Returns:
+        List of (label, port) sorted by device ID, the label is the
+        device ID, with the port added if two boards share one
+    """
+    print("Searching for DCC_tester boards...")
+    found = []
+    for port in find_serial_ports():
+        device_id = probe_board(port)
+        if device_id is not None:
+            print(f"  {port}: device {device_id}")
+            found.append((device_id, port))
+    
+    found.sort()
+    ids = [device_id for device_id, _ in found]
+    boards = []
+    for device_id, port in found:
+        if ids.count(device_id) > 1:
+            label = f"{device_id}@{Path(port).name}"
+        else:
+            label = str(device_id)
+        boards.append((label, port))
+    if len(set(ids)) != len(ids):
+        print("Warning: several boards share a system_device_id, set a unique one on each")
+    return boards
+
+
+def run_parallel(scripts, boards, shard=True):
+    """Run test runners on several boards at once, one worker per board.
+    
+    Args:
+        scripts: Runner script names
+        boards: List of (label, port) from discover_boards()
+        shard: True to share the scripts out among the boards (each runs
+               once), False to run every script on every board
+    
+    Returns:
+        List of result dictionaries (board, port, script, returncode, seconds, log)
+    """
+    config = get_config()
+    log_path = Path(config.log_directory)
+    if not log_path.is_absolute():
+        log_path = SCRIPT_DIR / log_path
+    run_dir = log_path / f"parallel_{datetime.now().strftime('%Y%m%d_%H%M%S')}"
+    run_dir.mkdir(parents=True, exist_ok=True)
+    
+    shared = queue.Queue()
+    queues = {}
+    for label, _ in boards:
+        queues[label] = shared if shard else queue.Queue()
+    for script in scripts:
+        if shard:
+            shared.put(script)
+        else:
+            for label, _ in boards:
+                queues[label].put(script)
+    
+    results = []
+    processes = []
+    lock = threading.Lock()
+    stopping = threading.Event()
+    
+    def worker(label, port):
+        jobs = queues[label]
+        while not stopping.is_set():
+            try:
+                script = jobs.get_nowait()
+            except queue.Empty:
+                return
+            log_file = run_dir / f"board{label.replace('@', '_')}_{Path(script).stem}.log"
+            with lock:
+                print(f"[{label}] {script} started ({port})")
+            started = time.monotonic()
+            env = dict(os.environ)
+            env[SERIAL_PORT_ENV] = port
+            env["PYTHONIOENCODING"] = "utf-8"
+            with open(log_file, "w", encoding="utf-8") as output:
+                process = subprocess.Popen(
+                    [sys.executable, '-u', str(SCRIPT_DIR / script)],
+                    cwd=str(SCRIPT_DIR),
+                    stdin=subprocess.DEVNULL,
+                    stdout=output,
+                    stderr=subprocess.STDOUT,
+                    env=env
+                )
+                with lock:
+                    processes.append(process)
+                returncode = process.wait()
+            result = {
+                "board": label,
+                "port": port,
+                "script": script,
+                "returncode": returncode,
+                "seconds": time.monotonic() - started,
+                "log": str(log_file),
+            }
+            with lock:
+                processes.remove(process)
+                results.append(result)
+                status = "PASS" if returncode == 0 else f"FAIL ({returncode})"
+                print(f"[{label}] {script} {status} in {result['seconds']:.0f} s")
+    
+    threads = [threading.Thread(target=worker, args=board, daemon=True) for board in boards]
+    for thread in threads:
+        thread.start()
+    try:
+        for thread in threads:
+            while thread.is_alive():
+                thread.join(timeout=0.5)
+    except KeyboardInterrupt:
+        print("\n\nStopping all boards...")
+        stopping.set()
+        with lock:
+            for process in processes:
+                process.terminate()
+        for thread in threads:
+            thread.join(timeout=5.0)
+    
+    write_parallel_summary(results, run_dir / "summary.txt")
+    return results
+
+
+def write_parallel_summary(results, summary_file):
+    """Print the results of a parallel run and save them to summary_file."""
+    lines = []
+    lines.append("=" * 70)
+    lines.append("PARALLEL RUN SUMMARY")
+    lines.append("=" * 70)
+    for result in sorted(results, key=lambda r: (r["board"], r["script"])):
+        status = "PASS" if result["returncode"] == 0 else "FAIL"
+        lines.append(f"  {status}  board {result['board']:<10} {result['script']:<36} {result['seconds']:6.0f} s")
+    passed = sum(1 for result in results if result["returncode"] == 0)
+    lines.append("")
+    lines.append(f"  Runs: {len(results)}  Passed: {passed}  Failed: {len(results) - passed}")
+    lines.append(f"  Logs: {summary_file.parent}")
+    lines.append("=" * 70)
+    
+    print()
+    for line in lines:
+        print(line)
+    with open(summary_file, "w", encoding="utf-8") as f:
+        f.write("\n".join(lines) + "\n")
+
+
+def run_parallel_menu():
+    """Select tests and run them on all connected boards."""
+    print()
+    boards = discover_boards()
+    if not boards:
+        print("\nNo boards found. Set serial_ports in SystemConfig.txt if the search misses them.")
+        return 1
+    
+    print()
+    print("Tests:")
+    for key, (name, _) in PARALLEL_TESTS.items():
+        print(f"  {key}. {name}")
+    print()
+    selection = input("Tests to run (e.g. 1,3,4): ").replace(" ", "").split(",")
+    scripts = list(dict.fromkeys(PARALLEL_TESTS[key][1] for key in selection if key in PARALLEL_TESTS))
+    if not scripts:
+        print("\nNo tests selected.")
+        return 1
+    
+    mode = input("Share tests among the boards, or run every test on every board? [S/a]: ").strip().upper()
+    shard = mode != "A"
+    
+    print()
+    print(f"Running {len(scripts)} test(s) on {len(boards)} board(s), "
+          f"{'shared among the boards' if shard else 'all on every board'}")
+    print()
+    results = run_parallel(scripts, boards, shard=shard)
+    return 0 if results and all(result["returncode"] == 0 for result in results) else 1
+
+
 def display_menu():
     """Display the main menu and get user selection."""
     global _logging_active
@@ -401,6 +649,7 @@ def display_menu():
     print("  7. Acceptance Test with Override")
     print("  8. Set Command Station Parameters")
     print()
+    print("  P. Run Tests on All Boards (parallel)")
     print("  C. View/Edit System Configuration")
     
     # Only show logging toggle if save_logs is enabled in config
@@ -413,7 +662,7 @@ def display_menu():
     print("=" * 70)
     print()
     
-    choice = input("Select test to run (1-8, C, L, Q): ").strip().upper()
+    choice = input("Select test to run (1-8, P, C, L, Q): ").strip().upper()
     return choice
 
 
@@ -506,8 +755,11 @@ def main():
             elif choice == "8":
                 run_script("RunSetCommandStationParameters.py")
             
+            elif choice == "P":
+                run_parallel_menu()
+            
             else:
-                print("\nInvalid selection. Please choose 1-8, C, L, or Q.")
+                print("\nInvalid selection. Please choose 1-8, P, C, L, or Q.")
                 continue
             
             print()
@@ -0,0 +1,96 @@
+#!/usr/bin/env python3
+"""
+PacketSuite Utility
+===================
+
+Builds a SUITnnnn.BIN packet suite (packet_suite_run) from a JSON description
+and optionally uploads it to the SD card over the RPC serial port.
+
+Description file:
+    {
+        "name": "bit1 sweep",
+        "default_gap_us": 5000,
+        "vectors": [
+            {"bytes": [3, 63, 129], "repeat": 10},
+            {"bytes": [255, 0], "gap_us": 20000, "trigger": true}
+        ]
+    }
+The checksum byte is appended unless a vector sets "checksum": false.
+
+Usage:
+    python PacketSuite.py suite.json SUIT0003.BIN
+    python PacketSuite.py suite.json --upload 3 --port /dev/ttyACM0
+"""
+
+import argparse
+import json
+import os
+import struct
+import sys
+
+PACKET_SUITE_MAGIC = 0x53434344
+HEADER = struct.Struct("<IHHII16s")
+VECTOR = struct.Struct("<BBHI")
+FLAG_TRIGGER = 0x01
+FLAG_ACK = 0x02
+MAX_BYTES = 18
+CHUNK = 900
+
+
+def build_suite(description):
+	"""Return the suite file contents for a description dictionary."""
+	body = bytearray()
+	for n, vector in enumerate(description["vectors"]):
+		packet = list(vector["bytes"])
+		if vector.get("checksum", True):
+			checksum = 0
+			for byte in packet:
+				checksum ^= byte
+			packet.append(checksum)
+		if not 1 <= len(packet) <= MAX_BYTES:
+			raise ValueError(f"vector {n}: 1-{MAX_BYTES} bytes")
+		flags = (FLAG_TRIGGER if vector.get("trigger") else 0) | (FLAG_ACK if vector.get("ack") else 0)
+		body += VECTOR.pack(len(packet), flags, vector.get("repeat", 0), vector.get("gap_us", 0))
+		body += bytes(packet)
+	header = HEADER.pack(PACKET_SUITE_MAGIC, 1, HEADER.size, len(description["vectors"]),
+	                     description.get("default_gap_us", 0), description.get("name", "").encode("ascii")[:16])
+	return header + body
+
+
+def upload(rpc, index, data):
+	"""Write the suite to SUITnnnn.BIN with packet_suite_write, all chunks in flight at once."""
+	offsets = range(0, len(data), CHUNK)
+	responses = rpc.pipeline(
+		("packet_suite_write", {"suite": index, "offset": offset, "data": data[offset:offset + CHUNK].hex()})
+		for offset in offsets)
+	for offset, response in zip(offsets, responses):
+		if response is None or response.get("status") != "ok":
+			print(f"ERROR: upload failed at offset {offset}: {response}")
+			return 1
+	print(f"Uploaded {len(data)} bytes to SUIT{index:04d}.BIN")
+	return 0
+
+
+def main():
+	parser = argparse.ArgumentParser(description="Build and upload a packet suite")
+	parser.add_argument("description", help="JSON suite description")
+	parser.add_argument("output", nargs="?", help="suite file to write")
+	parser.add_argument("--upload", type=int, metavar="SUITE", help="upload as SUITnnnn.BIN")
+	parser.add_argument("--port", default="/dev/ttyACM0", help="RPC serial port")
+	args = parser.parse_args()
+
+	with open(args.description) as f:
+		data = build_suite(json.load(f))
+	if args.output:
+		with open(args.output, "wb") as f:
+			f.write(data)
+	if args.upload is not None:
+		sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), ".."))
+		from RpcClient import RpcClient
+		with RpcClient(port=args.port, timeout=5) as rpc:
+			return upload(rpc, args.upload, data)
+	return 0
+
+
+if __name__ == "__main__":
+	sys.exit(main())
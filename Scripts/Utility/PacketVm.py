@@ -0,0 +1,231 @@
+#!/usr/bin/env python3
+"""
+PacketVm Utility
+================
+
+Assembles a packet VM program (packet_vm_load) from a text file, writes it
+to a VMnnnn.BIN file for the SD card or loads it over RPC, and optionally
+runs it and prints its records.
+
+Program file, one statement per line, ';' starts a comment:
+    name speed response
+    packet speed 3 63 128           ; the checksum byte is appended
+        load r0 10
+        load r1 130
+    step:
+        patch speed 2 r1
+        send speed none 3 5000      ; packet, flags, transmissions, gap_us
+        wait 2000                   ; bits
+        read r2 current_ma
+        record 1 r1 2
+        cmp r2 40
+        br gt done
+        add r1 r1 12
+        djnz r0 step
+        end 1
+    done:
+        end 0
+
+Operands: registers r0-r15, packet names, labels, numbers, read sources
+(current_ma voltage_mv io railcom_frames railcom_ch1 ack tick_ms packets),
+conditions (always eq ne lt le gt ge) and send flags (none, or trigger, ack,
+railcom joined with '|'). "jmp label" is "br always label".
+
+Usage:
+    python PacketVm.py program.txt --json
+    python PacketVm.py program.txt VM0003.BIN
+    python PacketVm.py program.txt --run --port /dev/ttyACM0
+"""
+
+import argparse
+import json
+import os
+import struct
+import sys
+import time
+
+PACKET_VM_MAGIC = 0x56434344
+HEADER = struct.Struct("<IHHHH16s")
+INSTRUCTION = struct.Struct("<BBBBi")
+PACKET = struct.Struct("<B18s")
+MAX_BYTES = 18
+REGISTERS = 16
+
+OPS = ["end", "send", "gap", "wait", "read", "load", "add", "addr", "sub",
+       "and", "shr", "cmp", "cmpr", "br", "djnz", "patch", "record"]
+SOURCES = ["current_ma", "voltage_mv", "io", "railcom_frames", "railcom_ch1", "ack", "tick_ms", "packets"]
+CONDITIONS = ["always", "eq", "ne", "lt", "le", "gt", "ge"]
+SEND_FLAGS = {"none": 0, "trigger": 1, "ack": 2, "railcom": 4}
+
+# Operand kinds of each op, in the order they are written, and the field they fill
+SYNTAX = {
+	"end": [("imm", "number")],
+	"send": [("a", "packet"), ("b", "flags"), ("c", "count"), ("imm", "number")],
+	"gap": [("imm", "number")],
+	"wait": [("imm", "number")],
+	"read": [("a", "register"), ("b", "source")],
+	"load": [("a", "register"), ("imm", "number")],
+	"add": [("a", "register"), ("b", "register"), ("imm", "number")],
+	"addr": [("a", "register"), ("b", "register"), ("c", "register")],
+	"sub": [("a", "register"), ("b", "register"), ("c", "register")],
+	"and": [("a", "register"), ("b", "register"), ("imm", "number")],
+	"shr": [("a", "register"), ("b", "register"), ("imm", "number")],
+	"cmp": [("a", "register"), ("imm", "number")],
+	"cmpr": [("a", "register"), ("b", "register")],
+	"br": [("a", "condition"), ("imm", "label")],
+	"djnz": [("a", "register"), ("imm", "label")],
+	"patch": [("a", "packet"), ("b", "number"), ("c", "register")],
+	"record": [("a", "number"), ("b", "register"), ("c", "number")],
+}
+
+
+def operand(kind, text, packets, labels):
+	"""Value of one operand."""
+	if kind == "register":
+		if not text.startswith("r") or not text[1:].isdigit() or int(text[1:]) >= REGISTERS:
+			raise ValueError(f"register r0-r{REGISTERS - 1} expected, got {text}")
+		return int(text[1:])
+	if kind == "packet":
+		if text in packets:
+			return packets[text]
+		return int(text, 0)
+	if kind == "flags":
+		flags = 0
+		for flag in text.split("|"):
+			if flag not in SEND_FLAGS:
+				raise ValueError(f"unknown send flag {flag}")
+			flags |= SEND_FLAGS[flag]
+		return flags
+	if kind == "count":
+		count = int(text, 0)
+		if not 1 <= count <= 256:
+			raise ValueError("transmissions must be 1-256")
+		return count - 1
+	if kind == "source":
+		return SOURCES.index(text) if text in SOURCES else int(text, 0)
+	if kind == "condition":
+		return CONDITIONS.index(text) if text in CONDITIONS else int(text, 0)
+	if kind == "label":
+		if text not in labels:
+			raise ValueError(f"unknown label {text}")
+		return labels[text]
+	return int(text, 0)
+
+
+def assemble(source):
+	"""Return (name, packets, instructions) of a program text, instructions as [op, a, b, c, imm]."""
+	statements = []
+	for number, line in enumerate(source.splitlines(), 1):
+		words = line.split(";", 1)[0].split()
+		if words:
+			statements.append((number, words))
+
+	# First pass: names, packets and label addresses
+	name = ""
+	packets = []
+	packet_names = {}
+	labels = {}
+	address = 0
+	for number, words in statements:
+		if words[0] == "name":
+			name = " ".join(words[1:])
+		elif words[0] == "packet":
+			packet = [int(word, 0) for word in words[2:]]
+			checksum = 0
+			for byte in packet:
+				checksum ^= byte
+			packet.append(checksum)
+			if not 2 <= len(packet) <= MAX_BYTES or any(not 0 <= byte <= 0xFF for byte in packet):
+				raise ValueError(f"line {number}: a packet is 1-{MAX_BYTES - 1} bytes before the checksum")
+			packet_names[words[1]] = len(packets)
+			packets.append(packet)
+		elif words[0].endswith(":") and len(words) == 1:
+			labels[words[0][:-1]] = address
+		else:
+			address += 1
+
+	instructions = []
+	for number, words in statements:
+		if words[0] in ("name", "packet") or (words[0].endswith(":") and len(words) == 1):
+			continue
+		op, args = words[0], words[1:]
+		if op == "jmp":
+			op, args = "br", ["always"] + args
+		if op not in SYNTAX:
+			raise ValueError(f"line {number}: unknown opcode {op}")
+		if len(args) > len(SYNTAX[op]):
+			raise ValueError(f"line {number}: {op} takes {len(SYNTAX[op])} operands")
+		fields = {"a": 0, "b": 0, "c": 0, "imm": 0}
+		try:
+			for (field, kind), text in zip(SYNTAX[op], args):
+				fields[field] = operand(kind, text, packet_names, labels)
+		except ValueError as error:
+			raise ValueError(f"line {number}: {error}") from None
+		instructions.append([op, fields["a"], fields["b"], fields["c"], fields["imm"]])
+	return name, packets, instructions
+
+
+def build_file(name, packets, instructions):
+	"""Return the VMnnnn.BIN contents of an assembled program."""
+	data = HEADER.pack(PACKET_VM_MAGIC, 1, HEADER.size, len(instructions), len(packets),
+	                   name.encode("ascii")[:16])
+	for op, a, b, c, imm in instructions:
+		data += INSTRUCTION.pack(OPS.index(op), a, b, c, imm)
+	for packet in packets:
+		data += PACKET.pack(len(packet), bytes(packet))
+	return data
+
+
+def run(rpc, packets, instructions):
+	"""Load and run the program, print its records and the final status."""
+	response = rpc.call("packet_vm_load", {"packets": packets, "program": instructions})
+	if response is None or response.get("status") != "ok":
+		print(f"ERROR: load failed: {response}")
+		return 1
+	response = rpc.call("packet_vm_run", {})
+	if response is None or response.get("status") != "ok":
+		print(f"ERROR: run refused: {response}")
+		return 1
+
+	first = 0
+	while True:
+		status = rpc.call("packet_vm_status", {})
+		records = rpc.call("packet_vm_records", {"first": first})
+		for record in records.get("records", []):
+			print(f"pc {record[0]:4d} tag {record[1]:3d} t {record[2]} ms: {record[3:]}")
+		first += len(records.get("records", []))
+		if not status.get("running") and first >= status.get("records", 0):
+			break
+		time.sleep(0.2)
+	print(f"Exit {status['exit_code']}{' (stopped)' if status['stopped'] else ''}, "
+	      f"{status['executed']} instructions, {status['packets_sent']} packets, {status['elapsed_ms']} ms")
+	print(f"Registers: {status['registers']}")
+	return 0 if status["exit_code"] == 0 and not status["stopped"] else 2
+
+
+def main():
+	parser = argparse.ArgumentParser(description="Assemble, store and run packet VM programs")
+	parser.add_argument("program", help="program text file")
+	parser.add_argument("output", nargs="?", help="VMnnnn.BIN file to write")
+	parser.add_argument("--json", action="store_true", help="print the packet_vm_load parameters")
+	parser.add_argument("--run", action="store_true", help="load over RPC and run")
+	parser.add_argument("--port", default="/dev/ttyACM0", help="RPC serial port")
+	args = parser.parse_args()
+
+	with open(args.program) as f:
+		name, packets, instructions = assemble(f.read())
+	if args.output:
+		with open(args.output, "wb") as f:
+			f.write(build_file(name, packets, instructions))
+	if args.json:
+		print(json.dumps({"packets": packets, "program": instructions}))
+	if args.run:
+		sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), ".."))
+		from RpcClient import RpcClient
+		with RpcClient(port=args.port, timeout=5) as rpc:
+			return run(rpc, packets, instructions)
+	return 0
+
+
+if __name__ == "__main__":
+	sys.exit(main())
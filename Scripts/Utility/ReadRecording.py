@@ -0,0 +1,174 @@
+#!/usr/bin/env python3
+"""
+ReadRecording Utility
+=====================
+
+Reads a RECnnnnn.BIN file written by the SD card recorder (recorder_start) and
+prints a summary, or exports the records of one channel as CSV.
+
+The file is memory-mapped, blocks are at fixed offsets so a file of any size is
+read without loading it:
+    header  512 bytes
+    block n at 512 + n * block_size
+
+Usage:
+    python ReadRecording.py REC00000.BIN
+    python ReadRecording.py REC00000.BIN --csv analog > analog.csv
+    python ReadRecording.py REC00000.BIN --csv packets > packets.csv
+"""
+
+import argparse
+import mmap
+import struct
+import sys
+
+RECORDER_MAGIC = 0x52434344
+BLOCK_MAGIC = 0x4B4C4244
+HEADER = struct.Struct("<IHHIIIIIIHH")
+CHANNEL = struct.Struct("<BBH12s")
+BLOCK_V1 = struct.Struct("<IIIIHHI")
+BLOCK = struct.Struct("<IIIIHHIQ")
+TIME_SOURCES = {0: "none", 1: "rtc", 2: "sntp"}
+RECORD = struct.Struct("<HBB")
+FLAG_LOST = 0x01
+
+
+def read_header(data):
+	"""Return the file header as a dictionary."""
+	fields = HEADER.unpack_from(data, 0)
+	(magic, version, header_size, block_size, file_index, blocks, start_tick_ms,
+	 cycle_hz, channel_mask, channel_count, time_source) = fields
+	if magic != RECORDER_MAGIC:
+		raise ValueError("not a recorder file")
+	channels = {}
+	for i in range(channel_count):
+		cid, enabled, payload_size, name = CHANNEL.unpack_from(data, HEADER.size + i * CHANNEL.size)
+		channels[cid] = {
+			"name": name.rstrip(b"\0").decode("ascii"),
+			"enabled": bool(enabled),
+			"payload_size": payload_size,
+		}
+	start_time_ns = 0
+	if version >= 2:
+		start_time_ns = struct.unpack_from("<Q", data, 88)[0]	# after the channels, 8 byte aligned
+	else:
+		time_source = 0
+	return {
+		"version": version,
+		"header_size": header_size,
+		"block_size": block_size,
+		"file_index": file_index,
+		"blocks": blocks,
+		"start_tick_ms": start_tick_ms,
+		"cycle_hz": cycle_hz,
+		"channel_mask": channel_mask,
+		"channels": channels,
+		"time_source": TIME_SOURCES.get(time_source, "unknown"),
+		"start_time_ns": start_time_ns,
+	}
+
+
+def iter_blocks(data, header):
+	"""Yield (block header tuple, block offset) for every complete block.
+
+	Version 1 blocks have no time_ns, it is returned as None.
+	"""
+	layout = BLOCK if header["version"] >= 2 else BLOCK_V1
+	count = (len(data) - header["header_size"]) // header["block_size"]
+	if header["blocks"]:
+		count = min(count, header["blocks"])
+	for n in range(count):
+		offset = header["header_size"] + n * header["block_size"]
+		block = layout.unpack_from(data, offset)
+		if block[0] != BLOCK_MAGIC:
+			break
+		if layout is BLOCK_V1:
+			block = block + (None,)
+		yield block, offset
+
+
+def iter_records(data, header):
+	"""Yield (channel, flags, payload bytes, block header tuple) in file order."""
+	block_size = BLOCK.size if header["version"] >= 2 else BLOCK_V1.size
+	for block, offset in iter_blocks(data, header):
+		used = block[4]
+		pos = offset + block_size
+		end = offset + used
+		while pos + RECORD.size <= end:
+			length, channel, flags = RECORD.unpack_from(data, pos)
+			if length < RECORD.size:
+				break
+			yield channel, flags, data[pos + RECORD.size:pos + length], block
+			pos += (length + 3) & ~3
+
+
+def iter_sniffer(payload):
+	"""Split a decoder record into the sniffer records it holds."""
+	pos = 0
+	while pos + 13 <= len(payload):
+		length, time_us, tick_ms, flags, preamble, count = struct.unpack_from("<HIIBBB", payload, pos)
+		if length == 0:
+			break
+		yield time_us, tick_ms, flags, preamble, payload[pos + 13:pos + 13 + count]
+		pos += length
+
+
+def main():
+	parser = argparse.ArgumentParser(description="Read an SD card recording")
+	parser.add_argument("file")
+	parser.add_argument("--csv", choices=["analog", "packets", "decoder"], help="export one channel as CSV")
+	args = parser.parse_args()
+
+	with open(args.file, "rb") as f, mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ) as data:
+		header = read_header(data)
+
+		if args.csv == "analog":
+			print("bucket,voltage_mv,current_ma,lost_before")
+			for channel, flags, payload, _ in iter_records(data, header):
+				if channel == 0:
+					bucket, voltage, current = struct.unpack_from("<IHH", payload)
+					print(f"{bucket},{voltage},{current},{flags & FLAG_LOST}")
+			return
+		if args.csv == "packets":
+			print("time_s,utc_ns,packet_seq,bytes,lost_before")
+			for channel, flags, payload, block in iter_records(data, header):
+				if channel == 1:
+					cycles, seq = struct.unpack_from("<II", payload)
+					utc_ns = ""
+					if block[7] is not None:
+						# Cycles of the record relative to the block start, either side of it
+						delta = ((cycles - block[3] + 0x80000000) & 0xFFFFFFFF) - 0x80000000
+						utc_ns = block[7] + delta * 1000000000 // header["cycle_hz"]
+					print(f"{cycles / header['cycle_hz']:.9f},{utc_ns},{seq},{payload[8:].hex(' ')},{flags & FLAG_LOST}")
+			return
+		if args.csv == "decoder":
+			print("time_us,tick_ms,flags,preamble,bytes")
+			for channel, flags, payload, _ in iter_records(data, header):
+				if channel == 2:
+					for time_us, tick_ms, sflags, preamble, packet in iter_sniffer(payload):
+						print(f"{time_us},{tick_ms},{sflags},{preamble},{packet.hex(' ')}")
+			return
+
+		counts = {}
+		lost = 0
+		blocks = 0
+		for block, _ in iter_blocks(data, header):
+			blocks += 1
+			lost += block[6]
+		for channel, _, _, _ in iter_records(data, header):
+			counts[channel] = counts.get(channel, 0) + 1
+
+		closed = "yes" if header["blocks"] else "no (recording interrupted)"
+		print(f"File index:   {header['file_index']}")
+		print(f"Closed:       {closed}")
+		if header["version"] >= 2:
+			print(f"Started:      {header['start_time_ns']} ns UTC ({header['time_source']})")
+		print(f"Blocks:       {blocks} x {header['block_size']} bytes")
+		print(f"Records lost: {lost}")
+		for cid, channel in sorted(header["channels"].items()):
+			if channel["enabled"]:
+				print(f"  {channel['name']:<10} {counts.get(cid, 0)} records")
+
+
+if __name__ == "__main__":
+	sys.exit(main())
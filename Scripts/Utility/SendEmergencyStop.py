@@ -1,55 +1,13 @@
 #!/usr/bin/env python3
 """
+
+
 SendEmergencyStop Script
 ========================
 
 Sends a single DCC emergency stop packet to a specific address or broadcast (0).
 """
 
-import json
-
-
-class DCCTesterRPC:
-	"""RPC client for DCC_tester command station."""
-
-	def __init__(self, ser):
-		"""
-		Initialize RPC client with an already-open serial port.
-
-		Args:
-			ser: Open serial port instance
-		"""
-		self.ser = ser
-
-	def send_rpc(self, method, params):
-		"""
-		Send an RPC request and return the response.
-
-		Args:
-			method: RPC method name
-			params: Dictionary of parameters
-
-		Returns:
-			Response dictionary
-		"""
-		request = {
-			"method": method,
-			"params": params
-		}
-
-		request_json = json.dumps(request) + '\r\n'
-		print(f"→ {request_json.strip()}")
-
-		self.ser.write(request_json.encode('utf-8'))
-
-		# Read response
-		response_line = self.ser.readline().decode('utf-8').strip()
-		print(f"← {response_line}")
-
-		if response_line:
-			return json.loads(response_line)
-		return None
-
 def calculate_dcc_checksum(bytes_list):
 	"""
 	Calculate DCC packet checksum (XOR of all bytes).
@@ -93,7 +51,7 @@ def send_emergency_stop(rpc, address=0):
 	Send an emergency stop packet using an already-open RPC connection.
 
 	Args:
-		rpc: DCCTesterRPC client instance (already connected)
+		rpc: RpcClient.DCCTesterRPC instance (already connected)
 		address: Locomotive address (0 for broadcast)
 	"""
 	estop_packet = make_emergency_stop_packet(address)
@@ -1,5 +1,7 @@
 #!/usr/bin/env python3
 """
+
+
 TestNoMotorStop Utility
 =======================
 
@@ -12,51 +14,6 @@ If both IO13 and IO14 are high, returns True.
 If either is low, prints RUN status and returns False.
 """
 
-import json
-
-
-class DCCTesterRPC:
-	"""RPC client for DCC_tester command station."""
-
-	def __init__(self, ser):
-		"""
-		Initialize RPC client with an already-open serial port.
-
-		Args:
-			ser: Open serial port instance
-		"""
-		self.ser = ser
-
-	def send_rpc(self, method, params):
-		"""
-		Send an RPC request and return the response.
-
-		Args:
-			method: RPC method name
-			params: Dictionary of parameters
-
-		Returns:
-			Response dictionary
-		"""
-		request = {
-			"method": method,
-			"params": params
-		}
-
-		request_json = json.dumps(request) + "\r\n"
-		print(f"→ {request_json.strip()}")
-
-		self.ser.write(request_json.encode("utf-8"))
-
-		# Read response
-		response_line = self.ser.readline().decode("utf-8").strip()
-		print(f"← {response_line}")
-
-		if response_line:
-			return json.loads(response_line)
-		return None
-
-
 RUN_REV_PIN = 13
 RUN_FWD_PIN = 14
 
@@ -71,7 +28,7 @@ def read_run_inputs(rpc):
 	Read IO13/IO14 in a single RPC call and return run status.
 
 	Args:
-		rpc: DCCTesterRPC client instance (already connected)
+		rpc: RpcClient.DCCTesterRPC instance (already connected)
 
 	Returns:
 		True if both IO13 and IO14 are HIGH, otherwise False.
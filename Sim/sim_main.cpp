@@ -0,0 +1,167 @@
+// Host simulation: command station looped back into the decoder
+//
+// Every half bit returned by CommandStation::transmit() is fed to
+// Decoder::receive() as the width of the edge that ends it, the same
+// duration in us a TIM2 period and a TIM15 capture have on target. A
+// precompiled timing profile reshapes the halves like the on-target
+// scheduler, jitter adds deterministic noise. Sends alternating speed and
+// F0-F4 packets and checks that the decoder executed every function packet
+// in order. Exits with 1 if it did not, so it can run in a regression script.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "command_station.hpp"
+#include "decoder.hpp"
+#include "sim_track.hpp"
+#include "timing_profiles.hpp"
+
+CommandStation command_station;
+Decoder decoder;
+
+namespace {
+
+constexpr uint16_t kAddress = 3u;         // CV1 of the firmware decoder
+constexpr uint64_t kExecuteUs = 3000u;    // decoder thread period on target
+constexpr uint32_t kDrainHalfBits = 4096u;
+
+struct Options {
+  uint32_t packets = 10000u;
+  uint8_t preamble = 17u;
+  uint8_t bit1 = 58u;
+  uint8_t bit0 = 100u;
+  uint8_t profile = PACKET_TIMING_PROFILE_CONFIGURED;
+  uint32_t jitter = 0u;                   // +- us per half bit
+  uint32_t seed = 1u;
+};
+
+void usage() {
+  printf("Usage: dcc_sim [--packets N] [--preamble N] [--bit1 US] [--bit0 US] [--profile NAME]\n"
+         "               [--jitter US] [--seed N]\n"
+         "Profiles:");
+  for (auto const& profile : timing_profiles) printf(" %s", profile.name);
+  printf("\n");
+}
+
+bool parse(int argc, char** argv, Options& options) {
+  for (int i = 1; i < argc; i++) {
+    char const* const arg = argv[i];
+    char const* const value = i + 1 < argc ? argv[i + 1] : nullptr;
+    if (!value) return false;
+    unsigned long const number = strtoul(value, nullptr, 0);
+    if (!strcmp(arg, "--packets")) options.packets = static_cast<uint32_t>(number);
+    else if (!strcmp(arg, "--preamble")) options.preamble = static_cast<uint8_t>(number);
+    else if (!strcmp(arg, "--bit1")) options.bit1 = static_cast<uint8_t>(number);
+    else if (!strcmp(arg, "--bit0")) options.bit0 = static_cast<uint8_t>(number);
+    else if (!strcmp(arg, "--jitter")) options.jitter = static_cast<uint32_t>(number);
+    else if (!strcmp(arg, "--seed")) options.seed = static_cast<uint32_t>(number);
+    else if (!strcmp(arg, "--profile")) {
+      options.profile = timing_profile_from_name(value);
+      if (options.profile >= PACKET_TIMING_PROFILE_COUNT) return false;
+    }
+    else return false;
+    i++;
+  }
+  return true;
+}
+
+// Half bit as it arrives at the decoder input
+struct Channel {
+  Options const& options;
+  uint32_t lcg;
+
+  uint32_t shape(uint32_t arr) {
+    uint32_t width = arr;
+    if (options.profile != PACKET_TIMING_PROFILE_CONFIGURED) {
+      TimingProfile const& profile = timing_profiles[options.profile];
+      bool const one = arr < DCC_TX_MIN_BIT_0_TIMING;
+      // trackOutputs() has set the level of the half that starts now
+      width = one ? (sim_track.p ? profile.one_p : profile.one_n) : (sim_track.p ? profile.zero_p : profile.zero_n);
+    }
+    if (options.jitter) {
+      lcg = lcg * 1664525u + 1013904223u;
+      int32_t const delta = static_cast<int32_t>((lcg >> 8) % (2u * options.jitter + 1u)) -
+                            static_cast<int32_t>(options.jitter);
+      int32_t const jittered = static_cast<int32_t>(width) + delta;
+      width = jittered < 1 ? 1u : static_cast<uint32_t>(jittered);
+    }
+    return width;
+  }
+};
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  Options options;
+  if (!parse(argc, argv, options)) {
+    usage();
+    return 2;
+  }
+
+  command_station.init({
+    .num_preamble = options.preamble,
+    .bit1_duration = options.bit1,
+    .bit0_duration = options.bit0,
+    .flags = {.bidi = false},
+  });
+  decoder.init();
+
+  Channel channel{options, options.seed};
+  uint64_t track_us = 0;
+  uint64_t next_execute = kExecuteUs;
+  auto half_bit = [&] {
+    uint32_t const width = channel.shape(command_station.transmit());
+    decoder.receive(width);
+    track_us += width;
+    if (track_us >= next_execute) {
+      decoder.execute();
+      next_execute = track_us + kExecuteUs;
+    }
+  };
+
+  std::vector<uint32_t> expected;
+  expected.reserve(options.packets / 2u + 1u);
+  auto const start = std::chrono::steady_clock::now();
+
+  for (uint32_t i = 0; i < options.packets; i++) {
+    dcc::Packet packet{};
+    if (i & 1u) {
+      // Consecutive function packets always differ
+      uint32_t const state = (i >> 1) & 0b1'1111u;
+      packet = dcc::make_f0_f4_packet(kAddress, state);
+      expected.push_back(state);
+    }
+    else {
+      packet = dcc::make_128_speed_step_control_packet(kAddress, 1u << 7u | (2u + (i >> 1) % 126u));
+    }
+    while (!command_station.packet(packet)) half_bit();
+  }
+  for (uint32_t i = 0; i < kDrainHalfBits; i++) half_bit();
+  decoder.execute();
+
+  double const seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  // In order match, a function state the decoder did not execute is lost
+  std::vector<uint32_t> const& received = sim_decoder.function_states;
+  size_t matched = 0;
+  for (size_t r = 0; r < received.size() && matched < expected.size(); r++) {
+    if (received[r] == expected[matched]) matched++;
+  }
+  size_t const lost = expected.size() - matched;
+
+  printf("Timing: preamble %u, bit1 %u us, bit0 %u us, profile %s, jitter +-%u us\n", options.preamble,
+         options.bit1, options.bit0, timing_profiles[options.profile].name, options.jitter);
+  printf("Packets queued:      %u\n", options.packets);
+  printf("Packets started:     %llu\n", static_cast<unsigned long long>(sim_track.packets_started));
+  printf("Half bits:           %llu\n", static_cast<unsigned long long>(sim_track.half_bits));
+  printf("Phase errors:        %llu\n", static_cast<unsigned long long>(sim_track.phase_errors));
+  printf("Speed calls:         %llu\n", static_cast<unsigned long long>(sim_decoder.speed_calls));
+  printf("Function packets:    %zu sent, %zu executed in order, %zu lost\n", expected.size(), matched, lost);
+  printf("Track time:          %.3f s\n", static_cast<double>(track_us) / 1e6);
+  printf("Host time:           %.3f s, %.0f packets/s, %.0fx real time\n", seconds,
+         seconds > 0.0 ? options.packets / seconds : 0.0,
+         seconds > 0.0 ? static_cast<double>(track_us) / 1e6 / seconds : 0.0);
+
+  return (lost || sim_track.phase_errors) ? 1 : 0;
+}
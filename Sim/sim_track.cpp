@@ -0,0 +1,58 @@
+// Hardware hooks of CommandStation and Decoder for the host simulation
+//
+// The firmware implements these in command_station.cpp and decoder.cpp on top
+// of HAL and ThreadX. Here the track outputs only record the level, the
+// decoder callbacks log what was executed and the CV accessors match the
+// firmware's.
+
+#include "command_station.hpp"
+#include "decoder.hpp"
+#include "sim_track.hpp"
+
+SimTrack sim_track;
+SimDecoder sim_decoder;
+
+void CommandStation::trackOutputs(bool N, bool P, bool first_bit) {
+  (void)N;
+  if (sim_track.half_bits && P == sim_track.p) sim_track.phase_errors++;
+  sim_track.p = P;
+  sim_track.half_bits++;
+  if (P && first_bit) sim_track.packets_started++;
+}
+
+void CommandStation::biDiStart() { sim_track.bidi_cutouts++; }
+
+void CommandStation::biDiChannel1() {}
+
+void CommandStation::biDiChannel2() {}
+
+void CommandStation::biDiEnd() {}
+
+void Decoder::direction(uint16_t addr, bool dir) {}
+
+void Decoder::speed(uint16_t addr, int32_t speed) { sim_decoder.speed_calls++; }
+
+void Decoder::function(uint16_t addr, uint32_t mask, uint32_t state) {
+  sim_decoder.function_calls++;
+  if ((mask & 0b1'1111u) == 0b1'1111u) sim_decoder.function_states.push_back(state & 0b1'1111u);
+}
+
+void Decoder::serviceModeHook(bool service_mode) {}
+
+void Decoder::serviceAck() {}
+
+void Decoder::transmitBiDi(std::span<uint8_t const> bytes) {}
+
+uint8_t Decoder::readCv(uint32_t cv_addr, uint8_t) {
+  if (cv_addr >= size(_cvs)) return 0u;
+  return _cvs[cv_addr];
+}
+
+uint8_t Decoder::writeCv(uint32_t cv_addr, uint8_t byte) {
+  if (cv_addr >= size(_cvs)) return 0u;
+  return _cvs[cv_addr] = byte;
+}
+
+bool Decoder::readCv(uint32_t cv_addr, bool, uint32_t pos) { return false; }
+
+bool Decoder::writeCv(uint32_t cv_addr, bool bit, uint32_t pos) { return false; }
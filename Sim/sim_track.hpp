@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// What the command station hooks saw, in place of the track output pins
+struct SimTrack {
+  bool p = false;                  // level of the half bit that has just started
+  uint64_t half_bits = 0;
+  uint64_t packets_started = 0;    // first bit of a packet written
+  uint64_t phase_errors = 0;       // P not alternating between half bits
+  uint64_t bidi_cutouts = 0;
+};
+
+// Commands the decoder executed
+struct SimDecoder {
+  uint64_t speed_calls = 0;
+  uint64_t function_calls = 0;
+  std::vector<uint32_t> function_states;  // F0-F4 of every function call, F0 in bit 0
+};
+
+extern SimTrack sim_track;
+extern SimDecoder sim_decoder;
@@ -22,7 +22,7 @@
 #include "app_usbx_device.h"
 /* Private includes ----------------------------------------------------------*/
 /* USER CODE BEGIN Includes */
-
+#include "usb_capture.h"
 /* USER CODE END Includes */
 
 /* Private typedef -----------------------------------------------------------*/
@@ -50,7 +50,6 @@ extern PCD_HandleTypeDef           hpcd_USB_DRD_FS;
 
 /* USER CODE BEGIN PV */
 TX_QUEUE ux_app_MsgQueue;
-TX_QUEUE rpc_rxqueue;
 static TX_THREAD ux_cdc_read_thread;
 
 TX_EVENT_FLAGS_GROUP EventFlag;
@@ -59,6 +58,10 @@ TX_EVENT_FLAGS_GROUP EventFlag;
 #endif /* defined ( __ICCARM__ ) */
 __ALIGN_BEGIN USB_MODE_STATE USB_Device_State_Msg __ALIGN_END;
 extern PCD_HandleTypeDef hpcd_USB_DRD_FS;
+
+/* Second CDC ACM function, the capture stream */
+static ULONG capture_interface_number;
+static UX_SLAVE_CLASS_CDC_ACM_PARAMETER capture_parameter;
 /* USER CODE END PV */
 
 /* Private function prototypes -----------------------------------------------*/
@@ -122,23 +125,6 @@ UINT MX_USBX_Device_Init(VOID *memory_ptr)
   {
     return TX_QUEUE_ERROR;
   }
-
-  if (tx_byte_allocate(byte_pool,
-                       (VOID **) &pointer,
-                       APP_QUEUE_SIZE * sizeof(ULONG),
-                       TX_NO_WAIT) != TX_SUCCESS)
-  {
-    return TX_POOL_ERROR;
-  }
-
-  if (tx_queue_create(&rpc_rxqueue,
-                      "RPC RX Queue",
-                      TX_1_ULONG,
-                      pointer,
-                      APP_QUEUE_SIZE * sizeof(ULONG)) != TX_SUCCESS)
-  {
-    return TX_QUEUE_ERROR;
-  }
   /* USER CODE END MX_USBX_Device_Init 1 */
 
   /* Allocate the stack for device application main thread */
@@ -254,6 +240,22 @@ UINT MX_USBX_Device_Stack_Init(void)
 
   /* USER CODE BEGIN MX_USBX_Device_Stack_Init 1 */
 
+  /* Capture stream, the host side sets no line coding that matters */
+  capture_parameter.ux_slave_class_cdc_acm_instance_activate   = usb_capture_activate;
+  capture_parameter.ux_slave_class_cdc_acm_instance_deactivate = usb_capture_deactivate;
+  capture_parameter.ux_slave_class_cdc_acm_parameter_change    = UX_NULL;
+
+  capture_interface_number = USBD_Get_Interface_Number(CLASS_TYPE_CDC_CAPTURE, 0);
+
+  if (ux_device_stack_class_register(_ux_system_slave_class_cdc_acm_name,
+                                     ux_device_class_cdc_acm_entry,
+                                     cdc_acm_configuration_number,
+                                     capture_interface_number,
+                                     &capture_parameter) != UX_SUCCESS)
+  {
+    return UX_ERROR;
+  }
+
   /* USER CODE END MX_USBX_Device_Stack_Init 1 */
 
   return ret;
@@ -327,6 +329,12 @@ UINT MX_USBX_Device_Stack_DeInit(void)
   UINT ret = UX_SUCCESS;
 
   /* USER CODE BEGIN MX_USBX_Device_Stack_DeInit_PreTreatment_0 */
+  /* Both functions are instances of the CDC ACM class, this takes the first */
+  if (ux_device_stack_class_unregister(_ux_system_slave_class_cdc_acm_name,
+                                       ux_device_class_cdc_acm_entry) != UX_SUCCESS)
+  {
+    return UX_ERROR;
+  }
   /* USER CODE END MX_USBX_Device_Stack_DeInit_PreTreatment_0 */
 
   /* Unregister USB device controller. */
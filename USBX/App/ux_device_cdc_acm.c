@@ -23,8 +23,12 @@
 
 /* Private includes ----------------------------------------------------------*/
 /* USER CODE BEGIN Includes */
+#include <stdbool.h>
 #include <string.h>
 #include "usbx_cdc_transport.h"
+#include "rpc_binary.h"
+#include "rpc_bus.h"
+#include "boot.h"
 
 /* USER CODE END Includes */
 
@@ -36,6 +40,15 @@
 /* Private define ------------------------------------------------------------*/
 /* USER CODE BEGIN PD */
 
+/* How long a complete frame waits for the RPC thread to return a buffer. While
+   waiting no USB data is read, so the host is held off instead of losing requests */
+#define RX_FREE_WAIT_MS  100
+
+/* The read thread keeps one buffer, the others may all be waiting on the command bus */
+#if (RX_POOL_SIZE - 1) > RPC_BUS_USB_REQUESTS
+#error "the command bus must hold every buffer the read thread can hand out"
+#endif
+
 /* USER CODE END PD */
 
 /* Private macro -------------------------------------------------------------*/
@@ -51,14 +64,16 @@
 
 UX_SLAVE_CLASS_CDC_ACM  *cdc_acm;
 
-int current_buf;
-ULONG rx_index;
-/* Buffer pool defined here */
-rpc_rxbuffer_t buffer_pool[RX_POOL_SIZE];
+/* Receive buffers, owned either by the read thread, the RPC thread or the free list */
+static rpc_rxbuffer_t buffer_pool[RX_POOL_SIZE];
+static ULONG rx_index;                    /* bytes in the buffer being filled */
+static ULONG rx_scan;                     /* bytes already searched for CRLF */
+static TX_QUEUE rpc_rxfree;
+static ULONG rx_free_storage[RX_POOL_SIZE];
+static bool rx_free_created = false;
+static UsbCdcRxStats_t rx_stats;
 
 extern TX_EVENT_FLAGS_GROUP EventFlag;
-/* External queue declared elsewhere */
-extern TX_QUEUE rpc_rxqueue;
 
 UX_SLAVE_CLASS_CDC_ACM_LINE_CODING_PARAMETER CDC_VCP_LineCoding =
 {
@@ -92,6 +107,7 @@ VOID USBD_CDC_ACM_Activate(VOID *cdc_acm_instance)
 
   /* Save the CDC instance */
   cdc_acm = (UX_SLAVE_CLASS_CDC_ACM*) cdc_acm_instance;
+  boot_event(BOOT_EVENT_USB_ACTIVE);
 
   /* Set device class_cdc_acm with default parameters */
   if (ux_device_class_cdc_acm_ioctl(cdc_acm, UX_SLAVE_CLASS_CDC_ACM_IOCTL_SET_LINE_CODING,
@@ -119,6 +135,9 @@ VOID USBD_CDC_ACM_Deactivate(VOID *cdc_acm_instance)
   /* Reset the cdc acm instance */
   cdc_acm = UX_NULL;
 
+  /* Binary framing is negotiated per session */
+  RpcBinary_SetEnabled(false);
+
   /* USER CODE END USBD_CDC_ACM_Deactivate */
 
   return;
@@ -236,8 +255,112 @@ void UsbCdcAcm_GetStatus(uint32_t* device_configured, uint32_t* cdc_active)
   }
 }
 
+/**
+  * @brief  Take a free receive buffer, waiting up to RX_FREE_WAIT_MS
+  * @retval Buffer, UX_NULL if the RPC thread still holds all of them
+  */
+static rpc_rxbuffer_t *rx_buffer_take(void)
+{
+  rpc_rxbuffer_t *buf = UX_NULL;
+
+  if (tx_queue_receive(&rpc_rxfree, &buf, TX_NO_WAIT) == TX_SUCCESS)
+  {
+    return buf;
+  }
+  rx_stats.stalls++;
+  if (tx_queue_receive(&rpc_rxfree, &buf, MS_TO_TICK(RX_FREE_WAIT_MS)) == TX_SUCCESS)
+  {
+    return buf;
+  }
+  return UX_NULL;
+}
+
+/**
+  * @brief  Return a buffer posted on the command bus
+  * @param  buf: Buffer taken from the command bus
+  * @retval none
+  */
+void UsbCdcAcm_ReleaseRx(rpc_rxbuffer_t *buf)
+{
+  if (buf != UX_NULL)
+  {
+    tx_queue_send(&rpc_rxfree, &buf, TX_NO_WAIT);
+  }
+}
+
+void UsbCdcAcm_GetRxStats(UsbCdcRxStats_t *stats)
+{
+  ULONG enqueued = 0;
+
+  if (stats == UX_NULL)
+  {
+    return;
+  }
+  *stats = rx_stats;
+  if (rx_free_created)
+  {
+    tx_queue_info_get(&rpc_rxfree, UX_NULL, &enqueued, UX_NULL, UX_NULL, UX_NULL, UX_NULL);
+  }
+  stats->free_buffers = (uint32_t)enqueued;
+}
+
+/**
+  * @brief  Find the end of the frame at the start of buf
+  * @param  buf: Buffer being filled, rx_index bytes valid
+  * @retval Frame length including its terminator, 0 if incomplete
+  */
+static ULONG rx_frame_end(rpc_rxbuffer_t *buf)
+{
+  if (rpc_binary_enabled && (rx_index > 0) && ((uint8_t)buf->data[0] == RPC_BIN_SOF))
+  {
+    for (;;)
+    {
+      int32_t frame_length = rpc_bin_frame_length((const uint8_t *)buf->data, rx_index);
+      if (frame_length > 0)
+      {
+        buf->length = (uint16_t)frame_length;
+        buf->type = RPC_FRAME_BINARY;
+        return (ULONG)frame_length;
+      }
+      if (frame_length == 0)
+      {
+        return 0;  /* wait for the rest of the frame */
+      }
+      /* Not a valid header, drop the SOF byte and resynchronise */
+      rx_stats.resyncs++;
+      memmove(buf->data, &buf->data[1], rx_index - 1);
+      rx_index--;
+      rx_scan = 0;
+      if ((rx_index == 0) || ((uint8_t)buf->data[0] != RPC_BIN_SOF))
+      {
+        break;
+      }
+    }
+  }
+
+  /* Only bytes received since the last scan are searched for CRLF */
+  for (ULONG i = (rx_scan > 1) ? rx_scan : 1; i < rx_index; i++)
+  {
+    if (buf->data[i-1] == '\r' && buf->data[i] == '\n')
+    {
+      /* Strip CRLF, length excludes it */
+      buf->data[i-1] = '\0';
+      buf->data[i] = '\0';
+      buf->length = (uint16_t)(i - 1);
+      buf->type = RPC_FRAME_JSON;
+      return i + 1;
+    }
+  }
+  rx_scan = rx_index;
+  return 0;
+}
+
 /**
   * @brief  USBX CDC ACM RX thread entry
+  *         Bytes are read straight into a buffer owned by this thread. A complete
+  *         frame is handed to the RPC thread together with its buffer, which comes
+  *         back through UsbCdcAcm_ReleaseRx. Only bytes received after the frame
+  *         are copied into the next buffer.
   * @param  thread_input: Not used
   * @retval none
   */
@@ -245,66 +368,90 @@ VOID usbx_cdc_acm_read_thread_entry(ULONG thread_input)
 {
     ULONG actual_length;
     UX_SLAVE_DEVICE *device = &_ux_system_slave->ux_system_slave_device;
+    rpc_rxbuffer_t *buf;
+
+    UX_PARAMETER_NOT_USED(thread_input);
+
+    if (tx_queue_create(&rpc_rxfree, "RPC RX Free", TX_1_ULONG, rx_free_storage, sizeof(rx_free_storage)) != TX_SUCCESS)
+    {
+      Error_Handler();
+    }
+    rx_free_created = true;
+    for (int i = 1; i < RX_POOL_SIZE; i++)
+    {
+      UsbCdcAcm_ReleaseRx(&buffer_pool[i]);
+    }
+    buf = &buffer_pool[0];
 
     while (1)
     {
-      if ((device->ux_slave_device_state == UX_DEVICE_CONFIGURED) && (cdc_acm != UX_NULL))
+      if ((device->ux_slave_device_state != UX_DEVICE_CONFIGURED) || (cdc_acm == UX_NULL))
+      {
+        tx_thread_sleep(MS_TO_TICK(10));
+        continue;
+      }
+
+      /* Blocking read from USB CDC ACM */
+      ux_device_class_cdc_acm_read(
+          cdc_acm,
+          (UCHAR*)&buf->data[rx_index],
+          RX_BUFFER_SIZE - rx_index - 1,
+          &actual_length
+      );
+
+      if (actual_length == 0)
+      {
+        continue;
+      }
+      rx_index += actual_length;
+      buf->data[rx_index] = '\0';
+
+      /* Extract complete messages: binary frames (once negotiated) or CRLF terminated JSON */
+      for (;;)
       {
-        /* Blocking read from USB CDC ACM */
-        ux_device_class_cdc_acm_read(
-            cdc_acm,
-            (UCHAR*)&buffer_pool[current_buf].data[rx_index],
-            RX_BUFFER_SIZE - rx_index - 1,
-            &actual_length
-        );
-
-        if (actual_length > 0)
+        ULONG consumed = rx_frame_end(buf);
+        if (consumed == 0)
         {
-            rx_index += actual_length;
-            buffer_pool[current_buf].data[rx_index] = '\0';
-
-            /* Scan for CRLF terminators */
-            for (uint16_t i = 1; i < rx_index; i++)
-            {
-                if (buffer_pool[current_buf].data[i-1] == '\r' &&
-                    buffer_pool[current_buf].data[i]   == '\n')
-                {
-                    /* Strip CRLF */
-                    buffer_pool[current_buf].data[i-1] = '\0';
-                    buffer_pool[current_buf].data[i] = '\0';
-
-                    /* Length excludes CRLF */
-                    buffer_pool[current_buf].length = i-1;
-
-                    rpc_rxbuffer_t *msg = &buffer_pool[current_buf];
-                    tx_queue_send(&rpc_rxqueue, &msg, TX_NO_WAIT);
-
-                    /* Switch to next buffer */
-                    current_buf = (current_buf + 1) % RX_POOL_SIZE;
-                    ULONG remaining = rx_index - (i+1);
-                    if (remaining > 0)
-                    {
-                        memcpy(buffer_pool[current_buf].data,
-                              &buffer_pool[(current_buf-1+RX_POOL_SIZE)%RX_POOL_SIZE].data[i+1],
-                              remaining);
-                        rx_index = remaining;
-                    }
-                    else
-                    {
-                        rx_index = 0;
-                    }
-
-                    i = 0; // restart scan
-                }
-            }
-
-            if (rx_index >= RX_BUFFER_SIZE-1)
-            {
-                rx_index = 0; // overflow protection
-            }
+          break;
         }
+
+        ULONG remaining = rx_index - consumed;
+        rpc_rxbuffer_t *next = rx_buffer_take();
+        if (next == UX_NULL)
+        {
+          /* The RPC thread is stuck, drop this frame and keep the buffer */
+          rx_stats.dropped++;
+          memmove(buf->data, &buf->data[consumed], remaining);
+        }
+        else
+        {
+          if (remaining > 0)
+          {
+            memcpy(next->data, &buf->data[consumed], remaining);
+          }
+          if (RpcBus_Post(RPC_ORIGIN_USB, buf, buf->data, buf->length, buf->type))
+          {
+            rx_stats.frames++;
+          }
+          else
+          {
+            rx_stats.dropped++;
+            UsbCdcAcm_ReleaseRx(buf);
+          }
+          buf = next;
+        }
+        rx_index = remaining;
+        rx_scan = 0;
+        buf->data[rx_index] = '\0';
+      }
+
+      if (rx_index >= RX_BUFFER_SIZE-1)
+      {
+        /* No terminator in a full buffer, discard it */
+        rx_stats.overflows++;
+        rx_index = 0;
+        rx_scan = 0;
       }
-      tx_thread_sleep(MS_TO_TICK(10));
     }
 }
 
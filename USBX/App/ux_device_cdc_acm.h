@@ -44,7 +44,7 @@ extern "C" {
 /* Exported constants --------------------------------------------------------*/
 /* USER CODE BEGIN EC */
 
-#define RX_POOL_SIZE    4
+#define RX_POOL_SIZE    6
 /* USER CODE END EC */
 
 /* Exported macro ------------------------------------------------------------*/
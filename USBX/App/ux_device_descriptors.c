@@ -146,6 +146,9 @@ uint8_t *USBD_Get_Device_Framework_Speed(uint8_t Speed, ULONG *Length)
   uint8_t *pFrameWork = NULL;
   /* USER CODE BEGIN Device_Framework0 */
 
+  /* The capture stream follows the RPC function */
+  UserClassInstance[1] = CLASS_TYPE_CDC_CAPTURE;
+
   /* USER CODE END Device_Framework0 */
 
   if (USBD_FULL_SPEED == Speed)
@@ -500,6 +503,30 @@ uint8_t  USBD_FrameWork_AddToConfDesc(USBD_DevClassHandleTypeDef *pdev, uint8_t
 
   /* USER CODE BEGIN FrameWork_AddToConfDesc_0 */
 
+#if USBD_CDC_ACM_CLASS_ACTIVATED == 1
+  /* Capture function, never the first class so the configuration descriptor exists */
+  if (pdev->tclasslist[pdev->classId].ClassType == CLASS_TYPE_CDC_CAPTURE)
+  {
+    pdev->Speed = Speed;
+
+    interface = USBD_FrameWork_FindFreeIFNbr(pdev);
+    pdev->tclasslist[pdev->classId].NumIf = 2U;
+    pdev->tclasslist[pdev->classId].Ifs[0] = interface;
+    pdev->tclasslist[pdev->classId].Ifs[1] = (uint8_t)(interface + 1U);
+    pdev->tclasslist[pdev->classId].NumEps = 3U;  /* EP_IN, EP_OUT, CMD_EP */
+
+    USBD_FrameWork_AssignEp(pdev, USBD_CAPTURE_EPOUT_ADDR, USBD_EP_TYPE_BULK,
+                            (Speed == USBD_HIGH_SPEED) ? USBD_CDCACM_EPOUT_HS_MPS : USBD_CDCACM_EPOUT_FS_MPS);
+    USBD_FrameWork_AssignEp(pdev, USBD_CAPTURE_EPIN_ADDR, USBD_EP_TYPE_BULK,
+                            (Speed == USBD_HIGH_SPEED) ? USBD_CDCACM_EPIN_HS_MPS : USBD_CDCACM_EPIN_FS_MPS);
+    USBD_FrameWork_AssignEp(pdev, USBD_CAPTURE_EPINCMD_ADDR, USBD_EP_TYPE_INTR,
+                            (Speed == USBD_HIGH_SPEED) ? USBD_CDCACM_EPINCMD_HS_MPS : USBD_CDCACM_EPINCMD_FS_MPS);
+
+    USBD_FrameWork_CDCDesc(pdev, (uint32_t)pCmpstConfDesc, &pdev->CurrConfDescSz);
+    return UX_SUCCESS;
+  }
+#endif /* USBD_CDC_ACM_CLASS_ACTIVATED == 1 */
+
   /* USER CODE END FrameWork_AddToConfDesc_0 */
 
   /* The USB drivers do not set the speed value, so set it here before starting */
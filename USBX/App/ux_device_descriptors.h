@@ -258,6 +258,13 @@ uint16_t USBD_Get_Configuration_Number(uint8_t class_type, uint8_t interface_typ
 /* Private defines -----------------------------------------------------------*/
 /* USER CODE BEGIN Private_defines */
 
+/* Second CDC ACM function, a binary stream of capture data (usb_capture.c).
+   Same descriptors as the RPC function, endpoints of its own */
+#define CLASS_TYPE_CDC_CAPTURE                        ((USBD_CompositeClassTypeDef)13)
+#define USBD_CAPTURE_EPINCMD_ADDR                     0x84U
+#define USBD_CAPTURE_EPIN_ADDR                        0x85U
+#define USBD_CAPTURE_EPOUT_ADDR                       0x06U
+
 /* USER CODE END Private_defines */
 
 #define USBD_VID                                      1155
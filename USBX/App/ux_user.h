@@ -166,7 +166,7 @@
 /* Defined, this value is the maximum number of classes in the device stack that can be loaded by
    USBX.  */
 
-#define UX_MAX_SLAVE_CLASS_DRIVER    1
+#define UX_MAX_SLAVE_CLASS_DRIVER    2
 
 /* Defined, this value represents the number of different host controllers available in the system.
    For USB 1.1 support, this value will usually be 1. For USB 2.0 support, this value can be more
@@ -185,7 +185,7 @@
 
 /* Defined, this value is the maximum number of interfaces in the device framework.  */
 
-#define UX_MAX_SLAVE_INTERFACES       2
+#define UX_MAX_SLAVE_INTERFACES       4
 
 /* Defined, this value represents the current number of SCSI logical units represented in the device
    storage class driver.  */
@@ -597,11 +597,11 @@
 
 /* it define USBX device max number of endpoints (1~n). */
 
-#define UX_MAX_DEVICE_ENDPOINTS              4
+#define UX_MAX_DEVICE_ENDPOINTS              7
 
 /* it define USBX device max number of interfacess (1~n). */
 
-#define UX_MAX_DEVICE_INTERFACES             2
+#define UX_MAX_DEVICE_INTERFACES             4
 
 /* Define USBX max root hub port (1 ~ n).  */
 